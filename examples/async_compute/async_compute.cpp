@@ -28,44 +28,172 @@
 #include <donut/core/vfs/VFS.h>
 #include <nvrhi/utils.h>
 
-#include <queue>
+#include "FrameProfiler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
 #include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
 
 
 using namespace donut;
 
 static const char* g_WindowTitle = "Donut Example: Async Compute";
 
-class TextureQueue
+// A bounded single-producer, single-consumer ring of textures, each with the command list instance that used it last.
+// TryPush and TryPop are lock-free. The blocking Push and Pop only take the mutex when they actually need to sleep,
+// and the other side only takes it to wake up a sleeping thread. The time spent sleeping is recorded for statistics.
+class TextureRing
 {
 private:
-    std::queue<std::pair<nvrhi::TextureHandle, uint64_t>> m_Queue;
+    struct Slot
+    {
+        nvrhi::TextureHandle texture;
+        uint64_t lastUse = 0;
+    };
+
+    std::vector<Slot> m_Slots;
+
+    // Monotonic counters, the slot index is (counter % capacity).
+    // Keep them on separate cache lines so that the producer and consumer don't invalidate each other's writes.
+    alignas(64) std::atomic<size_t> m_Head = 0; // Written by the consumer
+    alignas(64) std::atomic<size_t> m_Tail = 0; // Written by the producer
+
     std::mutex m_Mutex;
+    std::condition_variable m_Event;
+    std::atomic_bool m_ConsumerWaiting = false;
+    std::atomic_bool m_ProducerWaiting = false;
+    std::atomic_bool m_Canceled = false;
+
+    std::atomic<uint64_t> m_ProducerStallNanoseconds = 0;
+    std::atomic<uint64_t> m_ConsumerStallNanoseconds = 0;
+
+    using clock = std::chrono::steady_clock;
+
+    void WakeUp(std::atomic_bool& waiting)
+    {
+        if (waiting)
+        {
+            std::lock_guard lock(m_Mutex);
+            m_Event.notify_all();
+        }
+    }
+
+    template<typename Predicate>
+    void Wait(std::atomic_bool& waiting, std::atomic<uint64_t>* stallNanoseconds, Predicate ready)
+    {
+        clock::time_point startTime = clock::now();
+        {
+            std::unique_lock lock(m_Mutex);
+            waiting = true;
+            m_Event.wait(lock, [this, &ready]() { return m_Canceled || ready(); });
+            waiting = false;
+        }
+        if (stallNanoseconds)
+            *stallNanoseconds += uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - startTime).count());
+    }
 
 public:
+    explicit TextureRing(size_t capacity)
+        : m_Slots(capacity)
+    {
+        assert(capacity > 0);
+    }
+
+    [[nodiscard]] size_t GetCapacity() const { return m_Slots.size(); }
+    [[nodiscard]] bool IsEmpty() const { return m_Head == m_Tail; }
+    [[nodiscard]] bool IsFull() const { return m_Tail - m_Head == m_Slots.size(); }
+
+    // Producer side
+    bool TryPush(nvrhi::TextureHandle&& texture, uint64_t lastUse)
+    {
+        const size_t tail = m_Tail.load(std::memory_order_relaxed);
+        if (tail - m_Head.load(std::memory_order_acquire) == m_Slots.size())
+            return false;
+
+        Slot& slot = m_Slots[tail % m_Slots.size()];
+        slot.texture = std::move(texture);
+        slot.lastUse = lastUse;
+
+        // Sequentially consistent with the 'waiting' flag check in WakeUp, so a sleeping consumer can't be missed
+        m_Tail = tail + 1;
+        WakeUp(m_ConsumerWaiting);
+
+        return true;
+    }
+
+    // Blocks while the ring is full. Returns false if the ring was canceled.
+    bool Push(nvrhi::TextureHandle&& texture, uint64_t lastUse)
+    {
+        while (!TryPush(std::move(texture), lastUse))
+        {
+            if (m_Canceled)
+                return false;
+
+            Wait(m_ProducerWaiting, &m_ProducerStallNanoseconds, [this]() { return !IsFull(); });
+        }
 
-    void Push(nvrhi::TextureHandle&& texture, uint64_t lastUse)
+        return true;
+    }
+
+    // Blocks until the consumer has taken everything from the ring. Used for pacing, so it isn't counted as a stall.
+    // Returns false if the ring was canceled.
+    bool WaitUntilEmpty()
     {
-	    std::lock_guard lock(m_Mutex);
-        m_Queue.emplace(std::move(texture), lastUse);
+        if (!IsEmpty() && !m_Canceled)
+            Wait(m_ProducerWaiting, nullptr, [this]() { return IsEmpty(); });
+
+        return !m_Canceled;
     }
 
+    // Consumer side
     bool TryPop(nvrhi::TextureHandle& outTexture, uint64_t& outLastUse)
     {
-	    std::lock_guard lock(m_Mutex);
+        const size_t head = m_Head.load(std::memory_order_relaxed);
+        if (head == m_Tail.load(std::memory_order_acquire))
+            return false;
 
-	    if (m_Queue.empty())
-			return false;
+        Slot& slot = m_Slots[head % m_Slots.size()];
+        outTexture.Swap(slot.texture);
+        outLastUse = slot.lastUse;
+        slot.texture = nullptr;
 
-        auto& [texture, lastUse] = m_Queue.front();
-        outTexture.Swap(texture);
-        outLastUse = lastUse;
+        m_Head = head + 1;
+        WakeUp(m_ProducerWaiting);
 
-        m_Queue.pop();
+        return true;
+    }
+
+    // Blocks while the ring is empty. Returns false if the ring was canceled.
+    bool Pop(nvrhi::TextureHandle& outTexture, uint64_t& outLastUse)
+    {
+        while (!TryPop(outTexture, outLastUse))
+        {
+            if (m_Canceled)
+                return false;
+
+            Wait(m_ConsumerWaiting, &m_ConsumerStallNanoseconds, [this]() { return !IsEmpty(); });
+        }
 
         return true;
     }
 
+    // Wakes up and fails all current and future blocking calls
+    void Cancel()
+    {
+        m_Canceled = true;
+
+        std::lock_guard lock(m_Mutex);
+        m_Event.notify_all();
+    }
+
+    [[nodiscard]] uint64_t GetProducerStallNanoseconds() const { return m_ProducerStallNanoseconds; }
+    [[nodiscard]] uint64_t GetConsumerStallNanoseconds() const { return m_ConsumerStallNanoseconds; }
 };
 
 class AsyncCompute : public app::IRenderPass
@@ -92,20 +220,59 @@ private:
     std::thread m_ComputeThread;
     std::atomic_bool m_Terminate = false;
 
-    TextureQueue m_RenderToComputeQueue;
-    TextureQueue m_ComputeToRenderQueue;
+    std::unique_ptr<FrameProfiler> m_Profiler;
+
+    // Every texture is always either in one of the rings, owned by the compute thread, or displayed by the render thread.
+    // Both rings can hold all of the textures, so pushing into them never blocks.
+    size_t m_NumTextures;
+    TextureRing m_RenderToComputeQueue;
+    TextureRing m_ComputeToRenderQueue;
 
     nvrhi::TextureHandle m_CurrentRenderTexture;
     nvrhi::SamplerHandle m_Sampler;
     uint64_t m_LastRenderTextureUse = 0;
 
+    // Scheduling of the compute thread.
+    // In the fixed mode, it produces results at c_FixedComputeInterval no matter how fast they are consumed.
+    // In the adaptive mode, it produces one result per rendered frame and times the submission so that the result
+    // completes just before the render thread picks it up, using the measured frame interval and compute GPU time.
+    std::atomic_bool m_AdaptiveScheduling = false;
+    std::atomic<int64_t> m_LastRenderFrameTime = 0; // steady_clock, nanoseconds
+    std::atomic<int64_t> m_RenderFrameInterval = 0; // Moving average, nanoseconds
+    std::atomic<int64_t> m_ComputeGpuTime = 0;      // Moving average, nanoseconds
+
+    // With the latest-only policy, the render thread skips to the newest result and returns the stale ones unseen
+    bool m_LatestOnly = false;
+    uint64_t m_DroppedResults = 0;
+
+    static constexpr std::chrono::microseconds c_FixedComputeInterval{ 10000 }; // 100Hz
+    static constexpr size_t c_NumComputeTimerQueries = 4;
+
+    // Stall statistics for the window title, updated once per second
+    float m_StatisticsTime = 0.f;
+    uint64_t m_LastDroppedResults = 0;
+    uint64_t m_LastComputeStallNanoseconds = 0;
+    uint64_t m_LastRenderStallNanoseconds = 0;
+    std::string m_StatisticsText;
+
 public:
-    using IRenderPass::IRenderPass;
+    AsyncCompute(app::DeviceManager* deviceManager, size_t numTextures, bool adaptiveScheduling, bool latestOnly)
+        : IRenderPass(deviceManager)
+        , m_NumTextures(numTextures)
+        , m_RenderToComputeQueue(numTextures)
+        , m_ComputeToRenderQueue(numTextures)
+        , m_AdaptiveScheduling(adaptiveScheduling)
+        , m_LatestOnly(latestOnly)
+    { }
 
     ~AsyncCompute() override
     {
         m_Terminate = true;
-	    m_ComputeThread.join();
+        m_RenderToComputeQueue.Cancel();
+        m_ComputeToRenderQueue.Cancel();
+
+        if (m_ComputeThread.joinable())
+	        m_ComputeThread.join();
     }
 
     bool Init()
@@ -126,6 +293,9 @@ public:
 
         m_Sampler = GetDevice()->createSampler({});
 
+        m_Profiler = std::make_unique<FrameProfiler>(GetDevice(), app::GetDirectoryWithExecutable() / "async_compute_trace.json");
+        m_Profiler->SetThreadName("Render thread");
+
         {
 	        nvrhi::BindingLayoutDesc layoutDesc;
             layoutDesc
@@ -170,10 +340,9 @@ public:
     		.setIsUAV(true)
     		.enableAutomaticStateTracking(nvrhi::ResourceStates::ShaderResource);
 
-        constexpr size_t NumTextures = 2;
-        for (size_t i = 0; i < NumTextures; i++)
+        for (size_t i = 0; i < m_NumTextures; i++)
         {
-	        m_RenderToComputeQueue.Push(GetDevice()->createTexture(texDesc), 0);
+	        m_RenderToComputeQueue.TryPush(GetDevice()->createTexture(texDesc), 0);
         }
 
         m_ComputeThread = std::thread([this](){ this->AsyncThreadProc(); });
@@ -181,6 +350,8 @@ public:
         return true;
     }
 
+    FrameProfiler& GetProfiler() const { return *m_Profiler; }
+
     void BackBufferResizing() override
     { 
         m_GraphicsPipeline = nullptr;
@@ -188,11 +359,57 @@ public:
 
     void Animate(float fElapsedTimeSeconds) override
     {
-        GetDeviceManager()->SetInformativeWindowTitle(g_WindowTitle);
+        m_StatisticsTime += fElapsedTimeSeconds;
+        if (m_StatisticsTime >= 1.f || m_StatisticsText.empty())
+        {
+            // The compute thread waits for textures to render into, and for space to return them to the render thread.
+            // The render thread only waits when returning a texture to the compute thread.
+            const uint64_t computeStall = m_RenderToComputeQueue.GetConsumerStallNanoseconds() + m_ComputeToRenderQueue.GetProducerStallNanoseconds();
+            const uint64_t renderStall = m_RenderToComputeQueue.GetProducerStallNanoseconds();
+
+            const float scale = (m_StatisticsTime > 0.f) ? 1e-6f / m_StatisticsTime : 0.f;
+            char text[256];
+            snprintf(text, sizeof(text), "- %s%s (A/L), %d textures, compute GPU %.2f ms, compute stall %.1f ms/s, render stall %.1f ms/s, dropped %.0f/s",
+                m_AdaptiveScheduling ? "adaptive" : "fixed 100 Hz",
+                m_LatestOnly ? ", latest-only" : "",
+                int(m_NumTextures),
+                float(m_ComputeGpuTime) * 1e-6f,
+                float(computeStall - m_LastComputeStallNanoseconds) * scale,
+                float(renderStall - m_LastRenderStallNanoseconds) * scale,
+                float(m_DroppedResults - m_LastDroppedResults) * scale * 1e6f);
+            m_StatisticsText = text;
+
+            m_LastComputeStallNanoseconds = computeStall;
+            m_LastRenderStallNanoseconds = renderStall;
+            m_LastDroppedResults = m_DroppedResults;
+            m_StatisticsTime = 0.f;
+        }
+
+        GetDeviceManager()->SetInformativeWindowTitle(g_WindowTitle, m_StatisticsText.c_str());
+    }
+
+    bool KeyboardUpdate(int key, int scancode, int action, int mods) override
+    {
+        if (key == GLFW_KEY_A && action == GLFW_PRESS)
+        {
+            m_AdaptiveScheduling = !m_AdaptiveScheduling;
+            return true;
+        }
+
+        if (key == GLFW_KEY_L && action == GLFW_PRESS)
+        {
+            m_LatestOnly = !m_LatestOnly;
+            return true;
+        }
+
+        return false;
     }
     
     void Render(nvrhi::IFramebuffer* framebuffer) override
     {
+        m_Profiler->BeginFrame();
+        ScopedCpuZone renderZone(*m_Profiler, "Render");
+
         if (!m_GraphicsPipeline)
         {
             nvrhi::GraphicsPipelineDesc psoDesc;
@@ -205,13 +422,39 @@ public:
             m_GraphicsPipeline = GetDevice()->createGraphicsPipeline(psoDesc, framebuffer->getFramebufferInfo());
         }
 
+        // Track the frame rate for the adaptive compute scheduling
+        const int64_t frameTime = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+        const int64_t lastFrameTime = m_LastRenderFrameTime.exchange(frameTime);
+        if (lastFrameTime != 0)
+        {
+            const int64_t interval = frameTime - lastFrameTime;
+            const int64_t averageInterval = m_RenderFrameInterval;
+            m_RenderFrameInterval = (averageInterval == 0) ? interval : averageInterval + (interval - averageInterval) / 8;
+        }
+
         nvrhi::TextureHandle newTexture;
         uint64_t newTextureLastUse;
         if (m_ComputeToRenderQueue.TryPop(newTexture, newTextureLastUse))
         {
+            if (m_LatestOnly)
+            {
+                nvrhi::TextureHandle newerTexture;
+                uint64_t newerTextureLastUse;
+                while (m_ComputeToRenderQueue.TryPop(newerTexture, newerTextureLastUse))
+                {
+                    // The stale result was never drawn, so the compute queue doesn't need to wait for the graphics queue
+                    m_RenderToComputeQueue.Push(std::move(newTexture), 0);
+                    newTexture.Swap(newerTexture);
+                    newTextureLastUse = newerTextureLastUse;
+                    ++m_DroppedResults;
+                }
+            }
+
 	        m_CurrentRenderTexture.Swap(newTexture);
             if (newTexture)
             {
+                ScopedCpuZone returnZone(*m_Profiler, "Return texture");
 				m_RenderToComputeQueue.Push(std::move(newTexture), m_LastRenderTextureUse);
             }
 
@@ -219,6 +462,7 @@ public:
         }
 
         m_DrawCommandList->open();
+        m_Profiler->BeginGpuZone(m_DrawCommandList, "Draw");
 
         nvrhi::utils::ClearColorAttachment(m_DrawCommandList, framebuffer, 0, nvrhi::Color(0.f));
 
@@ -242,31 +486,100 @@ public:
             m_DrawCommandList->draw(args);
         }
 
+        m_Profiler->EndGpuZone(m_DrawCommandList);
         m_DrawCommandList->close();
         m_LastRenderTextureUse = GetDevice()->executeCommandList(m_DrawCommandList);
     }
 
+    // Reads the finished compute timer queries and updates the moving average of the compute GPU time
+    void ResolveComputeTimerQueries(std::vector<nvrhi::TimerQueryHandle>& pendingQueries, std::vector<nvrhi::TimerQueryHandle>& freeQueries)
+    {
+        while (!pendingQueries.empty() && GetDevice()->pollTimerQuery(pendingQueries.front()))
+        {
+            const int64_t time = int64_t(GetDevice()->getTimerQueryTime(pendingQueries.front()) * 1e9f);
+            const int64_t averageTime = m_ComputeGpuTime;
+            m_ComputeGpuTime = (averageTime == 0) ? time : averageTime + (time - averageTime) / 8;
+
+            GetDevice()->resetTimerQuery(pendingQueries.front());
+            freeQueries.push_back(pendingQueries.front());
+            pendingQueries.erase(pendingQueries.begin());
+        }
+    }
+
+    // Sleeps until the adaptive schedule says it's time to start the next compute submission.
+    // Returns false if the thread should terminate.
+    bool WaitForAdaptiveSchedule()
+    {
+        // Only keep one result in flight: anything more just adds latency, because the render thread can only show one per frame
+        if (!m_ComputeToRenderQueue.WaitUntilEmpty())
+            return false;
+
+        const int64_t frameInterval = m_RenderFrameInterval;
+        const int64_t lastFrameTime = m_LastRenderFrameTime;
+        if (frameInterval <= 0 || lastFrameTime == 0)
+            return true;
+
+        // Aim to finish right before the next frame picks up the result, with some headroom for the submission itself
+        const int64_t margin = std::max<int64_t>(frameInterval / 10, 500'000);
+        const int64_t startTime = lastFrameTime + frameInterval - m_ComputeGpuTime - margin;
+
+        const std::chrono::steady_clock::time_point startTimePoint{ std::chrono::nanoseconds(startTime) };
+        if (startTimePoint > std::chrono::steady_clock::now())
+            std::this_thread::sleep_until(startTimePoint);
+
+        return true;
+    }
+
     void AsyncThreadProc()
     {
 		uint32_t counter = 0;
 
 		using clock = std::chrono::steady_clock;
-        constexpr std::chrono::microseconds intervalMicroseconds{ 10000 }; // 100Hz
+
+        m_Profiler->SetThreadName("Compute thread");
+
+        // These queries drive the scheduling and are read on this thread, the profiler zones only feed the overlay and trace
+        std::vector<nvrhi::TimerQueryHandle> freeQueries;
+        std::vector<nvrhi::TimerQueryHandle> pendingQueries;
+        for (size_t i = 0; i < c_NumComputeTimerQueries; i++)
+            freeQueries.push_back(GetDevice()->createTimerQuery());
 
 	    while (!m_Terminate)
 	    {
-			clock::time_point nextTimePoint = clock::now() + intervalMicroseconds;
+			clock::time_point nextTimePoint = clock::now() + c_FixedComputeInterval;
             m_CommandListLifetimeTracker->runGarbageCollection();
+            ResolveComputeTimerQueries(pendingQueries, freeQueries);
+
+            const bool adaptiveScheduling = m_AdaptiveScheduling;
+            if (adaptiveScheduling)
+            {
+                ScopedCpuZone scheduleZone(*m_Profiler, "Wait for schedule");
+                if (!WaitForAdaptiveSchedule())
+                    break;
+            }
 
 		    nvrhi::TextureHandle texture;
             uint64_t textureLastUse = 0;
-            while (!m_Terminate && !m_RenderToComputeQueue.TryPop(texture, textureLastUse))
-            {}
 
-            if (m_Terminate)
-				break;
+            // Sleep until the render thread returns a texture, the GPU side of the handoff is a queue wait below
+            {
+                ScopedCpuZone waitZone(*m_Profiler, "Wait for texture");
+                if (!m_RenderToComputeQueue.Pop(texture, textureLastUse) || m_Terminate)
+                    break;
+            }
 
+            m_Profiler->BeginCpuZone("Submit compute");
             m_ComputeCommandList->open();
+            m_Profiler->BeginGpuZone(m_ComputeCommandList, "Compute");
+
+            // Skip the measurement when all queries are still in flight
+            nvrhi::TimerQueryHandle timerQuery;
+            if (!freeQueries.empty())
+            {
+                timerQuery = freeQueries.back();
+                freeQueries.pop_back();
+                m_ComputeCommandList->beginTimerQuery(timerQuery);
+            }
 
             nvrhi::BindingSetDesc bindingDesc;
             bindingDesc.addItem(nvrhi::BindingSetItem::Texture_UAV(0, texture));
@@ -282,16 +595,30 @@ public:
 
             m_ComputeCommandList->dispatch(64, 64);
 
+            if (timerQuery)
+            {
+                m_ComputeCommandList->endTimerQuery(timerQuery);
+                pendingQueries.push_back(timerQuery);
+            }
+
+            m_Profiler->EndGpuZone(m_ComputeCommandList);
             m_ComputeCommandList->close();
 
             if (textureLastUse > 0)
 				GetDevice()->queueWaitForCommandList(nvrhi::CommandQueue::Compute, nvrhi::CommandQueue::Graphics, textureLastUse);
             textureLastUse = GetDevice()->executeCommandList(m_ComputeCommandList, nvrhi::CommandQueue::Compute);
+            m_Profiler->EndCpuZone();
 
-            m_ComputeToRenderQueue.Push(std::move(texture), textureLastUse);
+            if (!m_ComputeToRenderQueue.Push(std::move(texture), textureLastUse))
+                break;
 
             counter++;
-            std::this_thread::sleep_until(nextTimePoint);
+
+            if (!adaptiveScheduling)
+            {
+                ScopedCpuZone sleepZone(*m_Profiler, "Wait for interval");
+                std::this_thread::sleep_until(nextTimePoint);
+            }
 	    }
     }
 
@@ -313,6 +640,26 @@ int main(int __argc, const char** __argv)
     deviceParams.enableNvrhiValidationLayer = true;
 #endif
 
+    // Number of textures in flight between the render and compute threads, 3 is triple buffering
+    size_t numTextures = 3;
+    bool adaptiveScheduling = false;
+    bool latestOnly = false;
+    for (int i = 1; i < __argc; i++)
+    {
+        if (strcmp(__argv[i], "-textures") == 0 && i + 1 < __argc)
+        {
+            numTextures = size_t(std::clamp(atoi(__argv[++i]), 2, 8));
+        }
+        else if (strcmp(__argv[i], "-adaptive") == 0)
+        {
+            adaptiveScheduling = true;
+        }
+        else if (strcmp(__argv[i], "-latestOnly") == 0)
+        {
+            latestOnly = true;
+        }
+    }
+
     if (!deviceManager->CreateWindowDeviceAndSwapChain(deviceParams, g_WindowTitle))
     {
         log::fatal("Cannot initialize a graphics device with the requested parameters");
@@ -320,12 +667,23 @@ int main(int __argc, const char** __argv)
     }
     
     {
-        AsyncCompute example(deviceManager);
+        AsyncCompute example(deviceManager, numTextures, adaptiveScheduling, latestOnly);
         if (example.Init())
         {
-            deviceManager->AddRenderPassToBack(&example);
-            deviceManager->RunMessageLoop();
-            deviceManager->RemoveRenderPass(&example);
+            std::filesystem::path frameworkShaderPath = app::GetDirectoryWithExecutable() / "shaders/framework" / app::GetShaderTypeName(deviceManager->GetDevice()->getGraphicsAPI());
+            auto rootFS = std::make_shared<vfs::RootFileSystem>();
+            rootFS->mount("/shaders/donut", frameworkShaderPath);
+            auto shaderFactory = std::make_shared<engine::ShaderFactory>(deviceManager->GetDevice(), rootFS, "/shaders");
+
+            FrameProfilerUI profilerUI(deviceManager, example.GetProfiler());
+            if (profilerUI.Init(shaderFactory))
+            {
+                deviceManager->AddRenderPassToBack(&example);
+                deviceManager->AddRenderPassToBack(&profilerUI);
+                deviceManager->RunMessageLoop();
+                deviceManager->RemoveRenderPass(&profilerUI);
+                deviceManager->RemoveRenderPass(&example);
+            }
         }
     }
     
@@ -0,0 +1,261 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+#include "BlasManager.h"
+
+#include <donut/engine/SceneGraph.h>
+#include <donut/engine/SceneTypes.h>
+#include <donut/core/log.h>
+#include <nvrhi/utils.h>
+
+#include <cassert>
+
+using namespace donut;
+using namespace donut::math;
+
+BlasManager::BlasManager(nvrhi::IDevice* device)
+    : m_Device(device)
+{
+}
+
+void BlasManager::GetMeshBlasDesc(const engine::MeshInfo& mesh, bool dynamic, const OpaqueGeometryPredicate& isOpaque,
+    nvrhi::rt::AccelStructDesc& blasDesc)
+{
+    blasDesc.isTopLevel = false;
+    blasDesc.debugName = mesh.name;
+    blasDesc.bottomLevelGeometries.clear();
+
+    for (const auto& geometry : mesh.geometries)
+    {
+        nvrhi::rt::GeometryDesc geometryDesc;
+        auto& triangles = geometryDesc.geometryData.triangles;
+        triangles.indexBuffer = mesh.buffers->indexBuffer;
+        triangles.indexOffset = (mesh.indexOffset + geometry->indexOffsetInMesh) * sizeof(uint32_t);
+        triangles.indexFormat = nvrhi::Format::R32_UINT;
+        triangles.indexCount = geometry->numIndices;
+        triangles.vertexBuffer = mesh.buffers->vertexBuffer;
+        triangles.vertexOffset = (mesh.vertexOffset + geometry->vertexOffsetInMesh) * sizeof(float3) + mesh.buffers->getVertexBufferRange(engine::VertexAttribute::Position).byteOffset;
+        triangles.vertexFormat = nvrhi::Format::RGB32_FLOAT;
+        triangles.vertexStride = sizeof(float3);
+        triangles.vertexCount = geometry->numVertices;
+        geometryDesc.geometryType = nvrhi::rt::GeometryType::Triangles;
+        const bool opaque = isOpaque ? isOpaque(*geometry) : geometry->material->domain == engine::MaterialDomain::Opaque;
+        geometryDesc.flags = opaque
+            ? nvrhi::rt::GeometryFlags::Opaque
+            : nvrhi::rt::GeometryFlags::None;
+        blasDesc.bottomLevelGeometries.push_back(geometryDesc);
+    }
+
+    // Dynamic geometry is rebuilt or refitted often, so the build time matters more than the trace performance.
+    // Compaction needs a readback of the compacted size and a copy, which is not worth it for a per-frame build.
+    if (dynamic)
+        blasDesc.buildFlags = nvrhi::rt::AccelStructBuildFlags::PreferFastBuild | nvrhi::rt::AccelStructBuildFlags::AllowUpdate;
+    else
+        blasDesc.buildFlags = nvrhi::rt::AccelStructBuildFlags::PreferFastTrace | nvrhi::rt::AccelStructBuildFlags::AllowCompaction;
+}
+
+void BlasManager::CreateAccelStructs(nvrhi::ICommandList* commandList, const engine::SceneGraph& sceneGraph,
+    const DynamicMeshPredicate& isDynamic, const OpaqueGeometryPredicate& isOpaque)
+{
+    m_Entries.clear();
+    m_EntryIndices.clear();
+    m_Statistics = Statistics();
+    m_IsOpaque = isOpaque;
+
+    for (const auto& mesh : sceneGraph.GetMeshes())
+    {
+        if (mesh->isSkinPrototype)
+            continue; // skip the skinning prototypes
+
+        BlasEntry entry;
+        entry.mesh = mesh;
+        entry.dynamic = isDynamic ? isDynamic(*mesh) : false;
+
+        nvrhi::rt::AccelStructDesc blasDesc;
+        GetMeshBlasDesc(*mesh, entry.dynamic, m_IsOpaque, blasDesc);
+        mesh->accelStruct = m_Device->createAccelStruct(blasDesc);
+
+        if (entry.dynamic)
+            ++m_Statistics.dynamicBlasCount;
+        else
+            ++m_Statistics.staticBlasCount;
+
+        m_EntryIndices[mesh.get()] = m_Entries.size();
+        m_Entries.push_back(std::move(entry));
+    }
+
+    commandList->beginMarker("Static BLAS Builds");
+
+    // Transition all the inputs and outputs first, so that the builds are not separated by barriers
+    for (const auto& entry : m_Entries)
+    {
+        if (entry.dynamic)
+            continue;
+
+        commandList->setAccelStructState(entry.mesh->accelStruct, nvrhi::ResourceStates::AccelStructWrite);
+        commandList->setBufferState(entry.mesh->buffers->indexBuffer, nvrhi::ResourceStates::AccelStructBuildInput);
+        commandList->setBufferState(entry.mesh->buffers->vertexBuffer, nvrhi::ResourceStates::AccelStructBuildInput);
+    }
+    commandList->commitBarriers();
+
+    for (auto& entry : m_Entries)
+    {
+        if (entry.dynamic)
+            continue;
+
+        nvrhi::rt::AccelStructDesc blasDesc;
+        GetMeshBlasDesc(*entry.mesh, false, m_IsOpaque, blasDesc);
+        nvrhi::utils::BuildBottomLevelAccelStruct(commandList, entry.mesh->accelStruct, blasDesc);
+        entry.built = true;
+
+        m_Statistics.staticMemoryBeforeCompaction += GetAccelStructMemorySize(entry.mesh->accelStruct);
+    }
+
+    commandList->endMarker();
+}
+
+void BlasManager::BuildDynamic(nvrhi::ICommandList* commandList, const std::vector<engine::MeshInfo*>& meshes, bool refit,
+    uint32_t maxConsecutiveRefits)
+{
+    if (meshes.empty())
+        return;
+
+    commandList->beginMarker("Dynamic BLAS Builds");
+
+    for (engine::MeshInfo* mesh : meshes)
+    {
+        const BlasEntry* entry = FindEntry(mesh);
+        nvrhi::IBuffer* vertexBuffer = entry && entry->vertexBuffer ? entry->vertexBuffer.Get() : mesh->buffers->vertexBuffer.Get();
+
+        commandList->setAccelStructState(mesh->accelStruct, nvrhi::ResourceStates::AccelStructWrite);
+        commandList->setBufferState(vertexBuffer, nvrhi::ResourceStates::AccelStructBuildInput);
+    }
+    commandList->commitBarriers();
+
+    for (engine::MeshInfo* mesh : meshes)
+    {
+        BlasEntry* entry = FindEntry(mesh);
+        assert(entry && entry->dynamic);
+        if (!entry)
+            continue;
+
+        nvrhi::rt::AccelStructDesc blasDesc;
+        GetMeshBlasDesc(*mesh, true, m_IsOpaque, blasDesc);
+
+        if (entry->vertexBuffer)
+        {
+            for (size_t geometryIndex = 0; geometryIndex < blasDesc.bottomLevelGeometries.size(); geometryIndex++)
+            {
+                auto& triangles = blasDesc.bottomLevelGeometries[geometryIndex].geometryData.triangles;
+                triangles.vertexBuffer = entry->vertexBuffer;
+                triangles.vertexOffset = entry->vertexOffset + mesh->geometries[geometryIndex]->vertexOffsetInMesh * sizeof(float3);
+            }
+        }
+
+        if (refit && entry->built && entry->refitCount < maxConsecutiveRefits)
+        {
+            blasDesc.buildFlags = blasDesc.buildFlags | nvrhi::rt::AccelStructBuildFlags::PerformUpdate;
+            ++entry->refitCount;
+        }
+        else if (entry->built)
+        {
+            entry->refitCount = 0;
+        }
+        else if (maxConsecutiveRefits != ~0u && maxConsecutiveRefits != 0)
+        {
+            // Meshes that are first built together would otherwise reach the refit limit in the same frame
+            entry->refitCount = uint32_t(entry - m_Entries.data()) % maxConsecutiveRefits;
+        }
+
+        nvrhi::utils::BuildBottomLevelAccelStruct(commandList, mesh->accelStruct, blasDesc);
+
+        if (!entry->built)
+            m_Statistics.dynamicMemory += GetAccelStructMemorySize(mesh->accelStruct);
+        entry->built = true;
+    }
+
+    commandList->endMarker();
+}
+
+void BlasManager::SetDynamicVertexSource(const engine::MeshInfo* mesh, nvrhi::IBuffer* buffer, uint64_t byteOffset)
+{
+    BlasEntry* entry = FindEntry(mesh);
+    assert(entry && entry->dynamic);
+    if (!entry)
+        return;
+
+    entry->vertexBuffer = buffer;
+    entry->vertexOffset = byteOffset;
+}
+
+bool BlasManager::Compact(nvrhi::ICommandList* commandList)
+{
+    if (!IsCompactionPending())
+        return false;
+
+    // Compacts the acceleration structures that are tagged for compaction and have finished executing the original build
+    commandList->compactBottomLevelAccelStructs();
+
+    bool anyCompacted = false;
+    for (auto& entry : m_Entries)
+    {
+        if (entry.dynamic || entry.compacted || !entry.mesh->accelStruct->isCompacted())
+            continue;
+
+        entry.compacted = true;
+        anyCompacted = true;
+        ++m_Statistics.compactedBlasCount;
+        m_Statistics.staticMemoryAfterCompaction += GetAccelStructMemorySize(entry.mesh->accelStruct);
+    }
+
+    if (anyCompacted && !IsCompactionPending())
+        LogStatistics();
+
+    return anyCompacted;
+}
+
+void BlasManager::LogStatistics() const
+{
+    constexpr double megabyte = 1024.0 * 1024.0;
+
+    log::info("BLAS memory: %u static BLAS'es use %.2f MB before compaction, %.2f MB after compaction (%u compacted); "
+        "%u dynamic BLAS'es use %.2f MB",
+        m_Statistics.staticBlasCount,
+        double(m_Statistics.staticMemoryBeforeCompaction) / megabyte,
+        double(m_Statistics.staticMemoryAfterCompaction) / megabyte,
+        m_Statistics.compactedBlasCount,
+        m_Statistics.dynamicBlasCount,
+        double(m_Statistics.dynamicMemory) / megabyte);
+}
+
+uint64_t BlasManager::GetAccelStructMemorySize(nvrhi::rt::IAccelStruct* as) const
+{
+    // This reports the size of the buffer that currently holds the acceleration structure,
+    // which is replaced with a smaller buffer when the acceleration structure is compacted.
+    return m_Device->getAccelStructMemoryRequirements(as).size;
+}
+
+BlasManager::BlasEntry* BlasManager::FindEntry(const engine::MeshInfo* mesh)
+{
+    auto it = m_EntryIndices.find(mesh);
+    return it != m_EntryIndices.end() ? &m_Entries[it->second] : nullptr;
+}
@@ -0,0 +1,117 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <nvrhi/nvrhi.h>
+
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+namespace donut::engine
+{
+    struct MeshGeometry;
+    struct MeshInfo;
+    class SceneGraph;
+}
+
+// Creates, builds and compacts the bottom level acceleration structures of the scene meshes.
+// Meshes are split into two groups by how often their geometry changes:
+//  - Static meshes are built once with PreferFastTrace and compacted when their builds have finished on the GPU.
+//  - Dynamic meshes (skinned or simulated geometry) are built with PreferFastBuild and AllowUpdate and are never compacted.
+// The builds of a batch are recorded back to back behind a single set of barriers, so their scratch memory
+// is sub-allocated from the same scratch chunks of the command list instead of being allocated per mesh.
+class BlasManager
+{
+public:
+    using DynamicMeshPredicate = std::function<bool(const donut::engine::MeshInfo& mesh)>;
+    using OpaqueGeometryPredicate = std::function<bool(const donut::engine::MeshGeometry& geometry)>;
+
+    struct Statistics
+    {
+        uint32_t staticBlasCount = 0;
+        uint32_t dynamicBlasCount = 0;
+        uint32_t compactedBlasCount = 0;
+        uint64_t staticMemoryBeforeCompaction = 0;  // Bytes, all static BLAS'es as built
+        uint64_t staticMemoryAfterCompaction = 0;   // Bytes, valid when compactedBlasCount == staticBlasCount
+        uint64_t dynamicMemory = 0;                 // Bytes
+    };
+
+    explicit BlasManager(nvrhi::IDevice* device);
+
+    // Fills the BLAS description for a mesh. The geometries selected by 'isOpaque' are marked as opaque, which skips
+    // their any-hit shaders. Without a predicate, only the geometries with materials in the Opaque domain are opaque.
+    static void GetMeshBlasDesc(const donut::engine::MeshInfo& mesh, bool dynamic, const OpaqueGeometryPredicate& isOpaque,
+        nvrhi::rt::AccelStructDesc& blasDesc);
+
+    // Creates a BLAS for every mesh in the scene graph, except the skinning prototypes, and stores it in MeshInfo::accelStruct.
+    // The static meshes are built in one batch. The dynamic meshes, selected by 'isDynamic', are only created:
+    // their geometry is usually not valid yet, so the application builds them with BuildDynamic.
+    // 'isOpaque' is used for all later builds too, see GetMeshBlasDesc.
+    void CreateAccelStructs(nvrhi::ICommandList* commandList, const donut::engine::SceneGraph& sceneGraph,
+        const DynamicMeshPredicate& isDynamic = nullptr, const OpaqueGeometryPredicate& isOpaque = nullptr);
+
+    // Builds a batch of dynamic meshes. If 'refit' is set, the BLAS'es that have been built before are updated in place,
+    // which is only valid when the topology and primitive counts of the meshes haven't changed since the last full build.
+    // Refits lose trace performance as the geometry moves away from the built shape, so a BLAS is fully rebuilt after
+    // 'maxConsecutiveRefits' refits. The rebuilds of different meshes are spread over different frames.
+    void BuildDynamic(nvrhi::ICommandList* commandList, const std::vector<donut::engine::MeshInfo*>& meshes, bool refit = false,
+        uint32_t maxConsecutiveRefits = ~0u);
+
+    // Builds the BLAS of a dynamic mesh from positions in another buffer instead of the mesh's vertex buffer,
+    // e.g. the output of an application skinning pass. The positions are tightly packed float3's, and 'byteOffset'
+    // is the position of the first vertex of the mesh, which the geometries' vertex offsets are relative to.
+    void SetDynamicVertexSource(const donut::engine::MeshInfo* mesh, nvrhi::IBuffer* buffer, uint64_t byteOffset);
+
+    // Compacts the static BLAS'es whose builds have completed on the GPU, and updates the statistics.
+    // Call this once per frame; it does nothing when there are no pending compactions.
+    // Returns true if any BLAS was compacted: compaction moves the BLAS data, so the TLAS must be rebuilt
+    // (not refitted) in the same command list after this call.
+    bool Compact(nvrhi::ICommandList* commandList);
+
+    [[nodiscard]] bool IsCompactionPending() const { return m_Statistics.compactedBlasCount < m_Statistics.staticBlasCount; }
+    [[nodiscard]] const Statistics& GetStatistics() const { return m_Statistics; }
+    void LogStatistics() const;
+
+private:
+    struct BlasEntry
+    {
+        std::shared_ptr<donut::engine::MeshInfo> mesh;
+        bool dynamic = false;
+        bool compacted = false;
+        bool built = false;
+        uint32_t refitCount = 0;
+        nvrhi::BufferHandle vertexBuffer;   // Replaces the mesh's vertex buffer when set, see SetDynamicVertexSource
+        uint64_t vertexOffset = 0;
+    };
+
+    nvrhi::DeviceHandle m_Device;
+    std::vector<BlasEntry> m_Entries;
+    std::unordered_map<const donut::engine::MeshInfo*, size_t> m_EntryIndices; // Into m_Entries
+    OpaqueGeometryPredicate m_IsOpaque;
+    Statistics m_Statistics;
+
+    [[nodiscard]] uint64_t GetAccelStructMemorySize(nvrhi::rt::IAccelStruct* as) const;
+    BlasEntry* FindEntry(const donut::engine::MeshInfo* mesh);
+};
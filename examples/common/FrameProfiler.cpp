@@ -0,0 +1,610 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+
+#include "FrameProfiler.h"
+
+#include <donut/core/log.h>
+#include <imgui.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+
+using namespace donut;
+
+namespace
+{
+    struct OpenCpuZone
+    {
+        const char* name;
+        int64_t start;
+    };
+
+    // Per-thread state, valid for the profiler with the matching instance ID
+    struct ThreadState
+    {
+        uint32_t profilerId = 0;
+        uint32_t track = 0;
+        std::vector<OpenCpuZone> openZones;
+    };
+
+    thread_local ThreadState t_ThreadState;
+    std::atomic<uint32_t> g_NextProfilerId = 1;
+
+    constexpr int64_t c_StatisticsInterval = 500'000'000; // 0.5 s
+    constexpr size_t c_MaxTimelineEvents = 8192;
+    constexpr uint64_t c_TimelineFrames = 3;
+
+    // The timeline ends this many frames ago, by which time the GPU zones have usually been read back
+    constexpr uint64_t c_TimelineLatencyFrames = 3;
+
+    std::string EscapeJson(const char* text)
+    {
+        std::string result;
+        for (const char* c = text; *c; ++c)
+        {
+            if (*c == '"' || *c == '\\')
+                result += '\\';
+            if (uint8_t(*c) >= 0x20)
+                result += *c;
+        }
+        return result;
+    }
+
+    ImU32 GetZoneColor(const char* name)
+    {
+        // FNV-1a, so that zones with the same name always get the same color
+        uint32_t hash = 2166136261u;
+        for (const char* c = name; *c; ++c)
+            hash = (hash ^ uint8_t(*c)) * 16777619u;
+
+        return ImColor::HSV(float(hash % 360) / 360.f, 0.55f, 0.75f);
+    }
+}
+
+FrameProfiler::FrameProfiler(nvrhi::IDevice* device, const std::filesystem::path& traceFileName)
+    : m_Device(device)
+    , m_TraceFileName(traceFileName)
+    , m_StartTime(std::chrono::steady_clock::now())
+    , m_InstanceId(g_NextProfilerId++)
+{
+    m_Events.resize(MaxEvents);
+    m_FrameStarts.resize(MaxFrames);
+
+    m_GpuZones.resize(GpuQueryCount);
+    for (GpuZone& zone : m_GpuZones)
+        zone.query = m_Device->createTimerQuery();
+
+    const char* queueNames[] = { "GPU Graphics queue", "GPU Compute queue", "GPU Copy queue" };
+    static_assert(std::size(queueNames) == size_t(nvrhi::CommandQueue::Count));
+
+    for (uint32_t queue = 0; queue < uint32_t(nvrhi::CommandQueue::Count); queue++)
+    {
+        m_GpuQueueTracks[queue] = uint32_t(m_Tracks.size());
+
+        Track track;
+        track.name = queueNames[queue];
+        track.gpu = true;
+        m_Tracks.push_back(std::move(track));
+    }
+}
+
+int64_t FrameProfiler::GetTime() const
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_StartTime).count();
+}
+
+uint32_t FrameProfiler::GetThreadTrack()
+{
+    ThreadState& state = t_ThreadState;
+    if (state.profilerId == m_InstanceId)
+        return state.track;
+
+    std::lock_guard lock(m_Mutex);
+
+    const size_t cpuTrackCount = std::count_if(m_Tracks.begin(), m_Tracks.end(), [](const Track& track) { return !track.gpu; });
+
+    Track track;
+    track.name = "Thread " + std::to_string(cpuTrackCount);
+    m_Tracks.push_back(std::move(track));
+
+    state.profilerId = m_InstanceId;
+    state.track = uint32_t(m_Tracks.size() - 1);
+    state.openZones.clear();
+    return state.track;
+}
+
+void FrameProfiler::SetThreadName(const char* name)
+{
+    const uint32_t track = GetThreadTrack();
+
+    std::lock_guard lock(m_Mutex);
+    m_Tracks[track].name = name;
+}
+
+void FrameProfiler::BeginFrame()
+{
+    const int64_t now = GetTime();
+
+    std::lock_guard lock(m_Mutex);
+
+    if (!m_Paused)
+    {
+        m_FrameStarts[m_FrameCount % MaxFrames] = now;
+        ++m_FrameCount;
+    }
+
+    ResolveGpuZones();
+
+    ++m_StatisticsFrames;
+    UpdateStatistics(now);
+}
+
+void FrameProfiler::BeginCpuZone(const char* name)
+{
+    GetThreadTrack();
+    t_ThreadState.openZones.push_back({ name, GetTime() });
+}
+
+void FrameProfiler::EndCpuZone()
+{
+    const uint32_t track = GetThreadTrack();
+    ThreadState& state = t_ThreadState;
+    if (state.openZones.empty())
+        return;
+
+    const OpenCpuZone zone = state.openZones.back();
+    state.openZones.pop_back();
+    const int64_t end = GetTime();
+
+    std::lock_guard lock(m_Mutex);
+    AddEvent(zone.name, zone.start, end - zone.start, track, uint32_t(state.openZones.size()));
+}
+
+void FrameProfiler::BeginGpuZone(nvrhi::ICommandList* commandList, const char* name)
+{
+    commandList->beginMarker(name);
+
+    const int64_t now = GetTime();
+
+    std::lock_guard lock(m_Mutex);
+
+    std::vector<uint64_t>& openZones = m_OpenGpuZones[commandList];
+
+    uint64_t id = 0;
+    if (m_GpuZoneHead - m_GpuZoneTail < GpuQueryCount)
+    {
+        GpuZone& zone = m_GpuZones[m_GpuZoneHead % GpuQueryCount];
+        id = ++m_GpuZoneHead;
+
+        zone.name = name;
+        zone.id = id;
+        zone.parentId = openZones.empty() ? 0 : openZones.back();
+        zone.track = m_GpuQueueTracks[uint32_t(commandList->getDesc().queueType)];
+        zone.depth = uint32_t(openZones.size());
+        zone.childCount = 0;
+        zone.cpuStart = now;
+        zone.ended = false;
+
+        // The parent is still open, so its slot in the ring can't have been reused
+        if (zone.parentId != 0)
+            ++m_GpuZones[(zone.parentId - 1) % GpuQueryCount].childCount;
+
+        commandList->beginTimerQuery(zone.query);
+    }
+    else
+    {
+        ++m_DroppedGpuZones;
+    }
+
+    openZones.push_back(id);
+}
+
+void FrameProfiler::EndGpuZone(nvrhi::ICommandList* commandList)
+{
+    {
+        std::lock_guard lock(m_Mutex);
+
+        auto openZones = m_OpenGpuZones.find(commandList);
+        if (openZones != m_OpenGpuZones.end() && !openZones->second.empty())
+        {
+            const uint64_t id = openZones->second.back();
+            openZones->second.pop_back();
+            if (openZones->second.empty())
+                m_OpenGpuZones.erase(openZones);
+
+            if (id != 0)
+            {
+                GpuZone& zone = m_GpuZones[(id - 1) % GpuQueryCount];
+                commandList->endTimerQuery(zone.query);
+                zone.ended = true;
+            }
+        }
+    }
+
+    commandList->endMarker();
+}
+
+void FrameProfiler::AddEvent(const char* name, int64_t start, int64_t duration, uint32_t track, uint32_t depth)
+{
+    auto statistics = std::find_if(m_Statistics.begin(), m_Statistics.end(),
+        [name, track](const ZoneStatistics& s) { return s.name == name && s.track == track; });
+
+    if (statistics == m_Statistics.end())
+    {
+        ZoneStatistics newStatistics;
+        newStatistics.name = name;
+        newStatistics.track = track;
+        newStatistics.depth = depth;
+        statistics = m_Statistics.insert(m_Statistics.end(), newStatistics);
+    }
+
+    statistics->accumulatedTime += duration;
+    ++statistics->accumulatedCount;
+
+    if (m_Paused)
+        return;
+
+    Event& event = m_Events[m_EventCount % MaxEvents];
+    event.name = name;
+    event.start = start;
+    event.duration = duration;
+    event.track = track;
+    event.depth = depth;
+    ++m_EventCount;
+}
+
+void FrameProfiler::ResolveGpuZones()
+{
+    // Zones are resolved in the order they were begun, so a parent is always placed before its children
+    while (m_GpuZoneTail != m_GpuZoneHead)
+    {
+        GpuZone& zone = m_GpuZones[m_GpuZoneTail % GpuQueryCount];
+        if (!zone.ended || !m_Device->pollTimerQuery(zone.query))
+            break;
+
+        int64_t duration = int64_t(double(m_Device->getTimerQueryTime(zone.query)) * 1e9);
+        m_Device->resetTimerQuery(zone.query);
+        ++m_GpuZoneTail;
+
+        int64_t start;
+        auto parent = (zone.parentId != 0) ? m_GpuParents.find(zone.parentId) : m_GpuParents.end();
+        if (parent != m_GpuParents.end())
+        {
+            // Children are laid out back to back from the start of their parent
+            start = parent->second.childCursor;
+            duration = std::max<int64_t>(std::min(duration, parent->second.end - start), 0);
+            parent->second.childCursor = start + duration;
+
+            if (--parent->second.pendingChildren == 0)
+                m_GpuParents.erase(parent);
+        }
+        else
+        {
+            Track& track = m_Tracks[zone.track];
+            start = std::max(zone.cpuStart, track.gpuCursor);
+            track.gpuCursor = start + duration;
+        }
+
+        if (zone.childCount != 0)
+            m_GpuParents[zone.id] = GpuParent{ start, start + duration, zone.childCount };
+
+        AddEvent(zone.name, start, duration, zone.track, zone.depth);
+    }
+}
+
+void FrameProfiler::UpdateStatistics(int64_t now)
+{
+    if (now - m_StatisticsStart < c_StatisticsInterval || m_StatisticsFrames == 0)
+        return;
+
+    for (ZoneStatistics& statistics : m_Statistics)
+    {
+        statistics.averageTimeMs = (statistics.accumulatedCount != 0)
+            ? float(double(statistics.accumulatedTime) * 1e-6 / double(m_StatisticsFrames))
+            : -1.f;
+        statistics.averageCount = float(statistics.accumulatedCount) / float(m_StatisticsFrames);
+        statistics.accumulatedTime = 0;
+        statistics.accumulatedCount = 0;
+    }
+
+    m_StatisticsStart = now;
+    m_StatisticsFrames = 0;
+}
+
+float FrameProfiler::GetTimeMs(const char* name, bool gpu) const
+{
+    std::lock_guard lock(m_Mutex);
+
+    float result = 0.f;
+    bool found = false;
+    for (const ZoneStatistics& statistics : m_Statistics)
+    {
+        if (m_Tracks[statistics.track].gpu == gpu && statistics.averageTimeMs >= 0.f && !strcmp(statistics.name, name))
+        {
+            result += statistics.averageTimeMs;
+            found = true;
+        }
+    }
+
+    return found ? result : -1.f;
+}
+
+float FrameProfiler::GetCpuTimeMs(const char* name) const
+{
+    return GetTimeMs(name, false);
+}
+
+float FrameProfiler::GetGpuTimeMs(const char* name) const
+{
+    return GetTimeMs(name, true);
+}
+
+bool FrameProfiler::WriteChromeTrace(const std::filesystem::path& fileName) const
+{
+    std::vector<Track> tracks;
+    std::vector<Event> events;
+    std::vector<std::pair<uint64_t, int64_t>> frames;
+    {
+        std::lock_guard lock(m_Mutex);
+
+        tracks = m_Tracks;
+
+        const uint64_t eventCount = std::min<uint64_t>(m_EventCount, MaxEvents);
+        events.reserve(eventCount);
+        for (uint64_t i = m_EventCount - eventCount; i < m_EventCount; i++)
+            events.push_back(m_Events[i % MaxEvents]);
+
+        const uint64_t frameCount = std::min<uint64_t>(m_FrameCount, MaxFrames);
+        for (uint64_t i = m_FrameCount - frameCount; i < m_FrameCount; i++)
+            frames.push_back({ i, m_FrameStarts[i % MaxFrames] });
+    }
+
+    FILE* file = fopen(fileName.generic_string().c_str(), "w");
+    if (!file)
+    {
+        log::error("Cannot open file '%s' for writing", fileName.generic_string().c_str());
+        return false;
+    }
+
+    // CPU threads and GPU queues are shown as threads of two separate processes
+    auto getPid = [](const Track& track) { return track.gpu ? 2 : 1; };
+
+    fprintf(file, "{\n\t\"displayTimeUnit\": \"ms\",\n\t\"traceEvents\": [\n");
+    fprintf(file, "\t\t{ \"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"args\": { \"name\": \"CPU\" } },\n");
+    fprintf(file, "\t\t{ \"name\": \"process_name\", \"ph\": \"M\", \"pid\": 2, \"args\": { \"name\": \"GPU\" } }");
+
+    for (size_t index = 0; index < tracks.size(); index++)
+    {
+        const Track& track = tracks[index];
+        fprintf(file, ",\n\t\t{ \"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %d, \"tid\": %zu, \"args\": { \"name\": \"%s\" } }",
+            getPid(track), index, EscapeJson(track.name.c_str()).c_str());
+        fprintf(file, ",\n\t\t{ \"name\": \"thread_sort_index\", \"ph\": \"M\", \"pid\": %d, \"tid\": %zu, \"args\": { \"sort_index\": %zu } }",
+            getPid(track), index, index);
+    }
+
+    const int64_t firstEventStart = events.empty() ? 0 : std::min_element(events.begin(), events.end(),
+        [](const Event& a, const Event& b) { return a.start < b.start; })->start;
+
+    for (const auto& [frameIndex, frameStart] : frames)
+    {
+        if (frameStart < firstEventStart)
+            continue;
+
+        fprintf(file, ",\n\t\t{ \"name\": \"Frame %llu\", \"ph\": \"i\", \"s\": \"g\", \"pid\": 1, \"tid\": 0, \"ts\": %.3f }",
+            (unsigned long long)frameIndex, double(frameStart) * 1e-3);
+    }
+
+    for (const Event& event : events)
+    {
+        fprintf(file, ",\n\t\t{ \"name\": \"%s\", \"ph\": \"X\", \"pid\": %d, \"tid\": %u, \"ts\": %.3f, \"dur\": %.3f }",
+            EscapeJson(event.name).c_str(), getPid(tracks[event.track]), event.track,
+            double(event.start) * 1e-3, double(event.duration) * 1e-3);
+    }
+
+    fprintf(file, "\n\t]\n}\n");
+
+    const bool success = !ferror(file);
+    fclose(file);
+
+    if (success)
+        log::info("Profiler trace with %zu zones written to '%s'", events.size(), fileName.generic_string().c_str());
+    else
+        log::error("Failed to write the profiler trace into '%s'", fileName.generic_string().c_str());
+
+    return success;
+}
+
+void FrameProfiler::BuildUI()
+{
+    ImGui::Begin("Profiler", nullptr, ImGuiWindowFlags_AlwaysAutoResize);
+
+    bool paused = m_Paused;
+    if (ImGui::Checkbox("Pause", &paused))
+        m_Paused = paused;
+
+    ImGui::SameLine();
+    if (ImGui::Button("Save Trace"))
+    {
+        m_TraceStatus = WriteChromeTrace(m_TraceFileName)
+            ? "Saved " + m_TraceFileName.filename().generic_string()
+            : "Failed to save " + m_TraceFileName.filename().generic_string();
+    }
+
+    if (!m_TraceStatus.empty())
+    {
+        ImGui::SameLine();
+        ImGui::TextUnformatted(m_TraceStatus.c_str());
+    }
+
+    std::vector<Track> tracks;
+    std::vector<ZoneStatistics> statistics;
+    uint64_t droppedGpuZones;
+    {
+        std::lock_guard lock(m_Mutex);
+        tracks = m_Tracks;
+        statistics = m_Statistics;
+        droppedGpuZones = m_DroppedGpuZones;
+    }
+
+    ImGui::TextUnformatted("Average time per frame:");
+
+    for (uint32_t track = 0; track < uint32_t(tracks.size()); track++)
+    {
+        bool headerShown = false;
+        for (const ZoneStatistics& zone : statistics)
+        {
+            if (zone.track != track || zone.averageTimeMs < 0.f)
+                continue;
+
+            if (!headerShown)
+            {
+                ImGui::Separator();
+                ImGui::TextUnformatted(tracks[track].name.c_str());
+                headerShown = true;
+            }
+
+            ImGui::Text("  %*s%s", int(zone.depth * 2), "", zone.name);
+            ImGui::SameLine(260.f);
+            if (zone.averageCount > 1.05f)
+                ImGui::Text("%8.3f ms  (x%.1f)", zone.averageTimeMs, zone.averageCount);
+            else
+                ImGui::Text("%8.3f ms", zone.averageTimeMs);
+        }
+    }
+
+    if (droppedGpuZones != 0)
+    {
+        ImGui::Separator();
+        ImGui::Text("GPU zones not timed because all queries were in flight: %llu", (unsigned long long)droppedGpuZones);
+    }
+
+    ImGui::Separator();
+    DrawTimeline();
+
+    ImGui::End();
+}
+
+void FrameProfiler::DrawTimeline()
+{
+    std::vector<Track> tracks;
+    std::vector<Event> events;
+    std::vector<int64_t> frameStarts;
+    uint64_t firstFrame = 0;
+    {
+        std::lock_guard lock(m_Mutex);
+
+        if (m_FrameCount < c_TimelineFrames + c_TimelineLatencyFrames + 1)
+            return;
+
+        tracks = m_Tracks;
+
+        firstFrame = m_FrameCount - c_TimelineFrames - c_TimelineLatencyFrames - 1;
+        for (uint64_t frame = firstFrame; frame <= firstFrame + c_TimelineFrames; frame++)
+            frameStarts.push_back(m_FrameStarts[frame % MaxFrames]);
+
+        const uint64_t eventCount = std::min<uint64_t>(m_EventCount, c_MaxTimelineEvents);
+        for (uint64_t i = m_EventCount - eventCount; i < m_EventCount; i++)
+        {
+            const Event& event = m_Events[i % MaxEvents];
+            if (event.start < frameStarts.back() && event.start + event.duration > frameStarts.front())
+                events.push_back(event);
+        }
+    }
+
+    const int64_t rangeStart = frameStarts.front();
+    const int64_t rangeEnd = frameStarts.back();
+    ImGui::Text("Timeline of frames %llu - %llu: %.2f ms", (unsigned long long)firstFrame,
+        (unsigned long long)(firstFrame + c_TimelineFrames - 1), double(rangeEnd - rangeStart) * 1e-6);
+
+    // Every track gets as many rows as its deepest zone needs
+    std::vector<uint32_t> trackRows(tracks.size(), 0);
+    for (const Event& event : events)
+        trackRows[event.track] = std::max(trackRows[event.track], event.depth + 1);
+
+    const float labelWidth = 140.f;
+    const float timelineWidth = 640.f;
+    const float rowHeight = ImGui::GetTextLineHeight() + 2.f;
+    const float trackSpacing = 4.f;
+    const double scale = double(timelineWidth) / double(std::max<int64_t>(rangeEnd - rangeStart, 1));
+
+    float height = 0.f;
+    for (uint32_t rows : trackRows)
+        if (rows != 0)
+            height += float(rows) * rowHeight + trackSpacing;
+
+    ImDrawList* drawList = ImGui::GetWindowDrawList();
+    const ImVec2 origin = ImGui::GetCursorScreenPos();
+    ImGui::Dummy(ImVec2(labelWidth + timelineWidth, height));
+
+    const float timelineLeft = origin.x + labelWidth;
+    const float timelineRight = timelineLeft + timelineWidth;
+
+    std::vector<float> trackTop(tracks.size(), 0.f);
+    float y = origin.y;
+    for (size_t track = 0; track < tracks.size(); track++)
+    {
+        if (trackRows[track] == 0)
+            continue;
+
+        trackTop[track] = y;
+        const float trackBottom = y + float(trackRows[track]) * rowHeight;
+        drawList->AddRectFilled(ImVec2(timelineLeft, y), ImVec2(timelineRight, trackBottom), IM_COL32(40, 40, 40, 200));
+        drawList->AddText(ImVec2(origin.x, y), IM_COL32(220, 220, 220, 255), tracks[track].name.c_str());
+        y = trackBottom + trackSpacing;
+    }
+
+    for (const Event& event : events)
+    {
+        const float x0 = std::max(timelineLeft, timelineLeft + float(double(event.start - rangeStart) * scale));
+        const float x1 = std::min(timelineRight, std::max(x0 + 1.f, timelineLeft + float(double(event.start + event.duration - rangeStart) * scale)));
+        const float y0 = trackTop[event.track] + float(event.depth) * rowHeight;
+        const ImVec2 min(x0, y0);
+        const ImVec2 max(x1, y0 + rowHeight - 1.f);
+
+        drawList->AddRectFilled(min, max, GetZoneColor(event.name));
+
+        if (x1 - x0 > ImGui::CalcTextSize(event.name).x + 4.f)
+        {
+            drawList->PushClipRect(min, max, true);
+            drawList->AddText(ImVec2(x0 + 2.f, y0), IM_COL32(255, 255, 255, 255), event.name);
+            drawList->PopClipRect();
+        }
+
+        if (ImGui::IsMouseHoveringRect(min, max))
+            ImGui::SetTooltip("%s\n%s\n%.3f ms", event.name, tracks[event.track].name.c_str(), double(event.duration) * 1e-6);
+    }
+
+    for (int64_t frameStart : frameStarts)
+    {
+        const float x = timelineLeft + float(double(frameStart - rangeStart) * scale);
+        drawList->AddLine(ImVec2(x, origin.y), ImVec2(x, origin.y + height), IM_COL32(255, 255, 255, 128));
+    }
+}
+
+void FrameProfilerUI::buildUI()
+{
+    ImGui::SetNextWindowPos(ImVec2(10.f, 10.f), ImGuiCond_FirstUseEver);
+    m_Profiler.BuildUI();
+}
@@ -0,0 +1,232 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <donut/app/imgui_renderer.h>
+#include <nvrhi/nvrhi.h>
+
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Collects timed CPU and GPU zones from all threads and queues of an application, averages them for an ImGui overlay,
+// and writes the recent history into a Chrome trace JSON file that can be opened in chrome://tracing or Perfetto.
+//
+// CPU zones are timed with steady_clock, and every thread that records a zone gets its own track.
+// GPU zones are timed with queries taken from a fixed ring. The queries are read back with pollTimerQuery
+// once they have completed, which is usually a few frames later, so reading the results never stalls the CPU.
+// When all queries of the ring are still in flight, new GPU zones are not timed and are counted as dropped.
+//
+// Timer queries only measure durations, so the GPU zones are placed on the timeline by their duration and order:
+// a zone starts when the previous zone on the same queue has ended, but not before the CPU started recording it.
+// The gaps between the GPU zones of a queue are therefore a lower bound of the time that queue was idle.
+//
+// Zone names are stored as pointers, so they must stay valid while the profiler exists; string literals work best.
+class FrameProfiler
+{
+public:
+    static constexpr uint32_t GpuQueryCount = 512;
+    static constexpr size_t MaxEvents = 65536;
+    static constexpr size_t MaxFrames = 1024;
+
+    FrameProfiler(nvrhi::IDevice* device, const std::filesystem::path& traceFileName);
+
+    // Call once per frame on the render thread, before any zones of the frame are recorded.
+    // Reads back the completed GPU zones and updates the averages a few times per second.
+    void BeginFrame();
+
+    // Names the track of the calling thread. Threads that don't call this are named by the order they first record a zone in.
+    void SetThreadName(const char* name);
+
+    // CPU zones must be properly nested on each thread.
+    void BeginCpuZone(const char* name);
+    void EndCpuZone();
+
+    // GPU zones also emit debug markers with the same name, so they replace beginMarker / endMarker pairs.
+    // The zones of a command list must be properly nested and all ended before the command list is closed.
+    // Different command lists may record zones from different threads.
+    void BeginGpuZone(nvrhi::ICommandList* commandList, const char* name);
+    void EndGpuZone(nvrhi::ICommandList* commandList);
+
+    // Returns the average time per frame spent in all zones with this name, in milliseconds,
+    // or a negative value if no such zone has completed recently.
+    [[nodiscard]] float GetCpuTimeMs(const char* name) const;
+    [[nodiscard]] float GetGpuTimeMs(const char* name) const;
+
+    // Writes the stored history, up to MaxEvents zones, into a Chrome trace JSON file.
+    bool WriteChromeTrace(const std::filesystem::path& fileName) const;
+    [[nodiscard]] const std::filesystem::path& GetTraceFileName() const { return m_TraceFileName; }
+
+    // Builds the overlay window with the averages and a timeline of recent frames.
+    // Call between ImGui::NewFrame and ImGui::Render, e.g. from ImGui_Renderer::buildUI.
+    void BuildUI();
+
+private:
+    struct Track
+    {
+        std::string name;
+        bool gpu = false;
+        int64_t gpuCursor = 0; // End of the last top-level zone placed on a GPU track
+    };
+
+    struct Event
+    {
+        const char* name = nullptr;
+        int64_t start = 0;  // Nanoseconds since the profiler was created
+        int64_t duration = 0;
+        uint32_t track = 0;
+        uint32_t depth = 0;
+    };
+
+    struct ZoneStatistics
+    {
+        const char* name = nullptr;
+        uint32_t track = 0;
+        uint32_t depth = 0;
+        int64_t accumulatedTime = 0;
+        uint32_t accumulatedCount = 0;
+        float averageTimeMs = -1.f;
+        float averageCount = 0.f;
+    };
+
+    struct GpuZone
+    {
+        nvrhi::TimerQueryHandle query;
+        const char* name = nullptr;
+        uint64_t id = 0;       // Sequence number + 1, 0 means no zone
+        uint64_t parentId = 0;
+        uint32_t track = 0;
+        uint32_t depth = 0;
+        uint32_t childCount = 0;
+        int64_t cpuStart = 0;
+        bool ended = false;
+    };
+
+    // Placement of a resolved GPU zone whose children haven't been resolved yet
+    struct GpuParent
+    {
+        int64_t childCursor = 0;
+        int64_t end = 0;
+        uint32_t pendingChildren = 0;
+    };
+
+    nvrhi::DeviceHandle m_Device;
+    std::filesystem::path m_TraceFileName;
+    std::chrono::steady_clock::time_point m_StartTime;
+    uint32_t m_InstanceId;
+
+    mutable std::mutex m_Mutex;
+    std::vector<Track> m_Tracks;
+    uint32_t m_GpuQueueTracks[uint32_t(nvrhi::CommandQueue::Count)];
+
+    std::vector<Event> m_Events;
+    uint64_t m_EventCount = 0;
+    std::vector<int64_t> m_FrameStarts;
+    uint64_t m_FrameCount = 0;
+
+    std::vector<ZoneStatistics> m_Statistics;
+    int64_t m_StatisticsStart = 0;
+    uint32_t m_StatisticsFrames = 0;
+
+    std::vector<GpuZone> m_GpuZones;
+    uint64_t m_GpuZoneHead = 0;
+    uint64_t m_GpuZoneTail = 0;
+    uint64_t m_DroppedGpuZones = 0;
+    std::unordered_map<nvrhi::ICommandList*, std::vector<uint64_t>> m_OpenGpuZones;
+    std::unordered_map<uint64_t, GpuParent> m_GpuParents;
+
+    std::atomic<bool> m_Paused = false;
+    std::string m_TraceStatus;
+
+    int64_t GetTime() const;
+    uint32_t GetThreadTrack();
+    float GetTimeMs(const char* name, bool gpu) const;
+
+    // These expect m_Mutex to be locked
+    void AddEvent(const char* name, int64_t start, int64_t duration, uint32_t track, uint32_t depth);
+    void ResolveGpuZones();
+    void UpdateStatistics(int64_t now);
+
+    void DrawTimeline();
+};
+
+// Records a CPU zone for the lifetime of the object.
+class ScopedCpuZone
+{
+public:
+    ScopedCpuZone(FrameProfiler& profiler, const char* name)
+        : m_Profiler(profiler)
+    {
+        m_Profiler.BeginCpuZone(name);
+    }
+
+    ~ScopedCpuZone() { m_Profiler.EndCpuZone(); }
+
+    ScopedCpuZone(const ScopedCpuZone&) = delete;
+    ScopedCpuZone& operator=(const ScopedCpuZone&) = delete;
+
+private:
+    FrameProfiler& m_Profiler;
+};
+
+// Records a GPU zone in a command list for the lifetime of the object.
+class ScopedGpuZone
+{
+public:
+    ScopedGpuZone(FrameProfiler& profiler, nvrhi::ICommandList* commandList, const char* name)
+        : m_Profiler(profiler)
+        , m_CommandList(commandList)
+    {
+        m_Profiler.BeginGpuZone(m_CommandList, name);
+    }
+
+    ~ScopedGpuZone() { m_Profiler.EndGpuZone(m_CommandList); }
+
+    ScopedGpuZone(const ScopedGpuZone&) = delete;
+    ScopedGpuZone& operator=(const ScopedGpuZone&) = delete;
+
+private:
+    FrameProfiler& m_Profiler;
+    nvrhi::ICommandList* m_CommandList;
+};
+
+// An ImGui renderer that only draws the profiler overlay, for applications that have no UI of their own.
+class FrameProfilerUI : public donut::app::ImGui_Renderer
+{
+public:
+    FrameProfilerUI(donut::app::DeviceManager* deviceManager, FrameProfiler& profiler)
+        : ImGui_Renderer(deviceManager)
+        , m_Profiler(profiler)
+    {
+    }
+
+protected:
+    void buildUI() override;
+
+private:
+    FrameProfiler& m_Profiler;
+};
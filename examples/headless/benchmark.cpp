@@ -0,0 +1,490 @@
+/*
+* Copyright (c) 2023, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+#include "benchmark.h"
+
+#include <donut/app/ApplicationBase.h>
+#include <donut/engine/ShaderFactory.h>
+#include <donut/core/log.h>
+#include <donut/core/math/math.h>
+#include <donut/core/vfs/VFS.h>
+#include <nvrhi/utils.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <numeric>
+
+using namespace donut;
+using namespace donut::math;
+
+#include "benchmark_cb.h"
+
+namespace
+{
+    struct BenchmarkResult
+    {
+        std::string test;
+        uint64_t sizeBytes = 0;
+        uint64_t bytesMoved = 0;    // The traffic that a minimal implementation of the test needs, used for the bandwidth
+        uint32_t iterations = 0;
+        float minMs = 0.f;
+        float medianMs = 0.f;
+        float meanMs = 0.f;
+        bool passed = false;
+    };
+
+    using RecordFunction = std::function<void(nvrhi::ICommandList* commandList)>;
+
+    class BenchmarkRunner
+    {
+    public:
+        BenchmarkRunner(nvrhi::IDevice* device, const BenchmarkSettings& settings)
+            : m_Device(device)
+            , m_Settings(settings)
+        { }
+
+        bool Init();
+        void Run(uint64_t sizeBytes, std::vector<BenchmarkResult>& results);
+
+    private:
+        nvrhi::DeviceHandle m_Device;
+        const BenchmarkSettings& m_Settings;
+
+        nvrhi::BindingLayoutHandle m_BindingLayout;
+        nvrhi::ComputePipelineHandle m_ReducePipeline;
+        nvrhi::ComputePipelineHandle m_ScanBlocksPipeline;
+        nvrhi::ComputePipelineHandle m_ScanBlockSumsPipeline;
+        nvrhi::ComputePipelineHandle m_ScanAddPipeline;
+        nvrhi::ComputePipelineHandle m_CopyPipeline;
+        nvrhi::CommandListHandle m_CommandList;
+        std::vector<nvrhi::TimerQueryHandle> m_TimerQueries;
+
+        // Created for every buffer size
+        uint32_t m_NumElements = 0;
+        uint32_t m_NumBlocks = 0;
+        std::vector<uint32_t> m_InputData;
+        nvrhi::BufferHandle m_InputBuffer;
+        nvrhi::BufferHandle m_OutputBuffer;
+        nvrhi::BufferHandle m_AuxiliaryBuffer;
+        nvrhi::BufferHandle m_UploadBuffer;
+        nvrhi::BufferHandle m_ReadbackBuffer;
+        nvrhi::BufferHandle m_ElementReadbackBuffer;
+        nvrhi::BindingSetHandle m_BindingSet;
+
+        nvrhi::ComputePipelineHandle CreatePipeline(engine::ShaderFactory& shaderFactory, const char* entryName);
+        void CreateBuffers(uint64_t sizeBytes);
+        void Dispatch(nvrhi::ICommandList* commandList, nvrhi::IComputePipeline* pipeline, uint32_t numGroups);
+        BenchmarkResult Measure(const char* test, uint64_t bytesMoved, const RecordFunction& prepare, const RecordFunction& run);
+        std::vector<uint32_t> ReadElements(nvrhi::IBuffer* buffer, const std::vector<uint32_t>& indices);
+    };
+
+    bool BenchmarkRunner::Init()
+    {
+        std::filesystem::path appShaderPath = app::GetDirectoryWithExecutable() / "shaders/headless" / app::GetShaderTypeName(m_Device->getGraphicsAPI());
+        auto nativeFS = std::make_shared<vfs::NativeFileSystem>();
+        engine::ShaderFactory shaderFactory(m_Device, nativeFS, appShaderPath);
+
+        auto layoutDesc = nvrhi::BindingLayoutDesc()
+            .setVisibility(nvrhi::ShaderType::Compute)
+            .addItem(nvrhi::BindingLayoutItem::PushConstants(0, sizeof(BenchmarkConstants)))
+            .addItem(nvrhi::BindingLayoutItem::TypedBuffer_SRV(0))
+            .addItem(nvrhi::BindingLayoutItem::TypedBuffer_UAV(0))
+            .addItem(nvrhi::BindingLayoutItem::TypedBuffer_UAV(1));
+        m_BindingLayout = m_Device->createBindingLayout(layoutDesc);
+
+        m_ReducePipeline = CreatePipeline(shaderFactory, "reduce_main");
+        m_ScanBlocksPipeline = CreatePipeline(shaderFactory, "scan_blocks_main");
+        m_ScanBlockSumsPipeline = CreatePipeline(shaderFactory, "scan_block_sums_main");
+        m_ScanAddPipeline = CreatePipeline(shaderFactory, "scan_add_main");
+        m_CopyPipeline = CreatePipeline(shaderFactory, "copy_main");
+
+        if (!m_ReducePipeline || !m_ScanBlocksPipeline || !m_ScanBlockSumsPipeline || !m_ScanAddPipeline || !m_CopyPipeline)
+            return false;
+
+        m_CommandList = m_Device->createCommandList();
+
+        for (uint32_t i = 0; i < m_Settings.measuredIterations; ++i)
+            m_TimerQueries.push_back(m_Device->createTimerQuery());
+
+        return true;
+    }
+
+    nvrhi::ComputePipelineHandle BenchmarkRunner::CreatePipeline(engine::ShaderFactory& shaderFactory, const char* entryName)
+    {
+        nvrhi::ShaderHandle shader = shaderFactory.CreateShader("benchmark.hlsl", entryName, nullptr, nvrhi::ShaderType::Compute);
+        if (!shader)
+            return nullptr;
+
+        auto pipelineDesc = nvrhi::ComputePipelineDesc()
+            .setComputeShader(shader)
+            .addBindingLayout(m_BindingLayout);
+
+        return m_Device->createComputePipeline(pipelineDesc);
+    }
+
+    void BenchmarkRunner::CreateBuffers(uint64_t sizeBytes)
+    {
+        m_BindingSet = nullptr;
+        m_InputBuffer = nullptr;
+        m_OutputBuffer = nullptr;
+        m_AuxiliaryBuffer = nullptr;
+        m_UploadBuffer = nullptr;
+        m_ReadbackBuffer = nullptr;
+
+        m_NumElements = uint32_t(sizeBytes / sizeof(uint32_t));
+        m_NumBlocks = div_ceil(m_NumElements, uint32_t(BENCHMARK_ELEMENTS_PER_GROUP));
+        sizeBytes = uint64_t(m_NumElements) * sizeof(uint32_t);
+
+        // Small values keep the sums easy to check, they wrap around the same way on the CPU and the GPU
+        m_InputData.resize(m_NumElements);
+        for (uint32_t i = 0; i < m_NumElements; ++i)
+            m_InputData[i] = (i * 7u + 3u) & 0xffu;
+
+        auto bufferDesc = nvrhi::BufferDesc()
+            .setByteSize(sizeBytes)
+            .setCanHaveTypedViews(true)
+            .setFormat(nvrhi::Format::R32_UINT)
+            .setDebugName("Input")
+            .setInitialState(nvrhi::ResourceStates::ShaderResource)
+            .setKeepInitialState(true);
+        m_InputBuffer = m_Device->createBuffer(bufferDesc);
+
+        bufferDesc
+            .setCanHaveUAVs(true)
+            .setDebugName("Output")
+            .setInitialState(nvrhi::ResourceStates::UnorderedAccess);
+        m_OutputBuffer = m_Device->createBuffer(bufferDesc);
+
+        bufferDesc
+            .setByteSize(uint64_t(m_NumBlocks) * sizeof(uint32_t))
+            .setDebugName("Auxiliary");
+        m_AuxiliaryBuffer = m_Device->createBuffer(bufferDesc);
+
+        auto stagingDesc = nvrhi::BufferDesc()
+            .setByteSize(sizeBytes)
+            .setCpuAccess(nvrhi::CpuAccessMode::Write)
+            .setDebugName("Upload")
+            .setInitialState(nvrhi::ResourceStates::CopySource)
+            .setKeepInitialState(true);
+        m_UploadBuffer = m_Device->createBuffer(stagingDesc);
+
+        stagingDesc
+            .setCpuAccess(nvrhi::CpuAccessMode::Read)
+            .setDebugName("Readback")
+            .setInitialState(nvrhi::ResourceStates::CopyDest);
+        m_ReadbackBuffer = m_Device->createBuffer(stagingDesc);
+
+        if (!m_ElementReadbackBuffer)
+        {
+            stagingDesc
+                .setByteSize(sizeof(uint32_t) * 4)
+                .setDebugName("ElementReadback");
+            m_ElementReadbackBuffer = m_Device->createBuffer(stagingDesc);
+        }
+
+        auto bindingSetDesc = nvrhi::BindingSetDesc()
+            .addItem(nvrhi::BindingSetItem::PushConstants(0, sizeof(BenchmarkConstants)))
+            .addItem(nvrhi::BindingSetItem::TypedBuffer_SRV(0, m_InputBuffer))
+            .addItem(nvrhi::BindingSetItem::TypedBuffer_UAV(0, m_OutputBuffer))
+            .addItem(nvrhi::BindingSetItem::TypedBuffer_UAV(1, m_AuxiliaryBuffer));
+        m_BindingSet = m_Device->createBindingSet(bindingSetDesc, m_BindingLayout);
+
+        // The input is filled through the upload buffer, which the upload test copies from again later
+        void* uploadData = m_Device->mapBuffer(m_UploadBuffer, nvrhi::CpuAccessMode::Write);
+        memcpy(uploadData, m_InputData.data(), sizeBytes);
+        m_Device->unmapBuffer(m_UploadBuffer);
+
+        m_CommandList->open();
+        m_CommandList->copyBuffer(m_InputBuffer, 0, m_UploadBuffer, 0, sizeBytes);
+        m_CommandList->close();
+        m_Device->executeCommandList(m_CommandList);
+        m_Device->waitForIdle();
+    }
+
+    void BenchmarkRunner::Dispatch(nvrhi::ICommandList* commandList, nvrhi::IComputePipeline* pipeline, uint32_t numGroups)
+    {
+        BenchmarkConstants constants = {};
+        constants.numElements = m_NumElements;
+        constants.groupsX = std::min(numGroups, uint32_t(BENCHMARK_MAX_GROUPS_X));
+        constants.numBlocks = m_NumBlocks;
+
+        auto state = nvrhi::ComputeState()
+            .setPipeline(pipeline)
+            .addBindingSet(m_BindingSet);
+        commandList->setComputeState(state);
+        commandList->setPushConstants(&constants, sizeof(constants));
+        commandList->dispatch(constants.groupsX, div_ceil(numGroups, constants.groupsX));
+    }
+
+    // Records the warm-up and the measured iterations into one command list, so that the GPU runs them back to back
+    // without waiting for the CPU. 'prepare' runs before every iteration outside of the timed range.
+    BenchmarkResult BenchmarkRunner::Measure(const char* test, uint64_t bytesMoved, const RecordFunction& prepare, const RecordFunction& run)
+    {
+        m_CommandList->open();
+        m_CommandList->beginMarker(test);
+
+        for (uint32_t i = 0; i < m_Settings.warmupIterations; ++i)
+        {
+            if (prepare)
+                prepare(m_CommandList);
+            run(m_CommandList);
+        }
+
+        for (const nvrhi::TimerQueryHandle& query : m_TimerQueries)
+        {
+            if (prepare)
+                prepare(m_CommandList);
+            m_CommandList->beginTimerQuery(query);
+            run(m_CommandList);
+            m_CommandList->endTimerQuery(query);
+        }
+
+        m_CommandList->endMarker();
+        m_CommandList->close();
+        m_Device->executeCommandList(m_CommandList);
+        m_Device->waitForIdle();
+
+        std::vector<float> timesMs;
+        for (const nvrhi::TimerQueryHandle& query : m_TimerQueries)
+        {
+            timesMs.push_back(m_Device->getTimerQueryTime(query) * 1e3f);
+            m_Device->resetTimerQuery(query);
+        }
+        std::sort(timesMs.begin(), timesMs.end());
+
+        BenchmarkResult result;
+        result.test = test;
+        result.sizeBytes = uint64_t(m_NumElements) * sizeof(uint32_t);
+        result.bytesMoved = bytesMoved;
+        result.iterations = uint32_t(timesMs.size());
+        result.minMs = timesMs.front();
+        result.medianMs = timesMs[timesMs.size() / 2];
+        result.meanMs = std::accumulate(timesMs.begin(), timesMs.end(), 0.f) / float(timesMs.size());
+        return result;
+    }
+
+    std::vector<uint32_t> BenchmarkRunner::ReadElements(nvrhi::IBuffer* buffer, const std::vector<uint32_t>& indices)
+    {
+        assert(indices.size() <= 4);
+
+        m_CommandList->open();
+        for (size_t i = 0; i < indices.size(); ++i)
+        {
+            m_CommandList->copyBuffer(m_ElementReadbackBuffer, i * sizeof(uint32_t),
+                buffer, uint64_t(indices[i]) * sizeof(uint32_t), sizeof(uint32_t));
+        }
+        m_CommandList->close();
+        m_Device->executeCommandList(m_CommandList);
+        m_Device->waitForIdle();
+
+        const uint32_t* data = static_cast<const uint32_t*>(m_Device->mapBuffer(m_ElementReadbackBuffer, nvrhi::CpuAccessMode::Read));
+        std::vector<uint32_t> values(data, data + indices.size());
+        m_Device->unmapBuffer(m_ElementReadbackBuffer);
+        return values;
+    }
+
+    void BenchmarkRunner::Run(uint64_t sizeBytes, std::vector<BenchmarkResult>& results)
+    {
+        CreateBuffers(sizeBytes);
+        sizeBytes = uint64_t(m_NumElements) * sizeof(uint32_t);
+
+        // Elements for checking the scan and copy outputs: first, last and one in the middle of a block
+        const uint32_t lastIndex = m_NumElements - 1;
+        const uint32_t middleIndex = std::min(m_NumElements / 2 + BENCHMARK_ELEMENTS_PER_GROUP / 3, lastIndex);
+        const uint32_t middlePrefixSum = std::accumulate(m_InputData.begin(), m_InputData.begin() + middleIndex + 1, 0u);
+        const uint32_t totalSum = std::accumulate(m_InputData.begin(), m_InputData.end(), 0u);
+
+        const auto clearOutput = [this](nvrhi::ICommandList* commandList)
+        {
+            commandList->clearBufferUInt(m_OutputBuffer, 0);
+        };
+
+        // Reduction
+        {
+            BenchmarkResult result = Measure("reduce", sizeBytes,
+                [this](nvrhi::ICommandList* commandList) { commandList->clearBufferUInt(m_AuxiliaryBuffer, 0); },
+                [this](nvrhi::ICommandList* commandList) { Dispatch(commandList, m_ReducePipeline, m_NumBlocks); });
+
+            std::vector<uint32_t> values = ReadElements(m_AuxiliaryBuffer, { 0 });
+            result.passed = values[0] == totalSum;
+            results.push_back(result);
+        }
+
+        // Inclusive prefix sum, which reads the input and writes the output at least once
+        {
+            BenchmarkResult result = Measure("scan", sizeBytes * 2, clearOutput,
+                [this](nvrhi::ICommandList* commandList)
+                {
+                    Dispatch(commandList, m_ScanBlocksPipeline, m_NumBlocks);
+                    Dispatch(commandList, m_ScanBlockSumsPipeline, 1);
+                    Dispatch(commandList, m_ScanAddPipeline, m_NumBlocks);
+                });
+
+            std::vector<uint32_t> values = ReadElements(m_OutputBuffer, { 0, middleIndex, lastIndex });
+            result.passed = values[0] == m_InputData[0] && values[1] == middlePrefixSum && values[2] == totalSum;
+            results.push_back(result);
+        }
+
+        // Device to device copies, through the shader cores and with the copy command
+        {
+            BenchmarkResult result = Measure("copy_shader", sizeBytes * 2, clearOutput,
+                [this](nvrhi::ICommandList* commandList) { Dispatch(commandList, m_CopyPipeline, m_NumBlocks); });
+
+            std::vector<uint32_t> values = ReadElements(m_OutputBuffer, { 0, middleIndex, lastIndex });
+            result.passed = values[0] == m_InputData[0] && values[1] == m_InputData[middleIndex] && values[2] == m_InputData[lastIndex];
+            results.push_back(result);
+        }
+        {
+            BenchmarkResult result = Measure("copy_engine", sizeBytes * 2, clearOutput,
+                [this, sizeBytes](nvrhi::ICommandList* commandList) { commandList->copyBuffer(m_OutputBuffer, 0, m_InputBuffer, 0, sizeBytes); });
+
+            std::vector<uint32_t> values = ReadElements(m_OutputBuffer, { 0, middleIndex, lastIndex });
+            result.passed = values[0] == m_InputData[0] && values[1] == m_InputData[middleIndex] && values[2] == m_InputData[lastIndex];
+            results.push_back(result);
+        }
+
+        // Transfers between the CPU-visible staging buffers and device memory, over PCIe on discrete GPUs
+        {
+            BenchmarkResult result = Measure("upload", sizeBytes, clearOutput,
+                [this, sizeBytes](nvrhi::ICommandList* commandList) { commandList->copyBuffer(m_OutputBuffer, 0, m_UploadBuffer, 0, sizeBytes); });
+
+            std::vector<uint32_t> values = ReadElements(m_OutputBuffer, { 0, middleIndex, lastIndex });
+            result.passed = values[0] == m_InputData[0] && values[1] == m_InputData[middleIndex] && values[2] == m_InputData[lastIndex];
+            results.push_back(result);
+        }
+        {
+            BenchmarkResult result = Measure("readback", sizeBytes, nullptr,
+                [this, sizeBytes](nvrhi::ICommandList* commandList) { commandList->copyBuffer(m_ReadbackBuffer, 0, m_InputBuffer, 0, sizeBytes); });
+
+            const void* data = m_Device->mapBuffer(m_ReadbackBuffer, nvrhi::CpuAccessMode::Read);
+            result.passed = data && memcmp(data, m_InputData.data(), sizeBytes) == 0;
+            m_Device->unmapBuffer(m_ReadbackBuffer);
+            results.push_back(result);
+        }
+    }
+
+    float GetBandwidthGBps(const BenchmarkResult& result)
+    {
+        return result.medianMs > 0.f ? float(double(result.bytesMoved) / (double(result.medianMs) * 1e6)) : 0.f;
+    }
+
+    std::string EscapeJsonString(const std::string& s)
+    {
+        std::string escaped;
+        for (char c : s)
+        {
+            if (c == '"' || c == '\\')
+                escaped += '\\';
+            escaped += c;
+        }
+        return escaped;
+    }
+
+    std::string EscapeCsvString(const std::string& s)
+    {
+        std::string escaped;
+        for (char c : s)
+        {
+            if (c == '"')
+                escaped += '"';
+            escaped += c;
+        }
+        return escaped;
+    }
+
+    void PrintCsv(const std::string& apiName, const std::string& adapterName, const std::vector<BenchmarkResult>& results)
+    {
+        const std::string adapter = EscapeCsvString(adapterName);
+        printf("api,adapter,test,size_bytes,iterations,min_ms,median_ms,mean_ms,bandwidth_gbps,passed\n");
+        for (const BenchmarkResult& result : results)
+        {
+            printf("%s,\"%s\",%s,%llu,%u,%.4f,%.4f,%.4f,%.2f,%d\n", apiName.c_str(), adapter.c_str(), result.test.c_str(),
+                (unsigned long long)result.sizeBytes, result.iterations, result.minMs, result.medianMs, result.meanMs, GetBandwidthGBps(result), result.passed ? 1 : 0);
+        }
+    }
+
+    void PrintJson(const std::string& apiName, const std::string& adapterName, const std::vector<BenchmarkResult>& results)
+    {
+        printf("{\n");
+        printf("  \"api\": \"%s\",\n", apiName.c_str());
+        printf("  \"adapter\": \"%s\",\n", EscapeJsonString(adapterName).c_str());
+        printf("  \"results\": [\n");
+        for (size_t i = 0; i < results.size(); ++i)
+        {
+            const BenchmarkResult& result = results[i];
+            printf("    { \"test\": \"%s\", \"sizeBytes\": %llu, \"iterations\": %u, \"minMs\": %.4f, \"medianMs\": %.4f, \"meanMs\": %.4f, "
+                "\"bandwidthGBps\": %.2f, \"passed\": %s }%s\n",
+                result.test.c_str(), (unsigned long long)result.sizeBytes, result.iterations, result.minMs, result.medianMs, result.meanMs,
+                GetBandwidthGBps(result), result.passed ? "true" : "false", i + 1 < results.size() ? "," : "");
+        }
+        printf("  ]\n");
+        printf("}\n");
+    }
+}
+
+bool RunBenchmarks(nvrhi::IDevice* device, const std::string& adapterName, const BenchmarkSettings& settings)
+{
+    if (settings.measuredIterations == 0)
+    {
+        log::error("The number of measured iterations must be at least 1");
+        return false;
+    }
+
+    BenchmarkRunner runner(device, settings);
+    if (!runner.Init())
+        return false;
+
+    std::vector<BenchmarkResult> results;
+    for (uint64_t sizeBytes : settings.bufferSizes)
+    {
+        if (sizeBytes < sizeof(uint32_t) || sizeBytes / sizeof(uint32_t) > UINT32_MAX)
+        {
+            log::error("Unsupported buffer size: %llu bytes", (unsigned long long)sizeBytes);
+            return false;
+        }
+
+        fprintf(stderr, "Running the tests on %llu byte buffers...\n", (unsigned long long)sizeBytes);
+        runner.Run(sizeBytes, results);
+    }
+
+    const std::string apiName = nvrhi::utils::GraphicsAPIToString(device->getGraphicsAPI());
+    if (settings.jsonOutput)
+        PrintJson(apiName, adapterName, results);
+    else
+        PrintCsv(apiName, adapterName, results);
+
+    bool allPassed = true;
+    for (const BenchmarkResult& result : results)
+    {
+        if (!result.passed)
+        {
+            log::error("Test '%s' on %llu byte buffers produced wrong results", result.test.c_str(), (unsigned long long)result.sizeBytes);
+            allPassed = false;
+        }
+    }
+
+    return allPassed;
+}
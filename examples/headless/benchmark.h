@@ -0,0 +1,41 @@
+/*
+* Copyright (c) 2023, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <nvrhi/nvrhi.h>
+#include <string>
+#include <vector>
+
+struct BenchmarkSettings
+{
+    std::vector<uint64_t> bufferSizes;  // Bytes, rounded down to whole uint's
+    uint32_t warmupIterations = 5;
+    uint32_t measuredIterations = 20;
+    bool jsonOutput = false;            // CSV otherwise
+};
+
+// Runs the compute and transfer throughput tests on every buffer size: reduction, prefix sum, shader and copy engine copies,
+// and upload and readback through staging buffers. Every iteration is timed with its own timer query.
+// The results are printed to stdout as CSV or JSON, everything else goes to stderr.
+// Returns false if the tests couldn't be set up or a result didn't match the one computed on the CPU.
+bool RunBenchmarks(nvrhi::IDevice* device, const std::string& adapterName, const BenchmarkSettings& settings);
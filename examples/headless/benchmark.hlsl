@@ -0,0 +1,177 @@
+/*
+* Copyright (c) 2023, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+#include "benchmark_cb.h"
+
+#ifdef SPIRV
+
+[[vk::push_constant]] ConstantBuffer<BenchmarkConstants> g_Const;
+
+#else
+
+cbuffer g_Const : register(b0)
+{
+    BenchmarkConstants g_Const;
+};
+#endif
+
+Buffer<uint> t_Input : register(t0);
+RWBuffer<uint> u_Output : register(u0);
+RWBuffer<uint> u_Auxiliary : register(u1); // Reduction result, or the sums of the scan blocks
+
+groupshared uint s_Data[BENCHMARK_GROUP_SIZE];
+
+uint GetGroupIndex(uint2 groupId)
+{
+    return groupId.y * g_Const.groupsX + groupId.x;
+}
+
+// Inclusive prefix sum over the values of the thread group, Hillis-Steele style
+uint GroupInclusiveScan(uint value, uint threadIdx)
+{
+    s_Data[threadIdx] = value;
+    GroupMemoryBarrierWithGroupSync();
+
+    for (uint offset = 1; offset < BENCHMARK_GROUP_SIZE; offset <<= 1)
+    {
+        uint other = threadIdx >= offset ? s_Data[threadIdx - offset] : 0;
+        GroupMemoryBarrierWithGroupSync();
+        value += other;
+        s_Data[threadIdx] = value;
+        GroupMemoryBarrierWithGroupSync();
+    }
+
+    return value;
+}
+
+// Adds all elements of the input buffer into u_Auxiliary[0]. Every group reduces one block of elements,
+// loaded with a stride of the group size so that neighbouring threads read neighbouring elements.
+[numthreads(BENCHMARK_GROUP_SIZE, 1, 1)]
+void reduce_main(uint threadIdx : SV_GroupThreadID, uint2 groupId : SV_GroupID)
+{
+    const uint blockStart = GetGroupIndex(groupId) * BENCHMARK_ELEMENTS_PER_GROUP;
+
+    uint sum = 0;
+    for (uint i = 0; i < BENCHMARK_ELEMENTS_PER_THREAD; i++)
+    {
+        uint index = blockStart + i * BENCHMARK_GROUP_SIZE + threadIdx;
+        if (index < g_Const.numElements)
+            sum += t_Input[index];
+    }
+
+    s_Data[threadIdx] = sum;
+    GroupMemoryBarrierWithGroupSync();
+
+    for (uint size = BENCHMARK_GROUP_SIZE / 2; size >= 1; size >>= 1)
+    {
+        if (threadIdx < size)
+            s_Data[threadIdx] += s_Data[threadIdx + size];
+
+        GroupMemoryBarrierWithGroupSync();
+    }
+
+    if (threadIdx == 0)
+        InterlockedAdd(u_Auxiliary[0], s_Data[0]);
+}
+
+// First pass of the prefix sum: the inclusive scan of every block, and the total of the block
+[numthreads(BENCHMARK_GROUP_SIZE, 1, 1)]
+void scan_blocks_main(uint threadIdx : SV_GroupThreadID, uint2 groupId : SV_GroupID)
+{
+    const uint blockIndex = GetGroupIndex(groupId);
+    if (blockIndex >= g_Const.numBlocks)
+        return;
+
+    // Every thread scans a run of consecutive elements on its own
+    const uint runStart = blockIndex * BENCHMARK_ELEMENTS_PER_GROUP + threadIdx * BENCHMARK_ELEMENTS_PER_THREAD;
+    uint values[BENCHMARK_ELEMENTS_PER_THREAD];
+    uint runSum = 0;
+    for (uint i = 0; i < BENCHMARK_ELEMENTS_PER_THREAD; i++)
+    {
+        uint index = runStart + i;
+        runSum += index < g_Const.numElements ? t_Input[index] : 0;
+        values[i] = runSum;
+    }
+
+    const uint runOffset = GroupInclusiveScan(runSum, threadIdx) - runSum;
+
+    for (uint j = 0; j < BENCHMARK_ELEMENTS_PER_THREAD; j++)
+    {
+        uint index = runStart + j;
+        if (index < g_Const.numElements)
+            u_Output[index] = values[j] + runOffset;
+    }
+
+    if (threadIdx == BENCHMARK_GROUP_SIZE - 1)
+        u_Auxiliary[blockIndex] = runOffset + runSum;
+}
+
+// Second pass: turns the block totals into exclusive block offsets, in chunks of one value per thread.
+// It runs as a single group, which is fine for the number of blocks in buffers of a few GB.
+[numthreads(BENCHMARK_GROUP_SIZE, 1, 1)]
+void scan_block_sums_main(uint threadIdx : SV_GroupThreadID)
+{
+    uint carry = 0;
+    for (uint chunkStart = 0; chunkStart < g_Const.numBlocks; chunkStart += BENCHMARK_GROUP_SIZE)
+    {
+        uint index = chunkStart + threadIdx;
+        uint value = index < g_Const.numBlocks ? u_Auxiliary[index] : 0;
+        uint inclusive = GroupInclusiveScan(value, threadIdx);
+
+        if (index < g_Const.numBlocks)
+            u_Auxiliary[index] = carry + inclusive - value;
+
+        carry += s_Data[BENCHMARK_GROUP_SIZE - 1];
+        GroupMemoryBarrierWithGroupSync();
+    }
+}
+
+// Third pass: adds the offset of its block to every element
+[numthreads(BENCHMARK_GROUP_SIZE, 1, 1)]
+void scan_add_main(uint threadIdx : SV_GroupThreadID, uint2 groupId : SV_GroupID)
+{
+    const uint blockIndex = GetGroupIndex(groupId);
+    if (blockIndex == 0 || blockIndex >= g_Const.numBlocks)
+        return;
+
+    const uint blockOffset = u_Auxiliary[blockIndex];
+    for (uint i = 0; i < BENCHMARK_ELEMENTS_PER_THREAD; i++)
+    {
+        uint index = blockIndex * BENCHMARK_ELEMENTS_PER_GROUP + i * BENCHMARK_GROUP_SIZE + threadIdx;
+        if (index < g_Const.numElements)
+            u_Output[index] += blockOffset;
+    }
+}
+
+// Buffer to buffer copy through the shader cores, for comparison with the copy engine
+[numthreads(BENCHMARK_GROUP_SIZE, 1, 1)]
+void copy_main(uint threadIdx : SV_GroupThreadID, uint2 groupId : SV_GroupID)
+{
+    const uint blockStart = GetGroupIndex(groupId) * BENCHMARK_ELEMENTS_PER_GROUP;
+
+    for (uint i = 0; i < BENCHMARK_ELEMENTS_PER_THREAD; i++)
+    {
+        uint index = blockStart + i * BENCHMARK_GROUP_SIZE + threadIdx;
+        if (index < g_Const.numElements)
+            u_Output[index] = t_Input[index];
+    }
+}
@@ -0,0 +1,41 @@
+/*
+* Copyright (c) 2023, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef BENCHMARK_CB_H
+#define BENCHMARK_CB_H
+
+#define BENCHMARK_GROUP_SIZE            256
+#define BENCHMARK_ELEMENTS_PER_THREAD   4
+#define BENCHMARK_ELEMENTS_PER_GROUP    (BENCHMARK_GROUP_SIZE * BENCHMARK_ELEMENTS_PER_THREAD)
+
+// Large dispatches are split into rows of this many groups to stay under the API limit on the X dimension
+#define BENCHMARK_MAX_GROUPS_X          32768
+
+struct BenchmarkConstants
+{
+    uint numElements;
+    uint groupsX;       // Number of groups in one row of the dispatch
+    uint numBlocks;     // Number of BENCHMARK_ELEMENTS_PER_GROUP sized blocks in the scan
+    uint padding;
+};
+
+#endif // BENCHMARK_CB_H
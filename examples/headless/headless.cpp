@@ -27,6 +27,10 @@
 #include <donut/core/vfs/VFS.h>
 #include <nvrhi/utils.h>
 
+#include <sstream>
+
+#include "benchmark.h"
+
 using namespace donut;
 
 bool RunTest(nvrhi::IDevice* device)
@@ -165,6 +169,10 @@ int main(int argc, const char** argv)
     deviceParams.enableDebugRuntime = true; 
     deviceParams.enableNvrhiValidationLayer = true;
 #endif
+
+    bool runBenchmarks = false;
+    BenchmarkSettings benchmarkSettings;
+    benchmarkSettings.bufferSizes = { 1ull << 20, 16ull << 20, 256ull << 20 };
     
     for (int i = 1; i < argc; ++i)
     {
@@ -175,7 +183,12 @@ int main(int argc, const char** argv)
                 " -dx12            Use DX12 API (default)\n"
                 " -vk              Use Vulkan API\n"
                 " --list-adapters  Enumerate the graphics adapters present in the system\n"
-                " --adapter <n>    Use graphics adapter with index <n> as reported by --list-adapters\n",
+                " --adapter <n>    Use graphics adapter with index <n> as reported by --list-adapters\n"
+                " --benchmark      Run the compute and transfer throughput tests instead of the reduction test\n"
+                " --sizes <list>   Comma separated buffer sizes in KB for the benchmark (default: 1024,16384,262144)\n"
+                " --warmup <n>     Number of untimed iterations of every benchmark test (default: 5)\n"
+                " --iterations <n> Number of timed iterations of every benchmark test (default: 20)\n"
+                " --json           Print the benchmark results as JSON instead of CSV\n",
                 argv[0]);
             return 0;
         }
@@ -212,6 +225,62 @@ int main(int argc, const char** argv)
             deviceParams.adapterIndex = atoi(argv[i + 1]);
             ++i;
         }
+        else if (strcmp(argv[i], "--benchmark") == 0)
+        {
+            runBenchmarks = true;
+        }
+        else if (strcmp(argv[i], "--sizes") == 0)
+        {
+            if (i + 1 >= argc)
+            {
+                log::error("--sizes requires a parameter");
+                return 1;
+            }
+            benchmarkSettings.bufferSizes.clear();
+            std::stringstream sizes(argv[i + 1]);
+            std::string size;
+            while (std::getline(sizes, size, ','))
+            {
+                char* end = nullptr;
+                const unsigned long long sizeKB = strtoull(size.c_str(), &end, 10);
+                if (size.empty() || *end != 0 || sizeKB == 0)
+                {
+                    log::error("--sizes expects a comma separated list of positive sizes in KB, got '%s'", size.c_str());
+                    return 1;
+                }
+                benchmarkSettings.bufferSizes.push_back(uint64_t(sizeKB) * 1024);
+            }
+            if (benchmarkSettings.bufferSizes.empty())
+            {
+                log::error("--sizes requires at least one size");
+                return 1;
+            }
+            ++i;
+        }
+        else if (strcmp(argv[i], "--warmup") == 0)
+        {
+            if (i + 1 >= argc)
+            {
+                log::error("--warmup requires a parameter");
+                return 1;
+            }
+            benchmarkSettings.warmupIterations = uint32_t(atoi(argv[i + 1]));
+            ++i;
+        }
+        else if (strcmp(argv[i], "--iterations") == 0)
+        {
+            if (i + 1 >= argc)
+            {
+                log::error("--iterations requires a parameter");
+                return 1;
+            }
+            benchmarkSettings.measuredIterations = uint32_t(atoi(argv[i + 1]));
+            ++i;
+        }
+        else if (strcmp(argv[i], "--json") == 0)
+        {
+            benchmarkSettings.jsonOutput = true;
+        }
     }
     
     if (!deviceManager->CreateHeadlessDevice(deviceParams))
@@ -220,10 +289,21 @@ int main(int argc, const char** argv)
         return 1;
     }
 
-    printf("Using %s API with %s.\n", nvrhi::utils::GraphicsAPIToString(api), deviceManager->GetRendererString());
-    
-    if (!RunTest(deviceManager->GetDevice()))
-        return 1;
+    if (runBenchmarks)
+    {
+        // Keep stdout machine-readable
+        fprintf(stderr, "Using %s API with %s.\n", nvrhi::utils::GraphicsAPIToString(api), deviceManager->GetRendererString());
+
+        if (!RunBenchmarks(deviceManager->GetDevice(), deviceManager->GetRendererString(), benchmarkSettings))
+            return 1;
+    }
+    else
+    {
+        printf("Using %s API with %s.\n", nvrhi::utils::GraphicsAPIToString(api), deviceManager->GetRendererString());
+
+        if (!RunTest(deviceManager->GetDevice()))
+            return 1;
+    }
 
     deviceManager->Shutdown();
 
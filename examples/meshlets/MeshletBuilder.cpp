@@ -0,0 +1,242 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+#include "MeshletBuilder.h"
+
+#include <donut/engine/SceneGraph.h>
+#include <donut/engine/SceneTypes.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+using namespace donut;
+using namespace donut::math;
+
+#include "meshlets_cb.h"
+
+static float3 UnpackNormal(uint32_t packed)
+{
+    float3 normal;
+    for (int component = 0; component < 3; component++)
+        normal[component] = std::max(float(int8_t(uint8_t(packed >> (component * 8)))) / 127.f, -1.f);
+    return normal;
+}
+
+void MeshletBuilder::BuildSceneMeshlets(const engine::SceneGraph& sceneGraph)
+{
+    m_Meshlets.clear();
+    m_Vertices.clear();
+    m_Primitives.clear();
+    m_GeometryRanges.clear();
+
+    for (const auto& mesh : sceneGraph.GetMeshes())
+    {
+        const auto& buffers = mesh->buffers;
+        if (!buffers)
+            continue;
+
+        for (const auto& geometry : mesh->geometries)
+        {
+            const size_t firstIndex = mesh->indexOffset + geometry->indexOffsetInMesh;
+            const size_t firstVertex = mesh->vertexOffset + geometry->vertexOffsetInMesh;
+
+            // Skinned and procedural meshes don't keep their data on the CPU
+            if (buffers->indexData.size() < firstIndex + geometry->numIndices ||
+                buffers->positionData.size() < firstVertex + geometry->numVertices)
+                continue;
+
+            const uint32_t* normals = buffers->normalData.size() >= firstVertex + geometry->numVertices
+                ? buffers->normalData.data() + firstVertex
+                : nullptr;
+
+            m_GeometryRanges[geometry.get()] = BuildGeometryMeshlets(
+                buffers->indexData.data() + firstIndex, geometry->numIndices,
+                buffers->positionData.data() + firstVertex, normals, geometry->numVertices);
+        }
+    }
+}
+
+const MeshletRange* MeshletBuilder::GetMeshletRange(const engine::MeshGeometry* geometry) const
+{
+    auto it = m_GeometryRanges.find(geometry);
+    if (it == m_GeometryRanges.end() || it->second.numMeshlets == 0)
+        return nullptr;
+
+    return &it->second;
+}
+
+MeshletRange MeshletBuilder::BuildGeometryMeshlets(const uint32_t* indices, uint32_t numIndices,
+    const float3* positions, const uint32_t* normals, uint32_t numVertices)
+{
+    MeshletRange range;
+    range.firstMeshlet = uint32_t(m_Meshlets.size());
+
+    m_VertexToLocal.assign(numVertices, -1);
+
+    MeshletInfo meshlet = {};
+    meshlet.vertexOffset = uint32_t(m_Vertices.size());
+    meshlet.primitiveOffset = uint32_t(m_Primitives.size());
+
+    for (uint32_t index = 0; index + 2 < numIndices; index += 3)
+    {
+        const uint32_t* triangle = indices + index;
+        if (triangle[0] >= numVertices || triangle[1] >= numVertices || triangle[2] >= numVertices)
+            continue;
+
+        uint32_t newVertices = 0;
+        for (uint32_t corner = 0; corner < 3; corner++)
+        {
+            const bool repeated = (corner > 0 && triangle[corner] == triangle[0]) || (corner > 1 && triangle[corner] == triangle[1]);
+            if (!repeated && m_VertexToLocal[triangle[corner]] < 0)
+                ++newVertices;
+        }
+
+        if (meshlet.vertexCount + newVertices > MESHLET_MAX_VERTICES || meshlet.primitiveCount == MESHLET_MAX_PRIMITIVES)
+        {
+            FinishMeshlet(meshlet, positions, normals);
+
+            // Vertices shared with the finished meshlet must be added again to the next one
+            for (uint32_t i = 0; i < meshlet.vertexCount; i++)
+                m_VertexToLocal[m_Vertices[meshlet.vertexOffset + i]] = -1;
+
+            meshlet = MeshletInfo();
+            meshlet.vertexOffset = uint32_t(m_Vertices.size());
+            meshlet.primitiveOffset = uint32_t(m_Primitives.size());
+        }
+
+        uint32_t packedTriangle = 0;
+        for (uint32_t corner = 0; corner < 3; corner++)
+        {
+            int& localIndex = m_VertexToLocal[triangle[corner]];
+            if (localIndex < 0)
+            {
+                localIndex = int(meshlet.vertexCount++);
+                m_Vertices.push_back(triangle[corner]);
+            }
+            assert(uint32_t(localIndex) < meshlet.vertexCount);
+            packedTriangle |= uint32_t(localIndex) << (corner * 8);
+        }
+
+        m_Primitives.push_back(packedTriangle);
+        ++meshlet.primitiveCount;
+    }
+
+    if (meshlet.primitiveCount > 0)
+        FinishMeshlet(meshlet, positions, normals);
+
+    range.numMeshlets = uint32_t(m_Meshlets.size()) - range.firstMeshlet;
+    return range;
+}
+
+void MeshletBuilder::FinishMeshlet(MeshletInfo& meshlet, const float3* positions, const uint32_t* normals)
+{
+    const uint32_t* vertices = m_Vertices.data() + meshlet.vertexOffset;
+    const uint32_t* primitives = m_Primitives.data() + meshlet.primitiveOffset;
+
+    // Ritter's bounding sphere: start with the sphere through two distant vertices and grow it to include the rest
+    auto findFarthest = [positions, vertices, &meshlet](const float3& from)
+    {
+        float3 farthest = from;
+        float maxDistance = -1.f;
+        for (uint32_t i = 0; i < meshlet.vertexCount; i++)
+        {
+            const float distance = lengthSquared(positions[vertices[i]] - from);
+            if (distance > maxDistance)
+            {
+                maxDistance = distance;
+                farthest = positions[vertices[i]];
+            }
+        }
+        return farthest;
+    };
+
+    const float3 a = findFarthest(positions[vertices[0]]);
+    const float3 b = findFarthest(a);
+    float3 center = (a + b) * 0.5f;
+    float radius = length(a - b) * 0.5f;
+
+    for (uint32_t i = 0; i < meshlet.vertexCount; i++)
+    {
+        const float3 position = positions[vertices[i]];
+        const float distance = length(position - center);
+        if (distance > radius)
+        {
+            const float newRadius = (radius + distance) * 0.5f;
+            center += (position - center) * ((newRadius - radius) / distance);
+            radius = newRadius;
+        }
+    }
+
+    meshlet.center = center;
+    meshlet.radius = radius;
+
+    // Normal cone. The face normals are oriented by the vertex normals, so the cone doesn't depend on the winding convention.
+    // Without vertex normals, the front side of the triangles is unknown and the meshlet is never cone culled.
+    meshlet.coneAxis = float3(0.f, 0.f, 1.f);
+    meshlet.coneCutoff = 1.f;
+
+    if (!normals)
+    {
+        m_Meshlets.push_back(meshlet);
+        return;
+    }
+
+    m_FaceNormals.clear();
+    float3 normalSum = 0.f;
+    for (uint32_t i = 0; i < meshlet.primitiveCount; i++)
+    {
+        const uint32_t i0 = vertices[primitives[i] & 0xff];
+        const uint32_t i1 = vertices[(primitives[i] >> 8) & 0xff];
+        const uint32_t i2 = vertices[(primitives[i] >> 16) & 0xff];
+
+        float3 faceNormal = cross(positions[i1] - positions[i0], positions[i2] - positions[i0]);
+        const float faceNormalLength = length(faceNormal);
+        if (faceNormalLength <= 0.f)
+            continue;
+
+        faceNormal /= faceNormalLength;
+        if (dot(faceNormal, UnpackNormal(normals[i0]) + UnpackNormal(normals[i1]) + UnpackNormal(normals[i2])) < 0.f)
+            faceNormal = -faceNormal;
+
+        m_FaceNormals.push_back(faceNormal);
+        normalSum += faceNormal;
+    }
+
+    const float normalSumLength = length(normalSum);
+    if (m_FaceNormals.empty() || normalSumLength < 1e-6f)
+    {
+        m_Meshlets.push_back(meshlet);
+        return;
+    }
+
+    const float3 axis = normalSum / normalSumLength;
+    float minDot = 1.f;
+    for (const float3& faceNormal : m_FaceNormals)
+        minDot = std::min(minDot, dot(axis, faceNormal));
+
+    // Cones wider than ~84 degrees cull almost nothing
+    meshlet.coneAxis = axis;
+    meshlet.coneCutoff = minDot <= 0.1f ? 1.f : sqrtf(1.f - minDot * minDot);
+
+    m_Meshlets.push_back(meshlet);
+}
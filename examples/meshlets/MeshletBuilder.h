@@ -0,0 +1,76 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <donut/core/math/math.h>
+
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+struct MeshletInfo;
+
+namespace donut::engine
+{
+    struct MeshGeometry;
+    class SceneGraph;
+}
+
+struct MeshletRange
+{
+    uint32_t firstMeshlet = 0;
+    uint32_t numMeshlets = 0;
+};
+
+// Splits the geometries of a scene into meshlets of at most MESHLET_MAX_VERTICES vertices and MESHLET_MAX_PRIMITIVES triangles,
+// and computes a bounding sphere and a normal cone for every meshlet.
+// The triangles are added in index buffer order, so the meshlets are only as compact as the index order of the source mesh.
+class MeshletBuilder
+{
+public:
+    // Builds the meshlets for every mesh of the scene graph that has its index and position data on the CPU.
+    void BuildSceneMeshlets(const donut::engine::SceneGraph& sceneGraph);
+
+    // Returns nullptr for geometries that have no meshlets
+    [[nodiscard]] const MeshletRange* GetMeshletRange(const donut::engine::MeshGeometry* geometry) const;
+
+    [[nodiscard]] const std::vector<MeshletInfo>& GetMeshlets() const { return m_Meshlets; }
+    [[nodiscard]] const std::vector<uint32_t>& GetMeshletVertices() const { return m_Vertices; }
+    [[nodiscard]] const std::vector<uint32_t>& GetMeshletPrimitives() const { return m_Primitives; }
+    [[nodiscard]] size_t GetNumTriangles() const { return m_Primitives.size(); }
+
+private:
+    std::vector<MeshletInfo> m_Meshlets;
+    std::vector<uint32_t> m_Vertices;   // Vertex indices relative to the start of the geometry
+    std::vector<uint32_t> m_Primitives; // Three 8-bit meshlet-local vertex indices per triangle
+    std::unordered_map<const donut::engine::MeshGeometry*, MeshletRange> m_GeometryRanges;
+
+    // Scratch data: the local index of every geometry vertex in the meshlet being built or -1, and the meshlet's face normals
+    std::vector<int> m_VertexToLocal;
+    std::vector<donut::math::float3> m_FaceNormals;
+
+    MeshletRange BuildGeometryMeshlets(const uint32_t* indices, uint32_t numIndices,
+        const donut::math::float3* positions, const uint32_t* normals, uint32_t numVertices);
+
+    void FinishMeshlet(MeshletInfo& meshlet, const donut::math::float3* positions, const uint32_t* normals);
+};
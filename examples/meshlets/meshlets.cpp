@@ -21,61 +21,319 @@
 */
 
 #include <donut/app/ApplicationBase.h>
+#include <donut/app/Camera.h>
 #include <donut/engine/ShaderFactory.h>
+#include <donut/engine/CommonRenderPasses.h>
+#include <donut/engine/TextureCache.h>
+#include <donut/engine/Scene.h>
+#include <donut/engine/DescriptorTableManager.h>
 #include <donut/app/DeviceManager.h>
 #include <donut/core/log.h>
 #include <donut/core/vfs/VFS.h>
+#include <donut/core/math/math.h>
 #include <nvrhi/utils.h>
 
+#include <array>
+#include <cmath>
+
 using namespace donut;
+using namespace donut::math;
+
+#include "meshlets_cb.h"
+#include "MeshletBuilder.h"
 
 static const char* g_WindowTitle = "Donut Example: Meshlets";
 
-class MeshletExample : public app::IRenderPass
+// Readback latency of the culling statistics, in frames
+static constexpr uint32_t c_StatisticsQueueSize = 4;
+
+// Extracts the world-space frustum planes from a row-vector world-to-clip matrix with a [0, 1] depth range.
+// Planes at infinity, like the far plane of an infinite projection, become planes that everything is inside of.
+static void GetFrustumPlanes(const float4x4& worldToClip, float4 planes[6])
+{
+    auto column = [&worldToClip](int c) { return float4(worldToClip[0][c], worldToClip[1][c], worldToClip[2][c], worldToClip[3][c]); };
+
+    const float4 x = column(0);
+    const float4 y = column(1);
+    const float4 z = column(2);
+    const float4 w = column(3);
+
+    planes[0] = w + x;
+    planes[1] = w - x;
+    planes[2] = w + y;
+    planes[3] = w - y;
+    planes[4] = z;
+    planes[5] = w - z;
+
+    for (int i = 0; i < 6; i++)
+    {
+        const float normalLength = length(planes[i].xyz());
+        planes[i] = normalLength > 1e-6f ? planes[i] / normalLength : float4(0.f, 0.f, 0.f, 1.f);
+    }
+}
+
+class MeshletExample : public app::ApplicationBase
 {
 private:
+    std::shared_ptr<vfs::RootFileSystem> m_RootFS;
+
     nvrhi::ShaderHandle m_AmplificationShader;
     nvrhi::ShaderHandle m_MeshShader;
     nvrhi::ShaderHandle m_PixelShader;
+    nvrhi::BindingLayoutHandle m_BindingLayout;
+    nvrhi::BindingLayoutHandle m_BindlessLayout;
+    nvrhi::BindingSetHandle m_BindingSet;
     nvrhi::MeshletPipelineHandle m_Pipeline;
+    nvrhi::MeshletPipelineHandle m_DoubleSidedPipeline;
     nvrhi::CommandListHandle m_CommandList;
 
-public:
-    using IRenderPass::IRenderPass;
+    nvrhi::BufferHandle m_ConstantBuffer;
+    nvrhi::BufferHandle m_MeshletBuffer;
+    nvrhi::BufferHandle m_MeshletVertexBuffer;
+    nvrhi::BufferHandle m_MeshletPrimitiveBuffer;
+    nvrhi::BufferHandle m_StatisticsBuffer;
 
-    bool Init()
+    struct StatisticsReadback
     {
-        auto nativeFS = std::make_shared<vfs::NativeFileSystem>();
+        nvrhi::BufferHandle buffer;
+        nvrhi::EventQueryHandle query;
+        bool pending = false;
+    };
+    std::array<StatisticsReadback, c_StatisticsQueueSize> m_StatisticsReadback;
+    uint32_t m_StatisticsIndex = 0;
+    uint32_t m_VisibleMeshlets = 0;
+    uint32_t m_VisibleTriangles = 0;
 
+    std::shared_ptr<engine::ShaderFactory> m_ShaderFactory;
+    std::unique_ptr<engine::Scene> m_Scene;
+    std::shared_ptr<engine::DescriptorTableManager> m_DescriptorTableManager;
+    MeshletBuilder m_MeshletBuilder;
+
+    app::FirstPersonCamera m_Camera;
+    engine::PlanarView m_View;
+
+    bool m_FrustumCulling = true;
+    bool m_ConeCulling = true;
+    bool m_ShowMeshlets = false;
+
+public:
+    using ApplicationBase::ApplicationBase;
+
+    bool Init(const std::filesystem::path& sceneFileName)
+    {
+        std::filesystem::path frameworkShaderPath = app::GetDirectoryWithExecutable() / "shaders/framework" / app::GetShaderTypeName(GetDevice()->getGraphicsAPI());
         std::filesystem::path appShaderPath = app::GetDirectoryWithExecutable() / "shaders/meshlets" / app::GetShaderTypeName(GetDevice()->getGraphicsAPI());
 
-        engine::ShaderFactory shaderFactory(GetDevice(), nativeFS, appShaderPath);
-        m_AmplificationShader = shaderFactory.CreateShader("shaders.hlsl", "main_as", nullptr, nvrhi::ShaderType::Amplification);
-        m_MeshShader = shaderFactory.CreateShader("shaders.hlsl", "main_ms", nullptr, nvrhi::ShaderType::Mesh);
-        m_PixelShader = shaderFactory.CreateShader("shaders.hlsl", "main_ps", nullptr, nvrhi::ShaderType::Pixel);
+        m_RootFS = std::make_shared<vfs::RootFileSystem>();
+        m_RootFS->mount("/shaders/donut", frameworkShaderPath);
+        m_RootFS->mount("/shaders/app", appShaderPath);
+
+        m_ShaderFactory = std::make_shared<engine::ShaderFactory>(GetDevice(), m_RootFS, "/shaders");
+        m_CommonPasses = std::make_shared<engine::CommonRenderPasses>(GetDevice(), m_ShaderFactory);
+
+        m_AmplificationShader = m_ShaderFactory->CreateShader("/shaders/app/shaders.hlsl", "main_as", nullptr, nvrhi::ShaderType::Amplification);
+        m_MeshShader = m_ShaderFactory->CreateShader("/shaders/app/shaders.hlsl", "main_ms", nullptr, nvrhi::ShaderType::Mesh);
+        m_PixelShader = m_ShaderFactory->CreateShader("/shaders/app/shaders.hlsl", "main_ps", nullptr, nvrhi::ShaderType::Pixel);
 
         if (!m_AmplificationShader || !m_MeshShader || !m_PixelShader)
         {
             return false;
         }
-        
+
+        nvrhi::BindlessLayoutDesc bindlessLayoutDesc;
+        bindlessLayoutDesc.visibility = nvrhi::ShaderType::All;
+        bindlessLayoutDesc.firstSlot = 0;
+        bindlessLayoutDesc.maxCapacity = 1024;
+        bindlessLayoutDesc.registerSpaces = {
+            nvrhi::BindingLayoutItem::RawBuffer_SRV(1),
+            nvrhi::BindingLayoutItem::Texture_SRV(2)
+        };
+        m_BindlessLayout = GetDevice()->createBindlessLayout(bindlessLayoutDesc);
+
+        m_DescriptorTableManager = std::make_shared<engine::DescriptorTableManager>(GetDevice(), m_BindlessLayout);
+
+        auto nativeFS = std::make_shared<vfs::NativeFileSystem>();
+        m_TextureCache = std::make_shared<engine::TextureCache>(GetDevice(), nativeFS, m_DescriptorTableManager);
+
         m_CommandList = GetDevice()->createCommandList();
 
+        SetAsynchronousLoadingEnabled(false);
+        BeginLoadingScene(nativeFS, sceneFileName);
+
+        if (!m_Scene)
+            return false;
+
+        m_Scene->FinishedLoading(GetFrameIndex());
+
+        m_Camera.LookAt(float3(0.f, 1.8f, 0.f), float3(1.f, 1.8f, 0.f));
+        m_Camera.SetMoveSpeed(3.f);
+
+        m_MeshletBuilder.BuildSceneMeshlets(*m_Scene->GetSceneGraph());
+        if (m_MeshletBuilder.GetMeshlets().empty())
+        {
+            log::error("The scene has no geometry that meshlets can be built from");
+            return false;
+        }
+
+        log::info("Built %d meshlets for %d triangles, %.1f triangles and %.1f vertices per meshlet",
+            int(m_MeshletBuilder.GetMeshlets().size()), int(m_MeshletBuilder.GetNumTriangles()),
+            float(m_MeshletBuilder.GetNumTriangles()) / float(m_MeshletBuilder.GetMeshlets().size()),
+            float(m_MeshletBuilder.GetMeshletVertices().size()) / float(m_MeshletBuilder.GetMeshlets().size()));
+
+        CreateMeshletBuffers();
+
+        m_ConstantBuffer = GetDevice()->createBuffer(nvrhi::utils::CreateVolatileConstantBufferDesc(sizeof(MeshletConstants), "MeshletConstants", engine::c_MaxRenderPassConstantBufferVersions));
+
+        GetDevice()->waitForIdle();
+
+        nvrhi::BindingSetDesc bindingSetDesc;
+        bindingSetDesc.bindings = {
+            nvrhi::BindingSetItem::ConstantBuffer(0, m_ConstantBuffer),
+            nvrhi::BindingSetItem::PushConstants(1, sizeof(MeshletDrawConstants)),
+            nvrhi::BindingSetItem::StructuredBuffer_SRV(0, m_Scene->GetInstanceBuffer()),
+            nvrhi::BindingSetItem::StructuredBuffer_SRV(1, m_Scene->GetGeometryBuffer()),
+            nvrhi::BindingSetItem::StructuredBuffer_SRV(2, m_Scene->GetMaterialBuffer()),
+            nvrhi::BindingSetItem::StructuredBuffer_SRV(3, m_MeshletBuffer),
+            nvrhi::BindingSetItem::StructuredBuffer_SRV(4, m_MeshletVertexBuffer),
+            nvrhi::BindingSetItem::StructuredBuffer_SRV(5, m_MeshletPrimitiveBuffer),
+            nvrhi::BindingSetItem::RawBuffer_UAV(0, m_StatisticsBuffer),
+            nvrhi::BindingSetItem::Sampler(0, m_CommonPasses->m_AnisotropicWrapSampler)
+        };
+        nvrhi::utils::CreateBindingSetAndLayout(GetDevice(), nvrhi::ShaderType::All, 0, bindingSetDesc, m_BindingLayout, m_BindingSet);
+
         return true;
     }
-    
+
+    void CreateMeshletBuffers()
+    {
+        auto createBuffer = [this](const void* data, size_t count, size_t stride, const char* name)
+        {
+            nvrhi::BufferDesc bufferDesc;
+            bufferDesc.byteSize = count * stride;
+            bufferDesc.structStride = uint32_t(stride);
+            bufferDesc.debugName = name;
+            bufferDesc.initialState = nvrhi::ResourceStates::ShaderResource;
+            bufferDesc.keepInitialState = true;
+            nvrhi::BufferHandle buffer = GetDevice()->createBuffer(bufferDesc);
+
+            m_CommandList->writeBuffer(buffer, data, count * stride);
+            return buffer;
+        };
+
+        m_CommandList->open();
+
+        m_MeshletBuffer = createBuffer(m_MeshletBuilder.GetMeshlets().data(), m_MeshletBuilder.GetMeshlets().size(), sizeof(MeshletInfo), "Meshlets");
+        m_MeshletVertexBuffer = createBuffer(m_MeshletBuilder.GetMeshletVertices().data(), m_MeshletBuilder.GetMeshletVertices().size(), sizeof(uint32_t), "MeshletVertices");
+        m_MeshletPrimitiveBuffer = createBuffer(m_MeshletBuilder.GetMeshletPrimitives().data(), m_MeshletBuilder.GetMeshletPrimitives().size(), sizeof(uint32_t), "MeshletPrimitives");
+
+        m_CommandList->close();
+        GetDevice()->executeCommandList(m_CommandList);
+
+        nvrhi::BufferDesc statisticsDesc;
+        statisticsDesc.byteSize = sizeof(uint32_t) * 2;
+        statisticsDesc.canHaveUAVs = true;
+        statisticsDesc.canHaveRawViews = true;
+        statisticsDesc.debugName = "MeshletStatistics";
+        statisticsDesc.initialState = nvrhi::ResourceStates::UnorderedAccess;
+        statisticsDesc.keepInitialState = true;
+        m_StatisticsBuffer = GetDevice()->createBuffer(statisticsDesc);
+
+        for (StatisticsReadback& readback : m_StatisticsReadback)
+        {
+            nvrhi::BufferDesc readbackDesc;
+            readbackDesc.byteSize = statisticsDesc.byteSize;
+            readbackDesc.cpuAccess = nvrhi::CpuAccessMode::Read;
+            readbackDesc.debugName = "MeshletStatisticsReadback";
+            readbackDesc.initialState = nvrhi::ResourceStates::CopyDest;
+            readbackDesc.keepInitialState = true;
+            readback.buffer = GetDevice()->createBuffer(readbackDesc);
+            readback.query = GetDevice()->createEventQuery();
+        }
+    }
+
+    bool LoadScene(std::shared_ptr<vfs::IFileSystem> fs, const std::filesystem::path& sceneFileName) override
+    {
+        std::unique_ptr<engine::Scene> scene = std::make_unique<engine::Scene>(GetDevice(),
+            *m_ShaderFactory, fs, m_TextureCache, m_DescriptorTableManager, nullptr);
+
+        if (scene->Load(sceneFileName))
+        {
+            m_Scene = std::move(scene);
+            return true;
+        }
+
+        return false;
+    }
+
+    bool KeyboardUpdate(int key, int scancode, int action, int mods) override
+    {
+        if (action == GLFW_PRESS)
+        {
+            switch (key)
+            {
+            case GLFW_KEY_F: m_FrustumCulling = !m_FrustumCulling; break;
+            case GLFW_KEY_C: m_ConeCulling = !m_ConeCulling; break;
+            case GLFW_KEY_M: m_ShowMeshlets = !m_ShowMeshlets; break;
+            default: break;
+            }
+        }
+
+        m_Camera.KeyboardUpdate(key, scancode, action, mods);
+        return true;
+    }
+
+    bool MousePosUpdate(double xpos, double ypos) override
+    {
+        m_Camera.MousePosUpdate(xpos, ypos);
+        return true;
+    }
+
+    bool MouseButtonUpdate(int button, int action, int mods) override
+    {
+        m_Camera.MouseButtonUpdate(button, action, mods);
+        return true;
+    }
+
     void Animate(float fElapsedTimeSeconds) override
     {
-        GetDeviceManager()->SetInformativeWindowTitle(g_WindowTitle);
+        m_Camera.Animate(fElapsedTimeSeconds);
+
+        char extraInfo[128];
+        snprintf(extraInfo, std::size(extraInfo), "%d/%d meshlets, %.2fM triangles, frustum (F) %s, cone (C) %s",
+            m_VisibleMeshlets, int(m_MeshletBuilder.GetMeshlets().size()), float(m_VisibleTriangles) * 1e-6f,
+            m_FrustumCulling ? "on" : "off", m_ConeCulling ? "on" : "off");
+        GetDeviceManager()->SetInformativeWindowTitle(g_WindowTitle, extraInfo);
     }
 
     void BackBufferResizing() override
     { 
         m_Pipeline = nullptr;
+        m_DoubleSidedPipeline = nullptr;
+    }
+
+    // Reads the statistics of the oldest frame in the queue if the GPU has finished it, without waiting
+    void ReadStatistics()
+    {
+        StatisticsReadback& readback = m_StatisticsReadback[m_StatisticsIndex];
+        if (!readback.pending || !GetDevice()->pollEventQuery(readback.query))
+            return;
+
+        const uint32_t* statistics = static_cast<const uint32_t*>(GetDevice()->mapBuffer(readback.buffer, nvrhi::CpuAccessMode::Read));
+        if (statistics)
+        {
+            m_VisibleMeshlets = statistics[0];
+            m_VisibleTriangles = statistics[1];
+            GetDevice()->unmapBuffer(readback.buffer);
+        }
+
+        GetDevice()->resetEventQuery(readback.query);
+        readback.pending = false;
     }
 
     void Render(nvrhi::IFramebuffer* framebuffer) override
     {
+        const auto& fbinfo = framebuffer->getFramebufferInfo();
+
         if (!m_Pipeline)
         {
             nvrhi::MeshletPipelineDesc psoDesc;
@@ -83,28 +341,105 @@ public:
             psoDesc.MS = m_MeshShader;
             psoDesc.PS = m_PixelShader;
             psoDesc.primType = nvrhi::PrimitiveType::TriangleList;
-            psoDesc.renderState.depthStencilState.depthTestEnable = false;
+            psoDesc.bindingLayouts = { m_BindingLayout, m_BindlessLayout };
+            psoDesc.renderState.depthStencilState.depthTestEnable = true;
+            psoDesc.renderState.depthStencilState.depthFunc = nvrhi::ComparisonFunc::GreaterOrEqual;
+            psoDesc.renderState.rasterState.frontCounterClockwise = true;
+            psoDesc.renderState.rasterState.setCullBack();
+            m_Pipeline = GetDevice()->createMeshletPipeline(psoDesc, fbinfo);
 
-            m_Pipeline = GetDevice()->createMeshletPipeline(psoDesc, framebuffer->getFramebufferInfo());
+            psoDesc.renderState.rasterState.setCullNone();
+            m_DoubleSidedPipeline = GetDevice()->createMeshletPipeline(psoDesc, fbinfo);
         }
 
+        ReadStatistics();
+
+        nvrhi::Viewport windowViewport(float(fbinfo.width), float(fbinfo.height));
+        m_View.SetViewport(windowViewport);
+        m_View.SetMatrices(m_Camera.GetWorldToViewMatrix(), perspProjD3DStyleReverse(dm::PI_f * 0.25f, windowViewport.width() / windowViewport.height(), 0.1f));
+        m_View.UpdateCache();
+
         m_CommandList->open();
 
-        nvrhi::utils::ClearColorAttachment(m_CommandList, framebuffer, 0, nvrhi::Color(0.f));
+        m_Scene->Refresh(m_CommandList, GetFrameIndex());
+
+        nvrhi::TextureHandle colorBuffer = framebuffer->getDesc().colorAttachments[0].texture;
+        nvrhi::TextureHandle depthBuffer = framebuffer->getDesc().depthAttachment.texture;
+        m_CommandList->clearTextureFloat(colorBuffer, nvrhi::AllSubresources, nvrhi::Color(0.f));
+        m_CommandList->clearDepthStencilTexture(depthBuffer, nvrhi::AllSubresources, true, 0.f, true, 0);
+        m_CommandList->clearBufferUInt(m_StatisticsBuffer, 0);
+
+        MeshletConstants constants = {};
+        m_View.FillPlanarViewConstants(constants.view);
+        GetFrustumPlanes(constants.view.matWorldToClip, constants.frustumPlanes);
+        constants.cameraPosition = m_Camera.GetPosition();
+        constants.flags = (m_FrustumCulling ? MESHLET_FLAG_FRUSTUM_CULLING : 0)
+            | (m_ConeCulling ? MESHLET_FLAG_CONE_CULLING : 0)
+            | (m_ShowMeshlets ? MESHLET_FLAG_SHOW_MESHLETS : 0);
+        m_CommandList->writeBuffer(m_ConstantBuffer, &constants, sizeof(constants));
 
         nvrhi::MeshletState state;
-        state.pipeline = m_Pipeline;
         state.framebuffer = framebuffer;
-        state.viewport.addViewportAndScissorRect(framebuffer->getFramebufferInfo().getViewport());
+        state.bindings = { m_BindingSet, m_DescriptorTableManager->GetDescriptorTable() };
+        state.viewport = m_View.GetViewportState();
+
+        for (const auto& instance : m_Scene->GetSceneGraph()->GetMeshInstances())
+        {
+            const auto& mesh = instance->GetMesh();
+            const affine3 transform = instance->GetNode()->GetLocalToWorldTransformFloat();
+
+            // The normal cones are in object space, the test is only exact for rotations and uniform scales
+            const float3 scale = float3(length(transform.m_linear[0]), length(transform.m_linear[1]), length(transform.m_linear[2]));
+            const float maxScale = std::max(scale.x, std::max(scale.y, scale.z));
+            const float minScale = std::min(scale.x, std::min(scale.y, scale.z));
+            const bool uniformScale = maxScale <= minScale * 1.01f;
+            const bool mirrored = determinant(transform.m_linear) < 0.f;
+
+            for (size_t i = 0; i < mesh->geometries.size(); i++)
+            {
+                const auto& geometry = mesh->geometries[i];
+                const MeshletRange* range = m_MeshletBuilder.GetMeshletRange(geometry.get());
+                if (!range)
+                    continue;
+
+                const bool doubleSided = geometry->material && geometry->material->doubleSided;
 
-        m_CommandList->setMeshletState(state);
-        
-        m_CommandList->dispatchMesh(1);
+                MeshletDrawConstants drawConstants = {};
+                drawConstants.instanceIndex = uint32_t(instance->GetInstanceIndex());
+                drawConstants.geometryInMesh = uint32_t(i);
+                drawConstants.meshletOffset = range->firstMeshlet;
+                drawConstants.meshletCount = range->numMeshlets;
+                drawConstants.flags = (uniformScale && !mirrored && !doubleSided) ? MESHLET_DRAW_FLAG_CONE_CULLING : 0;
+                drawConstants.radiusScale = maxScale;
+
+                nvrhi::MeshletPipelineHandle pipeline = doubleSided ? m_DoubleSidedPipeline : m_Pipeline;
+                if (state.pipeline != pipeline)
+                {
+                    state.pipeline = pipeline;
+                    m_CommandList->setMeshletState(state);
+                }
+
+                m_CommandList->setPushConstants(&drawConstants, sizeof(drawConstants));
+                m_CommandList->dispatchMesh((range->numMeshlets + MESHLET_AS_GROUP_SIZE - 1) / MESHLET_AS_GROUP_SIZE);
+            }
+        }
+
+        StatisticsReadback& readback = m_StatisticsReadback[m_StatisticsIndex];
+        if (!readback.pending)
+        {
+            m_CommandList->copyBuffer(readback.buffer, 0, m_StatisticsBuffer, 0, sizeof(uint32_t) * 2);
+        }
 
         m_CommandList->close();
         GetDevice()->executeCommandList(m_CommandList);
-    }
 
+        if (!readback.pending)
+        {
+            GetDevice()->setEventQuery(readback.query, nvrhi::CommandQueue::Graphics);
+            readback.pending = true;
+        }
+        m_StatisticsIndex = (m_StatisticsIndex + 1) % c_StatisticsQueueSize;
+    }
 };
 
 #ifdef WIN32
@@ -116,7 +451,16 @@ int main(int __argc, const char** __argv)
     nvrhi::GraphicsAPI api = app::GetGraphicsAPIFromCommandLine(__argc, __argv);
     app::DeviceManager* deviceManager = app::DeviceManager::Create(api);
 
+    // Any argument that is not an option is the scene to load, Sponza by default
+    std::filesystem::path sceneFileName = app::GetDirectoryWithExecutable().parent_path() / "media/glTF-Sample-Assets/Models/Sponza/glTF/Sponza.gltf";
+    for (int i = 1; i < __argc; i++)
+    {
+        if (__argv[i][0] != '-')
+            sceneFileName = __argv[i];
+    }
+
     app::DeviceCreationParameters deviceParams;
+    deviceParams.depthBufferFormat = nvrhi::Format::D24S8;
 #ifdef _DEBUG
     deviceParams.enableDebugRuntime = true; 
     deviceParams.enableNvrhiValidationLayer = true;
@@ -136,7 +480,7 @@ int main(int __argc, const char** __argv)
     
     {
         MeshletExample example(deviceManager);
-        if (example.Init())
+        if (example.Init(sceneFileName))
         {
             deviceManager->AddRenderPassToBack(&example);
             deviceManager->RunMessageLoop();
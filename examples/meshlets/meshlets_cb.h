@@ -0,0 +1,76 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef MESHLETS_CB_H
+#define MESHLETS_CB_H
+
+#include <donut/shaders/view_cb.h>
+
+#define MESHLET_MAX_VERTICES 64
+#define MESHLET_MAX_PRIMITIVES 124
+
+// One amplification shader thread tests one meshlet, one mesh shader thread outputs up to one vertex and one triangle
+#define MESHLET_AS_GROUP_SIZE 32
+#define MESHLET_MS_GROUP_SIZE 128
+
+// MeshletConstants::flags
+#define MESHLET_FLAG_FRUSTUM_CULLING    0x01
+#define MESHLET_FLAG_CONE_CULLING       0x02
+#define MESHLET_FLAG_SHOW_MESHLETS      0x04
+
+// MeshletDrawConstants::flags - the cone test is only valid for single-sided geometry with uniform scale and no mirroring
+#define MESHLET_DRAW_FLAG_CONE_CULLING  0x01
+
+struct MeshletInfo
+{
+    float3 center;          // Bounding sphere in object space
+    float radius;
+    float3 coneAxis;        // Average direction of the triangle normals in object space
+    float coneCutoff;       // Sine of the cone's half-angle, 1.0 if the triangles face too many directions to cull the meshlet
+    uint vertexOffset;      // First entry in the meshlet vertex buffer
+    uint primitiveOffset;   // First entry in the meshlet primitive buffer
+    uint vertexCount;
+    uint primitiveCount;
+};
+
+struct MeshletConstants
+{
+    PlanarViewConstants view;
+
+    float4 frustumPlanes[6]; // World space, a point is inside when dot(plane.xyz, p) + plane.w >= 0
+
+    float3 cameraPosition;
+    uint flags;
+};
+
+struct MeshletDrawConstants
+{
+    uint instanceIndex;
+    uint geometryInMesh;
+    uint meshletOffset;
+    uint meshletCount;
+
+    uint flags;
+    float radiusScale;      // Largest scale of the instance transform
+};
+
+#endif // MESHLETS_CB_H
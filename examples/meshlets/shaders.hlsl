@@ -20,65 +20,197 @@
 * DEALINGS IN THE SOFTWARE.
 */
 
-#define MAX_PRIMS_PER_MESHLET 1
-#define MAX_VERTICES_PER_MESHLET 3
+#pragma pack_matrix(row_major)
 
-static const float2 g_positions[] = {
-	float2(-0.5, -0.5),
-	float2(0, 0.5),
-	float2(0.5, -0.5)
-};
+#include <donut/shaders/bindless.h>
+#include <donut/shaders/packing.hlsli>
+#include "meshlets_cb.h"
 
-static const float3 g_colors[] = {
-	float3(1, 0, 0),
-	float3(0, 1, 0),
-	float3(0, 0, 1)	
-};
+#ifdef SPIRV
+#define VK_PUSH_CONSTANT [[vk::push_constant]]
+#define VK_BINDING(reg,dset) [[vk::binding(reg,dset)]]
+#else
+#define VK_PUSH_CONSTANT
+#define VK_BINDING(reg,dset) 
+#endif
+
+ConstantBuffer<MeshletConstants> g_Constants : register(b0);
+VK_PUSH_CONSTANT ConstantBuffer<MeshletDrawConstants> g_Draw : register(b1);
+StructuredBuffer<InstanceData> t_InstanceData : register(t0);
+StructuredBuffer<GeometryData> t_GeometryData : register(t1);
+StructuredBuffer<MaterialConstants> t_MaterialConstants : register(t2);
+StructuredBuffer<MeshletInfo> t_Meshlets : register(t3);
+StructuredBuffer<uint> t_MeshletVertices : register(t4);
+StructuredBuffer<uint> t_MeshletPrimitives : register(t5);
+RWByteAddressBuffer u_Statistics : register(u0); // Visible meshlets, visible triangles
+SamplerState s_MaterialSampler : register(s0);
+
+VK_BINDING(0, 1) ByteAddressBuffer t_BindlessBuffers[] : register(t0, space1);
+VK_BINDING(1, 1) Texture2D t_BindlessTextures[] : register(t0, space2);
 
 struct Payload
 {
-	int dummy;
+    uint meshletIndices[MESHLET_AS_GROUP_SIZE];
 };
 
 struct Vertex
 {
-	float4 pos : SV_Position;
-	float3 color : COLOR;
+    float4 pos : SV_Position;
+    float3 normal : NORMAL;
+    float2 uv : TEXCOORD;
+    nointerpolation uint meshlet : MESHLET;
 };
 
 groupshared Payload s_payload;
+groupshared uint s_numVisibleMeshlets;
+groupshared uint s_numVisibleTriangles;
+
+bool IsMeshletVisible(MeshletInfo meshlet, InstanceData instance)
+{
+    const float3 center = mul(instance.transform, float4(meshlet.center, 1.0)).xyz;
+    const float radius = meshlet.radius * g_Draw.radiusScale;
 
-[numthreads(1, 1, 1)]
+    if (g_Constants.flags & MESHLET_FLAG_FRUSTUM_CULLING)
+    {
+        [unroll]
+        for (uint i = 0; i < 6; i++)
+        {
+            if (dot(g_Constants.frustumPlanes[i].xyz, center) + g_Constants.frustumPlanes[i].w < -radius)
+                return false;
+        }
+    }
+
+    // The meshlet is back-facing if the camera is inside the complement of the normal cone, for every point of the bounding sphere
+    if ((g_Constants.flags & MESHLET_FLAG_CONE_CULLING) && (g_Draw.flags & MESHLET_DRAW_FLAG_CONE_CULLING))
+    {
+        const float3 axis = normalize(mul((float3x3)instance.transform, meshlet.coneAxis));
+        const float3 offset = center - g_Constants.cameraPosition;
+
+        if (dot(offset, axis) >= meshlet.coneCutoff * length(offset) + radius)
+            return false;
+    }
+
+    return true;
+}
+
+[numthreads(MESHLET_AS_GROUP_SIZE, 1, 1)]
 void main_as(
-	uint globalIdx : SV_DispatchThreadID)
+    uint globalIdx : SV_DispatchThreadID,
+    uint threadIdx : SV_GroupIndex)
 {
-	s_payload.dummy = 0;
-	DispatchMesh(1, 1, 1, s_payload);
+    if (threadIdx == 0)
+    {
+        s_numVisibleMeshlets = 0;
+        s_numVisibleTriangles = 0;
+    }
+
+    GroupMemoryBarrierWithGroupSync();
+
+    if (globalIdx < g_Draw.meshletCount)
+    {
+        const uint meshletIndex = g_Draw.meshletOffset + globalIdx;
+        const MeshletInfo meshlet = t_Meshlets[meshletIndex];
+
+        if (IsMeshletVisible(meshlet, t_InstanceData[g_Draw.instanceIndex]))
+        {
+            uint slot;
+            InterlockedAdd(s_numVisibleMeshlets, 1, slot);
+            InterlockedAdd(s_numVisibleTriangles, meshlet.primitiveCount);
+            s_payload.meshletIndices[slot] = meshletIndex;
+        }
+    }
+
+    GroupMemoryBarrierWithGroupSync();
+
+    if (threadIdx == 0 && s_numVisibleMeshlets > 0)
+    {
+        u_Statistics.InterlockedAdd(0, s_numVisibleMeshlets);
+        u_Statistics.InterlockedAdd(4, s_numVisibleTriangles);
+    }
+
+    DispatchMesh(s_numVisibleMeshlets, 1, 1, s_payload);
 }
 
-[numthreads(1,1,1)]
+[numthreads(MESHLET_MS_GROUP_SIZE, 1, 1)]
 [outputtopology("triangle")]
 void main_ms(
     uint threadId : SV_GroupThreadID,
+    uint groupId : SV_GroupID,
     in payload Payload i_payload,
-    out indices uint3 o_tris[MAX_PRIMS_PER_MESHLET],
-    out vertices Vertex o_verts[MAX_VERTICES_PER_MESHLET])
+    out indices uint3 o_tris[MESHLET_MAX_PRIMITIVES],
+    out vertices Vertex o_verts[MESHLET_MAX_VERTICES])
 {
-    SetMeshOutputCounts(3, 1);
-    o_tris[0] = uint3(0, 1, 2);
+    const uint meshletIndex = i_payload.meshletIndices[groupId];
+    const MeshletInfo meshlet = t_Meshlets[meshletIndex];
+
+    SetMeshOutputCounts(meshlet.vertexCount, meshlet.primitiveCount);
+
+    if (threadId < meshlet.vertexCount)
+    {
+        InstanceData instance = t_InstanceData[g_Draw.instanceIndex];
+        GeometryData geometry = t_GeometryData[instance.firstGeometryIndex + g_Draw.geometryInMesh];
+        ByteAddressBuffer vertexBuffer = t_BindlessBuffers[geometry.vertexBufferIndex];
+
+        const uint index = t_MeshletVertices[meshlet.vertexOffset + threadId];
+
+        float3 objectSpacePosition = asfloat(vertexBuffer.Load3(geometry.positionOffset + index * 12));
+        float3 objectSpaceNormal = geometry.normalOffset == ~0u ? 0 : Unpack_RGB8_SNORM(vertexBuffer.Load(geometry.normalOffset + index * 4));
+        float2 texcoord = geometry.texCoord1Offset == ~0u ? 0 : asfloat(vertexBuffer.Load2(geometry.texCoord1Offset + index * 8));
+
+        float3 worldSpacePosition = mul(instance.transform, float4(objectSpacePosition, 1.0)).xyz;
+
+        o_verts[threadId].pos = mul(float4(worldSpacePosition, 1.0), g_Constants.view.matWorldToClip);
+        o_verts[threadId].normal = mul((float3x3)instance.transform, objectSpaceNormal);
+        o_verts[threadId].uv = texcoord;
+        o_verts[threadId].meshlet = meshletIndex;
+    }
 
-    for (uint i = 0; i < 3; i++)
+    if (threadId < meshlet.primitiveCount)
     {
-    	o_verts[i].pos = float4(g_positions[i], 0, 1);
-    	o_verts[i].color = g_colors[i];
+        const uint packedTriangle = t_MeshletPrimitives[meshlet.primitiveOffset + threadId];
+        o_tris[threadId] = uint3(packedTriangle & 0xff, (packedTriangle >> 8) & 0xff, (packedTriangle >> 16) & 0xff);
     }
 }
 
+float3 GetMeshletColor(uint meshlet)
+{
+    uint hash = meshlet * 0x9e3779b9u;
+    hash ^= hash >> 16;
+    return float3(hash & 0xff, (hash >> 8) & 0xff, (hash >> 16) & 0xff) / 255.0 * 0.75 + 0.25;
+}
 
 void main_ps(
-	in Vertex i_vertex,
-	out float4 o_color : SV_Target0
-)
+    in Vertex i_vertex,
+    in bool i_isFrontFace : SV_IsFrontFace,
+    out float4 o_color : SV_Target0)
 {
-	o_color = float4(i_vertex.color, 1);
+    InstanceData instance = t_InstanceData[g_Draw.instanceIndex];
+    GeometryData geometry = t_GeometryData[instance.firstGeometryIndex + g_Draw.geometryInMesh];
+    MaterialConstants material = t_MaterialConstants[geometry.materialIndex];
+
+    float3 diffuse = material.baseOrDiffuseColor;
+
+    if (material.baseOrDiffuseTextureIndex >= 0)
+    {
+        Texture2D diffuseTexture = t_BindlessTextures[material.baseOrDiffuseTextureIndex];
+
+        float4 diffuseTextureValue = diffuseTexture.Sample(s_MaterialSampler, i_vertex.uv);
+        
+        if (material.domain == MaterialDomain_AlphaTested)
+            clip(diffuseTextureValue.a - material.alphaCutoff);
+
+        diffuse *= diffuseTextureValue.rgb;
+    }
+
+    if (g_Constants.flags & MESHLET_FLAG_SHOW_MESHLETS)
+        diffuse = GetMeshletColor(i_vertex.meshlet);
+
+    // Simple directional light so that the shape of the geometry is visible
+    float3 normal = any(i_vertex.normal != 0) ? normalize(i_vertex.normal) : 0;
+    if (!i_isFrontFace)
+        normal = -normal;
+    const float3 lightDirection = normalize(float3(0.3, 1.0, 0.2));
+    const float lighting = 0.35 + 0.65 * saturate(dot(normal, lightDirection));
+
+    o_color = float4(diffuse * lighting, 1);
 }
@@ -0,0 +1,293 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+#include "BatchedSkinning.h"
+#include "BlasManager.h"
+
+#include <donut/engine/DescriptorTableManager.h>
+#include <donut/engine/Scene.h>
+#include <donut/engine/SceneGraph.h>
+#include <donut/engine/ShaderFactory.h>
+#include <nvrhi/utils.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+
+using namespace donut;
+using namespace donut::math;
+
+#include <donut/shaders/bindless.h>
+#include "batched_skinning_cb.h"
+
+static_assert(sizeof(SkinningItem) % 16 == 0, "SkinningItem must match the structured buffer layout in batched_skinning.hlsl");
+
+static uint64_t AlignArenaOffset(uint64_t offset)
+{
+    return (offset + 15) & ~uint64_t(15);
+}
+
+BatchedSkinning::BatchedSkinning(nvrhi::IDevice* device, engine::ShaderFactory& shaderFactory,
+    std::shared_ptr<engine::DescriptorTableManager> descriptorTable, nvrhi::IBindingLayout* bindlessLayout)
+    : m_Device(device)
+    , m_DescriptorTable(std::move(descriptorTable))
+{
+    m_Shader = shaderFactory.CreateShader("app/batched_skinning.hlsl", "main", nullptr, nvrhi::ShaderType::Compute);
+
+    nvrhi::BindingLayoutDesc layoutDesc;
+    layoutDesc.visibility = nvrhi::ShaderType::Compute;
+    layoutDesc.bindings = {
+        nvrhi::BindingLayoutItem::StructuredBuffer_SRV(0),
+        nvrhi::BindingLayoutItem::StructuredBuffer_SRV(1),
+        nvrhi::BindingLayoutItem::RawBuffer_UAV(0)
+    };
+    m_BindingLayout = m_Device->createBindingLayout(layoutDesc);
+
+    auto pipelineDesc = nvrhi::ComputePipelineDesc()
+        .setComputeShader(m_Shader)
+        .addBindingLayout(m_BindingLayout)
+        .addBindingLayout(bindlessLayout);
+    m_Pipeline = m_Device->createComputePipeline(pipelineDesc);
+}
+
+void BatchedSkinning::Init(nvrhi::ICommandList* commandList, engine::Scene& scene, BlasManager& blasManager)
+{
+    m_Ranges.clear();
+    m_RangeIndices.clear();
+    m_Arena = nullptr;
+    m_ArenaDescriptor = nullptr;
+    m_ItemBuffer = nullptr;
+    m_JointBuffer = nullptr;
+    m_BindingSet = nullptr;
+
+    // The copy of the geometry buffer is needed even without skinned instances, it's what the hit shaders read
+    nvrhi::BufferDesc geometryBufferDesc = scene.GetGeometryBuffer()->getDesc();
+    geometryBufferDesc.debugName = "SkinnedGeometryData";
+    geometryBufferDesc.initialState = nvrhi::ResourceStates::ShaderResource;
+    geometryBufferDesc.keepInitialState = true;
+    m_GeometryBuffer = m_Device->createBuffer(geometryBufferDesc);
+
+    // Lay out the arena: positions, normals, tangents and texture coordinates of every instance
+    uint64_t arenaSize = 0;
+    uint32_t totalJoints = 0;
+    for (const auto& instance : scene.GetSceneGraph()->GetSkinnedMeshInstances())
+    {
+        const engine::MeshInfo* prototype = instance->GetMesh()->skinPrototype.get();
+        assert(prototype);
+
+        InstanceRange range;
+        range.instance = instance.get();
+        range.numVertices = prototype->totalVertices;
+        range.numJoints = uint32_t(instance->joints.size());
+        range.hasNormals = prototype->buffers->hasAttribute(engine::VertexAttribute::Normal);
+        range.hasTangents = prototype->buffers->hasAttribute(engine::VertexAttribute::Tangent);
+        range.hasTexCoords = prototype->buffers->hasAttribute(engine::VertexAttribute::TexCoord1);
+
+        range.positionOffset = arenaSize;
+        arenaSize = AlignArenaOffset(arenaSize + uint64_t(range.numVertices) * sizeof(float3));
+        range.normalOffset = arenaSize;
+        if (range.hasNormals)
+            arenaSize = AlignArenaOffset(arenaSize + uint64_t(range.numVertices) * sizeof(uint32_t));
+        range.tangentOffset = arenaSize;
+        if (range.hasTangents)
+            arenaSize = AlignArenaOffset(arenaSize + uint64_t(range.numVertices) * sizeof(uint32_t));
+        range.texCoordOffset = arenaSize;
+        if (range.hasTexCoords)
+            arenaSize = AlignArenaOffset(arenaSize + uint64_t(range.numVertices) * sizeof(float2));
+
+        totalJoints += range.numJoints;
+        m_RangeIndices[range.instance] = m_Ranges.size();
+        m_Ranges.push_back(range);
+    }
+
+    if (m_Ranges.empty())
+        return;
+
+    nvrhi::BufferDesc bufferDesc;
+    bufferDesc.byteSize = arenaSize;
+    bufferDesc.debugName = "SkinnedVertexArena";
+    bufferDesc.canHaveRawViews = true;
+    bufferDesc.canHaveUAVs = true;
+    bufferDesc.isAccelStructBuildInput = true;
+    bufferDesc.initialState = nvrhi::ResourceStates::ShaderResource | nvrhi::ResourceStates::AccelStructBuildInput;
+    bufferDesc.keepInitialState = true;
+    m_Arena = m_Device->createBuffer(bufferDesc);
+
+    m_ArenaDescriptor = std::make_shared<engine::DescriptorHandle>(
+        m_DescriptorTable->CreateDescriptorHandle(nvrhi::BindingSetItem::RawBuffer_SRV(0, m_Arena)));
+
+    bufferDesc = nvrhi::BufferDesc();
+    bufferDesc.byteSize = m_Ranges.size() * sizeof(SkinningItem);
+    bufferDesc.structStride = sizeof(SkinningItem);
+    bufferDesc.debugName = "SkinningItems";
+    bufferDesc.initialState = nvrhi::ResourceStates::ShaderResource;
+    bufferDesc.keepInitialState = true;
+    m_ItemBuffer = m_Device->createBuffer(bufferDesc);
+
+    bufferDesc.byteSize = uint64_t(std::max(totalJoints, 1u)) * sizeof(float4x4);
+    bufferDesc.structStride = sizeof(float4x4);
+    bufferDesc.debugName = "SkinningJoints";
+    m_JointBuffer = m_Device->createBuffer(bufferDesc);
+
+    nvrhi::BindingSetDesc bindingSetDesc;
+    bindingSetDesc.bindings = {
+        nvrhi::BindingSetItem::StructuredBuffer_SRV(0, m_ItemBuffer),
+        nvrhi::BindingSetItem::StructuredBuffer_SRV(1, m_JointBuffer),
+        nvrhi::BindingSetItem::RawBuffer_UAV(0, m_Arena)
+    };
+    m_BindingSet = m_Device->createBindingSet(bindingSetDesc, m_BindingLayout);
+
+    for (const InstanceRange& range : m_Ranges)
+    {
+        const engine::MeshInfo* mesh = range.instance->GetMesh().get();
+        const engine::MeshInfo* prototype = mesh->skinPrototype.get();
+
+        // Skinning doesn't change the texture coordinates, they're copied once
+        if (range.hasTexCoords)
+        {
+            const uint64_t sourceOffset = prototype->buffers->getVertexBufferRange(engine::VertexAttribute::TexCoord1).byteOffset
+                + uint64_t(prototype->vertexOffset) * sizeof(float2);
+            commandList->copyBuffer(m_Arena, range.texCoordOffset, prototype->buffers->vertexBuffer, sourceOffset,
+                uint64_t(range.numVertices) * sizeof(float2));
+        }
+
+        blasManager.SetDynamicVertexSource(mesh, m_Arena, range.positionOffset);
+    }
+}
+
+void BatchedSkinning::UpdateGeometryBuffer(nvrhi::ICommandList* commandList, engine::Scene& scene)
+{
+    nvrhi::IBuffer* sceneGeometryBuffer = scene.GetGeometryBuffer();
+    commandList->copyBuffer(m_GeometryBuffer, 0, sceneGeometryBuffer, 0,
+        std::min(m_GeometryBuffer->getDesc().byteSize, sceneGeometryBuffer->getDesc().byteSize));
+
+    if (m_Ranges.empty())
+        return;
+
+    // The patches below overlap the copy, which needs a barrier between them
+    commandList->setBufferState(m_GeometryBuffer, nvrhi::ResourceStates::ShaderResource);
+    commandList->commitBarriers();
+
+    const uint32_t arenaIndex = m_ArenaDescriptor->Get();
+
+    auto writeField = [this, commandList](uint64_t entryOffset, size_t fieldOffset, uint32_t value)
+    {
+        commandList->writeBuffer(m_GeometryBuffer, &value, sizeof(value), entryOffset + fieldOffset);
+    };
+
+    for (const InstanceRange& range : m_Ranges)
+    {
+        const engine::MeshInfo* mesh = range.instance->GetMesh().get();
+
+        for (size_t geometryIndex = 0; geometryIndex < mesh->geometries.size(); geometryIndex++)
+        {
+            const uint32_t firstVertex = mesh->geometries[geometryIndex]->vertexOffsetInMesh;
+            const uint64_t entryOffset = (uint64_t(range.instance->GetGeometryInstanceIndex()) + geometryIndex) * sizeof(GeometryData);
+
+            writeField(entryOffset, offsetof(GeometryData, vertexBufferIndex), arenaIndex);
+            writeField(entryOffset, offsetof(GeometryData, positionOffset),
+                uint32_t(range.positionOffset + firstVertex * sizeof(float3)));
+            writeField(entryOffset, offsetof(GeometryData, normalOffset),
+                range.hasNormals ? uint32_t(range.normalOffset + firstVertex * sizeof(uint32_t)) : ~0u);
+            writeField(entryOffset, offsetof(GeometryData, tangentOffset),
+                range.hasTangents ? uint32_t(range.tangentOffset + firstVertex * sizeof(uint32_t)) : ~0u);
+            writeField(entryOffset, offsetof(GeometryData, texCoord1Offset),
+                range.hasTexCoords ? uint32_t(range.texCoordOffset + firstVertex * sizeof(float2)) : ~0u);
+        }
+    }
+}
+
+void BatchedSkinning::Skin(nvrhi::ICommandList* commandList, const std::vector<const engine::SkinnedMeshInstance*>& instances)
+{
+    if (instances.empty() || !m_BindingSet)
+        return;
+
+    std::vector<SkinningItem> items;
+    std::vector<float4x4> joints;
+    uint32_t maxVertices = 0;
+
+    for (const engine::SkinnedMeshInstance* instance : instances)
+    {
+        const InstanceRange* range = FindRange(instance);
+        assert(range);
+        if (!range)
+            continue;
+
+        const engine::MeshInfo* prototype = instance->GetMesh()->skinPrototype.get();
+        const engine::BufferGroup& buffers = *prototype->buffers;
+
+        auto getInputOffset = [&buffers, prototype](engine::VertexAttribute attribute, size_t elementSize)
+        {
+            if (!buffers.hasAttribute(attribute))
+                return uint32_t(BATCHED_SKINNING_NO_ATTRIBUTE);
+
+            return uint32_t(buffers.getVertexBufferRange(attribute).byteOffset + uint64_t(prototype->vertexOffset) * elementSize);
+        };
+
+        SkinningItem item = {};
+        item.inputBufferIndex = buffers.vertexBufferDescriptor->Get();
+        item.numVertices = range->numVertices;
+        item.jointBase = uint32_t(joints.size());
+        item.inputPositionOffset = getInputOffset(engine::VertexAttribute::Position, sizeof(float3));
+        item.inputNormalOffset = getInputOffset(engine::VertexAttribute::Normal, sizeof(uint32_t));
+        item.inputTangentOffset = getInputOffset(engine::VertexAttribute::Tangent, sizeof(uint32_t));
+        item.inputJointIndicesOffset = getInputOffset(engine::VertexAttribute::JointIndices, sizeof(uint16_t) * 4);
+        item.inputJointWeightsOffset = getInputOffset(engine::VertexAttribute::JointWeights, sizeof(float4));
+        item.outputPositionOffset = uint32_t(range->positionOffset);
+        item.outputNormalOffset = uint32_t(range->normalOffset);
+        item.outputTangentOffset = uint32_t(range->tangentOffset);
+        items.push_back(item);
+
+        // Same joint transforms as the scene's skinning pass: from the bind pose to the current pose, in the space of the instance
+        const daffine3 worldToInstance = inverse(instance->GetNode()->GetLocalToWorldTransform());
+        for (const auto& joint : instance->joints)
+        {
+            const float4x4 jointMatrix = affineToHomogeneous(affine3(joint.node->GetLocalToWorldTransform() * worldToInstance));
+            joints.push_back(joint.inverseBindMatrix * jointMatrix);
+        }
+
+        maxVertices = std::max(maxVertices, range->numVertices);
+    }
+
+    if (items.empty())
+        return;
+
+    commandList->beginMarker("Batched Skinning");
+
+    commandList->writeBuffer(m_ItemBuffer, items.data(), items.size() * sizeof(SkinningItem));
+    if (!joints.empty())
+        commandList->writeBuffer(m_JointBuffer, joints.data(), joints.size() * sizeof(float4x4));
+
+    nvrhi::ComputeState state;
+    state.pipeline = m_Pipeline;
+    state.bindings = { m_BindingSet, m_DescriptorTable->GetDescriptorTable() };
+    commandList->setComputeState(state);
+    commandList->dispatch(div_ceil(maxVertices, BATCHED_SKINNING_GROUP_SIZE), uint32_t(items.size()));
+
+    commandList->endMarker();
+}
+
+const BatchedSkinning::InstanceRange* BatchedSkinning::FindRange(const engine::SkinnedMeshInstance* instance) const
+{
+    auto it = m_RangeIndices.find(instance);
+    return it != m_RangeIndices.end() ? &m_Ranges[it->second] : nullptr;
+}
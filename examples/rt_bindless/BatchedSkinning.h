@@ -0,0 +1,99 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <nvrhi/nvrhi.h>
+
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+namespace donut::engine
+{
+    class DescriptorHandle;
+    class DescriptorTableManager;
+    class Scene;
+    class ShaderFactory;
+    class SkinnedMeshInstance;
+}
+
+class BlasManager;
+
+// Skins the animated mesh instances for ray tracing with one compute dispatch per frame.
+// Every skinned instance gets a range of a shared vertex arena with its skinned positions, normals and tangents,
+// and a copy of the texture coordinates of its prototype. The skinned BLAS'es are built from the arena,
+// and the geometry buffer returned by GetGeometryBuffer is a copy of the scene's, with the skinned geometries
+// pointing at their arena ranges, so the hit shaders read the same vertices that the BLAS'es were built from.
+// The scene still runs its own per-instance skinning in Refresh; its output is not used by this sample.
+class BatchedSkinning
+{
+public:
+    BatchedSkinning(nvrhi::IDevice* device, donut::engine::ShaderFactory& shaderFactory,
+        std::shared_ptr<donut::engine::DescriptorTableManager> descriptorTable, nvrhi::IBindingLayout* bindlessLayout);
+
+    // Lays out the arena for all skinned instances of the scene and points their BLAS'es at it.
+    // Call after BlasManager::CreateAccelStructs.
+    void Init(nvrhi::ICommandList* commandList, donut::engine::Scene& scene, BlasManager& blasManager);
+
+    // Copies the scene's geometry buffer and redirects the skinned geometries into the arena.
+    // Call after Scene::Refresh whenever the scene's geometry data may have changed.
+    void UpdateGeometryBuffer(nvrhi::ICommandList* commandList, donut::engine::Scene& scene);
+
+    // Skins the given instances in one dispatch
+    void Skin(nvrhi::ICommandList* commandList, const std::vector<const donut::engine::SkinnedMeshInstance*>& instances);
+
+    [[nodiscard]] nvrhi::IBuffer* GetGeometryBuffer() const { return m_GeometryBuffer; }
+
+private:
+    struct InstanceRange
+    {
+        const donut::engine::SkinnedMeshInstance* instance = nullptr;
+        uint32_t numVertices = 0;
+        uint32_t numJoints = 0;
+        uint64_t positionOffset = 0;    // Byte offsets of the first vertex of the instance in the arena
+        uint64_t normalOffset = 0;
+        uint64_t tangentOffset = 0;
+        uint64_t texCoordOffset = 0;
+        bool hasNormals = false;
+        bool hasTangents = false;
+        bool hasTexCoords = false;
+    };
+
+    nvrhi::DeviceHandle m_Device;
+    std::shared_ptr<donut::engine::DescriptorTableManager> m_DescriptorTable;
+
+    nvrhi::ShaderHandle m_Shader;
+    nvrhi::BindingLayoutHandle m_BindingLayout;
+    nvrhi::ComputePipelineHandle m_Pipeline;
+    nvrhi::BindingSetHandle m_BindingSet;
+
+    std::vector<InstanceRange> m_Ranges;
+    std::unordered_map<const donut::engine::SkinnedMeshInstance*, size_t> m_RangeIndices; // Into m_Ranges
+    nvrhi::BufferHandle m_Arena;
+    std::shared_ptr<donut::engine::DescriptorHandle> m_ArenaDescriptor;
+    nvrhi::BufferHandle m_ItemBuffer;
+    nvrhi::BufferHandle m_JointBuffer;
+    nvrhi::BufferHandle m_GeometryBuffer;
+
+    [[nodiscard]] const InstanceRange* FindRange(const donut::engine::SkinnedMeshInstance* instance) const;
+};
@@ -0,0 +1,76 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+// Skins all animated mesh instances of a frame in one dispatch, one group row per instance.
+// The vertices are read from the prototype meshes through the bindless buffer table and written into the
+// shared vertex arena, which the skinned BLAS'es and the hit shaders read from.
+
+#pragma pack_matrix(row_major)
+
+#include <donut/shaders/binding_helpers.hlsli>
+#include <donut/shaders/packing.hlsli>
+#include "batched_skinning_cb.h"
+
+StructuredBuffer<SkinningItem> t_Items : register(t0);
+StructuredBuffer<float4x4> t_Joints : register(t1);
+RWByteAddressBuffer u_Arena : register(u0);
+
+VK_BINDING(0, 1) ByteAddressBuffer t_BindlessBuffers[] : register(t0, space1);
+
+[numthreads(BATCHED_SKINNING_GROUP_SIZE, 1, 1)]
+void main(uint3 groupId : SV_GroupID, uint threadIndex : SV_GroupThreadID)
+{
+    const SkinningItem item = t_Items[groupId.y];
+    const uint vertexIndex = groupId.x * BATCHED_SKINNING_GROUP_SIZE + threadIndex;
+    if (vertexIndex >= item.numVertices)
+        return;
+
+    ByteAddressBuffer vertexBuffer = t_BindlessBuffers[NonUniformResourceIndex(item.inputBufferIndex)];
+
+    // The joint indices are stored as 4x uint16
+    const uint2 packedJoints = vertexBuffer.Load2(item.inputJointIndicesOffset + vertexIndex * 8);
+    const uint4 joints = uint4(packedJoints.x & 0xffff, packedJoints.x >> 16, packedJoints.y & 0xffff, packedJoints.y >> 16) + item.jointBase;
+    const float4 weights = asfloat(vertexBuffer.Load4(item.inputJointWeightsOffset + vertexIndex * 16));
+
+    const float4x4 skinMatrix =
+        t_Joints[joints.x] * weights.x +
+        t_Joints[joints.y] * weights.y +
+        t_Joints[joints.z] * weights.z +
+        t_Joints[joints.w] * weights.w;
+
+    const float3 position = asfloat(vertexBuffer.Load3(item.inputPositionOffset + vertexIndex * 12));
+    u_Arena.Store3(item.outputPositionOffset + vertexIndex * 12, asuint(mul(float4(position, 1.0), skinMatrix).xyz));
+
+    if (item.inputNormalOffset != BATCHED_SKINNING_NO_ATTRIBUTE)
+    {
+        float3 normal = Unpack_RGB8_SNORM(vertexBuffer.Load(item.inputNormalOffset + vertexIndex * 4));
+        normal = normalize(mul(float4(normal, 0.0), skinMatrix).xyz);
+        u_Arena.Store(item.outputNormalOffset + vertexIndex * 4, Pack_RGB8_SNORM(normal));
+    }
+
+    if (item.inputTangentOffset != BATCHED_SKINNING_NO_ATTRIBUTE)
+    {
+        float4 tangent = Unpack_RGBA8_SNORM(vertexBuffer.Load(item.inputTangentOffset + vertexIndex * 4));
+        tangent.xyz = normalize(mul(float4(tangent.xyz, 0.0), skinMatrix).xyz);
+        u_Arena.Store(item.outputTangentOffset + vertexIndex * 4, Pack_RGBA8_SNORM(tangent));
+    }
+}
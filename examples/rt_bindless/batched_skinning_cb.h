@@ -0,0 +1,51 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef BATCHED_SKINNING_CB_H
+#define BATCHED_SKINNING_CB_H
+
+#define BATCHED_SKINNING_GROUP_SIZE 64
+
+// Marks a vertex attribute that the prototype mesh doesn't have
+#define BATCHED_SKINNING_NO_ATTRIBUTE 0xffffffff
+
+// One skinned mesh instance. The input offsets are byte offsets of the first vertex of the prototype mesh
+// in its vertex buffer, the output offsets are byte offsets of the first vertex of the instance in the arena.
+struct SkinningItem
+{
+    uint inputBufferIndex;          // Bindless index of the prototype vertex buffer
+    uint numVertices;
+    uint jointBase;                 // First joint matrix of the instance in the joint buffer
+    uint padding;
+
+    uint inputPositionOffset;
+    uint inputNormalOffset;
+    uint inputTangentOffset;
+    uint inputJointIndicesOffset;
+
+    uint inputJointWeightsOffset;
+    uint outputPositionOffset;
+    uint outputNormalOffset;
+    uint outputTangentOffset;
+};
+
+#endif // BATCHED_SKINNING_CB_H
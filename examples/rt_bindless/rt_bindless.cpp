@@ -34,13 +34,24 @@
 #include <donut/core/math/math.h>
 #include <nvrhi/utils.h>
 
+#include <algorithm>
+#include <cstring>
+#include <unordered_map>
+
 using namespace donut;
 using namespace donut::math;
 
 #include "lighting_cb.h"
+#include "BatchedSkinning.h"
+#include "BlasManager.h"
 
 static const char* g_WindowTitle = "Donut Example: Bindless Ray Tracing";
 
+// Refitting the TLAS is cheaper than building it, but the BVH quality degrades as the instances move.
+// After this many consecutive refits, the TLAS is built from scratch.
+static const uint32_t c_MaxConsecutiveTlasRefits = 60;
+static const uint32_t c_MaxConsecutiveSkinnedBlasRefits = 30;
+
 class BindlessRayTracing : public app::ApplicationBase
 {
 private:
@@ -56,7 +67,15 @@ private:
     nvrhi::BindingSetHandle m_BindingSet;
     nvrhi::BindingLayoutHandle m_BindlessLayout;
 
+    std::unique_ptr<BlasManager> m_BlasManager;
+    std::unique_ptr<BatchedSkinning> m_Skinning;
+    bool m_SkinnedGeometryValid = false; // The skinned copy of the geometry buffer has been written since the last structure change
     nvrhi::rt::AccelStructHandle m_TopLevelAS;
+    nvrhi::BufferHandle m_TlasInstanceBuffer;
+    std::vector<nvrhi::rt::InstanceDesc> m_TlasInstances; // Persistent between frames, mirrors m_TlasInstanceBuffer
+    std::unordered_map<const engine::MeshInstance*, uint32_t> m_TlasInstanceIndices;
+    std::vector<uint32_t> m_DirtyTlasInstances; // Entries whose transforms are updated by the next Scene::Refresh
+    uint32_t m_TlasRefitCount = 0;
 
     nvrhi::BufferHandle m_ConstantBuffer;
 
@@ -295,118 +314,186 @@ public:
         return true;
     }
 
-    void GetMeshBlasDesc(engine::MeshInfo& mesh, nvrhi::rt::AccelStructDesc& blasDesc) const
-    {
-        blasDesc.isTopLevel = false;
-        blasDesc.debugName = mesh.name;
-
-        for (const auto& geometry : mesh.geometries)
-        {
-            nvrhi::rt::GeometryDesc geometryDesc;
-            auto & triangles = geometryDesc.geometryData.triangles;
-            triangles.indexBuffer = mesh.buffers->indexBuffer;
-            triangles.indexOffset = (mesh.indexOffset + geometry->indexOffsetInMesh) * sizeof(uint32_t);
-            triangles.indexFormat = nvrhi::Format::R32_UINT;
-            triangles.indexCount = geometry->numIndices;
-            triangles.vertexBuffer = mesh.buffers->vertexBuffer;
-            triangles.vertexOffset = (mesh.vertexOffset + geometry->vertexOffsetInMesh) * sizeof(float3) + mesh.buffers->getVertexBufferRange(engine::VertexAttribute::Position).byteOffset;
-            triangles.vertexFormat = nvrhi::Format::RGB32_FLOAT;
-            triangles.vertexStride = sizeof(float3);
-            triangles.vertexCount = geometry->numVertices;
-            geometryDesc.geometryType = nvrhi::rt::GeometryType::Triangles;
-            geometryDesc.flags = (geometry->material->domain == engine::MaterialDomain::AlphaTested)
-                ? nvrhi::rt::GeometryFlags::None
-                : nvrhi::rt::GeometryFlags::Opaque;
-            blasDesc.bottomLevelGeometries.push_back(geometryDesc);
-        }
-
-        // don't compact acceleration structures that are built per frame
-        if (mesh.skinPrototype != nullptr)
-        {
-            blasDesc.buildFlags = nvrhi::rt::AccelStructBuildFlags::PreferFastTrace;
-        }
-        else
-        {
-            blasDesc.buildFlags = nvrhi::rt::AccelStructBuildFlags::PreferFastTrace | nvrhi::rt::AccelStructBuildFlags::AllowCompaction;
-        }
-    }
-
     void CreateAccelStructs(nvrhi::ICommandList* commandList)
     {
-        for (const auto& mesh : m_Scene->GetSceneGraph()->GetMeshes())
-        {
-            if (mesh->isSkinPrototype)
-                continue; // skip the skinning prototypes
-            
-            nvrhi::rt::AccelStructDesc blasDesc;
-
-            GetMeshBlasDesc(*mesh, blasDesc);
+        // Skinned meshes are refitted every frame they're animated, from the vertices of the batched skinning pass, see BuildTLAS.
+        // Only alpha tested geometry needs the any-hit shader, everything else is built as opaque.
+        m_BlasManager = std::make_unique<BlasManager>(GetDevice());
+        m_BlasManager->CreateAccelStructs(commandList, *m_Scene->GetSceneGraph(),
+            [](const engine::MeshInfo& mesh) { return mesh.skinPrototype != nullptr; },
+            [](const engine::MeshGeometry& geometry) { return geometry.material->domain != engine::MaterialDomain::AlphaTested; });
 
-            nvrhi::rt::AccelStructHandle as = GetDevice()->createAccelStruct(blasDesc);
-
-            if (!mesh->skinPrototype)
-                nvrhi::utils::BuildBottomLevelAccelStruct(commandList, as, blasDesc);
-
-            mesh->accelStruct = as;
-        }
+        m_Skinning = std::make_unique<BatchedSkinning>(GetDevice(), *m_ShaderFactory, m_DescriptorTable, m_BindlessLayout);
+        m_Skinning->Init(commandList, *m_Scene, *m_BlasManager);
+        m_SkinnedGeometryValid = false;
 
 
         nvrhi::rt::AccelStructDesc tlasDesc;
         tlasDesc.isTopLevel = true;
         tlasDesc.topLevelMaxInstances = m_Scene->GetSceneGraph()->GetMeshInstances().size();
+        tlasDesc.buildFlags = nvrhi::rt::AccelStructBuildFlags::AllowUpdate;
         m_TopLevelAS = GetDevice()->createAccelStruct(tlasDesc);
+
+        // The TLAS is built from a buffer, so that only the changed instances have to be uploaded
+        nvrhi::BufferDesc instanceBufferDesc;
+        instanceBufferDesc.byteSize = std::max<size_t>(tlasDesc.topLevelMaxInstances, 1) * sizeof(nvrhi::rt::InstanceDesc);
+        instanceBufferDesc.structStride = sizeof(nvrhi::rt::InstanceDesc);
+        instanceBufferDesc.isAccelStructBuildInput = true;
+        instanceBufferDesc.initialState = nvrhi::ResourceStates::AccelStructBuildInput;
+        instanceBufferDesc.keepInitialState = true;
+        instanceBufferDesc.debugName = "TlasInstanceBuffer";
+        m_TlasInstanceBuffer = GetDevice()->createBuffer(instanceBufferDesc);
+
+        m_TlasInstances.clear();
+        m_TlasInstanceIndices.clear();
+        m_DirtyTlasInstances.clear();
+        m_TlasRefitCount = 0;
     }
 
-    void BuildTLAS(nvrhi::ICommandList* commandList, uint32_t frameIndex) const
+    void FillTlasInstance(const engine::MeshInstance& instance, nvrhi::rt::InstanceDesc& instanceDesc)
     {
-        commandList->beginMarker("Skinned BLAS Updates");
+        // The instance buffer is consumed by the GPU directly, so it needs BLAS addresses instead of handles
+        instanceDesc = nvrhi::rt::InstanceDesc();
+        assert(instance.GetMesh()->accelStruct);
+        instanceDesc.blasDeviceAddress = instance.GetMesh()->accelStruct->getDeviceAddress();
+        instanceDesc.instanceMask = 1;
+        instanceDesc.instanceID = instance.GetInstanceIndex();
+
+        auto node = instance.GetNode();
+        assert(node);
+        dm::affineToColumnMajor(node->GetLocalToWorldTransformFloat(), instanceDesc.transform);
+    }
 
-        // Transition all the buffers to their necessary states before building the BLAS'es to allow BLAS batching
-        for (const auto& skinnedInstance : m_Scene->GetSceneGraph()->GetSkinnedMeshInstances())
+    // Records the TLAS entries of the mesh instances whose world transforms are going to change in the next Scene::Refresh,
+    // from the transform dirty flags of the scene graph. A node's world transform changes when its own or any of its
+    // ancestors' local transforms has changed; subgraphs without transform changes are skipped.
+    // The flags are reset by Scene::Refresh, so this must be called before it. Structure changes rewrite all entries anyway.
+    void MarkDirtyTlasInstances()
+    {
+        using DirtyFlags = engine::SceneGraphNode::DirtyFlags;
+
+        std::vector<bool> parentTransformChanged = { false };
+        engine::SceneGraphWalker walker(m_Scene->GetSceneGraph()->GetRootNode().get());
+        while (walker)
         {
-            if (skinnedInstance->GetLastUpdateFrameIndex() < frameIndex)
-                continue;
+            engine::SceneGraphNode* node = walker.Get();
+            const uint32_t dirtyFlags = uint32_t(node->GetDirtyFlags());
+            const bool transformChanged = parentTransformChanged.back() || (dirtyFlags & uint32_t(DirtyFlags::LocalTransform)) != 0;
+
+            if (transformChanged)
+            {
+                auto instance = dynamic_cast<const engine::MeshInstance*>(node->GetLeaf().get());
+                auto it = instance ? m_TlasInstanceIndices.find(instance) : m_TlasInstanceIndices.end();
+                if (it != m_TlasInstanceIndices.end())
+                    m_DirtyTlasInstances.push_back(it->second);
+            }
 
-            commandList->setAccelStructState(skinnedInstance->GetMesh()->accelStruct, nvrhi::ResourceStates::AccelStructWrite);
-            commandList->setBufferState(skinnedInstance->GetMesh()->buffers->vertexBuffer, nvrhi::ResourceStates::AccelStructBuildInput);
+            const bool enterChildren = transformChanged || (dirtyFlags & uint32_t(DirtyFlags::SubgraphTransforms)) != 0;
+            int deltaDepth = walker.Next(enterChildren);
+            if (deltaDepth > 0)
+            {
+                parentTransformChanged.push_back(transformChanged);
+            }
+            else
+            {
+                for (; deltaDepth < 0; deltaDepth++)
+                    parentTransformChanged.pop_back();
+            }
         }
-        commandList->commitBarriers();
+    }
 
-        // Now build the BLAS'es
+    // The scene structure flag must be queried, and MarkDirtyTlasInstances called, before Scene::Refresh, which resets them
+    void BuildTLAS(nvrhi::ICommandList* commandList, uint32_t frameIndex, bool sceneStructureChanged)
+    {
+        std::vector<const engine::SkinnedMeshInstance*> skinnedInstances;
+        std::vector<engine::MeshInfo*> skinnedMeshes;
         for (const auto& skinnedInstance : m_Scene->GetSceneGraph()->GetSkinnedMeshInstances())
         {
             if (skinnedInstance->GetLastUpdateFrameIndex() < frameIndex)
                 continue;
-            
-            nvrhi::rt::AccelStructDesc blasDesc;
-            GetMeshBlasDesc(*skinnedInstance->GetMesh(), blasDesc);
-            
-            nvrhi::utils::BuildBottomLevelAccelStruct(commandList, skinnedInstance->GetMesh()->accelStruct, blasDesc);
+
+            skinnedInstances.push_back(skinnedInstance.get());
+            skinnedMeshes.push_back(skinnedInstance->GetMesh().get());
         }
-        commandList->endMarker();
 
-        std::vector<nvrhi::rt::InstanceDesc> instances;
+        // Skin all animated instances in one dispatch, into the arena that their BLAS'es are built from
+        m_Skinning->Skin(commandList, skinnedInstances);
+
+        // Refit the animated skinned BLAS'es in one batch. Skinning keeps the topology, so the only reason for a full
+        // rebuild is the trace performance that the refits lose as the pose moves away from the one the BLAS was built for.
+        m_BlasManager->BuildDynamic(commandList, skinnedMeshes, true, c_MaxConsecutiveSkinnedBlasRefits);
+        const bool blasUpdated = !skinnedMeshes.empty();
+
+        // Compact acceleration structures that are tagged for compaction and have finished executing the original build
+        const bool blasCompacted = m_BlasManager->Compact(commandList);
+
+        const auto& meshInstances = m_Scene->GetSceneGraph()->GetMeshInstances();
+        const bool instanceCountChanged = m_TlasInstances.size() != meshInstances.size();
+        bool instancesChanged = false;
 
-        for (const auto& instance : m_Scene->GetSceneGraph()->GetMeshInstances())
+        if (instanceCountChanged || sceneStructureChanged || blasCompacted)
         {
-            nvrhi::rt::InstanceDesc instanceDesc;
-            instanceDesc.bottomLevelAS = instance->GetMesh()->accelStruct;
-            assert(instanceDesc.bottomLevelAS);
-            instanceDesc.instanceMask = 1;
-            instanceDesc.instanceID = instance->GetInstanceIndex();
+            // Rewrite the whole table: the instances have changed, or the compacted BLAS'es have moved to new addresses
+            m_TlasInstances.resize(meshInstances.size());
+            m_TlasInstanceIndices.clear();
+
+            for (size_t index = 0; index < meshInstances.size(); index++)
+            {
+                FillTlasInstance(*meshInstances[index], m_TlasInstances[index]);
+                m_TlasInstanceIndices[meshInstances[index].get()] = uint32_t(index);
+            }
 
-            auto node = instance->GetNode();
-            assert(node);
-            dm::affineToColumnMajor(node->GetLocalToWorldTransformFloat(), instanceDesc.transform);
+            if (!m_TlasInstances.empty())
+                commandList->writeBuffer(m_TlasInstanceBuffer, m_TlasInstances.data(), m_TlasInstances.size() * sizeof(nvrhi::rt::InstanceDesc));
 
-            instances.push_back(instanceDesc);
+            instancesChanged = true;
         }
+        else if (!m_DirtyTlasInstances.empty())
+        {
+            std::sort(m_DirtyTlasInstances.begin(), m_DirtyTlasInstances.end());
+            m_DirtyTlasInstances.erase(std::unique(m_DirtyTlasInstances.begin(), m_DirtyTlasInstances.end()), m_DirtyTlasInstances.end());
 
-        // Compact acceleration structures that are tagged for compaction and have finished executing the original build
-        commandList->compactBottomLevelAccelStructs();
+            for (uint32_t index : m_DirtyTlasInstances)
+                FillTlasInstance(*meshInstances[index], m_TlasInstances[index]);
+
+            // Upload the dirty entries as runs of consecutive indices
+            size_t runStart = 0;
+            for (size_t i = 1; i <= m_DirtyTlasInstances.size(); i++)
+            {
+                if (i < m_DirtyTlasInstances.size() && m_DirtyTlasInstances[i] == m_DirtyTlasInstances[i - 1] + 1)
+                    continue;
+
+                const uint32_t firstIndex = m_DirtyTlasInstances[runStart];
+                const size_t count = i - runStart;
+                commandList->writeBuffer(m_TlasInstanceBuffer, &m_TlasInstances[firstIndex], count * sizeof(nvrhi::rt::InstanceDesc),
+                    firstIndex * sizeof(nvrhi::rt::InstanceDesc));
+                runStart = i;
+            }
+
+            instancesChanged = true;
+        }
+        m_DirtyTlasInstances.clear();
+
+        if (!instancesChanged && !blasUpdated && !blasCompacted)
+            return;
+
+        // A refit keeps the BVH topology, so it only works when the set of instances is the same as in the last build.
+        // Compacted BLAS'es have moved in memory, which needs a full build.
+        const bool refit = !instanceCountChanged && !sceneStructureChanged && !blasCompacted && m_TlasRefitCount < c_MaxConsecutiveTlasRefits;
+
+        nvrhi::rt::AccelStructBuildFlags buildFlags = nvrhi::rt::AccelStructBuildFlags::AllowUpdate;
+        if (refit)
+        {
+            buildFlags = buildFlags | nvrhi::rt::AccelStructBuildFlags::PerformUpdate;
+            ++m_TlasRefitCount;
+        }
+        else
+        {
+            m_TlasRefitCount = 0;
+        }
 
-        commandList->beginMarker("TLAS Update");
-        commandList->buildTopLevelAccelStruct(m_TopLevelAS, instances.data(), instances.size());
+        commandList->beginMarker(refit ? "TLAS Refit" : "TLAS Build");
+        commandList->buildTopLevelAccelStructFromBuffer(m_TopLevelAS, m_TlasInstanceBuffer, 0, m_TlasInstances.size(), buildFlags);
         commandList->endMarker();
     }
 
@@ -438,7 +525,7 @@ public:
                 nvrhi::BindingSetItem::ConstantBuffer(0, m_ConstantBuffer),
                 nvrhi::BindingSetItem::RayTracingAccelStruct(0, m_TopLevelAS),
                 nvrhi::BindingSetItem::StructuredBuffer_SRV(1, m_Scene->GetInstanceBuffer()),
-                nvrhi::BindingSetItem::StructuredBuffer_SRV(2, m_Scene->GetGeometryBuffer()),
+                nvrhi::BindingSetItem::StructuredBuffer_SRV(2, m_Skinning->GetGeometryBuffer()),
                 nvrhi::BindingSetItem::StructuredBuffer_SRV(3, m_Scene->GetMaterialBuffer()),
                 nvrhi::BindingSetItem::Sampler(0, m_CommonPasses->m_AnisotropicWrapSampler),
                 nvrhi::BindingSetItem::Texture_UAV(0, m_ColorBuffer)
@@ -454,8 +541,19 @@ public:
 
         m_CommandList->open();
 
+        const bool sceneStructureChanged = m_Scene->GetSceneGraph()->HasPendingStructureChanges();
+        if (!sceneStructureChanged && m_Scene->GetSceneGraph()->HasPendingTransformChanges())
+            MarkDirtyTlasInstances();
+
         m_Scene->Refresh(m_CommandList, GetFrameIndex());
-        BuildTLAS(m_CommandList, GetFrameIndex());
+
+        if (sceneStructureChanged || !m_SkinnedGeometryValid)
+        {
+            m_Skinning->UpdateGeometryBuffer(m_CommandList, *m_Scene);
+            m_SkinnedGeometryValid = true;
+        }
+
+        BuildTLAS(m_CommandList, GetFrameIndex(), sceneStructureChanged);
         
         LightingConstants constants = {};
         constants.ambientColor = float4(0.05f);
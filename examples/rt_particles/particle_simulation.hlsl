@@ -0,0 +1,249 @@
+/*
+* Copyright (c) 2014-2023, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+// GPU particle simulation.
+// The particles live in fixed slots of u_Particles, and slot N always owns quad N in the particle mesh,
+// ParticleInfo N and intersection instance N in the TLAS. This keeps the primitive count of the particle BLAS
+// and the instance count of the TLAS constant, so both can be refitted instead of rebuilt.
+// Dead particles are collapsed into zero-area quads and masked out of the TLAS.
+// Free slots are tracked in a stack (u_FreeList) with the element count stored in u_Counters:
+// simulate_cs pushes the slots of the particles that die, and emit_cs pops slots for new particles.
+// The two never run in the same dispatch.
+
+#pragma pack_matrix(row_major)
+
+#include "rt_particles_cb.h"
+
+ConstantBuffer<ParticleSimulationConstants> g_Simulation : register(b0);
+
+RWStructuredBuffer<ParticleState> u_Particles : register(u0);
+RWStructuredBuffer<uint> u_FreeList : register(u1);
+RWByteAddressBuffer u_Counters : register(u2);
+RWByteAddressBuffer u_Indices : register(u3);
+RWByteAddressBuffer u_Vertices : register(u4);
+RWStructuredBuffer<ParticleInfo> u_ParticleInfos : register(u5);
+RWStructuredBuffer<TlasInstanceDesc> u_TlasInstances : register(u6);
+
+static const uint c_FreeCountOffset = 0;
+static const uint c_IndicesPerQuad = 6;
+static const uint c_VerticesPerQuad = 4;
+
+uint hashUint(uint x)
+{
+    // PCG hash
+    uint state = x * 747796405u + 2891336453u;
+    uint word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+    return (word >> 22u) ^ word;
+}
+
+struct RandomState
+{
+    uint seed;
+};
+
+float randomFloat(inout RandomState rng)
+{
+    rng.seed = hashUint(rng.seed);
+    return float(rng.seed >> 8) * (1.0 / 16777216.0);
+}
+
+float3 randomFloat3(inout RandomState rng)
+{
+    float x = randomFloat(rng);
+    float y = randomFloat(rng);
+    float z = randomFloat(rng);
+    return float3(x, y, z);
+}
+
+void writeQuadPositions(uint slot, float3 center, float3 worldRight, float3 worldUp)
+{
+    const uint baseAddress = slot * c_VerticesPerQuad * 12;
+    u_Vertices.Store3(baseAddress + 0,  asuint(center - worldRight + worldUp));
+    u_Vertices.Store3(baseAddress + 12, asuint(center + worldRight + worldUp));
+    u_Vertices.Store3(baseAddress + 24, asuint(center + worldRight - worldUp));
+    u_Vertices.Store3(baseAddress + 36, asuint(center - worldRight - worldUp));
+}
+
+// Collapses the particle into a zero-area quad and removes it from the intersection particle set.
+// The quad stays where the particle was, so that refitting the BLAS doesn't stretch the bounding boxes.
+void writeDeadParticle(uint slot, float3 position)
+{
+    writeQuadPositions(slot, position, 0, 0);
+
+    ParticleInfo info = (ParticleInfo)0;
+    info.center = position;
+    info.inverseRadius = 1.0;
+    info.textureIndex = g_Simulation.textureIndex;
+    u_ParticleInfos[slot] = info;
+
+    TlasInstanceDesc instance;
+    instance.transform[0] = float4(0, 0, 0, position.x);
+    instance.transform[1] = float4(0, 0, 0, position.y);
+    instance.transform[2] = float4(0, 0, 0, position.z);
+    instance.instanceIDAndMask = slot; // Mask = 0, so no rays will ever hit this instance
+    instance.hitGroupAndFlags = 0;
+    instance.blasAddress = g_Simulation.intersectionBlasAddress;
+    u_TlasInstances[g_Simulation.tlasInstanceOffset + slot] = instance;
+}
+
+// Initializes all particle slots as dead and fills the constant parts of the particle mesh.
+[numthreads(PARTICLE_SIMULATION_GROUP_SIZE, 1, 1)]
+void reset_cs(uint slot : SV_DispatchThreadID)
+{
+    if (slot >= g_Simulation.maxParticles)
+        return;
+
+    if (slot == 0)
+        u_Counters.Store(c_FreeCountOffset, g_Simulation.maxParticles);
+
+    // Fill the stack in reverse order so that the lowest slots are allocated first
+    u_FreeList[slot] = g_Simulation.maxParticles - 1 - slot;
+
+    ParticleState particle = (ParticleState)0;
+    particle.position = g_Simulation.emitterPosition;
+    u_Particles[slot] = particle;
+
+    // Indices for a quad
+    const uint baseIndexAddress = slot * c_IndicesPerQuad * 4;
+    const uint baseVertex = slot * c_VerticesPerQuad;
+    u_Indices.Store3(baseIndexAddress + 0,  uint3(baseVertex + 0, baseVertex + 1, baseVertex + 2));
+    u_Indices.Store3(baseIndexAddress + 12, uint3(baseVertex + 0, baseVertex + 2, baseVertex + 3));
+
+    // Texture coordinates
+    const uint baseTexcoordAddress = g_Simulation.texcoordByteOffset + slot * c_VerticesPerQuad * 8;
+    u_Vertices.Store2(baseTexcoordAddress + 0,  asuint(float2(0, 0)));
+    u_Vertices.Store2(baseTexcoordAddress + 8,  asuint(float2(1, 0)));
+    u_Vertices.Store2(baseTexcoordAddress + 16, asuint(float2(1, 1)));
+    u_Vertices.Store2(baseTexcoordAddress + 24, asuint(float2(0, 1)));
+
+    writeDeadParticle(slot, particle.position);
+}
+
+// Allocates slots for g_Simulation.emitCount new particles, as long as there are free slots.
+[numthreads(PARTICLE_SIMULATION_GROUP_SIZE, 1, 1)]
+void emit_cs(uint threadIndex : SV_DispatchThreadID)
+{
+    if (threadIndex >= g_Simulation.emitCount)
+        return;
+
+    uint freeCount;
+    u_Counters.InterlockedAdd(c_FreeCountOffset, uint(-1), freeCount);
+
+    if (int(freeCount) <= 0)
+    {
+        // The stack is empty, undo the decrement
+        u_Counters.InterlockedAdd(c_FreeCountOffset, 1);
+        return;
+    }
+
+    const uint slot = u_FreeList[freeCount - 1];
+
+    RandomState rng;
+    rng.seed = hashUint(threadIndex ^ hashUint(g_Simulation.randomSeed));
+
+    // Same distributions as ParticleEntity::Emit on the CPU
+    ParticleState particle;
+    particle.position = g_Simulation.emitterPosition;
+    particle.velocity = randomFloat3(rng) - 0.5;
+    particle.velocity.y += 1.0;
+    particle.radius = randomFloat(rng) * 0.05 + 0.1;
+    particle.age = 0;
+    particle.color = randomFloat3(rng) * 0.5 + 0.1;
+    particle.rotation = randomFloat(rng) * 6.28;
+    particle.alive = 1;
+    particle.justEmitted = 1;
+    particle.padding = 0;
+
+    u_Particles[slot] = particle;
+}
+
+// Advances the live particles, releases the ones that reached the end of their life,
+// and writes the billboard geometry, ParticleInfo and TLAS instance for every live particle.
+[numthreads(PARTICLE_SIMULATION_GROUP_SIZE, 1, 1)]
+void simulate_cs(uint slot : SV_DispatchThreadID)
+{
+    if (slot >= g_Simulation.maxParticles)
+        return;
+
+    ParticleState particle = u_Particles[slot];
+
+    if (!particle.alive)
+        return;
+
+    // Same motion as ParticleEntity::Animate on the CPU
+    if (!particle.justEmitted)
+    {
+        const float deltaTime = g_Simulation.deltaTime;
+        particle.position += particle.velocity * deltaTime;
+        particle.velocity.y += 1.0 * deltaTime;
+        particle.velocity.x += 1.0 * deltaTime;
+        particle.age += deltaTime;
+        particle.radius += 0.5 * deltaTime;
+    }
+    particle.justEmitted = 0;
+
+    if (particle.age > PARTICLE_LIFETIME)
+    {
+        particle.alive = 0;
+        u_Particles[slot] = particle;
+
+        uint freeCount;
+        u_Counters.InterlockedAdd(c_FreeCountOffset, 1, freeCount);
+        u_FreeList[freeCount] = slot;
+
+        writeDeadParticle(slot, particle.position);
+        return;
+    }
+
+    u_Particles[slot] = particle;
+
+    // Compute the quad orientation in world space
+    const float rotation = (g_Simulation.orientationMode == ORIENTATION_MODE_BEAM) ? 0 : particle.rotation;
+    float2 localRight;
+    sincos(rotation, localRight.y, localRight.x);
+    const float2 localUp = float2(-localRight.y, localRight.x);
+    const float3 worldRight = localRight.x * g_Simulation.cameraRight + localRight.y * g_Simulation.cameraUp;
+    const float3 worldUp    = localUp.x    * g_Simulation.cameraRight + localUp.y    * g_Simulation.cameraUp;
+
+    writeQuadPositions(slot, particle.position, worldRight * particle.radius, worldUp * particle.radius);
+
+    ParticleInfo info;
+    info.center = particle.position;
+    info.rotation = particle.rotation;
+    info.colorFactor = particle.color;
+    info.opacityFactor = saturate((PARTICLE_LIFETIME - particle.age) * 0.5);
+    info.xAxis = worldRight;
+    info.yAxis = worldUp;
+    info.inverseRadius = 1.0 / particle.radius;
+    info.textureIndex = g_Simulation.textureIndex;
+    u_ParticleInfos[slot] = info;
+
+    // Scale and translate the AABB to make it contain the particle billboard
+    TlasInstanceDesc instance;
+    instance.transform[0] = float4(particle.radius, 0, 0, particle.position.x);
+    instance.transform[1] = float4(0, particle.radius, 0, particle.position.y);
+    instance.transform[2] = float4(0, 0, particle.radius, particle.position.z);
+    instance.instanceIDAndMask = slot | (INSTANCE_MASK_INTERSECTION_PARTICLE << 24);
+    instance.hitGroupAndFlags = 0;
+    instance.blasAddress = g_Simulation.intersectionBlasAddress;
+    u_TlasInstances[g_Simulation.tlasInstanceOffset + slot] = instance;
+}
@@ -35,17 +35,27 @@
 #include <donut/core/math/math.h>
 #include <nvrhi/utils.h>
 
+#include <algorithm>
 
 using namespace donut;
 using namespace donut::math;
 
 #include "rt_particles_cb.h"
+#include "BlasManager.h"
 
 static const char* g_WindowTitle = "Donut Example: Ray Traced Particles";
 
 constexpr uint32_t c_MaxParticles = 1024;
+constexpr uint32_t c_MaxGpuParticles = 128 * 1024; // The GPU simulation mode has no CPU cost per particle
 constexpr uint32_t c_IndicesPerQuad = 6;
 constexpr uint32_t c_VerticesPerQuad = 4;
+// The particle instances move every frame, so the TLAS is refitted while the number of active particles stays the same.
+// Every so many refits it is rebuilt to restore the BVH quality.
+constexpr uint32_t c_MaxConsecutiveTlasRefits = 60;
+// Same for the particle BLAS in the GPU simulation mode, where the particle quads are always in the same slots.
+constexpr uint32_t c_MaxConsecutiveBlasRefits = 60;
+
+static_assert(sizeof(TlasInstanceDesc) == sizeof(nvrhi::rt::InstanceDesc), "TlasInstanceDesc must match the native instance layout");
 
 static float RandomFloat()
 {
@@ -83,7 +93,7 @@ struct ParticleEntity
 
     void Animate(float time)
     {
-        const float lifeTime = 2.f;
+        const float lifeTime = float(PARTICLE_LIFETIME);
 
         position += velocity * time;
         velocity.y += 1.f * time;
@@ -114,6 +124,8 @@ struct UIData
     uint mlabFragments = 4;
     ParticleTexture particleTexture = ParticleTexture::Smoke;
     float3 emitterPosition = 0.f;
+    bool gpuSimulation = false;
+    float gpuEmissionRate = 5000.f; // Particles per second
 };
 
 class RayTracedParticles : public app::ApplicationBase
@@ -128,7 +140,13 @@ private:
     nvrhi::BindingSetHandle m_BindingSet;
     nvrhi::BindingLayoutHandle m_BindlessLayout;
 
+    std::unique_ptr<BlasManager> m_BlasManager;
     nvrhi::rt::AccelStructHandle m_TopLevelAS;
+    std::vector<nvrhi::rt::InstanceDesc> m_TlasInstances; // Scene instances first, then the particle instances
+    uint32_t m_NumSceneTlasInstances = 0;
+    uint32_t m_MaxSceneTlasInstances = 0;
+    uint32_t m_TlasRefitCount = 0;
+    bool m_TlasBuilt = false;
 
     nvrhi::BufferHandle m_ConstantBuffer;
 
@@ -152,6 +170,27 @@ private:
     std::vector<ParticleEntity> m_Particles;
     std::vector<ParticleInfo> m_ParticleInfoData;
 
+    // GPU simulation mode
+    nvrhi::ShaderHandle m_ParticleResetShader;
+    nvrhi::ShaderHandle m_ParticleEmitShader;
+    nvrhi::ShaderHandle m_ParticleSimulateShader;
+    nvrhi::ComputePipelineHandle m_ParticleResetPipeline;
+    nvrhi::ComputePipelineHandle m_ParticleEmitPipeline;
+    nvrhi::ComputePipelineHandle m_ParticleSimulatePipeline;
+    nvrhi::BindingLayoutHandle m_ParticleSimulationBindingLayout;
+    nvrhi::BindingSetHandle m_ParticleSimulationBindingSet;
+    nvrhi::BufferHandle m_ParticleSimulationConstants;
+    nvrhi::BufferHandle m_ParticleStateBuffer;
+    nvrhi::BufferHandle m_ParticleFreeListBuffer;
+    nvrhi::BufferHandle m_ParticleCounterBuffer;
+    nvrhi::BufferHandle m_TlasInstanceBuffer; // Scene instances first, then c_MaxGpuParticles intersection particle instances
+    bool m_GpuSimulationActive = false;
+    bool m_GpuParticlesNeedReset = true;
+    bool m_ParticleBlasRefittable = false;
+    uint32_t m_ParticleBlasRefitCount = 0;
+    float m_GpuSimulationTime = 0.f; // Time that passed since the last GPU simulation step
+    float m_GpuEmissionAccumulator = 0.f;
+
     std::shared_ptr<engine::LoadedTexture> m_EnvironmentMap;
     std::shared_ptr<engine::LoadedTexture> m_SmokeTexture;
     std::shared_ptr<engine::LoadedTexture> m_LogoTexture;
@@ -215,6 +254,9 @@ public:
         m_Particles.resize(c_MaxParticles);
         m_ParticleInfoData.resize(c_MaxParticles);
 
+        if (!CreateParticleSimulation(*m_ShaderFactory))
+            return false;
+
         m_EnvironmentMap = m_TextureCache->LoadTextureFromFileDeferred("/media/rt_particles/environment-map.dds", false);
         m_SmokeTexture = m_TextureCache->LoadTextureFromFileDeferred("/media/rt_particles/smoke-particle.png", true);
         m_LogoTexture = m_TextureCache->LoadTextureFromFileDeferred("/media/nvidia-logo.png", true);
@@ -262,15 +304,16 @@ public:
         auto& positionRange = m_ParticleBuffers->getVertexBufferRange(engine::VertexAttribute::Position);
         auto& texcoordRange = m_ParticleBuffers->getVertexBufferRange(engine::VertexAttribute::TexCoord1);
         positionRange.byteOffset = 0;
-        positionRange.byteSize = c_MaxParticles * c_VerticesPerQuad * sizeof(float3);
+        positionRange.byteSize = c_MaxGpuParticles * c_VerticesPerQuad * sizeof(float3);
         texcoordRange.byteOffset = positionRange.byteOffset + positionRange.byteSize;
-        texcoordRange.byteSize = c_MaxParticles * c_VerticesPerQuad * sizeof(float2);
+        texcoordRange.byteSize = c_MaxGpuParticles * c_VerticesPerQuad * sizeof(float2);
 
-        // Index buffer
+        // Index buffer, also written by the GPU simulation
         nvrhi::BufferDesc bufferDesc;
-        bufferDesc.byteSize = c_MaxParticles * c_IndicesPerQuad * sizeof(uint32_t);
+        bufferDesc.byteSize = c_MaxGpuParticles * c_IndicesPerQuad * sizeof(uint32_t);
         bufferDesc.debugName = "ParticleIndices";
         bufferDesc.canHaveRawViews = true;
+        bufferDesc.canHaveUAVs = true;
         bufferDesc.initialState = nvrhi::ResourceStates::ShaderResource | nvrhi::ResourceStates::AccelStructBuildInput;
         bufferDesc.keepInitialState = true;
         bufferDesc.isAccelStructBuildInput = true;
@@ -297,11 +340,11 @@ public:
         m_ParticleGeometry->material = m_ParticleMaterial;
 
         // Set numVertices and numIndices to max possible to make sure that we create an appropriate BLAS before rendering
-        m_ParticleGeometry->numVertices = c_MaxParticles * c_VerticesPerQuad;
-        m_ParticleGeometry->numIndices = c_MaxParticles * c_IndicesPerQuad;
-        m_ParticleBuffers->indexData.resize(m_ParticleGeometry->numIndices);
-        m_ParticleBuffers->positionData.resize(m_ParticleGeometry->numVertices);
-        m_ParticleBuffers->texcoord1Data.resize(m_ParticleGeometry->numVertices);
+        m_ParticleGeometry->numVertices = c_MaxGpuParticles * c_VerticesPerQuad;
+        m_ParticleGeometry->numIndices = c_MaxGpuParticles * c_IndicesPerQuad;
+        m_ParticleBuffers->indexData.resize(c_MaxParticles * c_IndicesPerQuad);
+        m_ParticleBuffers->positionData.resize(c_MaxParticles * c_VerticesPerQuad);
+        m_ParticleBuffers->texcoord1Data.resize(c_MaxParticles * c_VerticesPerQuad);
 
         // Mesh
         m_ParticleMesh = std::make_shared<engine::MeshInfo>();
@@ -313,21 +356,76 @@ public:
         m_ParticleInstance = std::make_shared<engine::MeshInstance>(m_ParticleMesh);
 
         // Particle info buffer
-        bufferDesc.byteSize = c_MaxParticles * sizeof(ParticleInfo);
+        bufferDesc.byteSize = c_MaxGpuParticles * sizeof(ParticleInfo);
         bufferDesc.canHaveRawViews = false;
         bufferDesc.structStride = sizeof(ParticleInfo);
         bufferDesc.debugName = "ParticleInfoBuffer";
         m_ParticleInfoBuffer = GetDevice()->createBuffer(bufferDesc);
+
+        // Buffers for the GPU simulation mode
+        bufferDesc = nvrhi::BufferDesc();
+        bufferDesc.canHaveUAVs = true;
+        bufferDesc.initialState = nvrhi::ResourceStates::UnorderedAccess;
+        bufferDesc.keepInitialState = true;
+
+        bufferDesc.byteSize = c_MaxGpuParticles * sizeof(ParticleState);
+        bufferDesc.structStride = sizeof(ParticleState);
+        bufferDesc.debugName = "ParticleStateBuffer";
+        m_ParticleStateBuffer = GetDevice()->createBuffer(bufferDesc);
+
+        bufferDesc.byteSize = c_MaxGpuParticles * sizeof(uint32_t);
+        bufferDesc.structStride = sizeof(uint32_t);
+        bufferDesc.debugName = "ParticleFreeList";
+        m_ParticleFreeListBuffer = GetDevice()->createBuffer(bufferDesc);
+
+        bufferDesc.byteSize = sizeof(uint32_t) * 4;
+        bufferDesc.structStride = 0;
+        bufferDesc.canHaveRawViews = true;
+        bufferDesc.debugName = "ParticleCounters";
+        m_ParticleCounterBuffer = GetDevice()->createBuffer(bufferDesc);
+
+        m_ParticleSimulationConstants = GetDevice()->createBuffer(nvrhi::utils::CreateVolatileConstantBufferDesc(
+            sizeof(ParticleSimulationConstants), "ParticleSimulationConstants", engine::c_MaxRenderPassConstantBufferVersions));
     }
 
-    // Updates particle geometry -- to be called before rendering every frame
-    void BuildParticleGeometry(nvrhi::ICommandList* commandList)
+    bool CreateParticleSimulation(engine::ShaderFactory& shaderFactory)
+    {
+        m_ParticleResetShader = shaderFactory.CreateShader("app/particle_simulation.hlsl", "reset_cs", nullptr, nvrhi::ShaderType::Compute);
+        m_ParticleEmitShader = shaderFactory.CreateShader("app/particle_simulation.hlsl", "emit_cs", nullptr, nvrhi::ShaderType::Compute);
+        m_ParticleSimulateShader = shaderFactory.CreateShader("app/particle_simulation.hlsl", "simulate_cs", nullptr, nvrhi::ShaderType::Compute);
+
+        if (!m_ParticleResetShader || !m_ParticleEmitShader || !m_ParticleSimulateShader)
+            return false;
+
+        nvrhi::BindingLayoutDesc layoutDesc;
+        layoutDesc.visibility = nvrhi::ShaderType::Compute;
+        layoutDesc.bindings = {
+            nvrhi::BindingLayoutItem::VolatileConstantBuffer(0),
+            nvrhi::BindingLayoutItem::StructuredBuffer_UAV(0),
+            nvrhi::BindingLayoutItem::StructuredBuffer_UAV(1),
+            nvrhi::BindingLayoutItem::RawBuffer_UAV(2),
+            nvrhi::BindingLayoutItem::RawBuffer_UAV(3),
+            nvrhi::BindingLayoutItem::RawBuffer_UAV(4),
+            nvrhi::BindingLayoutItem::StructuredBuffer_UAV(5),
+            nvrhi::BindingLayoutItem::StructuredBuffer_UAV(6)
+        };
+        m_ParticleSimulationBindingLayout = GetDevice()->createBindingLayout(layoutDesc);
+
+        auto pipelineDesc = nvrhi::ComputePipelineDesc()
+            .addBindingLayout(m_ParticleSimulationBindingLayout);
+
+        m_ParticleResetPipeline = GetDevice()->createComputePipeline(pipelineDesc.setComputeShader(m_ParticleResetShader));
+        m_ParticleEmitPipeline = GetDevice()->createComputePipeline(pipelineDesc.setComputeShader(m_ParticleEmitShader));
+        m_ParticleSimulatePipeline = GetDevice()->createComputePipeline(pipelineDesc.setComputeShader(m_ParticleSimulateShader));
+
+        return m_ParticleResetPipeline && m_ParticleEmitPipeline && m_ParticleSimulatePipeline;
+    }
+
+    // Computes the camera plane vectors for particle orientation
+    void GetParticleCameraBasis(float3& cameraRight, float3& cameraUp) const
     {
-        commandList->beginMarker("Update Particles");
-        
-        // Get the camera plane vectors for particle orientation
         float3 cameraForward = m_Camera.GetDir();
-        float3 cameraUp = m_Camera.GetUp();
+        cameraUp = m_Camera.GetUp();
 
         // To demonstrate beam orientation, we create vertical sprites that are free to rotate
         // around the world-space Y axis, simulating what old Doom-like games used.
@@ -341,7 +439,17 @@ public:
             cameraUp = float3(0.f, 1.f, 0.f);
         }
 
-        const float3 cameraRight = cross(cameraForward, cameraUp);
+        cameraRight = cross(cameraForward, cameraUp);
+    }
+
+    // Updates particle geometry -- to be called before rendering every frame
+    void BuildParticleGeometry(nvrhi::ICommandList* commandList)
+    {
+        commandList->beginMarker("Update Particles");
+        
+        // Get the camera plane vectors for particle orientation
+        float3 cameraRight, cameraUp;
+        GetParticleCameraBasis(cameraRight, cameraUp);
 
         // Generate the geometry for particles
         uint32_t numParticles = 0;
@@ -412,14 +520,102 @@ public:
             commandList->writeBuffer(m_ParticleInfoBuffer, m_ParticleInfoData.data(), numParticles * sizeof(ParticleInfo), 0);
         }
 
-        // Build the BLAS
-        nvrhi::rt::AccelStructDesc blasDesc;
-        GetMeshBlasDesc(*m_ParticleMesh, blasDesc);
-        nvrhi::utils::BuildBottomLevelAccelStruct(commandList, m_ParticleMesh->accelStruct, blasDesc);
+        // Build the BLAS - the primitive count changes between frames, so this is always a full build
+        m_BlasManager->BuildDynamic(commandList, { m_ParticleMesh.get() });
         
         commandList->endMarker();
     }
 
+    // Runs the GPU simulation step and refits the particle BLAS -- replaces BuildParticleGeometry in the GPU simulation mode
+    void SimulateGpuParticles(nvrhi::ICommandList* commandList)
+    {
+        commandList->beginMarker("Simulate Particles");
+
+        if (!m_ParticleSimulationBindingSet)
+        {
+            nvrhi::BindingSetDesc bindingSetDesc;
+            bindingSetDesc.bindings = {
+                nvrhi::BindingSetItem::ConstantBuffer(0, m_ParticleSimulationConstants),
+                nvrhi::BindingSetItem::StructuredBuffer_UAV(0, m_ParticleStateBuffer),
+                nvrhi::BindingSetItem::StructuredBuffer_UAV(1, m_ParticleFreeListBuffer),
+                nvrhi::BindingSetItem::RawBuffer_UAV(2, m_ParticleCounterBuffer),
+                nvrhi::BindingSetItem::RawBuffer_UAV(3, m_ParticleBuffers->indexBuffer),
+                nvrhi::BindingSetItem::RawBuffer_UAV(4, m_ParticleBuffers->vertexBuffer),
+                nvrhi::BindingSetItem::StructuredBuffer_UAV(5, m_ParticleInfoBuffer),
+                nvrhi::BindingSetItem::StructuredBuffer_UAV(6, m_TlasInstanceBuffer)
+            };
+
+            m_ParticleSimulationBindingSet = GetDevice()->createBindingSet(bindingSetDesc, m_ParticleSimulationBindingLayout);
+        }
+
+        float3 cameraRight, cameraUp;
+        GetParticleCameraBasis(cameraRight, cameraUp);
+
+        const uint32_t emitCount = std::min(uint32_t(m_GpuEmissionAccumulator), c_MaxGpuParticles);
+        m_GpuEmissionAccumulator -= float(emitCount);
+
+        const uint64_t intersectionBlasAddress = m_ParticleIntersectionBLAS->getDeviceAddress();
+
+        ParticleSimulationConstants constants = {};
+        constants.emitterPosition = m_ui->emitterPosition;
+        constants.deltaTime = m_GpuSimulationTime;
+        constants.cameraRight = cameraRight;
+        constants.emitCount = emitCount;
+        constants.cameraUp = cameraUp;
+        constants.randomSeed = GetFrameIndex();
+        constants.maxParticles = c_MaxGpuParticles;
+        constants.tlasInstanceOffset = m_MaxSceneTlasInstances;
+        constants.intersectionBlasAddress = uint2(uint32_t(intersectionBlasAddress), uint32_t(intersectionBlasAddress >> 32));
+        constants.orientationMode = m_ui->orientationMode;
+        constants.textureIndex = m_ParticleMaterial->baseOrDiffuseTexture->bindlessDescriptor.Get();
+        constants.texcoordByteOffset = uint32_t(m_ParticleBuffers->getVertexBufferRange(engine::VertexAttribute::TexCoord1).byteOffset);
+        commandList->writeBuffer(m_ParticleSimulationConstants, &constants, sizeof(constants));
+
+        m_GpuSimulationTime = 0.f;
+
+        nvrhi::ComputeState state;
+        state.bindings = { m_ParticleSimulationBindingSet };
+
+        const uint32_t particleGroups = div_ceil(c_MaxGpuParticles, PARTICLE_SIMULATION_GROUP_SIZE);
+
+        if (m_GpuParticlesNeedReset)
+        {
+            state.pipeline = m_ParticleResetPipeline;
+            commandList->setComputeState(state);
+            commandList->dispatch(particleGroups);
+
+            m_GpuParticlesNeedReset = false;
+        }
+
+        // Emission runs before the simulation so that the two never push and pop the free list at the same time
+        if (emitCount > 0)
+        {
+            state.pipeline = m_ParticleEmitPipeline;
+            commandList->setComputeState(state);
+            commandList->dispatch(div_ceil(emitCount, PARTICLE_SIMULATION_GROUP_SIZE));
+        }
+
+        state.pipeline = m_ParticleSimulatePipeline;
+        commandList->setComputeState(state);
+        commandList->dispatch(particleGroups);
+
+        // Every particle slot has a quad in the mesh, dead particles have zero-area quads
+        m_ParticleGeometry->numIndices = c_MaxGpuParticles * c_IndicesPerQuad;
+        m_ParticleGeometry->numVertices = c_MaxGpuParticles * c_VerticesPerQuad;
+
+        // The primitive count doesn't change, so the BLAS can be refitted in place
+        const bool refit = m_ParticleBlasRefittable && m_ParticleBlasRefitCount < c_MaxConsecutiveBlasRefits;
+        if (refit)
+            ++m_ParticleBlasRefitCount;
+        else
+            m_ParticleBlasRefitCount = 0;
+
+        m_BlasManager->BuildDynamic(commandList, { m_ParticleMesh.get() }, refit);
+        m_ParticleBlasRefittable = true;
+
+        commandList->endMarker();
+    }
+
     void BuildParticleIntersectionBLAS(nvrhi::ICommandList* commandList)
     {
         // Only need to create and build the BLAS once, it's immutable
@@ -507,7 +703,13 @@ public:
     {
         m_Camera.Animate(fElapsedTimeSeconds);
 
-        if (IsSceneLoaded() && m_ui->enableAnimations)
+        if (IsSceneLoaded() && m_ui->enableAnimations && m_ui->gpuSimulation)
+        {
+            // The simulation itself runs in Render, just accumulate the time and the number of particles to emit
+            m_GpuSimulationTime += fElapsedTimeSeconds;
+            m_GpuEmissionAccumulator += fElapsedTimeSeconds * m_ui->gpuEmissionRate;
+        }
+        else if (IsSceneLoaded() && m_ui->enableAnimations)
         {
             m_WallclockTime += fElapsedTimeSeconds;
 
@@ -570,79 +772,77 @@ public:
         return true;
     }
 
-    void GetMeshBlasDesc(engine::MeshInfo& mesh, nvrhi::rt::AccelStructDesc& blasDesc) const
-    {
-        blasDesc.isTopLevel = false;
-        blasDesc.debugName = mesh.name;
-
-        for (const auto& geometry : mesh.geometries)
-        {
-            nvrhi::rt::GeometryDesc geometryDesc;
-            auto & triangles = geometryDesc.geometryData.triangles;
-            triangles.indexBuffer = mesh.buffers->indexBuffer;
-            triangles.indexOffset = (mesh.indexOffset + geometry->indexOffsetInMesh) * sizeof(uint32_t);
-            triangles.indexFormat = nvrhi::Format::R32_UINT;
-            triangles.indexCount = geometry->numIndices;
-            triangles.vertexBuffer = mesh.buffers->vertexBuffer;
-            triangles.vertexOffset = (mesh.vertexOffset + geometry->vertexOffsetInMesh) * sizeof(float3) + mesh.buffers->getVertexBufferRange(engine::VertexAttribute::Position).byteOffset;
-            triangles.vertexFormat = nvrhi::Format::RGB32_FLOAT;
-            triangles.vertexStride = sizeof(float3);
-            triangles.vertexCount = geometry->numVertices;
-            geometryDesc.geometryType = nvrhi::rt::GeometryType::Triangles;
-            geometryDesc.flags = (geometry->material->domain == engine::MaterialDomain::Opaque)
-                ? nvrhi::rt::GeometryFlags::Opaque
-                : nvrhi::rt::GeometryFlags::None;
-            blasDesc.bottomLevelGeometries.push_back(geometryDesc);
-        }
-        
-        blasDesc.buildFlags = nvrhi::rt::AccelStructBuildFlags::PreferFastTrace;
-    }
-
     void CreateAccelStructs(nvrhi::ICommandList* commandList)
     {
-        for (const auto& mesh : m_Scene->GetSceneGraph()->GetMeshes())
-        {
-            nvrhi::rt::AccelStructDesc blasDesc;
-            GetMeshBlasDesc(*mesh, blasDesc);
-
-            nvrhi::rt::AccelStructHandle as = GetDevice()->createAccelStruct(blasDesc);
-
-            // Build the BLAS if it's not the particle mesh - that one's dynamic
-            if (mesh != m_ParticleMesh)
-                nvrhi::utils::BuildBottomLevelAccelStruct(commandList, as, blasDesc);
-
-            mesh->accelStruct = as;
-        }
+        // The particle mesh is rebuilt or refitted every frame, see BuildParticleGeometry and SimulateGpuParticles
+        m_BlasManager = std::make_unique<BlasManager>(GetDevice());
+        m_BlasManager->CreateAccelStructs(commandList, *m_Scene->GetSceneGraph(),
+            [this](const engine::MeshInfo& mesh) { return &mesh == m_ParticleMesh.get(); });
         
         nvrhi::rt::AccelStructDesc tlasDesc;
         tlasDesc.isTopLevel = true;
         // Note: the TLAS will include the scene geometries (including the single instance for geometric particles)
         // and many instances of the intersection BLAS, one instnace per particle.
         const uint32_t numSceneInstances = uint32_t(m_Scene->GetSceneGraph()->GetMeshInstances().size());
-        tlasDesc.topLevelMaxInstances = numSceneInstances + c_MaxParticles;
+        tlasDesc.topLevelMaxInstances = numSceneInstances + std::max(c_MaxParticles, c_MaxGpuParticles);
+        tlasDesc.buildFlags = nvrhi::rt::AccelStructBuildFlags::AllowUpdate;
         m_TopLevelAS = GetDevice()->createAccelStruct(tlasDesc);
+
+        // In the GPU simulation mode, the TLAS is built from a buffer where the simulation writes the particle instances
+        nvrhi::BufferDesc instanceBufferDesc;
+        instanceBufferDesc.byteSize = tlasDesc.topLevelMaxInstances * sizeof(nvrhi::rt::InstanceDesc);
+        instanceBufferDesc.structStride = sizeof(nvrhi::rt::InstanceDesc);
+        instanceBufferDesc.canHaveUAVs = true;
+        instanceBufferDesc.isAccelStructBuildInput = true;
+        instanceBufferDesc.initialState = nvrhi::ResourceStates::AccelStructBuildInput;
+        instanceBufferDesc.keepInitialState = true;
+        instanceBufferDesc.debugName = "TlasInstanceBuffer";
+        m_TlasInstanceBuffer = GetDevice()->createBuffer(instanceBufferDesc);
+        m_ParticleSimulationBindingSet = nullptr;
+        m_MaxSceneTlasInstances = numSceneInstances;
+
+        m_TlasInstances.clear();
+        m_TlasInstances.reserve(tlasDesc.topLevelMaxInstances);
+        m_NumSceneTlasInstances = 0;
+        m_TlasRefitCount = 0;
+        m_TlasBuilt = false;
     }
 
-    void BuildTLAS(nvrhi::ICommandList* commandList, uint32_t frameIndex)
-    {   
-        std::vector<nvrhi::rt::InstanceDesc> instances;
+    // The scene change flags must be queried before Scene::Refresh, which resets them
+    void BuildTLAS(nvrhi::ICommandList* commandList, uint32_t frameIndex, bool sceneStructureChanged, bool sceneTransformsChanged)
+    {
+        const auto& meshInstances = m_Scene->GetSceneGraph()->GetMeshInstances();
+        const uint32_t previousInstanceCount = uint32_t(m_TlasInstances.size());
+        const bool sceneInstanceCountChanged = m_NumSceneTlasInstances != uint32_t(meshInstances.size());
 
-        // Generate regular instances for scene meshes
-        for (const auto& instance : m_Scene->GetSceneGraph()->GetMeshInstances())
+        // Regular instances for scene meshes only need to be regenerated when the scene graph has changed
+        if (!m_TlasBuilt || sceneInstanceCountChanged || sceneStructureChanged || sceneTransformsChanged)
         {
-            nvrhi::rt::InstanceDesc instanceDesc;
-            instanceDesc.bottomLevelAS = instance->GetMesh()->accelStruct;
-            assert(instanceDesc.bottomLevelAS);
-            instanceDesc.instanceMask = (instance->GetMesh() == m_ParticleMesh)
-                ? INSTANCE_MASK_PARTICLE_GEOMETRY
-                : INSTANCE_MASK_OPAQUE;
-            instanceDesc.instanceID = instance->GetInstanceIndex();
-
-            auto node = instance->GetNode();
-            assert(node);
-            affineToColumnMajor(node->GetLocalToWorldTransformFloat(), instanceDesc.transform);
-
-            instances.push_back(instanceDesc);
+            m_NumSceneTlasInstances = uint32_t(meshInstances.size());
+            m_TlasInstances.resize(m_NumSceneTlasInstances);
+
+            for (size_t index = 0; index < meshInstances.size(); index++)
+            {
+                const auto& instance = meshInstances[index];
+
+                nvrhi::rt::InstanceDesc instanceDesc;
+                instanceDesc.bottomLevelAS = instance->GetMesh()->accelStruct;
+                assert(instanceDesc.bottomLevelAS);
+                instanceDesc.instanceMask = (instance->GetMesh() == m_ParticleMesh)
+                    ? INSTANCE_MASK_PARTICLE_GEOMETRY
+                    : INSTANCE_MASK_OPAQUE;
+                instanceDesc.instanceID = instance->GetInstanceIndex();
+
+                auto node = instance->GetNode();
+                assert(node);
+                affineToColumnMajor(node->GetLocalToWorldTransformFloat(), instanceDesc.transform);
+
+                m_TlasInstances[index] = instanceDesc;
+            }
+        }
+        else
+        {
+            m_TlasInstances.resize(m_NumSceneTlasInstances);
         }
 
         // Generate intersection instances for active particles
@@ -661,14 +861,89 @@ public:
             const affine3 transform = scaling(float3(particle.radius)) * translation(particle.position);
             affineToColumnMajor(transform, instanceDesc.transform);
 
-            instances.push_back(instanceDesc);
+            m_TlasInstances.push_back(instanceDesc);
 
             ++particleIndex;
         }
+
+        // A refit keeps the BVH topology, so it only works when the set of instances is the same as in the last build
+        const bool refit = m_TlasBuilt
+            && !sceneStructureChanged
+            && uint32_t(m_TlasInstances.size()) == previousInstanceCount
+            && m_TlasRefitCount < c_MaxConsecutiveTlasRefits;
+
+        nvrhi::rt::AccelStructBuildFlags buildFlags = nvrhi::rt::AccelStructBuildFlags::AllowUpdate;
+        if (refit)
+        {
+            buildFlags = buildFlags | nvrhi::rt::AccelStructBuildFlags::PerformUpdate;
+            ++m_TlasRefitCount;
+        }
+        else
+        {
+            m_TlasRefitCount = 0;
+        }
         
-        commandList->beginMarker("TLAS Update");
-        commandList->buildTopLevelAccelStruct(m_TopLevelAS, instances.data(), instances.size());
+        commandList->beginMarker(refit ? "TLAS Refit" : "TLAS Build");
+        commandList->buildTopLevelAccelStruct(m_TopLevelAS, m_TlasInstances.data(), m_TlasInstances.size(), buildFlags);
         commandList->endMarker();
+
+        m_TlasBuilt = true;
+    }
+
+    // GPU simulation mode: the particle instances are already in m_TlasInstanceBuffer, written by SimulateGpuParticles.
+    // The instance count is always the same, so the TLAS is refitted unless the scene structure has changed.
+    void BuildGpuParticleTLAS(nvrhi::ICommandList* commandList, bool sceneStructureChanged, bool sceneTransformsChanged)
+    {
+        if (!m_TlasBuilt || sceneStructureChanged || sceneTransformsChanged)
+        {
+            const auto& meshInstances = m_Scene->GetSceneGraph()->GetMeshInstances();
+            assert(meshInstances.size() <= m_MaxSceneTlasInstances);
+
+            // Unused scene instance slots get an empty mask, so they never produce hits
+            nvrhi::rt::InstanceDesc unusedInstanceDesc;
+            unusedInstanceDesc.blasDeviceAddress = m_ParticleIntersectionBLAS->getDeviceAddress();
+            unusedInstanceDesc.instanceMask = 0;
+            m_TlasInstances.assign(m_MaxSceneTlasInstances, unusedInstanceDesc);
+
+            for (size_t index = 0; index < std::min(meshInstances.size(), size_t(m_MaxSceneTlasInstances)); index++)
+            {
+                const auto& instance = meshInstances[index];
+
+                // The instance buffer is consumed by the GPU directly, so it needs BLAS addresses instead of handles
+                nvrhi::rt::InstanceDesc& instanceDesc = m_TlasInstances[index];
+                assert(instance->GetMesh()->accelStruct);
+                instanceDesc.blasDeviceAddress = instance->GetMesh()->accelStruct->getDeviceAddress();
+                instanceDesc.instanceMask = (instance->GetMesh() == m_ParticleMesh)
+                    ? INSTANCE_MASK_PARTICLE_GEOMETRY
+                    : INSTANCE_MASK_OPAQUE;
+                instanceDesc.instanceID = instance->GetInstanceIndex();
+
+                auto node = instance->GetNode();
+                assert(node);
+                affineToColumnMajor(node->GetLocalToWorldTransformFloat(), instanceDesc.transform);
+            }
+
+            commandList->writeBuffer(m_TlasInstanceBuffer, m_TlasInstances.data(), m_TlasInstances.size() * sizeof(nvrhi::rt::InstanceDesc));
+        }
+
+        const bool refit = m_TlasBuilt && !sceneStructureChanged && m_TlasRefitCount < c_MaxConsecutiveTlasRefits;
+
+        nvrhi::rt::AccelStructBuildFlags buildFlags = nvrhi::rt::AccelStructBuildFlags::AllowUpdate;
+        if (refit)
+        {
+            buildFlags = buildFlags | nvrhi::rt::AccelStructBuildFlags::PerformUpdate;
+            ++m_TlasRefitCount;
+        }
+        else
+        {
+            m_TlasRefitCount = 0;
+        }
+
+        commandList->beginMarker(refit ? "TLAS Refit" : "TLAS Build");
+        commandList->buildTopLevelAccelStructFromBuffer(m_TopLevelAS, m_TlasInstanceBuffer, 0, m_MaxSceneTlasInstances + c_MaxGpuParticles, buildFlags);
+        commandList->endMarker();
+
+        m_TlasBuilt = true;
     }
 
 
@@ -735,13 +1010,43 @@ public:
         m_View.UpdateCache();
         m_Camera.SetView(m_View);
 
+        // Switching between the CPU and GPU simulation invalidates the particle geometry and the TLAS contents
+        bool simulationModeChanged = false;
+        if (m_ui->gpuSimulation != m_GpuSimulationActive)
+        {
+            m_GpuSimulationActive = m_ui->gpuSimulation;
+            m_GpuParticlesNeedReset = true;
+            m_GpuSimulationTime = 0.f;
+            m_GpuEmissionAccumulator = 0.f;
+            m_ParticleBlasRefittable = false;
+            m_TlasBuilt = false;
+            simulationModeChanged = true;
+        }
+
         m_CommandList->open();
+
+        // Compaction moves the BLAS data, so the TLAS needs a full build with the new addresses
+        const bool blasCompacted = m_BlasManager->Compact(m_CommandList);
+        if (blasCompacted)
+            m_TlasBuilt = false;
         
-        if (m_ui->enableAnimations || m_ui->alwaysUpdateOrientation || m_ParticleMaterial->dirty)
+        if (m_ui->enableAnimations || m_ui->alwaysUpdateOrientation || m_ParticleMaterial->dirty || simulationModeChanged || blasCompacted)
         {
+            const bool sceneStructureChanged = m_Scene->GetSceneGraph()->HasPendingStructureChanges();
+            const bool sceneTransformsChanged = m_Scene->GetSceneGraph()->HasPendingTransformChanges();
+
             m_Scene->Refresh(m_CommandList, GetFrameIndex());
-            BuildParticleGeometry(m_CommandList);
-            BuildTLAS(m_CommandList, GetFrameIndex());
+
+            if (m_GpuSimulationActive)
+            {
+                SimulateGpuParticles(m_CommandList);
+                BuildGpuParticleTLAS(m_CommandList, sceneStructureChanged, sceneTransformsChanged);
+            }
+            else
+            {
+                BuildParticleGeometry(m_CommandList);
+                BuildTLAS(m_CommandList, GetFrameIndex(), sceneStructureChanged, sceneTransformsChanged);
+            }
         }
         
         GlobalConstants constants = {};
@@ -789,6 +1094,16 @@ public:
 
         ImGui::Checkbox("Animate particles (Space)", &m_ui->enableAnimations);
         ImGui::Checkbox("Update orientation when paused", &m_ui->alwaysUpdateOrientation);
+        ImGui::Checkbox("Simulate on the GPU", &m_ui->gpuSimulation);
+        if (m_ui->gpuSimulation)
+        {
+            ImGui::Indent();
+            ImGui::PushItemWidth(150.f);
+            ImGui::SliderFloat("Particles per second", &m_ui->gpuEmissionRate, 100.f, float(c_MaxGpuParticles) / float(PARTICLE_LIFETIME), "%.0f",
+                ImGuiSliderFlags_Logarithmic);
+            ImGui::PopItemWidth();
+            ImGui::Unindent();
+        }
         ImGui::Separator();
 
         ImGui::Text("Orientation mode:");
@@ -858,6 +1173,7 @@ int main(int __argc, const char** __argv)
 
     app::DeviceCreationParameters deviceParams;
     deviceParams.enableRayTracingExtensions = true;
+    bool gpuSimulation = false;
     
     for (int i = 1; i < __argc; i++)
     {
@@ -866,6 +1182,10 @@ int main(int __argc, const char** __argv)
             deviceParams.enableDebugRuntime = true;
             deviceParams.enableNvrhiValidationLayer = true;
         }
+        else if (strcmp(__argv[i], "-gpu-particles") == 0)
+        {
+            gpuSimulation = true;
+        }
     }
 
     if (!deviceManager->CreateWindowDeviceAndSwapChain(deviceParams, g_WindowTitle))
@@ -882,6 +1202,7 @@ int main(int __argc, const char** __argv)
 
     {
         UIData uiData;
+        uiData.gpuSimulation = gpuSimulation;
         RayTracedParticles example(deviceManager, &uiData);
         UserInterface gui(deviceManager, &uiData);
 
@@ -52,6 +52,53 @@ struct ParticleInfo
     float opacityFactor;
 };
 
+// State of one particle in the GPU simulation mode, see particle_simulation.hlsl
+struct ParticleState
+{
+    float3 position;
+    float radius;
+
+    float3 velocity;
+    float age;
+
+    float3 color;
+    float rotation;
+
+    uint alive;
+    uint justEmitted; // Set by the emit pass so that the particle isn't advanced in the same frame, like on the CPU
+    uint2 padding;
+};
+
+struct ParticleSimulationConstants
+{
+    float3 emitterPosition;
+    float deltaTime;
+
+    float3 cameraRight;
+    uint emitCount;
+
+    float3 cameraUp;
+    uint randomSeed;
+
+    uint maxParticles;
+    uint tlasInstanceOffset;        // Index of the first particle instance in the TLAS instance buffer
+    uint2 intersectionBlasAddress;  // Device address of the AABB BLAS used by the intersection particles
+
+    uint orientationMode;
+    int textureIndex;
+    uint texcoordByteOffset;        // Offset of the texture coordinates in the particle vertex buffer
+    uint padding;
+};
+
+// Same layout as nvrhi::rt::InstanceDesc, D3D12_RAYTRACING_INSTANCE_DESC and VkAccelerationStructureInstanceKHR
+struct TlasInstanceDesc
+{
+    float4 transform[3];
+    uint instanceIDAndMask;
+    uint hitGroupAndFlags;
+    uint2 blasAddress;
+};
+
 #define INSTANCE_MASK_OPAQUE                1
 #define INSTANCE_MASK_PARTICLE_GEOMETRY     2
 #define INSTANCE_MASK_INTERSECTION_PARTICLE 4
@@ -61,4 +108,7 @@ struct ParticleInfo
 #define ORIENTATION_MODE_BEAM               2
 #define ORIENTATION_MODE_BASIS              3
 
+#define PARTICLE_SIMULATION_GROUP_SIZE      256
+#define PARTICLE_LIFETIME                   2.0
+
 #endif // PARTICLES_CB_H
@@ -36,6 +36,9 @@
 #define REFLECTIONS_BINDING_GBUFFER_1_TEXTURE       3
 #define REFLECTIONS_BINDING_GBUFFER_2_TEXTURE       4
 #define REFLECTIONS_BINDING_GBUFFER_3_TEXTURE       5
+#define REFLECTIONS_BINDING_RAY_LIST                6
+#define REFLECTIONS_BINDING_RAY_COUNT               7
+#define REFLECTIONS_BINDING_REFLECTIONS_UAV         1
 
 #define REFLECTIONS_SPACE_LOCAL                     1
 #define REFLECTIONS_BINDING_MATERIAL_CONSTANTS      0
@@ -56,6 +59,19 @@ struct LightingConstants
 
     LightConstants light;
     PlanarViewConstants view;
+
+    // Pixels rougher than 'roughnessThreshold' use the fallback reflection and trace no rays.
+    // Quads with a pixel smoother than 'mirrorThreshold' trace a ray for every pixel, other quads trace one ray.
+    float roughnessThreshold;
+    float mirrorThreshold;
+    float roughnessFadeRange;
+    uint rayListCapacity;
 };
 
+#define REFLECTIONS_CLASSIFY_GROUP_SIZE 8
+
+// Entries of the ray list are pixel positions packed into 16 bits per coordinate
+#define REFLECTIONS_PACK_PIXEL(pixel) ((pixel).x | ((pixel).y << 16))
+#define REFLECTIONS_UNPACK_PIXEL(entry) uint2((entry) & 0xffff, (entry) >> 16)
+
 #endif // LIGHTING_CB_H
\ No newline at end of file
@@ -0,0 +1,176 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+// classify_cs: sorts the G-buffer quads by roughness and builds the list of pixels that trace reflection rays.
+//   Rough quads trace nothing, glossy quads trace one ray from their smoothest pixel, and quads containing
+//   a near-mirror pixel trace every pixel that isn't rough.
+// upsample_cs: resolves a reflection for every pixel from the traced samples around it, weighted by depth,
+//   normal and roughness similarity, and adds it to the lit image. Rough pixels and pixels without a usable
+//   sample use the ambient term as a stand-in for the environment.
+
+#pragma pack_matrix(row_major)
+
+#include <donut/shaders/gbuffer.hlsli>
+#include <donut/shaders/lighting.hlsli>
+#include "lighting_cb.h"
+
+ConstantBuffer<LightingConstants> g_Lighting : register(b0);
+
+Texture2D t_GBufferDepth : register(t0);
+Texture2D t_GBuffer0 : register(t1);
+Texture2D t_GBuffer1 : register(t2);
+Texture2D t_GBuffer2 : register(t3);
+Texture2D t_GBuffer3 : register(t4);
+Texture2D<float4> t_Reflections : register(t5);
+
+RWStructuredBuffer<uint> u_RayList : register(u0);
+RWByteAddressBuffer u_RayCount : register(u1);
+RWTexture2D<float4> u_Output : register(u2);
+
+bool IsInsideViewport(int2 pixel)
+{
+    return all(pixel >= 0) && all(float2(pixel) < g_Lighting.view.viewportSize);
+}
+
+float GetViewDepth(int2 pixel, float depth)
+{
+    float4 clipPos = float4((float2(pixel) + 0.5) * g_Lighting.view.windowToClipScale + g_Lighting.view.windowToClipBias, depth, 1);
+    float4 viewPos = mul(clipPos, g_Lighting.view.matClipToView);
+    return viewPos.z / viewPos.w;
+}
+
+[numthreads(REFLECTIONS_CLASSIFY_GROUP_SIZE, REFLECTIONS_CLASSIFY_GROUP_SIZE, 1)]
+void classify_cs(uint2 quadIdx : SV_DispatchThreadID)
+{
+    uint2 pixels[4];
+    uint numPixels = 0;
+    uint smoothestPixel = 0;
+    float minRoughness = 1;
+
+    for (uint index = 0; index < 4; index++)
+    {
+        const uint2 pixel = quadIdx * 2 + uint2(index & 1, index >> 1);
+        if (!IsInsideViewport(int2(pixel)))
+            continue;
+
+        MaterialSample surfaceMaterial = DecodeGBuffer(pixel, t_GBuffer0, t_GBuffer1, t_GBuffer2, t_GBuffer3);
+        if (all(surfaceMaterial.shadingNormal == 0) || surfaceMaterial.roughness > g_Lighting.roughnessThreshold)
+            continue;
+
+        if (surfaceMaterial.roughness < minRoughness || numPixels == 0)
+        {
+            minRoughness = surfaceMaterial.roughness;
+            smoothestPixel = numPixels;
+        }
+
+        pixels[numPixels] = pixel;
+        ++numPixels;
+    }
+
+    if (numPixels == 0)
+        return;
+
+    if (minRoughness >= g_Lighting.mirrorThreshold)
+    {
+        pixels[0] = pixels[smoothestPixel];
+        numPixels = 1;
+    }
+
+    uint offset;
+    u_RayCount.InterlockedAdd(0, numPixels, offset);
+
+    for (uint ray = 0; ray < numPixels; ray++)
+    {
+        if (offset + ray < g_Lighting.rayListCapacity)
+            u_RayList[offset + ray] = REFLECTIONS_PACK_PIXEL(pixels[ray]);
+    }
+}
+
+[numthreads(REFLECTIONS_CLASSIFY_GROUP_SIZE, REFLECTIONS_CLASSIFY_GROUP_SIZE, 1)]
+void upsample_cs(uint2 globalIdx : SV_DispatchThreadID)
+{
+    const int2 pixel = int2(globalIdx);
+    if (!IsInsideViewport(pixel))
+        return;
+
+    MaterialSample surfaceMaterial = DecodeGBuffer(globalIdx, t_GBuffer0, t_GBuffer1, t_GBuffer2, t_GBuffer3);
+    if (all(surfaceMaterial.shadingNormal == 0))
+        return;
+
+    const float3 fallback = g_Lighting.ambientColor.rgb;
+    float3 reflection = fallback;
+
+    if (surfaceMaterial.roughness <= g_Lighting.roughnessThreshold)
+    {
+        float4 traced = t_Reflections[pixel];
+
+        if (traced.a == 0)
+        {
+            // Bilateral gather over the neighboring quads
+            const float centerDepth = GetViewDepth(pixel, t_GBufferDepth[pixel].x);
+            float3 colorSum = 0;
+            float weightSum = 0;
+
+            for (int dy = -2; dy <= 2; dy++)
+            {
+                for (int dx = -2; dx <= 2; dx++)
+                {
+                    const int2 neighbor = pixel + int2(dx, dy);
+                    if (!IsInsideViewport(neighbor))
+                        continue;
+
+                    const float4 neighborReflection = t_Reflections[neighbor];
+                    if (neighborReflection.a == 0)
+                        continue;
+
+                    MaterialSample neighborMaterial = DecodeGBuffer(uint2(neighbor), t_GBuffer0, t_GBuffer1, t_GBuffer2, t_GBuffer3);
+                    const float neighborDepth = GetViewDepth(neighbor, t_GBufferDepth[neighbor].x);
+
+                    float weight = exp(-0.5 * float(dx * dx + dy * dy));
+                    weight *= exp(-abs(neighborDepth - centerDepth) / (0.02 * centerDepth));
+                    weight *= pow(saturate(dot(neighborMaterial.shadingNormal, surfaceMaterial.shadingNormal)), 32);
+                    weight *= exp(-abs(neighborMaterial.roughness - surfaceMaterial.roughness) * 10);
+
+                    colorSum += neighborReflection.rgb * weight;
+                    weightSum += weight;
+                }
+            }
+
+            if (weightSum > 1e-4)
+                traced = float4(colorSum / weightSum, 1);
+        }
+
+        if (traced.a != 0)
+        {
+            // Fade into the fallback near the roughness threshold so that the classification boundary isn't visible
+            const float fade = saturate((g_Lighting.roughnessThreshold - surfaceMaterial.roughness) / max(g_Lighting.roughnessFadeRange, 1e-3));
+            reflection = lerp(fallback, traced.rgb, fade);
+        }
+    }
+
+    float2 pixelPosition = float2(globalIdx) + 0.5;
+    float3 surfaceWorldPos = ReconstructWorldPosition(g_Lighting.view, pixelPosition, t_GBufferDepth[pixel].x);
+    float3 viewIncident = GetIncidentVector(g_Lighting.view.cameraDirectionOrPosition, surfaceWorldPos);
+    float3 fresnel = Schlick_Fresnel(surfaceMaterial.specularF0, saturate(-dot(viewIncident, surfaceMaterial.shadingNormal)));
+
+    u_Output[pixel] += float4(reflection * fresnel, 0);
+}
@@ -37,10 +37,15 @@
 #include <donut/core/math/math.h>
 #include <nvrhi/utils.h>
 
+#include <algorithm>
+#include <array>
+#include <cstdio>
+
 using namespace donut;
 using namespace donut::math;
 
 #include "lighting_cb.h"
+#include "BlasManager.h"
 
 static const char* g_WindowTitle = "Donut Example: Ray Traced Reflections";
 
@@ -54,6 +59,13 @@ public:
     nvrhi::TextureHandle m_GBufferEmissive;
     nvrhi::TextureHandle m_HdrColor;
 
+    // Reflection rays: the traced colors with alpha = 1 where a ray was traced,
+    // and the list of pixels to trace built by the classification pass
+    nvrhi::TextureHandle m_Reflections;
+    nvrhi::BufferHandle m_RayList;
+    nvrhi::BufferHandle m_RayCount;
+    uint32_t m_RayListCapacity = 0;
+
     std::shared_ptr<engine::FramebufferFactory> m_HdrFramebuffer;
     std::shared_ptr<engine::FramebufferFactory> m_HdrFramebufferDepth;
     std::shared_ptr<engine::FramebufferFactory> m_GBufferFramebuffer;
@@ -102,6 +114,31 @@ public:
         desc.debugName = "GBufferEmissive";
         m_GBufferEmissive = device->createTexture(desc);
 
+        desc.format = nvrhi::Format::RGBA16_FLOAT;
+        desc.isRenderTarget = false;
+        desc.isUAV = true;
+        desc.initialState = nvrhi::ResourceStates::UnorderedAccess;
+        desc.debugName = "Reflections";
+        m_Reflections = device->createTexture(desc);
+
+        // Every pixel may need its own ray
+        m_RayListCapacity = uint32_t(size.x * size.y);
+
+        nvrhi::BufferDesc bufferDesc;
+        bufferDesc.byteSize = sizeof(uint32_t) * m_RayListCapacity;
+        bufferDesc.structStride = sizeof(uint32_t);
+        bufferDesc.canHaveUAVs = true;
+        bufferDesc.initialState = nvrhi::ResourceStates::ShaderResource;
+        bufferDesc.keepInitialState = true;
+        bufferDesc.debugName = "ReflectionRayList";
+        m_RayList = device->createBuffer(bufferDesc);
+
+        bufferDesc.byteSize = sizeof(uint32_t);
+        bufferDesc.structStride = 0;
+        bufferDesc.canHaveRawViews = true;
+        bufferDesc.debugName = "ReflectionRayCount";
+        m_RayCount = device->createBuffer(bufferDesc);
+
         m_GBufferFramebuffer = std::make_shared<engine::FramebufferFactory>(device);
         m_GBufferFramebuffer->RenderTargets = { m_GBufferDiffuse, m_GBufferSpecular, m_GBufferNormals, m_GBufferEmissive };
         m_GBufferFramebuffer->DepthTarget = m_Depth;
@@ -146,16 +183,38 @@ private:
     nvrhi::ShaderLibraryHandle m_ShaderLibrary;
     nvrhi::rt::PipelineHandle m_Pipeline;
     nvrhi::rt::ShaderTableHandle m_ShaderTable;
+    nvrhi::rt::ShaderTableHandle m_ReflectionShaderTable;
     nvrhi::CommandListHandle m_CommandList;
     nvrhi::BindingLayoutHandle m_GlobalBindingLayout;
     nvrhi::BindingLayoutHandle m_LocalBindingLayout;
     nvrhi::BindingSetHandle m_BindingSet;
 
-    nvrhi::rt::AccelStructHandle m_BottomLevelAS;
+    std::unique_ptr<BlasManager> m_BlasManager;
     nvrhi::rt::AccelStructHandle m_TopLevelAS;
+    std::vector<nvrhi::rt::InstanceDesc> m_TlasInstances;
 
     nvrhi::BufferHandle m_ConstantBuffer;
 
+    nvrhi::ShaderHandle m_ClassifyShader;
+    nvrhi::ShaderHandle m_UpsampleShader;
+    nvrhi::BindingLayoutHandle m_ReflectionPassesBindingLayout;
+    nvrhi::BindingSetHandle m_ReflectionPassesBindingSet;
+    nvrhi::ComputePipelineHandle m_ClassifyPipeline;
+    nvrhi::ComputePipelineHandle m_UpsamplePipeline;
+
+    // The number of reflection rays is read back a few frames later to size the ray dispatch
+    static constexpr uint32_t c_RayCountReadbackCount = 3;
+    std::array<nvrhi::BufferHandle, c_RayCountReadbackCount> m_RayCountReadback;
+    std::array<nvrhi::EventQueryHandle, c_RayCountReadbackCount> m_RayCountQueries;
+    std::array<bool, c_RayCountReadbackCount> m_RayCountPending{};
+    uint32_t m_RayCountReadbackIndex = 0;
+    uint32_t m_LastRayCount = 0;
+    bool m_LastRayCountValid = false;
+
+    bool m_ClassificationEnabled = true;
+    float m_RoughnessThreshold = 0.6f;
+    float m_MirrorThreshold = 0.1f;
+
     std::shared_ptr<engine::ShaderFactory> m_ShaderFactory;
     std::unique_ptr<engine::Scene> m_Scene;
     std::unique_ptr<render::GBufferFillPass> m_GBufferPass;
@@ -211,6 +270,9 @@ public:
         if (!CreateRayTracingPipeline(*m_ShaderFactory))
             return false;
 
+        if (!CreateReflectionPasses(*m_ShaderFactory))
+            return false;
+
         m_CommandList = GetDevice()->createCommandList();
 
         m_CommandList->open();
@@ -241,6 +303,17 @@ public:
 
     bool KeyboardUpdate(int key, int scancode, int action, int mods) override
     {
+        if (action == GLFW_PRESS || action == GLFW_REPEAT)
+        {
+            switch (key)
+            {
+            case GLFW_KEY_C: if (action == GLFW_PRESS) m_ClassificationEnabled = !m_ClassificationEnabled; break;
+            case GLFW_KEY_MINUS: m_RoughnessThreshold = std::max(m_RoughnessThreshold - 0.05f, m_MirrorThreshold); break;
+            case GLFW_KEY_EQUAL: m_RoughnessThreshold = std::min(m_RoughnessThreshold + 0.05f, 1.f); break;
+            default: break;
+            }
+        }
+
         m_Camera.KeyboardUpdate(key, scancode, action, mods);
         return true;
     }
@@ -260,7 +333,15 @@ public:
     void Animate(float fElapsedTimeSeconds) override
     {
         m_Camera.Animate(fElapsedTimeSeconds);
-        GetDeviceManager()->SetInformativeWindowTitle(g_WindowTitle);
+
+        char extraInfo[128] = "";
+        if (m_RenderTargets && m_LastRayCountValid)
+        {
+            snprintf(extraInfo, std::size(extraInfo), "classification (C) %s, roughness cutoff (-/=) %.2f, %u reflection rays (%.0f%% of pixels)",
+                m_ClassificationEnabled ? "on" : "off", m_RoughnessThreshold, m_LastRayCount,
+                100.f * float(m_LastRayCount) / float(m_RenderTargets->m_RayListCapacity));
+        }
+        GetDeviceManager()->SetInformativeWindowTitle(g_WindowTitle, extraInfo);
     }
 
     bool CreateRayTracingPipeline(engine::ShaderFactory& shaderFactory)
@@ -281,7 +362,10 @@ public:
             nvrhi::BindingLayoutItem::Texture_SRV(REFLECTIONS_BINDING_GBUFFER_1_TEXTURE),
             nvrhi::BindingLayoutItem::Texture_SRV(REFLECTIONS_BINDING_GBUFFER_2_TEXTURE),
             nvrhi::BindingLayoutItem::Texture_SRV(REFLECTIONS_BINDING_GBUFFER_3_TEXTURE),
+            nvrhi::BindingLayoutItem::StructuredBuffer_SRV(REFLECTIONS_BINDING_RAY_LIST),
+            nvrhi::BindingLayoutItem::RawBuffer_SRV(REFLECTIONS_BINDING_RAY_COUNT),
             nvrhi::BindingLayoutItem::Texture_UAV(REFLECTIONS_BINDING_OUTPUT_UAV),
+            nvrhi::BindingLayoutItem::Texture_UAV(REFLECTIONS_BINDING_REFLECTIONS_UAV),
             nvrhi::BindingLayoutItem::Sampler(REFLECTIONS_BINDING_MATERIAL_SAMPLER)
         };
 
@@ -310,6 +394,7 @@ public:
         pipelineDesc.globalBindingLayouts = { m_GlobalBindingLayout };
         pipelineDesc.shaders = {
             { "", m_ShaderLibrary->getShader("RayGen", nvrhi::ShaderType::RayGeneration), nullptr },
+            { "", m_ShaderLibrary->getShader("ReflectionRayGen", nvrhi::ShaderType::RayGeneration), nullptr },
             { "", m_ShaderLibrary->getShader("ShadowMiss", nvrhi::ShaderType::Miss), nullptr },
             { "", m_ShaderLibrary->getShader("ReflectionMiss", nvrhi::ShaderType::Miss), nullptr }
         };
@@ -343,6 +428,12 @@ public:
         m_ShaderTable->addMissShader("ShadowMiss");
         m_ShaderTable->addMissShader("ReflectionMiss");
 
+        // The reflection rays are traced in a separate dispatch that only differs in the ray generation shader
+        m_ReflectionShaderTable = m_Pipeline->createShaderTable();
+        m_ReflectionShaderTable->setRayGenerationShader("ReflectionRayGen");
+        m_ReflectionShaderTable->addMissShader("ShadowMiss");
+        m_ReflectionShaderTable->addMissShader("ReflectionMiss");
+
         for (const auto& mesh : m_Scene->GetSceneGraph()->GetMeshes())
         {
             for (const auto& geometry : mesh->geometries)
@@ -396,48 +487,102 @@ public:
                 assert(hitGroupIndex == geometry->globalGeometryIndex * 2);
 
                 m_ShaderTable->addHitGroup("ReflectionHitGroup", localBindingSet);
+
+                m_ReflectionShaderTable->addHitGroup("ShadowHitGroup", nullptr);
+                m_ReflectionShaderTable->addHitGroup("ReflectionHitGroup", localBindingSet);
             }
         }
 
         return true;
     }
 
-    void CreateAccelStruct(nvrhi::ICommandList* commandList)
+    bool CreateReflectionPasses(engine::ShaderFactory& shaderFactory)
     {
-        for (const auto& mesh : m_Scene->GetSceneGraph()->GetMeshes())
+        m_ClassifyShader = shaderFactory.CreateShader("app/reflection_passes.hlsl", "classify_cs", nullptr, nvrhi::ShaderType::Compute);
+        m_UpsampleShader = shaderFactory.CreateShader("app/reflection_passes.hlsl", "upsample_cs", nullptr, nvrhi::ShaderType::Compute);
+
+        if (!m_ClassifyShader || !m_UpsampleShader)
+            return false;
+
+        nvrhi::BindingLayoutDesc layoutDesc;
+        layoutDesc.visibility = nvrhi::ShaderType::Compute;
+        layoutDesc.bindings = {
+            nvrhi::BindingLayoutItem::VolatileConstantBuffer(0),
+            nvrhi::BindingLayoutItem::Texture_SRV(0),
+            nvrhi::BindingLayoutItem::Texture_SRV(1),
+            nvrhi::BindingLayoutItem::Texture_SRV(2),
+            nvrhi::BindingLayoutItem::Texture_SRV(3),
+            nvrhi::BindingLayoutItem::Texture_SRV(4),
+            nvrhi::BindingLayoutItem::Texture_SRV(5),
+            nvrhi::BindingLayoutItem::StructuredBuffer_UAV(0),
+            nvrhi::BindingLayoutItem::RawBuffer_UAV(1),
+            nvrhi::BindingLayoutItem::Texture_UAV(2)
+        };
+        m_ReflectionPassesBindingLayout = GetDevice()->createBindingLayout(layoutDesc);
+
+        m_ClassifyPipeline = GetDevice()->createComputePipeline(nvrhi::ComputePipelineDesc()
+            .setComputeShader(m_ClassifyShader)
+            .addBindingLayout(m_ReflectionPassesBindingLayout));
+        m_UpsamplePipeline = GetDevice()->createComputePipeline(nvrhi::ComputePipelineDesc()
+            .setComputeShader(m_UpsampleShader)
+            .addBindingLayout(m_ReflectionPassesBindingLayout));
+
+        nvrhi::BufferDesc readbackDesc;
+        readbackDesc.byteSize = sizeof(uint32_t);
+        readbackDesc.cpuAccess = nvrhi::CpuAccessMode::Read;
+        readbackDesc.initialState = nvrhi::ResourceStates::CopyDest;
+        readbackDesc.keepInitialState = true;
+        readbackDesc.debugName = "ReflectionRayCountReadback";
+
+        for (uint32_t index = 0; index < c_RayCountReadbackCount; index++)
         {
-            nvrhi::rt::AccelStructDesc blasDesc;
-            blasDesc.isTopLevel = false;
+            m_RayCountReadback[index] = GetDevice()->createBuffer(readbackDesc);
+            m_RayCountQueries[index] = GetDevice()->createEventQuery();
+        }
 
-            for (const auto& geometry : mesh->geometries)
+        return true;
+    }
+
+    // Returns the number of reflection rays to dispatch, from the ray count of an earlier frame plus some headroom.
+    // Rays that don't fit into the dispatch use the fallback reflection.
+    uint32_t GetReflectionDispatchSize()
+    {
+        const uint32_t slot = m_RayCountReadbackIndex;
+        if (m_RayCountPending[slot])
+        {
+            // The query was issued c_RayCountReadbackCount frames ago, so this normally does not wait
+            GetDevice()->waitEventQuery(m_RayCountQueries[slot]);
+            GetDevice()->resetEventQuery(m_RayCountQueries[slot]);
+
+            const uint32_t* rayCount = static_cast<const uint32_t*>(GetDevice()->mapBuffer(m_RayCountReadback[slot], nvrhi::CpuAccessMode::Read));
+            if (rayCount)
             {
-                nvrhi::rt::GeometryDesc geometryDesc;
-                auto& triangles = geometryDesc.geometryData.triangles;
-                triangles.indexBuffer = mesh->buffers->indexBuffer;
-                triangles.indexOffset = (mesh->indexOffset + geometry->indexOffsetInMesh) * sizeof(uint32_t);
-                triangles.indexFormat = nvrhi::Format::R32_UINT;
-                triangles.indexCount = geometry->numIndices;
-                triangles.vertexBuffer = mesh->buffers->vertexBuffer;
-                triangles.vertexOffset = (mesh->vertexOffset + geometry->vertexOffsetInMesh) * sizeof(float3) + mesh->buffers->getVertexBufferRange(engine::VertexAttribute::Position).byteOffset;
-                triangles.vertexFormat = nvrhi::Format::RGB32_FLOAT;
-                triangles.vertexStride = sizeof(float3);
-                triangles.vertexCount = geometry->numVertices;
-                geometryDesc.geometryType = nvrhi::rt::GeometryType::Triangles;
-                geometryDesc.flags = nvrhi::rt::GeometryFlags::Opaque;
-                blasDesc.bottomLevelGeometries.push_back(geometryDesc);
+                m_LastRayCount = *rayCount;
+                m_LastRayCountValid = true;
+                GetDevice()->unmapBuffer(m_RayCountReadback[slot]);
             }
+            m_RayCountPending[slot] = false;
+        }
 
-            nvrhi::rt::AccelStructHandle as = GetDevice()->createAccelStruct(blasDesc);
-            nvrhi::utils::BuildBottomLevelAccelStruct(commandList, as, blasDesc);
+        const uint32_t capacity = m_RenderTargets->m_RayListCapacity;
+        if (!m_LastRayCountValid)
+            return capacity;
 
-            mesh->accelStruct = as;
-        }
+        return std::min(m_LastRayCount + m_LastRayCount / 4 + 4096, capacity);
+    }
+
+    void CreateAccelStruct(nvrhi::ICommandList* commandList)
+    {
+        // The hit groups have no any-hit shaders, so all geometry is built as opaque
+        m_BlasManager = std::make_unique<BlasManager>(GetDevice());
+        m_BlasManager->CreateAccelStructs(commandList, *m_Scene->GetSceneGraph(), nullptr,
+            [](const engine::MeshGeometry&) { return true; });
 
 
         nvrhi::rt::AccelStructDesc tlasDesc;
         tlasDesc.isTopLevel = true;
 
-        std::vector<nvrhi::rt::InstanceDesc> instances;
+        m_TlasInstances.clear();
         for (const auto& instance : m_Scene->GetSceneGraph()->GetMeshInstances())
         {
             const auto& mesh = instance->GetMesh();
@@ -452,13 +597,13 @@ public:
             assert(node);
             dm::affineToColumnMajor(node->GetLocalToWorldTransformFloat(), instanceDesc.transform);
             
-            instances.push_back(instanceDesc);
+            m_TlasInstances.push_back(instanceDesc);
         }
 
-        tlasDesc.topLevelMaxInstances = instances.size();
+        tlasDesc.topLevelMaxInstances = m_TlasInstances.size();
         m_TopLevelAS = GetDevice()->createAccelStruct(tlasDesc);
 
-        commandList->buildTopLevelAccelStruct(m_TopLevelAS, instances.data(), instances.size());
+        commandList->buildTopLevelAccelStruct(m_TopLevelAS, m_TlasInstances.data(), m_TlasInstances.size());
     }
     
     void BackBufferResizing() override
@@ -467,6 +612,7 @@ public:
         m_BindingCache->Clear();
         m_GBufferPass = nullptr;
         m_ForwardPass = nullptr;
+        m_LastRayCountValid = false;
     }
 
     void Render(nvrhi::IFramebuffer* framebuffer) override
@@ -486,11 +632,30 @@ public:
                 nvrhi::BindingSetItem::Texture_SRV(REFLECTIONS_BINDING_GBUFFER_1_TEXTURE, m_RenderTargets->m_GBufferSpecular),
                 nvrhi::BindingSetItem::Texture_SRV(REFLECTIONS_BINDING_GBUFFER_2_TEXTURE, m_RenderTargets->m_GBufferNormals),
                 nvrhi::BindingSetItem::Texture_SRV(REFLECTIONS_BINDING_GBUFFER_3_TEXTURE, m_RenderTargets->m_GBufferEmissive),
+                nvrhi::BindingSetItem::StructuredBuffer_SRV(REFLECTIONS_BINDING_RAY_LIST, m_RenderTargets->m_RayList),
+                nvrhi::BindingSetItem::RawBuffer_SRV(REFLECTIONS_BINDING_RAY_COUNT, m_RenderTargets->m_RayCount),
                 nvrhi::BindingSetItem::Texture_UAV(REFLECTIONS_BINDING_OUTPUT_UAV, m_RenderTargets->m_HdrColor),
+                nvrhi::BindingSetItem::Texture_UAV(REFLECTIONS_BINDING_REFLECTIONS_UAV, m_RenderTargets->m_Reflections),
                 nvrhi::BindingSetItem::Sampler(REFLECTIONS_BINDING_MATERIAL_SAMPLER, m_CommonPasses->m_LinearWrapSampler)
             };
 
             m_BindingSet = GetDevice()->createBindingSet(bindingSetDesc, m_GlobalBindingLayout);
+
+            nvrhi::BindingSetDesc passesBindingSetDesc;
+            passesBindingSetDesc.bindings = {
+                nvrhi::BindingSetItem::ConstantBuffer(0, m_ConstantBuffer),
+                nvrhi::BindingSetItem::Texture_SRV(0, m_RenderTargets->m_Depth),
+                nvrhi::BindingSetItem::Texture_SRV(1, m_RenderTargets->m_GBufferDiffuse),
+                nvrhi::BindingSetItem::Texture_SRV(2, m_RenderTargets->m_GBufferSpecular),
+                nvrhi::BindingSetItem::Texture_SRV(3, m_RenderTargets->m_GBufferNormals),
+                nvrhi::BindingSetItem::Texture_SRV(4, m_RenderTargets->m_GBufferEmissive),
+                nvrhi::BindingSetItem::Texture_SRV(5, m_RenderTargets->m_Reflections),
+                nvrhi::BindingSetItem::StructuredBuffer_UAV(0, m_RenderTargets->m_RayList),
+                nvrhi::BindingSetItem::RawBuffer_UAV(1, m_RenderTargets->m_RayCount),
+                nvrhi::BindingSetItem::Texture_UAV(2, m_RenderTargets->m_HdrColor)
+            };
+
+            m_ReflectionPassesBindingSet = GetDevice()->createBindingSet(passesBindingSetDesc, m_ReflectionPassesBindingLayout);
         }
 
         if (!m_GBufferPass)
@@ -517,6 +682,10 @@ public:
 
         m_CommandList->open();
 
+        // Compaction moves the BLAS data, so the TLAS is rebuilt with the new addresses
+        if (m_BlasManager->Compact(m_CommandList))
+            m_CommandList->buildTopLevelAccelStruct(m_TopLevelAS, m_TlasInstances.data(), m_TlasInstances.size());
+
         m_RenderTargets->Clear(m_CommandList);
         render::GBufferFillPass::Context gbufferContext;
         render::RenderCompositeView(m_CommandList, &m_View, &m_View, *m_RenderTargets->m_GBufferFramebuffer, 
@@ -526,6 +695,11 @@ public:
         constants.ambientColor = float4(0.2f);
         m_View.FillPlanarViewConstants(constants.view);
         m_SunLight->FillLightConstants(constants.light);
+        // Without classification, every pixel traces its own ray
+        constants.roughnessThreshold = m_ClassificationEnabled ? m_RoughnessThreshold : 1.f;
+        constants.mirrorThreshold = m_ClassificationEnabled ? m_MirrorThreshold : 2.f;
+        constants.roughnessFadeRange = m_ClassificationEnabled ? 0.1f : 0.f;
+        constants.rayListCapacity = m_RenderTargets->m_RayListCapacity;
         m_CommandList->writeBuffer(m_ConstantBuffer, &constants, sizeof(constants));
 
         nvrhi::rt::State state;
@@ -538,6 +712,39 @@ public:
         args.height = fbinfo.height;
         m_CommandList->dispatchRays(args);
 
+        // Reflections: classify the pixels by roughness, trace the compacted ray list, then resolve at full resolution
+        m_CommandList->clearBufferUInt(m_RenderTargets->m_RayCount, 0);
+        m_CommandList->clearTextureFloat(m_RenderTargets->m_Reflections, nvrhi::AllSubresources, nvrhi::Color(0.f));
+
+        nvrhi::ComputeState computeState;
+        computeState.pipeline = m_ClassifyPipeline;
+        computeState.bindings = { m_ReflectionPassesBindingSet };
+        m_CommandList->setComputeState(computeState);
+        m_CommandList->dispatch(
+            dm::div_ceil(fbinfo.width, 2 * REFLECTIONS_CLASSIFY_GROUP_SIZE),
+            dm::div_ceil(fbinfo.height, 2 * REFLECTIONS_CLASSIFY_GROUP_SIZE));
+
+        // Read the slot before it is overwritten with the count of this frame
+        const uint32_t reflectionRays = GetReflectionDispatchSize();
+        const uint32_t readbackSlot = m_RayCountReadbackIndex;
+        m_CommandList->copyBuffer(m_RayCountReadback[readbackSlot], 0, m_RenderTargets->m_RayCount, 0, sizeof(uint32_t));
+        if (reflectionRays > 0)
+        {
+            state.shaderTable = m_ReflectionShaderTable;
+            m_CommandList->setRayTracingState(state);
+
+            nvrhi::rt::DispatchRaysArguments reflectionArgs;
+            reflectionArgs.width = reflectionRays;
+            reflectionArgs.height = 1;
+            m_CommandList->dispatchRays(reflectionArgs);
+        }
+
+        computeState.pipeline = m_UpsamplePipeline;
+        m_CommandList->setComputeState(computeState);
+        m_CommandList->dispatch(
+            dm::div_ceil(fbinfo.width, REFLECTIONS_CLASSIFY_GROUP_SIZE),
+            dm::div_ceil(fbinfo.height, REFLECTIONS_CLASSIFY_GROUP_SIZE));
+
         render::ForwardShadingPass::Context forwardContext;
         m_ForwardPass->PrepareLights(forwardContext, m_CommandList, m_Scene->GetSceneGraph()->GetLights(), constants.ambientColor, constants.ambientColor, {});
         render::RenderCompositeView(m_CommandList, &m_View, &m_View, *m_RenderTargets->m_HdrFramebufferDepth,
@@ -548,6 +755,10 @@ public:
         m_CommandList->close();
         GetDevice()->executeCommandList(m_CommandList);
 
+        GetDevice()->setEventQuery(m_RayCountQueries[readbackSlot], nvrhi::CommandQueue::Graphics);
+        m_RayCountPending[readbackSlot] = true;
+        m_RayCountReadbackIndex = (m_RayCountReadbackIndex + 1) % c_RayCountReadbackCount;
+
         GetDeviceManager()->SetVsyncEnabled(true);
     }
 
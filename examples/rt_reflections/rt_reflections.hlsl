@@ -72,6 +72,9 @@ Texture2D t_GBuffer0                         : REGISTER_SRV(REFLECTIONS_BINDING_
 Texture2D t_GBuffer1                         : REGISTER_SRV(REFLECTIONS_BINDING_GBUFFER_1_TEXTURE,      REFLECTIONS_SPACE_GLOBAL);
 Texture2D t_GBuffer2                         : REGISTER_SRV(REFLECTIONS_BINDING_GBUFFER_2_TEXTURE,      REFLECTIONS_SPACE_GLOBAL);
 Texture2D t_GBuffer3                         : REGISTER_SRV(REFLECTIONS_BINDING_GBUFFER_3_TEXTURE,      REFLECTIONS_SPACE_GLOBAL);
+StructuredBuffer<uint> t_RayList             : REGISTER_SRV(REFLECTIONS_BINDING_RAY_LIST,               REFLECTIONS_SPACE_GLOBAL);
+ByteAddressBuffer t_RayCount                 : REGISTER_SRV(REFLECTIONS_BINDING_RAY_COUNT,              REFLECTIONS_SPACE_GLOBAL);
+RWTexture2D<float4> u_Reflections            : REGISTER_UAV(REFLECTIONS_BINDING_REFLECTIONS_UAV,        REFLECTIONS_SPACE_GLOBAL);
 
 // ---[ Ray Generation Shader ]---
 
@@ -156,10 +159,8 @@ void RayGen()
         }
 
         diffuseTerm += g_Lighting.ambientColor.rgb * surfaceMaterial.diffuseAlbedo;
-        
-        float3 reflection = GetReflection(surfaceWorldPos, reflect(viewIncident, surfaceMaterial.shadingNormal));
-        float3 fresnel = Schlick_Fresnel(surfaceMaterial.specularF0, saturate(-dot(viewIncident, surfaceMaterial.shadingNormal)));
-        specularTerm += reflection * fresnel;
+
+        // The reflections are traced by ReflectionRayGen and added by reflection_passes.hlsl
     }
 
     float3 outputColor = diffuseTerm
@@ -169,6 +170,30 @@ void RayGen()
     u_Output[globalIdx] = float4(outputColor, 1);
 }
 
+// Traces the reflection rays for the pixels in the ray list built by classify_cs.
+// The dispatch size is an estimate from a previous frame, rays past the end of the list exit immediately,
+// and entries past the end of the dispatch are left for the fallback in upsample_cs.
+[shader("raygeneration")]
+void ReflectionRayGen()
+{
+    uint rayIndex = DispatchRaysIndex().x;
+    if (rayIndex >= t_RayCount.Load(0))
+        return;
+
+    uint2 globalIdx = REFLECTIONS_UNPACK_PIXEL(t_RayList[rayIndex]);
+    float2 pixelPosition = float2(globalIdx) + 0.5;
+
+    MaterialSample surfaceMaterial = DecodeGBuffer(globalIdx, t_GBuffer0, t_GBuffer1, t_GBuffer2, t_GBuffer3);
+
+    float3 surfaceWorldPos = ReconstructWorldPosition(g_Lighting.view, pixelPosition.xy, t_GBufferDepth[globalIdx].x);
+
+    float3 viewIncident = GetIncidentVector(g_Lighting.view.cameraDirectionOrPosition, surfaceWorldPos);
+
+    float3 reflection = GetReflection(surfaceWorldPos, reflect(viewIncident, surfaceMaterial.shadingNormal));
+
+    u_Reflections[globalIdx] = float4(reflection, 1);
+}
+
 // ---[ Shadow Miss Shader ]---
 
 [shader("miss")]
@@ -32,6 +32,11 @@ struct LightingConstants
 
     LightConstants light;
     PlanarViewConstants view;
+
+    // One shadow ray is traced for every 'traceRate' pixels, see trace_pattern.hlsli
+    uint traceRate;
+    uint frameIndex;
+    uint2 padding;
 };
 
 #endif // LIGHTING_CB_H
\ No newline at end of file
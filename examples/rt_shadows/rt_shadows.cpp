@@ -37,10 +37,17 @@
 
 #include "donut/engine/BindingCache.h"
 
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <string>
+
 using namespace donut;
 using namespace donut::math;
 
 #include "lighting_cb.h"
+#include "shadow_denoiser_cb.h"
+#include "BlasManager.h"
 
 static const char* g_WindowTitle = "Donut Example: Ray Traced Shadows";
 
@@ -52,8 +59,15 @@ public:
     nvrhi::TextureHandle m_GBufferSpecular;
     nvrhi::TextureHandle m_GBufferNormals;
     nvrhi::TextureHandle m_GBufferEmissive;
+    nvrhi::TextureHandle m_MotionVectors;
     nvrhi::TextureHandle m_HdrColor;
 
+    // Sun visibility: the traced rays, the temporal history (visibility, history length, view depth)
+    // and the ping-pong targets of the spatial filter
+    nvrhi::TextureHandle m_ShadowRaw;
+    std::array<nvrhi::TextureHandle, 2> m_ShadowHistory;
+    std::array<nvrhi::TextureHandle, 2> m_ShadowFiltered;
+
     std::shared_ptr<engine::FramebufferFactory> m_HdrFramebuffer;
     std::shared_ptr<engine::FramebufferFactory> m_GBufferFramebuffer;
     
@@ -101,8 +115,34 @@ public:
         desc.debugName = "GBufferEmissive";
         m_GBufferEmissive = device->createTexture(desc);
 
+        desc.format = nvrhi::Format::RG16_FLOAT;
+        desc.debugName = "MotionVectors";
+        m_MotionVectors = device->createTexture(desc);
+
+        nvrhi::TextureDesc shadowDesc;
+        shadowDesc.width = size.x;
+        shadowDesc.height = size.y;
+        shadowDesc.isUAV = true;
+        shadowDesc.initialState = nvrhi::ResourceStates::UnorderedAccess;
+        shadowDesc.keepInitialState = true;
+
+        shadowDesc.format = nvrhi::Format::R8_UNORM;
+        shadowDesc.debugName = "ShadowRaw";
+        m_ShadowRaw = device->createTexture(shadowDesc);
+
+        for (size_t index = 0; index < m_ShadowHistory.size(); index++)
+        {
+            shadowDesc.format = nvrhi::Format::RGBA16_FLOAT;
+            shadowDesc.debugName = "ShadowHistory" + std::to_string(index);
+            m_ShadowHistory[index] = device->createTexture(shadowDesc);
+
+            shadowDesc.format = nvrhi::Format::R16_FLOAT;
+            shadowDesc.debugName = "ShadowFiltered" + std::to_string(index);
+            m_ShadowFiltered[index] = device->createTexture(shadowDesc);
+        }
+
         m_GBufferFramebuffer = std::make_shared<engine::FramebufferFactory>(device);
-        m_GBufferFramebuffer->RenderTargets = { m_GBufferDiffuse, m_GBufferSpecular, m_GBufferNormals, m_GBufferEmissive };
+        m_GBufferFramebuffer->RenderTargets = { m_GBufferDiffuse, m_GBufferSpecular, m_GBufferNormals, m_GBufferEmissive, m_MotionVectors };
         m_GBufferFramebuffer->DepthTarget = m_Depth;
 
         m_HdrFramebuffer = std::make_shared<engine::FramebufferFactory>(device);
@@ -125,6 +165,7 @@ public:
         commandList->clearTextureFloat(m_GBufferSpecular, nvrhi::AllSubresources, nvrhi::Color(0.f));
         commandList->clearTextureFloat(m_GBufferNormals, nvrhi::AllSubresources, nvrhi::Color(0.f));
         commandList->clearTextureFloat(m_GBufferEmissive, nvrhi::AllSubresources, nvrhi::Color(0.f));
+        commandList->clearTextureFloat(m_MotionVectors, nvrhi::AllSubresources, nvrhi::Color(0.f));
     }
 
     const int2& GetSize()
@@ -133,6 +174,18 @@ public:
     }
 };
 
+// The passes with GPU timers, shown in the window title
+enum class TimedPass : uint32_t
+{
+    GBuffer,
+    Trace,
+    Temporal,
+    Spatial,
+    Composite,
+
+    Count
+};
+
 class RayTracedShadows : public app::ApplicationBase
 {
 private:
@@ -145,11 +198,35 @@ private:
     nvrhi::BindingLayoutHandle m_BindingLayout;
     nvrhi::BindingSetHandle m_BindingSet;
 
-    std::unordered_map<std::shared_ptr<engine::MeshInfo>, nvrhi::rt::AccelStructHandle> m_MeshAccelStructs;
-    nvrhi::rt::AccelStructHandle m_BottomLevelAS;
+    std::unique_ptr<BlasManager> m_BlasManager;
     nvrhi::rt::AccelStructHandle m_TopLevelAS;
+    std::vector<nvrhi::rt::InstanceDesc> m_TlasInstances;
 
     nvrhi::BufferHandle m_ConstantBuffer;
+    nvrhi::BufferHandle m_DenoiserConstantBuffer;
+
+    nvrhi::ShaderHandle m_TemporalShader;
+    nvrhi::ShaderHandle m_SpatialShader;
+    nvrhi::ShaderHandle m_CompositeShader;
+    nvrhi::BindingLayoutHandle m_TemporalBindingLayout;
+    nvrhi::BindingLayoutHandle m_SpatialBindingLayout;
+    nvrhi::BindingLayoutHandle m_CompositeBindingLayout;
+    nvrhi::ComputePipelineHandle m_TemporalPipeline;
+    nvrhi::ComputePipelineHandle m_SpatialPipeline;
+    nvrhi::ComputePipelineHandle m_CompositePipeline;
+
+    // Shadow rays are traced for one in m_TraceRate pixels, the reduced rates always use the denoiser
+    uint32_t m_TraceRate = 2;
+    bool m_DenoiserEnabled = true;
+    uint32_t m_SpatialPasses = 2;
+    uint32_t m_HistoryIndex = 0;
+    bool m_HistoryValid = false;
+
+    static constexpr uint32_t c_TimerQueryCount = 4;
+    std::array<std::array<nvrhi::TimerQueryHandle, size_t(TimedPass::Count)>, c_TimerQueryCount> m_PassTimers;
+    std::array<std::array<bool, size_t(TimedPass::Count)>, c_TimerQueryCount> m_PassTimerPending{};
+    std::array<float, size_t(TimedPass::Count)> m_PassTimesMs{};
+    uint32_t m_PassTimerIndex = 0;
 
     std::shared_ptr<engine::ShaderFactory> m_ShaderFactory;
     std::unique_ptr<engine::Scene> m_Scene;
@@ -157,6 +234,7 @@ private:
     std::unique_ptr<RenderTargets> m_RenderTargets;
     app::FirstPersonCamera m_Camera;
     engine::PlanarView m_View;
+    engine::PlanarView m_ViewPrevious;
     std::shared_ptr<engine::DirectionalLight> m_SunLight;
     std::unique_ptr<render::InstancedOpaqueDrawStrategy> m_OpaqueDrawStrategy;
     std::unique_ptr<engine::BindingCache> m_BindingCache;
@@ -202,6 +280,15 @@ public:
         if (!CreateRayTracingPipeline(*m_ShaderFactory))
             return false;
 
+        if (!CreateDenoiserPipelines(*m_ShaderFactory))
+            return false;
+
+        for (auto& frameTimers : m_PassTimers)
+        {
+            for (auto& timer : frameTimers)
+                timer = GetDevice()->createTimerQuery();
+        }
+
         m_CommandList = GetDevice()->createCommandList();
 
         m_CommandList->open();
@@ -232,6 +319,18 @@ public:
 
     bool KeyboardUpdate(int key, int scancode, int action, int mods) override
     {
+        if (action == GLFW_PRESS)
+        {
+            switch (key)
+            {
+            case GLFW_KEY_R: m_TraceRate = (m_TraceRate == 4) ? 1 : m_TraceRate * 2; break;
+            case GLFW_KEY_T: m_DenoiserEnabled = !m_DenoiserEnabled; break;
+            case GLFW_KEY_MINUS: m_SpatialPasses = (m_SpatialPasses > 0) ? m_SpatialPasses - 1 : 0; break;
+            case GLFW_KEY_EQUAL: m_SpatialPasses = std::min(m_SpatialPasses + 1, 4u); break;
+            default: break;
+            }
+        }
+
         m_Camera.KeyboardUpdate(key, scancode, action, mods);
         return true;
     }
@@ -251,7 +350,20 @@ public:
     void Animate(float fElapsedTimeSeconds) override
     {
         m_Camera.Animate(fElapsedTimeSeconds);
-        GetDeviceManager()->SetInformativeWindowTitle(g_WindowTitle);
+
+        char extraInfo[256];
+        snprintf(extraInfo, std::size(extraInfo), "1/%u rays (R), denoiser (T) %s, %u filter passes (-/=), "
+            "G-buffer %.2f ms, trace %.2f ms, temporal %.2f ms, spatial %.2f ms, composite %.2f ms",
+            m_TraceRate, IsDenoiserActive() ? "on" : "off", m_SpatialPasses,
+            m_PassTimesMs[size_t(TimedPass::GBuffer)], m_PassTimesMs[size_t(TimedPass::Trace)],
+            m_PassTimesMs[size_t(TimedPass::Temporal)], m_PassTimesMs[size_t(TimedPass::Spatial)],
+            m_PassTimesMs[size_t(TimedPass::Composite)]);
+        GetDeviceManager()->SetInformativeWindowTitle(g_WindowTitle, extraInfo);
+    }
+
+    [[nodiscard]] bool IsDenoiserActive() const
+    {
+        return m_DenoiserEnabled || m_TraceRate > 1;
     }
 
     bool CreateRayTracingPipeline(engine::ShaderFactory& shaderFactory)
@@ -267,10 +379,6 @@ public:
             nvrhi::BindingLayoutItem::VolatileConstantBuffer(0),
             nvrhi::BindingLayoutItem::RayTracingAccelStruct(0),
             nvrhi::BindingLayoutItem::Texture_SRV(1),
-            nvrhi::BindingLayoutItem::Texture_SRV(2),
-            nvrhi::BindingLayoutItem::Texture_SRV(3),
-            nvrhi::BindingLayoutItem::Texture_SRV(4),
-            nvrhi::BindingLayoutItem::Texture_SRV(5),
             nvrhi::BindingLayoutItem::Texture_UAV(0)
         };
 
@@ -304,47 +412,96 @@ public:
         return true;
     }
 
-    void CreateAccelStruct(nvrhi::ICommandList* commandList)
+    bool CreateDenoiserPipelines(engine::ShaderFactory& shaderFactory)
     {
-        for (const auto& mesh : m_Scene->GetSceneGraph()->GetMeshes())
-        {
-            nvrhi::rt::AccelStructDesc blasDesc;
-            blasDesc.isTopLevel = false;
+        m_TemporalShader = shaderFactory.CreateShader("app/shadow_denoiser.hlsl", "temporal_cs", nullptr, nvrhi::ShaderType::Compute);
+        m_SpatialShader = shaderFactory.CreateShader("app/shadow_denoiser.hlsl", "spatial_cs", nullptr, nvrhi::ShaderType::Compute);
+        m_CompositeShader = shaderFactory.CreateShader("app/composite.hlsl", "main_cs", nullptr, nvrhi::ShaderType::Compute);
 
-            for (const auto& geometry : mesh->geometries)
-            {
-                nvrhi::rt::GeometryDesc geometryDesc;
-                auto& triangles = geometryDesc.geometryData.triangles;
-                triangles.indexBuffer = mesh->buffers->indexBuffer;
-                triangles.indexOffset = (mesh->indexOffset + geometry->indexOffsetInMesh) * sizeof(uint32_t);
-                triangles.indexFormat = nvrhi::Format::R32_UINT;
-                triangles.indexCount = geometry->numIndices;
-                triangles.vertexBuffer = mesh->buffers->vertexBuffer;
-                triangles.vertexOffset = (mesh->vertexOffset + geometry->vertexOffsetInMesh) * sizeof(float3) + mesh->buffers->getVertexBufferRange(engine::VertexAttribute::Position).byteOffset;
-                triangles.vertexFormat = nvrhi::Format::RGB32_FLOAT;
-                triangles.vertexStride = sizeof(float3);
-                triangles.vertexCount = geometry->numVertices;
-                geometryDesc.geometryType = nvrhi::rt::GeometryType::Triangles;
-                geometryDesc.flags = nvrhi::rt::GeometryFlags::Opaque;
-                blasDesc.bottomLevelGeometries.push_back(geometryDesc);
-            }
+        if (!m_TemporalShader || !m_SpatialShader || !m_CompositeShader)
+            return false;
 
-            nvrhi::rt::AccelStructHandle as = GetDevice()->createAccelStruct(blasDesc);
-            nvrhi::utils::BuildBottomLevelAccelStruct(commandList, as, blasDesc);
+        nvrhi::BindingLayoutDesc temporalLayoutDesc;
+        temporalLayoutDesc.visibility = nvrhi::ShaderType::Compute;
+        temporalLayoutDesc.bindings = {
+            nvrhi::BindingLayoutItem::VolatileConstantBuffer(0),
+            nvrhi::BindingLayoutItem::Texture_SRV(0),
+            nvrhi::BindingLayoutItem::Texture_SRV(2),
+            nvrhi::BindingLayoutItem::Texture_SRV(3),
+            nvrhi::BindingLayoutItem::Texture_SRV(4),
+            nvrhi::BindingLayoutItem::Texture_UAV(0)
+        };
+        m_TemporalBindingLayout = GetDevice()->createBindingLayout(temporalLayoutDesc);
 
-            m_MeshAccelStructs[mesh] = as;
-        }
+        nvrhi::BindingLayoutDesc spatialLayoutDesc;
+        spatialLayoutDesc.visibility = nvrhi::ShaderType::Compute;
+        spatialLayoutDesc.bindings = {
+            nvrhi::BindingLayoutItem::VolatileConstantBuffer(0),
+            nvrhi::BindingLayoutItem::Texture_SRV(1),
+            nvrhi::BindingLayoutItem::Texture_SRV(4),
+            nvrhi::BindingLayoutItem::Texture_SRV(5),
+            nvrhi::BindingLayoutItem::Texture_UAV(1)
+        };
+        m_SpatialBindingLayout = GetDevice()->createBindingLayout(spatialLayoutDesc);
+
+        nvrhi::BindingLayoutDesc compositeLayoutDesc;
+        compositeLayoutDesc.visibility = nvrhi::ShaderType::Compute;
+        compositeLayoutDesc.bindings = {
+            nvrhi::BindingLayoutItem::VolatileConstantBuffer(0),
+            nvrhi::BindingLayoutItem::Texture_SRV(1),
+            nvrhi::BindingLayoutItem::Texture_SRV(2),
+            nvrhi::BindingLayoutItem::Texture_SRV(3),
+            nvrhi::BindingLayoutItem::Texture_SRV(4),
+            nvrhi::BindingLayoutItem::Texture_SRV(5),
+            nvrhi::BindingLayoutItem::Texture_SRV(6),
+            nvrhi::BindingLayoutItem::Texture_UAV(0)
+        };
+        m_CompositeBindingLayout = GetDevice()->createBindingLayout(compositeLayoutDesc);
+
+        m_TemporalPipeline = GetDevice()->createComputePipeline(nvrhi::ComputePipelineDesc()
+            .setComputeShader(m_TemporalShader)
+            .addBindingLayout(m_TemporalBindingLayout));
+        m_SpatialPipeline = GetDevice()->createComputePipeline(nvrhi::ComputePipelineDesc()
+            .setComputeShader(m_SpatialShader)
+            .addBindingLayout(m_SpatialBindingLayout));
+        m_CompositePipeline = GetDevice()->createComputePipeline(nvrhi::ComputePipelineDesc()
+            .setComputeShader(m_CompositeShader)
+            .addBindingLayout(m_CompositeBindingLayout));
+
+        m_DenoiserConstantBuffer = GetDevice()->createBuffer(nvrhi::utils::CreateVolatileConstantBufferDesc(
+            sizeof(ShadowDenoiserConstants), "ShadowDenoiserConstants", engine::c_MaxRenderPassConstantBufferVersions));
+
+        return true;
+    }
+
+    void BeginPass(TimedPass pass)
+    {
+        m_CommandList->beginTimerQuery(m_PassTimers[m_PassTimerIndex][size_t(pass)]);
+    }
+
+    void EndPass(TimedPass pass)
+    {
+        m_CommandList->endTimerQuery(m_PassTimers[m_PassTimerIndex][size_t(pass)]);
+        m_PassTimerPending[m_PassTimerIndex][size_t(pass)] = true;
+    }
+
+    void CreateAccelStruct(nvrhi::ICommandList* commandList)
+    {
+        // The scene is static, and the shadow rays don't run any-hit shaders - build everything as opaque
+        m_BlasManager = std::make_unique<BlasManager>(GetDevice());
+        m_BlasManager->CreateAccelStructs(commandList, *m_Scene->GetSceneGraph(), nullptr,
+            [](const engine::MeshGeometry&) { return true; });
 
 
         nvrhi::rt::AccelStructDesc tlasDesc;
         tlasDesc.isTopLevel = true;
 
-        std::vector<nvrhi::rt::InstanceDesc> instances;
+        m_TlasInstances.clear();
 
         for (auto instance : m_Scene->GetSceneGraph()->GetMeshInstances())
         {
             nvrhi::rt::InstanceDesc instanceDesc;
-            instanceDesc.bottomLevelAS = m_MeshAccelStructs[instance->GetMesh()];
+            instanceDesc.bottomLevelAS = instance->GetMesh()->accelStruct;
             assert(instanceDesc.bottomLevelAS);
             instanceDesc.instanceMask = 1;
 
@@ -352,13 +509,12 @@ public:
             assert(node);
             dm::affineToColumnMajor(node->GetLocalToWorldTransformFloat(), instanceDesc.transform);
 
-            instances.push_back(instanceDesc);
+            m_TlasInstances.push_back(instanceDesc);
         }
-        tlasDesc.topLevelMaxInstances = instances.size();
+        tlasDesc.topLevelMaxInstances = m_TlasInstances.size();
 
         m_TopLevelAS = GetDevice()->createAccelStruct(tlasDesc);
-        commandList->buildTopLevelAccelStruct(m_TopLevelAS, instances.data(), instances.size());
-        
+        commandList->buildTopLevelAccelStruct(m_TopLevelAS, m_TlasInstances.data(), m_TlasInstances.size());
     }
 
 
@@ -367,11 +523,13 @@ public:
         m_RenderTargets = nullptr;
         m_BindingCache->Clear();
         m_GBufferPass = nullptr;
+        m_HistoryValid = false;
     }
 
     void Render(nvrhi::IFramebuffer* framebuffer) override
     {
         const auto& fbinfo = framebuffer->getFramebufferInfo();
+        const bool renderTargetsCreated = !m_RenderTargets;
 
         if (!m_RenderTargets)
         {
@@ -382,11 +540,7 @@ public:
                 nvrhi::BindingSetItem::ConstantBuffer(0, m_ConstantBuffer),
                 nvrhi::BindingSetItem::RayTracingAccelStruct(0, m_TopLevelAS),
                 nvrhi::BindingSetItem::Texture_SRV(1, m_RenderTargets->m_Depth),
-                nvrhi::BindingSetItem::Texture_SRV(2, m_RenderTargets->m_GBufferDiffuse),
-                nvrhi::BindingSetItem::Texture_SRV(3, m_RenderTargets->m_GBufferSpecular),
-                nvrhi::BindingSetItem::Texture_SRV(4, m_RenderTargets->m_GBufferNormals),
-                nvrhi::BindingSetItem::Texture_SRV(5, m_RenderTargets->m_GBufferEmissive),
-                nvrhi::BindingSetItem::Texture_UAV(0, m_RenderTargets->m_HdrColor)
+                nvrhi::BindingSetItem::Texture_UAV(0, m_RenderTargets->m_ShadowRaw)
             };
 
             m_BindingSet = GetDevice()->createBindingSet(bindingSetDesc, m_BindingLayout);
@@ -397,42 +551,180 @@ public:
         m_View.SetMatrices(m_Camera.GetWorldToViewMatrix(), perspProjD3DStyleReverse(dm::PI_f * 0.25f, windowViewport.width() / windowViewport.height(), 0.1f));
         m_View.UpdateCache();
 
+        // There are no valid motion vectors before the first frame
+        if (renderTargetsCreated)
+            m_ViewPrevious = m_View;
+
         if (!m_GBufferPass)
         {
             m_GBufferPass = std::make_unique<render::GBufferFillPass>(GetDevice(), m_CommonPasses);
 
             render::GBufferFillPass::CreateParameters gbufferParams;
+            gbufferParams.enableMotionVectors = true;
             m_GBufferPass->Init(*m_ShaderFactory, gbufferParams);
         }
 
 
+        // Read the timers issued c_TimerQueryCount frames ago, which normally does not wait
+        m_PassTimerIndex = (m_PassTimerIndex + 1) % c_TimerQueryCount;
+        for (size_t pass = 0; pass < size_t(TimedPass::Count); pass++)
+        {
+            float& timeMs = m_PassTimesMs[pass];
+            bool& pending = m_PassTimerPending[m_PassTimerIndex][pass];
+            timeMs = pending ? GetDevice()->getTimerQueryTime(m_PassTimers[m_PassTimerIndex][pass]) * 1e3f : 0.f;
+            if (pending)
+                GetDevice()->resetTimerQuery(m_PassTimers[m_PassTimerIndex][pass]);
+            pending = false;
+        }
+
         m_CommandList->open();
 
+        // Compaction moves the BLAS data, so the TLAS is rebuilt with the new addresses
+        if (m_BlasManager->Compact(m_CommandList))
+            m_CommandList->buildTopLevelAccelStruct(m_TopLevelAS, m_TlasInstances.data(), m_TlasInstances.size());
+
+        BeginPass(TimedPass::GBuffer);
         m_RenderTargets->Clear(m_CommandList);
         render::GBufferFillPass::Context gbufferContext;
-        render::RenderCompositeView(m_CommandList, &m_View, &m_View, *m_RenderTargets->m_GBufferFramebuffer,
+        render::RenderCompositeView(m_CommandList, &m_View, &m_ViewPrevious, *m_RenderTargets->m_GBufferFramebuffer,
             m_Scene->GetSceneGraph()->GetRootNode(), *m_OpaqueDrawStrategy, *m_GBufferPass, gbufferContext);
+        EndPass(TimedPass::GBuffer);
+
+        const uint32_t frameIndex = uint32_t(GetFrameIndex());
 
         LightingConstants constants = {};
         constants.ambientColor = float4(0.05f);
         m_View.FillPlanarViewConstants(constants.view);
         m_SunLight->FillLightConstants(constants.light);
+        constants.traceRate = m_TraceRate;
+        constants.frameIndex = frameIndex;
         m_CommandList->writeBuffer(m_ConstantBuffer, &constants, sizeof(constants));
 
+        BeginPass(TimedPass::Trace);
+
         nvrhi::rt::State state;
         state.shaderTable = m_ShaderTable;
         state.bindings = { m_BindingSet };
         m_CommandList->setRayTracingState(state);
 
+        // See GetTracedPixel in trace_pattern.hlsli for the pixels covered by the dispatch
         nvrhi::rt::DispatchRaysArguments args;
-        args.width = fbinfo.width;
-        args.height = fbinfo.height;
+        args.width = (m_TraceRate > 1) ? (fbinfo.width + 1) / 2 : fbinfo.width;
+        args.height = (m_TraceRate > 2) ? (fbinfo.height + 1) / 2 : fbinfo.height;
         m_CommandList->dispatchRays(args);
-        
+
+        EndPass(TimedPass::Trace);
+
+        const uint32_t groupsX = dm::div_ceil(fbinfo.width, SHADOW_DENOISER_GROUP_SIZE);
+        const uint32_t groupsY = dm::div_ceil(fbinfo.height, SHADOW_DENOISER_GROUP_SIZE);
+
+        nvrhi::ITexture* shadowTexture = m_RenderTargets->m_ShadowRaw;
+
+        if (IsDenoiserActive())
+        {
+            ShadowDenoiserConstants denoiserConstants = {};
+            m_View.FillPlanarViewConstants(denoiserConstants.view);
+            m_ViewPrevious.FillPlanarViewConstants(denoiserConstants.viewPrev);
+            denoiserConstants.traceRate = m_TraceRate;
+            denoiserConstants.frameIndex = frameIndex;
+            denoiserConstants.historyValid = m_HistoryValid;
+            denoiserConstants.maxHistoryLength = 16.f;
+            denoiserConstants.depthSigma = 0.02f;
+            denoiserConstants.normalPower = 32.f;
+
+            nvrhi::ITexture* historyTexture = m_RenderTargets->m_ShadowHistory[m_HistoryIndex];
+            nvrhi::ITexture* historyPrevTexture = m_RenderTargets->m_ShadowHistory[m_HistoryIndex ^ 1];
+
+            BeginPass(TimedPass::Temporal);
+            
+            nvrhi::BindingSetDesc temporalBindingSetDesc;
+            temporalBindingSetDesc.bindings = {
+                nvrhi::BindingSetItem::ConstantBuffer(0, m_DenoiserConstantBuffer),
+                nvrhi::BindingSetItem::Texture_SRV(0, m_RenderTargets->m_Depth),
+                nvrhi::BindingSetItem::Texture_SRV(2, m_RenderTargets->m_MotionVectors),
+                nvrhi::BindingSetItem::Texture_SRV(3, m_RenderTargets->m_ShadowRaw),
+                nvrhi::BindingSetItem::Texture_SRV(4, historyPrevTexture),
+                nvrhi::BindingSetItem::Texture_UAV(0, historyTexture)
+            };
+
+            nvrhi::ComputeState temporalState;
+            temporalState.pipeline = m_TemporalPipeline;
+            temporalState.bindings = { m_BindingCache->GetOrCreateBindingSet(temporalBindingSetDesc, m_TemporalBindingLayout) };
+
+            m_CommandList->writeBuffer(m_DenoiserConstantBuffer, &denoiserConstants, sizeof(denoiserConstants));
+            m_CommandList->setComputeState(temporalState);
+            m_CommandList->dispatch(groupsX, groupsY);
+
+            EndPass(TimedPass::Temporal);
+
+            shadowTexture = historyTexture;
+
+            // A-trous iterations with growing tap distances, alternating between the two filter targets
+            BeginPass(TimedPass::Spatial);
+
+            for (uint32_t pass = 0; pass < m_SpatialPasses; pass++)
+            {
+                nvrhi::ITexture* outputTexture = m_RenderTargets->m_ShadowFiltered[pass & 1];
+
+                nvrhi::BindingSetDesc spatialBindingSetDesc;
+                spatialBindingSetDesc.bindings = {
+                    nvrhi::BindingSetItem::ConstantBuffer(0, m_DenoiserConstantBuffer),
+                    nvrhi::BindingSetItem::Texture_SRV(1, m_RenderTargets->m_GBufferNormals),
+                    nvrhi::BindingSetItem::Texture_SRV(4, historyTexture),
+                    nvrhi::BindingSetItem::Texture_SRV(5, shadowTexture),
+                    nvrhi::BindingSetItem::Texture_UAV(1, outputTexture)
+                };
+
+                nvrhi::ComputeState spatialState;
+                spatialState.pipeline = m_SpatialPipeline;
+                spatialState.bindings = { m_BindingCache->GetOrCreateBindingSet(spatialBindingSetDesc, m_SpatialBindingLayout) };
+
+                denoiserConstants.stepSize = 1u << pass;
+                m_CommandList->writeBuffer(m_DenoiserConstantBuffer, &denoiserConstants, sizeof(denoiserConstants));
+                m_CommandList->setComputeState(spatialState);
+                m_CommandList->dispatch(groupsX, groupsY);
+
+                shadowTexture = outputTexture;
+            }
+
+            EndPass(TimedPass::Spatial);
+
+            m_HistoryIndex ^= 1;
+            m_HistoryValid = true;
+        }
+        else
+        {
+            m_HistoryValid = false;
+        }
+
+        BeginPass(TimedPass::Composite);
+
+        nvrhi::BindingSetDesc compositeBindingSetDesc;
+        compositeBindingSetDesc.bindings = {
+            nvrhi::BindingSetItem::ConstantBuffer(0, m_ConstantBuffer),
+            nvrhi::BindingSetItem::Texture_SRV(1, m_RenderTargets->m_Depth),
+            nvrhi::BindingSetItem::Texture_SRV(2, m_RenderTargets->m_GBufferDiffuse),
+            nvrhi::BindingSetItem::Texture_SRV(3, m_RenderTargets->m_GBufferSpecular),
+            nvrhi::BindingSetItem::Texture_SRV(4, m_RenderTargets->m_GBufferNormals),
+            nvrhi::BindingSetItem::Texture_SRV(5, m_RenderTargets->m_GBufferEmissive),
+            nvrhi::BindingSetItem::Texture_SRV(6, shadowTexture),
+            nvrhi::BindingSetItem::Texture_UAV(0, m_RenderTargets->m_HdrColor)
+        };
+
+        nvrhi::ComputeState compositeState;
+        compositeState.pipeline = m_CompositePipeline;
+        compositeState.bindings = { m_BindingCache->GetOrCreateBindingSet(compositeBindingSetDesc, m_CompositeBindingLayout) };
+        m_CommandList->setComputeState(compositeState);
+        m_CommandList->dispatch(dm::div_ceil(fbinfo.width, 8), dm::div_ceil(fbinfo.height, 8));
+
+        EndPass(TimedPass::Composite);
+
         m_CommonPasses->BlitTexture(m_CommandList, framebuffer, m_RenderTargets->m_HdrColor, m_BindingCache.get());
 
         m_CommandList->close();
         GetDevice()->executeCommandList(m_CommandList);
+
+        m_ViewPrevious = m_View;
     }
 
 };
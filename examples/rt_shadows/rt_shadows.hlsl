@@ -25,6 +25,7 @@
 #include <donut/shaders/gbuffer.hlsli>
 #include <donut/shaders/lighting.hlsli>
 #include "lighting_cb.h"
+#include "trace_pattern.hlsli"
 
 // ---[ Structures ]---
 
@@ -37,29 +38,34 @@ struct HitInfo
 
 ConstantBuffer<LightingConstants> g_Lighting : register(b0);
 
-RWTexture2D<float4> u_Output : register(u0);
+RWTexture2D<float> u_Shadow : register(u0);
 
 RaytracingAccelerationStructure SceneBVH : register(t0);
 Texture2D t_GBufferDepth : register(t1);
-Texture2D t_GBuffer0 : register(t2);
-Texture2D t_GBuffer1 : register(t3);
-Texture2D t_GBuffer2 : register(t4);
-Texture2D t_GBuffer3 : register(t5);
 
 
 // ---[ Ray Generation Shader ]---
 
+// Traces the sun shadow rays for the pixels selected by the trace pattern and stores their visibility.
+// The lighting is applied by composite.hlsl after the visibility has been denoised.
 [shader("raygeneration")]
 void RayGen()
 {
-    uint2 globalIdx = DispatchRaysIndex().xy;
+    uint2 globalIdx = GetTracedPixel(DispatchRaysIndex().xy, g_Lighting.traceRate, g_Lighting.frameIndex);
+    if (any(float2(globalIdx) >= g_Lighting.view.viewportSize))
+        return;
+
     float2 pixelPosition = float2(globalIdx) + 0.5;
-    
-    MaterialSample surfaceMaterial = DecodeGBuffer(globalIdx, t_GBuffer0, t_GBuffer1, t_GBuffer2, t_GBuffer3);
+    float depth = t_GBufferDepth[globalIdx].x;
 
-    float3 surfaceWorldPos = ReconstructWorldPosition(g_Lighting.view, pixelPosition.xy, t_GBufferDepth[pixelPosition.xy].x);
+    // Nothing to shadow where the G-buffer is empty
+    if (depth == 0)
+    {
+        u_Shadow[globalIdx] = 1;
+        return;
+    }
 
-    float3 viewIncident = GetIncidentVector(g_Lighting.view.cameraDirectionOrPosition, surfaceWorldPos);
+    float3 surfaceWorldPos = ReconstructWorldPosition(g_Lighting.view, pixelPosition.xy, depth);
 
     // Setup the ray
     RayDesc ray;
@@ -82,24 +88,7 @@ void RayGen()
         ray,
         payload);
 
-    float shadow = (payload.missed) ? 1 : 0;
-
-    float3 diffuseTerm = 0;
-    float3 specularTerm = 0;
-
-    float3 diffuseRadiance, specularRadiance;
-    ShadeSurface(g_Lighting.light, surfaceMaterial, surfaceWorldPos, viewIncident, diffuseRadiance, specularRadiance);
-    
-    diffuseTerm += (shadow * diffuseRadiance) * g_Lighting.light.color;
-    specularTerm += (shadow * specularRadiance) * g_Lighting.light.color;
-
-    diffuseTerm += g_Lighting.ambientColor.rgb * surfaceMaterial.diffuseAlbedo;
-    
-    float3 outputColor = diffuseTerm
-        + specularTerm
-        + surfaceMaterial.emissiveColor;
-
-    u_Output[globalIdx] = float4(outputColor, 1);
+    u_Shadow[globalIdx] = (payload.missed) ? 1 : 0;
 }
 
 // ---[ Miss Shader ]---
@@ -0,0 +1,203 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+// Reconstruction of the sun visibility from shadow rays traced at a reduced rate.
+//
+// temporal_cs: reprojects the visibility history with the G-buffer motion vectors and blends in the rays
+//   traced this frame. Pixels that were not traced use a depth weighted average of their traced neighbors.
+//   The history is clamped to the range of the neighbors to limit ghosting, and it is discarded where the
+//   reprojected depth doesn't match.
+// spatial_cs: one iteration of an edge-aware a-trous filter, weighted by view depth and normals.
+
+#pragma pack_matrix(row_major)
+
+#include <donut/shaders/gbuffer.hlsli>
+#include <donut/shaders/lighting.hlsli>
+#include "shadow_denoiser_cb.h"
+#include "trace_pattern.hlsli"
+
+ConstantBuffer<ShadowDenoiserConstants> g_Denoiser : register(b0);
+
+Texture2D t_GBufferDepth : register(t0);
+Texture2D t_GBufferNormals : register(t1);
+Texture2D<float2> t_MotionVectors : register(t2);
+Texture2D<float> t_Shadow : register(t3);
+Texture2D<float4> t_History : register(t4); // temporal_cs: the previous frame, spatial_cs: the current frame
+Texture2D<float> t_Input : register(t5);
+
+RWTexture2D<float4> u_History : register(u0);
+RWTexture2D<float> u_Output : register(u1);
+
+float GetViewDepth(int2 pixel, float depth)
+{
+    float4 clipPos = float4((float2(pixel) + 0.5) * g_Denoiser.view.windowToClipScale + g_Denoiser.view.windowToClipBias, depth, 1);
+    float4 viewPos = mul(clipPos, g_Denoiser.view.matClipToView);
+    return viewPos.z / viewPos.w;
+}
+
+float GetDepthWeight(float depth, float centerDepth)
+{
+    return exp(-abs(depth - centerDepth) / (g_Denoiser.depthSigma * centerDepth));
+}
+
+bool IsInsideViewport(int2 pixel)
+{
+    return all(pixel >= 0) && all(float2(pixel) < g_Denoiser.view.viewportSize);
+}
+
+[numthreads(SHADOW_DENOISER_GROUP_SIZE, SHADOW_DENOISER_GROUP_SIZE, 1)]
+void temporal_cs(uint2 globalIdx : SV_DispatchThreadID)
+{
+    const int2 pixel = int2(globalIdx);
+    if (!IsInsideViewport(pixel))
+        return;
+
+    const float depth = t_GBufferDepth[pixel].x;
+    if (depth == 0)
+    {
+        u_History[pixel] = float4(1, 0, 0, 0);
+        return;
+    }
+
+    const float viewDepth = GetViewDepth(pixel, depth);
+
+    // Gather the rays traced this frame around the pixel
+    float minVisibility = 1;
+    float maxVisibility = 0;
+    float visibilitySum = 0;
+    float weightSum = 0;
+
+    for (int dy = -1; dy <= 1; dy++)
+    {
+        for (int dx = -1; dx <= 1; dx++)
+        {
+            const int2 neighbor = pixel + int2(dx, dy);
+            if (!IsInsideViewport(neighbor) || !IsPixelTraced(uint2(neighbor), g_Denoiser.traceRate, g_Denoiser.frameIndex))
+                continue;
+
+            const float neighborDepth = t_GBufferDepth[neighbor].x;
+            if (neighborDepth == 0)
+                continue;
+
+            const float visibility = t_Shadow[neighbor];
+            const float weight = GetDepthWeight(GetViewDepth(neighbor, neighborDepth), viewDepth);
+
+            minVisibility = min(minVisibility, visibility);
+            maxVisibility = max(maxVisibility, visibility);
+            visibilitySum += visibility * weight;
+            weightSum += weight;
+        }
+    }
+
+    const bool traced = IsPixelTraced(globalIdx, g_Denoiser.traceRate, g_Denoiser.frameIndex);
+    const bool hasSample = traced || weightSum > 0;
+    const float currentVisibility = traced ? t_Shadow[pixel] : (weightSum > 0 ? visibilitySum / weightSum : 1);
+
+    // Interpolated samples are worth less than traced ones
+    const float sampleWeight = traced ? 1.0 : 0.5;
+
+    // Find the pixel in the previous frame and check that it saw the same surface
+    bool historyValid = g_Denoiser.historyValid != 0;
+    float4 history = 0;
+
+    const int2 prevPixel = int2(floor(float2(pixel) + 0.5 + t_MotionVectors[pixel]));
+    if (historyValid && IsInsideViewport(prevPixel))
+    {
+        history = t_History[prevPixel];
+
+        const float3 worldPos = ReconstructWorldPosition(g_Denoiser.view, float2(pixel) + 0.5, depth);
+        const float expectedDepth = mul(float4(worldPos, 1), g_Denoiser.viewPrev.matWorldToView).z;
+
+        historyValid = history.y > 0 && GetDepthWeight(history.z, expectedDepth) > 0.5;
+    }
+    else
+    {
+        historyValid = false;
+    }
+
+    float visibility;
+    float historyLength;
+
+    if (historyValid)
+    {
+        float historyVisibility = history.x;
+        if (weightSum > 0)
+            historyVisibility = clamp(historyVisibility, minVisibility, maxVisibility);
+
+        historyLength = min(history.y + sampleWeight * float(hasSample), g_Denoiser.maxHistoryLength);
+        visibility = hasSample ? lerp(historyVisibility, currentVisibility, sampleWeight / max(historyLength, 1)) : historyVisibility;
+    }
+    else
+    {
+        visibility = currentVisibility;
+        historyLength = sampleWeight;
+    }
+
+    u_History[pixel] = float4(visibility, historyLength, viewDepth, 0);
+}
+
+[numthreads(SHADOW_DENOISER_GROUP_SIZE, SHADOW_DENOISER_GROUP_SIZE, 1)]
+void spatial_cs(uint2 globalIdx : SV_DispatchThreadID)
+{
+    const int2 pixel = int2(globalIdx);
+    if (!IsInsideViewport(pixel))
+        return;
+
+    // The view depth of every pixel is stored in the history written by temporal_cs, 0 means no geometry
+    const float centerDepth = t_History[pixel].z;
+    if (centerDepth == 0)
+    {
+        u_Output[pixel] = t_Input[pixel];
+        return;
+    }
+
+    const float3 centerNormal = t_GBufferNormals[pixel].xyz;
+    const float kernel[3] = { 3.0 / 8.0, 1.0 / 4.0, 1.0 / 16.0 };
+
+    float visibilitySum = 0;
+    float weightSum = 0;
+
+    for (int dy = -2; dy <= 2; dy++)
+    {
+        for (int dx = -2; dx <= 2; dx++)
+        {
+            const int2 neighbor = pixel + int2(dx, dy) * int(g_Denoiser.stepSize);
+            if (!IsInsideViewport(neighbor))
+                continue;
+
+            const float neighborDepth = t_History[neighbor].z;
+            if (neighborDepth == 0)
+                continue;
+
+            const float3 neighborNormal = t_GBufferNormals[neighbor].xyz;
+
+            float weight = kernel[abs(dx)] * kernel[abs(dy)];
+            weight *= GetDepthWeight(neighborDepth, centerDepth);
+            weight *= pow(saturate(dot(centerNormal, neighborNormal)), g_Denoiser.normalPower);
+
+            visibilitySum += t_Input[neighbor] * weight;
+            weightSum += weight;
+        }
+    }
+
+    u_Output[pixel] = weightSum > 0 ? visibilitySum / weightSum : t_Input[pixel];
+}
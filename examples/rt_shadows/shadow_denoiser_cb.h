@@ -0,0 +1,46 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef SHADOW_DENOISER_CB_H
+#define SHADOW_DENOISER_CB_H
+
+#include <donut/shaders/view_cb.h>
+
+#define SHADOW_DENOISER_GROUP_SIZE 8
+
+struct ShadowDenoiserConstants
+{
+    PlanarViewConstants view;
+    PlanarViewConstants viewPrev;
+
+    uint traceRate;
+    uint frameIndex;
+    uint historyValid;
+    uint stepSize;              // Distance between the taps of the spatial filter, in pixels
+
+    float maxHistoryLength;     // In frames, smaller values make the shadows react faster to changes
+    float depthSigma;           // Relative view depth difference at which the filter weights fall off
+    float normalPower;
+    float padding;
+};
+
+#endif // SHADOW_DENOISER_CB_H
@@ -0,0 +1,56 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+// Pixel patterns for tracing the shadow rays at a reduced rate. The pattern moves every frame,
+// so that every pixel is traced once in 'rate' frames.
+//   Rate 1: every pixel.
+//   Rate 2: a checkerboard, the dispatch covers half of the columns.
+//   Rate 4: one pixel in every 2x2 quad, the dispatch covers half of the columns and half of the rows.
+
+#ifndef TRACE_PATTERN_HLSLI
+#define TRACE_PATTERN_HLSLI
+
+static const uint2 c_QuadOffsets[4] = { uint2(0, 0), uint2(1, 1), uint2(1, 0), uint2(0, 1) };
+
+uint2 GetTracedPixel(uint2 dispatchIndex, uint rate, uint frameIndex)
+{
+    if (rate == 2)
+        return uint2(dispatchIndex.x * 2 + ((dispatchIndex.y + frameIndex) & 1), dispatchIndex.y);
+
+    if (rate == 4)
+        return dispatchIndex * 2 + c_QuadOffsets[frameIndex & 3];
+
+    return dispatchIndex;
+}
+
+bool IsPixelTraced(uint2 pixel, uint rate, uint frameIndex)
+{
+    if (rate == 2)
+        return ((pixel.x + pixel.y + frameIndex) & 1) == 0;
+
+    if (rate == 4)
+        return all((pixel & 1) == c_QuadOffsets[frameIndex & 3]);
+
+    return true;
+}
+
+#endif // TRACE_PATTERN_HLSLI
@@ -0,0 +1,294 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+#include "PipelineCache.h"
+
+#include <donut/core/log.h>
+#include <donut/core/vfs/VFS.h>
+#include <donut/engine/ThreadPool.h>
+
+#include <cstdio>
+#include <cstring>
+
+using namespace donut;
+
+static_assert(sizeof(nvrhi::ShaderSpecialization) == 8, "The cache file stores specializations as raw 8-byte records");
+
+static constexpr uint32_t c_CacheFileMagic = 0x43505350; // 'PSPC'
+static constexpr uint32_t c_CacheFileVersion = 1;
+static constexpr uint32_t c_MaxSpecializationsPerShader = 64;
+
+// FNV-1a, the hashes are stored in the cache file so they have to be stable between runs
+static uint64_t HashBytes(const void* data, size_t size)
+{
+    uint64_t hash = 0xcbf29ce484222325ull;
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+static uint64_t HashShader(nvrhi::IShader* shader)
+{
+    const void* bytecode = nullptr;
+    size_t size = 0;
+    shader->getBytecode(&bytecode, &size);
+    return HashBytes(bytecode, size);
+}
+
+template<typename T>
+static void Write(std::string& data, const T& value)
+{
+    data.append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template<typename T>
+static bool Read(const std::string& data, size_t& offset, T& value)
+{
+    if (offset + sizeof(T) > data.size())
+        return false;
+
+    memcpy(&value, data.data() + offset, sizeof(T));
+    offset += sizeof(T);
+    return true;
+}
+
+std::string PipelineCache::PipelineKey::Serialize() const
+{
+    std::string data;
+    Write(data, vertexShaderHash);
+    Write(data, pixelShaderHash);
+    Write(data, uint32_t(vertexSpecializations.size()));
+    for (const auto& specialization : vertexSpecializations)
+        Write(data, specialization);
+    Write(data, uint32_t(pixelSpecializations.size()));
+    for (const auto& specialization : pixelSpecializations)
+        Write(data, specialization);
+    Write(data, uint32_t(colorFormats.size()));
+    for (nvrhi::Format format : colorFormats)
+        Write(data, uint32_t(format));
+    Write(data, uint32_t(depthFormat));
+    Write(data, sampleCount);
+    Write(data, sampleQuality);
+    return data;
+}
+
+bool PipelineCache::PipelineKey::Deserialize(const std::string& data)
+{
+    size_t offset = 0;
+    uint32_t count = 0;
+    uint32_t format = 0;
+
+    if (!Read(data, offset, vertexShaderHash) || !Read(data, offset, pixelShaderHash))
+        return false;
+
+    if (!Read(data, offset, count) || count > c_MaxSpecializationsPerShader)
+        return false;
+    vertexSpecializations.resize(count);
+    for (auto& specialization : vertexSpecializations)
+        if (!Read(data, offset, specialization))
+            return false;
+
+    if (!Read(data, offset, count) || count > c_MaxSpecializationsPerShader)
+        return false;
+    pixelSpecializations.resize(count);
+    for (auto& specialization : pixelSpecializations)
+        if (!Read(data, offset, specialization))
+            return false;
+
+    if (!Read(data, offset, count) || count > nvrhi::c_MaxRenderTargets)
+        return false;
+    colorFormats.resize(count);
+    for (nvrhi::Format& colorFormat : colorFormats)
+    {
+        if (!Read(data, offset, format))
+            return false;
+        colorFormat = nvrhi::Format(format);
+    }
+
+    if (!Read(data, offset, format))
+        return false;
+    depthFormat = nvrhi::Format(format);
+
+    return Read(data, offset, sampleCount) && Read(data, offset, sampleQuality) && offset == data.size();
+}
+
+PipelineCache::PipelineCache(nvrhi::IDevice* device, const nvrhi::GraphicsPipelineDesc& baseDesc, nvrhi::IShader* vertexShader, nvrhi::IShader* pixelShader)
+    : m_Device(device)
+    , m_BaseDesc(baseDesc)
+    , m_VertexShader(vertexShader)
+    , m_PixelShader(pixelShader)
+{
+    m_VertexShaderHash = HashShader(vertexShader);
+    m_PixelShaderHash = HashShader(pixelShader);
+}
+
+bool PipelineCache::Load(const std::filesystem::path& fileName)
+{
+    vfs::NativeFileSystem fs;
+    std::shared_ptr<vfs::IBlob> blob = fs.readFile(fileName);
+    if (!blob)
+        return false;
+
+    const std::string data(static_cast<const char*>(blob->data()), blob->size());
+    size_t offset = 0;
+    uint32_t magic = 0;
+    uint32_t version = 0;
+    uint32_t numKeys = 0;
+
+    if (!Read(data, offset, magic) || !Read(data, offset, version) || !Read(data, offset, numKeys) ||
+        magic != c_CacheFileMagic || version != c_CacheFileVersion)
+    {
+        log::warning("Ignoring the pipeline cache file '%s' because it has an unknown format", fileName.generic_string().c_str());
+        return false;
+    }
+
+    m_LoadedKeys.clear();
+    for (uint32_t index = 0; index < numKeys; index++)
+    {
+        uint32_t keySize = 0;
+        if (!Read(data, offset, keySize) || offset + keySize > data.size())
+        {
+            log::warning("The pipeline cache file '%s' is truncated", fileName.generic_string().c_str());
+            break;
+        }
+
+        m_LoadedKeys.push_back(data.substr(offset, keySize));
+        offset += keySize;
+    }
+
+    return true;
+}
+
+bool PipelineCache::Save(const std::filesystem::path& fileName) const
+{
+    std::string data;
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+
+        Write(data, c_CacheFileMagic);
+        Write(data, c_CacheFileVersion);
+        Write(data, uint32_t(m_Pipelines.size()));
+        for (const auto& [key, pipeline] : m_Pipelines)
+        {
+            Write(data, uint32_t(key.size()));
+            data.append(key);
+        }
+    }
+
+    FILE* file = fopen(fileName.generic_string().c_str(), "wb");
+    if (!file)
+    {
+        log::warning("Cannot write the pipeline cache file '%s'", fileName.generic_string().c_str());
+        return false;
+    }
+
+    const bool success = fwrite(data.data(), 1, data.size(), file) == data.size();
+    fclose(file);
+    return success;
+}
+
+void PipelineCache::Prewarm(engine::ThreadPool& threadPool)
+{
+    for (const std::string& serializedKey : m_LoadedKeys)
+    {
+        PipelineKey key;
+        if (!key.Deserialize(serializedKey))
+            continue;
+
+        // The shaders have been rebuilt since the key was saved
+        if (key.vertexShaderHash != m_VertexShaderHash || key.pixelShaderHash != m_PixelShaderHash)
+            continue;
+
+        threadPool.AddTask([this, key, serializedKey]()
+        {
+            nvrhi::GraphicsPipelineHandle pipeline = CreatePipeline(key);
+            if (!pipeline)
+                return;
+
+            std::lock_guard<std::mutex> lock(m_Mutex);
+            if (m_Pipelines.emplace(serializedKey, pipeline).second)
+                ++m_NumPrewarmedPipelines;
+        });
+    }
+
+    threadPool.WaitForTasks();
+    m_LoadedKeys.clear();
+}
+
+nvrhi::GraphicsPipelineHandle PipelineCache::CreatePipeline(const PipelineKey& key)
+{
+    nvrhi::GraphicsPipelineDesc psoDesc = m_BaseDesc;
+
+    psoDesc.VS = key.vertexSpecializations.empty()
+        ? m_VertexShader
+        : m_Device->createShaderSpecialization(m_VertexShader, key.vertexSpecializations.data(), uint32_t(key.vertexSpecializations.size()));
+
+    psoDesc.PS = key.pixelSpecializations.empty()
+        ? m_PixelShader
+        : m_Device->createShaderSpecialization(m_PixelShader, key.pixelSpecializations.data(), uint32_t(key.pixelSpecializations.size()));
+
+    nvrhi::FramebufferInfo framebufferInfo;
+    for (nvrhi::Format format : key.colorFormats)
+        framebufferInfo.colorFormats.push_back(format);
+    framebufferInfo.depthFormat = key.depthFormat;
+    framebufferInfo.sampleCount = key.sampleCount;
+    framebufferInfo.sampleQuality = key.sampleQuality;
+
+    return m_Device->createGraphicsPipeline(psoDesc, framebufferInfo);
+}
+
+nvrhi::GraphicsPipelineHandle PipelineCache::GetOrCreatePipeline(
+    const std::vector<nvrhi::ShaderSpecialization>& vertexSpecializations,
+    const std::vector<nvrhi::ShaderSpecialization>& pixelSpecializations,
+    const nvrhi::FramebufferInfo& framebufferInfo)
+{
+    PipelineKey key;
+    key.vertexShaderHash = m_VertexShaderHash;
+    key.pixelShaderHash = m_PixelShaderHash;
+    key.vertexSpecializations = vertexSpecializations;
+    key.pixelSpecializations = pixelSpecializations;
+    key.colorFormats.assign(framebufferInfo.colorFormats.begin(), framebufferInfo.colorFormats.end());
+    key.depthFormat = framebufferInfo.depthFormat;
+    key.sampleCount = framebufferInfo.sampleCount;
+    key.sampleQuality = framebufferInfo.sampleQuality;
+
+    const std::string serializedKey = key.Serialize();
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        auto it = m_Pipelines.find(serializedKey);
+        if (it != m_Pipelines.end())
+            return it->second;
+    }
+
+    nvrhi::GraphicsPipelineHandle pipeline = CreatePipeline(key);
+    if (!pipeline)
+        return nullptr;
+
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    m_Pipelines[serializedKey] = pipeline;
+    ++m_NumCreatedPipelines;
+    return pipeline;
+}
@@ -0,0 +1,97 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <nvrhi/nvrhi.h>
+
+#include <atomic>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace donut::engine
+{
+    class ThreadPool;
+}
+
+// A cache of specialized graphics pipelines that persists between runs.
+// Pipelines are keyed by the bytecode hashes of their shaders, the specialization constants and the framebuffer formats,
+// so a resize that keeps the formats finds the existing pipelines.
+//
+// NVRHI doesn't expose the driver's pipeline cache data, so the cache file stores the keys of the pipelines that were used.
+// At startup, Prewarm creates those pipelines on worker threads, which is fast when the driver's own shader cache is warm,
+// and they are ready before the first frame asks for them. Keys whose shaders have changed since they were saved are dropped.
+class PipelineCache
+{
+public:
+    // All pipelines are created from 'baseDesc' with its shaders replaced by the specializations of the cache's shaders
+    PipelineCache(nvrhi::IDevice* device, const nvrhi::GraphicsPipelineDesc& baseDesc, nvrhi::IShader* vertexShader, nvrhi::IShader* pixelShader);
+
+    bool Load(const std::filesystem::path& fileName);
+    bool Save(const std::filesystem::path& fileName) const;
+
+    // Creates the pipelines for all loaded keys that match the current shaders, and waits for them.
+    void Prewarm(donut::engine::ThreadPool& threadPool);
+
+    nvrhi::GraphicsPipelineHandle GetOrCreatePipeline(
+        const std::vector<nvrhi::ShaderSpecialization>& vertexSpecializations,
+        const std::vector<nvrhi::ShaderSpecialization>& pixelSpecializations,
+        const nvrhi::FramebufferInfo& framebufferInfo);
+
+    [[nodiscard]] uint32_t GetNumPrewarmedPipelines() const { return m_NumPrewarmedPipelines; }
+    [[nodiscard]] uint32_t GetNumCreatedPipelines() const { return m_NumCreatedPipelines; }
+
+private:
+    struct PipelineKey
+    {
+        uint64_t vertexShaderHash = 0;
+        uint64_t pixelShaderHash = 0;
+        std::vector<nvrhi::ShaderSpecialization> vertexSpecializations;
+        std::vector<nvrhi::ShaderSpecialization> pixelSpecializations;
+        std::vector<nvrhi::Format> colorFormats;
+        nvrhi::Format depthFormat = nvrhi::Format::UNKNOWN;
+        uint32_t sampleCount = 1;
+        uint32_t sampleQuality = 0;
+
+        // The serialized key is both the map key and the record in the cache file
+        [[nodiscard]] std::string Serialize() const;
+        bool Deserialize(const std::string& data);
+    };
+
+    nvrhi::DeviceHandle m_Device;
+    nvrhi::GraphicsPipelineDesc m_BaseDesc;
+    nvrhi::ShaderHandle m_VertexShader;
+    nvrhi::ShaderHandle m_PixelShader;
+    uint64_t m_VertexShaderHash = 0;
+    uint64_t m_PixelShaderHash = 0;
+
+    mutable std::mutex m_Mutex;
+    std::unordered_map<std::string, nvrhi::GraphicsPipelineHandle> m_Pipelines;
+    std::vector<std::string> m_LoadedKeys;
+    std::atomic<uint32_t> m_NumPrewarmedPipelines = 0;
+    std::atomic<uint32_t> m_NumCreatedPipelines = 0;
+
+    nvrhi::GraphicsPipelineHandle CreatePipeline(const PipelineKey& key);
+};
@@ -22,11 +22,14 @@
 
 #include <donut/app/ApplicationBase.h>
 #include <donut/engine/ShaderFactory.h>
+#include <donut/engine/ThreadPool.h>
 #include <donut/app/DeviceManager.h>
 #include <donut/core/log.h>
 #include <donut/core/vfs/VFS.h>
 #include <nvrhi/utils.h>
 
+#include "PipelineCache.h"
+
 using namespace donut;
 
 static const char* g_WindowTitle = "Donut Example: Vulkan Shader Specializations";
@@ -36,12 +39,20 @@ class ShaderSpecializations : public app::IRenderPass
 private:
     nvrhi::ShaderHandle m_VertexShader;
     nvrhi::ShaderHandle m_PixelShader;
+    std::unique_ptr<PipelineCache> m_PipelineCache;
+    std::filesystem::path m_PipelineCacheFile;
     std::vector<nvrhi::GraphicsPipelineHandle> m_Pipelines;
     nvrhi::CommandListHandle m_CommandList;
 
 public:
     using IRenderPass::IRenderPass;
 
+    ~ShaderSpecializations()
+    {
+        if (m_PipelineCache)
+            m_PipelineCache->Save(m_PipelineCacheFile);
+    }
+
     bool Init()
     {
         auto nativeFS = std::make_shared<vfs::NativeFileSystem>();
@@ -59,12 +70,29 @@ public:
         
         m_CommandList = GetDevice()->createCommandList();
 
+        nvrhi::GraphicsPipelineDesc psoDesc;
+        psoDesc.primType = nvrhi::PrimitiveType::TriangleList;
+        psoDesc.renderState.depthStencilState.depthTestEnable = false;
+        m_PipelineCache = std::make_unique<PipelineCache>(GetDevice(), psoDesc, m_VertexShader, m_PixelShader);
+
+        // Create the pipelines that were used in the previous run before the first frame needs them
+        m_PipelineCacheFile = app::GetDirectoryWithExecutable() / "shader_specializations.psocache";
+        if (m_PipelineCache->Load(m_PipelineCacheFile))
+        {
+            engine::ThreadPool threadPool;
+            m_PipelineCache->Prewarm(threadPool);
+            log::info("Prewarmed %d pipelines from '%s'", m_PipelineCache->GetNumPrewarmedPipelines(), m_PipelineCacheFile.generic_string().c_str());
+        }
+
         return true;
     }
 
     void Animate(float fElapsedTimeSeconds) override
     {
-        GetDeviceManager()->SetInformativeWindowTitle(g_WindowTitle);
+        char extraInfo[64];
+        snprintf(extraInfo, std::size(extraInfo), "%d prewarmed, %d created pipelines",
+            m_PipelineCache->GetNumPrewarmedPipelines(), m_PipelineCache->GetNumCreatedPipelines());
+        GetDeviceManager()->SetInformativeWindowTitle(g_WindowTitle, extraInfo);
     }
 
     void BackBufferResizing() override
@@ -76,37 +104,25 @@ public:
     {
         if (m_Pipelines.empty())
         {
-            nvrhi::IDevice* device = GetDevice();
-
-            // Create pipelines with shader specializations.
-            // The specializations could be created ahead of time, but they're cheap and it doesn't really matter.
+            // Get the pipelines with shader specializations from the cache.
+            // After a resize, the framebuffer formats are the same and the cache returns the existing pipelines.
 
             for (uint32_t i = 0; i < 4; i++)
             {
                 // Vertex shader specialization
-                nvrhi::ShaderSpecialization vertexShaderSpecializations[] = {
+                std::vector<nvrhi::ShaderSpecialization> vertexShaderSpecializations = {
                     nvrhi::ShaderSpecialization::Float( 0, float(i) * 0.5f - 0.75f)
                 };
-                nvrhi::ShaderHandle vertexShader = device->createShaderSpecialization(m_VertexShader, 
-                    vertexShaderSpecializations, uint32_t(std::size(vertexShaderSpecializations)));
                 
                 // Pixel shader specialization
                 uint32_t colors[4] = { 0x0000ff, 0x00ff00, 0xff0000, 0xff00ff };
-                nvrhi::ShaderSpecialization pixelShaderSpecializations[] = {
+                std::vector<nvrhi::ShaderSpecialization> pixelShaderSpecializations = {
                     nvrhi::ShaderSpecialization::UInt32(1, colors[i])
                 };
-                nvrhi::ShaderHandle pixelShader = device->createShaderSpecialization(m_PixelShader, 
-                    pixelShaderSpecializations, uint32_t(std::size(pixelShaderSpecializations)));
 
                 // Pipeline
-                nvrhi::GraphicsPipelineDesc psoDesc;
-                psoDesc.VS = vertexShader;
-                psoDesc.PS = pixelShader;
-                psoDesc.primType = nvrhi::PrimitiveType::TriangleList;
-                psoDesc.renderState.depthStencilState.depthTestEnable = false;
-
-                nvrhi::GraphicsPipelineHandle pipeline = device->createGraphicsPipeline(psoDesc,
-                    framebuffer->getFramebufferInfo());
+                nvrhi::GraphicsPipelineHandle pipeline = m_PipelineCache->GetOrCreatePipeline(
+                    vertexShaderSpecializations, pixelShaderSpecializations, framebuffer->getFramebufferInfo());
                 assert(pipeline);
 
                 m_Pipelines.push_back(pipeline);
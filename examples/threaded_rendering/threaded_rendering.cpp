@@ -36,10 +36,14 @@
 #include <donut/core/vfs/VFS.h>
 #include <donut/core/math/math.h>
 
+#include "FrameProfiler.h"
+
 using namespace donut;
 
 static const char* g_WindowTitle = "Donut Example: Threaded Rendering";
 
+static const char* g_CubeFaceZoneNames[] = { "Cube face +X", "Cube face -X", "Cube face +Y", "Cube face -Y", "Cube face +Z", "Cube face -Z" };
+
 class ThreadedRendering : public app::ApplicationBase
 {
 private:
@@ -50,6 +54,7 @@ private:
 
     bool m_UseThreads = true;
     std::unique_ptr<engine::ThreadPool> m_ThreadPool;
+    std::unique_ptr<FrameProfiler> m_Profiler;
     
     nvrhi::TextureHandle m_DepthBuffer;
     nvrhi::TextureHandle m_ColorBuffer;
@@ -76,6 +81,9 @@ public:
 
         m_ThreadPool = std::make_unique<engine::ThreadPool>();
 
+        m_Profiler = std::make_unique<FrameProfiler>(GetDevice(), app::GetDirectoryWithExecutable() / "threaded_rendering_trace.json");
+        m_Profiler->SetThreadName("Render thread");
+
         m_ShaderFactory = std::make_shared<engine::ShaderFactory>(GetDevice(), m_RootFS, "/shaders");
         m_CommonPasses = std::make_shared<engine::CommonRenderPasses>(GetDevice(), m_ShaderFactory);
         m_BindingCache = std::make_unique<engine::BindingCache>(GetDevice());
@@ -108,6 +116,9 @@ public:
         return true;
     }
     
+    std::shared_ptr<engine::ShaderFactory> GetShaderFactory() const { return m_ShaderFactory; }
+    FrameProfiler& GetProfiler() const { return *m_Profiler; }
+
     void CreateRenderTargets()
     {
         auto textureDesc = nvrhi::TextureDesc()
@@ -188,10 +199,13 @@ public:
 
     void RenderCubeFace(int face)
     {
+        ScopedCpuZone cpuZone(*m_Profiler, g_CubeFaceZoneNames[face]);
+
         const engine::IView* faceView = m_CubemapView.GetChildView(engine::ViewType::PLANAR, face);
 
         nvrhi::ICommandList* commandList = m_FaceCommandLists[face];
         commandList->open();
+        m_Profiler->BeginGpuZone(commandList, g_CubeFaceZoneNames[face]);
         commandList->clearDepthStencilTexture(m_DepthBuffer, faceView->GetSubresources(), true, 0.f, false, 0);
         commandList->clearTextureFloat(m_ColorBuffer, faceView->GetSubresources(), nvrhi::Color(0.f));
 
@@ -209,11 +223,15 @@ public:
 
         commandList->setEnableAutomaticBarriers(true);
 
+        m_Profiler->EndGpuZone(commandList);
         commandList->close();
     }
 
     void Render(nvrhi::IFramebuffer* framebuffer) override
     {
+        m_Profiler->BeginFrame();
+        ScopedCpuZone renderZone(*m_Profiler, "Render");
+
         dm::affine viewMatrix = m_Camera.GetWorldToViewMatrix();
         m_CubemapView.SetTransform(viewMatrix, 0.1f, 100.f);
         m_CubemapView.UpdateCache();
@@ -233,7 +251,9 @@ public:
             }
         }
         
+        m_Profiler->BeginCpuZone("Record blits");
         m_CommandList->open();
+        m_Profiler->BeginGpuZone(m_CommandList, "Blit faces");
 
         const std::vector<std::pair<int, int>> faceLayout = {
             { 3, 1 },
@@ -264,11 +284,14 @@ public:
             blitParams.sourceArraySlice = face;
             m_CommonPasses->BlitTexture(m_CommandList, blitParams, m_BindingCache.get());
         }
-        
+
+        m_Profiler->EndGpuZone(m_CommandList);
         m_CommandList->close();
+        m_Profiler->EndCpuZone();
 
         if (m_UseThreads)
         {
+            ScopedCpuZone waitZone(*m_Profiler, "Wait for face threads");
             m_ThreadPool->WaitForTasks();
         }
 
@@ -319,9 +342,15 @@ int main(int __argc, const char** __argv)
         ThreadedRendering example(deviceManager);
         if (example.Init())
         {
-            deviceManager->AddRenderPassToBack(&example);
-            deviceManager->RunMessageLoop();
-            deviceManager->RemoveRenderPass(&example);
+            FrameProfilerUI profilerUI(deviceManager, example.GetProfiler());
+            if (profilerUI.Init(example.GetShaderFactory()))
+            {
+                deviceManager->AddRenderPassToBack(&example);
+                deviceManager->AddRenderPassToBack(&profilerUI);
+                deviceManager->RunMessageLoop();
+                deviceManager->RemoveRenderPass(&profilerUI);
+                deviceManager->RemoveRenderPass(&example);
+            }
         }
     }
     
@@ -32,35 +32,134 @@
         D3D12_SHADING_RATE_4X4	= 0xa
     } 	D3D12_SHADING_RATE;
 */
+#include "shading_rate_cb.h"
+
+ConstantBuffer<ShadingRateConstants> g_Constants : register(b0);
 RWTexture2D<uint> shadingRateSurface : register(u0);
 Texture2D<float2> motionVectors : register(t0);
 Texture2D<float4> prevFrameColors : register(t1);
 
-#define TILE_SIZE 16
+#define GROUP_THREADS (SHADING_RATE_GROUP_SIZE * SHADING_RATE_GROUP_SIZE)
+
+// Error of shading at quarter rate relative to the error at half rate, for typical game content
+static const float c_QuarterRateErrorScale = 2.13;
+
+groupshared float4 s_TileSums[GROUP_THREADS]; // luminance, squared X gradient, squared Y gradient, pixel count
+groupshared float2 s_TileMotion[GROUP_THREADS]; // absolute motion in X and Y, in pixels
+
+float PerceptualLuminance(float3 color)
+{
+    // Approximate gamma 2 encoding, the error is measured on the values that the viewer actually sees
+    return dot(sqrt(saturate(color)), float3(0.2126, 0.7152, 0.0722));
+}
+
+// Motion blur on the display (sample-and-hold) and in the eye hides some of the shading error on moving content.
+// This is a fit of the visible error reduction as a function of the motion speed in pixels per frame.
+float MotionErrorScale(float velocity)
+{
+    return pow(1.0 / (1.0 + pow(1.05 * velocity, 3.10)), 0.35);
+}
+
+// Returns log2 of the coarsest shading rate along one axis (0 = 1x, 1 = 2x, 2 = 4x) that keeps the estimated error below the threshold
+uint SelectAxisRate(float halfRateError, float threshold)
+{
+    if (halfRateError * c_QuarterRateErrorScale < threshold)
+        return 2;
+    if (halfRateError < threshold)
+        return 1;
+    return 0;
+}
 
-[numthreads(1, 1, 1)]
-void main_cs(uint3 DispatchThreadID : SV_DispatchThreadID)
+// Shading rate selection inspired by "Visually Lossless Content and Motion Adaptive Shading in Games" (Yang et al. 2019).
+// One thread group processes one VRS tile. The previous frame's resolved color is reprojected with the motion vectors,
+// and the luminance gradients in X and Y estimate the error that shading at half or quarter rate along that axis would introduce.
+[numthreads(SHADING_RATE_GROUP_SIZE, SHADING_RATE_GROUP_SIZE, 1)]
+void main_cs(uint3 GroupID : SV_GroupID, uint3 GroupThreadID : SV_GroupThreadID, uint GroupIndex : SV_GroupIndex)
 {
-    // This is a fairly nonsensical algorithm, reads the average color for the tile in the previous frame
-    // and sets the shading rate to 4X4 if green channel is bigger than red channel, 1X1 otherwise
-    // really just intended to make the VRS difference very noticeable to confirm that it is working
-    float2 motionVector = motionVectors.Load(int3(TILE_SIZE * DispatchThreadID.xy, 0));
-    uint2 oldTexel = uint2(float2(DispatchThreadID.xy * TILE_SIZE) + motionVector);
-    float4 averageColor = 0;
-    for (int i = 0; i < TILE_SIZE; i++)
+    const int2 maxPixel = int2(g_Constants.sourceSize) - 1;
+    const uint2 tileOrigin = GroupID.xy * g_Constants.tileSize;
+
+    float4 sums = 0;
+    float2 motion = 0;
+
+    for (uint y = GroupThreadID.y; y < g_Constants.tileSize; y += SHADING_RATE_GROUP_SIZE)
     {
-        for (int j = 0; j < TILE_SIZE; j++)
+        for (uint x = GroupThreadID.x; x < g_Constants.tileSize; x += SHADING_RATE_GROUP_SIZE)
         {
-            averageColor += prevFrameColors.Load(int3(oldTexel + uint2(i, j), 0));
+            int2 pixel = int2(tileOrigin + uint2(x, y));
+            if (any(pixel > maxPixel))
+                continue;
+
+            float2 motionVector = 0;
+            if (g_Constants.flags & SHADING_RATE_FLAG_MOTION_VECTORS)
+                motionVector = motionVectors[pixel];
+
+            int2 prevPixel = clamp(int2(float2(pixel) + 0.5 + motionVector), 0, maxPixel);
+            int2 prevPixelX = min(prevPixel + int2(1, 0), maxPixel);
+            int2 prevPixelY = min(prevPixel + int2(0, 1), maxPixel);
+
+            float luminance = PerceptualLuminance(prevFrameColors[prevPixel].rgb);
+            float gradientX = PerceptualLuminance(prevFrameColors[prevPixelX].rgb) - luminance;
+            float gradientY = PerceptualLuminance(prevFrameColors[prevPixelY].rgb) - luminance;
+
+            sums += float4(luminance, gradientX * gradientX, gradientY * gradientY, 1.0);
+            motion += abs(motionVector);
         }
     }
-    averageColor /= (TILE_SIZE * TILE_SIZE);
-    if (averageColor.g > averageColor.r)
+
+    s_TileSums[GroupIndex] = sums;
+    s_TileMotion[GroupIndex] = motion;
+    GroupMemoryBarrierWithGroupSync();
+
+    [unroll]
+    for (uint stride = GROUP_THREADS / 2; stride > 0; stride >>= 1)
     {
-        shadingRateSurface[DispatchThreadID.xy] = 0xa;
+        if (GroupIndex < stride)
+        {
+            s_TileSums[GroupIndex] += s_TileSums[GroupIndex + stride];
+            s_TileMotion[GroupIndex] += s_TileMotion[GroupIndex + stride];
+        }
+        GroupMemoryBarrierWithGroupSync();
     }
-    else
+
+    if (GroupIndex != 0)
+        return;
+
+    sums = s_TileSums[0];
+    motion = s_TileMotion[0];
+
+    // Rate value encoding is the same in D3D12 and Vulkan: (log2(rateX) << 2) | log2(rateY)
+    uint shadingRate = 0;
+
+    if (sums.w > 0)
     {
-        shadingRateSurface[DispatchThreadID.xy] = 0x0;
+        const float pixelCount = sums.w;
+        const float averageLuminance = sums.x / pixelCount;
+        motion /= pixelCount;
+
+        // The error of dropping every other sample along an axis is approximately the RMS of the gradient along that axis
+        float errorX = sqrt(sums.y / pixelCount) * MotionErrorScale(motion.x);
+        float errorY = sqrt(sums.z / pixelCount) * MotionErrorScale(motion.y);
+
+        float threshold = g_Constants.errorThreshold * (averageLuminance + g_Constants.luminanceOffset);
+
+        if (g_Constants.flags & SHADING_RATE_FLAG_FOVEATION)
+        {
+            float2 tileCenter = float2(tileOrigin) + 0.5 * float(g_Constants.tileSize);
+            float distance = length(tileCenter - g_Constants.foveationCenter);
+            float falloff = saturate((distance - g_Constants.foveationInnerRadius) / max(g_Constants.foveationOuterRadius - g_Constants.foveationInnerRadius, 1.0));
+            threshold *= 1.0 + g_Constants.foveationStrength * falloff;
+        }
+
+        uint rateX = SelectAxisRate(errorX, threshold);
+        uint rateY = SelectAxisRate(errorY, threshold);
+
+        // 1X4 and 4X1 are not valid shading rates
+        rateX = min(rateX, rateY + 1);
+        rateY = min(rateY, rateX + 1);
+
+        shadingRate = (rateX << 2) | rateY;
     }
-}
\ No newline at end of file
+
+    shadingRateSurface[GroupID.xy] = shadingRate;
+}
@@ -0,0 +1,51 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef SHADING_RATE_CB_H
+#define SHADING_RATE_CB_H
+
+#define SHADING_RATE_GROUP_SIZE 8
+
+#define SHADING_RATE_FLAG_MOTION_VECTORS 0x01
+#define SHADING_RATE_FLAG_FOVEATION 0x02
+
+struct ShadingRateConstants
+{
+    uint2 sourceSize;
+    uint tileSize;
+    uint flags;
+
+    // Maximum perceptual error that a tile may have when shaded at a reduced rate, relative to its average luminance.
+    // This is the quality/performance knob: higher values select coarser shading rates for more tiles.
+    float errorThreshold;
+    // Luminance added to the tile average before applying the threshold, so that dark tiles are not forced to full rate.
+    float luminanceOffset;
+    // Foveation center and radii in pixels. Outside of the inner radius, the error threshold grows linearly
+    // up to 'threshold * (1 + foveationStrength)' at the outer radius.
+    float2 foveationCenter;
+    float foveationInnerRadius;
+    float foveationOuterRadius;
+    float foveationStrength;
+    float padding;
+};
+
+#endif // SHADING_RATE_CB_H
@@ -38,16 +38,20 @@
 #include <donut/core/math/math.h>
 #include <nvrhi/utils.h>
 
+#include <algorithm>
+#include <array>
 
 using namespace donut;
 using namespace donut::math;
 
 #include "lighting_cb.h"
+#include "shading_rate_cb.h"
 
 static const char* g_WindowTitle = "Donut Example: Variable Rate Shading";
 
 // NVIDIA Variable Rate Shading (VRS) sample application
 // Relevant sample code is in the Render() function, marked with comments
+// Controls: V toggles VRS, F toggles foveation around the mouse cursor, '-' and '=' lower and raise the quality target
 
 class RenderTargets
 {
@@ -173,8 +177,22 @@ private:
     nvrhi::BindingLayoutHandle m_bindingLayout;
     nvrhi::BindingSetHandle m_bindingSet;
     nvrhi::TextureHandle m_shadingRateSurface;
+    nvrhi::BufferHandle m_shadingRateConstants;
     uint m_vrsTileSize;
 
+    // Shading rate policy settings, adjustable at runtime
+    bool m_VrsEnabled = true;
+    bool m_FoveationEnabled = false;
+    float m_ErrorThreshold = 0.15f;
+    float2 m_MousePosition = 0.f;
+
+    // GPU time of the forward pass, to measure the savings from VRS
+    static constexpr uint32_t c_TimerQueryCount = 4;
+    std::array<nvrhi::TimerQueryHandle, c_TimerQueryCount> m_ForwardPassTimers;
+    std::array<bool, c_TimerQueryCount> m_ForwardPassTimerPending{};
+    uint32_t m_ForwardPassTimerIndex = 0;
+    float m_ForwardPassTimeMs = 0.f;
+
     engine::PlanarView m_ViewPrevious;
     bool m_PreviousViewsValid = false;
 
@@ -227,6 +245,12 @@ public:
         m_Camera.SetMoveSpeed(3.f);
 
         m_ConstantBuffer = GetDevice()->createBuffer(nvrhi::utils::CreateVolatileConstantBufferDesc(sizeof(LightingConstants), "LightingConstants", engine::c_MaxRenderPassConstantBufferVersions));
+        m_shadingRateConstants = GetDevice()->createBuffer(nvrhi::utils::CreateVolatileConstantBufferDesc(sizeof(ShadingRateConstants), "ShadingRateConstants", engine::c_MaxRenderPassConstantBufferVersions));
+
+        for (auto& timer : m_ForwardPassTimers)
+        {
+            timer = GetDevice()->createTimerQuery();
+        }
 
         m_CommandList = GetDevice()->createCommandList();
         
@@ -268,12 +292,25 @@ public:
 
     bool KeyboardUpdate(int key, int scancode, int action, int mods) override
     {
+        if (action == GLFW_PRESS || action == GLFW_REPEAT)
+        {
+            switch (key)
+            {
+            case GLFW_KEY_V: if (action == GLFW_PRESS) m_VrsEnabled = !m_VrsEnabled; break;
+            case GLFW_KEY_F: if (action == GLFW_PRESS) m_FoveationEnabled = !m_FoveationEnabled; break;
+            case GLFW_KEY_MINUS: m_ErrorThreshold = std::max(m_ErrorThreshold / 1.25f, 0.01f); break;
+            case GLFW_KEY_EQUAL: m_ErrorThreshold = std::min(m_ErrorThreshold * 1.25f, 2.f); break;
+            default: break;
+            }
+        }
+
         m_Camera.KeyboardUpdate(key, scancode, action, mods);
         return true;
     }
 
     bool MousePosUpdate(double xpos, double ypos) override
     {
+        m_MousePosition = float2(float(xpos), float(ypos));
         m_Camera.MousePosUpdate(xpos, ypos);
         return true;
     }
@@ -287,7 +324,11 @@ public:
     void Animate(float fElapsedTimeSeconds) override
     {
         m_Camera.Animate(fElapsedTimeSeconds);
-        GetDeviceManager()->SetInformativeWindowTitle(g_WindowTitle);
+
+        char extraInfo[128];
+        snprintf(extraInfo, std::size(extraInfo), "VRS (V) %s, threshold (-/=) %.3f, foveation (F) %s, forward pass %.2f ms",
+            m_VrsEnabled ? "on" : "off", m_ErrorThreshold, m_FoveationEnabled ? "on" : "off", m_ForwardPassTimeMs);
+        GetDeviceManager()->SetInformativeWindowTitle(g_WindowTitle, extraInfo);
     }
 
     void BackBufferResizing() override
@@ -371,6 +412,7 @@ public:
             nvrhi::BindingLayoutDesc layoutDesc;
             layoutDesc.visibility = nvrhi::ShaderType::Compute;
             layoutDesc.bindings = {
+                nvrhi::BindingLayoutItem::VolatileConstantBuffer(0),
                 nvrhi::BindingLayoutItem::Texture_UAV(0),
                 nvrhi::BindingLayoutItem::Texture_SRV(0),
                 nvrhi::BindingLayoutItem::Texture_SRV(1)
@@ -378,10 +420,13 @@ public:
             m_bindingLayout = GetDevice()->createBindingLayout(layoutDesc);
 
             nvrhi::BindingSetDesc bindingSetDesc;
+            // The shading rates are derived from the previous frame's TAA output, which is stable and free of aliasing,
+            // reprojected into the current frame with the motion vectors
             bindingSetDesc.bindings = {
+                nvrhi::BindingSetItem::ConstantBuffer(0, m_shadingRateConstants),
                 nvrhi::BindingSetItem::Texture_UAV(0, m_shadingRateSurface, nvrhi::Format::R8_UINT),
                 nvrhi::BindingSetItem::Texture_SRV(0, m_RenderTargets->m_MotionVectors, nvrhi::Format::RG16_FLOAT),
-                nvrhi::BindingSetItem::Texture_SRV(1, m_RenderTargets->m_HdrColor, nvrhi::Format::RGBA16_FLOAT)
+                nvrhi::BindingSetItem::Texture_SRV(1, m_RenderTargets->m_ResolvedColor, nvrhi::Format::RGBA16_FLOAT)
             };
             m_bindingSet = GetDevice()->createBindingSet(bindingSetDesc, m_bindingLayout);
 
@@ -399,13 +444,36 @@ public:
             m_temporalPass->RenderMotionVectors(m_CommandList, m_View, m_ViewPrevious);
         }
 
-        nvrhi::ComputeState state;
-        state.pipeline = m_Pipeline;
-        state.bindings = { m_bindingSet };
-        m_CommandList->setComputeState(state);
-
-        // Dispatch call to generate the VRS surface
-        m_CommandList->dispatch(surfaceDimensions.x, surfaceDimensions.y, 1);
+        if (m_VrsEnabled)
+        {
+            if (m_PreviousViewsValid)
+            {
+                ShadingRateConstants shadingRateConstants = {};
+                shadingRateConstants.sourceSize = uint2(fbinfo.width, fbinfo.height);
+                shadingRateConstants.tileSize = m_vrsTileSize;
+                shadingRateConstants.flags = SHADING_RATE_FLAG_MOTION_VECTORS | (m_FoveationEnabled ? SHADING_RATE_FLAG_FOVEATION : 0);
+                shadingRateConstants.errorThreshold = m_ErrorThreshold;
+                shadingRateConstants.luminanceOffset = 0.05f;
+                shadingRateConstants.foveationCenter = m_MousePosition;
+                shadingRateConstants.foveationInnerRadius = 0.15f * float(fbinfo.height);
+                shadingRateConstants.foveationOuterRadius = 0.6f * float(fbinfo.height);
+                shadingRateConstants.foveationStrength = 4.f;
+                m_CommandList->writeBuffer(m_shadingRateConstants, &shadingRateConstants, sizeof(shadingRateConstants));
+
+                nvrhi::ComputeState state;
+                state.pipeline = m_Pipeline;
+                state.bindings = { m_bindingSet };
+                m_CommandList->setComputeState(state);
+
+                // Dispatch call to generate the VRS surface, one thread group per tile
+                m_CommandList->dispatch(surfaceDimensions.x, surfaceDimensions.y, 1);
+            }
+            else
+            {
+                // There is no previous frame to derive the rates from yet, shade everything at full rate
+                m_CommandList->clearTextureUInt(m_shadingRateSurface, nvrhi::AllSubresources, 0);
+            }
+        }
 
         m_RenderTargets->Clear(m_CommandList);
 
@@ -415,7 +483,7 @@ public:
         // the PrepareLights() call below will send the constants to the command list, so no need to call it explictly here
 
 #if DONUT_WITH_DX12
-        if (m_UseRawD3D12)
+        if (m_UseRawD3D12 && m_VrsEnabled)
         {
             // VRS command list methods require ID3D12GraphicsCommandList5
             ID3D12GraphicsCommandList* d3dcmdlist = m_CommandList->getNativeObject(nvrhi::ObjectTypes::D3D12_GraphicsCommandList);
@@ -448,8 +516,18 @@ public:
 #endif // DONUT_WITH_DX12
         {
             // enable VRS, with a per-drawcall shading rate of 1X1, and make the shading rate image result always override all others
-            m_View.SetVariableRateShadingState(nvrhi::VariableRateShadingState().setEnabled(true).setShadingRate(nvrhi::VariableShadingRate::e1x1).setImageCombiner(nvrhi::ShadingRateCombiner::Override));
+            m_View.SetVariableRateShadingState(nvrhi::VariableRateShadingState().setEnabled(m_VrsEnabled).setShadingRate(nvrhi::VariableShadingRate::e1x1).setImageCombiner(nvrhi::ShadingRateCombiner::Override));
+        }
+
+        const uint32_t timerIndex = m_ForwardPassTimerIndex;
+        m_ForwardPassTimerIndex = (m_ForwardPassTimerIndex + 1) % c_TimerQueryCount;
+        if (m_ForwardPassTimerPending[timerIndex])
+        {
+            // The query was issued c_TimerQueryCount frames ago, so this normally does not wait
+            m_ForwardPassTimeMs = GetDevice()->getTimerQueryTime(m_ForwardPassTimers[timerIndex]) * 1e3f;
+            GetDevice()->resetTimerQuery(m_ForwardPassTimers[timerIndex]);
         }
+        m_CommandList->beginTimerQuery(m_ForwardPassTimers[timerIndex]);
 
         // Forward pass to draw the scene with the VRS surface set above
         render::ForwardShadingPass::Context forwardContext;
@@ -457,8 +535,11 @@ public:
         render::RenderCompositeView(m_CommandList, &m_View, &m_View, *m_RenderTargets->m_HdrFramebufferDepth, m_Scene->GetSceneGraph()->GetRootNode(), *m_OpaqueDrawStrategy, *m_ForwardPass, forwardContext);
         render::RenderCompositeView(m_CommandList, &m_View, &m_View, *m_RenderTargets->m_HdrFramebufferDepth, m_Scene->GetSceneGraph()->GetRootNode(), *m_TransparentDrawStrategy, *m_ForwardPass, forwardContext);
 
+        m_CommandList->endTimerQuery(m_ForwardPassTimers[timerIndex]);
+        m_ForwardPassTimerPending[timerIndex] = true;
+
 #if DONUT_WITH_DX12
-        if (m_UseRawD3D12)
+        if (m_UseRawD3D12 && m_VrsEnabled)
         {
             ID3D12GraphicsCommandList* d3dcmdlist = m_CommandList->getNativeObject(nvrhi::ObjectTypes::D3D12_GraphicsCommandList);
             ID3D12GraphicsCommandList5* vrscmdlist = nullptr;
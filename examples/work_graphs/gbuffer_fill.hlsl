@@ -22,12 +22,6 @@
 
 #include "scene_data.hlsli"
 
-// This is a root 32-bit value
-cbuffer InstanceConstantBuffer : register(b0)
-{
-    uint g_InstanceID;
-};
-
 StructuredBuffer<Instance> t_InstanceData : register(t0);
 StructuredBuffer<Material> t_MaterialData : register(t3);
 StructuredBuffer<AnimState> t_AnimStateData : register(t4);
@@ -41,10 +35,18 @@ struct PSInput
     uint material : MATERIAL;
 };
 
-PSInput VSMain(float3 vertexPosition : POSITION, float3 vertexNormal : NORMAL)
+float3 DecodeOctahedralNormal(float2 e)
+{
+    float3 n = float3(e.xy, 1.0f - abs(e.x) - abs(e.y));
+    float t = saturate(-n.z);
+    n.x += n.x >= 0.0f ? -t : t;
+    n.y += n.y >= 0.0f ? -t : t;
+    return normalize(n);
+}
+
+PSInput TransformVertex(float3 vertexPosition, float3 vertexNormal, Instance instanceData, uint instanceID)
 {
-    const Instance instanceData = t_InstanceData[g_InstanceID];
-    const AnimState animStateData = t_AnimStateData[g_InstanceID];
+    const AnimState animStateData = t_AnimStateData[instanceID];
     const Material material = t_MaterialData[instanceData.material];
 
     float3 scale = instanceData.size*animStateData.scale;
@@ -76,6 +78,22 @@ PSInput VSMain(float3 vertexPosition : POSITION, float3 vertexNormal : NORMAL)
     return result;
 }
 
+// The instance index comes from the per-instance stream of visible objects written by the culling pass (instance_culling.hlsl).
+#if QUANTIZED_VERTICES
+// 16-bit positions relative to the bounds of the mesh and octahedral normals, see Scene::QuantizedVertex
+PSInput VSMain(float4 quantizedPosition : POSITION, float2 octahedralNormal : NORMAL, uint instanceID : INSTANCEID)
+{
+    const Instance instanceData = t_InstanceData[instanceID];
+    const float3 vertexPosition = meshPositionBias[instanceData.meshType].xyz + quantizedPosition.xyz * meshPositionScale[instanceData.meshType].xyz;
+    return TransformVertex(vertexPosition, DecodeOctahedralNormal(octahedralNormal), instanceData, instanceID);
+}
+#else
+PSInput VSMain(float3 vertexPosition : POSITION, float3 vertexNormal : NORMAL, uint instanceID : INSTANCEID)
+{
+    return TransformVertex(vertexPosition, vertexNormal, t_InstanceData[instanceID], instanceID);
+}
+#endif
+
 uint4 PSMain(PSInput input) : SV_Target
 {
     if (input.faceted)
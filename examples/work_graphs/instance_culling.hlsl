@@ -0,0 +1,104 @@
+/*
+* Copyright (c) 2014-2024, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+#include "scene_data.hlsli"
+
+// These are root 32-bit values
+cbuffer InlineConstants : register(b0)
+{
+    uint g_ObjectCount;
+    float g_LodScale; // Converts (bounding radius / distance) into a fraction of the LOD 0 mesh detail. See PopulateInstanceCullingPass.
+    uint g_Flags;
+};
+
+#define CULLING_FLAG_FRUSTUM 1
+#define CULLING_FLAG_LOD 2
+
+// Must match the constants in scene.cpp.
+static const uint c_LodCount = 4;
+
+StructuredBuffer<Instance> t_InstanceData : register(t0);
+StructuredBuffer<AnimState> t_AnimStateData : register(t4);
+RWStructuredBuffer<uint> u_VisibleInstances : register(u0);
+RWStructuredBuffer<uint> u_DrawArguments : register(u2); // One DrawIndexedIndirectArguments (5 uints) per mesh type and LOD
+
+// Bounding sphere of the animated object in world space, using the same transform as the g-buffer vertex shader.
+// The mesh fits in a unit cube, and the twist only rotates around the Y axis, so half the diagonal of the scaled cube is enough.
+float4 GetBoundingSphere(Instance instanceData, AnimState animStateData)
+{
+    const float3 scale = instanceData.size*animStateData.scale;
+    const float3 translation = instanceData.position+float3(0,(scale.y-instanceData.size.y)*0.5f+animStateData.offsetY,0);
+    return float4(translation, length(scale)*0.5f);
+}
+
+bool IsSphereInFrustum(float4 sphere)
+{
+    // Gribb-Hartmann plane extraction from the columns of the row-vector view-projection matrix. Depth is in [0, 1].
+    const float4x4 m = transpose(viewProj);
+    const float4 planes[6] =
+    {
+        m[3] + m[0],
+        m[3] - m[0],
+        m[3] + m[1],
+        m[3] - m[1],
+        m[2],
+        m[3] - m[2]
+    };
+
+    [unroll]
+    for (int i=0;i<6;i++)
+    {
+        if (dot(planes[i].xyz, sphere.xyz) + planes[i].w < -sphere.w*length(planes[i].xyz))
+            return false;
+    }
+    return true;
+}
+
+[numthreads(32, 1, 1)]
+void CSMain(uint2 dispatchThreadId : SV_DispatchThreadID)
+{
+    const uint objectIndex = dispatchThreadId.y*0xFFFF*32 + dispatchThreadId.x;
+    if (objectIndex >= g_ObjectCount)
+        return;
+
+    const Instance instanceData = t_InstanceData[objectIndex];
+    const float4 sphere = GetBoundingSphere(instanceData, t_AnimStateData[objectIndex]);
+
+    if ((g_Flags & CULLING_FLAG_FRUSTUM) && !IsSphereInFrustum(sphere))
+        return;
+
+    // Every LOD halves the mesh detail. Pick the coarsest one that still has the detail needed for the projected size.
+    uint lod = 0;
+    if ((g_Flags & CULLING_FLAG_LOD) && instanceData.meshType != MT_Plane)
+    {
+        const float distance = max(length(sphere.xyz - camPosAndSceneTime.xyz) - sphere.w, 1e-3f);
+        const float requiredDetail = sphere.w / distance * g_LodScale;
+        lod = (uint)clamp(floor(-log2(max(requiredDetail, 1e-6f))), 0.0f, (float)(c_LodCount-1));
+    }
+
+    // Append the object to the instance range of its draw. The ranges are placed one after another in
+    // u_VisibleInstances, and every draw's range can hold all objects of its mesh type.
+    const uint drawIndex = instanceData.meshType*c_LodCount + lod;
+    uint slot;
+    InterlockedAdd(u_DrawArguments[drawIndex*5+1], 1, slot);
+    u_VisibleInstances[u_DrawArguments[drawIndex*5+4] + slot] = objectIndex;
+}
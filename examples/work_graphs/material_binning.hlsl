@@ -0,0 +1,208 @@
+/*
+* Copyright (c) 2014-2024, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+#include "scene_data.hlsli"
+#include "materials.hlsli"
+#include "lighting.hlsli"
+
+// Material binning: an alternative to the deferred shading uber shader for hardware without work graphs.
+// CSClassify sorts the light tiles into one list per material type (plus one list for tiles with sky pixels),
+// CSBuildArguments turns the list sizes into indirect dispatch arguments, and CSShade is compiled once per list
+// with MATERIAL_BIN set to the material type it evaluates.
+
+// These are root 32-bit values
+cbuffer InlineConstants : register(b0)
+{
+    uint g_LightTilesX, g_LightTilesY;
+    uint g_LightCount;
+};
+
+#define MATERIAL_BIN_SKY BT_COUNT
+#define MATERIAL_BIN_COUNT (BT_COUNT+1) // This value must match MaterialBinning_BinCount defined in work_graphs_d3d12.cpp
+#define MATERIAL_BIN_UNIFORM_TILE 0x80000000 // Set on list entries for tiles where all pixels belong to the bin
+
+#ifndef MATERIAL_BIN
+#define MATERIAL_BIN 0 // Only used by CSShade
+#endif
+
+static const uint c_MaxGroupsPerDimension = 65535;
+
+StructuredBuffer<Material> t_MaterialData : register(t0);
+Texture2D<uint4> t_GBuffer : register(t1);
+Texture2D<float> t_DepthBuffer : register(t2);
+StructuredBuffer<uint> t_CulledLightsData : register(t3);
+StructuredBuffer<Light> t_LightData : register(t4);
+
+// The first MATERIAL_BIN_COUNT entries are the list sizes, then come the lists, each one with room for all tiles.
+RWStructuredBuffer<uint> u_MaterialTiles : register(u0);
+RWTexture2D<float4> u_LDRBuffer : register(u1);
+RWStructuredBuffer<uint> u_DispatchArguments : register(u2); // One DispatchIndirectArguments (3 uints) per bin
+
+uint GetTileListStart(uint bin)
+{
+    return MATERIAL_BIN_COUNT + bin * g_LightTilesX * g_LightTilesY;
+}
+
+// One thread per light tile.
+[numthreads(8, 8, 1)]
+void CSClassify(uint2 dispatchThreadId : SV_DispatchThreadID)
+{
+    const uint2 tileXY = dispatchThreadId;
+    const bool validTile = all(tileXY < uint2(g_LightTilesX, g_LightTilesY));
+
+    uint binMask = 0;
+    if (validTile)
+    {
+        for (uint y=0;y<4;y++)
+        for (uint x=0;x<8;x++)
+        {
+            const uint2 pixelXY = tileXY * uint2(8,4) + uint2(x,y);
+            if (any(pixelXY >= (uint2)viewportSizeXY.xy))
+                continue;
+
+            if (t_DepthBuffer.Load(uint3(pixelXY,0)) == 1.0f)
+                binMask |= 1U << MATERIAL_BIN_SKY;
+            else
+                binMask |= 1U << t_MaterialData[t_GBuffer.Load(uint3(pixelXY,0)).w].materialType;
+        }
+    }
+
+    const uint tileEntry = (tileXY.y * g_LightTilesX + tileXY.x) | (countbits(binMask) == 1 ? MATERIAL_BIN_UNIFORM_TILE : 0);
+
+    // Append the tile to the list of every bin it needs. The write offsets within the wave are a prefix sum
+    // of the tiles that go into the bin, so there is only one atomic per wave and bin.
+    for (uint bin=0;bin<MATERIAL_BIN_COUNT;bin++)
+    {
+        const bool inBin = (binMask & (1U << bin)) != 0;
+        const uint waveCount = WaveActiveCountBits(inBin);
+        if (waveCount == 0)
+            continue;
+
+        uint waveStart = 0;
+        if (WaveIsFirstLane())
+            InterlockedAdd(u_MaterialTiles[bin], waveCount, waveStart);
+        waveStart = WaveReadLaneFirst(waveStart);
+
+        if (inBin)
+            u_MaterialTiles[GetTileListStart(bin) + waveStart + WavePrefixCountBits(inBin)] = tileEntry;
+    }
+}
+
+// One thread per bin.
+[numthreads(MATERIAL_BIN_COUNT, 1, 1)]
+void CSBuildArguments(uint bin : SV_DispatchThreadID)
+{
+    const uint tileCount = u_MaterialTiles[bin];
+    u_DispatchArguments[bin*3+0] = min(tileCount, c_MaxGroupsPerDimension);
+    u_DispatchArguments[bin*3+1] = (tileCount + c_MaxGroupsPerDimension - 1) / c_MaxGroupsPerDimension;
+    u_DispatchArguments[bin*3+2] = 1;
+}
+
+// One thread group per tile in the list of bin MATERIAL_BIN.
+[numthreads(8, 4, 1)]
+void CSShade(uint2 groupThreadId : SV_GroupThreadID, uint2 groupId : SV_GroupID)
+{
+    const uint listIndex = groupId.y * c_MaxGroupsPerDimension + groupId.x;
+    if (listIndex >= u_MaterialTiles[MATERIAL_BIN])
+        return;
+
+    const uint tileEntry = u_MaterialTiles[GetTileListStart(MATERIAL_BIN) + listIndex];
+    const uint tileIndex = tileEntry & ~MATERIAL_BIN_UNIFORM_TILE;
+    const bool uniformTile = (tileEntry & MATERIAL_BIN_UNIFORM_TILE) != 0;
+    const uint2 pixelXY = uint2(tileIndex % g_LightTilesX, tileIndex / g_LightTilesX) * uint2(8,4) + groupThreadId;
+
+    const float depth = t_DepthBuffer.Load(uint3(pixelXY,0));
+
+#if MATERIAL_BIN == MATERIAL_BIN_SKY
+    if (uniformTile || depth == 1.0f)
+        u_LDRBuffer[pixelXY] = float4(EvaluateSky(pixelXY),1); // Sky
+#else
+    if (depth == 1.0f)
+        return;
+
+    const uint4 gbufferData = t_GBuffer.Load(uint3(pixelXY,0));
+    const uint materialID = gbufferData.w;
+    const Material material = t_MaterialData[materialID];
+
+    if (!uniformTile && material.materialType != MATERIAL_BIN)
+        return; // Shaded by another bin
+
+    const float3 worldPosition = Unproject(pixelXY, depth);
+    const float3 worldNormal = normalize(((gbufferData.xyz/(float)0xFFFF)-0.5f)*2.0f); // Decode normal from g-buffer
+    const float3 camPosition = camPosAndSceneTime.xyz;
+    const uint lightReadSlotIndex = tileIndex * c_MaxLightsPerTile;
+
+    float3 color = float3(0,0,0);
+    for (uint i=0;i<c_MaxLightsPerTile;i++)
+    {
+        const uint lightIndex = t_CulledLightsData[lightReadSlotIndex+i];
+        if (lightIndex == 0xFFFFFFFF)
+            break;
+
+        const Light light = t_LightData[lightIndex];
+        if (!PointInSpotLight(pixelXY, depth, light))
+            continue;
+
+        float3 lightToPointDir,lightColor;
+        float lightAttenuation;
+        EvaluateSpotLight(light, worldPosition, lightToPointDir, lightColor, lightAttenuation);
+
+        // MATERIAL_BIN is a compile-time constant, so only one case is compiled into each shader.
+        switch (MATERIAL_BIN)
+        {
+        case BT_Lambert:
+            color += EvaluateMaterial_Lambert(material, worldPosition, worldNormal, lightToPointDir, lightColor, lightAttenuation);
+            break;
+
+        case BT_Phong:
+            color += EvaluateMaterial_Phong(material, worldPosition, worldNormal, lightToPointDir, lightColor, lightAttenuation, camPosition);
+            break;
+
+        case BT_Metallic:
+            color += EvaluateMaterial_Metallic(material, worldPosition, worldNormal, lightToPointDir, lightColor, lightAttenuation, camPosition);
+            break;
+
+        case BT_Velvet:
+            color += EvaluateMaterial_Velvet(material, worldPosition, worldNormal, lightToPointDir, lightColor, lightAttenuation, camPosition);
+            break;
+
+        case BT_Flakes:
+            color += EvaluateMaterial_Flakes(material, worldPosition, worldNormal, lightToPointDir, lightColor, lightAttenuation, camPosition);
+            break;
+
+        case BT_Stan:
+            color += EvaluateMaterial_Stan(material, worldPosition, worldNormal, lightToPointDir, lightColor, lightAttenuation);
+            break;
+
+        case BT_Faceted:
+            color += EvaluateMaterial_Faceted(material, worldPosition, worldNormal, lightToPointDir, lightColor, lightAttenuation, camPosition);
+            break;
+
+        case BT_Checker:
+            color += EvaluateMaterial_Checker(material, worldPosition, worldNormal, lightToPointDir, lightColor, lightAttenuation, camPosition);
+            break;
+        }
+    }
+
+    u_LDRBuffer[pixelXY] = float4(color,1);
+#endif
+}
@@ -20,13 +20,22 @@
 * DEALINGS IN THE SOFTWARE.
 */
 
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
 #include <donut/app/ApplicationBase.h>
 #include <donut/engine/ShaderFactory.h>
+#include <donut/engine/ThreadPool.h>
 #include <donut/app/DeviceManager.h>
 #include <donut/core/log.h>
 #include <donut/core/vfs/VFS.h>
 #include <donut/core/math/math.h>
 #include <nvrhi/utils.h>
+#include <cfloat>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
 #include "scene.h"
 
 using namespace donut::math;
@@ -47,6 +56,7 @@ static const uint32_t SceneParam_LightsPerBall = 3; // Shaders can handle a max
 static const uint16_t SceneParam_BoxSubdivisions = 100;
 static const uint16_t SceneParam_SphereSides = 100;
 static const uint16_t SceneParam_SphereSlices = 50;
+static const uint32_t SceneParam_LodCount = 4; // Each level halves the box subdivisions and the sphere sides and slices. The plane has a single level.
 
 // Materials visual look.
 static const float3 SceneParam_GroundColor = {0.5f,0.5f,0.5f};
@@ -74,64 +84,395 @@ struct MESH_DATA
 	std::vector<float3> positions,normals;
 	std::vector<uint16_t> indices;
 };
-static float3 RandomPosXZ(float extentsX,float y,float extentsZ);
-static float3 RandomSize(float height,float size,float heightVariation,float sizeVariation);
-static float3 RandomColor(bool normalized);
-static float Random01();
-static float RandomAngle();
+
+// Random number stream used by scene generation. Each generation task seeds its own stream from its place in the scene,
+// which makes the generated scene independent of the number of worker threads and of the order the tasks run in.
+class SceneRandom
+{
+public:
+	SceneRandom(uint32_t stream,uint32_t index) : m_state(Hash(Hash(stream)+index) | 1) {}
+
+	uint32_t NextUInt()
+	{
+		// Xorshift32
+		m_state ^= m_state << 13;
+		m_state ^= m_state >> 17;
+		m_state ^= m_state << 5;
+		return m_state;
+	}
+
+	float Next01() { return (NextUInt() >> 8) / (float)0xFFFFFF; } // In [0,1], like rand()/RAND_MAX.
+
+private:
+	static uint32_t Hash(uint32_t seed)
+	{
+		// WangHash, same as Random() in scene_data.hlsli
+		seed = (seed ^ 61) ^ (seed >> 16);
+		seed *= 9;
+		seed = seed ^ (seed >> 4);
+		seed *= 0x27d4eb2d;
+		seed = seed ^ (seed >> 15);
+		return seed;
+	}
+
+	uint32_t m_state;
+};
+
+static float3 RandomPosXZ(SceneRandom& random,float extentsX,float y,float extentsZ);
+static float3 RandomSize(SceneRandom& random,float height,float size,float heightVariation,float sizeVariation);
+static float3 RandomColor(SceneRandom& random,bool normalized);
+static float Random01(SceneRandom& random);
+static float RandomAngle(SceneRandom& random);
 static void GeneratePlane(MESH_DATA& outMesh);
 static void GenerateBox(uint16_t faceSubdivisions,MESH_DATA& outMesh);
 static void GenerateSphere(uint16_t sides,uint16_t slices,MESH_DATA& outMesh);
+static void QuantizeVertices(const float3 *vertices,uint64_t vertexCount,Scene::QuantizedVertex *outVertices,Scene::VertexQuantization& outQuantization);
 
-void Scene::CreateAssets(nvrhi::IDevice *device,nvrhi::ICommandList *commandList)
+// Runs the task on the thread pool, or right away if there is none.
+template<typename F> static void RunTask(donut::engine::ThreadPool *threadPool,F&& task)
 {
-	// Generate geometry data.
-	MESH_DATA meshSet[(int)MeshType::MT_COUNT];
-	GeneratePlane(meshSet[(int)MeshType::MT_Plane]);
-	GenerateBox(SceneParam_BoxSubdivisions, meshSet[(int)MeshType::MT_Box]);
-	GenerateSphere(SceneParam_SphereSides, SceneParam_SphereSlices, meshSet[(int)MeshType::MT_Sphere]);
+	if (threadPool)
+		threadPool->AddTask(std::forward<F>(task));
+	else
+		task();
+}
 
-	PopulateWorld();
+#pragma region Scene cache
+// Layout of a scene cache file: the header, the mesh LOD table, the materials, instances and lights,
+// then the interleaved vertices of every mesh type, and last the indices of every mesh type.
+struct SceneCacheHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t paramsHash;
+	uint32_t materialCount;
+	uint32_t worldObjectCount;
+	uint32_t lightCount;
+	uint32_t lodCount;
+	uint64_t vertexCounts[(int)Scene::MeshType::MT_COUNT]; // In float3 elements, positions and normals are interleaved.
+	uint64_t indexCounts[(int)Scene::MeshType::MT_COUNT];
+};
 
-	// Create GPU buffers and record upload data commands.
+static const uint32_t SceneCache_Magic = 0x43534757; // 'WGSC'
+static const uint32_t SceneCache_Version = 1;
+
+// Changes whenever one of the generation constants above or the layout of the cached structures changes.
+static uint64_t GetSceneParamsHash()
+{
+	const float params[] =
+	{
+		(float)SceneParam_MaterialCountOfEachType, (float)SceneParam_Floors, SceneParam_FloorToCeilingHeight, SceneParam_FloorSize,
+		SceneParam_ObjectRoomSize, SceneParam_BallRoomSize, SceneParam_BallSize, (float)SceneParam_LightsPerBall,
+		(float)SceneParam_BoxSubdivisions, (float)SceneParam_SphereSides, (float)SceneParam_SphereSlices, (float)SceneParam_LodCount,
+		SceneParam_GroundColor.x, SceneParam_GroundColor.y, SceneParam_GroundColor.z,
+		SceneParam_PhongSpecularColorScale, SceneParam_PhongSpecularPowerMin, SceneParam_PhongSpecularPowerRange,
+		SceneParam_VelvetRoughnessMin, SceneParam_VelvetRoughnessRange,
+		SceneParam_FlakesSpecularColorScale, SceneParam_FlakesSpecularPowerMin, SceneParam_FlakesSpecularPowerRange,
+		SceneParam_FlakesGranularityMin, SceneParam_FlakesGranularityRange,
+		SceneParam_StanLineThicknessMin, SceneParam_StanLineThicknessRange, SceneParam_StanLineSpacingMin, SceneParam_StanLineSpacingRange,
+		SceneParam_CheckersSize, SceneParam_CheckersSpecularPowerMin, SceneParam_CheckersSpecularPowerRange,
+		(float)sizeof(Scene::Material), (float)sizeof(Scene::Instance), (float)sizeof(Scene::Light), (float)sizeof(Scene::MeshLod)
+	};
+
+	// FNV-1a
+	uint64_t hash = 0xcbf29ce484222325ull;
+	const uint8_t *bytes = (const uint8_t*)params;
+	for (size_t i=0;i<sizeof(params);i++)
+		hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+	return hash;
+}
+
+// Read-only memory mapping of a whole file.
+class MappedFile
+{
+public:
+	MappedFile() = default;
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	~MappedFile()
+	{
+		if (m_data)
+			UnmapViewOfFile(m_data);
+		if (m_mapping)
+			CloseHandle(m_mapping);
+		if (m_file != INVALID_HANDLE_VALUE)
+			CloseHandle(m_file);
+	}
+
+	bool Open(const std::filesystem::path& fileName)
+	{
+		m_file = CreateFileW(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		if (m_file == INVALID_HANDLE_VALUE)
+			return false;
+
+		LARGE_INTEGER fileSize = {};
+		if (!GetFileSizeEx(m_file, &fileSize) || fileSize.QuadPart == 0)
+			return false;
+
+		m_mapping = CreateFileMappingW(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (!m_mapping)
+			return false;
+
+		m_data = MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+		m_size = (size_t)fileSize.QuadPart;
+		return m_data != nullptr;
+	}
+
+	const uint8_t* GetData() const { return (const uint8_t*)m_data; }
+	size_t GetSize() const { return m_size; }
+
+private:
+	HANDLE m_file = INVALID_HANDLE_VALUE;
+	HANDLE m_mapping = nullptr;
+	void *m_data = nullptr;
+	size_t m_size = 0;
+};
+
+bool Scene::LoadFromCache(nvrhi::IDevice *device,nvrhi::ICommandList *commandList,const std::filesystem::path& cacheFile)
+{
+	MappedFile file;
+	if (!file.Open(cacheFile) || file.GetSize() < sizeof(SceneCacheHeader))
+		return false;
+
+	const SceneCacheHeader& header = *(const SceneCacheHeader*)file.GetData();
+	if (header.magic != SceneCache_Magic || header.version != SceneCache_Version ||
+		header.paramsHash != GetSceneParamsHash() || header.lodCount != SceneParam_LodCount)
+	{
+		donut::log::info("Scene cache '%s' is out of date, regenerating the scene", cacheFile.generic_string().c_str());
+		return false;
+	}
+
+	uint64_t expectedSize = sizeof(SceneCacheHeader) + (uint64_t)MeshType::MT_COUNT * SceneParam_LodCount * sizeof(MeshLod) +
+		header.materialCount * sizeof(Material) + header.worldObjectCount * sizeof(Instance) + header.lightCount * sizeof(Light);
+	for (int i=0;i<(int)MeshType::MT_COUNT;i++)
+		expectedSize += header.vertexCounts[i] * sizeof(float3) + header.indexCounts[i] * sizeof(uint16_t);
+
+	if (file.GetSize() != expectedSize)
+	{
+		donut::log::warning("Scene cache '%s' has an unexpected size, regenerating the scene", cacheFile.generic_string().c_str());
+		return false;
+	}
+
+	const uint8_t *data = file.GetData() + sizeof(SceneCacheHeader);
+	auto readArray = [&data](auto& outArray, size_t count)
+	{
+		using T = typename std::remove_reference_t<decltype(outArray)>::value_type;
+		outArray.assign((const T*)data, (const T*)data + count);
+		data += count * sizeof(T);
+	};
+
+	for (int i=0;i<(int)MeshType::MT_COUNT;i++)
+		readArray(m_meshLods[i], SceneParam_LodCount);
+	readArray(m_materials, header.materialCount);
+	readArray(m_worldObjects, header.worldObjectCount);
+	readArray(m_lights, header.lightCount);
+
+	// The mesh data is uploaded straight from the mapped file.
+	const float3 *vertices[(int)MeshType::MT_COUNT];
+	const uint16_t *indices[(int)MeshType::MT_COUNT];
+	for (int i=0;i<(int)MeshType::MT_COUNT;i++)
+	{
+		vertices[i] = (const float3*)data;
+		data += header.vertexCounts[i] * sizeof(float3);
+	}
+	for (int i=0;i<(int)MeshType::MT_COUNT;i++)
+	{
+		indices[i] = (const uint16_t*)data;
+		data += header.indexCounts[i] * sizeof(uint16_t);
+	}
+
+	CreateBuffers(device, commandList, vertices, header.vertexCounts, indices, header.indexCounts);
+	return true;
+}
+
+void Scene::SaveToCache(const std::filesystem::path& cacheFile,const std::vector<float3> vertices[],const std::vector<uint16_t> indices[]) const
+{
+	SceneCacheHeader header = {};
+	header.magic = SceneCache_Magic;
+	header.version = SceneCache_Version;
+	header.paramsHash = GetSceneParamsHash();
+	header.materialCount = (uint32_t)m_materials.size();
+	header.worldObjectCount = (uint32_t)m_worldObjects.size();
+	header.lightCount = (uint32_t)m_lights.size();
+	header.lodCount = SceneParam_LodCount;
 	for (int i=0;i<(int)MeshType::MT_COUNT;i++)
 	{
-		const MESH_DATA& mesh = meshSet[i];
+		header.vertexCounts[i] = vertices[i].size();
+		header.indexCounts[i] = indices[i].size();
+	}
+
+	FILE *file = fopen(cacheFile.generic_string().c_str(), "wb");
+	if (!file)
+	{
+		donut::log::warning("Cannot write the scene cache '%s'", cacheFile.generic_string().c_str());
+		return;
+	}
+
+	bool success = fwrite(&header, sizeof(header), 1, file) == 1;
+	auto writeArray = [file, &success](const auto& array)
+	{
+		if (!array.empty())
+			success = success && fwrite(array.data(), sizeof(array[0]), array.size(), file) == array.size();
+	};
 
-		// Generate vertex buffer data by interleaving positions and normals
-		std::vector<float3> vertices(mesh.positions.size()*2);
-		for (size_t j=0;j<mesh.positions.size();j++)
+	for (int i=0;i<(int)MeshType::MT_COUNT;i++)
+		writeArray(m_meshLods[i]);
+	writeArray(m_materials);
+	writeArray(m_worldObjects);
+	writeArray(m_lights);
+	for (int i=0;i<(int)MeshType::MT_COUNT;i++)
+		writeArray(vertices[i]);
+	for (int i=0;i<(int)MeshType::MT_COUNT;i++)
+		writeArray(indices[i]);
+
+	fclose(file);
+
+	if (!success)
+	{
+		donut::log::warning("Failed to write the scene cache '%s'", cacheFile.generic_string().c_str());
+		std::error_code ec;
+		std::filesystem::remove(cacheFile, ec);
+	}
+}
+#pragma endregion
+
+Scene::MeshLod Scene::GetMeshLod(MeshType meshType,uint32_t lod) const
+{
+	MeshLod meshLod = m_meshLods[(int)meshType][lod];
+	meshLod.startIndex += m_meshFirstIndices[(int)meshType];
+	meshLod.baseVertex += m_meshFirstVertices[(int)meshType];
+	return meshLod;
+}
+
+void Scene::CreateAssets(nvrhi::IDevice *device,nvrhi::ICommandList *commandList,donut::engine::ThreadPool *threadPool,const std::filesystem::path& cacheFile,bool quantizeVertices)
+{
+	// The scene cache always stores full precision vertices, they are quantized when the buffers are created.
+	m_quantizedVertices = quantizeVertices;
+
+	const auto startTime = std::chrono::steady_clock::now();
+	auto getElapsedMilliseconds = [startTime]() { return std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - startTime).count(); };
+
+	if (!cacheFile.empty() && LoadFromCache(device, commandList, cacheFile))
+	{
+		donut::log::info("Loaded the scene from '%s' in %.1f ms", cacheFile.generic_string().c_str(), getElapsedMilliseconds());
+		return;
+	}
+
+	// Generate geometry data. Every mesh type and LOD is generated by its own task.
+	MESH_DATA lodMeshes[SceneParam_LodCount][(int)MeshType::MT_COUNT];
+	RunTask(threadPool, [&lodMeshes]() { GeneratePlane(lodMeshes[0][(int)MeshType::MT_Plane]); });
+	for (uint32_t lod=0;lod<SceneParam_LodCount;lod++)
+	{
+		RunTask(threadPool, [&lodMeshes, lod]() { GenerateBox(max(uint16_t(SceneParam_BoxSubdivisions>>lod), uint16_t(1)), lodMeshes[lod][(int)MeshType::MT_Box]); });
+		RunTask(threadPool, [&lodMeshes, lod]() { GenerateSphere(max(uint16_t(SceneParam_SphereSides>>lod), uint16_t(3)), max(uint16_t(SceneParam_SphereSlices>>lod), uint16_t(2)), lodMeshes[lod][(int)MeshType::MT_Sphere]); });
+	}
+
+	PopulateWorld(threadPool);
+
+	if (threadPool)
+		threadPool->WaitForTasks();
+
+	// The levels of detail of a mesh are appended one after another, each level uses 16-bit indices
+	// relative to its own first vertex. Positions and normals are interleaved in the vertex buffer.
+	std::vector<float3> vertices[(int)MeshType::MT_COUNT];
+	std::vector<uint16_t> indices[(int)MeshType::MT_COUNT];
+	for (uint32_t lod=0;lod<SceneParam_LodCount;lod++)
+	{
+		for (int i=0;i<(int)MeshType::MT_COUNT;i++)
 		{
-			vertices[j*2+0] = mesh.positions[j];
-			vertices[j*2+1] = mesh.normals[j];
+			const MESH_DATA& lodMesh = lodMeshes[lod][i];
+			if (lodMesh.indices.empty())
+			{
+				m_meshLods[i].push_back(m_meshLods[i].back()); // Reuse the previous level.
+				continue;
+			}
+
+			m_meshLods[i].push_back(MeshLod { (uint32_t)lodMesh.indices.size(), (uint32_t)indices[i].size(), (int32_t)(vertices[i].size()/2) });
+			for (size_t j=0;j<lodMesh.positions.size();j++)
+			{
+				vertices[i].push_back(lodMesh.positions[j]);
+				vertices[i].push_back(lodMesh.normals[j]);
+			}
+			indices[i].insert(indices[i].end(),lodMesh.indices.begin(),lodMesh.indices.end());
 		}
+	}
+
+	const float3 *vertexData[(int)MeshType::MT_COUNT];
+	const uint16_t *indexData[(int)MeshType::MT_COUNT];
+	uint64_t vertexCounts[(int)MeshType::MT_COUNT];
+	uint64_t indexCounts[(int)MeshType::MT_COUNT];
+	for (int i=0;i<(int)MeshType::MT_COUNT;i++)
+	{
+		vertexData[i] = vertices[i].data();
+		indexData[i] = indices[i].data();
+		vertexCounts[i] = vertices[i].size();
+		indexCounts[i] = indices[i].size();
+	}
 
-		// Interleave position and normal information in the vertex buffer
-		const uint64_t vertexBufferSize = (mesh.positions.size()+mesh.normals.size()) * sizeof(float3);
+	CreateBuffers(device, commandList, vertexData, vertexCounts, indexData, indexCounts);
 
-		m_vertexBuffers[i] = device->createBuffer(
-			nvrhi::BufferDesc().setByteSize(vertexBufferSize).
-			setIsVertexBuffer(true).
-			setInitialState(nvrhi::ResourceStates::VertexBuffer).
-			setKeepInitialState(true).
-			setDebugName("MeshVB"));
+	donut::log::info("Generated the scene in %.1f ms", getElapsedMilliseconds());
 
-		commandList->writeBuffer(m_vertexBuffers[i], &vertices[0], vertexBufferSize);
+	if (!cacheFile.empty())
+		SaveToCache(cacheFile, vertices, indices);
+}
 
+void Scene::CreateBuffers(nvrhi::IDevice *device,nvrhi::ICommandList *commandList,const float3* const vertices[],const uint64_t vertexCounts[],const uint16_t* const indices[],const uint64_t indexCounts[])
+{
+	for (const Instance& object : m_worldObjects)
+		m_worldObjectCounts[(int)object.meshType]++;
 
-		// Index buffer, 16-bit indices
-		const uint64_t indexBufferSize = mesh.indices.size() * sizeof(uint16_t);
+	// All mesh types share one vertex and one index buffer, so the g-buffer pass binds them once for all of its draws.
+	// The input vertex counts are in float3 elements, positions and normals are interleaved.
+	uint64_t totalVertexCount = 0;
+	uint64_t totalIndexCount = 0;
+	for (int i=0;i<(int)MeshType::MT_COUNT;i++)
+	{
+		m_meshFirstVertices[i] = (int32_t)totalVertexCount;
+		m_meshFirstIndices[i] = (uint32_t)totalIndexCount;
+		totalVertexCount += vertexCounts[i]/2;
+		totalIndexCount += indexCounts[i];
+	}
 
-		m_indexBuffers[i] = device->createBuffer(
-			nvrhi::BufferDesc().setByteSize(indexBufferSize).
-			setIsIndexBuffer(true).
-			setInitialState(nvrhi::ResourceStates::IndexBuffer).
-			setKeepInitialState(true).
-			setDebugName("MeshIB"));
+	const uint64_t vertexSize = m_quantizedVertices ? sizeof(QuantizedVertex) : sizeof(float3)*2;
+	std::vector<uint8_t> vertexData(totalVertexCount * vertexSize);
+	std::vector<uint16_t> indexData(totalIndexCount);
+	for (int i=0;i<(int)MeshType::MT_COUNT;i++)
+	{
+		const uint64_t meshVertexCount = vertexCounts[i]/2;
+		uint8_t *meshVertexData = vertexData.data() + m_meshFirstVertices[i] * vertexSize;
+
+		if (m_quantizedVertices)
+			QuantizeVertices(vertices[i], meshVertexCount, (QuantizedVertex*)meshVertexData, m_vertexQuantization[i]);
+		else
+			memcpy(meshVertexData, vertices[i], meshVertexCount * vertexSize);
 
-		commandList->writeBuffer(m_indexBuffers[i], &mesh.indices[0], indexBufferSize);
+		memcpy(indexData.data() + m_meshFirstIndices[i], indices[i], indexCounts[i] * sizeof(uint16_t));
 	}
 
+	m_vertexBuffer = device->createBuffer(
+		nvrhi::BufferDesc().setByteSize(vertexData.size()).
+		setIsVertexBuffer(true).
+		setInitialState(nvrhi::ResourceStates::VertexBuffer).
+		setKeepInitialState(true).
+		setDebugName("MeshVB"));
+
+	commandList->writeBuffer(m_vertexBuffer, vertexData.data(), vertexData.size());
+
+	// Index buffer, 16-bit indices relative to the base vertex of each level
+	m_indexBuffer = device->createBuffer(
+		nvrhi::BufferDesc().setByteSize(indexData.size() * sizeof(uint16_t)).
+		setIsIndexBuffer(true).
+		setInitialState(nvrhi::ResourceStates::IndexBuffer).
+		setKeepInitialState(true).
+		setDebugName("MeshIB"));
+
+	commandList->writeBuffer(m_indexBuffer, indexData.data(), indexData.size() * sizeof(uint16_t));
+
+	donut::log::info("Scene geometry: %.1f MB of %s vertices, %.1f MB of indices", vertexData.size() / (1024.0f*1024.0f),
+		m_quantizedVertices ? "quantized" : "full precision", indexData.size() * sizeof(uint16_t) / (1024.0f*1024.0f));
+
 	// Materials data.
 	{
 		const uint64_t materialDataBufferSize = m_materials.size() * sizeof(Material);
@@ -203,174 +544,207 @@ float Scene::GetSceneHeight()
 	return SceneParam_FloorToCeilingHeight * SceneParam_Floors;
 }
 
-void Scene::PopulateWorld()
+uint32_t Scene::GetLodCount()
+{
+	return SceneParam_LodCount;
+}
+
+uint32_t Scene::GetLod0Detail()
+{
+	return max((uint32_t)SceneParam_BoxSubdivisions, (uint32_t)SceneParam_SphereSides);
+}
+
+void Scene::PopulateWorld(donut::engine::ThreadPool *threadPool)
 {
-	srand(0); // Determinstic world content.
+	SceneRandom random(0,0);
 
 	// Generate materials.
 	m_materials.push_back(Material { SceneParam_GroundColor, MaterialType::BT_Lambert }); // Material 0 is lambert.
 	m_materials.push_back(Material { {1,1,1}, MaterialType::BT_Faceted }); // Material 1 is faceted.
-	const float materialCountOfEachType = 10;
 	{
 		// Lamberts.
 		for (uint32_t i=0;i<SceneParam_MaterialCountOfEachType;i++)
-			m_materials.push_back(Material { RandomColor(true), MaterialType::BT_Lambert });
+			m_materials.push_back(Material { RandomColor(random,true), MaterialType::BT_Lambert });
 
 		// Phongs.
 		for (uint32_t i=0;i<SceneParam_MaterialCountOfEachType;i++)
 		{
-			Material mat = { RandomColor(true), MaterialType::BT_Phong };
-			mat.phong.specularColor = RandomColor(true);
+			Material mat = { RandomColor(random,true), MaterialType::BT_Phong };
+			mat.phong.specularColor = RandomColor(random,true);
 			mat.phong.specularColor = mat.phong.specularColor * SceneParam_PhongSpecularColorScale;
-			mat.phong.specularPower = Random01()  *SceneParam_PhongSpecularPowerRange + SceneParam_PhongSpecularPowerMin;
+			mat.phong.specularPower = Random01(random)  *SceneParam_PhongSpecularPowerRange + SceneParam_PhongSpecularPowerMin;
 			m_materials.push_back(mat);
 		}
 
 		// Metallics.
 		for (uint32_t i=0;i<SceneParam_MaterialCountOfEachType;i++)
-			m_materials.push_back(Material { RandomColor(true), MaterialType::BT_Metallic });
+			m_materials.push_back(Material { RandomColor(random,true), MaterialType::BT_Metallic });
 
 		// Velvets.
 		for (uint32_t i=0;i<SceneParam_MaterialCountOfEachType;i++)
 		{
-			Material mat = { RandomColor(true), MaterialType::BT_Velvet };
-			mat.velvet.roughness = Random01() * SceneParam_VelvetRoughnessRange + SceneParam_VelvetRoughnessMin;
+			Material mat = { RandomColor(random,true), MaterialType::BT_Velvet };
+			mat.velvet.roughness = Random01(random) * SceneParam_VelvetRoughnessRange + SceneParam_VelvetRoughnessMin;
 			m_materials.push_back(mat);
 		}
 
 		// Flakes.
 		for (uint32_t i=0;i<SceneParam_MaterialCountOfEachType;i++)
 		{
-			Material mat = { RandomColor(true), MaterialType::BT_Flakes };
-			mat.flakes.specularColor = RandomColor(true);
+			Material mat = { RandomColor(random,true), MaterialType::BT_Flakes };
+			mat.flakes.specularColor = RandomColor(random,true);
 			mat.phong.specularColor = mat.phong.specularColor * SceneParam_FlakesSpecularColorScale;
-			mat.flakes.specularPower = Random01() * SceneParam_FlakesSpecularPowerRange + SceneParam_FlakesSpecularPowerMin;
-			mat.flakes.granularity = Random01() * SceneParam_FlakesGranularityRange + SceneParam_FlakesGranularityMin;
+			mat.flakes.specularPower = Random01(random) * SceneParam_FlakesSpecularPowerRange + SceneParam_FlakesSpecularPowerMin;
+			mat.flakes.granularity = Random01(random) * SceneParam_FlakesGranularityRange + SceneParam_FlakesGranularityMin;
 			m_materials.push_back(mat);
 		}
 
 		// Stans.
 		for (uint32_t i=0;i<SceneParam_MaterialCountOfEachType;i++)
 		{
-			Material mat = { RandomColor(true), MaterialType::BT_Stan };
-			mat.stan.linesColor = RandomColor(false);
-			mat.stan.linesThickness = Random01() * SceneParam_StanLineThicknessRange + SceneParam_StanLineThicknessMin;
-			mat.stan.linesSpacing = Random01() * SceneParam_StanLineSpacingRange + SceneParam_StanLineSpacingMin;
+			Material mat = { RandomColor(random,true), MaterialType::BT_Stan };
+			mat.stan.linesColor = RandomColor(random,false);
+			mat.stan.linesThickness = Random01(random) * SceneParam_StanLineThicknessRange + SceneParam_StanLineThicknessMin;
+			mat.stan.linesSpacing = Random01(random) * SceneParam_StanLineSpacingRange + SceneParam_StanLineSpacingMin;
 			m_materials.push_back(mat);
 		}
 
 		// Checkers.
 		for (uint32_t i=0;i<SceneParam_MaterialCountOfEachType;i++)
 		{
-			Material mat = { RandomColor(true), MaterialType::BT_Checker };
-			mat.curvature.baseColor2 = RandomColor(false);
+			Material mat = { RandomColor(random,true), MaterialType::BT_Checker };
+			mat.curvature.baseColor2 = RandomColor(random,false);
 			mat.curvature.checkerSize = SceneParam_CheckersSize;
-			mat.curvature.specularPower = Random01() * SceneParam_CheckersSpecularPowerRange + SceneParam_CheckersSpecularPowerMin;
+			mat.curvature.specularPower = Random01(random) * SceneParam_CheckersSpecularPowerRange + SceneParam_CheckersSpecularPowerMin;
 			m_materials.push_back(mat);
 		}
 	} // Materials
 
 	// Spawn multiple floors, each floor has a single plane, multiple glitter balls, and many cute dancers.
+	// The instances of a floor are laid out as the plane, then the balls, then the dancers. All counts are known
+	// up front, so every task writes into its own range of the instance and light arrays.
+	const int ballRoomCount1D = (int)(SceneParam_FloorSize / SceneParam_BallRoomSize);
+	const int objectRoomCount1D = (int)(SceneParam_FloorSize / SceneParam_ObjectRoomSize);
+	const size_t ballsPerFloor = (size_t)ballRoomCount1D * ballRoomCount1D;
+	const size_t objectsPerFloor = (size_t)objectRoomCount1D * objectRoomCount1D;
+	const size_t instancesPerFloor = 1 + ballsPerFloor + objectsPerFloor;
+	const size_t lightsPerFloor = ballsPerFloor * SceneParam_LightsPerBall;
+	const uint32_t dancerMaterialCount = (uint32_t)m_materials.size()-2; // Skip the first two hard-coded materials.
+
+	m_worldObjects.resize(instancesPerFloor * SceneParam_Floors);
+	m_lights.resize(lightsPerFloor * SceneParam_Floors);
+
 	for (uint32_t floor=0;floor<SceneParam_Floors;floor++)
 	{
 		const float floorHeight = floor * SceneParam_FloorToCeilingHeight;
 		const float ceilingHeight = (floor+1) * SceneParam_FloorToCeilingHeight;
+		Instance *floorObjects = m_worldObjects.data() + floor * instancesPerFloor;
+		Light *floorLights = m_lights.data() + floor * lightsPerFloor;
 
 		// Ground.
-		m_worldObjects.push_back(Instance {{0,floorHeight,0}, 0, {SceneParam_FloorSize,0,SceneParam_FloorSize}, MeshType::MT_Plane, 0, AnimType::AT_Static });
+		floorObjects[0] = Instance {{0,floorHeight,0}, 0, {SceneParam_FloorSize,0,SceneParam_FloorSize}, MeshType::MT_Plane, 0, AnimType::AT_Static };
 
-		// Multiple balls hung from the ceiling, emitting lights.
+		// Multiple balls hung from the ceiling, emitting lights. One task per row of rooms.
+		for (int roomX=0;roomX<ballRoomCount1D;roomX++)
 		{
-			const int roomCount1D = (int)(SceneParam_FloorSize / SceneParam_BallRoomSize);
-			const float ballHeight = ceilingHeight-SceneParam_BallSize*0.5f;
-			for (int roomX=0;roomX<roomCount1D;roomX++)
-			for (int roomZ=0;roomZ<roomCount1D;roomZ++)
+			RunTask(threadPool, [=]()
 			{
-				const float roomCenterX = -SceneParam_FloorSize*0.5f + roomX * SceneParam_BallRoomSize + SceneParam_BallRoomSize*0.5f;
-				const float roomCenterZ = -SceneParam_FloorSize*0.5f + roomZ * SceneParam_BallRoomSize + SceneParam_BallRoomSize*0.5f;
-				float3 ballPos = RandomPosXZ((SceneParam_BallRoomSize-SceneParam_BallSize)*0.3f,ballHeight,(SceneParam_BallRoomSize-SceneParam_BallSize)*0.3f);
-				ballPos.x += roomCenterX;
-				ballPos.z += roomCenterZ;
-				m_worldObjects.push_back(Instance {ballPos, RandomAngle(), {SceneParam_BallSize,SceneParam_BallSize,SceneParam_BallSize}, MeshType::MT_Sphere, 1, AnimType::AT_RotateY });
-
-				// From each ball, generate a few lights.
-				for (uint32_t light=0;light<SceneParam_LightsPerBall;light++)
+				SceneRandom random(1+floor*2,roomX);
+				const float ballHeight = ceilingHeight-SceneParam_BallSize*0.5f;
+				for (int roomZ=0;roomZ<ballRoomCount1D;roomZ++)
 				{
-					const float3 dir = normalize(RandomSize(-1,0,0.8f,2.0f));
-					const float length = Random01() * SceneParam_FloorSize*0.35f + SceneParam_FloorToCeilingHeight;
-					const float3 tgt = {dir.x*length+ballPos.x, dir.y*length+ballPos.y, dir.z*length+ballPos.z};
-					float angle1 = RandomAngle()*0.25f+0.25f; // Within 90-degree limit.
-					float angle2 = RandomAngle()*0.25f+0.25f; // Within 90-degree limit.
-					const float innerAngle = min(angle1,angle2);
-					const float outerAngle = max(angle1,angle2)+RandomAngle()*0.1f;
-
-					m_lights.push_back(Light {ballPos, tgt, float3(0,0,0), RandomColor(true), innerAngle, outerAngle});
+					const float roomCenterX = -SceneParam_FloorSize*0.5f + roomX * SceneParam_BallRoomSize + SceneParam_BallRoomSize*0.5f;
+					const float roomCenterZ = -SceneParam_FloorSize*0.5f + roomZ * SceneParam_BallRoomSize + SceneParam_BallRoomSize*0.5f;
+					float3 ballPos = RandomPosXZ(random,(SceneParam_BallRoomSize-SceneParam_BallSize)*0.3f,ballHeight,(SceneParam_BallRoomSize-SceneParam_BallSize)*0.3f);
+					ballPos.x += roomCenterX;
+					ballPos.z += roomCenterZ;
+
+					const size_t ballIndex = (size_t)roomX*ballRoomCount1D + roomZ;
+					floorObjects[1+ballIndex] = Instance {ballPos, RandomAngle(random), {SceneParam_BallSize,SceneParam_BallSize,SceneParam_BallSize}, MeshType::MT_Sphere, 1, AnimType::AT_RotateY };
+
+					// From each ball, generate a few lights.
+					for (uint32_t light=0;light<SceneParam_LightsPerBall;light++)
+					{
+						const float3 dir = normalize(RandomSize(random,-1,0,0.8f,2.0f));
+						const float length = Random01(random) * SceneParam_FloorSize*0.35f + SceneParam_FloorToCeilingHeight;
+						const float3 tgt = {dir.x*length+ballPos.x, dir.y*length+ballPos.y, dir.z*length+ballPos.z};
+						float angle1 = RandomAngle(random)*0.25f+0.25f; // Within 90-degree limit.
+						float angle2 = RandomAngle(random)*0.25f+0.25f; // Within 90-degree limit.
+						const float innerAngle = min(angle1,angle2);
+						const float outerAngle = max(angle1,angle2)+RandomAngle(random)*0.1f;
+
+						floorLights[ballIndex*SceneParam_LightsPerBall+light] = Light {ballPos, tgt, float3(0,0,0), RandomColor(random,true), innerAngle, outerAngle};
+					}
 				}
-			}
+			});
 		}
 
 		// Many objects on the floor, sub-divide the plane into squares and place one object randomly within that square.
+		// One task per row of squares.
+		for (int roomX=0;roomX<objectRoomCount1D;roomX++)
 		{
-			const int roomCount1D = (int)(SceneParam_FloorSize / SceneParam_ObjectRoomSize);
-			for (int roomX=0;roomX<roomCount1D;roomX++)
-			for (int roomZ=0;roomZ<roomCount1D;roomZ++)
+			RunTask(threadPool, [=]()
 			{
-				const float roomCenterX = -SceneParam_FloorSize*0.5f + roomX * SceneParam_ObjectRoomSize + SceneParam_ObjectRoomSize*0.5f;
-				const float roomCenterZ = -SceneParam_FloorSize*0.5f + roomZ * SceneParam_ObjectRoomSize + SceneParam_ObjectRoomSize*0.5f;
-			
-				float3 size = RandomSize(SceneParam_FloorToCeilingHeight*0.35f,SceneParam_ObjectRoomSize*0.20f,SceneParam_FloorToCeilingHeight*0.1f,SceneParam_ObjectRoomSize*0.05f);
-				float3 pos = RandomPosXZ((SceneParam_ObjectRoomSize-size.x)*0.5f,floorHeight+size.y*0.5f,(SceneParam_ObjectRoomSize-size.z)*0.5f);
-				pos.x += roomCenterX;
-				pos.y += 0.01f; // Counter z-fighting.
-				pos.z += roomCenterZ;
-				const UINT32 material = (UINT32)(rand()%((int)m_materials.size()-2)+2); // Skip the first two hard-coded materials.
-
-				m_worldObjects.push_back(Instance {pos, RandomAngle(), size, MeshType::MT_Box, material, AnimType::AT_Dance });
-			}
+				SceneRandom random(2+floor*2,roomX);
+				for (int roomZ=0;roomZ<objectRoomCount1D;roomZ++)
+				{
+					const float roomCenterX = -SceneParam_FloorSize*0.5f + roomX * SceneParam_ObjectRoomSize + SceneParam_ObjectRoomSize*0.5f;
+					const float roomCenterZ = -SceneParam_FloorSize*0.5f + roomZ * SceneParam_ObjectRoomSize + SceneParam_ObjectRoomSize*0.5f;
+
+					float3 size = RandomSize(random,SceneParam_FloorToCeilingHeight*0.35f,SceneParam_ObjectRoomSize*0.20f,SceneParam_FloorToCeilingHeight*0.1f,SceneParam_ObjectRoomSize*0.05f);
+					float3 pos = RandomPosXZ(random,(SceneParam_ObjectRoomSize-size.x)*0.5f,floorHeight+size.y*0.5f,(SceneParam_ObjectRoomSize-size.z)*0.5f);
+					pos.x += roomCenterX;
+					pos.y += 0.01f; // Counter z-fighting.
+					pos.z += roomCenterZ;
+					const UINT32 material = random.NextUInt()%dancerMaterialCount+2;
+
+					floorObjects[1+ballsPerFloor+(size_t)roomX*objectRoomCount1D+roomZ] = Instance {pos, RandomAngle(random), size, MeshType::MT_Box, material, AnimType::AT_Dance };
+				}
+			});
 		}
 	}
 }
 
 #pragma region Randomization Functions
-static float3 RandomPosXZ(float extentsX,float y,float extentsZ)
+static float3 RandomPosXZ(SceneRandom& random,float extentsX,float y,float extentsZ)
 {
 	return float3
 	{
-		((rand()/(float)RAND_MAX)-0.5f)*extentsX*2.0f,
+		(random.Next01()-0.5f)*extentsX*2.0f,
 		y,
-		((rand()/(float)RAND_MAX)-0.5f)*extentsZ*2.0f
+		(random.Next01()-0.5f)*extentsZ*2.0f
 	};
 };
 
-static float3 RandomSize(float height,float size,float heightVariation,float sizeVariation)
+static float3 RandomSize(SceneRandom& random,float height,float size,float heightVariation,float sizeVariation)
 {
 	return float3
 	{
-		size + (rand()/(float)RAND_MAX-0.5f)*sizeVariation,
-		height + (rand()/(float)RAND_MAX-0.5f)*heightVariation,
-		size + (rand()/(float)RAND_MAX-0.5f)*sizeVariation,
+		size + (random.Next01()-0.5f)*sizeVariation,
+		height + (random.Next01()-0.5f)*heightVariation,
+		size + (random.Next01()-0.5f)*sizeVariation,
 	};
 }
 
-static float3 RandomColor(bool normalized)
+static float3 RandomColor(SceneRandom& random,bool normalized)
 {
 	float3 clr = float3
 	{
-		rand()/(float)RAND_MAX,
-		rand()/(float)RAND_MAX,
-		rand()/(float)RAND_MAX
+		random.Next01(),
+		random.Next01(),
+		random.Next01()
 	};
 	return normalized ? normalize(clr) : clr;
 }
 
-static float Random01()
+static float Random01(SceneRandom& random)
 {
-	return rand()/(float)RAND_MAX;
+	return random.Next01();
 }
 
-static float RandomAngle()
+static float RandomAngle(SceneRandom& random)
 {
-	return (rand()/(float)RAND_MAX)*PI_f*2.0f;
+	return random.Next01()*PI_f*2.0f;
 };
 #pragma endregion
 
@@ -496,4 +870,47 @@ static void GenerateSphere(uint16_t sides,uint16_t slices,MESH_DATA& outMesh)
 		outMesh.indices.push_back(capBaseVtx+(i+1)%sides);
 	}
 }
-#pragma endregion
\ No newline at end of file
+#pragma endregion
+
+// Octahedral normal encoding, decoded by DecodeOctahedralNormal in gbuffer_fill.hlsl.
+static float2 EncodeOctahedralNormal(float3 n)
+{
+	n /= (fabsf(n.x)+fabsf(n.y)+fabsf(n.z));
+	float2 p(n.x,n.y);
+	if (n.z < 0)
+	{
+		p.x = (1.0f-fabsf(n.y)) * (n.x >= 0 ? 1.0f : -1.0f);
+		p.y = (1.0f-fabsf(n.x)) * (n.y >= 0 ? 1.0f : -1.0f);
+	}
+	return p;
+}
+
+// The input vertices are interleaved positions and normals.
+static void QuantizeVertices(const float3 *vertices,uint64_t vertexCount,Scene::QuantizedVertex *outVertices,Scene::VertexQuantization& outQuantization)
+{
+	float3 boundsMin = float3(FLT_MAX);
+	float3 boundsMax = float3(-FLT_MAX);
+	for (uint64_t i=0;i<vertexCount;i++)
+	{
+		boundsMin = min(boundsMin, vertices[i*2]);
+		boundsMax = max(boundsMax, vertices[i*2]);
+	}
+
+	outQuantization.positionBias = boundsMin;
+	outQuantization.positionScale = boundsMax-boundsMin; // Zero on flat axes, where every vertex is at the bias.
+	const float3 extent = max(outQuantization.positionScale, float3(FLT_MIN));
+
+	for (uint64_t i=0;i<vertexCount;i++)
+	{
+		const float3 fraction = saturate((vertices[i*2]-boundsMin)/extent);
+		const float2 normal = clamp(EncodeOctahedralNormal(normalize(vertices[i*2+1])), float2(-1.0f), float2(1.0f));
+
+		Scene::QuantizedVertex& vertex = outVertices[i];
+		vertex.position[0] = (uint16_t)(fraction.x*0xFFFF+0.5f);
+		vertex.position[1] = (uint16_t)(fraction.y*0xFFFF+0.5f);
+		vertex.position[2] = (uint16_t)(fraction.z*0xFFFF+0.5f);
+		vertex.position[3] = 0;
+		vertex.normal[0] = (int16_t)roundf(normal.x*0x7FFF);
+		vertex.normal[1] = (int16_t)roundf(normal.y*0x7FFF);
+	}
+}
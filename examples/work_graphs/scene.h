@@ -22,6 +22,13 @@
 
 #pragma once
 
+#include <filesystem>
+
+namespace donut::engine
+{
+	class ThreadPool;
+}
+
 class Scene
 {
 public:
@@ -117,6 +124,28 @@ public:
 		float outerAngle;
 	};
 
+	// All mesh types and their SceneParam_LodCount levels of detail are stored in a single vertex and index buffer.
+	struct MeshLod
+	{
+		uint32_t indexCount;
+		uint32_t startIndex;
+		int32_t baseVertex;
+	};
+
+	// Quantized vertices store the position as 16-bit UNORM fractions of the mesh bounds, position = bias + fraction * scale,
+	// and the normal as a 16-bit SNORM octahedral encoding. Vertices are 12 bytes instead of 24.
+	struct QuantizedVertex
+	{
+		uint16_t position[4]; // The last component is padding.
+		int16_t normal[2];
+	};
+
+	struct VertexQuantization
+	{
+		dm::float3 positionScale;
+		dm::float3 positionBias;
+	};
+
 	struct AnimState
 	{
 		uint32_t state;
@@ -130,7 +159,11 @@ public:
 		float twist;
 	};
 
-	void CreateAssets(nvrhi::IDevice *device,nvrhi::ICommandList *commandList);
+	// Generates the scene on the thread pool, or on the calling thread if threadPool is null.
+	// If cacheFile is not empty, the scene is loaded from that file when it matches the generation constants in scene.cpp,
+	// and otherwise it is generated and saved into the file.
+	// If quantizeVertices is set, the vertex buffer holds QuantizedVertex elements, otherwise interleaved float3 positions and normals.
+	void CreateAssets(nvrhi::IDevice *device,nvrhi::ICommandList *commandList,donut::engine::ThreadPool *threadPool = nullptr,const std::filesystem::path& cacheFile = {},bool quantizeVertices = false);
 
 	const std::vector<Material>& GetMaterials() const { return m_materials; }
 	const std::vector<Instance>& GetWorldObjects() const { return m_worldObjects; }
@@ -139,17 +172,33 @@ public:
 	nvrhi::BufferHandle GetWorldObjectsBuffer() const { return m_instanceDataBuffer; }
 	nvrhi::BufferHandle GetLightsBuffer() const { return m_lightDataBuffer; }
 	nvrhi::BufferHandle GetAnimStateBuffer() const { return m_animStateBuffer; }
-	nvrhi::BufferHandle GetMeshVertexBuffer(MeshType meshType) const { return m_vertexBuffers[(int)meshType]; }
-	nvrhi::BufferHandle GetMeshIndexBuffer(MeshType meshType) const { return m_indexBuffers[(int)meshType]; }
+	nvrhi::BufferHandle GetMeshVertexBuffer() const { return m_vertexBuffer; }
+	nvrhi::BufferHandle GetMeshIndexBuffer() const { return m_indexBuffer; }
+	bool HasQuantizedVertices() const { return m_quantizedVertices; }
+	const VertexQuantization& GetVertexQuantization(MeshType meshType) const { return m_vertexQuantization[(int)meshType]; }
+	// The start index and base vertex are locations in the shared buffers.
+	MeshLod GetMeshLod(MeshType meshType, uint32_t lod) const;
+	uint32_t GetWorldObjectCount(MeshType meshType) const { return m_worldObjectCounts[(int)meshType]; }
 
 	static float GetSceneSize();
 	static float GetSceneHeight();
+	static uint32_t GetLodCount();
+	static uint32_t GetLod0Detail();
 
 protected:
-	void PopulateWorld();
-
-	nvrhi::BufferHandle m_vertexBuffers[(int)MeshType::MT_COUNT];
-	nvrhi::BufferHandle m_indexBuffers[(int)MeshType::MT_COUNT];
+	void PopulateWorld(donut::engine::ThreadPool *threadPool);
+	void CreateBuffers(nvrhi::IDevice *device,nvrhi::ICommandList *commandList,const dm::float3* const vertices[],const uint64_t vertexCounts[],const uint16_t* const indices[],const uint64_t indexCounts[]);
+	bool LoadFromCache(nvrhi::IDevice *device,nvrhi::ICommandList *commandList,const std::filesystem::path& cacheFile);
+	void SaveToCache(const std::filesystem::path& cacheFile,const std::vector<dm::float3> vertices[],const std::vector<uint16_t> indices[]) const;
+
+	nvrhi::BufferHandle m_vertexBuffer;
+	nvrhi::BufferHandle m_indexBuffer;
+	bool m_quantizedVertices = false;
+	std::vector<MeshLod> m_meshLods[(int)MeshType::MT_COUNT]; // Relative to the mesh type's range in the shared buffers, as in the scene cache.
+	uint32_t m_meshFirstIndices[(int)MeshType::MT_COUNT] = {};
+	int32_t m_meshFirstVertices[(int)MeshType::MT_COUNT] = {};
+	VertexQuantization m_vertexQuantization[(int)MeshType::MT_COUNT] = {};
+	uint32_t m_worldObjectCounts[(int)MeshType::MT_COUNT] = {};
 	nvrhi::BufferHandle m_materialDataBuffer;
 	nvrhi::BufferHandle m_instanceDataBuffer;
 	nvrhi::BufferHandle m_lightDataBuffer;
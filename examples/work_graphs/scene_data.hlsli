@@ -25,6 +25,12 @@
 #define AT_RotateY 1
 #define AT_Dance 2
 
+// enum MeshType
+#define MT_Plane 0
+#define MT_Box 1
+#define MT_Sphere 2
+#define MT_COUNT 3
+
 // enum MaterialType
 #define BT_Lambert 0
 #define BT_Phong 1
@@ -44,6 +50,8 @@ cbuffer SceneConstantBuffer : register(b1)
     float4 camPosAndSceneTime;
     float4 camDir;
     float4 viewportSizeXY;
+    float4 meshPositionScale[MT_COUNT]; // Dequantization of the vertex positions, by mesh type
+    float4 meshPositionBias[MT_COUNT];
 };
 
 struct Instance
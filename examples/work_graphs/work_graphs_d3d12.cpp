@@ -24,6 +24,7 @@
 #include <donut/app/ApplicationBase.h>
 #include <donut/engine/FramebufferFactory.h>
 #include <donut/engine/ShaderFactory.h>
+#include <donut/engine/ThreadPool.h>
 #include <donut/app/DeviceManager.h>
 #include <donut/app/imgui_renderer.h>
 #include <donut/core/log.h>
@@ -31,6 +32,7 @@
 #include <donut/core/math/math.h>
 #include <wrl.h>
 #include "scene.h"
+#include "FrameProfiler.h"
 
 using namespace donut;
 using namespace donut::app;
@@ -40,12 +42,15 @@ using Microsoft::WRL::ComPtr;
 
 static const char* g_WindowTitle = "Donut Example: Work Graphs";
 #define WORKGRAPH_NAME L"D3D12WorkGraphs"
+static bool g_UseSceneCache = false; // Load the generated scene from a file next to the executable, -scene-cache
+static bool g_QuantizeVertices = false; // Store 16-bit positions and octahedral normals in the vertex buffer, -quantize-vertices
 
 
 // Constants used by deferred shading. Ensure these values are matched with the shaders.
 static const uint32_t DeferredShadingParam_MaxLightsPerTile = 64; // If changed, make sure to also change the constant c_MaxLightsPerTile in lighting.hlsli
 static const uint32_t DeferredShadingParam_TileWidth = 8;
 static const uint32_t DeferredShadingParam_TileHeight = 4;
+static const uint32_t MaterialBinning_BinCount = (uint32_t)Scene::MaterialType::BT_COUNT + 1; // One bin per material type and one for sky. Must match MATERIAL_BIN_COUNT in material_binning.hlsl
 
 // Simulation and camera control constants.
 static const float Animation_SpeedMultiplier = 1.0f;
@@ -58,6 +63,9 @@ static const float Camera_ClimbRatio = 0.6f;
 static const float Camera_VerticalFOV = (dm::PI_f/4.0f)*1.15f; // In radians.
 static const float Camera_NearClipDistance = 0.5f;
 
+// Instance culling constants.
+static const float Culling_LodPixelsPerEdge = 4.0f; // Target on-screen length of a box subdivision or a sphere side when choosing the LOD.
+
 
 struct UIData
 {
@@ -65,6 +73,9 @@ struct UIData
     int CurrentTechnique = 0;
     bool Paused = false;
     bool ResetAnim = false;
+    bool EnableFrustumCulling = true;
+    bool EnableLod = true;
+    bool ShowProfiler = false;
     float GPUFrameTime = 0.0f;
     float GPUShadingTime = 0.0f;
 };
@@ -133,9 +144,12 @@ private:
     {
         AnimateObjects,
         AnimateLights,
+        InstanceCulling,
         GBufferFill,
         LightCulling,
         DeferredShading,
+        MaterialClassify,
+        MaterialShading,
         WorkGraph,
 
         COUNT
@@ -145,6 +159,7 @@ private:
     {
         WorkGraphBroadcastingLaunch,
         Dispatch,
+        DispatchMaterialBinning,
 
         COUNT,
     };
@@ -152,6 +167,7 @@ private:
     std::unique_ptr<RenderTargets> m_RenderTargets;
     nvrhi::InputLayoutHandle m_InputLayout;
     nvrhi::BindingLayoutHandle m_BindingLayout;
+    nvrhi::BindingLayoutHandle m_GBufferBindingLayout;
     nvrhi::BindingSetHandle m_BindingSets[(int)ScenePass::COUNT];
 
     Scene m_Scene;
@@ -160,9 +176,13 @@ private:
     // Pipeline state objects.
     nvrhi::ComputePipelineHandle m_AnimateObjectsPSO;
     nvrhi::ComputePipelineHandle m_AnimateLightsPSO;
+    nvrhi::ComputePipelineHandle m_InstanceCullingPSO;
     nvrhi::GraphicsPipelineHandle m_GBufferFillPSO;
     nvrhi::ComputePipelineHandle m_CullLightsPSO;
     nvrhi::ComputePipelineHandle m_ShadePSO;
+    nvrhi::ComputePipelineHandle m_MaterialClassifyPSO;
+    nvrhi::ComputePipelineHandle m_MaterialBuildArgumentsPSO;
+    nvrhi::ComputePipelineHandle m_MaterialShadePSOs[MaterialBinning_BinCount];
 
     // Work graph objects.
     ComPtr<ID3D12StateObject> m_WorkGraphBroadcastingSO;
@@ -174,6 +194,11 @@ private:
     // Resources.
     nvrhi::BufferHandle m_ConstantBuffer;
     nvrhi::BufferHandle m_CulledLightsBuffer;
+    nvrhi::BufferHandle m_MaterialTilesBuffer;
+    nvrhi::BufferHandle m_MaterialDispatchArgumentsBuffer;
+    nvrhi::BufferHandle m_VisibleInstancesBuffer;
+    nvrhi::BufferHandle m_DrawArgumentsBuffer;
+    std::vector<nvrhi::DrawIndexedIndirectArguments> m_InitialDrawArguments;
 
     nvrhi::BufferHandle m_NullSRVBuffer;
     nvrhi::BufferHandle m_NullUAVBuffer;
@@ -186,10 +211,7 @@ private:
     UIData& m_UI;
 
     // Timing.
-    static const uint32_t QueuedFramesCount = 10;
-    nvrhi::TimerQueryHandle m_FrameTimers[QueuedFramesCount];
-    nvrhi::TimerQueryHandle m_ShadingTimers[QueuedFramesCount];
-    int m_NextTimerToUse = 0;
+    FrameProfiler m_Profiler;
     float m_TimeInSeconds = 0.0f;
     float m_TimeDiffThisFrame = 0.0f;
     bool m_ForceResetAnimation = true;
@@ -202,11 +224,14 @@ private:
         float4 camPosAndSceneTime;
         float4 camDir;
         float4 viewportSizeXY;
+        float4 meshPositionScale[(int)Scene::MeshType::MT_COUNT]; // Dequantization of the vertex positions, see Scene::VertexQuantization
+        float4 meshPositionBias[(int)Scene::MeshType::MT_COUNT];
 
         // Constant buffers are 256-byte aligned. Add padding in the struct to allow multiple buffers
         // to be array-indexed.
-        float padding[20];
+        float padding[60];
     };
+    static_assert(sizeof(SceneConstantBuffer) % 256 == 0, "SceneConstantBuffer must be a multiple of 256 bytes");
 
     // Utility functions.
     static inline bool HRSuccess(HRESULT hr) { assert(SUCCEEDED(hr)); return SUCCEEDED(hr); }
@@ -219,22 +244,6 @@ private:
     static inline uint32_t GetLightTileCountX(uint32_t viewportWidth) { return (viewportWidth+DeferredShadingParam_TileWidth-1)/DeferredShadingParam_TileWidth; };
     static inline uint32_t GetLightTileCountY(uint32_t viewportHeight) { return (viewportHeight+DeferredShadingParam_TileHeight-1)/DeferredShadingParam_TileHeight; };
     static inline uint32_t GetLightTileCount(uint32_t viewportWidth, uint32_t viewportHeight) { return GetLightTileCountX(viewportWidth) * GetLightTileCountY(viewportHeight); };
-    float GetLastValidQueryTimer(nvrhi::TimerQueryHandle timers[QueuedFramesCount])
-    {
-        nvrhi::IDevice *device = GetDevice();
-        for (int i=m_NextTimerToUse-1;i>=0;i--)
-        {
-            if (device->pollTimerQuery(timers[i]))
-                return device->getTimerQueryTime(timers[i])*1000.0f;
-        }
-
-        for (int i=QueuedFramesCount-1;i>m_NextTimerToUse;i--)
-        {
-            if (device->pollTimerQuery(timers[i]))
-                return device->getTimerQueryTime(timers[i])*1000.0f;
-        }
-        return -1.0f;
-    }
     static inline float4x4 lookToD3DStyle(const float3& eyePosition, const float3& focusPosition, const float3& upDirection)
     {
         float3 eyeDirection = focusPosition - eyePosition;
@@ -256,8 +265,13 @@ public:
 
     WorkGraphs(DeviceManager* deviceManager, UIData& ui) :
         IRenderPass(deviceManager),
-        m_UI(ui)
-    {}
+        m_UI(ui),
+        m_Profiler(deviceManager->GetDevice(), app::GetDirectoryWithExecutable() / "work_graphs_trace.json")
+    {
+        m_Profiler.SetThreadName("Render thread");
+    }
+
+    FrameProfiler& GetProfiler() { return m_Profiler; }
 
     bool Init()
     {
@@ -294,22 +308,55 @@ public:
             .setFormat(nvrhi::Format::RGBA8_UNORM).setKeepInitialState(true)
             .setInitialState(nvrhi::ResourceStates::UnorderedAccess).setIsUAV(true).setDebugName("NullUAVTexture"));
 
-        for (uint32_t i=0; i<QueuedFramesCount; i++)
+        // Create the scene procedurally, using all cores.
         {
-            m_FrameTimers[i] = GetDevice()->createTimerQuery();
-            m_ShadingTimers[i] = GetDevice()->createTimerQuery();
+            engine::ThreadPool threadPool;
+            const std::filesystem::path cacheFile = g_UseSceneCache ? app::GetDirectoryWithExecutable() / "work_graphs_scene.cache" : std::filesystem::path();
+
+            m_CommandList->open();
+            m_Scene.CreateAssets(GetDevice(), m_CommandList, &threadPool, cacheFile, g_QuantizeVertices);
         }
-        
-        // Create the scene procedurally.
-        m_CommandList->open();
-        m_Scene.CreateAssets(GetDevice(), m_CommandList);
         m_CommandList->close();
         GetDevice()->executeCommandList(m_CommandList);
         GetDevice()->waitForIdle();
 
+        CreateInstanceCullingBuffers();
+
         return true;
     }
 
+    void CreateInstanceCullingBuffers()
+    {
+        // One indexed draw per mesh type and LOD. Each draw owns a range of the visible instances buffer
+        // that is large enough to hold all objects of its mesh type. The culling pass appends to these ranges
+        // and increments the instance counts, which are reset to zero from m_InitialDrawArguments every frame.
+        uint32_t instanceRangeStart = 0;
+        for (int meshType=0;meshType<(int)Scene::MeshType::MT_COUNT;meshType++)
+        {
+            for (uint32_t lod=0;lod<Scene::GetLodCount();lod++)
+            {
+                const Scene::MeshLod meshLod = m_Scene.GetMeshLod((Scene::MeshType)meshType, lod);
+                m_InitialDrawArguments.push_back(nvrhi::DrawIndexedIndirectArguments()
+                    .setIndexCount(meshLod.indexCount)
+                    .setInstanceCount(0)
+                    .setStartIndexLocation(meshLod.startIndex)
+                    .setBaseVertexLocation(meshLod.baseVertex)
+                    .setStartInstanceLocation(instanceRangeStart));
+                instanceRangeStart += m_Scene.GetWorldObjectCount((Scene::MeshType)meshType);
+            }
+        }
+
+        m_DrawArgumentsBuffer = GetDevice()->createBuffer(nvrhi::BufferDesc()
+            .setByteSize(m_InitialDrawArguments.size() * sizeof(nvrhi::DrawIndexedIndirectArguments))
+            .setStructStride(sizeof(UINT32)).setCanHaveUAVs(true).setIsDrawIndirectArgs(true).setKeepInitialState(true)
+            .setInitialState(nvrhi::ResourceStates::IndirectArgument).setDebugName("DrawArguments"));
+
+        m_VisibleInstancesBuffer = GetDevice()->createBuffer(nvrhi::BufferDesc()
+            .setByteSize(max(instanceRangeStart, 1U) * sizeof(UINT32))
+            .setStructStride(sizeof(UINT32)).setCanHaveUAVs(true).setIsVertexBuffer(true).setKeepInitialState(true)
+            .setInitialState(nvrhi::ResourceStates::VertexBuffer).setDebugName("VisibleInstances"));
+    }
+
     bool LoadScenePipelines(nvrhi::FramebufferInfoEx const& fbinfo)
     {
         std::filesystem::path appShaderPath = app::GetDirectoryWithExecutable() / "shaders/work_graphs_d3d12" /  app::GetShaderTypeName(GetDevice()->getGraphicsAPI());
@@ -319,18 +366,33 @@ public:
 
         nvrhi::ShaderHandle animateObjects_computeShader = shaderFactory.CreateShader("animation.hlsl", "CSMainObjects", nullptr, nvrhi::ShaderType::Compute);
         nvrhi::ShaderHandle animateLights_computeShader = shaderFactory.CreateShader("animation.hlsl", "CSMainLights", nullptr, nvrhi::ShaderType::Compute);
-        nvrhi::ShaderHandle gbuffer_vertexShader = shaderFactory.CreateShader("gbuffer_fill.hlsl", "VSMain", nullptr, nvrhi::ShaderType::Vertex);
+        nvrhi::ShaderHandle instanceCulling_computeShader = shaderFactory.CreateShader("instance_culling.hlsl", "CSMain", nullptr, nvrhi::ShaderType::Compute);
+        std::vector<engine::ShaderMacro> gbufferDefines = { { "QUANTIZED_VERTICES", m_Scene.HasQuantizedVertices() ? "1" : "0" } };
+        nvrhi::ShaderHandle gbuffer_vertexShader = shaderFactory.CreateShader("gbuffer_fill.hlsl", "VSMain", &gbufferDefines, nvrhi::ShaderType::Vertex);
         nvrhi::ShaderHandle gbuffer_pixelShader = shaderFactory.CreateShader("gbuffer_fill.hlsl", "PSMain", nullptr, nvrhi::ShaderType::Pixel);
         nvrhi::ShaderHandle lightCulling_computeShader = shaderFactory.CreateShader("light_culling.hlsl", "CSMain", nullptr, nvrhi::ShaderType::Compute);
         nvrhi::ShaderHandle deferredShading_computeShader = shaderFactory.CreateShader("deferred_shading.hlsl", "CSMain", nullptr, nvrhi::ShaderType::Compute);
+        nvrhi::ShaderHandle materialClassify_computeShader = shaderFactory.CreateShader("material_binning.hlsl", "CSClassify", nullptr, nvrhi::ShaderType::Compute);
+        nvrhi::ShaderHandle materialBuildArguments_computeShader = shaderFactory.CreateShader("material_binning.hlsl", "CSBuildArguments", nullptr, nvrhi::ShaderType::Compute);
 
-        if (!animateObjects_computeShader || !animateLights_computeShader ||
+        if (!animateObjects_computeShader || !animateLights_computeShader || !instanceCulling_computeShader ||
             !gbuffer_vertexShader || !gbuffer_pixelShader ||
-            !lightCulling_computeShader || !deferredShading_computeShader)
+            !lightCulling_computeShader || !deferredShading_computeShader ||
+            !materialClassify_computeShader || !materialBuildArguments_computeShader)
         {
             return false;
         }
 
+        // One material shading shader per bin, specialized for the material type of the bin.
+        nvrhi::ShaderHandle materialShade_computeShaders[MaterialBinning_BinCount];
+        for (uint32_t bin=0; bin<MaterialBinning_BinCount; bin++)
+        {
+            std::vector<engine::ShaderMacro> defines = { { "MATERIAL_BIN", std::to_string(bin) } };
+            materialShade_computeShaders[bin] = shaderFactory.CreateShader("material_binning.hlsl", "CSShade", &defines, nvrhi::ShaderType::Compute);
+            if (!materialShade_computeShaders[bin])
+                return false;
+        }
+
 		auto bindingLayoutDesc = nvrhi::BindingLayoutDesc()
             .setRegisterSpace(0)
             .setVisibility(nvrhi::ShaderType::All)
@@ -342,20 +404,40 @@ public:
 			.addItem(nvrhi::BindingLayoutItem::StructuredBuffer_SRV(3))
 			.addItem(nvrhi::BindingLayoutItem::StructuredBuffer_SRV(4))
 			.addItem(nvrhi::BindingLayoutItem::StructuredBuffer_UAV(0))
-            .addItem(nvrhi::BindingLayoutItem::Texture_UAV(1));
+            .addItem(nvrhi::BindingLayoutItem::Texture_UAV(1))
+            .addItem(nvrhi::BindingLayoutItem::StructuredBuffer_UAV(2));
         m_BindingLayout = GetDevice()->createBindingLayout(bindingLayoutDesc);
 
+        // The g-buffer fill pass gets its object indices from the instance stream, so it has no root constants to set
+        auto gbufferBindingLayoutDesc = nvrhi::BindingLayoutDesc()
+            .setRegisterSpace(0)
+            .setVisibility(nvrhi::ShaderType::All)
+            .addItem(nvrhi::BindingLayoutItem::VolatileConstantBuffer(1))
+            .addItem(nvrhi::BindingLayoutItem::StructuredBuffer_SRV(0))
+            .addItem(nvrhi::BindingLayoutItem::StructuredBuffer_SRV(3))
+            .addItem(nvrhi::BindingLayoutItem::StructuredBuffer_SRV(4));
+        m_GBufferBindingLayout = GetDevice()->createBindingLayout(gbufferBindingLayoutDesc);
+
+        const bool quantizedVertices = m_Scene.HasQuantizedVertices();
+        const uint32_t vertexStride = quantizedVertices ? sizeof(Scene::QuantizedVertex) : sizeof(float3)*2;
         nvrhi::VertexAttributeDesc attributes[] = {
             nvrhi::VertexAttributeDesc()
                 .setName("POSITION")
-                .setFormat(nvrhi::Format::RGB32_FLOAT)
-                .setOffset(0)
-                .setElementStride(sizeof(float3)*2),
+                .setFormat(quantizedVertices ? nvrhi::Format::RGBA16_UNORM : nvrhi::Format::RGB32_FLOAT)
+                .setOffset(quantizedVertices ? offsetof(Scene::QuantizedVertex, position) : 0)
+                .setElementStride(vertexStride),
             nvrhi::VertexAttributeDesc()
                 .setName("NORMAL")
-                .setFormat(nvrhi::Format::RGB32_FLOAT)
-                .setOffset(sizeof(float3))
-                .setElementStride(sizeof(float3)*2),
+                .setFormat(quantizedVertices ? nvrhi::Format::RG16_SNORM : nvrhi::Format::RGB32_FLOAT)
+                .setOffset(quantizedVertices ? offsetof(Scene::QuantizedVertex, normal) : sizeof(float3))
+                .setElementStride(vertexStride),
+            nvrhi::VertexAttributeDesc()
+                .setName("INSTANCEID")
+                .setFormat(nvrhi::Format::R32_UINT)
+                .setBufferIndex(1)
+                .setOffset(0)
+                .setElementStride(sizeof(UINT32))
+                .setIsInstanced(true),
             };
         m_InputLayout = GetDevice()->createInputLayout(attributes, uint32_t(std::size(attributes)), gbuffer_vertexShader);
 
@@ -363,7 +445,7 @@ public:
         {
             nvrhi::GraphicsPipelineDesc psoGfxDesc;
             psoGfxDesc.inputLayout = m_InputLayout;
-            psoGfxDesc.bindingLayouts = { m_BindingLayout };
+            psoGfxDesc.bindingLayouts = { m_GBufferBindingLayout };
             psoGfxDesc.VS = gbuffer_vertexShader;
             psoGfxDesc.PS = gbuffer_pixelShader;
 
@@ -375,8 +457,13 @@ public:
 
         m_AnimateObjectsPSO = GetDevice()->createComputePipeline(psoCSDesc.setComputeShader(animateObjects_computeShader));
         m_AnimateLightsPSO = GetDevice()->createComputePipeline(psoCSDesc.setComputeShader(animateLights_computeShader));
+        m_InstanceCullingPSO = GetDevice()->createComputePipeline(psoCSDesc.setComputeShader(instanceCulling_computeShader));
         m_CullLightsPSO = GetDevice()->createComputePipeline(psoCSDesc.setComputeShader(lightCulling_computeShader));
         m_ShadePSO = GetDevice()->createComputePipeline(psoCSDesc.setComputeShader(deferredShading_computeShader));
+        m_MaterialClassifyPSO = GetDevice()->createComputePipeline(psoCSDesc.setComputeShader(materialClassify_computeShader));
+        m_MaterialBuildArgumentsPSO = GetDevice()->createComputePipeline(psoCSDesc.setComputeShader(materialBuildArguments_computeShader));
+        for (uint32_t bin=0; bin<MaterialBinning_BinCount; bin++)
+            m_MaterialShadePSOs[bin] = GetDevice()->createComputePipeline(psoCSDesc.setComputeShader(materialShade_computeShaders[bin]));
 
         // Create the culled lights buffer.
         {
@@ -391,6 +478,19 @@ public:
             bufferDesc.initialState = nvrhi::ResourceStates::ShaderResource;
             bufferDesc.keepInitialState = true;
             m_CulledLightsBuffer = GetDevice()->createBuffer(bufferDesc);
+
+            // Material binning buffers: the tile list sizes followed by one list of tiles per bin, and the indirect
+            // dispatch arguments built from the list sizes.
+            bufferDesc.byteSize = (MaterialBinning_BinCount + MaterialBinning_BinCount * tileCount) * sizeof(UINT32);
+            bufferDesc.debugName = "MaterialTiles";
+            bufferDesc.initialState = nvrhi::ResourceStates::UnorderedAccess;
+            m_MaterialTilesBuffer = GetDevice()->createBuffer(bufferDesc);
+
+            bufferDesc.byteSize = MaterialBinning_BinCount * sizeof(nvrhi::DispatchIndirectArguments);
+            bufferDesc.isDrawIndirectArgs = true;
+            bufferDesc.debugName = "MaterialDispatchArguments";
+            bufferDesc.initialState = nvrhi::ResourceStates::IndirectArgument;
+            m_MaterialDispatchArgumentsBuffer = GetDevice()->createBuffer(bufferDesc);
         }
 
         // Create the constant buffer.
@@ -417,7 +517,8 @@ public:
             .addItem(nvrhi::BindingSetItem::StructuredBuffer_SRV(3, m_NullSRVBuffer))
             .addItem(nvrhi::BindingSetItem::StructuredBuffer_SRV(4, m_NullSRVBuffer))
             .addItem(nvrhi::BindingSetItem::StructuredBuffer_UAV(0, m_Scene.GetAnimStateBuffer()))
-            .addItem(nvrhi::BindingSetItem::Texture_UAV(1, m_NullUAVTexture)),
+            .addItem(nvrhi::BindingSetItem::Texture_UAV(1, m_NullUAVTexture))
+            .addItem(nvrhi::BindingSetItem::StructuredBuffer_UAV(2, m_NullUAVBuffer)),
             m_BindingLayout);
 
         m_BindingSets[(int)ScenePass::AnimateLights] = GetDevice()->createBindingSet(nvrhi::BindingSetDesc()
@@ -429,21 +530,30 @@ public:
             .addItem(nvrhi::BindingSetItem::StructuredBuffer_SRV(3, m_NullSRVBuffer))
             .addItem(nvrhi::BindingSetItem::StructuredBuffer_SRV(4, m_NullSRVBuffer))
             .addItem(nvrhi::BindingSetItem::StructuredBuffer_UAV(0, m_Scene.GetLightsBuffer()))
-            .addItem(nvrhi::BindingSetItem::Texture_UAV(1, m_NullUAVTexture)),
+            .addItem(nvrhi::BindingSetItem::Texture_UAV(1, m_NullUAVTexture))
+            .addItem(nvrhi::BindingSetItem::StructuredBuffer_UAV(2, m_NullUAVBuffer)),
             m_BindingLayout);
 
-        m_BindingSets[(int)ScenePass::GBufferFill] = GetDevice()->createBindingSet(nvrhi::BindingSetDesc()
+        m_BindingSets[(int)ScenePass::InstanceCulling] = GetDevice()->createBindingSet(nvrhi::BindingSetDesc()
             .addItem(nvrhi::BindingSetItem::PushConstants(0, sizeof(uint3)))
             .addItem(nvrhi::BindingSetItem::ConstantBuffer(1, m_ConstantBuffer))
             .addItem(nvrhi::BindingSetItem::StructuredBuffer_SRV(0, m_Scene.GetWorldObjectsBuffer()))
             .addItem(nvrhi::BindingSetItem::Texture_SRV(1, m_NullSRVTexture))
             .addItem(nvrhi::BindingSetItem::Texture_SRV(2, m_NullSRVTexture))
-            .addItem(nvrhi::BindingSetItem::StructuredBuffer_SRV(3, m_Scene.GetMaterialsBuffer()))
+            .addItem(nvrhi::BindingSetItem::StructuredBuffer_SRV(3, m_NullSRVBuffer))
             .addItem(nvrhi::BindingSetItem::StructuredBuffer_SRV(4, m_Scene.GetAnimStateBuffer()))
-            .addItem(nvrhi::BindingSetItem::StructuredBuffer_UAV(0, m_NullUAVBuffer))
-            .addItem(nvrhi::BindingSetItem::Texture_UAV(1, m_NullUAVTexture)),
+            .addItem(nvrhi::BindingSetItem::StructuredBuffer_UAV(0, m_VisibleInstancesBuffer))
+            .addItem(nvrhi::BindingSetItem::Texture_UAV(1, m_NullUAVTexture))
+            .addItem(nvrhi::BindingSetItem::StructuredBuffer_UAV(2, m_DrawArgumentsBuffer)),
             m_BindingLayout);
 
+        m_BindingSets[(int)ScenePass::GBufferFill] = GetDevice()->createBindingSet(nvrhi::BindingSetDesc()
+            .addItem(nvrhi::BindingSetItem::ConstantBuffer(1, m_ConstantBuffer))
+            .addItem(nvrhi::BindingSetItem::StructuredBuffer_SRV(0, m_Scene.GetWorldObjectsBuffer()))
+            .addItem(nvrhi::BindingSetItem::StructuredBuffer_SRV(3, m_Scene.GetMaterialsBuffer()))
+            .addItem(nvrhi::BindingSetItem::StructuredBuffer_SRV(4, m_Scene.GetAnimStateBuffer())),
+            m_GBufferBindingLayout);
+
         m_BindingSets[(int)ScenePass::LightCulling] = GetDevice()->createBindingSet(nvrhi::BindingSetDesc()
             .addItem(nvrhi::BindingSetItem::PushConstants(0, sizeof(uint3)))
             .addItem(nvrhi::BindingSetItem::ConstantBuffer(1, m_ConstantBuffer))
@@ -453,7 +563,8 @@ public:
             .addItem(nvrhi::BindingSetItem::StructuredBuffer_SRV(3, m_NullSRVBuffer))
             .addItem(nvrhi::BindingSetItem::StructuredBuffer_SRV(4, m_Scene.GetLightsBuffer()))
             .addItem(nvrhi::BindingSetItem::StructuredBuffer_UAV(0, m_CulledLightsBuffer))
-            .addItem(nvrhi::BindingSetItem::Texture_UAV(1, m_NullUAVTexture)),
+            .addItem(nvrhi::BindingSetItem::Texture_UAV(1, m_NullUAVTexture))
+            .addItem(nvrhi::BindingSetItem::StructuredBuffer_UAV(2, m_NullUAVBuffer)),
             m_BindingLayout);
 
         m_BindingSets[(int)ScenePass::DeferredShading] = GetDevice()->createBindingSet(nvrhi::BindingSetDesc()
@@ -465,7 +576,34 @@ public:
             .addItem(nvrhi::BindingSetItem::StructuredBuffer_SRV(3, m_CulledLightsBuffer))
             .addItem(nvrhi::BindingSetItem::StructuredBuffer_SRV(4, m_Scene.GetLightsBuffer()))
             .addItem(nvrhi::BindingSetItem::StructuredBuffer_UAV(0, m_NullUAVBuffer))
-            .addItem(nvrhi::BindingSetItem::Texture_UAV(1, m_RenderTargets->m_LDRBuffer)),
+            .addItem(nvrhi::BindingSetItem::Texture_UAV(1, m_RenderTargets->m_LDRBuffer))
+            .addItem(nvrhi::BindingSetItem::StructuredBuffer_UAV(2, m_NullUAVBuffer)),
+            m_BindingLayout);
+
+        m_BindingSets[(int)ScenePass::MaterialClassify] = GetDevice()->createBindingSet(nvrhi::BindingSetDesc()
+            .addItem(nvrhi::BindingSetItem::PushConstants(0, sizeof(uint3)))
+            .addItem(nvrhi::BindingSetItem::ConstantBuffer(1, m_ConstantBuffer))
+            .addItem(nvrhi::BindingSetItem::StructuredBuffer_SRV(0, m_Scene.GetMaterialsBuffer()))
+            .addItem(nvrhi::BindingSetItem::Texture_SRV(1, m_RenderTargets->m_GBuffer))
+            .addItem(nvrhi::BindingSetItem::Texture_SRV(2, m_RenderTargets->m_Depth))
+            .addItem(nvrhi::BindingSetItem::StructuredBuffer_SRV(3, m_NullSRVBuffer))
+            .addItem(nvrhi::BindingSetItem::StructuredBuffer_SRV(4, m_NullSRVBuffer))
+            .addItem(nvrhi::BindingSetItem::StructuredBuffer_UAV(0, m_MaterialTilesBuffer))
+            .addItem(nvrhi::BindingSetItem::Texture_UAV(1, m_NullUAVTexture))
+            .addItem(nvrhi::BindingSetItem::StructuredBuffer_UAV(2, m_MaterialDispatchArgumentsBuffer)),
+            m_BindingLayout);
+
+        m_BindingSets[(int)ScenePass::MaterialShading] = GetDevice()->createBindingSet(nvrhi::BindingSetDesc()
+            .addItem(nvrhi::BindingSetItem::PushConstants(0, sizeof(uint3)))
+            .addItem(nvrhi::BindingSetItem::ConstantBuffer(1, m_ConstantBuffer))
+            .addItem(nvrhi::BindingSetItem::StructuredBuffer_SRV(0, m_Scene.GetMaterialsBuffer()))
+            .addItem(nvrhi::BindingSetItem::Texture_SRV(1, m_RenderTargets->m_GBuffer))
+            .addItem(nvrhi::BindingSetItem::Texture_SRV(2, m_RenderTargets->m_Depth))
+            .addItem(nvrhi::BindingSetItem::StructuredBuffer_SRV(3, m_CulledLightsBuffer))
+            .addItem(nvrhi::BindingSetItem::StructuredBuffer_SRV(4, m_Scene.GetLightsBuffer()))
+            .addItem(nvrhi::BindingSetItem::StructuredBuffer_UAV(0, m_MaterialTilesBuffer))
+            .addItem(nvrhi::BindingSetItem::Texture_UAV(1, m_RenderTargets->m_LDRBuffer))
+            .addItem(nvrhi::BindingSetItem::StructuredBuffer_UAV(2, m_NullUAVBuffer)),
             m_BindingLayout);
 
          m_BindingSets[(int)ScenePass::WorkGraph] = GetDevice()->createBindingSet(nvrhi::BindingSetDesc()
@@ -477,7 +615,8 @@ public:
             .addItem(nvrhi::BindingSetItem::StructuredBuffer_SRV(3, m_NullSRVBuffer))
             .addItem(nvrhi::BindingSetItem::StructuredBuffer_SRV(4, m_Scene.GetLightsBuffer()))
             .addItem(nvrhi::BindingSetItem::StructuredBuffer_UAV(0, m_NullUAVBuffer))
-            .addItem(nvrhi::BindingSetItem::Texture_UAV(1, m_RenderTargets->m_LDRBuffer)),
+            .addItem(nvrhi::BindingSetItem::Texture_UAV(1, m_RenderTargets->m_LDRBuffer))
+            .addItem(nvrhi::BindingSetItem::StructuredBuffer_UAV(2, m_NullUAVBuffer)),
             m_BindingLayout);
 
         // Animation state must be reset to good values before being updated every frame.
@@ -613,13 +752,19 @@ public:
         constants.camDir = float4(normalize(camTarget-camPosition),0);
         constants.viewportSizeXY.x = (float)m_RenderTargets->m_Size.x;
         constants.viewportSizeXY.y = (float)m_RenderTargets->m_Size.y;
+        for (int meshType=0;meshType<(int)Scene::MeshType::MT_COUNT;meshType++)
+        {
+            const Scene::VertexQuantization& quantization = m_Scene.GetVertexQuantization((Scene::MeshType)meshType);
+            constants.meshPositionScale[meshType] = float4(quantization.positionScale, 0);
+            constants.meshPositionBias[meshType] = float4(quantization.positionBias, 0);
+        }
 
         m_CommandList->writeBuffer(m_ConstantBuffer, &constants, sizeof(constants));
     }
 
     void PopulateAnimationPass()
     {
-        m_CommandList->beginMarker("Animation");
+        m_Profiler.BeginGpuZone(m_CommandList, "Animation");
 
         bool resetAnim = m_ForceResetAnimation || m_UI.ResetAnim;
 
@@ -658,11 +803,45 @@ public:
             m_CommandList->dispatch((uint32_t)dispatchX, (uint32_t)dispatchY);
         }
 
-        m_CommandList->endMarker();
+        m_Profiler.EndGpuZone(m_CommandList);
 
         m_ForceResetAnimation = false; // Animation buffer initialized, no need to redo it again in subsequent frames.
     }
 
+    void PopulateInstanceCullingPass()
+    {
+        m_Profiler.BeginGpuZone(m_CommandList, "Instance Culling");
+
+        // Reset the instance counts of all draws.
+        m_CommandList->writeBuffer(m_DrawArgumentsBuffer, m_InitialDrawArguments.data(), m_InitialDrawArguments.size() * sizeof(nvrhi::DrawIndexedIndirectArguments));
+
+        nvrhi::ComputeState state;
+        state.pipeline = m_InstanceCullingPSO;
+        state.bindings = { m_BindingSets[(int)ScenePass::InstanceCulling] };
+        m_CommandList->setComputeState(state);
+
+        // LOD scale: an object with bounding radius r at distance d covers r/d * pixelsPerUnit pixels of radius,
+        // and it needs 2*r/d * pixelsPerUnit / Culling_LodPixelsPerEdge edges across. The shader divides that by the LOD 0 detail.
+        const float pixelsPerUnit = (float)m_RenderTargets->m_Size.y * 0.5f / tanf(Camera_VerticalFOV * 0.5f);
+        const float lodScale = 2.0f * pixelsPerUnit / (Culling_LodPixelsPerEdge * (float)Scene::GetLod0Detail());
+        const uint32_t flags = (m_UI.EnableFrustumCulling ? 1U : 0U) | (m_UI.EnableLod ? 2U : 0U);
+
+        uint32_t rootConstants[3] = {(uint32_t)m_Scene.GetWorldObjects().size(), 0, flags};
+        ((float*)rootConstants)[1] = lodScale;
+        m_CommandList->setPushConstants(rootConstants, sizeof(rootConstants));
+
+        // Dispatch enough thread groups to cover all scene objects.
+        {
+            const int threadsX = 32;
+            const size_t totalDispatchSize = (m_Scene.GetWorldObjects().size()+(threadsX-1)) / threadsX;
+            const size_t dispatchY = max(totalDispatchSize / D3D12_CS_DISPATCH_MAX_THREAD_GROUPS_PER_DIMENSION, size_t(1));
+            const size_t dispatchX = max(totalDispatchSize % D3D12_CS_DISPATCH_MAX_THREAD_GROUPS_PER_DIMENSION, size_t(1));
+            m_CommandList->dispatch((uint32_t)dispatchX, (uint32_t)dispatchY);
+        }
+
+        m_Profiler.EndGpuZone(m_CommandList);
+    }
+
     void PopulateGBufferPass()
     {
         // It is enough to clear the depth-buffer without the g-buffer. Depth buffer values of 1 mean "sky".
@@ -673,37 +852,23 @@ public:
         state.bindings = { m_BindingSets[(int)ScenePass::GBufferFill] };
         state.framebuffer = m_RenderTargets->m_FrameBufferGB;
         state.viewport.addViewportAndScissorRect(m_RenderTargets->m_FrameBufferGB->getFramebufferInfo().getViewport());
-        state.indexBuffer = nvrhi::IndexBufferBinding().setFormat(nvrhi::Format::R16_UINT);
-        state.vertexBuffers.push_back(nvrhi::VertexBufferBinding());
-
-        m_CommandList->beginMarker("Draw all meshes");
-
-        size_t objectIndex = 0;
-        Scene::MeshType lastMeshType = Scene::MeshType::MT_COUNT;
-        uint32_t indexCount = 0;
-        for (const Scene::Instance& object : m_Scene.GetWorldObjects())
-        {
-            if (object.meshType != lastMeshType)
-            {
-                lastMeshType = object.meshType;
-
-                indexCount = (uint32_t)(m_Scene.GetMeshIndexBuffer(object.meshType)->getDesc().byteSize / sizeof(UINT16));
-                state.indexBuffer.buffer = m_Scene.GetMeshIndexBuffer(object.meshType);
-                state.vertexBuffers.front().buffer = m_Scene.GetMeshVertexBuffer(object.meshType);
-                m_CommandList->setGraphicsState(state);
-            }
-            
-            uint32_t rootConstant[3] = { (uint32_t)objectIndex, 0, 0 };
-            m_CommandList->setPushConstants(&rootConstant,sizeof(rootConstant));
-            m_CommandList->drawIndexed(nvrhi::DrawArguments().setVertexCount(indexCount));
-            objectIndex++;
-        }
-        m_CommandList->endMarker();
+        state.indexBuffer = nvrhi::IndexBufferBinding().setBuffer(m_Scene.GetMeshIndexBuffer()).setFormat(nvrhi::Format::R16_UINT);
+        state.vertexBuffers.push_back(nvrhi::VertexBufferBinding().setSlot(0).setBuffer(m_Scene.GetMeshVertexBuffer()));
+        state.vertexBuffers.push_back(nvrhi::VertexBufferBinding().setSlot(1).setBuffer(m_VisibleInstancesBuffer));
+        state.indirectParams = m_DrawArgumentsBuffer;
+
+        m_Profiler.BeginGpuZone(m_CommandList, "Draw visible meshes");
+
+        // The instance culling pass has written the instance counts and the visible object indices of every draw.
+        // All mesh types live in the same buffers, so the draws of every mesh type and LOD are submitted together.
+        m_CommandList->setGraphicsState(state);
+        m_CommandList->drawIndexedIndirect(0, uint32_t(m_InitialDrawArguments.size()));
+        m_Profiler.EndGpuZone(m_CommandList);
     }
 
     void PopulateLightCullingPass()
     {
-        m_CommandList->beginMarker("Light Culling");
+        m_Profiler.BeginGpuZone(m_CommandList, "Light Culling");
 
         // Light culling compute shader.
         nvrhi::ComputeState state;
@@ -719,12 +884,12 @@ public:
         // Dispatch enough thread groups to cover all screen tiles.
         m_CommandList->dispatch(tilesX, tilesY);
 
-        m_CommandList->endMarker();
+        m_Profiler.EndGpuZone(m_CommandList);
     }
 
     void PopulateDeferredShadingPass()
     {
-        m_CommandList->beginMarker("Deferred Shading");
+        m_Profiler.BeginGpuZone(m_CommandList, "Deferred Shading");
 
         // Deferred shading compute shader.
         nvrhi::ComputeState state;
@@ -743,12 +908,56 @@ public:
             const int threadsY = 4;
             m_CommandList->dispatch((m_RenderTargets->m_Size.x+(threadsX-1))/threadsX, (m_RenderTargets->m_Size.y+(threadsY-1))/threadsY, 1);
         }
-        m_CommandList->endMarker();
+        m_Profiler.EndGpuZone(m_CommandList);
     }
     
+    void PopulateMaterialBinningPass()
+    {
+        m_Profiler.BeginGpuZone(m_CommandList, "Material Binning");
+
+        const uint32_t tilesX = GetLightTileCountX(m_RenderTargets->m_Size.x);
+        const uint32_t tilesY = GetLightTileCountY(m_RenderTargets->m_Size.y);
+        const uint32_t rootConstants[3] = {tilesX, tilesY, (uint32_t)m_Scene.GetLights().size()};
+
+        // Reset the tile list sizes.
+        const uint32_t emptyListSizes[MaterialBinning_BinCount] = {};
+        m_CommandList->writeBuffer(m_MaterialTilesBuffer, emptyListSizes, sizeof(emptyListSizes));
+
+        // Classify the tiles by the material types they contain, one thread per tile.
+        nvrhi::ComputeState state;
+        state.pipeline = m_MaterialClassifyPSO;
+        state.bindings = { m_BindingSets[(int)ScenePass::MaterialClassify] };
+        m_CommandList->setComputeState(state);
+        m_CommandList->setPushConstants(rootConstants, sizeof(rootConstants));
+        {
+            const int threadsX = 8;
+            const int threadsY = 8;
+            m_CommandList->dispatch((tilesX+(threadsX-1))/threadsX, (tilesY+(threadsY-1))/threadsY, 1);
+        }
+
+        // Convert the list sizes into dispatch arguments.
+        state.pipeline = m_MaterialBuildArgumentsPSO;
+        m_CommandList->setComputeState(state);
+        m_CommandList->setPushConstants(rootConstants, sizeof(rootConstants));
+        m_CommandList->dispatch(1);
+
+        // Shade each bin with a shader that evaluates only its material type.
+        state.bindings = { m_BindingSets[(int)ScenePass::MaterialShading] };
+        state.indirectParams = m_MaterialDispatchArgumentsBuffer;
+        for (uint32_t bin=0; bin<MaterialBinning_BinCount; bin++)
+        {
+            state.pipeline = m_MaterialShadePSOs[bin];
+            m_CommandList->setComputeState(state);
+            m_CommandList->setPushConstants(rootConstants, sizeof(rootConstants));
+            m_CommandList->dispatchIndirect(bin * sizeof(nvrhi::DispatchIndirectArguments));
+        }
+
+        m_Profiler.EndGpuZone(m_CommandList);
+    }
+
     void PopulateDeferredShadingWorkGraph()
     {
-        m_CommandList->beginMarker("Deferred Shading Work Graph");
+        m_Profiler.BeginGpuZone(m_CommandList, "Deferred Shading Work Graph");
 
         // Work graph resource bindings. These are regular bindings applied on the compute state.
         nvrhi::ComputeState state;
@@ -787,7 +996,7 @@ public:
 
         m_InitWorkGraphBackingMemory = false; // Memory initialized, no need to redo it again in subsequent frames.
 
-        m_CommandList->endMarker();
+        m_Profiler.EndGpuZone(m_CommandList);
     }
 
     void BackBufferResizing() override
@@ -815,8 +1024,8 @@ public:
         }
 
         // Update UI info.
-        m_UI.GPUFrameTime = GetLastValidQueryTimer(m_FrameTimers);
-        m_UI.GPUShadingTime = GetLastValidQueryTimer(m_ShadingTimers);
+        m_UI.GPUFrameTime = m_Profiler.GetGpuTimeMs("Frame");
+        m_UI.GPUShadingTime = m_Profiler.GetGpuTimeMs("Shading");
 
         GetDeviceManager()->SetInformativeWindowTitle(g_WindowTitle);
     }
@@ -835,14 +1044,14 @@ public:
             LoadWorkGraphPipelines(m_RenderTargets->m_FrameBufferGB->getFramebufferInfo());
         }
 
-        // Reset GPU timers.
-        GetDevice()->resetTimerQuery(m_FrameTimers[m_NextTimerToUse]);
-        GetDevice()->resetTimerQuery(m_ShadingTimers[m_NextTimerToUse]);
+        // Read back the GPU timings of earlier frames.
+        m_Profiler.BeginFrame();
+        ScopedCpuZone renderZone(m_Profiler, "Render");
 
         // Begin recording the command list for this frame.
         m_CommandList->open();
 
-        m_CommandList->beginTimerQuery(m_FrameTimers[m_NextTimerToUse]);
+        m_Profiler.BeginGpuZone(m_CommandList, "Frame");
 
         // Update scene constants used by all the passes to follow in this frame.
         UpdateSceneConstants();
@@ -850,42 +1059,46 @@ public:
         // Animation compute passes.
         PopulateAnimationPass();
 
+        // Frustum culling and LOD selection pass, produces the indirect draws for the g-buffer.
+        PopulateInstanceCullingPass();
+
         // G-buffer fill pass.
         PopulateGBufferPass();
 
-        if (m_CurrentTechnique == Techniques::Dispatch)
+        if (m_CurrentTechnique == Techniques::Dispatch || m_CurrentTechnique == Techniques::DispatchMaterialBinning)
         {
-            m_CommandList->beginTimerQuery(m_ShadingTimers[m_NextTimerToUse]);
+            m_Profiler.BeginGpuZone(m_CommandList, "Shading");
 
             // Light culling pass.
             PopulateLightCullingPass();
 
-            // Deferred shading pass.
-            PopulateDeferredShadingPass();
+            // Deferred shading pass, either with the uber shader or with one shader per material type.
+            if (m_CurrentTechnique == Techniques::DispatchMaterialBinning)
+                PopulateMaterialBinningPass();
+            else
+                PopulateDeferredShadingPass();
 
-            m_CommandList->endTimerQuery(m_ShadingTimers[m_NextTimerToUse]);
+            m_Profiler.EndGpuZone(m_CommandList);
         }
 
         if (m_CurrentTechnique == Techniques::WorkGraphBroadcastingLaunch)
         {
-            m_CommandList->beginTimerQuery(m_ShadingTimers[m_NextTimerToUse]);
+            m_Profiler.BeginGpuZone(m_CommandList, "Shading");
 
             // Deferred shading work graph pass.
             PopulateDeferredShadingWorkGraph();
 
-            m_CommandList->endTimerQuery(m_ShadingTimers[m_NextTimerToUse]);
+            m_Profiler.EndGpuZone(m_CommandList);
         }
 
         // Copy the final shaded results from the LDR buffer to the back buffer for display.
         m_CommandList->copyTexture(framebuffer->getDesc().colorAttachments[0].texture, nvrhi::TextureSlice(), m_RenderTargets->m_LDRBuffer, nvrhi::TextureSlice());
 
-        m_CommandList->endTimerQuery(m_FrameTimers[m_NextTimerToUse]);
+        m_Profiler.EndGpuZone(m_CommandList);
 
         // Done with this frame.
         m_CommandList->close();
         GetDevice()->executeCommandList(m_CommandList);
-
-        m_NextTimerToUse = (m_NextTimerToUse+1) % QueuedFramesCount;
     }
 };
 
@@ -896,9 +1109,10 @@ private:
 	std::shared_ptr<ShaderFactory> m_ShaderFactory;
 
 	UIData& m_UI;
+	FrameProfiler& m_Profiler;
 
 public:
-    UIRenderer(DeviceManager* deviceManager, UIData& ui) : ImGui_Renderer(deviceManager), m_UI(ui) {}
+    UIRenderer(DeviceManager* deviceManager, UIData& ui, FrameProfiler& profiler) : ImGui_Renderer(deviceManager), m_UI(ui), m_Profiler(profiler) {}
 
     bool Init()
     {
@@ -921,7 +1135,8 @@ protected:
         const char *techniqueNames[] =
         {
             "Work Graph (Broadcast Launch)",
-            "Compute Dispatches"
+            "Compute Dispatches",
+            "Compute Dispatches (Material Binning)"
         };
 
         ImGui::SetNextWindowPos(ImVec2(10.f, 10.f), 0);
@@ -929,9 +1144,18 @@ protected:
         ImGui::Combo("Current Technique", &m_UI.CurrentTechnique, techniqueNames, sizeof(techniqueNames)/sizeof(techniqueNames[0]));
         ImGui::Checkbox("Pause Animation", &m_UI.Paused);
         m_UI.ResetAnim = ImGui::Button("Reset Animation");
+        ImGui::Checkbox("Frustum Culling", &m_UI.EnableFrustumCulling);
+        ImGui::Checkbox("Mesh LOD", &m_UI.EnableLod);
         ImGui::Text("Frame Time (GPU): %.3f ms", m_UI.GPUFrameTime);
         ImGui::Text("Shading Time (GPU): %.3f ms", m_UI.GPUShadingTime);
+        ImGui::Checkbox("Show Profiler", &m_UI.ShowProfiler);
         ImGui::End();
+
+        if (m_UI.ShowProfiler)
+        {
+            ImGui::SetNextWindowPos(ImVec2(10.f, 250.f), ImGuiCond_FirstUseEver);
+            m_Profiler.BuildUI();
+        }
     }
 };
 
@@ -953,6 +1177,14 @@ int main(int __argc, const char** __argv)
         return -1;
     }
 
+    for (int i = 1; i < __argc; i++)
+    {
+        if (!strcmp(__argv[i], "-scene-cache"))
+            g_UseSceneCache = true;
+        else if (!strcmp(__argv[i], "-quantize-vertices"))
+            g_QuantizeVertices = true;
+    }
+
     app::DeviceManager* deviceManager = app::DeviceManager::Create(api);
 
     app::DeviceCreationParameters deviceParams;
@@ -972,7 +1204,7 @@ int main(int __argc, const char** __argv)
     {
         UIData uiData;
         WorkGraphs example(deviceManager, uiData);
-        UIRenderer ui(deviceManager, uiData);
+        UIRenderer ui(deviceManager, uiData, example.GetProfiler());
         if (example.Init() && ui.Init())
         {
             deviceManager->AddRenderPassToBack(&example);
@@ -0,0 +1,184 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+#include "AsyncReadback.h"
+
+#include <algorithm>
+
+AsyncReadback::AsyncReadback(nvrhi::IDevice* device, uint32_t maxRequests)
+    : m_Device(device)
+    , m_Slots(maxRequests)
+{
+    for (Slot& slot : m_Slots)
+        slot.query = m_Device->createEventQuery();
+}
+
+AsyncReadback::Slot* AsyncReadback::AllocateSlot()
+{
+    for (Slot& slot : m_Slots)
+    {
+        if (slot.state == SlotState::Free)
+            return &slot;
+    }
+
+    return nullptr;
+}
+
+bool AsyncReadback::ReadBuffer(nvrhi::ICommandList* commandList, nvrhi::IBuffer* buffer, uint64_t offset, uint64_t size, BufferCallback callback)
+{
+    Slot* slot = AllocateSlot();
+    if (!slot)
+        return false;
+
+    // Staging buffers are kept per slot, and only grow
+    if (!slot->stagingBuffer || slot->stagingBuffer->getDesc().byteSize < size)
+    {
+        nvrhi::BufferDesc bufferDesc;
+        bufferDesc.byteSize = size;
+        bufferDesc.cpuAccess = nvrhi::CpuAccessMode::Read;
+        bufferDesc.initialState = nvrhi::ResourceStates::CopyDest;
+        bufferDesc.keepInitialState = true;
+        bufferDesc.debugName = "AsyncReadback";
+        slot->stagingBuffer = m_Device->createBuffer(bufferDesc);
+    }
+
+    commandList->copyBuffer(slot->stagingBuffer, 0, buffer, offset, size);
+
+    slot->bufferCallback = std::move(callback);
+    slot->callback = nullptr;
+    slot->size = size;
+    slot->state = SlotState::Recorded;
+    return true;
+}
+
+bool AsyncReadback::Notify(Callback callback)
+{
+    Slot* slot = AllocateSlot();
+    if (!slot)
+        return false;
+
+    slot->bufferCallback = nullptr;
+    slot->callback = std::move(callback);
+    slot->size = 0;
+    slot->state = SlotState::Recorded;
+    return true;
+}
+
+void AsyncReadback::Submit(nvrhi::CommandQueue queue)
+{
+    bool anyRecorded = false;
+    for (Slot& slot : m_Slots)
+    {
+        if (slot.state != SlotState::Recorded)
+            continue;
+
+        m_Device->resetEventQuery(slot.query);
+        m_Device->setEventQuery(slot.query, queue);
+        slot.submission = m_SubmissionCount;
+        slot.state = SlotState::Submitted;
+        anyRecorded = true;
+    }
+
+    if (anyRecorded)
+        ++m_SubmissionCount;
+}
+
+void AsyncReadback::GetSubmittedSlots(std::vector<Slot*>& outSlots)
+{
+    outSlots.clear();
+    for (Slot& slot : m_Slots)
+    {
+        if (slot.state == SlotState::Submitted)
+            outSlots.push_back(&slot);
+    }
+
+    std::stable_sort(outSlots.begin(), outSlots.end(), [](const Slot* a, const Slot* b) { return a->submission < b->submission; });
+}
+
+void AsyncReadback::Complete(Slot& slot)
+{
+    // Release the slot before running the callback, so that the callback can make a new request.
+    // A new request may reuse the slot with a different staging buffer and size, so the completed ones are kept here.
+    BufferCallback bufferCallback = std::move(slot.bufferCallback);
+    Callback callback = std::move(slot.callback);
+    nvrhi::BufferHandle stagingBuffer = slot.stagingBuffer;
+    const size_t size = size_t(slot.size);
+    slot.bufferCallback = nullptr;
+    slot.callback = nullptr;
+    slot.state = SlotState::Free;
+
+    if (bufferCallback)
+    {
+        const void* data = m_Device->mapBuffer(stagingBuffer, nvrhi::CpuAccessMode::Read);
+        if (data)
+        {
+            bufferCallback(data, size);
+            m_Device->unmapBuffer(stagingBuffer);
+        }
+    }
+    else if (callback)
+    {
+        callback();
+    }
+}
+
+void AsyncReadback::Poll()
+{
+    std::vector<Slot*> slots;
+    GetSubmittedSlots(slots);
+
+    // The queries of one queue complete in order, so stop at the first one that hasn't
+    for (Slot* slot : slots)
+    {
+        if (!m_Device->pollEventQuery(slot->query))
+            break;
+
+        Complete(*slot);
+    }
+}
+
+void AsyncReadback::Flush()
+{
+    std::vector<Slot*> slots;
+    GetSubmittedSlots(slots);
+
+    for (Slot* slot : slots)
+    {
+        m_Device->waitEventQuery(slot->query);
+        Complete(*slot);
+    }
+}
+
+void AsyncReadback::Cancel()
+{
+    for (Slot& slot : m_Slots)
+    {
+        slot.bufferCallback = nullptr;
+        slot.callback = nullptr;
+        slot.state = SlotState::Free;
+    }
+}
+
+uint32_t AsyncReadback::GetPendingCount() const
+{
+    return uint32_t(std::count_if(m_Slots.begin(), m_Slots.end(), [](const Slot& slot) { return slot.state != SlotState::Free; }));
+}
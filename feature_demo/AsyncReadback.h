@@ -0,0 +1,90 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <nvrhi/nvrhi.h>
+
+#include <functional>
+#include <vector>
+
+// Returns the results of GPU work to the CPU without stalling the frame.
+// Requests are recorded into a command list and become pending when Submit is called after that command list has been
+// executed. Poll runs the callbacks of the requests that the GPU has finished, usually a few frames after the request.
+// The number of requests in flight is limited; when all slots are busy, a request is rejected and may be retried later.
+class AsyncReadback
+{
+public:
+    // 'data' is only valid during the callback
+    using BufferCallback = std::function<void(const void* data, size_t size)>;
+    using Callback = std::function<void()>;
+
+    AsyncReadback(nvrhi::IDevice* device, uint32_t maxRequests);
+
+    // Copies a range of 'buffer' into a staging buffer, and passes the staging buffer contents to 'callback'
+    bool ReadBuffer(nvrhi::ICommandList* commandList, nvrhi::IBuffer* buffer, uint64_t offset, uint64_t size, BufferCallback callback);
+
+    // Runs 'callback' when the GPU has finished all work submitted before the next Submit. Used for resources that
+    // have their own CPU-readable copy, such as the staging texture of a PixelReadbackPass.
+    bool Notify(Callback callback);
+
+    // Call after executing the command lists with the requests made since the previous Submit on 'queue'
+    void Submit(nvrhi::CommandQueue queue = nvrhi::CommandQueue::Graphics);
+
+    // Runs the callbacks of the completed requests, in the order of submission
+    void Poll();
+
+    // Blocks until all submitted requests have completed, and runs their callbacks
+    void Flush();
+
+    // Drops all requests without running their callbacks, for when the objects that the callbacks refer to go away
+    void Cancel();
+
+    [[nodiscard]] uint32_t GetPendingCount() const;
+
+private:
+    enum class SlotState
+    {
+        Free,
+        Recorded,
+        Submitted
+    };
+
+    struct Slot
+    {
+        nvrhi::BufferHandle stagingBuffer;
+        nvrhi::EventQueryHandle query;
+        BufferCallback bufferCallback;
+        Callback callback;
+        uint64_t size = 0;
+        uint64_t submission = 0;
+        SlotState state = SlotState::Free;
+    };
+
+    nvrhi::DeviceHandle m_Device;
+    std::vector<Slot> m_Slots;
+    uint64_t m_SubmissionCount = 0;
+
+    Slot* AllocateSlot();
+    void Complete(Slot& slot);
+    void GetSubmittedSlots(std::vector<Slot*>& outSlots);
+};
@@ -0,0 +1,428 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+#include "Benchmark.h"
+
+#include <donut/core/json.h>
+#include <donut/core/log.h>
+#include <donut/core/vfs/VFS.h>
+#include <json/value.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cctype>
+
+using namespace donut;
+using namespace donut::math;
+
+bool CameraPath::Load(vfs::IFileSystem& fs, const std::filesystem::path& fileName)
+{
+    Json::Value root;
+    if (!json::LoadFromFile(fs, fileName, root))
+        return false;
+
+    const Json::Value& keyframes = root["keyframes"];
+    if (!keyframes.isArray())
+    {
+        log::error("Camera path file '%s' doesn't contain a 'keyframes' array", fileName.generic_string().c_str());
+        return false;
+    }
+
+    m_Keyframes.clear();
+    for (const Json::Value& node : keyframes)
+    {
+        CameraPathKeyframe keyframe;
+        keyframe.time = node["time"].asFloat();
+        keyframe.position = json::Read<float3>(node["position"], keyframe.position);
+        keyframe.direction = normalize(json::Read<float3>(node["direction"], keyframe.direction));
+        keyframe.up = normalize(json::Read<float3>(node["up"], keyframe.up));
+        m_Keyframes.push_back(keyframe);
+    }
+
+    std::stable_sort(m_Keyframes.begin(), m_Keyframes.end(),
+        [](const CameraPathKeyframe& a, const CameraPathKeyframe& b) { return a.time < b.time; });
+
+    return !m_Keyframes.empty();
+}
+
+bool CameraPath::Save(const std::filesystem::path& fileName) const
+{
+    FILE* file = fopen(fileName.generic_string().c_str(), "w");
+    if (!file)
+    {
+        log::error("Cannot open file '%s' for writing", fileName.generic_string().c_str());
+        return false;
+    }
+
+    fprintf(file, "{\n\t\"keyframes\": [\n");
+    for (size_t i = 0; i < m_Keyframes.size(); i++)
+    {
+        const CameraPathKeyframe& k = m_Keyframes[i];
+        fprintf(file, "\t\t{ \"time\": %.4f, \"position\": [%.4f, %.4f, %.4f], \"direction\": [%.5f, %.5f, %.5f], \"up\": [%.5f, %.5f, %.5f] }%s\n",
+            k.time,
+            k.position.x, k.position.y, k.position.z,
+            k.direction.x, k.direction.y, k.direction.z,
+            k.up.x, k.up.y, k.up.z,
+            (i + 1 < m_Keyframes.size()) ? "," : "");
+    }
+    fprintf(file, "\t]\n}\n");
+    fclose(file);
+
+    return true;
+}
+
+void CameraPath::AddKeyframe(const CameraPathKeyframe& keyframe)
+{
+    assert(m_Keyframes.empty() || m_Keyframes.back().time <= keyframe.time);
+    m_Keyframes.push_back(keyframe);
+}
+
+CameraPathKeyframe CameraPath::Evaluate(float time) const
+{
+    if (m_Keyframes.empty())
+        return CameraPathKeyframe();
+
+    if (time <= m_Keyframes.front().time)
+        return m_Keyframes.front();
+
+    if (time >= m_Keyframes.back().time)
+        return m_Keyframes.back();
+
+    auto next = std::upper_bound(m_Keyframes.begin(), m_Keyframes.end(), time,
+        [](float t, const CameraPathKeyframe& k) { return t < k.time; });
+    auto prev = next - 1;
+
+    float span = next->time - prev->time;
+    float u = span > 0.f ? (time - prev->time) / span : 0.f;
+
+    CameraPathKeyframe result;
+    result.time = time;
+    result.position = prev->position + (next->position - prev->position) * u;
+    result.direction = normalize(prev->direction + (next->direction - prev->direction) * u);
+    result.up = normalize(prev->up + (next->up - prev->up) * u);
+    return result;
+}
+
+float CameraPath::GetDuration() const
+{
+    if (m_Keyframes.empty())
+        return 0.f;
+
+    return m_Keyframes.back().time - m_Keyframes.front().time;
+}
+
+const char* GetGpuPassName(GpuPass pass)
+{
+    switch (pass)
+    {
+    case GpuPass::ShadowMap:          return "ShadowMap";
+    case GpuPass::GBufferFill:        return "GBufferFill";
+    case GpuPass::Ssao:               return "SSAO";
+    case GpuPass::DeferredLighting:   return "DeferredLighting";
+    case GpuPass::ForwardOpaque:      return "ForwardOpaque";
+    case GpuPass::ForwardTransparent: return "ForwardTransparent";
+    case GpuPass::TemporalAA:         return "TemporalAA";
+    case GpuPass::Bloom:              return "Bloom";
+    case GpuPass::ToneMapping:        return "ToneMapping";
+    case GpuPass::Exposure:           return "Exposure";
+    case GpuPass::Frame:              return "Frame";
+    default:                          return "Unknown";
+    }
+}
+
+GpuPassTimers::GpuPassTimers(nvrhi::IDevice* device)
+    : m_Device(device)
+{
+    for (FrameSlot& slot : m_Slots)
+    {
+        for (auto& passQueries : slot.queries)
+        {
+            for (auto& query : passQueries)
+                query = m_Device->createTimerQuery();
+        }
+    }
+}
+
+void GpuPassTimers::ResolveSlot(FrameSlot& slot, FrameTimings& outTimings)
+{
+    for (size_t pass = 0; pass < size_t(GpuPass::COUNT); pass++)
+    {
+        for (uint32_t section = 0; section < MaxPassSections; section++)
+        {
+            if (!slot.used[pass][section])
+                continue;
+
+            // getTimerQueryTime waits for the query if it's not resolved yet, which only happens
+            // when the GPU is more than QueuedFramesCount frames behind.
+            float& time = slot.timings.gpuPassTimesMs[pass];
+            time = std::max(time, 0.f) + m_Device->getTimerQueryTime(slot.queries[pass][section]) * 1000.f;
+            m_Device->resetTimerQuery(slot.queries[pass][section]);
+
+            slot.used[pass][section] = false;
+        }
+    }
+
+    outTimings = slot.timings;
+    slot.pending = false;
+}
+
+bool GpuPassTimers::BeginFrame(uint64_t frameIndex, FrameTimings& outTimings)
+{
+    assert(!m_FrameActive);
+
+    m_CurrentSlot = (m_CurrentSlot + 1) % QueuedFramesCount;
+    FrameSlot& slot = m_Slots[m_CurrentSlot];
+
+    bool resolved = false;
+    if (slot.pending)
+    {
+        ResolveSlot(slot, outTimings);
+        resolved = true;
+    }
+
+    slot.timings = FrameTimings();
+    slot.timings.frameIndex = frameIndex;
+    m_FrameActive = true;
+
+    return resolved;
+}
+
+void GpuPassTimers::EndFrame(float cpuFrameTimeMs, float cpuRenderTimeMs)
+{
+    if (!m_FrameActive)
+        return;
+
+    FrameSlot& slot = m_Slots[m_CurrentSlot];
+    slot.timings.cpuFrameTimeMs = cpuFrameTimeMs;
+    slot.timings.cpuRenderTimeMs = cpuRenderTimeMs;
+    slot.pending = true;
+    m_FrameActive = false;
+}
+
+void GpuPassTimers::BeginPass(nvrhi::ICommandList* commandList, GpuPass pass, uint32_t section)
+{
+    if (!m_FrameActive)
+        return;
+
+    assert(section < MaxPassSections);
+
+    FrameSlot& slot = m_Slots[m_CurrentSlot];
+    assert(!slot.used[size_t(pass)][section]); // Every section of a pass may be measured once per frame
+
+    commandList->beginTimerQuery(slot.queries[size_t(pass)][section]);
+    slot.used[size_t(pass)][section] = true;
+}
+
+void GpuPassTimers::EndPass(nvrhi::ICommandList* commandList, GpuPass pass, uint32_t section)
+{
+    if (!m_FrameActive)
+        return;
+
+    assert(section < MaxPassSections);
+
+    FrameSlot& slot = m_Slots[m_CurrentSlot];
+    if (slot.used[size_t(pass)][section])
+        commandList->endTimerQuery(slot.queries[size_t(pass)][section]);
+}
+
+void GpuPassTimers::Flush(std::vector<FrameTimings>& outTimings)
+{
+    assert(!m_FrameActive);
+
+    // Walk the ring starting from the slot after the current one, which holds the oldest frame
+    for (uint32_t i = 1; i <= QueuedFramesCount; i++)
+    {
+        FrameSlot& slot = m_Slots[(m_CurrentSlot + i) % QueuedFramesCount];
+        if (slot.pending)
+        {
+            FrameTimings timings;
+            ResolveSlot(slot, timings);
+            outTimings.push_back(timings);
+        }
+    }
+}
+
+template<typename F>
+BenchmarkReport::Statistics BenchmarkReport::ComputeStatistics(F getValue) const
+{
+    std::vector<float> values;
+    values.reserve(m_Frames.size());
+    for (const FrameTimings& frame : m_Frames)
+    {
+        float value = getValue(frame);
+        if (value >= 0.f)
+            values.push_back(value);
+    }
+
+    Statistics stats;
+    stats.samples = values.size();
+    if (values.empty())
+        return stats;
+
+    std::sort(values.begin(), values.end());
+
+    double sum = 0.0;
+    for (float value : values)
+        sum += value;
+
+    stats.average = float(sum / double(values.size()));
+    stats.minimum = values.front();
+    stats.maximum = values.back();
+    stats.median = values[values.size() / 2];
+    stats.percentile95 = values[std::min(values.size() - 1, (values.size() * 95) / 100)];
+    return stats;
+}
+
+bool BenchmarkReport::WriteCsv(FILE* file) const
+{
+    fprintf(file, "frame,cpu_frame_ms,cpu_render_ms");
+    for (uint32_t pass = 0; pass < uint32_t(GpuPass::COUNT); pass++)
+        fprintf(file, ",gpu_%s_ms", GetGpuPassName(GpuPass(pass)));
+    fprintf(file, "\n");
+
+    for (const FrameTimings& frame : m_Frames)
+    {
+        fprintf(file, "%llu,%.4f,%.4f", (unsigned long long)frame.frameIndex, frame.cpuFrameTimeMs, frame.cpuRenderTimeMs);
+        for (float time : frame.gpuPassTimesMs)
+        {
+            // Passes that didn't run are left empty so that spreadsheets don't average them in
+            if (time >= 0.f)
+                fprintf(file, ",%.4f", time);
+            else
+                fprintf(file, ",");
+        }
+        fprintf(file, "\n");
+    }
+
+    return true;
+}
+
+// Escapes the quotes, backslashes and control characters of a string for a JSON string literal
+static std::string EscapeJson(const std::string& text)
+{
+    std::string result;
+    result.reserve(text.size());
+    for (char c : text)
+    {
+        if (c == '"' || c == '\\')
+        {
+            result += '\\';
+            result += c;
+        }
+        else if (uint8_t(c) < 0x20)
+        {
+            char code[8];
+            snprintf(code, std::size(code), "\\u%04x", uint32_t(uint8_t(c)));
+            result += code;
+        }
+        else
+            result += c;
+    }
+    return result;
+}
+
+bool BenchmarkReport::WriteJson(FILE* file, const std::string& sceneName, const std::string& rendererName) const
+{
+    auto writeStatistics = [file](const char* name, const Statistics& stats, bool last)
+    {
+        fprintf(file, "\t\t\"%s\": { \"avg\": %.4f, \"min\": %.4f, \"max\": %.4f, \"median\": %.4f, \"p95\": %.4f, \"samples\": %zu }%s\n",
+            name, stats.average, stats.minimum, stats.maximum, stats.median, stats.percentile95, stats.samples, last ? "" : ",");
+    };
+
+    fprintf(file, "{\n");
+    fprintf(file, "\t\"scene\": \"%s\",\n", EscapeJson(sceneName).c_str());
+    fprintf(file, "\t\"renderer\": \"%s\",\n", EscapeJson(rendererName).c_str());
+    fprintf(file, "\t\"frameCount\": %zu,\n", m_Frames.size());
+    fprintf(file, "\t\"summary\": {\n");
+
+    writeStatistics("cpu_frame_ms", ComputeStatistics([](const FrameTimings& f) { return f.cpuFrameTimeMs; }), false);
+    writeStatistics("cpu_render_ms", ComputeStatistics([](const FrameTimings& f) { return f.cpuRenderTimeMs; }), false);
+    for (uint32_t pass = 0; pass < uint32_t(GpuPass::COUNT); pass++)
+    {
+        std::string name = std::string("gpu_") + GetGpuPassName(GpuPass(pass)) + "_ms";
+        writeStatistics(name.c_str(), ComputeStatistics([pass](const FrameTimings& f) { return f.gpuPassTimesMs[pass]; }),
+            pass + 1 == uint32_t(GpuPass::COUNT));
+    }
+    fprintf(file, "\t},\n");
+
+    fprintf(file, "\t\"frames\": [\n");
+    for (size_t i = 0; i < m_Frames.size(); i++)
+    {
+        const FrameTimings& frame = m_Frames[i];
+        fprintf(file, "\t\t{ \"frame\": %llu, \"cpu_frame_ms\": %.4f, \"cpu_render_ms\": %.4f",
+            (unsigned long long)frame.frameIndex, frame.cpuFrameTimeMs, frame.cpuRenderTimeMs);
+        for (uint32_t pass = 0; pass < uint32_t(GpuPass::COUNT); pass++)
+        {
+            if (frame.gpuPassTimesMs[pass] >= 0.f)
+                fprintf(file, ", \"gpu_%s_ms\": %.4f", GetGpuPassName(GpuPass(pass)), frame.gpuPassTimesMs[pass]);
+        }
+        fprintf(file, " }%s\n", (i + 1 < m_Frames.size()) ? "," : "");
+    }
+    fprintf(file, "\t]\n}\n");
+
+    return true;
+}
+
+bool BenchmarkReport::Write(const std::filesystem::path& fileName, const std::string& sceneName, const std::string& rendererName) const
+{
+    FILE* file = fopen(fileName.generic_string().c_str(), "w");
+    if (!file)
+    {
+        log::error("Cannot open file '%s' for writing", fileName.generic_string().c_str());
+        return false;
+    }
+
+    std::string extension = fileName.extension().generic_string();
+    std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return char(std::tolower(c)); });
+
+    bool result = (extension == ".json")
+        ? WriteJson(file, sceneName, rendererName)
+        : WriteCsv(file);
+
+    fclose(file);
+
+    if (result)
+        log::info("Benchmark results written to '%s'", fileName.generic_string().c_str());
+
+    return result;
+}
+
+void BenchmarkReport::LogSummary() const
+{
+    log::info("Benchmark: %zu frames measured", m_Frames.size());
+
+    auto logStatistics = [](const char* name, const Statistics& stats)
+    {
+        if (stats.samples == 0)
+            return;
+
+        log::info("  %-20s avg %8.3f ms, median %8.3f ms, p95 %8.3f ms, min %8.3f ms, max %8.3f ms",
+            name, stats.average, stats.median, stats.percentile95, stats.minimum, stats.maximum);
+    };
+
+    logStatistics("CPU Frame", ComputeStatistics([](const FrameTimings& f) { return f.cpuFrameTimeMs; }));
+    logStatistics("CPU Render", ComputeStatistics([](const FrameTimings& f) { return f.cpuRenderTimeMs; }));
+    for (uint32_t pass = 0; pass < uint32_t(GpuPass::COUNT); pass++)
+    {
+        logStatistics(GetGpuPassName(GpuPass(pass)), ComputeStatistics([pass](const FrameTimings& f) { return f.gpuPassTimesMs[pass]; }));
+    }
+}
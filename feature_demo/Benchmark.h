@@ -0,0 +1,178 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <donut/core/math/math.h>
+#include <nvrhi/nvrhi.h>
+
+#include <array>
+#include <cstdio>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace donut::vfs
+{
+    class IFileSystem;
+}
+
+// Settings for the benchmark mode, filled from the command line.
+struct BenchmarkParameters
+{
+    bool enabled = false;
+    std::string cameraPathFile;         // Camera path to replay, optional - the scene's default camera is used if empty
+    std::string recordCameraPathFile;   // If not empty, the camera movement of an interactive session is saved into this file
+    std::string outputFile;             // Results file, the format is chosen by extension: .json or .csv
+    uint32_t warmupFrames = 60;
+    uint32_t measuredFrames = 0;        // 0 means "the duration of the camera path", or 600 frames if there is no path
+    float frameRate = 60.f;             // Fixed simulation rate used to advance the camera path and animations
+};
+
+struct CameraPathKeyframe
+{
+    float time = 0.f;
+    dm::float3 position = 0.f;
+    dm::float3 direction = dm::float3(0.f, 0.f, 1.f);
+    dm::float3 up = dm::float3(0.f, 1.f, 0.f);
+};
+
+// A list of camera keyframes that is linearly interpolated in time.
+// The file format is JSON: { "keyframes": [ { "time": 0.0, "position": [x, y, z], "direction": [x, y, z], "up": [x, y, z] }, ... ] }
+class CameraPath
+{
+public:
+    bool Load(donut::vfs::IFileSystem& fs, const std::filesystem::path& fileName);
+    bool Save(const std::filesystem::path& fileName) const;
+
+    void AddKeyframe(const CameraPathKeyframe& keyframe);
+    void Clear() { m_Keyframes.clear(); }
+
+    [[nodiscard]] CameraPathKeyframe Evaluate(float time) const;
+    [[nodiscard]] float GetDuration() const;
+    [[nodiscard]] bool IsEmpty() const { return m_Keyframes.empty(); }
+
+private:
+    std::vector<CameraPathKeyframe> m_Keyframes;
+};
+
+enum class GpuPass : uint32_t
+{
+    ShadowMap,
+    GBufferFill,
+    Ssao,
+    DeferredLighting,
+    ForwardOpaque,
+    ForwardTransparent,
+    TemporalAA,
+    Bloom,
+    ToneMapping,
+    Exposure,
+    Frame,
+
+    COUNT
+};
+
+const char* GetGpuPassName(GpuPass pass);
+
+struct FrameTimings
+{
+    uint64_t frameIndex = 0;
+    float cpuFrameTimeMs = 0.f;
+    float cpuRenderTimeMs = 0.f;
+
+    // Negative values mean the pass didn't run in this frame
+    std::array<float, size_t(GpuPass::COUNT)> gpuPassTimesMs;
+
+    FrameTimings() { gpuPassTimesMs.fill(-1.f); }
+};
+
+// A ring of timer queries, one set per frame in flight.
+// The results of a frame are read back when its slot in the ring is reused, so the readback never stalls the GPU.
+class GpuPassTimers
+{
+public:
+    static constexpr uint32_t QueuedFramesCount = 8;
+    static constexpr uint32_t MaxPassSections = 8;
+
+    explicit GpuPassTimers(nvrhi::IDevice* device);
+
+    // Starts recording a new frame. If the ring slot for this frame still holds the results of an older frame,
+    // those results are written into 'outTimings' and the function returns true.
+    bool BeginFrame(uint64_t frameIndex, FrameTimings& outTimings);
+    void EndFrame(float cpuFrameTimeMs, float cpuRenderTimeMs);
+
+    // These are no-ops when called outside of BeginFrame/EndFrame.
+    // A pass that is recorded into several command lists is measured in sections, one per list, which begin and end
+    // in the same list; the reported time of the pass is the sum of its sections. Only GpuPass::Frame spans lists,
+    // its query brackets all the lists of a frame that are executed back to back on the graphics queue.
+    // Different passes and different sections of a pass may be recorded from different threads.
+    void BeginPass(nvrhi::ICommandList* commandList, GpuPass pass, uint32_t section = 0);
+    void EndPass(nvrhi::ICommandList* commandList, GpuPass pass, uint32_t section = 0);
+
+    // Reads the results of all frames that are still pending, oldest first. Blocks until the GPU has finished them.
+    void Flush(std::vector<FrameTimings>& outTimings);
+
+private:
+    struct FrameSlot
+    {
+        std::array<std::array<nvrhi::TimerQueryHandle, MaxPassSections>, size_t(GpuPass::COUNT)> queries;
+        std::array<std::array<bool, MaxPassSections>, size_t(GpuPass::COUNT)> used{};
+        FrameTimings timings;
+        bool pending = false;
+    };
+
+    nvrhi::DeviceHandle m_Device;
+    std::array<FrameSlot, QueuedFramesCount> m_Slots;
+    uint32_t m_CurrentSlot = 0;
+    bool m_FrameActive = false;
+
+    void ResolveSlot(FrameSlot& slot, FrameTimings& outTimings);
+};
+
+// Collects the per-frame timings of a benchmark run and writes them into a CSV or JSON file with summary statistics.
+class BenchmarkReport
+{
+public:
+    void AddFrame(const FrameTimings& timings) { m_Frames.push_back(timings); }
+    [[nodiscard]] size_t GetFrameCount() const { return m_Frames.size(); }
+
+    bool Write(const std::filesystem::path& fileName, const std::string& sceneName, const std::string& rendererName) const;
+    void LogSummary() const;
+
+private:
+    struct Statistics
+    {
+        float average = 0.f;
+        float minimum = 0.f;
+        float maximum = 0.f;
+        float median = 0.f;
+        float percentile95 = 0.f;
+        size_t samples = 0;
+    };
+
+    std::vector<FrameTimings> m_Frames;
+
+    template<typename F> Statistics ComputeStatistics(F getValue) const;
+    bool WriteCsv(FILE* file) const;
+    bool WriteJson(FILE* file, const std::string& sceneName, const std::string& rendererName) const;
+};
@@ -0,0 +1,89 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+#include "DynamicResolution.h"
+#include "Benchmark.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace donut::math;
+
+static_assert(DynamicResolutionController::HistoryLength > GpuPassTimers::QueuedFramesCount,
+    "The scale of a frame must still be known when its timings are resolved");
+
+// Weights of a new measurement in the cost estimate. Cost increases are followed quickly, decreases slowly,
+// so that a single cheap frame doesn't raise the resolution into a miss.
+static const float c_CostRiseWeight = 0.5f;
+static const float c_CostFallWeight = 0.1f;
+
+// Scale changes smaller than this are ignored, to keep the upscaler from seeing a new input size every frame
+static const float c_ScaleDeadBand = 0.01f;
+
+void DynamicResolutionController::RecordFrame(uint64_t frameIndex, float scale)
+{
+    m_History[frameIndex % HistoryLength] = { frameIndex, scale };
+}
+
+void DynamicResolutionController::Update(uint64_t frameIndex, float gpuFrameTimeMs, const DynamicResolutionParameters& params)
+{
+    const FrameRecord& record = m_History[frameIndex % HistoryLength];
+    if (record.frameIndex != frameIndex || record.scale <= 0.f || gpuFrameTimeMs <= 0.f)
+        return;
+
+    const float fullResolutionCostMs = gpuFrameTimeMs / (record.scale * record.scale);
+    if (m_CostValid)
+    {
+        const float weight = fullResolutionCostMs > m_FullResolutionCostMs ? c_CostRiseWeight : c_CostFallWeight;
+        m_FullResolutionCostMs = lerp(m_FullResolutionCostMs, fullResolutionCostMs, weight);
+    }
+    else
+    {
+        m_FullResolutionCostMs = fullResolutionCostMs;
+        m_CostValid = true;
+    }
+
+    const float budgetMs = 1000.f / std::max(params.targetFrameRate, 1.f) * (1.f - params.headroom);
+    const float desiredScale = std::clamp(sqrtf(budgetMs / m_FullResolutionCostMs), params.minScale, params.maxScale);
+
+    const float step = std::clamp(desiredScale - m_Scale, -params.maxStepDown, params.maxStepUp);
+    if (fabsf(step) < c_ScaleDeadBand && desiredScale != params.minScale && desiredScale != params.maxScale)
+        return;
+
+    m_Scale = std::clamp(m_Scale + step, params.minScale, params.maxScale);
+}
+
+void DynamicResolutionController::Reset()
+{
+    m_History.fill({ ~0ull, 0.f });
+    m_Scale = 1.f;
+    m_FullResolutionCostMs = 0.f;
+    m_CostValid = false;
+}
+
+uint2 DynamicResolutionController::GetRenderSize(uint2 maxSize, float scale)
+{
+    uint2 size;
+    size.x = uint32_t(floorf(float(maxSize.x) * scale + 0.5f));
+    size.y = uint32_t(floorf(float(maxSize.y) * scale + 0.5f));
+    return min(max(size, uint2(1u)), maxSize);
+}
@@ -0,0 +1,71 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <donut/core/math/math.h>
+
+#include <array>
+
+struct DynamicResolutionParameters
+{
+    float targetFrameRate = 60.f;
+    float headroom = 0.1f;          // Fraction of the frame time budget that is kept free to absorb spikes
+    float minScale = 0.5f;
+    float maxScale = 1.f;
+    float maxStepDown = 0.1f;       // Largest scale change per measurement. The scale drops faster than it rises to avoid missed frames.
+    float maxStepUp = 0.02f;
+};
+
+// Chooses the fraction of the render targets, per axis, that the scene is rendered into, from the measured GPU frame times.
+// The GPU cost of a frame is modelled as proportional to the number of rendered pixels. The model is refitted from every
+// measurement, so the costs that don't depend on the resolution are followed as well, only less precisely.
+// The timings arrive several frames after the frame was rendered, so the scale that each frame used is remembered.
+class DynamicResolutionController
+{
+public:
+    static constexpr uint32_t HistoryLength = 16;
+
+    DynamicResolutionController() { m_History.fill({ ~0ull, 0.f }); }
+
+    // Remembers the scale that a frame is rendered with, under the index that its timings will be reported with
+    void RecordFrame(uint64_t frameIndex, float scale);
+
+    void Update(uint64_t frameIndex, float gpuFrameTimeMs, const DynamicResolutionParameters& params);
+    void Reset();
+
+    [[nodiscard]] float GetScale() const { return m_Scale; }
+
+    [[nodiscard]] static dm::uint2 GetRenderSize(dm::uint2 maxSize, float scale);
+
+private:
+    struct FrameRecord
+    {
+        uint64_t frameIndex;
+        float scale;
+    };
+
+    std::array<FrameRecord, HistoryLength> m_History;
+    float m_Scale = 1.f;
+    float m_FullResolutionCostMs = 0.f;
+    bool m_CostValid = false;
+};
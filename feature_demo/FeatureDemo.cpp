@@ -20,10 +20,13 @@
 * DEALINGS IN THE SOFTWARE.
 */
 
+#include <algorithm>
+#include <array>
 #include <string>
 #include <vector>
 #include <memory>
 #include <chrono>
+#include <cfloat>
 
 #include <donut/core/vfs/VFS.h>
 #include <donut/core/log.h>
@@ -35,6 +38,7 @@
 #include <donut/engine/Scene.h>
 #include <donut/engine/ShaderFactory.h>
 #include <donut/engine/TextureCache.h>
+#include <donut/engine/ThreadPool.h>
 #include <donut/render/BloomPass.h>
 #include <donut/render/CascadedShadowMap.h>
 #include <donut/render/DeferredLightingPass.h>
@@ -60,6 +64,18 @@
 #include <nvrhi/utils.h>
 #include <nvrhi/common/misc.h>
 
+#include "AsyncReadback.h"
+#include "Benchmark.h"
+#include "DynamicResolution.h"
+#include "GpuCulling.h"
+#include "LightCulling.h"
+#include "LightProbeScheduler.h"
+#include "OrderIndependentTransparency.h"
+#include "ShadowCache.h"
+#include "TextureStreamer.h"
+#include "TransientTextures.h"
+#include "TransparencySort.h"
+
 using namespace donut;
 using namespace donut::math;
 using namespace donut::app;
@@ -67,8 +83,53 @@ using namespace donut::vfs;
 using namespace donut::engine;
 using namespace donut::render;
 
+#include "light_culling_cb.h"
+
 static bool g_PrintSceneGraph = false;
 static bool g_PrintFormats = false;
+static bool g_EnableGpuCulling = false;
+static bool g_EnableTiledLighting = true;
+static bool g_StreamingLoad = false;
+static uint64_t g_StreamingBudget = 16ull << 20;
+static BenchmarkParameters g_Benchmark;
+static const float c_CameraPathRecordInterval = 1.f / 30.f;
+static const uint32_t c_NumShadowCascades = 4;
+static_assert(c_NumShadowCascades < GpuPassTimers::MaxPassSections, "The parallel shadow map timer needs a section per cascade and one for the clear");
+static const float c_StereoEyeSeparation = 0.2f;
+static const uint32_t c_GpuCullingCameraSlot = 0; // Two slots, for the stereo views
+static const uint32_t c_GpuCullingShadowSlot = 2;
+static const uint32_t c_NumGpuCullingSlots = c_GpuCullingShadowSlot + c_NumShadowCascades;
+static const uint32_t c_NumTransparentGpuCullingSlots = 2; // The stereo views, starting at c_GpuCullingCameraSlot
+static const uint32_t c_MotionVectorStencilMask = 0x01;
+// How the donut geometry passes take the base vertex and instance locations of their draws, which the GPU-culled indirect draws
+// have to match: the depth and G-buffer passes fetch vertices from buffers and get the locations in push constants,
+// the forward passes use the input assembler.
+static const GpuCulling::BaseLocations c_DepthPassBaseLocations = GpuCulling::BaseLocations::PushConstants;
+static const GpuCulling::BaseLocations c_GBufferPassBaseLocations = GpuCulling::BaseLocations::PushConstants;
+static const GpuCulling::BaseLocations c_ForwardPassBaseLocations = GpuCulling::BaseLocations::DrawArguments;
+static const size_t c_MaxForwardLights = 16; // Matches the light array size of ForwardShadingPass
+static const uint32_t c_NumLightProbes = 32;
+static const size_t c_MaxActiveLightProbes = 16; // The lighting passes have a fixed-size light probe array, the probes closest to the camera are used
+static const uint32_t c_LightProbeCaptureSize = 512;
+static const uint32_t c_LightProbeCaptureMipLevels = 8;
+static const float c_LightProbeCullDistance = 100.f;
+static const size_t c_TimingHistoryLength = 120;
+static const uint32_t c_NumPickReadbacks = 4; // Picks that can be in flight, one is issued per frame at most
+static const uint32_t c_MaxReadbackRequests = c_NumPickReadbacks + 8;
+static const float c_LightProbeInvalidationMargin = 5.f; // Changes further than this from the influence bounds of a probe are not recaptured
+
+// The phases of a frame in recording order, as seen by the transient render target allocator
+enum class FramePhase : uint32_t
+{
+    GBufferFill,
+    Ssao,
+    Lighting,
+    MaterialId,
+    Transparency,    // Only used by order-independent transparency
+    TemporalResolve, // TAA, DLSS or the MSAA resolve
+    ToneMapping,
+    Present
+};
 
 class RenderTargets : public GBufferRenderTargets
 {
@@ -80,14 +141,19 @@ public:
     nvrhi::TextureHandle TemporalFeedback1;
     nvrhi::TextureHandle TemporalFeedback2;
     nvrhi::TextureHandle AmbientOcclusion;
+    nvrhi::TextureHandle OitAccumulation;
+    nvrhi::TextureHandle OitRevealage;
 
+    // Holds the targets that live across frames, the others are placed by Transients
     nvrhi::HeapHandle Heap;
+    std::unique_ptr<TransientTextureAllocator> Transients;
 
     std::shared_ptr<FramebufferFactory> ForwardFramebuffer;
     std::shared_ptr<FramebufferFactory> HdrFramebuffer;
     std::shared_ptr<FramebufferFactory> LdrFramebuffer;
     std::shared_ptr<FramebufferFactory> ResolvedFramebuffer;
     std::shared_ptr<FramebufferFactory> MaterialIDFramebuffer;
+    std::shared_ptr<FramebufferFactory> OitFramebuffer;
     
     void Init(
         nvrhi::IDevice* device,
@@ -109,6 +175,40 @@ public:
         desc.keepInitialState = true;
         desc.isVirtual = device->queryFeatureSupport(nvrhi::Feature::VirtualResources);
 
+        // The G-buffer channels are dead after the lighting pass. Recreate them as placed textures,
+        // so that the targets of the later passes can reuse their memory.
+        // SSAO can run on the compute queue, which can't transition textures out of the RenderTarget or DepthWrite
+        // states, so its inputs are kept in the ShaderResource state between command lists.
+        const bool computeQueue = device->queryFeatureSupport(nvrhi::Feature::ComputeQueue);
+        auto recreateGBufferTexture = [this, device](nvrhi::TextureHandle& texture, bool isVirtual, bool shaderResourceState)
+        {
+            if (!texture || (!isVirtual && !shaderResourceState))
+                return;
+
+            nvrhi::TextureDesc gbufferDesc = texture->getDesc();
+            gbufferDesc.isVirtual = isVirtual;
+            if (shaderResourceState)
+                gbufferDesc.initialState = nvrhi::ResourceStates::ShaderResource;
+            nvrhi::TextureHandle newTexture = device->createTexture(gbufferDesc);
+
+            for (auto& target : GBufferFramebuffer->RenderTargets)
+            {
+                if (target == texture)
+                    target = newTexture;
+            }
+            if (GBufferFramebuffer->DepthTarget == texture)
+                GBufferFramebuffer->DepthTarget = newTexture;
+
+            texture = newTexture;
+        };
+
+        recreateGBufferTexture(Depth, false, computeQueue);
+        recreateGBufferTexture(GBufferDiffuse, desc.isVirtual, false);
+        recreateGBufferTexture(GBufferSpecular, desc.isVirtual, false);
+        recreateGBufferTexture(GBufferNormals, desc.isVirtual, computeQueue);
+        recreateGBufferTexture(GBufferEmissive, desc.isVirtual, false);
+        recreateGBufferTexture(MotionVectors, desc.isVirtual, false);
+
         desc.clearValue = nvrhi::Color(0.f);
         desc.isTypeless = false;
         desc.isUAV = sampleCount == 1;
@@ -119,9 +219,21 @@ public:
 
         desc.format = nvrhi::Format::RG16_UINT;
         desc.isUAV = false;
+        desc.clearValue = nvrhi::Color(float(0xffff)); // No material
         desc.debugName = "MaterialIDs";
         MaterialIDs = device->createTexture(desc);
 
+        desc.format = nvrhi::Format::RGBA16_FLOAT;
+        desc.clearValue = nvrhi::Color(0.f);
+        desc.debugName = "OitAccumulation";
+        OitAccumulation = device->createTexture(desc);
+
+        desc.format = nvrhi::Format::R16_FLOAT;
+        desc.clearValue = nvrhi::Color(1.f); // Fully revealed
+        desc.debugName = "OitRevealage";
+        OitRevealage = device->createTexture(desc);
+        desc.clearValue = nvrhi::Color(0.f);
+
         // The render targets below this point are non-MSAA
         desc.sampleCount = 1;
         desc.dimension = nvrhi::TextureDimension::Texture2D;
@@ -144,22 +256,35 @@ public:
         desc.debugName = "LdrColor";
         LdrColor = device->createTexture(desc);
 
+        // Only written by the SSAO compute shaders, so it can stay in a state that is valid on the compute queue
         desc.format = nvrhi::Format::R8_UNORM;
         desc.isUAV = true;
+        desc.isRenderTarget = false;
+        desc.initialState = nvrhi::ResourceStates::UnorderedAccess;
         desc.debugName = "AmbientOcclusion";
         AmbientOcclusion = device->createTexture(desc);
 
+        // Every pass of the frame that uses a transient target must be declared here.
+        // The TAA feedback textures carry the history between frames, they can't be transient.
+        Transients = std::make_unique<TransientTextureAllocator>(device);
+        Transients->DeclarePass(uint32_t(FramePhase::GBufferFill), {},
+            { GBufferDiffuse, GBufferSpecular, GBufferNormals, GBufferEmissive, MotionVectors });
+        Transients->DeclarePass(uint32_t(FramePhase::Ssao), { GBufferNormals }, { AmbientOcclusion });
+        Transients->DeclarePass(uint32_t(FramePhase::Lighting),
+            { GBufferDiffuse, GBufferSpecular, GBufferNormals, GBufferEmissive, AmbientOcclusion }, { HdrColor });
+        Transients->DeclarePass(uint32_t(FramePhase::MaterialId), {}, { MaterialIDs });
+        Transients->DeclarePass(uint32_t(FramePhase::Transparency), {}, { HdrColor, OitAccumulation, OitRevealage });
+        Transients->DeclarePass(uint32_t(FramePhase::TemporalResolve), {}, { MotionVectors, ResolvedColor });
+        Transients->DeclarePass(uint32_t(FramePhase::ToneMapping), { HdrColor, ResolvedColor }, { LdrColor });
+        Transients->DeclarePass(uint32_t(FramePhase::Present), { LdrColor }, { ResolvedColor });
+        Transients->Allocate("TransientRenderTargetHeap");
+
         if (desc.isVirtual)
         {
             uint64_t heapSize = 0;
             nvrhi::ITexture* const textures[] = {
-                HdrColor,
-                MaterialIDs,
-                ResolvedColor,
                 TemporalFeedback1,
-                TemporalFeedback2,
-                LdrColor,
-                AmbientOcclusion
+                TemporalFeedback2
             };
 
             for (auto texture : textures)
@@ -204,6 +329,10 @@ public:
         MaterialIDFramebuffer = std::make_shared<FramebufferFactory>(device);
         MaterialIDFramebuffer->RenderTargets = { MaterialIDs };
         MaterialIDFramebuffer->DepthTarget = Depth;
+
+        OitFramebuffer = std::make_shared<FramebufferFactory>(device);
+        OitFramebuffer->RenderTargets = { OitAccumulation, OitRevealage };
+        OitFramebuffer->DepthTarget = Depth;
     }
 
     [[nodiscard]] bool IsUpdateRequired(uint2 size, uint sampleCount) const
@@ -214,13 +343,19 @@ public:
         return false;
     }
 
+    // Clears the depth buffer and starts the frame: the G-buffer channels are the transient targets of the first phase
     void Clear(nvrhi::ICommandList* commandList) override
     {
-        GBufferRenderTargets::Clear(commandList);
+        const nvrhi::FormatInfo& depthFormatInfo = nvrhi::getFormatInfo(Depth->getDesc().format);
+        commandList->clearDepthStencilTexture(Depth, nvrhi::AllSubresources, true, Depth->getDesc().clearValue.r, depthFormatInfo.hasStencil, 0);
 
-        commandList->clearTextureFloat(HdrColor, nvrhi::AllSubresources, nvrhi::Color(0.f));
-        commandList->clearTextureFloat(LdrColor, nvrhi::AllSubresources, nvrhi::Color(0.f));
-        commandList->clearTextureFloat(ResolvedColor, nvrhi::AllSubresources, nvrhi::Color(0.f));
+        BeginPhase(commandList, FramePhase::GBufferFill);
+    }
+
+    // Starts the lifetimes of the transient targets that are first used in 'phase', which clears them
+    void BeginPhase(nvrhi::ICommandList* commandList, FramePhase phase) const
+    {
+        Transients->BeginPass(commandList, uint32_t(phase));
     }
 };
 
@@ -234,12 +369,22 @@ enum class AntiAliasingMode
     MSAA_8X
 };
 
+enum class TransparencyMode
+{
+    CpuSorted,          // TransparentDrawStrategy
+    GpuSorted,          // TransparencySort, culled on the CPU and ordered by a GPU sort that is one or two frames late
+    OrderIndependent    // Weighted blended OIT, unsorted, with GPU culling when it is enabled
+};
+
 struct UIData
 {
     bool                                ShowUI = true;
 	bool                                ShowConsole = false;
     bool                                UseDeferredShading = true;
     bool                                Stereo = false;
+    bool                                StereoSharedDrawList = true;
+    bool                                SinglePassStereo = true;
+    bool                                SinglePassStereoSupported = false;
     bool                                EnableSsao = true;
     SsaoParameters                      SsaoParams;
     ToneMappingParameters               ToneMappingParams;
@@ -247,6 +392,8 @@ struct UIData
     SkyParameters                       SkyParams;
     enum AntiAliasingMode               AntiAliasingMode = AntiAliasingMode::TEMPORAL;
     enum TemporalAntiAliasingJitter     TemporalAntiAliasingJitter = TemporalAntiAliasingJitter::MSAA;
+    bool                                EnableDynamicResolution = false;
+    DynamicResolutionParameters         DynamicResolutionParams;
     bool                                EnableVsync = true;
     bool                                ShaderReoladRequested = false;
     bool                                EnableProceduralSky = true;
@@ -255,17 +402,33 @@ struct UIData
     float                               BloomSigma = 32.f;
     float                               BloomAlpha = 0.05f;
     bool                                EnableTranslucency = true;
+    TransparencyMode                    Transparency = TransparencyMode::CpuSorted;
     bool                                EnableMaterialEvents = false;
     bool                                EnableShadows = true;
+    bool                                EnableShadowCache = true;
+    bool                                EnableShadowCacheScrolling = true;
+    int                                 ShadowCacheReducedRateCascade = 2;
+    int                                 ShadowCacheReducedRateInterval = 4;
     float                               AmbientIntensity = 1.0f;
     bool                                EnableLightProbe = true;
     float                               LightProbeDiffuseScale = 1.f;
     float                               LightProbeSpecularScale = 1.f;
+    bool                                EnableLightProbeUpdates = true;
+    int                                 LightProbeFacesPerFrame = 1;
+    int                                 LightProbeRefreshInterval = 0;
     float                               CsmExponent = 4.f;
     bool                                DisplayShadowMap = false;
     bool                                UseThirdPersonCamera = false;
     bool                                EnableAnimations = false;
     bool                                TestMipMapGen = false;
+    bool                                EnablePassTimers = false;
+    bool                                EnableParallelRecording = true;
+    bool                                ParallelRecordingAvailable = false;
+    bool                                EnableAsyncCompute = false;
+    bool                                AsyncComputeAvailable = false;
+    bool                                EnableGpuCulling = false;
+    bool                                EnableOcclusionCulling = true;
+    bool                                EnableTiledLighting = true;
     std::shared_ptr<Material>           SelectedMaterial;
     std::shared_ptr<SceneGraphNode>     SelectedNode;
     std::string                         ScreenshotFileName;
@@ -288,10 +451,14 @@ private:
     std::shared_ptr<CascadedShadowMap>  m_ShadowMap;
     std::shared_ptr<FramebufferFactory> m_ShadowFramebuffer;
     std::shared_ptr<DepthPass>          m_ShadowDepthPass;
+    std::unique_ptr<ShadowCache>        m_ShadowCache;
+    bool                                m_ShadowCacheActive = false;
     std::shared_ptr<InstancedOpaqueDrawStrategy> m_OpaqueDrawStrategy;
     std::shared_ptr<TransparentDrawStrategy> m_TransparentDrawStrategy;
     std::unique_ptr<RenderTargets>      m_RenderTargets;
     std::shared_ptr<ForwardShadingPass> m_ForwardPass;
+    std::shared_ptr<OitForwardShadingPass> m_OitPass;
+    std::unique_ptr<OitCompositePass>   m_OitCompositePass;
     std::unique_ptr<GBufferFillPass>    m_GBufferPass;
     std::unique_ptr<DeferredLightingPass> m_DeferredLightingPass;
     std::unique_ptr<SkyPass>            m_SkyPass;
@@ -304,13 +471,61 @@ private:
     std::unique_ptr<SsaoPass>           m_SsaoPass;
     std::shared_ptr<LightProbeProcessingPass> m_LightProbePass;
     std::unique_ptr<MaterialIDPass>     m_MaterialIDPass;
-    std::unique_ptr<PixelReadbackPass>  m_PixelReadbackPass;
+    std::array<std::unique_ptr<PixelReadbackPass>, c_NumPickReadbacks> m_PickReadbackPasses;
+    std::array<bool, c_NumPickReadbacks> m_PickReadbackPending{};
+    std::unique_ptr<AsyncReadback>      m_Readback;
     std::unique_ptr<MipMapGenPass>      m_MipMapGenPass;
+    std::unique_ptr<GpuCulling>         m_GpuCulling;
+    std::unique_ptr<GpuCulling>         m_TransparentGpuCulling;
+    std::unique_ptr<TransparencySort>   m_TransparencySort;
+    bool                                m_GpuCullingActive = false;
+    std::unique_ptr<LightCulling>       m_LightCulling;
 
     std::shared_ptr<IView>              m_View;
     std::shared_ptr<IView>              m_ViewPrevious;
+    PlanarView                          m_StereoCullingView; // Contains the frusta of both eyes
+    bool                                m_SinglePassStereoActive = false; // The G-buffer passes were created for single-pass stereo
+    PlanarView                          m_OutputView; // Covers the whole render targets, used after the upscaling resolve
+    DynamicResolutionController         m_DynamicResolution;
+    bool                                m_DynamicResolutionActive = false;
+    float                               m_ResolutionScale = 1.f;
     
     nvrhi::CommandListHandle            m_CommandList;
+
+    // Scene loading decodes geometry, materials and textures on its own pool, separate from the command recording workers.
+    // In streaming mode, the scene starts rendering as soon as its geometry is loaded, with fallback textures for the
+    // textures that are not resident yet. Textures with a mip chain are uploaded by the texture streamer, lowest mips first.
+    struct StreamingMaterial
+    {
+        std::shared_ptr<Material> material;
+        std::array<nvrhi::TextureHandle, 6> textures;
+    };
+
+    std::unique_ptr<ThreadPool>         m_LoadingThreadPool;
+    std::shared_ptr<TextureStreamer>    m_TextureStreamer;
+    nvrhi::CommandListHandle            m_StreamingCommandList;
+    std::vector<StreamingMaterial>      m_StreamingMaterials;
+    bool                                m_SceneStreaming = false;
+
+    // Parallel recording of the shadow cascades and the G-buffer fill pass.
+    // Every worker command list has its own draw strategy and framebuffer factory because those are not thread-safe.
+    std::unique_ptr<ThreadPool>         m_ThreadPool;
+    nvrhi::CommandListHandle            m_SetupCommandList;
+    nvrhi::CommandListHandle            m_GBufferCommandList;
+    InstancedOpaqueDrawStrategy         m_GBufferDrawStrategy;
+    std::array<nvrhi::CommandListHandle, c_NumShadowCascades> m_ShadowCommandLists;
+    std::array<InstancedOpaqueDrawStrategy, c_NumShadowCascades> m_ShadowDrawStrategies;
+    std::array<std::shared_ptr<FramebufferFactory>, c_NumShadowCascades> m_ShadowCascadeFramebuffers;
+
+    // Async compute: SSAO runs on the compute queue while the graphics queue renders the shadow maps,
+    // which are moved after the G-buffer fill, and the exposure of a frame is computed while the graphics queue
+    // starts on the next frame. Tone mapping uses the exposure of the previous frame in this mode.
+    nvrhi::CommandListHandle            m_SsaoCommandList;
+    nvrhi::CommandListHandle            m_ExposureCommandList;
+    nvrhi::CommandListHandle            m_AsyncShadowCommandList;
+    uint64_t                            m_LastComputeSubmission = 0;
+    bool                                m_ComputeSubmissionPending = false;
+
     bool                                m_PreviousViewsValid = false;
     FirstPersonCamera                   m_FirstPersonCamera;
     ThirdPersonCamera                   m_ThirdPersonCamera;
@@ -321,12 +536,41 @@ private:
     float3                              m_AmbientBottom = 0.f;
     uint2                               m_PickPosition = 0u;
     bool                                m_Pick = false;
+    uint32_t                            m_VisibleGpuCullingRecords = 0;
+    uint32_t                            m_LightCullingOverflowTiles = 0;
+    uint32_t                            m_LightCullingMaxTileLights = 0;
     
     std::vector<std::shared_ptr<LightProbe>> m_LightProbes;
     nvrhi::TextureHandle                m_LightProbeDiffuseTexture;
     nvrhi::TextureHandle                m_LightProbeSpecularTexture;
 
+    // Light probe captures are spread over several frames, see LightProbeScheduler.
+    // The captures use their own shadow map so that they don't disturb the cascades of the main view.
+    std::unique_ptr<LightProbeScheduler> m_LightProbeScheduler;
+    std::shared_ptr<ForwardShadingPass> m_LightProbeForwardPass;
+    std::array<std::unique_ptr<SkyPass>, LightProbeScheduler::c_NumCaptureTargets> m_LightProbeSkyPasses;
+    std::shared_ptr<CascadedShadowMap>  m_LightProbeShadowMap;
+    std::shared_ptr<FramebufferFactory> m_LightProbeShadowFramebuffer;
+    bool                                m_EnvironmentBrdfRendered = false;
+    double3                             m_LightProbeSunDirection = 0.0;
+    float3                              m_LightProbeSunRadiance = 0.f;
+
     float                               m_WallclockTime = 0.f;
+
+    std::unique_ptr<GpuPassTimers>      m_PassTimers;
+    FrameTimings                        m_LatestTimings;
+    std::vector<FrameTimings>           m_TimingHistory; // Ring buffer for the timer graphs
+    size_t                              m_TimingHistoryNext = 0;
+    float                               m_LastFrameTimeSeconds = 0.f;
+
+    CameraPath                          m_BenchmarkCameraPath;
+    BenchmarkReport                     m_BenchmarkReport;
+    uint32_t                            m_BenchmarkFrame = 0;
+    uint32_t                            m_BenchmarkFrameCount = 0;
+    bool                                m_BenchmarkFinished = false;
+    CameraPath                          m_RecordedCameraPath;
+    float                               m_RecordingTime = 0.f;
+    float                               m_LastRecordedKeyframeTime = -1.f;
     
     UIData&                             m_ui;
 
@@ -341,9 +585,11 @@ public:
 
         std::filesystem::path mediaDir = app::GetDirectoryWithExecutable().parent_path() / "media";
         std::filesystem::path frameworkShaderDir = app::GetDirectoryWithExecutable() / "shaders/framework" / app::GetShaderTypeName(GetDevice()->getGraphicsAPI());
+        std::filesystem::path appShaderDir = app::GetDirectoryWithExecutable() / "shaders/feature_demo" / app::GetShaderTypeName(GetDevice()->getGraphicsAPI());
 
         m_RootFs->mount("/media", mediaDir);
         m_RootFs->mount("/shaders/donut", frameworkShaderDir);
+        m_RootFs->mount("/shaders/app", appShaderDir);
 
         m_NativeFs = std::make_shared<NativeFileSystem>();
 
@@ -356,7 +602,16 @@ public:
                 "Please make sure that folder contains valid scene files.", m_SceneDir.generic_string().c_str());
         }
         
-        m_TextureCache = std::make_shared<TextureCache>(GetDevice(), m_NativeFs, nullptr);
+        if (g_StreamingLoad)
+        {
+            // The cache reads the textures through the streamer, which keeps the mips above the tail of DDS files for itself
+            m_TextureStreamer = std::make_shared<TextureStreamer>(GetDevice(), g_StreamingBudget);
+            auto streamingFs = std::make_shared<StreamingFileSystem>(m_NativeFs, m_TextureStreamer);
+            m_TextureCache = std::make_shared<TextureCache>(GetDevice(), streamingFs, nullptr);
+            m_StreamingCommandList = GetDevice()->createCommandList();
+        }
+        else
+            m_TextureCache = std::make_shared<TextureCache>(GetDevice(), m_NativeFs, nullptr);
 
         m_ShaderFactory = std::make_shared<ShaderFactory>(GetDevice(), m_RootFs, "/shaders");
         m_CommonPasses = std::make_shared<CommonRenderPasses>(GetDevice(), m_ShaderFactory);
@@ -378,11 +633,13 @@ public:
         
         nvrhi::Format shadowMapFormat = nvrhi::utils::ChooseFormat(GetDevice(), shadowMapFeatures, shadowMapFormats, std::size(shadowMapFormats));
         
-        m_ShadowMap = std::make_shared<CascadedShadowMap>(GetDevice(), 2048, 4, 0, shadowMapFormat);
+        m_ShadowMap = std::make_shared<CascadedShadowMap>(GetDevice(), 2048, c_NumShadowCascades, 0, shadowMapFormat);
         m_ShadowMap->SetupProxyViews();
         
         m_ShadowFramebuffer = std::make_shared<FramebufferFactory>(GetDevice());
         m_ShadowFramebuffer->DepthTarget = m_ShadowMap->GetTexture();
+
+        m_ShadowCache = std::make_unique<ShadowCache>(GetDevice(), *m_ShaderFactory, m_ShadowMap->GetTexture());
         
         DepthPass::CreateParameters shadowDepthParams;
         shadowDepthParams.slopeScaledDepthBias = 4.f;
@@ -390,7 +647,51 @@ public:
         m_ShadowDepthPass = std::make_shared<DepthPass>(GetDevice(), m_CommonPasses);
         m_ShadowDepthPass->Init(*m_ShaderFactory, shadowDepthParams);
 
+        m_ui.SinglePassStereoSupported = GetDevice()->queryFeatureSupport(nvrhi::Feature::SinglePassStereo);
+
         m_CommandList = GetDevice()->createCommandList();
+        m_LoadingThreadPool = std::make_unique<ThreadPool>();
+
+        // D3D11 cannot record command lists on multiple threads
+        if (GetDevice()->getGraphicsAPI() != nvrhi::GraphicsAPI::D3D11)
+        {
+            m_ThreadPool = std::make_unique<ThreadPool>();
+
+            auto deferredParams = nvrhi::CommandListParameters().setEnableImmediateExecution(false);
+            m_SetupCommandList = GetDevice()->createCommandList(deferredParams);
+            m_GBufferCommandList = GetDevice()->createCommandList(deferredParams);
+
+            for (uint32_t cascade = 0; cascade < c_NumShadowCascades; cascade++)
+            {
+                m_ShadowCommandLists[cascade] = GetDevice()->createCommandList(deferredParams);
+
+                m_ShadowCascadeFramebuffers[cascade] = std::make_shared<FramebufferFactory>(GetDevice());
+                m_ShadowCascadeFramebuffers[cascade]->DepthTarget = m_ShadowMap->GetTexture();
+            }
+
+            m_ui.ParallelRecordingAvailable = true;
+
+            if (GetDevice()->queryFeatureSupport(nvrhi::Feature::ComputeQueue))
+            {
+                auto computeParams = nvrhi::CommandListParameters()
+                    .setEnableImmediateExecution(false)
+                    .setQueueType(nvrhi::CommandQueue::Compute);
+                m_SsaoCommandList = GetDevice()->createCommandList(computeParams);
+                m_ExposureCommandList = GetDevice()->createCommandList(computeParams);
+                m_AsyncShadowCommandList = GetDevice()->createCommandList(deferredParams);
+
+                m_ui.AsyncComputeAvailable = true;
+            }
+        }
+
+        m_PassTimers = std::make_unique<GpuPassTimers>(GetDevice());
+        m_Readback = std::make_unique<AsyncReadback>(GetDevice(), c_MaxReadbackRequests);
+
+        m_LightProbeScheduler = std::make_unique<LightProbeScheduler>(GetDevice(), *m_ShaderFactory,
+            c_LightProbeCaptureSize, c_LightProbeCaptureMipLevels, 0.1f, c_LightProbeCullDistance);
+        m_LightProbeShadowMap = std::make_shared<CascadedShadowMap>(GetDevice(), 1024, c_NumShadowCascades, 0, shadowMapFormat);
+        m_LightProbeShadowFramebuffer = std::make_shared<FramebufferFactory>(GetDevice());
+        m_LightProbeShadowFramebuffer->DepthTarget = m_LightProbeShadowMap->GetTexture();
 
         m_FirstPersonCamera.SetMoveSpeed(3.0f);
         m_ThirdPersonCamera.SetMoveSpeed(3.0f);
@@ -407,7 +708,208 @@ public:
         else
             SetCurrentSceneName(sceneName);
 
-        CreateLightProbes(4);
+        CreateLightProbes(c_NumLightProbes);
+
+        if (g_Benchmark.enabled)
+            InitBenchmark();
+    }
+
+    ~FeatureDemo()
+    {
+        if (!g_Benchmark.recordCameraPathFile.empty() && !m_RecordedCameraPath.IsEmpty())
+        {
+            if (m_RecordedCameraPath.Save(g_Benchmark.recordCameraPathFile))
+                log::info("Camera path saved to '%s'", g_Benchmark.recordCameraPathFile.c_str());
+        }
+    }
+
+    void InitBenchmark()
+    {
+        if (!g_Benchmark.cameraPathFile.empty())
+        {
+            if (!m_BenchmarkCameraPath.Load(*m_NativeFs, g_Benchmark.cameraPathFile))
+                log::fatal("Cannot load the camera path from '%s'", g_Benchmark.cameraPathFile.c_str());
+        }
+
+        m_BenchmarkFrameCount = g_Benchmark.measuredFrames;
+        if (m_BenchmarkFrameCount == 0)
+        {
+            m_BenchmarkFrameCount = m_BenchmarkCameraPath.IsEmpty()
+                ? 600
+                : uint32_t(ceilf(m_BenchmarkCameraPath.GetDuration() * g_Benchmark.frameRate)) + 1;
+        }
+
+        // Benchmark runs are unattended: no UI overlay, no vsync, and the pass timers are always on
+        m_ui.ShowUI = false;
+        m_ui.EnableVsync = false;
+        m_ui.EnablePassTimers = true;
+
+        log::info("Benchmark: %u warm-up frames, %u measured frames at %.1f simulated FPS",
+            g_Benchmark.warmupFrames, m_BenchmarkFrameCount, g_Benchmark.frameRate);
+    }
+
+    [[nodiscard]] bool IsBenchmarkRunning() const
+    {
+        return g_Benchmark.enabled && !m_BenchmarkFinished;
+    }
+
+    void AnimateBenchmarkCamera()
+    {
+        if (m_BenchmarkCameraPath.IsEmpty())
+            return;
+
+        // The camera stays at the start of the path during warm-up
+        uint32_t measuredFrame = m_BenchmarkFrame > g_Benchmark.warmupFrames ? m_BenchmarkFrame - g_Benchmark.warmupFrames : 0;
+        float pathTime = float(measuredFrame) / g_Benchmark.frameRate;
+
+        CameraPathKeyframe keyframe = m_BenchmarkCameraPath.Evaluate(pathTime);
+
+        m_ui.ActiveSceneCamera.reset();
+        m_ui.UseThirdPersonCamera = false;
+        m_FirstPersonCamera.LookAt(keyframe.position, keyframe.position + keyframe.direction, keyframe.up);
+    }
+
+    void OnFrameTimingsResolved(const FrameTimings& timings)
+    {
+        m_LatestTimings = timings;
+
+        if (m_TimingHistory.size() < c_TimingHistoryLength)
+            m_TimingHistory.push_back(timings);
+        else
+            m_TimingHistory[m_TimingHistoryNext] = timings;
+        m_TimingHistoryNext = (m_TimingHistoryNext + 1) % c_TimingHistoryLength;
+
+        if (g_Benchmark.enabled && timings.frameIndex >= g_Benchmark.warmupFrames)
+            m_BenchmarkReport.AddFrame(timings);
+
+        if (m_DynamicResolutionActive)
+            m_DynamicResolution.Update(timings.frameIndex, timings.gpuPassTimesMs[size_t(GpuPass::Frame)], m_ui.DynamicResolutionParams);
+    }
+
+    void FinishBenchmark()
+    {
+        // Collect the timings of the frames that are still in flight
+        GetDevice()->waitForIdle();
+
+        std::vector<FrameTimings> pendingTimings;
+        m_PassTimers->Flush(pendingTimings);
+        for (const FrameTimings& timings : pendingTimings)
+            OnFrameTimingsResolved(timings);
+
+        m_BenchmarkReport.LogSummary();
+
+        if (!g_Benchmark.outputFile.empty())
+            m_BenchmarkReport.Write(g_Benchmark.outputFile, m_CurrentSceneName, GetDeviceManager()->GetRendererString());
+
+        m_BenchmarkFinished = true;
+        glfwSetWindowShouldClose(GetDeviceManager()->GetWindow(), GLFW_TRUE);
+    }
+
+    uint32_t FindFreePickReadback() const
+    {
+        for (uint32_t index = 0; index < c_NumPickReadbacks; index++)
+        {
+            if (!m_PickReadbackPending[index])
+                return index;
+        }
+
+        return c_NumPickReadbacks;
+    }
+
+    void CancelReadbacks()
+    {
+        if (m_Readback)
+            m_Readback->Cancel();
+        m_PickReadbackPending.fill(false);
+    }
+
+    void PickResolved(const uint4& pixelValue)
+    {
+        m_ui.SelectedMaterial = nullptr;
+        m_ui.SelectedNode = nullptr;
+
+        for (const auto& material : m_Scene->GetSceneGraph()->GetMaterials())
+        {
+            if (material->materialID == int(pixelValue.x))
+            {
+                m_ui.SelectedMaterial = material;
+                break;
+            }
+        }
+
+        for (const auto& instance : m_Scene->GetSceneGraph()->GetMeshInstances())
+        {
+            if (instance->GetInstanceIndex() == int(pixelValue.y))
+            {
+                m_ui.SelectedNode = instance->GetNodeSharedPtr();
+                break;
+            }
+        }
+
+        if (m_ui.SelectedNode)
+        {
+            log::info("Picked node: %s", m_ui.SelectedNode->GetPath().generic_string().c_str());
+            PointThirdPersonCameraAt(m_ui.SelectedNode);
+        }
+        else
+        {
+            PointThirdPersonCameraAt(m_Scene->GetSceneGraph()->GetRootNode());
+        }
+    }
+
+    // Read back from the GPU a few frames late
+    uint32_t GetVisibleGpuCullingRecords() const
+    {
+        return m_VisibleGpuCullingRecords;
+    }
+
+    // Tiles that have more local lights than the tile lists can hold, and the most lights in one tile. Read back a few frames late.
+    uint32_t GetLightCullingOverflowTiles() const
+    {
+        return m_LightCullingOverflowTiles;
+    }
+
+    uint32_t GetLightCullingMaxTileLights() const
+    {
+        return m_LightCullingMaxTileLights;
+    }
+
+    uint32_t GetGpuCullingCandidates() const
+    {
+        return m_GpuCulling ? m_GpuCulling->GetNumCandidates() : 0;
+    }
+
+    bool IsDynamicResolutionActive() const
+    {
+        return m_DynamicResolutionActive;
+    }
+
+    float GetResolutionScale() const
+    {
+        return m_ResolutionScale;
+    }
+
+    // The passes after TAA or DLSS work on the upscaled image
+    const IView& GetOutputView() const
+    {
+        if (m_DynamicResolutionActive)
+            return m_OutputView;
+        return *m_View;
+    }
+
+    const FrameTimings& GetLatestTimings() const
+    {
+        return m_LatestTimings;
+    }
+
+    // Fills 'outTimes' with the recent times of a pass, oldest first. Frames where the pass didn't run are zero.
+    void GetPassTimeHistory(GpuPass pass, std::vector<float>& outTimes) const
+    {
+        outTimes.clear();
+        const size_t count = m_TimingHistory.size();
+        const size_t first = count < c_TimingHistoryLength ? 0 : m_TimingHistoryNext;
+        for (size_t i = 0; i < count; i++)
+            outTimes.push_back(std::max(m_TimingHistory[(first + i) % count].gpuPassTimesMs[size_t(pass)], 0.f));
     }
 
 	std::shared_ptr<vfs::IFileSystem> GetRootFs() const
@@ -530,9 +1032,22 @@ public:
 
     virtual void Animate(float fElapsedTimeSeconds) override
     { 
-        if (!m_ui.ActiveSceneCamera)
+        m_LastFrameTimeSeconds = fElapsedTimeSeconds;
+
+        if (IsBenchmarkRunning())
+        {
+            // Advance the simulation at a fixed rate so that every run renders the same frames
+            fElapsedTimeSeconds = 1.f / g_Benchmark.frameRate;
+
+            if (IsSceneLoaded())
+                AnimateBenchmarkCamera();
+        }
+        else if (!m_ui.ActiveSceneCamera)
             GetActiveCamera().Animate(fElapsedTimeSeconds);
 
+        if (!g_Benchmark.recordCameraPathFile.empty() && IsSceneLoaded())
+            m_RecordingTime += fElapsedTimeSeconds;
+
         if(m_ToneMappingPass)
             m_ToneMappingPass->AdvanceFrame(fElapsedTimeSeconds);
         
@@ -546,6 +1061,13 @@ public:
                 float integral;
                 float animationTime = std::modf(m_WallclockTime / duration, &integral) * duration;
                 (void)anim->Apply(animationTime);
+
+                // The bounds are from the previous frame, which covers the area where the animated node was last captured
+                for (const auto& channel : anim->GetChannels())
+                {
+                    if (auto node = channel->GetTargetNode())
+                        m_LightProbeScheduler->InvalidateBounds(node->GetGlobalBoundingBox(), c_LightProbeInvalidationMargin);
+                }
             }
         }
     }
@@ -554,19 +1076,26 @@ public:
     virtual void SceneUnloading() override
     {
         if (m_ForwardPass) m_ForwardPass->ResetBindingCache();
+        if (m_OitPass) m_OitPass->ResetBindingCache();
         if (m_DeferredLightingPass) m_DeferredLightingPass->ResetBindingCache();
+        if (m_LightCulling) m_LightCulling->ResetBindingCache();
         if (m_GBufferPass) m_GBufferPass->ResetBindingCache();
         if (m_LightProbePass) m_LightProbePass->ResetCaches();
         if (m_ShadowDepthPass) m_ShadowDepthPass->ResetBindingCache();
         m_BindingCache.Clear();
         m_SunLight.reset();
+        CancelReadbacks();
         m_ui.SelectedMaterial = nullptr;
         m_ui.SelectedNode = nullptr;
+        m_StreamingMaterials.clear();
+        m_SceneStreaming = false;
+        if (m_TextureStreamer) m_TextureStreamer->Clear();
 
         for (auto probe : m_LightProbes)
         {
             probe->enabled = false;
         }
+        m_LightProbeScheduler->SetProbes(m_LightProbes);
     }
 
     virtual bool LoadScene(std::shared_ptr<IFileSystem> fs, const std::filesystem::path& fileName) override
@@ -578,7 +1107,7 @@ public:
 
         auto startTime = high_resolution_clock::now();
 
-        if (scene->Load(fileName))
+        if (scene->LoadWithThreadPool(fileName, m_LoadingThreadPool.get()))
         {
             m_Scene = std::move(scene);
 
@@ -595,11 +1124,27 @@ public:
     virtual void SceneLoaded() override
     {
         Super::SceneLoaded();
-        
+
+        if (m_SceneStreaming)
+        {
+            // The scene has been rendering since its geometry was loaded, keep the camera.
+            // The streamer keeps writing the larger mips after this.
+            UpdateStreamingMaterials();
+            return;
+        }
+
+        InitializeLoadedScene();
+    }
+
+    void InitializeLoadedScene()
+    {
         m_Scene->FinishedLoading(GetFrameIndex());
 
         m_WallclockTime = 0.f;
         m_PreviousViewsValid = false;
+        if (m_GpuCulling)
+            m_GpuCulling->InvalidateHiZ();
+        m_ShadowCache->SetScene(*m_Scene->GetSceneGraph());
 
         for (auto light : m_Scene->GetSceneGraph()->GetLights())
         {
@@ -648,10 +1193,138 @@ public:
 
         CopyActiveCameraToFirstPerson();
 
+        PlaceLightProbes();
+
         if (g_PrintSceneGraph)
             PrintSceneGraph(m_Scene->GetSceneGraph()->GetRootNode());
     }
 
+    // Returns the current textures of the material and whether all the textures it requested are resident
+    static bool GetResidentTextures(const Material& material, std::array<nvrhi::TextureHandle, 6>& outTextures)
+    {
+        const std::shared_ptr<LoadedTexture>* textures[] = {
+            &material.baseOrDiffuseTexture,
+            &material.metalRoughOrSpecularTexture,
+            &material.normalTexture,
+            &material.emissiveTexture,
+            &material.occlusionTexture,
+            &material.transmissionTexture
+        };
+
+        bool allResident = true;
+        for (size_t index = 0; index < outTextures.size(); ++index)
+        {
+            const std::shared_ptr<LoadedTexture>& texture = *textures[index];
+            outTextures[index] = texture ? texture->texture : nullptr;
+            if (texture && !texture->texture)
+                allResident = false;
+        }
+        return allResident;
+    }
+
+    void BeginSceneStreaming()
+    {
+        InitializeLoadedScene();
+
+        for (const auto& material : m_Scene->GetSceneGraph()->GetMaterials())
+            m_StreamingMaterials.push_back({ material, {} });
+
+        m_SceneStreaming = true;
+        UpdateStreamingMaterials();
+    }
+
+    // Textures are finalized by the texture cache under its per-frame time limit, DDS files with a mip chain only with their
+    // mip tail, which the texture streamer then replaces with more resident mips over time. When a material gets new textures, its constants
+    // and binding sets have to be rebuilt because they were created with the fallback or the previous textures.
+    void UpdateStreamingMaterials()
+    {
+        bool anyMaterialChanged = false;
+        const bool streamerIdle = !m_TextureStreamer || m_TextureStreamer->IsIdle();
+
+        for (size_t index = 0; index < m_StreamingMaterials.size(); )
+        {
+            StreamingMaterial& entry = m_StreamingMaterials[index];
+
+            std::array<nvrhi::TextureHandle, 6> textures;
+            const bool allResident = GetResidentTextures(*entry.material, textures);
+            const bool texturesChanged = !std::equal(textures.begin(), textures.end(), entry.textures.begin(),
+                [](const nvrhi::TextureHandle& a, const nvrhi::TextureHandle& b) { return a.Get() == b.Get(); });
+            if (texturesChanged)
+            {
+                entry.textures = std::move(textures);
+                entry.material->dirty = true;
+                anyMaterialChanged = true;
+            }
+
+            // Materials don't need to be tracked anymore when all their textures are resident with all mips
+            if (allResident && streamerIdle)
+            {
+                entry = std::move(m_StreamingMaterials.back());
+                m_StreamingMaterials.pop_back();
+            }
+            else
+                ++index;
+        }
+
+        if (anyMaterialChanged)
+        {
+            if (m_ForwardPass) m_ForwardPass->ResetBindingCache();
+            if (m_OitPass) m_OitPass->ResetBindingCache();
+            if (m_GBufferPass) m_GBufferPass->ResetBindingCache();
+            if (m_ShadowDepthPass) m_ShadowDepthPass->ResetBindingCache();
+            if (m_MaterialIDPass) m_MaterialIDPass->ResetBindingCache();
+            // Alpha tested materials may have received their opacity textures
+            m_ShadowCache->Invalidate();
+        }
+    }
+
+    [[nodiscard]] bool IsSceneStreaming() const
+    {
+        return m_SceneStreaming;
+    }
+
+    [[nodiscard]] bool IsStreamingTextures() const
+    {
+        return m_SceneStreaming && (!m_StreamingMaterials.empty() || (m_TextureStreamer && !m_TextureStreamer->IsIdle()));
+    }
+
+    [[nodiscard]] const TextureStreamer* GetTextureStreamer() const
+    {
+        return m_TextureStreamer.get();
+    }
+
+    // Picks up the textures whose mip tails the texture cache has finalized, and writes the pending mips of this frame
+    void StreamTextures()
+    {
+        if (m_TextureStreamer->IsIdle())
+            return;
+
+        m_StreamingCommandList->open();
+        m_StreamingCommandList->beginMarker("Texture Streaming");
+
+        m_TextureStreamer->Update(m_StreamingCommandList, *m_TextureCache);
+
+        m_StreamingCommandList->endMarker();
+        m_StreamingCommandList->close();
+        GetDevice()->executeCommandList(m_StreamingCommandList);
+    }
+
+    virtual void Render(nvrhi::IFramebuffer* framebuffer) override
+    {
+        if (m_TextureStreamer)
+            StreamTextures();
+
+        if (m_SceneStreaming && IsSceneLoaded())
+            UpdateStreamingMaterials();
+
+        Super::Render(framebuffer);
+    }
+
+    [[nodiscard]] size_t GetNumStreamingMaterials() const
+    {
+        return m_StreamingMaterials.size();
+    }
+
     void PointThirdPersonCameraAt(const std::shared_ptr<SceneGraphNode>& node)
     {
         dm::box3 bounds = node->GetGlobalBoundingBox();
@@ -667,6 +1340,13 @@ public:
         return m_ui.Stereo;
     }
 
+    // The G-buffer and material ID passes render both eyes with one draw per item through single-pass stereo.
+    // The forward and depth passes of donut have no stereo shaders, they use the shared stereo draw list.
+    bool IsSinglePassStereo()
+    {
+        return IsStereo() && m_ui.SinglePassStereo && m_ui.SinglePassStereoSupported;
+    }
+
     std::shared_ptr<TextureCache> GetTextureCache()
     {
         return m_TextureCache;
@@ -735,12 +1415,20 @@ public:
                 stereoView->LeftView.SetMatrices(leftView, projection);
 
                 affine3 rightView = leftView;
-                rightView.m_translation -= float3(0.2f, 0, 0);
+                rightView.m_translation -= float3(c_StereoEyeSeparation, 0, 0);
                 stereoView->RightView.SetMatrices(rightView, projection);
+
+                // Centered between the eyes, and moved back until the horizontal field of view covers both
+                const float tanHalfFovX = tanf(verticalFov * 0.5f) * renderTargetSize.x / renderTargetSize.y * 0.5f;
+                affine3 cullingView = leftView;
+                cullingView.m_translation += float3(-c_StereoEyeSeparation * 0.5f, 0.f, c_StereoEyeSeparation * 0.5f / tanHalfFovX);
+                m_StereoCullingView.SetViewport(nvrhi::Viewport(renderTargetSize.x * 0.5f, renderTargetSize.y));
+                m_StereoCullingView.SetMatrices(cullingView, projection);
             }
 
             stereoView->LeftView.UpdateCache();
             stereoView->RightView.UpdateCache();
+            m_StereoCullingView.UpdateCache();
 
             m_ThirdPersonCamera.SetView(stereoView->LeftView);
 
@@ -760,12 +1448,18 @@ public:
 
             float4x4 projection = perspProjD3DStyleReverse(verticalFov, renderTargetSize.x / renderTargetSize.y, zNear);
 
-            planarView->SetViewport(nvrhi::Viewport(renderTargetSize.x, renderTargetSize.y));
+            // With dynamic resolution, the scene is rendered into the top left corner of the render targets
+            const float2 renderSize = float2(DynamicResolutionController::GetRenderSize(m_RenderTargets->GetSize(), m_ResolutionScale));
+            planarView->SetViewport(nvrhi::Viewport(renderSize.x, renderSize.y));
             planarView->SetPixelOffset(pixelOffset);
 
             planarView->SetMatrices(viewMatrix, projection);
             planarView->UpdateCache();
 
+            m_OutputView.SetViewport(nvrhi::Viewport(renderTargetSize.x, renderTargetSize.y));
+            m_OutputView.SetMatrices(viewMatrix, projection);
+            m_OutputView.UpdateCache();
+
             m_ThirdPersonCamera.SetView(*planarView);
 
             if (topologyChanged)
@@ -777,18 +1471,24 @@ public:
         return topologyChanged;
     }
 
-    void CreateRenderPasses(bool& exposureResetRequired)
+    // The material passes create their pipelines lazily and keep them, and they don't reference the render targets.
+    // They only need to be re-created when the shaders are reloaded or the sample count changes, not on every resize.
+    void CreateMaterialPasses()
     {
-        uint32_t motionVectorStencilMask = 0x01;
-        
         ForwardShadingPass::CreateParameters ForwardParams;
         ForwardParams.trackLiveness = false;
         m_ForwardPass = std::make_unique<ForwardShadingPass>(GetDevice(), m_CommonPasses);
         m_ForwardPass->Init(*m_ShaderFactory, ForwardParams);
+
+        m_OitPass = std::make_shared<OitForwardShadingPass>(GetDevice(), m_CommonPasses);
+        m_OitPass->Init(*m_ShaderFactory, ForwardParams);
         
+        m_SinglePassStereoActive = IsSinglePassStereo();
+
         GBufferFillPass::CreateParameters GBufferParams;
+        GBufferParams.enableSinglePassStereo = m_SinglePassStereoActive;
         GBufferParams.enableMotionVectors = true;
-        GBufferParams.stencilWriteMask = motionVectorStencilMask;
+        GBufferParams.stencilWriteMask = c_MotionVectorStencilMask;
         m_GBufferPass = std::make_unique<GBufferFillPass>(GetDevice(), m_CommonPasses);
         m_GBufferPass->Init(*m_ShaderFactory, GBufferParams);
 
@@ -796,12 +1496,37 @@ public:
         m_MaterialIDPass = std::make_unique<MaterialIDPass>(GetDevice(), m_CommonPasses);
         m_MaterialIDPass->Init(*m_ShaderFactory, GBufferParams);
 
-        m_PixelReadbackPass = std::make_unique<PixelReadbackPass>(GetDevice(), m_ShaderFactory, m_RenderTargets->MaterialIDs, nvrhi::Format::RGBA32_UINT);
-        m_MipMapGenPass = std::make_unique <MipMapGenPass>(GetDevice(), m_ShaderFactory, m_RenderTargets->ResolvedColor, MipMapGenPass::Mode::MODE_COLOR);
-
         m_DeferredLightingPass = std::make_unique<DeferredLightingPass>(GetDevice(), m_CommonPasses);
         m_DeferredLightingPass->Init(m_ShaderFactory);
 
+        m_LightProbePass = std::make_shared<LightProbeProcessingPass>(GetDevice(), m_ShaderFactory, m_CommonPasses);
+        m_EnvironmentBrdfRendered = false;
+
+        // Light probe faces are rendered one at a time, as planar views
+        m_LightProbeForwardPass = std::make_shared<ForwardShadingPass>(GetDevice(), m_CommonPasses);
+        m_LightProbeForwardPass->Init(*m_ShaderFactory, ForwardShadingPass::CreateParameters());
+        for (uint32_t target = 0; target < LightProbeScheduler::c_NumCaptureTargets; target++)
+        {
+            m_LightProbeSkyPasses[target] = std::make_unique<SkyPass>(GetDevice(), m_ShaderFactory, m_CommonPasses,
+                m_LightProbeScheduler->GetCaptureFramebuffer(target), m_LightProbeScheduler->GetReferenceFaceView());
+        }
+
+        m_GpuCulling = std::make_unique<GpuCulling>(GetDevice(), *m_ShaderFactory, c_NumGpuCullingSlots);
+        m_TransparentGpuCulling = std::make_unique<GpuCulling>(GetDevice(), *m_ShaderFactory, c_NumTransparentGpuCullingSlots, GpuCulling::Domains::Transparent);
+        m_TransparencySort = std::make_unique<TransparencySort>(GetDevice(), *m_ShaderFactory);
+        m_LightCulling = std::make_unique<LightCulling>(GetDevice(), *m_ShaderFactory);
+    }
+
+    void CreateRenderPasses(bool& exposureResetRequired)
+    {
+        // The pending picks refer to the old passes
+        CancelReadbacks();
+        for (auto& pickReadbackPass : m_PickReadbackPasses)
+            pickReadbackPass = std::make_unique<PixelReadbackPass>(GetDevice(), m_ShaderFactory, m_RenderTargets->MaterialIDs, nvrhi::Format::RGBA32_UINT);
+        m_OitCompositePass = std::make_unique<OitCompositePass>(GetDevice(), *m_ShaderFactory,
+            m_RenderTargets->OitAccumulation, m_RenderTargets->OitRevealage, m_RenderTargets->HdrFramebuffer);
+        m_MipMapGenPass = std::make_unique <MipMapGenPass>(GetDevice(), m_ShaderFactory, m_RenderTargets->ResolvedColor, MipMapGenPass::Mode::MODE_COLOR);
+
         m_SkyPass = std::make_unique<SkyPass>(GetDevice(), m_ShaderFactory, m_CommonPasses, m_RenderTargets->ForwardFramebuffer, *m_View);
         
         {
@@ -812,7 +1537,7 @@ public:
             taaParams.resolvedColor = m_RenderTargets->ResolvedColor;
             taaParams.feedback1 = m_RenderTargets->TemporalFeedback1;
             taaParams.feedback2 = m_RenderTargets->TemporalFeedback2;
-            taaParams.motionVectorStencilMask = motionVectorStencilMask;
+            taaParams.motionVectorStencilMask = c_MotionVectorStencilMask;
             taaParams.useCatmullRomFilter = true;
 
             m_TemporalAntiAliasingPass = std::make_unique<TemporalAntiAliasingPass>(GetDevice(), m_ShaderFactory, m_CommonPasses, *m_View, taaParams);
@@ -823,8 +1548,6 @@ public:
             m_SsaoPass = std::make_unique<SsaoPass>(GetDevice(), m_ShaderFactory, m_CommonPasses, m_RenderTargets->Depth, m_RenderTargets->GBufferNormals, m_RenderTargets->AmbientOcclusion);
         }
 
-        m_LightProbePass = std::make_shared<LightProbeProcessingPass>(GetDevice(), m_ShaderFactory, m_CommonPasses);
-
         nvrhi::BufferHandle exposureBuffer = nullptr;
         if (m_ToneMappingPass)
             exposureBuffer = m_ToneMappingPass->GetExposureBuffer();
@@ -836,7 +1559,7 @@ public:
         m_ToneMappingPass = std::make_unique<ToneMappingPass>(GetDevice(), m_ShaderFactory, m_CommonPasses, m_RenderTargets->LdrFramebuffer, *m_View, toneMappingParams);
 
         m_BloomPass = std::make_unique<BloomPass>(GetDevice(), m_ShaderFactory, m_CommonPasses, m_RenderTargets->ResolvedFramebuffer, *m_View);
-        
+
 #if DONUT_WITH_DLSS
         if (m_DLSS)
         {
@@ -857,6 +1580,17 @@ public:
 
     virtual void RenderSplashScreen(nvrhi::IFramebuffer* framebuffer) override
     {
+        // The application keeps showing the splash screen until all textures are finalized.
+        // In streaming mode, render the scene with what is resident instead, as soon as the geometry is loaded.
+        if (g_StreamingLoad && IsSceneLoaded() && m_Scene)
+        {
+            if (!m_SceneStreaming)
+                BeginSceneStreaming();
+
+            RenderScene(framebuffer);
+            return;
+        }
+
         nvrhi::ITexture* framebufferTexture = framebuffer->getDesc().colorAttachments[0].texture;
         m_CommandList->open();
         m_CommandList->clearTextureFloat(framebufferTexture, nvrhi::AllSubresources, nvrhi::Color(0.f));
@@ -865,12 +1599,179 @@ public:
         GetDeviceManager()->SetVsyncEnabled(true);
     }
 
-    virtual void RenderScene(nvrhi::IFramebuffer* framebuffer) override
+    // Renders the opaque geometry of a pass either with the CPU draw strategy or with GPU culling and indirect draws.
+    // Only the shadow cascade and G-buffer workers call this from other threads, with their own draw strategies and view slots.
+    void RenderOpaqueCompositeView(
+        nvrhi::ICommandList* commandList,
+        const ICompositeView* compositeView,
+        const ICompositeView* compositeViewPrev,
+        FramebufferFactory& framebufferFactory,
+        IDrawStrategy& drawStrategy,
+        IGeometryPass& pass,
+        GpuCulling::BaseLocations baseLocations,
+        GeometryPassContext& passContext,
+        const char* passEvent,
+        uint32_t cullingViewSlot,
+        bool enableOcclusion)
     {
-        int windowWidth, windowHeight;
-        GetDeviceManager()->GetWindowDimensions(windowWidth, windowHeight);
-        nvrhi::Viewport windowViewport = nvrhi::Viewport(float(windowWidth), float(windowHeight));
-        nvrhi::Viewport renderViewport = windowViewport;
+        if (m_GpuCullingActive)
+        {
+            m_GpuCulling->RenderCompositeView(commandList,
+                compositeView, compositeViewPrev,
+                framebufferFactory,
+                cullingViewSlot,
+                pass,
+                baseLocations,
+                passContext,
+                passEvent,
+                enableOcclusion,
+                m_ui.EnableMaterialEvents,
+                &m_StereoCullingView);
+        }
+        else
+        {
+            RenderSceneCompositeView(commandList,
+                compositeView, compositeViewPrev,
+                framebufferFactory,
+                m_Scene->GetSceneGraph()->GetRootNode(),
+                drawStrategy,
+                pass,
+                passContext,
+                passEvent,
+                m_ui.EnableMaterialEvents);
+        }
+    }
+
+    // RenderCompositeView for the camera views. With a shared stereo draw list, the draw strategy walks the scene once
+    // for a view that contains both eyes, and every eye renders the same items. Passes that support stereo views
+    // render both eyes with one draw per item, the others still need separate draws per eye.
+    void RenderSceneCompositeView(
+        nvrhi::ICommandList* commandList,
+        const ICompositeView* compositeView,
+        const ICompositeView* compositeViewPrev,
+        FramebufferFactory& framebufferFactory,
+        const std::shared_ptr<SceneGraphNode>& rootNode,
+        IDrawStrategy& drawStrategy,
+        IGeometryPass& pass,
+        GeometryPassContext& passContext,
+        const char* passEvent,
+        bool materialEvents)
+    {
+        const ViewType::Enum viewTypes = pass.GetSupportedViewTypes();
+        const uint32_t numChildViews = compositeView->GetNumChildViews(viewTypes);
+        const bool singlePassStereo = numChildViews == 1 && compositeView->GetChildView(viewTypes, 0)->IsStereoView();
+
+        // The frustum of the stereo view may not contain both eyes, so single-pass stereo always culls for the culling view
+        if (!IsStereo() || compositeView != m_View.get() || !(m_ui.StereoSharedDrawList || singlePassStereo))
+        {
+            RenderCompositeView(commandList, compositeView, compositeViewPrev, framebufferFactory, rootNode,
+                drawStrategy, pass, passContext, passEvent, materialEvents);
+            return;
+        }
+
+        if (passEvent)
+            commandList->beginMarker(passEvent);
+
+        // Different passes may be recorded on different threads, each with its own draw strategy
+        std::vector<DrawItem> drawItems;
+        drawStrategy.PrepareForView(rootNode, m_StereoCullingView);
+        while (const DrawItem* item = drawStrategy.GetNextItem())
+            drawItems.push_back(*item);
+
+        PassthroughDrawStrategy passthroughStrategy;
+        for (uint32_t viewIndex = 0; viewIndex < numChildViews; viewIndex++)
+        {
+            const IView* view = compositeView->GetChildView(viewTypes, viewIndex);
+            const IView* viewPrev = compositeViewPrev ? compositeViewPrev->GetChildView(viewTypes, viewIndex) : nullptr;
+
+            passthroughStrategy.SetData(drawItems.data(), drawItems.size());
+
+            RenderView(commandList, view, viewPrev, framebufferFactory.GetFramebuffer(*view),
+                passthroughStrategy, pass, passContext, materialEvents);
+        }
+
+        if (passEvent)
+            commandList->endMarker();
+    }
+
+    void RecordShadowCascade(uint32_t cascade)
+    {
+        nvrhi::ICommandList* commandList = m_ShadowCommandLists[cascade];
+        commandList->open();
+
+        char passName[32];
+        snprintf(passName, std::size(passName), "ShadowMap Cascade %u", cascade);
+
+        m_PassTimers->BeginPass(commandList, GpuPass::ShadowMap, cascade);
+
+        DepthPass::Context context;
+
+        RenderOpaqueCompositeView(commandList,
+            m_ShadowMap->GetView().GetChildView(ViewType::PLANAR, cascade), nullptr,
+            *m_ShadowCascadeFramebuffers[cascade],
+            m_ShadowDrawStrategies[cascade],
+            *m_ShadowDepthPass,
+            c_DepthPassBaseLocations,
+            context,
+            passName,
+            c_GpuCullingShadowSlot + cascade,
+            false);
+
+        m_PassTimers->EndPass(commandList, GpuPass::ShadowMap, cascade);
+
+        commandList->close();
+    }
+
+    void RecordGBufferFill()
+    {
+        nvrhi::ICommandList* commandList = m_GBufferCommandList;
+        commandList->open();
+
+        m_PassTimers->BeginPass(commandList, GpuPass::GBufferFill);
+
+        GBufferFillPass::Context gbufferContext;
+
+        RenderOpaqueCompositeView(commandList,
+            m_View.get(), m_ViewPrevious.get(),
+            *m_RenderTargets->GBufferFramebuffer,
+            m_GBufferDrawStrategy,
+            *m_GBufferPass,
+            c_GBufferPassBaseLocations,
+            gbufferContext,
+            "GBufferFill",
+            c_GpuCullingCameraSlot,
+            m_ui.EnableOcclusionCulling);
+
+        m_PassTimers->EndPass(commandList, GpuPass::GBufferFill);
+
+        commandList->close();
+    }
+
+    void RecordCameraPathKeyframe()
+    {
+        if (m_LastRecordedKeyframeTime >= 0.f && m_RecordingTime - m_LastRecordedKeyframeTime < c_CameraPathRecordInterval)
+            return;
+
+        dm::affine3 viewToWorld = m_View->GetChildView(ViewType::PLANAR, 0)->GetInverseViewMatrix();
+
+        CameraPathKeyframe keyframe;
+        keyframe.time = m_RecordingTime;
+        keyframe.position = viewToWorld.m_translation;
+        keyframe.direction = normalize(viewToWorld.m_linear.row2);
+        keyframe.up = normalize(viewToWorld.m_linear.row1);
+        m_RecordedCameraPath.AddKeyframe(keyframe);
+
+        m_LastRecordedKeyframeTime = m_RecordingTime;
+    }
+
+    virtual void RenderScene(nvrhi::IFramebuffer* framebuffer) override
+    {
+        auto renderStartTime = std::chrono::high_resolution_clock::now();
+
+        int windowWidth, windowHeight;
+        GetDeviceManager()->GetWindowDimensions(windowWidth, windowHeight);
+        nvrhi::Viewport windowViewport = nvrhi::Viewport(float(windowWidth), float(windowHeight));
+        nvrhi::Viewport renderViewport = windowViewport;
 
         m_Scene->RefreshSceneGraph(GetFrameIndex());
 
@@ -890,9 +1791,13 @@ public:
             }
 
             bool needNewPasses = false;
+            bool needNewMaterialPasses = !m_ForwardPass;
 
             if (!m_RenderTargets || m_RenderTargets->IsUpdateRequired(uint2(width, height), sampleCount))
             {
+                if (!m_RenderTargets || m_RenderTargets->GetSampleCount() != sampleCount)
+                    needNewMaterialPasses = true;
+
                 m_RenderTargets = nullptr;
                 m_BindingCache.Clear();
                 m_RenderTargets = std::make_unique<RenderTargets>();
@@ -901,15 +1806,37 @@ public:
                 needNewPasses = true;
             }
 
+            // The render targets keep the window size, only the viewport of the scene changes, and TAA or DLSS upscale it
+            m_DynamicResolutionActive = m_ui.EnableDynamicResolution && !IsStereo() &&
+                (m_ui.AntiAliasingMode == AntiAliasingMode::TEMPORAL || m_ui.AntiAliasingMode == AntiAliasingMode::DLSS);
+            if (!m_DynamicResolutionActive)
+                m_DynamicResolution.Reset();
+            m_ResolutionScale = m_DynamicResolution.GetScale();
+
             if (SetupView())
             {
                 needNewPasses = true;
             }
 
+            if (IsSinglePassStereo() != m_SinglePassStereoActive)
+                needNewMaterialPasses = true;
+
             if (m_ui.ShaderReoladRequested)
             {
                 m_ShaderFactory->ClearCache();
                 needNewPasses = true;
+                needNewMaterialPasses = true;
+            }
+
+            if (needNewMaterialPasses)
+            {
+                CreateMaterialPasses();
+            }
+            else if (needNewPasses)
+            {
+                // The kept passes may have binding sets that reference the previous render targets
+                m_DeferredLightingPass->ResetBindingCache();
+                m_LightCulling->ResetBindingCache();
             }
 
             if(needNewPasses)
@@ -920,15 +1847,67 @@ public:
             m_ui.ShaderReoladRequested = false;
         }
 
+        if (!g_Benchmark.recordCameraPathFile.empty())
+            RecordCameraPathKeyframe();
+
+        // Dynamic resolution is driven by the frame timer
+        if (m_ui.EnablePassTimers || m_DynamicResolutionActive)
+        {
+            FrameTimings resolvedTimings;
+            uint64_t frameIndex = g_Benchmark.enabled ? m_BenchmarkFrame : GetFrameIndex();
+            m_DynamicResolution.RecordFrame(frameIndex, m_ResolutionScale);
+            if (m_PassTimers->BeginFrame(frameIndex, resolvedTimings))
+                OnFrameTimingsResolved(resolvedTimings);
+        }
+
+        // With parallel recording, the frame is submitted as: setup list, shadow cascade lists, G-buffer list, main list.
+        // With async compute, it is: setup list, G-buffer list, SSAO list on the compute queue, shadow list, main list;
+        // the shadow maps are rendered while the compute queue works on SSAO, and the main list waits for it.
+        // Everything that the worker lists depend on is recorded into the setup list.
+        const bool parallelRecording = m_ui.EnableParallelRecording && m_ThreadPool;
+        const bool asyncCompute = m_ui.EnableAsyncCompute && m_ui.AsyncComputeAvailable && m_ui.UseDeferredShading;
+        const bool cachedShadows = m_ui.EnableShadows && m_ui.EnableShadowCache;
+        const bool parallelShadows = parallelRecording && m_ui.EnableShadows && !cachedShadows && !asyncCompute;
+        const bool parallelGBuffer = parallelRecording && m_ui.UseDeferredShading;
+        const bool separateSetup = parallelRecording || asyncCompute;
+        nvrhi::ICommandList* setupCommandList = separateSetup ? m_SetupCommandList.Get() : m_CommandList.Get();
+        nvrhi::ICommandList* shadowCommandList = asyncCompute ? m_AsyncShadowCommandList.Get()
+            : cachedShadows ? setupCommandList : m_CommandList.Get();
+
+        if (separateSetup)
+            m_SetupCommandList->open();
+        if (asyncCompute)
+            m_AsyncShadowCommandList->open();
         m_CommandList->open();
+        m_PassTimers->BeginPass(setupCommandList, GpuPass::Frame);
+
+        m_Scene->RefreshBuffers(setupCommandList, GetFrameIndex());
+
+        // The worker threads read this flag, it must not change until the frame is submitted
+        m_GpuCullingActive = m_ui.EnableGpuCulling && m_GpuCulling;
+        if (m_GpuCullingActive && m_GpuCulling->Update(setupCommandList, *m_Scene, m_RenderTargets->Depth))
+        {
+            // The culled draws use their own buffer groups, drop the input binding sets that reference the previous ones
+            m_ForwardPass->ResetBindingCache();
+            m_GBufferPass->ResetBindingCache();
+            m_ShadowDepthPass->ResetBindingCache();
+        }
 
-        m_Scene->RefreshBuffers(m_CommandList, GetFrameIndex());
+        // The transparent geometry is only GPU culled for OIT, the sorted modes need the draws in order.
+        // Its Hi-Z pyramid is never built, so those draws are only frustum culled.
+        const bool transparentGpuCulling = m_GpuCullingActive && m_ui.EnableTranslucency && m_ui.Transparency == TransparencyMode::OrderIndependent;
+        if (transparentGpuCulling && m_TransparentGpuCulling->Update(setupCommandList, *m_Scene, m_RenderTargets->Depth))
+            m_OitPass->ResetBindingCache();
 
         nvrhi::ITexture* framebufferTexture = framebuffer->getDesc().colorAttachments[0].texture;
-        m_CommandList->clearTextureFloat(framebufferTexture, nvrhi::AllSubresources, nvrhi::Color(0.f));
+        setupCommandList->clearTextureFloat(framebufferTexture, nvrhi::AllSubresources, nvrhi::Color(0.f));
         
         m_AmbientTop = m_ui.AmbientIntensity * m_ui.SkyParams.skyColor * m_ui.SkyParams.brightness;
         m_AmbientBottom = m_ui.AmbientIntensity * m_ui.SkyParams.groundColor * m_ui.SkyParams.brightness;
+
+        if (m_ui.EnableLightProbe)
+            UpdateLightProbes(setupCommandList);
+
         if (m_ui.EnableShadows)
         {
             m_SunLight->shadowMap = m_ShadowMap;
@@ -940,105 +1919,232 @@ public:
             dm::affine3 viewMatrixInv = m_View->GetChildView(ViewType::PLANAR, 0)->GetInverseViewMatrix();
 
             float zRange = length(sceneBounds.diagonal());
+            if (cachedShadows)
+            {
+                // Moving objects change the scene bounds, round the range up so that the cascades keep their depth mapping
+                const float zRangeStep = 16.f;
+                zRange = std::ceil(zRange / zRangeStep) * zRangeStep;
+            }
             m_ShadowMap->SetupForPlanarViewStable(*m_SunLight, projectionFrustum, viewMatrixInv, maxShadowDistance, zRange, zRange, m_ui.CsmExponent);
 
-            m_ShadowMap->Clear(m_CommandList);
-
-            DepthPass::Context context;
+            if (cachedShadows)
+            {
+                // The cascades rendered without the cache don't match its contents.
+                // Cached cascades are always drawn from CPU side lists, the culled GPU draws can't be split into static and dynamic.
+                if (!m_ShadowCacheActive)
+                    m_ShadowCache->Invalidate();
+
+                ShadowCache::Settings& settings = m_ShadowCache->GetSettings();
+                settings.enableScrolling = m_ui.EnableShadowCacheScrolling;
+                settings.reducedRateFirstCascade = uint32_t(m_ui.ShadowCacheReducedRateCascade);
+                settings.reducedRateInterval = uint32_t(m_ui.ShadowCacheReducedRateInterval);
+
+                m_PassTimers->BeginPass(shadowCommandList, GpuPass::ShadowMap);
+                m_ShadowCache->Render(shadowCommandList, *m_ShadowMap, m_Scene->GetSceneGraph()->GetRootNode(), *m_ShadowDepthPass, m_ui.EnableMaterialEvents);
+                m_PassTimers->EndPass(shadowCommandList, GpuPass::ShadowMap);
+            }
+            else if (parallelShadows)
+            {
+                // Every cascade is timed in its own list, the clear is the last section of the pass
+                m_PassTimers->BeginPass(setupCommandList, GpuPass::ShadowMap, c_NumShadowCascades);
+                m_ShadowMap->Clear(setupCommandList);
+                m_PassTimers->EndPass(setupCommandList, GpuPass::ShadowMap, c_NumShadowCascades);
 
-            RenderCompositeView(m_CommandList, 
-                &m_ShadowMap->GetView(), nullptr, 
-                *m_ShadowFramebuffer,
-                m_Scene->GetSceneGraph()->GetRootNode(),
-                *m_OpaqueDrawStrategy, 
-                *m_ShadowDepthPass,
-                context,
-                "ShadowMap",
-                m_ui.EnableMaterialEvents);
+                for (uint32_t cascade = 0; cascade < c_NumShadowCascades; cascade++)
+                {
+                    m_ThreadPool->AddTask([this, cascade]() { RecordShadowCascade(cascade); });
+                }
+            }
+            else
+            {
+                m_PassTimers->BeginPass(shadowCommandList, GpuPass::ShadowMap);
+                m_ShadowMap->Clear(shadowCommandList);
+
+                DepthPass::Context context;
+
+                RenderOpaqueCompositeView(shadowCommandList, 
+                    &m_ShadowMap->GetView(), nullptr, 
+                    *m_ShadowFramebuffer,
+                    *m_OpaqueDrawStrategy, 
+                    *m_ShadowDepthPass,
+                    c_DepthPassBaseLocations,
+                    context,
+                    "ShadowMap",
+                    c_GpuCullingShadowSlot,
+                    false);
+                
+                m_PassTimers->EndPass(shadowCommandList, GpuPass::ShadowMap);
+            }
         }
         else
         {
             m_SunLight->shadowMap = nullptr;
         }
+        m_ShadowCacheActive = cachedShadows;
+
+        if (asyncCompute)
+            m_AsyncShadowCommandList->close();
 
         std::vector<std::shared_ptr<LightProbe>> lightProbes;
         if (m_ui.EnableLightProbe)
         {
-            for (auto probe : m_LightProbes)
+            lightProbes = m_LightProbeScheduler->GetClosestProbes(m_View->GetViewOrigin(), c_MaxActiveLightProbes);
+            for (auto probe : lightProbes)
             {
-                if (probe->enabled)
-                {
-                    probe->diffuseScale = m_ui.LightProbeDiffuseScale;
-                    probe->specularScale = m_ui.LightProbeSpecularScale;
-                    lightProbes.push_back(probe);
-                }
+                probe->diffuseScale = m_ui.LightProbeDiffuseScale;
+                probe->specularScale = m_ui.LightProbeSpecularScale;
             }
         }
 
-        m_RenderTargets->Clear(m_CommandList);
+        m_RenderTargets->Clear(setupCommandList);
 
+        // The main list is ordered after the exposure computation of the previous frame on the compute queue
         if (exposureResetRequired)
             m_ToneMappingPass->ResetExposure(m_CommandList, 0.5f);
 
+        if (parallelGBuffer)
+        {
+            m_ThreadPool->AddTask([this]() { RecordGBufferFill(); });
+        }
+        else if (asyncCompute)
+        {
+            RecordGBufferFill();
+        }
+
+        if (separateSetup)
+            m_SetupCommandList->close();
+
+        // With tiled lighting, the deferred pass only shades the global lights and the local lights are added by LightCulling.
+        // The forward pass gets a prioritized subset of all lights because it can't use the tiles.
+        const bool tiledLighting = m_ui.EnableTiledLighting && m_LightCulling && !IsStereo();
+        const std::vector<std::shared_ptr<Light>>* forwardLights = &m_Scene->GetSceneGraph()->GetLights();
+        const std::vector<std::shared_ptr<Light>>* deferredLights = forwardLights;
+        if (tiledLighting)
+        {
+            m_LightCulling->PrepareLights(m_Scene->GetSceneGraph()->GetLights(), *m_View, c_MaxForwardLights);
+            forwardLights = &m_LightCulling->GetForwardLights();
+            deferredLights = &m_LightCulling->GetGlobalLights();
+        }
+
         ForwardShadingPass::Context forwardContext;
 
         if (!m_ui.UseDeferredShading || m_ui.EnableTranslucency)
         {
-            m_ForwardPass->PrepareLights(forwardContext, m_CommandList, m_Scene->GetSceneGraph()->GetLights(), m_AmbientTop, m_AmbientBottom, lightProbes);
+            m_ForwardPass->PrepareLights(forwardContext, m_CommandList, *forwardLights, m_AmbientTop, m_AmbientBottom, lightProbes);
         }
 
         if (m_ui.UseDeferredShading)
         {
-            GBufferFillPass::Context gbufferContext;
+            if (!parallelGBuffer && !asyncCompute)
+            {
+                GBufferFillPass::Context gbufferContext;
+
+                m_PassTimers->BeginPass(m_CommandList, GpuPass::GBufferFill);
+
+                RenderOpaqueCompositeView(m_CommandList,
+                    m_View.get(), m_ViewPrevious.get(), 
+                    *m_RenderTargets->GBufferFramebuffer, 
+                    *m_OpaqueDrawStrategy,
+                    *m_GBufferPass,
+                    c_GBufferPassBaseLocations,
+                    gbufferContext,
+                    "GBufferFill",
+                    c_GpuCullingCameraSlot,
+                    m_ui.EnableOcclusionCulling);
+
+                m_PassTimers->EndPass(m_CommandList, GpuPass::GBufferFill);
+            }
 
-            RenderCompositeView(m_CommandList,
-                m_View.get(), m_ViewPrevious.get(), 
-                *m_RenderTargets->GBufferFramebuffer, 
-                m_Scene->GetSceneGraph()->GetRootNode(),
-                *m_OpaqueDrawStrategy,
-                *m_GBufferPass,
-                gbufferContext,
-                "GBufferFill",
-                m_ui.EnableMaterialEvents);
+            // SSAO only reads the depth and normals, so it can run on the compute queue
+            nvrhi::ICommandList* ssaoCommandList = asyncCompute ? m_SsaoCommandList.Get() : m_CommandList.Get();
+            if (asyncCompute)
+                m_SsaoCommandList->open();
+
+            m_RenderTargets->BeginPhase(ssaoCommandList, FramePhase::Ssao);
 
             nvrhi::ITexture* ambientOcclusionTarget = nullptr;
             if (m_ui.EnableSsao && m_SsaoPass)
             {
-                m_SsaoPass->Render(m_CommandList, m_ui.SsaoParams, *m_View);
+                m_PassTimers->BeginPass(ssaoCommandList, GpuPass::Ssao);
+                m_SsaoPass->Render(ssaoCommandList, m_ui.SsaoParams, *m_View);
+                m_PassTimers->EndPass(ssaoCommandList, GpuPass::Ssao);
                 ambientOcclusionTarget = m_RenderTargets->AmbientOcclusion;
             }
 
+            if (asyncCompute)
+                m_SsaoCommandList->close();
+
             DeferredLightingPass::Inputs deferredInputs;
             deferredInputs.SetGBuffer(*m_RenderTargets);
             deferredInputs.ambientOcclusion = m_ui.EnableSsao ? m_RenderTargets->AmbientOcclusion : nullptr;
             deferredInputs.ambientColorTop = m_AmbientTop;
             deferredInputs.ambientColorBottom = m_AmbientBottom;
-            deferredInputs.lights = &m_Scene->GetSceneGraph()->GetLights();
-            deferredInputs.lightProbes = m_ui.EnableLightProbe ? &m_LightProbes : nullptr;
+            deferredInputs.lights = deferredLights;
+            deferredInputs.lightProbes = m_ui.EnableLightProbe ? &lightProbes : nullptr;
             deferredInputs.output = m_RenderTargets->HdrColor;
 
+            m_RenderTargets->BeginPhase(m_CommandList, FramePhase::Lighting);
+
+            m_PassTimers->BeginPass(m_CommandList, GpuPass::DeferredLighting);
             m_DeferredLightingPass->Render(m_CommandList, *m_View, deferredInputs);
+            if (tiledLighting && m_RenderTargets->GetSampleCount() == 1)
+            {
+                m_CommandList->beginMarker("TiledLighting");
+                m_LightCulling->CullLights(m_CommandList, *m_View, m_RenderTargets->Depth);
+                m_LightCulling->RenderDeferredLighting(m_CommandList, *m_RenderTargets, m_RenderTargets->HdrColor);
+                m_CommandList->endMarker();
+            }
+            m_PassTimers->EndPass(m_CommandList, GpuPass::DeferredLighting);
+
+            if (tiledLighting && m_RenderTargets->GetSampleCount() == 1 && m_LightCulling->GetNumLocalLights() > 0)
+            {
+                m_Readback->ReadBuffer(m_CommandList, m_LightCulling->GetStatsBuffer(), 0, LIGHT_CULLING_STAT_COUNT * sizeof(uint32_t),
+                    [this](const void* data, size_t size)
+                    {
+                        const auto* stats = static_cast<const uint32_t*>(data);
+                        m_LightCullingOverflowTiles = stats[LIGHT_CULLING_STAT_OVERFLOW_TILES];
+                        m_LightCullingMaxTileLights = stats[LIGHT_CULLING_STAT_MAX_TILE_LIGHTS];
+                    });
+            }
+            else
+            {
+                m_LightCullingOverflowTiles = 0;
+                m_LightCullingMaxTileLights = 0;
+            }
         }
         else
         {
-            RenderCompositeView(m_CommandList,
+            // Forward shading doesn't use the G-buffer or SSAO, but the targets of these phases still have to be started
+            m_RenderTargets->BeginPhase(m_CommandList, FramePhase::Ssao);
+            m_RenderTargets->BeginPhase(m_CommandList, FramePhase::Lighting);
+
+            m_PassTimers->BeginPass(m_CommandList, GpuPass::ForwardOpaque);
+
+            RenderOpaqueCompositeView(m_CommandList,
                 m_View.get(), m_ViewPrevious.get(),
                 *m_RenderTargets->ForwardFramebuffer,
-                m_Scene->GetSceneGraph()->GetRootNode(),
                 *m_OpaqueDrawStrategy,
                 *m_ForwardPass,
+                c_ForwardPassBaseLocations,
                 forwardContext,
                 "ForwardOpaque",
-                m_ui.EnableMaterialEvents);
+                c_GpuCullingCameraSlot,
+                m_ui.EnableOcclusionCulling);
+
+            m_PassTimers->EndPass(m_CommandList, GpuPass::ForwardOpaque);
         }
 
-        if(m_Pick)
+        // Every pick uses its own readback pass, so that a new pick can be issued while older ones are still in flight.
+        // If all of them are in flight, the pick is tried again in the next frame.
+        const uint32_t pickReadbackIndex = m_Pick ? FindFreePickReadback() : c_NumPickReadbacks;
+        if (pickReadbackIndex < c_NumPickReadbacks)
         {
-            m_CommandList->clearTextureUInt(m_RenderTargets->MaterialIDs, nvrhi::AllSubresources, 0xffff);
+            // Clears the material IDs to 0xffff
+            m_RenderTargets->BeginPhase(m_CommandList, FramePhase::MaterialId);
 
             MaterialIDPass::Context materialIdContext;
 
-            RenderCompositeView(m_CommandList, 
+            RenderSceneCompositeView(m_CommandList, 
                 m_View.get(), m_ViewPrevious.get(),
                 *m_RenderTargets->MaterialIDFramebuffer,
                 m_Scene->GetSceneGraph()->GetRootNode(),
@@ -1049,7 +2155,7 @@ public:
             
             if (m_ui.EnableTranslucency)
             {
-                RenderCompositeView(m_CommandList,
+                RenderSceneCompositeView(m_CommandList,
                     m_View.get(), m_ViewPrevious.get(),
                     *m_RenderTargets->MaterialIDFramebuffer,
                     m_Scene->GetSceneGraph()->GetRootNode(),
@@ -1059,7 +2165,39 @@ public:
                     "MaterialID - Translucent");
             }
 
-            m_PixelReadbackPass->Capture(m_CommandList, m_PickPosition);
+            // The material IDs are rendered at the dynamic resolution, the cursor position is in window pixels
+            const uint2 pickPosition = uint2(float2(m_PickPosition) * m_ResolutionScale);
+            m_PickReadbackPasses[pickReadbackIndex]->Capture(m_CommandList, pickPosition);
+
+            if (m_Readback->Notify([this, pickReadbackIndex]()
+                {
+                    m_PickReadbackPending[pickReadbackIndex] = false;
+                    PickResolved(m_PickReadbackPasses[pickReadbackIndex]->ReadUInts());
+                }))
+            {
+                m_PickReadbackPending[pickReadbackIndex] = true;
+                m_Pick = false;
+            }
+        }
+
+        if (m_GpuCullingActive && m_GpuCulling->GetNumDraws() == 0)
+        {
+            // Nothing to read back, a zero sized copy is not valid
+            m_VisibleGpuCullingRecords = 0;
+        }
+        else if (m_GpuCullingActive && m_GpuCulling->GetDrawArgumentsBuffer())
+        {
+            // Count the (instance, geometry) records that passed culling for the camera view, for the UI
+            m_Readback->ReadBuffer(m_CommandList, m_GpuCulling->GetDrawArgumentsBuffer(),
+                m_GpuCulling->GetDrawArgumentsOffset(c_GpuCullingCameraSlot),
+                m_GpuCulling->GetNumDraws() * sizeof(nvrhi::DrawIndexedIndirectArguments),
+                [this](const void* data, size_t size)
+                {
+                    const auto* arguments = static_cast<const nvrhi::DrawIndexedIndirectArguments*>(data);
+                    m_VisibleGpuCullingRecords = 0;
+                    for (size_t i = 0; i < size / sizeof(nvrhi::DrawIndexedIndirectArguments); i++)
+                        m_VisibleGpuCullingRecords += arguments[i].instanceCount;
+                });
         }
 
         if (m_ui.EnableProceduralSky)
@@ -1067,21 +2205,85 @@ public:
 
         if (m_ui.EnableTranslucency)
         {
-            RenderCompositeView(m_CommandList,
-                m_View.get(), m_ViewPrevious.get(),
-                *m_RenderTargets->ForwardFramebuffer,
-                m_Scene->GetSceneGraph()->GetRootNode(),
-                *m_TransparentDrawStrategy,
-                *m_ForwardPass,
-                forwardContext,
-                "ForwardTransparent",
-                m_ui.EnableMaterialEvents);
+            m_PassTimers->BeginPass(m_CommandList, GpuPass::ForwardTransparent);
+
+            if (m_ui.Transparency == TransparencyMode::GpuSorted)
+            {
+                // The order computed here is used by a later frame, the draws below use the latest one that has been read back
+                m_TransparencySort->Update(m_CommandList, *m_Scene);
+                m_TransparencySort->Sort(m_CommandList, *m_View, *m_Readback);
+            }
+
+            if (m_ui.Transparency == TransparencyMode::OrderIndependent)
+            {
+                // Clears the accumulation and revealage targets
+                m_RenderTargets->BeginPhase(m_CommandList, FramePhase::Transparency);
+
+                ForwardShadingPass::Context oitContext;
+                m_OitPass->PrepareLights(oitContext, m_CommandList, *forwardLights, m_AmbientTop, m_AmbientBottom, lightProbes);
+
+                if (transparentGpuCulling)
+                {
+                    m_TransparentGpuCulling->RenderCompositeView(m_CommandList,
+                        m_View.get(), m_ViewPrevious.get(),
+                        *m_RenderTargets->OitFramebuffer,
+                        c_GpuCullingCameraSlot,
+                        *m_OitPass,
+                        c_ForwardPassBaseLocations,
+                        oitContext,
+                        "OitTransparent",
+                        false,
+                        m_ui.EnableMaterialEvents);
+                }
+                else
+                {
+                    RenderSceneCompositeView(m_CommandList,
+                        m_View.get(), m_ViewPrevious.get(),
+                        *m_RenderTargets->OitFramebuffer,
+                        m_Scene->GetSceneGraph()->GetRootNode(),
+                        *m_TransparentDrawStrategy,
+                        *m_OitPass,
+                        oitContext,
+                        "OitTransparent",
+                        m_ui.EnableMaterialEvents);
+                }
+
+                m_OitCompositePass->Render(m_CommandList, *m_View);
+            }
+            else
+            {
+                IDrawStrategy& drawStrategy = m_ui.Transparency == TransparencyMode::GpuSorted
+                    ? static_cast<IDrawStrategy&>(*m_TransparencySort)
+                    : static_cast<IDrawStrategy&>(*m_TransparentDrawStrategy);
+
+                RenderSceneCompositeView(m_CommandList,
+                    m_View.get(), m_ViewPrevious.get(),
+                    *m_RenderTargets->ForwardFramebuffer,
+                    m_Scene->GetSceneGraph()->GetRootNode(),
+                    drawStrategy,
+                    *m_ForwardPass,
+                    forwardContext,
+                    "ForwardTransparent",
+                    m_ui.EnableMaterialEvents);
+            }
+
+            m_PassTimers->EndPass(m_CommandList, GpuPass::ForwardTransparent);
         }
 
+        // The depth buffer is complete here, keep its Hi-Z pyramid for the occlusion culling in the next frame
+        if (m_GpuCullingActive)
+            m_GpuCulling->BuildHiZ(m_CommandList);
+        else if (m_GpuCulling)
+            m_GpuCulling->InvalidateHiZ();
+
+        m_RenderTargets->BeginPhase(m_CommandList, FramePhase::TemporalResolve);
+
         nvrhi::ITexture* finalHdrColor = m_RenderTargets->HdrColor;
 
         if (m_ui.AntiAliasingMode == AntiAliasingMode::TEMPORAL || m_ui.AntiAliasingMode == AntiAliasingMode::DLSS)
         {
+            m_PassTimers->BeginPass(m_CommandList, GpuPass::TemporalAA);
+
             if (m_PreviousViewsValid)
             {
                 m_TemporalAntiAliasingPass->RenderMotionVectors(m_CommandList, *m_View, *m_ViewPrevious);
@@ -1114,14 +2316,18 @@ public:
 
             if (m_ui.AntiAliasingMode == AntiAliasingMode::TEMPORAL)
             {
-                m_TemporalAntiAliasingPass->TemporalResolve(m_CommandList, m_ui.TemporalAntiAliasingParams, m_PreviousViewsValid, *m_View, *m_View);
+                m_TemporalAntiAliasingPass->TemporalResolve(m_CommandList, m_ui.TemporalAntiAliasingParams, m_PreviousViewsValid, *m_View, GetOutputView());
             }
 
+            m_PassTimers->EndPass(m_CommandList, GpuPass::TemporalAA);
+
             finalHdrColor = m_RenderTargets->ResolvedColor;
             
             if (m_ui.EnableBloom)
             {
-                m_BloomPass->Render(m_CommandList, m_RenderTargets->ResolvedFramebuffer, *m_View, m_RenderTargets->ResolvedColor, m_ui.BloomSigma, m_ui.BloomAlpha);
+                m_PassTimers->BeginPass(m_CommandList, GpuPass::Bloom);
+                m_BloomPass->Render(m_CommandList, m_RenderTargets->ResolvedFramebuffer, GetOutputView(), m_RenderTargets->ResolvedColor, m_ui.BloomSigma, m_ui.BloomAlpha);
+                m_PassTimers->EndPass(m_CommandList, GpuPass::Bloom);
             }
             m_PreviousViewsValid = true;
         }
@@ -1139,7 +2345,9 @@ public:
 
             if (m_ui.EnableBloom)
             {
+                m_PassTimers->BeginPass(m_CommandList, GpuPass::Bloom);
                 m_BloomPass->Render(m_CommandList, finalHdrFramebuffer, *m_View, finalHdrColor, m_ui.BloomSigma, m_ui.BloomAlpha);
+                m_PassTimers->EndPass(m_CommandList, GpuPass::Bloom);
             }
 
             m_PreviousViewsValid = false;
@@ -1151,7 +2359,24 @@ public:
             toneMappingParams.eyeAdaptationSpeedUp = 0.f;
             toneMappingParams.eyeAdaptationSpeedDown = 0.f;
         }
-        m_ToneMappingPass->SimpleRender(m_CommandList, toneMappingParams, *m_View, finalHdrColor);
+        m_RenderTargets->BeginPhase(m_CommandList, FramePhase::ToneMapping);
+
+        m_PassTimers->BeginPass(m_CommandList, GpuPass::ToneMapping);
+        if (asyncCompute)
+        {
+            // Tone map with the exposure computed from the previous frame, and build the histogram that the compute queue
+            // turns into the exposure for the next frame after this frame's submission
+            m_ToneMappingPass->Render(m_CommandList, toneMappingParams, GetOutputView(), finalHdrColor);
+            m_ToneMappingPass->ResetHistogram(m_CommandList);
+            m_ToneMappingPass->AddFrameToHistogram(m_CommandList, GetOutputView(), finalHdrColor);
+        }
+        else
+        {
+            m_ToneMappingPass->SimpleRender(m_CommandList, toneMappingParams, GetOutputView(), finalHdrColor);
+        }
+        m_PassTimers->EndPass(m_CommandList, GpuPass::ToneMapping);
+
+        m_RenderTargets->BeginPhase(m_CommandList, FramePhase::Present);
         
         m_CommonPasses->BlitTexture(m_CommandList, framebuffer, m_RenderTargets->LdrColor, &m_BindingCache);
 
@@ -1163,7 +2388,7 @@ public:
 
         if (m_ui.DisplayShadowMap)
         {
-            for (int cascade = 0; cascade < 4; cascade++)
+            for (int cascade = 0; cascade < int(c_NumShadowCascades); cascade++)
             {
                 nvrhi::Viewport viewport = nvrhi::Viewport(
                     10.f + 266.f * cascade,
@@ -1181,55 +2406,97 @@ public:
             }
         }
 
+        m_PassTimers->EndPass(m_CommandList, GpuPass::Frame);
         m_CommandList->close();
-        GetDevice()->executeCommandList(m_CommandList);
 
-        if (!m_ui.ScreenshotFileName.empty())
+        // The exposure list of the last async compute frame may still be running on the compute queue,
+        // and the non-async path uses the same exposure buffer on the graphics queue
+        if (!asyncCompute && m_ComputeSubmissionPending)
         {
-            SaveTextureToFile(GetDevice(), m_CommonPasses.get(), framebufferTexture, nvrhi::ResourceStates::RenderTarget, m_ui.ScreenshotFileName.c_str());
-            m_ui.ScreenshotFileName = "";
+            GetDevice()->queueWaitForCommandList(nvrhi::CommandQueue::Graphics, nvrhi::CommandQueue::Compute, m_LastComputeSubmission);
+            m_ComputeSubmissionPending = false;
         }
 
-        if (m_Pick)
+        uint64_t frameSubmission;
+        if (asyncCompute)
         {
-            m_Pick = false;
-            uint4 pixelValue = m_PixelReadbackPass->ReadUInts();
-            m_ui.SelectedMaterial = nullptr;
-            m_ui.SelectedNode = nullptr;
+            if (parallelRecording)
+                m_ThreadPool->WaitForTasks();
 
-            for (const auto& material : m_Scene->GetSceneGraph()->GetMaterials())
-            {
-                if (material->materialID == int(pixelValue.x))
-                {
-                    m_ui.SelectedMaterial = material;
-                    break;
-                }
-            }
+            nvrhi::ICommandList* gbufferCommandLists[] = { m_SetupCommandList, m_GBufferCommandList };
+            const uint64_t gbufferSubmission = GetDevice()->executeCommandLists(gbufferCommandLists, std::size(gbufferCommandLists));
 
-            for (const auto& instance : m_Scene->GetSceneGraph()->GetMeshInstances())
-            {
-                if (instance->GetInstanceIndex() == int(pixelValue.y))
-                {
-                    m_ui.SelectedNode = instance->GetNodeSharedPtr();
-                    break;
-                }
-            }
+            GetDevice()->queueWaitForCommandList(nvrhi::CommandQueue::Compute, nvrhi::CommandQueue::Graphics, gbufferSubmission);
+            m_LastComputeSubmission = GetDevice()->executeCommandList(m_SsaoCommandList, nvrhi::CommandQueue::Compute);
 
-            if (m_ui.SelectedNode)
-            {
-                log::info("Picked node: %s", m_ui.SelectedNode->GetPath().generic_string().c_str());
-                PointThirdPersonCameraAt(m_ui.SelectedNode);
-            }
-            else
+            GetDevice()->executeCommandList(m_AsyncShadowCommandList);
+
+            // Lighting needs the AO, and tone mapping needs the exposure from the previous frame's compute list
+            GetDevice()->queueWaitForCommandList(nvrhi::CommandQueue::Graphics, nvrhi::CommandQueue::Compute, m_LastComputeSubmission);
+            m_ComputeSubmissionPending = false;
+
+            frameSubmission = GetDevice()->executeCommandList(m_CommandList);
+
+            m_ExposureCommandList->open();
+            m_PassTimers->BeginPass(m_ExposureCommandList, GpuPass::Exposure);
+            m_ToneMappingPass->ComputeExposure(m_ExposureCommandList, toneMappingParams);
+            m_PassTimers->EndPass(m_ExposureCommandList, GpuPass::Exposure);
+            m_ExposureCommandList->close();
+
+            // The exposure computation overlaps the start of the next frame on the graphics queue
+            GetDevice()->queueWaitForCommandList(nvrhi::CommandQueue::Compute, nvrhi::CommandQueue::Graphics, frameSubmission);
+            m_LastComputeSubmission = GetDevice()->executeCommandList(m_ExposureCommandList, nvrhi::CommandQueue::Compute);
+            m_ComputeSubmissionPending = true;
+        }
+        else if (parallelRecording)
+        {
+            m_ThreadPool->WaitForTasks();
+
+            std::vector<nvrhi::ICommandList*> commandLists;
+            commandLists.push_back(m_SetupCommandList);
+            if (parallelShadows)
             {
-                PointThirdPersonCameraAt(m_Scene->GetSceneGraph()->GetRootNode());
+                for (const auto& commandList : m_ShadowCommandLists)
+                    commandLists.push_back(commandList);
             }
+            if (parallelGBuffer)
+                commandLists.push_back(m_GBufferCommandList);
+            commandLists.push_back(m_CommandList);
+
+            frameSubmission = GetDevice()->executeCommandLists(commandLists.data(), commandLists.size());
+        }
+        else
+        {
+            frameSubmission = GetDevice()->executeCommandList(m_CommandList);
+        }
+
+        m_Readback->Submit();
+        m_Readback->Poll();
+
+        if (m_ui.EnableLightProbe)
+            m_LightProbeScheduler->SubmitFiltering(frameSubmission);
+
+        auto renderEndTime = std::chrono::high_resolution_clock::now();
+        float renderTimeMs = std::chrono::duration<float, std::milli>(renderEndTime - renderStartTime).count();
+        m_PassTimers->EndFrame(m_LastFrameTimeSeconds * 1000.f, renderTimeMs);
+
+        if (!m_ui.ScreenshotFileName.empty())
+        {
+            SaveTextureToFile(GetDevice(), m_CommonPasses.get(), framebufferTexture, nvrhi::ResourceStates::RenderTarget, m_ui.ScreenshotFileName.c_str());
+            m_ui.ScreenshotFileName = "";
         }
 
         m_TemporalAntiAliasingPass->AdvanceFrame();
         std::swap(m_View, m_ViewPrevious);
 
         GetDeviceManager()->SetVsyncEnabled(m_ui.EnableVsync);
+
+        if (IsBenchmarkRunning())
+        {
+            ++m_BenchmarkFrame;
+            if (m_BenchmarkFrame >= g_Benchmark.warmupFrames + m_BenchmarkFrameCount)
+                FinishBenchmark();
+        }
     }
 
     std::shared_ptr<ShaderFactory> GetShaderFactory()
@@ -1237,18 +2504,14 @@ public:
         return m_ShaderFactory;
     }
 
-    std::vector<std::shared_ptr<LightProbe>>& GetLightProbes()
-    {
-        return m_LightProbes;
-    }
-
     void CreateLightProbes(uint32_t numProbes)
     {
         nvrhi::DeviceHandle device = GetDeviceManager()->GetDevice();
 
-        uint32_t diffuseMapSize = 256;
+        // Irradiance has no high frequencies, and the specular maps are kept small so that dozens of probes fit in memory
+        uint32_t diffuseMapSize = 32;
         uint32_t diffuseMapMipLevels = 1;
-        uint32_t specularMapSize = 512;
+        uint32_t specularMapSize = 256;
         uint32_t specularMapMipLevels = 8;
 
         nvrhi::TextureDesc cubemapDesc;
@@ -1292,140 +2555,158 @@ public:
 
             m_LightProbes.push_back(probe);
         }
+
+        m_LightProbeScheduler->SetProbes(m_LightProbes);
     }
 
-    void RenderLightProbe(LightProbe& probe)
+    const TransparencySort& GetTransparencySort() const
     {
-        nvrhi::DeviceHandle device = GetDeviceManager()->GetDevice();
-
-        uint32_t environmentMapSize = 1024;
-        uint32_t environmentMapMipLevels = 8;
+        return *m_TransparencySort;
+    }
 
-        nvrhi::TextureDesc cubemapDesc;
-        cubemapDesc.arraySize = 6;
-        cubemapDesc.width = environmentMapSize;
-        cubemapDesc.height = environmentMapSize;
-        cubemapDesc.mipLevels = environmentMapMipLevels;
-        cubemapDesc.dimension = nvrhi::TextureDimension::TextureCube;
-        cubemapDesc.isRenderTarget = true;
-        cubemapDesc.format = nvrhi::Format::RGBA16_FLOAT;
-        cubemapDesc.initialState = nvrhi::ResourceStates::RenderTarget;
-        cubemapDesc.keepInitialState = true;
-        cubemapDesc.clearValue = nvrhi::Color(0.f);
-        cubemapDesc.useClearValue = true;
+    ShadowCache& GetShadowCache()
+    {
+        return *m_ShadowCache;
+    }
 
-        nvrhi::TextureHandle colorTexture = device->createTexture(cubemapDesc);
+    LightProbeScheduler& GetLightProbeScheduler()
+    {
+        return *m_LightProbeScheduler;
+    }
 
-        const nvrhi::Format depthFormats[] = {
-            nvrhi::Format::D24S8,
-            nvrhi::Format::D32,
-            nvrhi::Format::D16,
-            nvrhi::Format::D32S8 };
+    // Spreads the probes on a grid over the scene footprint, one layer at about eye height above the lowest point.
+    // Each probe influences its grid cell and half of the neighbouring cells, so that the lighting blends between probes.
+    void PlaceLightProbes()
+    {
+        for (auto probe : m_LightProbes)
+        {
+            probe->enabled = false;
+        }
+        m_LightProbeScheduler->SetProbes(m_LightProbes);
 
-        const nvrhi::FormatSupport depthFeatures =
-            nvrhi::FormatSupport::Texture |
-            nvrhi::FormatSupport::DepthStencil |
-            nvrhi::FormatSupport::ShaderLoad;
+        box3 sceneBounds = m_Scene->GetSceneGraph()->GetRootNode()->GetGlobalBoundingBox();
+        if (sceneBounds.isempty() || m_LightProbes.empty())
+            return;
 
-        cubemapDesc.mipLevels = 1;
-        cubemapDesc.format = nvrhi::utils::ChooseFormat(GetDevice(), depthFeatures, depthFormats, std::size(depthFormats));
-        cubemapDesc.isTypeless = true;
-        cubemapDesc.initialState = nvrhi::ResourceStates::DepthWrite;
+        const uint32_t numProbes = uint32_t(m_LightProbes.size());
+        const float3 extent = sceneBounds.diagonal();
+        const uint32_t countX = clamp(uint32_t(roundf(sqrtf(float(numProbes) * extent.x / std::max(extent.z, 1e-3f)))), 1u, numProbes);
+        const uint32_t countZ = std::max(numProbes / countX, 1u);
+        const float3 cellSize = float3(extent.x / float(countX), extent.y, extent.z / float(countZ));
+        const float height = sceneBounds.m_mins.y + std::min(extent.y * 0.5f, 2.f);
 
-        nvrhi::TextureHandle depthTexture = device->createTexture(cubemapDesc);
+        uint32_t probeIndex = 0;
+        for (uint32_t z = 0; z < countZ; z++)
+        {
+            for (uint32_t x = 0; x < countX; x++)
+            {
+                const float3 cellMin = sceneBounds.m_mins + float3(float(x) * cellSize.x, 0.f, float(z) * cellSize.z);
+                const box3 cell = box3(cellMin, cellMin + cellSize);
+                const float3 position = float3(cell.center().x, height, cell.center().z);
 
-        std::shared_ptr<FramebufferFactory> framebuffer = std::make_shared<FramebufferFactory>(device);
-        framebuffer->RenderTargets = { colorTexture };
-        framebuffer->DepthTarget = depthTexture;
+                m_LightProbeScheduler->SetProbePosition(*m_LightProbes[probeIndex++], position,
+                    cell.grow(float3(cellSize.x * 0.5f, 0.f, cellSize.z * 0.5f)));
+            }
+        }
+    }
 
-        CubemapView view;
-        view.SetArrayViewports(environmentMapSize, 0);
-        const float nearPlane = 0.1f;
-        const float cullDistance = 100.f;
+    // Moves the probe that is closest to the camera to the camera position
+    void PlaceLightProbeAtCamera()
+    {
         float3 probePosition = GetActiveCamera().GetPosition();
         if (m_ui.ActiveSceneCamera)
             probePosition = m_ui.ActiveSceneCamera->GetWorldToViewMatrix().m_translation;
 
-        view.SetTransform(dm::translation(-probePosition), nearPlane, cullDistance);
-        view.UpdateCache();
-        
-        std::shared_ptr<SkyPass> skyPass = std::make_shared<SkyPass>(device, m_ShaderFactory, m_CommonPasses, framebuffer, view);
+        auto closestProbes = m_LightProbeScheduler->GetClosestProbes(probePosition, 1);
+        std::shared_ptr<LightProbe> probe = closestProbes.empty() ? m_LightProbes[0] : closestProbes[0];
 
-        ForwardShadingPass::CreateParameters ForwardParams;
-        ForwardParams.singlePassCubemap = GetDevice()->queryFeatureSupport(nvrhi::Feature::FastGeometryShader);
-        std::shared_ptr<ForwardShadingPass> forwardPass = std::make_shared<ForwardShadingPass>(device, m_CommonPasses);
-        forwardPass->Init(*m_ShaderFactory, ForwardParams);
-        
-        nvrhi::CommandListHandle commandList = device->createCommandList();
-        commandList->open();
-        commandList->clearTextureFloat(colorTexture, nvrhi::AllSubresources, nvrhi::Color(0.f));
+        m_LightProbeScheduler->SetProbePosition(*probe, probePosition, box3(probePosition, probePosition).grow(10.f));
+    }
 
-        const nvrhi::FormatInfo& depthFormatInfo = nvrhi::getFormatInfo(depthTexture->getDesc().format);
-        commandList->clearDepthStencilTexture(depthTexture, nvrhi::AllSubresources, true, 0.f, depthFormatInfo.hasStencil, 0);
+    void UpdateLightProbes(nvrhi::ICommandList* commandList)
+    {
+        if (!m_EnvironmentBrdfRendered)
+        {
+            m_LightProbePass->RenderEnvironmentBrdfTexture(commandList);
+            for (auto probe : m_LightProbes)
+            {
+                probe->environmentBrdf = m_LightProbePass->GetEnvironmentBrdfTexture();
+            }
+            m_EnvironmentBrdfRendered = true;
+        }
 
-        box3 sceneBounds = m_Scene->GetSceneGraph()->GetRootNode()->GetGlobalBoundingBox();
-        float zRange = length(sceneBounds.diagonal()) * 0.5f;
-        m_ShadowMap->SetupForCubemapView(*m_SunLight, view.GetViewOrigin(), cullDistance, zRange, zRange, m_ui.CsmExponent);
-        m_ShadowMap->Clear(commandList);
+        // A change of the sun affects every probe
+        const double3 sunDirection = m_SunLight->GetDirection();
+        const float3 sunRadiance = m_SunLight->color * m_SunLight->irradiance;
+        if (any(sunDirection != m_LightProbeSunDirection) || any(sunRadiance != m_LightProbeSunRadiance))
+        {
+            m_LightProbeScheduler->InvalidateAll();
+            m_LightProbeSunDirection = sunDirection;
+            m_LightProbeSunRadiance = sunRadiance;
+        }
 
-        DepthPass::Context shadowContext;
+        if (!m_ui.EnableLightProbeUpdates)
+            return;
 
-        RenderCompositeView(commandList,
-            &m_ShadowMap->GetView(), nullptr,
-            *m_ShadowFramebuffer,
-            m_Scene->GetSceneGraph()->GetRootNode(),
-            *m_OpaqueDrawStrategy,
-            *m_ShadowDepthPass,
-            shadowContext,
-            "ShadowMap");
+        LightProbeScheduler::Settings& settings = m_LightProbeScheduler->GetSettings();
+        settings.facesPerFrame = uint32_t(m_ui.LightProbeFacesPerFrame);
+        settings.refreshIntervalFrames = uint32_t(m_ui.LightProbeRefreshInterval);
+
+        m_LightProbeScheduler->Update(commandList, m_View->GetViewOrigin(),
+            [this](nvrhi::ICommandList* commandList, const IView& faceView, FramebufferFactory& framebuffer, uint32_t captureTarget, bool firstFace)
+            {
+                RenderLightProbeFace(commandList, faceView, framebuffer, captureTarget, firstFace);
+            });
+    }
+
+    void RenderLightProbeFace(nvrhi::ICommandList* commandList, const IView& faceView, FramebufferFactory& framebuffer, uint32_t captureTarget, bool firstFace)
+    {
+        if (m_ui.EnableShadows && firstFace)
+        {
+            box3 sceneBounds = m_Scene->GetSceneGraph()->GetRootNode()->GetGlobalBoundingBox();
+            float zRange = length(sceneBounds.diagonal()) * 0.5f;
+            m_LightProbeShadowMap->SetupForCubemapView(*m_SunLight, faceView.GetViewOrigin(), c_LightProbeCullDistance, zRange, zRange, m_ui.CsmExponent);
+            m_LightProbeShadowMap->Clear(commandList);
+
+            DepthPass::Context shadowContext;
+
+            RenderCompositeView(commandList,
+                &m_LightProbeShadowMap->GetView(), nullptr,
+                *m_LightProbeShadowFramebuffer,
+                m_Scene->GetSceneGraph()->GetRootNode(),
+                *m_OpaqueDrawStrategy,
+                *m_ShadowDepthPass,
+                shadowContext,
+                "LightProbeShadowMap");
+        }
+
+        // RenderScene assigns the main shadow map to the sun after the light probe update
+        m_SunLight->shadowMap = m_ui.EnableShadows ? m_LightProbeShadowMap : nullptr;
 
         ForwardShadingPass::Context forwardContext;
 
         std::vector<std::shared_ptr<LightProbe>> lightProbes;
-        forwardPass->PrepareLights(forwardContext, commandList, m_Scene->GetSceneGraph()->GetLights(), m_AmbientTop, m_AmbientBottom, lightProbes);
+        m_LightProbeForwardPass->PrepareLights(forwardContext, commandList, m_Scene->GetSceneGraph()->GetLights(), m_AmbientTop, m_AmbientBottom, lightProbes);
 
         RenderCompositeView(commandList,
-            &view, nullptr,
-            *framebuffer,
+            &faceView, nullptr,
+            framebuffer,
             m_Scene->GetSceneGraph()->GetRootNode(),
             *m_OpaqueDrawStrategy,
-            *forwardPass,
+            *m_LightProbeForwardPass,
             forwardContext,
             "ForwardOpaque");
-        
-        skyPass->Render(commandList, view, *m_SunLight, m_ui.SkyParams);
+
+        m_LightProbeSkyPasses[captureTarget]->Render(commandList, faceView, *m_SunLight, m_ui.SkyParams);
 
         RenderCompositeView(commandList,
-            &view, nullptr,
-            *framebuffer,
+            &faceView, nullptr,
+            framebuffer,
             m_Scene->GetSceneGraph()->GetRootNode(),
             *m_TransparentDrawStrategy,
-            *forwardPass,
+            *m_LightProbeForwardPass,
             forwardContext,
             "ForwardTransparent");
-
-        m_LightProbePass->GenerateCubemapMips(commandList, colorTexture, 0, 0, environmentMapMipLevels - 1);
-
-        m_LightProbePass->RenderDiffuseMap(commandList, colorTexture, nvrhi::AllSubresources, probe.diffuseMap, probe.diffuseArrayIndex * 6, 0);
-        
-        uint32_t specularMapMipLevels = probe.specularMap->getDesc().mipLevels;
-        for (uint32_t mipLevel = 0; mipLevel < specularMapMipLevels; mipLevel++)
-        {
-            float roughness = powf(float(mipLevel) / float(specularMapMipLevels - 1), 2.0f);
-            m_LightProbePass->RenderSpecularMap(commandList, roughness, colorTexture, nvrhi::AllSubresources, probe.specularMap, probe.specularArrayIndex * 6, mipLevel);
-        }
-        
-        m_LightProbePass->RenderEnvironmentBrdfTexture(commandList);
-
-        commandList->close();
-        device->executeCommandList(commandList);
-        device->waitForIdle();
-        device->runGarbageCollection();
-
-        probe.environmentBrdf = m_LightProbePass->GetEnvironmentBrdfTexture();
-        box3 bounds = box3(probePosition, probePosition).grow(10.f);
-        probe.bounds = frustum::fromBox(bounds);
-        probe.enabled = true;
     }
 };
 
@@ -1473,7 +2754,7 @@ protected:
         int width, height;
         GetDeviceManager()->GetWindowDimensions(width, height);
 
-        if (m_app->IsSceneLoading())
+        if (m_app->IsSceneLoading() && !m_app->IsSceneStreaming())
         {
             BeginFullScreenWindow();
             ImGui::PushFont(m_FontOpenSans->GetScaledFont());
@@ -1506,6 +2787,16 @@ protected:
         double frameTime = GetDeviceManager()->GetAverageFrameTimeSeconds();
         if (frameTime > 0.0)
             ImGui::Text("%.3f ms/frame (%.1f FPS)", frameTime * 1e3, 1.0 / frameTime);
+        if (m_app->IsStreamingTextures())
+        {
+            ImGui::Text("Streaming textures: %d/%d, %d materials pending", int(m_app->GetTextureCache()->GetNumberOfLoadedTextures()),
+                int(m_app->GetTextureCache()->GetNumberOfRequestedTextures()), int(m_app->GetNumStreamingMaterials()));
+            if (const TextureStreamer* streamer = m_app->GetTextureStreamer())
+            {
+                ImGui::Text("Streaming mips: %d textures, %.1f MB pending", int(streamer->GetNumStreamingTextures()),
+                    double(streamer->GetPendingBytes()) / double(1 << 20));
+            }
+        }
 
         const std::string sceneDir = m_app->GetSceneDir().generic_string();
         
@@ -1539,6 +2830,12 @@ protected:
         if (m_ui.AntiAliasingMode >= AntiAliasingMode::MSAA_2X)
             m_ui.UseDeferredShading = false; // Deferred shading doesn't work with MSAA
         ImGui::Checkbox("Stereo", &m_ui.Stereo);
+        if (m_ui.Stereo)
+        {
+            ImGui::Checkbox("Share Draw List Between Eyes", &m_ui.StereoSharedDrawList);
+            if (m_ui.SinglePassStereoSupported)
+                ImGui::Checkbox("Single-Pass Stereo G-Buffer", &m_ui.SinglePassStereo);
+        }
         ImGui::Checkbox("Animations", &m_ui.EnableAnimations);
 
         if (ImGui::BeginCombo("Camera (T)", m_ui.ActiveSceneCamera ? m_ui.ActiveSceneCamera->GetName().c_str()
@@ -1595,6 +2892,17 @@ protected:
         }
 
         ImGui::Combo("TAA Camera Jitter", (int*)&m_ui.TemporalAntiAliasingJitter, "MSAA\0Halton\0R2\0White Noise\0");
+
+        ImGui::Checkbox("Dynamic Resolution", &m_ui.EnableDynamicResolution);
+        if (m_ui.EnableDynamicResolution)
+        {
+            ImGui::SliderFloat("Target Frame Rate", &m_ui.DynamicResolutionParams.targetFrameRate, 30.f, 144.f, "%.0f Hz");
+            ImGui::SliderFloat("Minimum Scale", &m_ui.DynamicResolutionParams.minScale, 0.25f, 1.f);
+            if (m_app->IsDynamicResolutionActive())
+                ImGui::Text("Resolution Scale: %.0f%%", m_app->GetResolutionScale() * 100.f);
+            else
+                ImGui::TextUnformatted("Requires TAA or DLSS, and no stereo");
+        }
         
         ImGui::SliderFloat("Ambient Intensity", &m_ui.AmbientIntensity, 0.f, 1.f);
 
@@ -1603,6 +2911,22 @@ protected:
         {
             ImGui::DragFloat("Diffuse Scale", &m_ui.LightProbeDiffuseScale, 0.01f, 0.0f, 10.0f);
             ImGui::DragFloat("Specular Scale", &m_ui.LightProbeSpecularScale, 0.01f, 0.0f, 10.0f);
+            ImGui::Checkbox("Update Probes", &m_ui.EnableLightProbeUpdates);
+            ImGui::SliderInt("Faces Per Frame", &m_ui.LightProbeFacesPerFrame, 1, 6);
+            ImGui::SliderInt("Refresh Interval (frames)", &m_ui.LightProbeRefreshInterval, 0, 600);
+
+            LightProbeScheduler& scheduler = m_app->GetLightProbeScheduler();
+            ImGui::Text("%u probes captured, %u pending, filtering on the %s queue", scheduler.GetNumValidProbes(),
+                scheduler.GetNumPendingProbes(), scheduler.IsUsingComputeQueue() ? "compute" : "graphics");
+
+            if (ImGui::Button("Place Probe At Camera"))
+                m_app->PlaceLightProbeAtCamera();
+            ImGui::SameLine();
+            if (ImGui::Button("Reset Probe Grid"))
+                m_app->PlaceLightProbes();
+            ImGui::SameLine();
+            if (ImGui::Button("Recapture All"))
+                scheduler.InvalidateAll();
         }
 
         ImGui::Checkbox("Enable Procedural Sky", &m_ui.EnableProceduralSky);
@@ -1619,11 +2943,74 @@ protected:
         ImGui::DragFloat("Bloom Sigma", &m_ui.BloomSigma, 0.01f, 0.1f, 100.f);
         ImGui::DragFloat("Bloom Alpha", &m_ui.BloomAlpha, 0.01f, 0.01f, 1.0f);
         ImGui::Checkbox("Enable Shadows", &m_ui.EnableShadows);
+        if (m_ui.EnableShadows)
+        {
+            ImGui::Checkbox("Cache Shadow Cascades", &m_ui.EnableShadowCache);
+            if (m_ui.EnableShadowCache && ImGui::CollapsingHeader("Shadow Cache"))
+            {
+                ImGui::Checkbox("Scroll Cascades", &m_ui.EnableShadowCacheScrolling);
+                ImGui::SliderInt("Reduced Rate From Cascade", &m_ui.ShadowCacheReducedRateCascade, 0, int(c_NumShadowCascades));
+                ImGui::SliderInt("Reduced Rate Interval", &m_ui.ShadowCacheReducedRateInterval, 1, 16);
+
+                const ShadowCache::Statistics& stats = m_app->GetShadowCache().GetStatistics();
+                ImGui::Text("Cascades: %u rendered, %u scrolled, %u reused, %u skipped",
+                    stats.renderedCascades, stats.scrolledCascades, stats.reusedCascades, stats.skippedCascades);
+            }
+        }
         ImGui::Checkbox("Enable Translucency", &m_ui.EnableTranslucency);
+        if (m_ui.EnableTranslucency)
+        {
+            ImGui::Combo("Transparency", (int*)&m_ui.Transparency, "CPU Sorted\0GPU Sorted\0Order Independent\0");
+            if (m_ui.Transparency == TransparencyMode::GpuSorted)
+            {
+                const TransparencySort& transparencySort = m_app->GetTransparencySort();
+                ImGui::Text("Visible: %u of %u transparent records", transparencySort.GetNumVisibleRecords(), transparencySort.GetNumRecords());
+            }
+        }
 
         ImGui::Separator();
         ImGui::Checkbox("Temporal AA Clamping", &m_ui.TemporalAntiAliasingParams.enableHistoryClamping);
         ImGui::Checkbox("Material Events", &m_ui.EnableMaterialEvents);
+        if (m_ui.ParallelRecordingAvailable)
+            ImGui::Checkbox("Parallel Command Recording", &m_ui.EnableParallelRecording);
+        if (m_ui.AsyncComputeAvailable && m_ui.UseDeferredShading)
+            ImGui::Checkbox("Async Compute (SSAO, Exposure)", &m_ui.EnableAsyncCompute);
+        ImGui::Checkbox("GPU Culling", &m_ui.EnableGpuCulling);
+        if (m_ui.UseDeferredShading)
+        {
+            ImGui::Checkbox("Tiled Lighting", &m_ui.EnableTiledLighting);
+            if (m_ui.EnableTiledLighting && m_app->GetLightCullingMaxTileLights() > 0)
+            {
+                ImGui::Text("Most lights in a tile: %u of %u", m_app->GetLightCullingMaxTileLights(), uint32_t(LIGHT_CULLING_MAX_LIGHTS_PER_TILE));
+                if (m_app->GetLightCullingOverflowTiles() > 0)
+                    ImGui::Text("%u tiles drop lights over the limit", m_app->GetLightCullingOverflowTiles());
+            }
+        }
+        if (m_ui.EnableGpuCulling)
+        {
+            ImGui::Checkbox("Occlusion Culling", &m_ui.EnableOcclusionCulling);
+            ImGui::Text("Visible: %u of %u instance records", m_app->GetVisibleGpuCullingRecords(), m_app->GetGpuCullingCandidates());
+        }
+        ImGui::Checkbox("GPU Pass Timers", &m_ui.EnablePassTimers);
+        if (m_ui.EnablePassTimers)
+        {
+            const FrameTimings& timings = m_app->GetLatestTimings();
+            std::vector<float> history;
+            for (uint32_t pass = 0; pass < uint32_t(GpuPass::COUNT); pass++)
+            {
+                if (timings.gpuPassTimesMs[pass] < 0.f)
+                    continue;
+
+                const char* passName = GetGpuPassName(GpuPass(pass));
+                m_app->GetPassTimeHistory(GpuPass(pass), history);
+
+                char overlay[64];
+                snprintf(overlay, sizeof(overlay), "%s: %.3f ms", passName, timings.gpuPassTimesMs[pass]);
+                ImGui::PushID(passName);
+                ImGui::PlotLines("", history.data(), int(history.size()), 0, overlay, 0.f, FLT_MAX, ImVec2(0.f, 40.f));
+                ImGui::PopID();
+            }
+        }
         ImGui::Separator();
 
         const auto& lights = m_app->GetScene()->GetSceneGraph()->GetLights();
@@ -1651,17 +3038,6 @@ protected:
             }
         }
 
-        ImGui::TextUnformatted("Render Light Probe: ");
-        uint32_t probeIndex = 1;
-        for (auto probe : m_app->GetLightProbes())
-        {
-            ImGui::SameLine();
-            if (ImGui::Button(probe->name.c_str()))
-            {
-                m_app->RenderLightProbe(*probe);
-            }
-        }
-
         if (ImGui::Button("Screenshot"))
         {
             std::string fileName;
@@ -1734,16 +3110,71 @@ bool ProcessCommandLine(int argc, const char* const* argv, DeviceCreationParamet
         {
             g_PrintSceneGraph = true;
         }
+        else if (!strcmp(argv[i], "-streaming"))
+        {
+            g_StreamingLoad = true;
+        }
+        else if (!strcmp(argv[i], "-streaming-budget") && i + 1 < argc)
+        {
+            g_StreamingBudget = uint64_t(std::max(std::stoi(argv[++i]), 1)) << 20;
+        }
         else if (!strcmp(argv[i], "-print-formats"))
         {
             g_PrintFormats = true;
         }
+        else if (!strcmp(argv[i], "-gpu-culling"))
+        {
+            g_EnableGpuCulling = true;
+        }
+        else if (!strcmp(argv[i], "-no-tiled-lighting"))
+        {
+            g_EnableTiledLighting = false;
+        }
+        else if (!strcmp(argv[i], "-benchmark"))
+        {
+            g_Benchmark.enabled = true;
+        }
+        else if (!strcmp(argv[i], "-camera-path") && i + 1 < argc)
+        {
+            g_Benchmark.cameraPathFile = argv[++i];
+        }
+        else if (!strcmp(argv[i], "-record-camera-path") && i + 1 < argc)
+        {
+            g_Benchmark.recordCameraPathFile = argv[++i];
+        }
+        else if (!strcmp(argv[i], "-benchmark-output") && i + 1 < argc)
+        {
+            g_Benchmark.outputFile = argv[++i];
+        }
+        else if (!strcmp(argv[i], "-benchmark-frames") && i + 1 < argc)
+        {
+            g_Benchmark.measuredFrames = uint32_t(std::stoi(argv[++i]));
+        }
+        else if (!strcmp(argv[i], "-benchmark-warmup") && i + 1 < argc)
+        {
+            g_Benchmark.warmupFrames = uint32_t(std::stoi(argv[++i]));
+        }
+        else if (!strcmp(argv[i], "-benchmark-fps") && i + 1 < argc)
+        {
+            g_Benchmark.frameRate = std::max(1.f, std::stof(argv[++i]));
+        }
         else if (argv[i][0] != '-')
         {
             sceneName = argv[i];
         }
     }
 
+    if (g_Benchmark.enabled)
+    {
+        if (!g_Benchmark.recordCameraPathFile.empty())
+        {
+            log::error("-benchmark and -record-camera-path cannot be used together");
+            return false;
+        }
+
+        deviceParams.vsyncEnabled = false;
+    }
+
     return true;
 }
 
@@ -1766,6 +3197,7 @@ int main(int __argc, const char* const* __argv)
     deviceParams.startFullscreen = false;
     deviceParams.vsyncEnabled = true;
     deviceParams.enablePerMonitorDPI = true;
+    deviceParams.enableComputeQueue = true; // Light probe filtering
     deviceParams.supportExplicitDisplayScaling = true;
     
 #if DONUT_WITH_DLSS && DONUT_WITH_VULKAN
@@ -1823,6 +3255,8 @@ int main(int __argc, const char* const* __argv)
 
     {
         UIData uiData;
+        uiData.EnableGpuCulling = g_EnableGpuCulling;
+        uiData.EnableTiledLighting = g_EnableTiledLighting;
 
         std::shared_ptr<FeatureDemo> demo = std::make_shared<FeatureDemo>(deviceManager, uiData, sceneName);
         std::shared_ptr<UIRenderer> gui = std::make_shared<UIRenderer>(deviceManager, demo, uiData);
@@ -0,0 +1,581 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+#include "GpuCulling.h"
+
+#include <donut/core/log.h>
+#include <donut/engine/FramebufferFactory.h>
+#include <donut/engine/Scene.h>
+#include <donut/engine/ShaderFactory.h>
+#include <nvrhi/utils.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <numeric>
+
+using namespace donut;
+using namespace donut::math;
+using namespace donut::engine;
+using namespace donut::render;
+
+#include <donut/shaders/bindless.h>
+#include "gpu_culling_cb.h"
+
+static_assert(sizeof(CullingRecord) == 48, "CullingRecord must match the structured buffer layout in gpu_culling.hlsl");
+static_assert(offsetof(InstanceData, transform) == INSTANCE_DATA_TRANSFORM_OFFSET, "InstanceData layout has changed");
+static_assert(offsetof(InstanceData, prevTransform) == INSTANCE_DATA_PREV_TRANSFORM_OFFSET, "InstanceData layout has changed");
+static_assert(sizeof(InstanceData) % 16 == 0, "The culling shader copies instances in 16-byte blocks");
+static_assert(sizeof(nvrhi::DrawIndexedIndirectArguments) == DRAW_INDEXED_INDIRECT_ARGS_SIZE, "Unexpected indirect arguments size");
+
+GpuCulling::GpuCulling(nvrhi::IDevice* device, ShaderFactory& shaderFactory, uint32_t numViewSlots, Domains domains)
+    : m_Device(device)
+    , m_Domains(domains)
+{
+    m_CullShader = shaderFactory.CreateShader("app/gpu_culling.hlsl", "cull_cs", nullptr, nvrhi::ShaderType::Compute);
+    m_HiZShader = shaderFactory.CreateShader("app/hiz_build.hlsl", "main", nullptr, nvrhi::ShaderType::Compute);
+
+    nvrhi::BindingLayoutDesc cullLayoutDesc;
+    cullLayoutDesc.visibility = nvrhi::ShaderType::Compute;
+    cullLayoutDesc.bindings = {
+        nvrhi::BindingLayoutItem::VolatileConstantBuffer(0),
+        nvrhi::BindingLayoutItem::StructuredBuffer_SRV(0),
+        nvrhi::BindingLayoutItem::RawBuffer_SRV(1),
+        nvrhi::BindingLayoutItem::Texture_SRV(2),
+        nvrhi::BindingLayoutItem::RawBuffer_UAV(0),
+        nvrhi::BindingLayoutItem::RawBuffer_UAV(1)
+    };
+    m_CullBindingLayout = m_Device->createBindingLayout(cullLayoutDesc);
+
+    auto cullPipelineDesc = nvrhi::ComputePipelineDesc()
+        .setComputeShader(m_CullShader)
+        .addBindingLayout(m_CullBindingLayout);
+    m_CullPipeline = m_Device->createComputePipeline(cullPipelineDesc);
+
+    nvrhi::BindingLayoutDesc hizLayoutDesc;
+    hizLayoutDesc.visibility = nvrhi::ShaderType::Compute;
+    hizLayoutDesc.bindings = {
+        nvrhi::BindingLayoutItem::VolatileConstantBuffer(0),
+        nvrhi::BindingLayoutItem::Texture_SRV(0),
+        nvrhi::BindingLayoutItem::Texture_UAV(0)
+    };
+    m_HiZBindingLayout = m_Device->createBindingLayout(hizLayoutDesc);
+
+    auto hizPipelineDesc = nvrhi::ComputePipelineDesc()
+        .setComputeShader(m_HiZShader)
+        .addBindingLayout(m_HiZBindingLayout);
+    m_HiZPipeline = m_Device->createComputePipeline(hizPipelineDesc);
+
+    m_HiZConstantBuffer = m_Device->createBuffer(nvrhi::utils::CreateVolatileConstantBufferDesc(
+        sizeof(HiZBuildConstants), "HiZBuildConstants", c_MaxRenderPassConstantBufferVersions));
+
+    m_ViewSlots.resize(numViewSlots);
+    for (ViewSlot& slot : m_ViewSlots)
+    {
+        slot.constantBuffer = m_Device->createBuffer(nvrhi::utils::CreateVolatileConstantBufferDesc(
+            sizeof(GpuCullingConstants), "GpuCullingConstants", c_MaxRenderPassConstantBufferVersions));
+    }
+}
+
+bool GpuCulling::Update(nvrhi::ICommandList* commandList, Scene& scene, nvrhi::ITexture* depthBuffer)
+{
+    bool hizChanged = false;
+    if (depthBuffer != m_DepthBuffer)
+    {
+        CreateHiZ(depthBuffer);
+        hizChanged = true;
+    }
+
+    bool sceneChanged = IsSceneChanged(scene);
+    if (sceneChanged)
+        BuildBatches(commandList, scene);
+
+    if (sceneChanged || hizChanged)
+        CreateCullBindingSets();
+
+    return sceneChanged;
+}
+
+bool GpuCulling::IsSceneChanged(Scene& scene) const
+{
+    if (scene.GetInstanceBuffer() != m_SceneInstanceBuffer)
+        return true;
+
+    const auto& instances = scene.GetSceneGraph()->GetMeshInstances();
+    if (instances.size() != m_Instances.size())
+        return true;
+
+    for (size_t index = 0; index < instances.size(); index++)
+    {
+        if (instances[index].get() != m_Instances[index])
+            return true;
+    }
+
+    return false;
+}
+
+void GpuCulling::BuildBatches(nvrhi::ICommandList* commandList, Scene& scene)
+{
+    m_Instances.clear();
+    m_Batches.clear();
+    m_CulledBufferGroups.clear();
+    m_NumRecords = 0;
+    m_RecordBuffer = nullptr;
+    m_DrawArgumentsBuffer = nullptr;
+    m_CulledInstanceBuffer = nullptr;
+    m_SceneInstanceBuffer = scene.GetInstanceBuffer();
+
+    // Group the instances by geometry: every geometry becomes one indirect draw
+    std::vector<DrawBatch> batches;
+    std::vector<std::shared_ptr<BufferGroup>> batchBuffers;
+    std::vector<std::vector<CullingRecord>> batchRecords;
+    std::unordered_map<const MeshGeometry*, uint32_t> geometryBatches;
+
+    for (const auto& instance : scene.GetSceneGraph()->GetMeshInstances())
+    {
+        m_Instances.push_back(instance.get());
+
+        const auto& mesh = instance->GetMesh();
+        if (!mesh || !mesh->buffers)
+            continue;
+
+        for (const auto& geometry : mesh->geometries)
+        {
+            const Material* material = geometry->material.get();
+            if (!material)
+                continue;
+
+            const bool opaque = material->domain == MaterialDomain::Opaque || material->domain == MaterialDomain::AlphaTested;
+            if (opaque != (m_Domains == Domains::Opaque))
+                continue;
+
+            auto [batchIt, inserted] = geometryBatches.try_emplace(geometry.get(), uint32_t(batches.size()));
+            if (inserted)
+            {
+                DrawBatch batch;
+                batch.material = material;
+                batch.buffers = mesh->buffers.get();
+                batch.cullMode = material->doubleSided ? nvrhi::RasterCullMode::None : nvrhi::RasterCullMode::Back;
+                batch.arguments.indexCount = geometry->numIndices;
+                batch.arguments.startIndexLocation = mesh->indexOffset + geometry->indexOffsetInMesh;
+                batch.arguments.baseVertexLocation = int32_t(mesh->vertexOffset + geometry->vertexOffsetInMesh);
+                batches.push_back(batch);
+                batchBuffers.push_back(mesh->buffers);
+                batchRecords.emplace_back();
+            }
+
+            CullingRecord record{};
+            record.boundsMin = geometry->objectSpaceBounds.m_mins;
+            record.boundsMax = geometry->objectSpaceBounds.m_maxs;
+            record.instanceIndex = uint32_t(instance->GetInstanceIndex());
+
+            // Skinned meshes move outside of their bind pose bounds
+            if (mesh->skinPrototype || geometry->objectSpaceBounds.isempty())
+                record.flags |= CULLING_RECORD_ALWAYS_VISIBLE;
+
+            batchRecords[batchIt->second].push_back(record);
+        }
+    }
+
+    if (batches.empty())
+        return;
+
+    // Order the draws to minimize the state changes between them, like the CPU draw strategy does
+    std::vector<uint32_t> order(batches.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&batches](uint32_t a, uint32_t b)
+    {
+        const DrawBatch& batchA = batches[a];
+        const DrawBatch& batchB = batches[b];
+        if (batchA.buffers != batchB.buffers)
+            return batchA.buffers < batchB.buffers;
+        if (batchA.material != batchB.material)
+            return batchA.material < batchB.material;
+        return batchA.cullMode < batchB.cullMode;
+    });
+
+    std::vector<CullingRecord> records;
+    for (uint32_t sourceIndex : order)
+    {
+        DrawBatch& batch = batches[sourceIndex];
+        batch.arguments.startInstanceLocation = uint32_t(records.size());
+
+        for (CullingRecord record : batchRecords[sourceIndex])
+        {
+            record.batchIndex = uint32_t(m_Batches.size());
+            record.batchFirstInstance = batch.arguments.startInstanceLocation;
+            records.push_back(record);
+        }
+
+        m_Batches.push_back(batch);
+    }
+
+    m_NumRecords = uint32_t(records.size());
+
+    const uint32_t numViewSlots = uint32_t(m_ViewSlots.size());
+    const bool useStructuredInstances = m_Device->getGraphicsAPI() != nvrhi::GraphicsAPI::D3D11;
+
+    nvrhi::BufferDesc bufferDesc;
+    bufferDesc.byteSize = records.size() * sizeof(CullingRecord);
+    bufferDesc.structStride = sizeof(CullingRecord);
+    bufferDesc.initialState = nvrhi::ResourceStates::ShaderResource;
+    bufferDesc.keepInitialState = true;
+    bufferDesc.debugName = "CullingRecords";
+    m_RecordBuffer = m_Device->createBuffer(bufferDesc);
+
+    commandList->writeBuffer(m_RecordBuffer, records.data(), records.size() * sizeof(CullingRecord));
+
+    bufferDesc = nvrhi::BufferDesc();
+    bufferDesc.byteSize = uint64_t(numViewSlots) * m_Batches.size() * sizeof(nvrhi::DrawIndexedIndirectArguments);
+    bufferDesc.isDrawIndirectArgs = true;
+    bufferDesc.canHaveUAVs = true;
+    bufferDesc.canHaveRawViews = true;
+    bufferDesc.initialState = nvrhi::ResourceStates::IndirectArgument;
+    bufferDesc.keepInitialState = true;
+    bufferDesc.debugName = "CulledDrawArguments";
+    m_DrawArgumentsBuffer = m_Device->createBuffer(bufferDesc);
+
+    // Same rules as the scene instance buffer: the geometry passes access it as structured on DX12 and Vulkan, and as raw on DX11
+    bufferDesc = nvrhi::BufferDesc();
+    bufferDesc.byteSize = uint64_t(numViewSlots) * m_NumRecords * sizeof(InstanceData);
+    bufferDesc.structStride = useStructuredInstances ? sizeof(InstanceData) : 0;
+    bufferDesc.canHaveUAVs = true;
+    bufferDesc.canHaveRawViews = true;
+    bufferDesc.isVertexBuffer = true;
+    bufferDesc.initialState = nvrhi::ResourceStates::ShaderResource;
+    bufferDesc.keepInitialState = true;
+    bufferDesc.debugName = "CulledInstances";
+    m_CulledInstanceBuffer = m_Device->createBuffer(bufferDesc);
+
+    for (size_t batchIndex = 0; batchIndex < m_Batches.size(); batchIndex++)
+    {
+        DrawBatch& batch = m_Batches[batchIndex];
+        const std::shared_ptr<BufferGroup>& sourceBuffers = batchBuffers[order[batchIndex]];
+
+        std::shared_ptr<BufferGroup>& culledBuffers = m_CulledBufferGroups[batch.buffers];
+        if (!culledBuffers)
+        {
+            culledBuffers = std::make_shared<BufferGroup>();
+            culledBuffers->indexBuffer = sourceBuffers->indexBuffer;
+            culledBuffers->vertexBuffer = sourceBuffers->vertexBuffer;
+            culledBuffers->instanceBuffer = m_CulledInstanceBuffer;
+
+            for (int attribute = 0; attribute < int(VertexAttribute::Count); attribute++)
+            {
+                culledBuffers->getVertexBufferRange(VertexAttribute(attribute)) = sourceBuffers->getVertexBufferRange(VertexAttribute(attribute));
+            }
+        }
+
+        batch.culledBuffers = culledBuffers.get();
+    }
+
+    for (ViewSlot& slot : m_ViewSlots)
+    {
+        slot.drawArguments.resize(m_Batches.size());
+    }
+}
+
+void GpuCulling::CreateHiZ(nvrhi::ITexture* depthBuffer)
+{
+    m_DepthBuffer = depthBuffer;
+    m_HiZTexture = nullptr;
+    m_HiZBindingSets.clear();
+    m_HiZValid = false;
+
+    if (!depthBuffer)
+        return;
+
+    const nvrhi::TextureDesc& depthDesc = depthBuffer->getDesc();
+
+    nvrhi::TextureDesc desc;
+    desc.width = std::max(depthDesc.width / 2, 1u);
+    desc.height = std::max(depthDesc.height / 2, 1u);
+    desc.mipLevels = uint32_t(floorf(::log2f(float(std::max(desc.width, desc.height))))) + 1;
+    desc.format = nvrhi::Format::R32_FLOAT;
+    desc.isUAV = true;
+    desc.initialState = nvrhi::ResourceStates::ShaderResource;
+    desc.keepInitialState = true;
+    desc.debugName = "HiZ";
+    m_HiZTexture = m_Device->createTexture(desc);
+
+    if (depthDesc.sampleCount != 1)
+        return;
+
+    for (uint32_t mipLevel = 0; mipLevel < desc.mipLevels; mipLevel++)
+    {
+        nvrhi::BindingSetDesc bindingSetDesc;
+        bindingSetDesc.bindings = {
+            nvrhi::BindingSetItem::ConstantBuffer(0, m_HiZConstantBuffer),
+            mipLevel == 0
+                ? nvrhi::BindingSetItem::Texture_SRV(0, depthBuffer)
+                : nvrhi::BindingSetItem::Texture_SRV(0, m_HiZTexture, nvrhi::Format::UNKNOWN, nvrhi::TextureSubresourceSet(mipLevel - 1, 1, 0, 1)),
+            nvrhi::BindingSetItem::Texture_UAV(0, m_HiZTexture, nvrhi::Format::UNKNOWN, nvrhi::TextureSubresourceSet(mipLevel, 1, 0, 1))
+        };
+
+        m_HiZBindingSets.push_back(m_Device->createBindingSet(bindingSetDesc, m_HiZBindingLayout));
+    }
+}
+
+void GpuCulling::CreateCullBindingSets()
+{
+    for (ViewSlot& slot : m_ViewSlots)
+    {
+        slot.bindingSet = nullptr;
+
+        if (m_NumRecords == 0 || !m_HiZTexture)
+            continue;
+
+        nvrhi::BindingSetDesc bindingSetDesc;
+        bindingSetDesc.bindings = {
+            nvrhi::BindingSetItem::ConstantBuffer(0, slot.constantBuffer),
+            nvrhi::BindingSetItem::StructuredBuffer_SRV(0, m_RecordBuffer),
+            nvrhi::BindingSetItem::RawBuffer_SRV(1, m_SceneInstanceBuffer),
+            nvrhi::BindingSetItem::Texture_SRV(2, m_HiZTexture),
+            nvrhi::BindingSetItem::RawBuffer_UAV(0, m_DrawArgumentsBuffer),
+            nvrhi::BindingSetItem::RawBuffer_UAV(1, m_CulledInstanceBuffer)
+        };
+
+        slot.bindingSet = m_Device->createBindingSet(bindingSetDesc, m_CullBindingLayout);
+    }
+}
+
+void GpuCulling::BuildHiZ(nvrhi::ICommandList* commandList)
+{
+    if (m_HiZBindingSets.empty())
+        return;
+
+    commandList->beginMarker("BuildHiZ");
+
+    const nvrhi::TextureDesc& depthDesc = m_DepthBuffer->getDesc();
+    const nvrhi::TextureDesc& hizDesc = m_HiZTexture->getDesc();
+    uint2 inputSize = uint2(depthDesc.width, depthDesc.height);
+
+    for (uint32_t mipLevel = 0; mipLevel < hizDesc.mipLevels; mipLevel++)
+    {
+        uint2 outputSize = uint2(std::max(hizDesc.width >> mipLevel, 1u), std::max(hizDesc.height >> mipLevel, 1u));
+
+        HiZBuildConstants constants = {};
+        constants.inputSize = inputSize;
+        constants.outputSize = outputSize;
+        commandList->writeBuffer(m_HiZConstantBuffer, &constants, sizeof(constants));
+
+        nvrhi::ComputeState state;
+        state.pipeline = m_HiZPipeline;
+        state.bindings = { m_HiZBindingSets[mipLevel] };
+        commandList->setComputeState(state);
+
+        commandList->dispatch(
+            div_ceil(outputSize.x, HIZ_BUILD_GROUP_SIZE),
+            div_ceil(outputSize.y, HIZ_BUILD_GROUP_SIZE));
+
+        inputSize = outputSize;
+    }
+
+    commandList->endMarker();
+
+    m_HiZValid = true;
+}
+
+void GpuCulling::RenderCompositeView(
+    nvrhi::ICommandList* commandList,
+    const ICompositeView* compositeView,
+    const ICompositeView* compositeViewPrev,
+    FramebufferFactory& framebufferFactory,
+    uint32_t firstViewSlot,
+    IGeometryPass& pass,
+    BaseLocations baseLocations,
+    GeometryPassContext& passContext,
+    const char* passEvent,
+    bool enableOcclusion,
+    bool materialEvents,
+    const IView* stereoCullingView)
+{
+    if (passEvent)
+        commandList->beginMarker(passEvent);
+
+    const ViewType::Enum viewTypes = pass.GetSupportedViewTypes();
+    const uint32_t numChildViews = compositeView->GetNumChildViews(viewTypes);
+
+    // The Hi-Z pyramid covers the whole depth buffer, which only matches a single planar view
+    enableOcclusion = enableOcclusion && m_HiZValid && compositeViewPrev && numChildViews == 1
+        && !compositeView->GetChildView(viewTypes, 0)->IsStereoView();
+
+    for (uint32_t viewIndex = 0; viewIndex < numChildViews; viewIndex++)
+    {
+        const IView* view = compositeView->GetChildView(viewTypes, viewIndex);
+        const IView* viewPrev = compositeViewPrev ? compositeViewPrev->GetChildView(viewTypes, viewIndex) : nullptr;
+
+        const IView* cullingView = view;
+        if (view->IsStereoView())
+        {
+            assert(stereoCullingView);
+            cullingView = stereoCullingView;
+        }
+
+        assert(firstViewSlot + viewIndex < m_ViewSlots.size());
+
+        nvrhi::IFramebuffer* framebuffer = framebufferFactory.GetFramebuffer(*view);
+
+        RenderView(commandList, view, viewPrev, cullingView, framebuffer, firstViewSlot + viewIndex, pass, baseLocations, passContext,
+            enableOcclusion, materialEvents);
+    }
+
+    if (passEvent)
+        commandList->endMarker();
+}
+
+void GpuCulling::RenderView(
+    nvrhi::ICommandList* commandList,
+    const IView* view,
+    const IView* viewPrev,
+    const IView* cullingView,
+    nvrhi::IFramebuffer* framebuffer,
+    uint32_t viewSlot,
+    IGeometryPass& pass,
+    BaseLocations baseLocations,
+    GeometryPassContext& passContext,
+    bool enableOcclusion,
+    bool materialEvents)
+{
+    ViewSlot& slot = m_ViewSlots[viewSlot];
+    if (!slot.bindingSet)
+        return;
+
+    const uint32_t drawArgsBase = viewSlot * uint32_t(m_Batches.size());
+    const uint32_t instanceBase = viewSlot * m_NumRecords;
+
+    pass.SetupView(passContext, commandList, view, viewPrev);
+
+    nvrhi::GraphicsState graphicsState;
+    graphicsState.framebuffer = framebuffer;
+    graphicsState.viewport = view->GetViewportState();
+    graphicsState.shadingRateState = view->GetVariableRateShadingState();
+    graphicsState.indirectParams = m_DrawArgumentsBuffer;
+
+    // Reset the instance counts, the culling shader increments them
+    for (size_t batchIndex = 0; batchIndex < m_Batches.size(); batchIndex++)
+    {
+        nvrhi::DrawIndexedIndirectArguments& args = slot.drawArguments[batchIndex];
+        args = m_Batches[batchIndex].arguments;
+        args.instanceCount = 0;
+        args.startInstanceLocation += instanceBase;
+
+        // The pass gets the base locations in push constants, and the indirect draws must not apply them a second time
+        if (baseLocations == BaseLocations::PushConstants)
+        {
+            args.baseVertexLocation = 0;
+            args.startInstanceLocation = 0;
+        }
+    }
+
+    commandList->writeBuffer(m_DrawArgumentsBuffer, slot.drawArguments.data(),
+        slot.drawArguments.size() * sizeof(nvrhi::DrawIndexedIndirectArguments),
+        drawArgsBase * sizeof(nvrhi::DrawIndexedIndirectArguments));
+
+    // The previous view is only needed for occlusion culling, which stereo views don't use
+    const IView* occlusionViewPrev = cullingView == view ? viewPrev : nullptr;
+
+    GpuCullingConstants constants = {};
+    constants.matWorldToClip = cullingView->GetViewProjectionMatrix(false);
+    constants.matPrevWorldToClip = occlusionViewPrev ? occlusionViewPrev->GetViewProjectionMatrix(false) : constants.matWorldToClip;
+    constants.hizSize = float2(float(m_HiZTexture->getDesc().width), float(m_HiZTexture->getDesc().height));
+    constants.hizMipLevels = m_HiZTexture->getDesc().mipLevels;
+    constants.hizUvScale = float2(1.f);
+    if (occlusionViewPrev && m_DepthBuffer)
+    {
+        // The pyramid was built from the previous frame's depth, which only covers that frame's viewport
+        const nvrhi::Rect prevExtent = occlusionViewPrev->GetViewExtent();
+        constants.hizUvScale = float2(float(prevExtent.width()) / float(m_DepthBuffer->getDesc().width),
+            float(prevExtent.height()) / float(m_DepthBuffer->getDesc().height));
+    }
+    constants.enableOcclusion = enableOcclusion ? 1 : 0;
+    constants.numRecords = m_NumRecords;
+    constants.instanceDataStride = sizeof(InstanceData);
+    constants.drawArgsBase = drawArgsBase;
+    constants.instanceBase = instanceBase;
+    commandList->writeBuffer(slot.constantBuffer, &constants, sizeof(constants));
+
+    nvrhi::ComputeState computeState;
+    computeState.pipeline = m_CullPipeline;
+    computeState.bindings = { slot.bindingSet };
+    commandList->setComputeState(computeState);
+
+    commandList->dispatch(div_ceil(m_NumRecords, GPU_CULLING_GROUP_SIZE));
+
+    const Material* lastMaterial = nullptr;
+    const BufferGroup* lastBuffers = nullptr;
+    nvrhi::RasterCullMode lastCullMode = nvrhi::RasterCullMode::Back;
+    const Material* eventMaterial = nullptr;
+    bool drawMaterial = true;
+    bool stateValid = false;
+
+    for (size_t batchIndex = 0; batchIndex < m_Batches.size(); batchIndex++)
+    {
+        const DrawBatch& batch = m_Batches[batchIndex];
+
+        if (batch.culledBuffers != lastBuffers)
+        {
+            pass.SetupInputBuffers(passContext, batch.culledBuffers, graphicsState);
+            lastBuffers = batch.culledBuffers;
+            stateValid = false;
+        }
+
+        if (batch.material != lastMaterial || batch.cullMode != lastCullMode)
+        {
+            drawMaterial = pass.SetupMaterial(passContext, batch.material, batch.cullMode, graphicsState);
+            lastMaterial = batch.material;
+            lastCullMode = batch.cullMode;
+            stateValid = false;
+        }
+
+        if (!drawMaterial)
+            continue;
+
+        if (!stateValid)
+        {
+            commandList->setGraphicsState(graphicsState);
+            stateValid = true;
+        }
+
+        if (materialEvents && batch.material != eventMaterial)
+        {
+            if (eventMaterial)
+                commandList->endMarker();
+
+            commandList->beginMarker(batch.material->name.c_str());
+            eventMaterial = batch.material;
+        }
+
+        nvrhi::DrawArguments args;
+        args.vertexCount = batch.arguments.indexCount;
+        args.startIndexLocation = batch.arguments.startIndexLocation;
+        args.startVertexLocation = uint32_t(batch.arguments.baseVertexLocation);
+        args.startInstanceLocation = instanceBase + batch.arguments.startInstanceLocation;
+        pass.SetPushConstants(passContext, commandList, graphicsState, args);
+
+        commandList->drawIndexedIndirect(uint32_t((drawArgsBase + batchIndex) * sizeof(nvrhi::DrawIndexedIndirectArguments)));
+    }
+
+    if (eventMaterial)
+        commandList->endMarker();
+}
@@ -0,0 +1,173 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <donut/engine/SceneGraph.h>
+#include <donut/engine/SceneTypes.h>
+#include <donut/engine/View.h>
+#include <donut/render/GeometryPasses.h>
+#include <nvrhi/nvrhi.h>
+
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+namespace donut::engine
+{
+    class FramebufferFactory;
+    class Scene;
+    class ShaderFactory;
+}
+
+// GPU-driven replacement for InstancedOpaqueDrawStrategy.
+// A compute pass tests every opaque (or every transparent, see Domains) pair of (instance, geometry) against the view
+// frustum and, optionally, against a Hi-Z pyramid built from the previous frame's depth. The surviving instances are compacted into a separate
+// instance buffer and counted into drawIndexedIndirect arguments, one indirect draw per geometry.
+//
+// Every view that is culled in a frame uses its own slot, so that the results of different views don't overwrite each other.
+// Different slots may be rendered from different threads.
+class GpuCulling
+{
+public:
+    // Which material domains are culled and drawn. Transparent geometry is drawn in no particular order,
+    // which is only correct for order-independent methods.
+    enum class Domains
+    {
+        Opaque,         // Opaque and alpha tested
+        Transparent     // Blended and transmissive
+    };
+
+    // How a geometry pass consumes the base vertex and instance locations of its draws
+    enum class BaseLocations
+    {
+        DrawArguments,  // From the draw arguments, e.g. passes that use the input assembler
+        PushConstants   // From push constants written by SetPushConstants, which clears them in the draw arguments
+    };
+
+    GpuCulling(nvrhi::IDevice* device, donut::engine::ShaderFactory& shaderFactory, uint32_t numViewSlots, Domains domains = Domains::Opaque);
+
+    // Rebuilds the draw batches when the set of mesh instances has changed, and the Hi-Z pyramid when the depth buffer has changed.
+    // Returns true if the buffer groups used for the culled draws were re-created, in which case the geometry passes
+    // must drop their cached input binding sets.
+    bool Update(nvrhi::ICommandList* commandList, donut::engine::Scene& scene, nvrhi::ITexture* depthBuffer);
+
+    // Culls and draws the geometry for every child view of 'compositeView' that 'pass' supports, starting at 'firstViewSlot'.
+    // 'baseLocations' must match the pass, the indirect draw arguments are written accordingly.
+    // A stereo child view of a single-pass stereo pass is culled with 'stereoCullingView', which must contain both eyes,
+    // and both eyes are rendered by the same indirect draws.
+    // Occlusion culling only applies to single planar views when a valid Hi-Z pyramid exists.
+    void RenderCompositeView(
+        nvrhi::ICommandList* commandList,
+        const donut::engine::ICompositeView* compositeView,
+        const donut::engine::ICompositeView* compositeViewPrev,
+        donut::engine::FramebufferFactory& framebufferFactory,
+        uint32_t firstViewSlot,
+        donut::render::IGeometryPass& pass,
+        BaseLocations baseLocations,
+        donut::render::GeometryPassContext& passContext,
+        const char* passEvent,
+        bool enableOcclusion,
+        bool materialEvents,
+        const donut::engine::IView* stereoCullingView = nullptr);
+
+    // Builds the Hi-Z pyramid from the depth buffer passed to Update. Must be called after all opaque geometry is rendered,
+    // the pyramid is used by the next frame. Multisampled depth buffers are not supported.
+    void BuildHiZ(nvrhi::ICommandList* commandList);
+    void InvalidateHiZ() { m_HiZValid = false; }
+
+    [[nodiscard]] uint32_t GetNumDraws() const { return uint32_t(m_Batches.size()); }
+    [[nodiscard]] uint32_t GetNumCandidates() const { return m_NumRecords; }
+
+    // The indirect draw arguments written by the culling pass, GetNumDraws() per view slot. The instance counts are the
+    // number of visible instances of each draw.
+    [[nodiscard]] nvrhi::IBuffer* GetDrawArgumentsBuffer() const { return m_DrawArgumentsBuffer; }
+    [[nodiscard]] uint64_t GetDrawArgumentsOffset(uint32_t viewSlot) const
+    {
+        return uint64_t(viewSlot) * m_Batches.size() * sizeof(nvrhi::DrawIndexedIndirectArguments);
+    }
+
+private:
+    struct DrawBatch
+    {
+        const donut::engine::Material* material = nullptr;
+        const donut::engine::BufferGroup* buffers = nullptr;
+        const donut::engine::BufferGroup* culledBuffers = nullptr;
+        nvrhi::RasterCullMode cullMode = nvrhi::RasterCullMode::Back;
+        nvrhi::DrawIndexedIndirectArguments arguments; // The instance location is relative to the view's first culled instance
+    };
+
+    struct ViewSlot
+    {
+        nvrhi::BufferHandle constantBuffer;
+        nvrhi::BindingSetHandle bindingSet;
+        std::vector<nvrhi::DrawIndexedIndirectArguments> drawArguments;
+    };
+
+    nvrhi::DeviceHandle m_Device;
+    Domains m_Domains;
+    std::vector<ViewSlot> m_ViewSlots;
+
+    nvrhi::ShaderHandle m_CullShader;
+    nvrhi::BindingLayoutHandle m_CullBindingLayout;
+    nvrhi::ComputePipelineHandle m_CullPipeline;
+
+    nvrhi::ShaderHandle m_HiZShader;
+    nvrhi::BindingLayoutHandle m_HiZBindingLayout;
+    nvrhi::ComputePipelineHandle m_HiZPipeline;
+    nvrhi::BufferHandle m_HiZConstantBuffer;
+    std::vector<nvrhi::BindingSetHandle> m_HiZBindingSets;
+    nvrhi::TextureHandle m_HiZTexture;
+    nvrhi::TextureHandle m_DepthBuffer;
+    bool m_HiZValid = false;
+
+    // Scene state that the batches were built from
+    std::vector<const donut::engine::MeshInstance*> m_Instances;
+    nvrhi::BufferHandle m_SceneInstanceBuffer;
+
+    std::vector<DrawBatch> m_Batches;
+    uint32_t m_NumRecords = 0;
+    nvrhi::BufferHandle m_RecordBuffer;
+    nvrhi::BufferHandle m_DrawArgumentsBuffer;
+    nvrhi::BufferHandle m_CulledInstanceBuffer;
+
+    // Copies of the mesh buffer groups that reference the culled instance buffer instead of the scene instance buffer
+    std::unordered_map<const donut::engine::BufferGroup*, std::shared_ptr<donut::engine::BufferGroup>> m_CulledBufferGroups;
+
+    [[nodiscard]] bool IsSceneChanged(donut::engine::Scene& scene) const;
+    void BuildBatches(nvrhi::ICommandList* commandList, donut::engine::Scene& scene);
+    void CreateHiZ(nvrhi::ITexture* depthBuffer);
+    void CreateCullBindingSets();
+
+    void RenderView(
+        nvrhi::ICommandList* commandList,
+        const donut::engine::IView* view,
+        const donut::engine::IView* viewPrev,
+        const donut::engine::IView* cullingView,
+        nvrhi::IFramebuffer* framebuffer,
+        uint32_t viewSlot,
+        donut::render::IGeometryPass& pass,
+        BaseLocations baseLocations,
+        donut::render::GeometryPassContext& passContext,
+        bool enableOcclusion,
+        bool materialEvents);
+};
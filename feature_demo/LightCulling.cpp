@@ -0,0 +1,301 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+#include "LightCulling.h"
+
+#include <donut/engine/CommonRenderPasses.h>
+#include <donut/engine/ShaderFactory.h>
+#include <donut/render/GBuffer.h>
+#include <nvrhi/utils.h>
+
+#include <algorithm>
+#include <cmath>
+
+using namespace donut;
+using namespace donut::math;
+using namespace donut::engine;
+using namespace donut::render;
+
+#include <donut/shaders/light_cb.h>
+#include "light_culling_cb.h"
+
+LightCulling::LightCulling(nvrhi::IDevice* device, ShaderFactory& shaderFactory)
+    : m_Device(device)
+    , m_BindingCache(device)
+{
+    m_CullShader = shaderFactory.CreateShader("app/light_culling.hlsl", "cull_cs", nullptr, nvrhi::ShaderType::Compute);
+    m_LightingShader = shaderFactory.CreateShader("app/tiled_lighting.hlsl", "main", nullptr, nvrhi::ShaderType::Compute);
+
+    nvrhi::BindingLayoutDesc cullLayoutDesc;
+    cullLayoutDesc.visibility = nvrhi::ShaderType::Compute;
+    cullLayoutDesc.bindings = {
+        nvrhi::BindingLayoutItem::VolatileConstantBuffer(0),
+        nvrhi::BindingLayoutItem::Texture_SRV(0),
+        nvrhi::BindingLayoutItem::StructuredBuffer_SRV(1),
+        nvrhi::BindingLayoutItem::StructuredBuffer_UAV(0),
+        nvrhi::BindingLayoutItem::StructuredBuffer_UAV(1)
+    };
+    m_CullBindingLayout = m_Device->createBindingLayout(cullLayoutDesc);
+
+    auto cullPipelineDesc = nvrhi::ComputePipelineDesc()
+        .setComputeShader(m_CullShader)
+        .addBindingLayout(m_CullBindingLayout);
+    m_CullPipeline = m_Device->createComputePipeline(cullPipelineDesc);
+
+    nvrhi::BindingLayoutDesc lightingLayoutDesc;
+    lightingLayoutDesc.visibility = nvrhi::ShaderType::Compute;
+    lightingLayoutDesc.bindings = {
+        nvrhi::BindingLayoutItem::VolatileConstantBuffer(0),
+        nvrhi::BindingLayoutItem::Texture_SRV(0),
+        nvrhi::BindingLayoutItem::Texture_SRV(1),
+        nvrhi::BindingLayoutItem::Texture_SRV(2),
+        nvrhi::BindingLayoutItem::Texture_SRV(3),
+        nvrhi::BindingLayoutItem::Texture_SRV(4),
+        nvrhi::BindingLayoutItem::StructuredBuffer_SRV(5),
+        nvrhi::BindingLayoutItem::StructuredBuffer_SRV(6),
+        nvrhi::BindingLayoutItem::Texture_UAV(0)
+    };
+    m_LightingBindingLayout = m_Device->createBindingLayout(lightingLayoutDesc);
+
+    auto lightingPipelineDesc = nvrhi::ComputePipelineDesc()
+        .setComputeShader(m_LightingShader)
+        .addBindingLayout(m_LightingBindingLayout);
+    m_LightingPipeline = m_Device->createComputePipeline(lightingPipelineDesc);
+
+    m_ConstantBuffer = m_Device->createBuffer(nvrhi::utils::CreateVolatileConstantBufferDesc(
+        sizeof(LightCullingConstants), "LightCullingConstants", c_MaxRenderPassConstantBufferVersions));
+
+    nvrhi::BufferDesc statsBufferDesc;
+    statsBufferDesc.byteSize = LIGHT_CULLING_STAT_COUNT * sizeof(uint32_t);
+    statsBufferDesc.structStride = sizeof(uint32_t);
+    statsBufferDesc.canHaveUAVs = true;
+    statsBufferDesc.initialState = nvrhi::ResourceStates::UnorderedAccess;
+    statsBufferDesc.keepInitialState = true;
+    statsBufferDesc.debugName = "LightCullingStats";
+    m_StatsBuffer = m_Device->createBuffer(statsBufferDesc);
+}
+
+// Returns the bounding sphere of a local light, or false if the light affects the whole scene.
+static bool GetLocalLightBounds(const Light& light, float3& outCenter, float& outRadius)
+{
+    if (light.shadowMap)
+        return false;
+
+    if (light.GetLightType() == LightType_Point)
+    {
+        const auto& pointLight = static_cast<const PointLight&>(light);
+        if (pointLight.range <= 0.f)
+            return false;
+
+        outCenter = float3(pointLight.GetPosition());
+        outRadius = pointLight.range;
+        return true;
+    }
+
+    if (light.GetLightType() == LightType_Spot)
+    {
+        const auto& spotLight = static_cast<const SpotLight&>(light);
+        if (spotLight.range <= 0.f)
+            return false;
+
+        const float3 position = float3(spotLight.GetPosition());
+        const float3 direction = normalize(float3(spotLight.GetDirection()));
+        const float angle = radians(spotLight.outerAngle);
+
+        if (angle > PI_f * 0.5f)
+        {
+            // Wider than a hemisphere, the cone doesn't have a tighter sphere than the range sphere
+            outCenter = position;
+            outRadius = spotLight.range;
+        }
+        else if (angle > PI_f * 0.25f)
+        {
+            // The sphere through the apex and the cap rim, centered on the cap
+            outCenter = position + direction * (cosf(angle) * spotLight.range);
+            outRadius = sinf(angle) * spotLight.range;
+        }
+        else
+        {
+            // The sphere through the apex and the cap rim, centered on the axis
+            outRadius = spotLight.range / (2.f * cosf(angle));
+            outCenter = position + direction * outRadius;
+        }
+        return true;
+    }
+
+    return false;
+}
+
+void LightCulling::PrepareLights(const std::vector<std::shared_ptr<Light>>& sceneLights, const IView& view, size_t maxForwardLights)
+{
+    m_GlobalLights.clear();
+    m_LocalLights.clear();
+    m_ForwardLights.clear();
+
+    const frustum viewFrustum = view.GetViewFrustum();
+    const float3 viewOrigin = view.GetViewOrigin();
+
+    for (const auto& light : sceneLights)
+    {
+        LocalLight localLight;
+        if (!GetLocalLightBounds(*light, localLight.center, localLight.radius))
+        {
+            m_GlobalLights.push_back(light);
+            continue;
+        }
+
+        if (!viewFrustum.intersectsWith(box3(localLight.center - localLight.radius, localLight.center + localLight.radius)))
+            continue;
+
+        localLight.light = light;
+        localLight.cameraDistance = std::max(0.f, length(localLight.center - viewOrigin) - localLight.radius);
+        m_LocalLights.push_back(std::move(localLight));
+    }
+
+    // Closest lights first, so that the forward pass keeps the ones that are most likely to be visible
+    std::sort(m_LocalLights.begin(), m_LocalLights.end(), [](const LocalLight& a, const LocalLight& b)
+    {
+        return a.cameraDistance < b.cameraDistance;
+    });
+
+    m_ForwardLights = m_GlobalLights;
+    for (const LocalLight& localLight : m_LocalLights)
+    {
+        if (m_ForwardLights.size() >= maxForwardLights)
+            break;
+
+        m_ForwardLights.push_back(localLight.light);
+    }
+}
+
+void LightCulling::CreateLightBuffers(uint32_t numLights)
+{
+    m_LightBufferCapacity = std::max(numLights, m_LightBufferCapacity * 2);
+
+    nvrhi::BufferDesc bufferDesc;
+    bufferDesc.byteSize = uint64_t(m_LightBufferCapacity) * sizeof(LightConstants);
+    bufferDesc.structStride = sizeof(LightConstants);
+    bufferDesc.initialState = nvrhi::ResourceStates::ShaderResource;
+    bufferDesc.keepInitialState = true;
+    bufferDesc.debugName = "TiledLights";
+    m_LightBuffer = m_Device->createBuffer(bufferDesc);
+
+    bufferDesc.byteSize = uint64_t(m_LightBufferCapacity) * sizeof(float4);
+    bufferDesc.structStride = sizeof(float4);
+    bufferDesc.debugName = "TiledLightBounds";
+    m_LightBoundsBuffer = m_Device->createBuffer(bufferDesc);
+
+    m_BindingCache.Clear();
+}
+
+void LightCulling::CreateTileBuffer(uint2 tileCount)
+{
+    m_TileBufferCapacity = tileCount.x * tileCount.y;
+
+    nvrhi::BufferDesc bufferDesc;
+    bufferDesc.byteSize = uint64_t(m_TileBufferCapacity) * LIGHT_CULLING_MAX_LIGHTS_PER_TILE * sizeof(uint32_t);
+    bufferDesc.structStride = sizeof(uint32_t);
+    bufferDesc.canHaveUAVs = true;
+    bufferDesc.initialState = nvrhi::ResourceStates::ShaderResource;
+    bufferDesc.keepInitialState = true;
+    bufferDesc.debugName = "TileLights";
+    m_TileLightsBuffer = m_Device->createBuffer(bufferDesc);
+
+    m_BindingCache.Clear();
+}
+
+void LightCulling::CullLights(nvrhi::ICommandList* commandList, const IView& view, nvrhi::ITexture* depthBuffer)
+{
+    if (m_LocalLights.empty())
+        return;
+
+    const uint32_t numLights = uint32_t(m_LocalLights.size());
+    if (numLights > m_LightBufferCapacity)
+        CreateLightBuffers(numLights);
+
+    LightCullingConstants constants = {};
+    view.FillPlanarViewConstants(constants.view);
+    constants.tileCount.x = (uint32_t(constants.view.viewportSize.x) + LIGHT_CULLING_TILE_SIZE - 1) / LIGHT_CULLING_TILE_SIZE;
+    constants.tileCount.y = (uint32_t(constants.view.viewportSize.y) + LIGHT_CULLING_TILE_SIZE - 1) / LIGHT_CULLING_TILE_SIZE;
+    constants.numLights = numLights;
+    constants.reverseDepth = view.IsReverseDepth() ? 1 : 0;
+
+    if (constants.tileCount.x * constants.tileCount.y > m_TileBufferCapacity)
+        CreateTileBuffer(constants.tileCount);
+    m_TileCount = constants.tileCount;
+
+    std::vector<LightConstants> lightConstants(numLights);
+    std::vector<float4> lightBounds(numLights);
+    for (uint32_t index = 0; index < numLights; index++)
+    {
+        const LocalLight& localLight = m_LocalLights[index];
+        localLight.light->FillLightConstants(lightConstants[index]);
+        lightBounds[index] = float4(localLight.center, localLight.radius);
+    }
+
+    commandList->writeBuffer(m_LightBuffer, lightConstants.data(), lightConstants.size() * sizeof(LightConstants));
+    commandList->writeBuffer(m_LightBoundsBuffer, lightBounds.data(), lightBounds.size() * sizeof(float4));
+    commandList->writeBuffer(m_ConstantBuffer, &constants, sizeof(constants));
+
+    nvrhi::BindingSetDesc bindingSetDesc;
+    bindingSetDesc.bindings = {
+        nvrhi::BindingSetItem::ConstantBuffer(0, m_ConstantBuffer),
+        nvrhi::BindingSetItem::Texture_SRV(0, depthBuffer),
+        nvrhi::BindingSetItem::StructuredBuffer_SRV(1, m_LightBoundsBuffer),
+        nvrhi::BindingSetItem::StructuredBuffer_UAV(0, m_TileLightsBuffer),
+        nvrhi::BindingSetItem::StructuredBuffer_UAV(1, m_StatsBuffer)
+    };
+    nvrhi::BindingSetHandle bindingSet = m_BindingCache.GetOrCreateBindingSet(bindingSetDesc, m_CullBindingLayout);
+
+    commandList->clearBufferUInt(m_StatsBuffer, 0);
+
+    nvrhi::ComputeState state;
+    state.pipeline = m_CullPipeline;
+    state.bindings = { bindingSet };
+    commandList->setComputeState(state);
+    commandList->dispatch(constants.tileCount.x, constants.tileCount.y);
+}
+
+void LightCulling::RenderDeferredLighting(nvrhi::ICommandList* commandList, const GBufferRenderTargets& gbuffer, nvrhi::ITexture* outputTexture)
+{
+    if (m_LocalLights.empty())
+        return;
+
+    nvrhi::BindingSetDesc bindingSetDesc;
+    bindingSetDesc.bindings = {
+        nvrhi::BindingSetItem::ConstantBuffer(0, m_ConstantBuffer),
+        nvrhi::BindingSetItem::Texture_SRV(0, gbuffer.Depth),
+        nvrhi::BindingSetItem::Texture_SRV(1, gbuffer.GBufferDiffuse),
+        nvrhi::BindingSetItem::Texture_SRV(2, gbuffer.GBufferSpecular),
+        nvrhi::BindingSetItem::Texture_SRV(3, gbuffer.GBufferNormals),
+        nvrhi::BindingSetItem::Texture_SRV(4, gbuffer.GBufferEmissive),
+        nvrhi::BindingSetItem::StructuredBuffer_SRV(5, m_LightBuffer),
+        nvrhi::BindingSetItem::StructuredBuffer_SRV(6, m_TileLightsBuffer),
+        nvrhi::BindingSetItem::Texture_UAV(0, outputTexture)
+    };
+    nvrhi::BindingSetHandle bindingSet = m_BindingCache.GetOrCreateBindingSet(bindingSetDesc, m_LightingBindingLayout);
+
+    nvrhi::ComputeState state;
+    state.pipeline = m_LightingPipeline;
+    state.bindings = { bindingSet };
+    commandList->setComputeState(state);
+    commandList->dispatch(m_TileCount.x, m_TileCount.y);
+}
@@ -0,0 +1,107 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+#pragma once
+
+#include <donut/engine/BindingCache.h>
+#include <donut/engine/SceneTypes.h>
+#include <donut/engine/View.h>
+#include <nvrhi/nvrhi.h>
+
+#include <memory>
+#include <vector>
+
+namespace donut::engine
+{
+    class ShaderFactory;
+}
+
+namespace donut::render
+{
+    class GBufferRenderTargets;
+}
+
+// Tiled culling and shading of the scene's local lights.
+// Point and spot lights with a finite range and no shadow map are local: they are culled against the view frustum on the CPU,
+// binned into screen tiles by a compute pass that reads the depth buffer, and shaded by a tiled pass that adds their light
+// to the output of the deferred lighting pass. All other lights are global and go through the regular lighting passes.
+//
+// The forward shading pass can't consume the tile lists, so it gets the global lights followed by the local lights
+// closest to the camera, up to its light limit.
+class LightCulling
+{
+public:
+    LightCulling(nvrhi::IDevice* device, donut::engine::ShaderFactory& shaderFactory);
+
+    // Sorts the scene lights into global and visible local lights for the view. Must be called once per frame before the other functions.
+    void PrepareLights(const std::vector<std::shared_ptr<donut::engine::Light>>& sceneLights, const donut::engine::IView& view, size_t maxForwardLights);
+
+    [[nodiscard]] const std::vector<std::shared_ptr<donut::engine::Light>>& GetGlobalLights() const { return m_GlobalLights; }
+    [[nodiscard]] const std::vector<std::shared_ptr<donut::engine::Light>>& GetForwardLights() const { return m_ForwardLights; }
+    [[nodiscard]] uint32_t GetNumLocalLights() const { return uint32_t(m_LocalLights.size()); }
+
+    // Bins the local lights into tiles using the depth buffer. 'view' must be a single planar view.
+    void CullLights(nvrhi::ICommandList* commandList, const donut::engine::IView& view, nvrhi::ITexture* depthBuffer);
+
+    // Adds the light of the local lights to 'outputTexture'. Must be recorded after CullLights, into the same command list.
+    void RenderDeferredLighting(nvrhi::ICommandList* commandList, const donut::render::GBufferRenderTargets& gbuffer, nvrhi::ITexture* outputTexture);
+
+    // LIGHT_CULLING_STAT_COUNT uints written by the last CullLights, see light_culling_cb.h. Not written when there are no local lights.
+    [[nodiscard]] nvrhi::IBuffer* GetStatsBuffer() const { return m_StatsBuffer; }
+
+    void ResetBindingCache() { m_BindingCache.Clear(); }
+
+private:
+    struct LocalLight
+    {
+        std::shared_ptr<donut::engine::Light> light;
+        donut::math::float3 center;
+        float radius = 0.f;
+        float cameraDistance = 0.f;
+    };
+
+    nvrhi::DeviceHandle m_Device;
+    donut::engine::BindingCache m_BindingCache;
+
+    nvrhi::ShaderHandle m_CullShader;
+    nvrhi::BindingLayoutHandle m_CullBindingLayout;
+    nvrhi::ComputePipelineHandle m_CullPipeline;
+
+    nvrhi::ShaderHandle m_LightingShader;
+    nvrhi::BindingLayoutHandle m_LightingBindingLayout;
+    nvrhi::ComputePipelineHandle m_LightingPipeline;
+
+    nvrhi::BufferHandle m_ConstantBuffer;
+    nvrhi::BufferHandle m_LightBuffer;
+    nvrhi::BufferHandle m_LightBoundsBuffer;
+    nvrhi::BufferHandle m_TileLightsBuffer;
+    nvrhi::BufferHandle m_StatsBuffer;
+    uint32_t m_LightBufferCapacity = 0;
+    donut::math::uint2 m_TileCount = 0u;
+    uint32_t m_TileBufferCapacity = 0; // In tiles, only grows so that a changing viewport doesn't reallocate the buffer
+
+    std::vector<std::shared_ptr<donut::engine::Light>> m_GlobalLights;
+    std::vector<std::shared_ptr<donut::engine::Light>> m_ForwardLights;
+    std::vector<LocalLight> m_LocalLights;
+
+    void CreateLightBuffers(uint32_t numLights);
+    void CreateTileBuffer(donut::math::uint2 tileCount);
+};
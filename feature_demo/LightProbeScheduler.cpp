@@ -0,0 +1,534 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+#include "LightProbeScheduler.h"
+
+#include <donut/engine/ShaderFactory.h>
+#include <nvrhi/utils.h>
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <utility>
+
+using namespace donut;
+using namespace donut::math;
+using namespace donut::engine;
+
+#include "light_probe_filter_cb.h"
+
+static const uint32_t c_NumCubemapFaces = 6;
+
+LightProbeScheduler::LightProbeScheduler(nvrhi::IDevice* device, ShaderFactory& shaderFactory,
+    uint32_t captureSize, uint32_t captureMipLevels, float nearPlane, float cullDistance)
+    : m_Device(device)
+    , m_CaptureSize(captureSize)
+    , m_CaptureMipLevels(captureMipLevels)
+    , m_NearPlane(nearPlane)
+    , m_CullDistance(cullDistance)
+    , m_BindingCache(device)
+{
+    m_UseComputeQueue = m_Device->queryFeatureSupport(nvrhi::Feature::ComputeQueue);
+
+    m_DownsampleShader = shaderFactory.CreateShader("app/light_probe_filter.hlsl", "downsample_cs", nullptr, nvrhi::ShaderType::Compute);
+    m_DiffuseShader = shaderFactory.CreateShader("app/light_probe_filter.hlsl", "diffuse_cs", nullptr, nvrhi::ShaderType::Compute);
+    m_SpecularShader = shaderFactory.CreateShader("app/light_probe_filter.hlsl", "specular_cs", nullptr, nvrhi::ShaderType::Compute);
+
+    nvrhi::BindingLayoutDesc downsampleLayoutDesc;
+    downsampleLayoutDesc.visibility = nvrhi::ShaderType::Compute;
+    downsampleLayoutDesc.bindings = {
+        nvrhi::BindingLayoutItem::VolatileConstantBuffer(0),
+        nvrhi::BindingLayoutItem::Texture_SRV(0),
+        nvrhi::BindingLayoutItem::Texture_UAV(0)
+    };
+    m_DownsampleBindingLayout = m_Device->createBindingLayout(downsampleLayoutDesc);
+
+    nvrhi::BindingLayoutDesc filterLayoutDesc;
+    filterLayoutDesc.visibility = nvrhi::ShaderType::Compute;
+    filterLayoutDesc.bindings = {
+        nvrhi::BindingLayoutItem::VolatileConstantBuffer(0),
+        nvrhi::BindingLayoutItem::Texture_SRV(1),
+        nvrhi::BindingLayoutItem::Sampler(0),
+        nvrhi::BindingLayoutItem::Texture_UAV(0)
+    };
+    m_FilterBindingLayout = m_Device->createBindingLayout(filterLayoutDesc);
+
+    m_DownsamplePipeline = m_Device->createComputePipeline(nvrhi::ComputePipelineDesc()
+        .setComputeShader(m_DownsampleShader)
+        .addBindingLayout(m_DownsampleBindingLayout));
+    m_DiffusePipeline = m_Device->createComputePipeline(nvrhi::ComputePipelineDesc()
+        .setComputeShader(m_DiffuseShader)
+        .addBindingLayout(m_FilterBindingLayout));
+    m_SpecularPipeline = m_Device->createComputePipeline(nvrhi::ComputePipelineDesc()
+        .setComputeShader(m_SpecularShader)
+        .addBindingLayout(m_FilterBindingLayout));
+
+    m_ConstantBuffer = m_Device->createBuffer(nvrhi::utils::CreateVolatileConstantBufferDesc(
+        sizeof(LightProbeFilterConstants), "LightProbeFilterConstants", c_MaxRenderPassConstantBufferVersions));
+
+    auto samplerDesc = nvrhi::SamplerDesc()
+        .setAllFilters(true)
+        .setAllAddressModes(nvrhi::SamplerAddressMode::Clamp);
+    m_LinearSampler = m_Device->createSampler(samplerDesc);
+
+    m_FilterCommandList = m_Device->createCommandList(nvrhi::CommandListParameters()
+        .setEnableImmediateExecution(false)
+        .setQueueType(m_UseComputeQueue ? nvrhi::CommandQueue::Compute : nvrhi::CommandQueue::Graphics));
+
+    // The capture targets start in the ShaderResource state, which is valid on both queues.
+    // The graphics queue moves them to RenderTarget for rendering and the compute queue to UnorderedAccess for filtering.
+    nvrhi::TextureDesc colorDesc;
+    colorDesc.width = m_CaptureSize;
+    colorDesc.height = m_CaptureSize;
+    colorDesc.mipLevels = m_CaptureMipLevels;
+    colorDesc.arraySize = c_NumCubemapFaces;
+    colorDesc.dimension = nvrhi::TextureDimension::TextureCube;
+    colorDesc.format = nvrhi::Format::RGBA16_FLOAT;
+    colorDesc.isRenderTarget = true;
+    colorDesc.isUAV = true;
+    colorDesc.clearValue = nvrhi::Color(0.f);
+    colorDesc.useClearValue = true;
+    colorDesc.initialState = nvrhi::ResourceStates::ShaderResource;
+    colorDesc.keepInitialState = true;
+
+    const nvrhi::Format depthFormats[] = {
+        nvrhi::Format::D24S8,
+        nvrhi::Format::D32,
+        nvrhi::Format::D16,
+        nvrhi::Format::D32S8 };
+
+    const nvrhi::FormatSupport depthFeatures =
+        nvrhi::FormatSupport::Texture |
+        nvrhi::FormatSupport::DepthStencil |
+        nvrhi::FormatSupport::ShaderLoad;
+
+    // Only one capture renders at a time, so the depth buffer is shared by all capture targets
+    nvrhi::TextureDesc depthDesc = colorDesc;
+    depthDesc.mipLevels = 1;
+    depthDesc.format = nvrhi::utils::ChooseFormat(m_Device, depthFeatures, depthFormats, std::size(depthFormats));
+    depthDesc.isUAV = false;
+    depthDesc.isTypeless = true;
+    depthDesc.initialState = nvrhi::ResourceStates::DepthWrite;
+    depthDesc.debugName = "LightProbeCaptureDepth";
+    m_CaptureDepth = m_Device->createTexture(depthDesc);
+
+    for (uint32_t index = 0; index < c_NumCaptureTargets; index++)
+    {
+        CaptureTarget& target = m_CaptureTargets[index];
+
+        colorDesc.debugName = "LightProbeCaptureColor" + std::to_string(index);
+        target.color = m_Device->createTexture(colorDesc);
+
+        target.framebuffer = std::make_shared<FramebufferFactory>(m_Device);
+        target.framebuffer->RenderTargets = { target.color };
+        target.framebuffer->DepthTarget = m_CaptureDepth;
+
+        target.filterQuery = m_Device->createEventQuery();
+        target.view.SetArrayViewports(m_CaptureSize, 0);
+    }
+
+    m_ReferenceView.SetArrayViewports(m_CaptureSize, 0);
+    m_ReferenceView.SetTransform(affine3::identity(), m_NearPlane, m_CullDistance);
+    m_ReferenceView.UpdateCache();
+}
+
+void LightProbeScheduler::SetProbes(const std::vector<std::shared_ptr<LightProbe>>& probes)
+{
+    for (CaptureTarget& target : m_CaptureTargets)
+    {
+        // Filtering work that is still on the GPU keeps its target busy until it completes, the result is dropped
+        target.probeIndex = -1;
+        if (target.state != CaptureState::Filtering)
+            target.state = CaptureState::Free;
+    }
+
+    m_Probes.clear();
+    m_Probes.reserve(probes.size());
+    for (const auto& probe : probes)
+    {
+        ProbeRecord record;
+        record.probe = probe;
+        m_Probes.push_back(record);
+    }
+
+    if (probes.empty())
+        return;
+
+    // The staging maps have the layout of one probe in the shared cube arrays
+    nvrhi::TextureDesc diffuseDesc = probes[0]->diffuseMap->getDesc();
+    nvrhi::TextureDesc specularDesc = probes[0]->specularMap->getDesc();
+    for (nvrhi::TextureDesc* desc : { &diffuseDesc, &specularDesc })
+    {
+        desc->arraySize = c_NumCubemapFaces;
+        desc->dimension = nvrhi::TextureDimension::TextureCube;
+        desc->isRenderTarget = false;
+        desc->isUAV = true;
+        desc->initialState = nvrhi::ResourceStates::ShaderResource;
+        desc->keepInitialState = true;
+    }
+
+    for (CaptureTarget& target : m_CaptureTargets)
+    {
+        if (target.diffuse && target.diffuse->getDesc().width == diffuseDesc.width && target.diffuse->getDesc().mipLevels == diffuseDesc.mipLevels &&
+            target.specular && target.specular->getDesc().width == specularDesc.width && target.specular->getDesc().mipLevels == specularDesc.mipLevels)
+            continue;
+
+        diffuseDesc.debugName = "LightProbeStagingDiffuse";
+        target.diffuse = m_Device->createTexture(diffuseDesc);
+        specularDesc.debugName = "LightProbeStagingSpecular";
+        target.specular = m_Device->createTexture(specularDesc);
+    }
+
+    m_BindingCache.Clear();
+}
+
+void LightProbeScheduler::SetProbePosition(const LightProbe& probe, const float3& position, const box3& influenceBounds)
+{
+    for (ProbeRecord& record : m_Probes)
+    {
+        if (record.probe.get() == &probe)
+        {
+            // The old contents are wrong for the new position, the probe is not used until it is captured again
+            record.position = position;
+            record.influenceBounds = influenceBounds;
+            record.valid = false;
+            record.dirty = true;
+            record.probe->enabled = false;
+            return;
+        }
+    }
+}
+
+void LightProbeScheduler::InvalidateAll()
+{
+    for (ProbeRecord& record : m_Probes)
+        record.dirty = true;
+}
+
+void LightProbeScheduler::InvalidateBounds(const box3& bounds, float margin)
+{
+    if (bounds.isempty())
+        return;
+
+    for (ProbeRecord& record : m_Probes)
+    {
+        if (!record.dirty && record.influenceBounds.grow(margin).intersects(bounds))
+            record.dirty = true;
+    }
+}
+
+int LightProbeScheduler::SelectNextProbe(const float3& cameraPosition) const
+{
+    int bestIndex = -1;
+    float bestScore = 0.f;
+
+    for (size_t index = 0; index < m_Probes.size(); index++)
+    {
+        const ProbeRecord& record = m_Probes[index];
+        if (record.inFlight || record.influenceBounds.isempty())
+            continue;
+
+        // The integer part of the score is the priority group, the fraction orders the probes in a group by distance
+        float score;
+        if (!record.valid)
+            score = 3.f;
+        else if (record.dirty)
+            score = 2.f;
+        else if (m_Settings.refreshIntervalFrames > 0 && m_FrameIndex - record.lastCaptureFrame >= m_Settings.refreshIntervalFrames)
+            score = 1.f;
+        else
+            continue;
+
+        score += 1.f / (2.f + length(record.position - cameraPosition));
+
+        if (score > bestScore)
+        {
+            bestScore = score;
+            bestIndex = int(index);
+        }
+    }
+
+    return bestIndex;
+}
+
+void LightProbeScheduler::BeginCapture(CaptureTarget& target, int probeIndex)
+{
+    ProbeRecord& record = m_Probes[probeIndex];
+
+    // Changes that happen during the capture may not be in all faces, so they mark the probe dirty again
+    record.dirty = false;
+    record.inFlight = true;
+
+    target.probeIndex = probeIndex;
+    target.position = record.position;
+    target.facesRendered = 0;
+    target.state = CaptureState::Rendering;
+    target.view.SetTransform(translation(-record.position), m_NearPlane, m_CullDistance);
+    target.view.UpdateCache();
+}
+
+void LightProbeScheduler::FinishCapture(nvrhi::ICommandList* commandList, CaptureTarget& target)
+{
+    m_Device->resetEventQuery(target.filterQuery);
+    target.state = CaptureState::Free;
+
+    if (target.probeIndex < 0)
+        return;
+
+    ProbeRecord& record = m_Probes[target.probeIndex];
+    LightProbe& probe = *record.probe;
+    target.probeIndex = -1;
+    record.inFlight = false;
+
+    // The probe was moved while it was being captured, the next capture will be at the new position
+    if (any(record.position != target.position))
+        return;
+
+    commandList->beginMarker("LightProbeCopy");
+
+    for (uint32_t face = 0; face < c_NumCubemapFaces; face++)
+    {
+        for (uint32_t mipLevel = 0; mipLevel < target.diffuse->getDesc().mipLevels; mipLevel++)
+        {
+            commandList->copyTexture(
+                probe.diffuseMap, nvrhi::TextureSlice().setArraySlice(probe.diffuseArrayIndex * c_NumCubemapFaces + face).setMipLevel(mipLevel),
+                target.diffuse, nvrhi::TextureSlice().setArraySlice(face).setMipLevel(mipLevel));
+        }
+
+        for (uint32_t mipLevel = 0; mipLevel < target.specular->getDesc().mipLevels; mipLevel++)
+        {
+            commandList->copyTexture(
+                probe.specularMap, nvrhi::TextureSlice().setArraySlice(probe.specularArrayIndex * c_NumCubemapFaces + face).setMipLevel(mipLevel),
+                target.specular, nvrhi::TextureSlice().setArraySlice(face).setMipLevel(mipLevel));
+        }
+    }
+
+    commandList->endMarker();
+
+    record.valid = true;
+    record.lastCaptureFrame = m_FrameIndex;
+
+    probe.bounds = frustum::fromBox(record.influenceBounds);
+    probe.enabled = true;
+}
+
+void LightProbeScheduler::Update(nvrhi::ICommandList* commandList, const float3& cameraPosition, const RenderFaceCallback& renderFace)
+{
+    m_FrameIndex++;
+
+    for (CaptureTarget& target : m_CaptureTargets)
+    {
+        // Polling the query instead of waiting for the compute queue keeps the graphics queue running
+        if (target.state == CaptureState::Filtering && m_Device->pollEventQuery(target.filterQuery))
+            FinishCapture(commandList, target);
+    }
+
+    int activeTargetIndex = -1;
+    for (uint32_t index = 0; index < c_NumCaptureTargets; index++)
+    {
+        if (m_CaptureTargets[index].state == CaptureState::Rendering)
+        {
+            activeTargetIndex = int(index);
+            break;
+        }
+    }
+
+    if (activeTargetIndex < 0)
+    {
+        for (uint32_t index = 0; index < c_NumCaptureTargets; index++)
+        {
+            if (m_CaptureTargets[index].state != CaptureState::Free)
+                continue;
+
+            int probeIndex = SelectNextProbe(cameraPosition);
+            if (probeIndex >= 0)
+            {
+                BeginCapture(m_CaptureTargets[index], probeIndex);
+                activeTargetIndex = int(index);
+            }
+            break;
+        }
+    }
+
+    if (activeTargetIndex < 0)
+        return;
+
+    CaptureTarget& target = m_CaptureTargets[activeTargetIndex];
+    const nvrhi::FormatInfo& depthFormatInfo = nvrhi::getFormatInfo(m_CaptureDepth->getDesc().format);
+
+    commandList->beginMarker("LightProbeCapture");
+
+    for (uint32_t face = 0; face < m_Settings.facesPerFrame && target.facesRendered < c_NumCubemapFaces; face++)
+    {
+        const uint32_t faceIndex = target.facesRendered;
+        const nvrhi::TextureSubresourceSet faceSlice(0, 1, faceIndex, 1);
+
+        commandList->clearTextureFloat(target.color, faceSlice, nvrhi::Color(0.f));
+        commandList->clearDepthStencilTexture(m_CaptureDepth, faceSlice, true, 0.f, depthFormatInfo.hasStencil, 0);
+
+        renderFace(commandList, *target.view.GetChildView(ViewType::PLANAR, faceIndex), *target.framebuffer, uint32_t(activeTargetIndex), faceIndex == 0);
+
+        target.facesRendered++;
+    }
+
+    commandList->endMarker();
+
+    if (target.facesRendered == c_NumCubemapFaces)
+        target.state = CaptureState::ReadyToFilter;
+}
+
+void LightProbeScheduler::Dispatch(nvrhi::IComputePipeline* pipeline, nvrhi::ITexture* source, uint32_t sourceMip, nvrhi::ITexture* output, uint32_t outputMip,
+    uint32_t sampleCount, float roughness)
+{
+    const bool downsample = pipeline == m_DownsamplePipeline;
+    const uint32_t outputSize = std::max(output->getDesc().width >> outputMip, 1u);
+
+    nvrhi::BindingSetDesc bindingSetDesc;
+    bindingSetDesc.bindings = {
+        nvrhi::BindingSetItem::ConstantBuffer(0, m_ConstantBuffer),
+        nvrhi::BindingSetItem::Texture_UAV(0, output, nvrhi::Format::UNKNOWN, nvrhi::TextureSubresourceSet(outputMip, 1, 0, c_NumCubemapFaces), nvrhi::TextureDimension::Texture2DArray)
+    };
+
+    if (downsample)
+    {
+        bindingSetDesc.bindings.push_back(nvrhi::BindingSetItem::Texture_SRV(0, source, nvrhi::Format::UNKNOWN,
+            nvrhi::TextureSubresourceSet(sourceMip, 1, 0, c_NumCubemapFaces), nvrhi::TextureDimension::Texture2DArray));
+    }
+    else
+    {
+        bindingSetDesc.bindings.push_back(nvrhi::BindingSetItem::Texture_SRV(1, source));
+        bindingSetDesc.bindings.push_back(nvrhi::BindingSetItem::Sampler(0, m_LinearSampler));
+    }
+
+    nvrhi::BindingSetHandle bindingSet = m_BindingCache.GetOrCreateBindingSet(bindingSetDesc,
+        downsample ? m_DownsampleBindingLayout : m_FilterBindingLayout);
+
+    LightProbeFilterConstants constants = {};
+    constants.outputSize = outputSize;
+    constants.sampleCount = sampleCount;
+    constants.roughness = roughness;
+    constants.sourceMipLevels = float(source->getDesc().mipLevels);
+    constants.sourceTexelSolidAngle = 4.f * PI_f / (float(c_NumCubemapFaces) * float(m_CaptureSize) * float(m_CaptureSize));
+    m_FilterCommandList->writeBuffer(m_ConstantBuffer, &constants, sizeof(constants));
+
+    nvrhi::ComputeState state;
+    state.pipeline = pipeline;
+    state.bindings = { bindingSet };
+    m_FilterCommandList->setComputeState(state);
+
+    const uint32_t groups = (outputSize + LIGHT_PROBE_FILTER_GROUP_SIZE - 1) / LIGHT_PROBE_FILTER_GROUP_SIZE;
+    m_FilterCommandList->dispatch(groups, groups, c_NumCubemapFaces);
+}
+
+void LightProbeScheduler::RecordFiltering(CaptureTarget& target)
+{
+    m_FilterCommandList->beginMarker("LightProbeFiltering");
+
+    for (uint32_t mipLevel = 1; mipLevel < m_CaptureMipLevels; mipLevel++)
+    {
+        Dispatch(m_DownsamplePipeline, target.color, mipLevel - 1, target.color, mipLevel, 0, 0.f);
+    }
+
+    Dispatch(m_DiffusePipeline, target.color, 0, target.diffuse, 0, m_Settings.diffuseSampleCount, 0.f);
+
+    const uint32_t specularMipLevels = target.specular->getDesc().mipLevels;
+    for (uint32_t mipLevel = 0; mipLevel < specularMipLevels; mipLevel++)
+    {
+        float roughness = specularMipLevels > 1 ? powf(float(mipLevel) / float(specularMipLevels - 1), 2.0f) : 0.f;
+        Dispatch(m_SpecularPipeline, target.color, 0, target.specular, mipLevel, m_Settings.specularSampleCount, roughness);
+    }
+
+    m_FilterCommandList->endMarker();
+}
+
+void LightProbeScheduler::SubmitFiltering(uint64_t graphicsSubmission)
+{
+    bool anyReady = false;
+    for (const CaptureTarget& target : m_CaptureTargets)
+        anyReady |= target.state == CaptureState::ReadyToFilter;
+
+    if (!anyReady)
+        return;
+
+    m_FilterCommandList->open();
+
+    for (CaptureTarget& target : m_CaptureTargets)
+    {
+        if (target.state == CaptureState::ReadyToFilter)
+            RecordFiltering(target);
+    }
+
+    m_FilterCommandList->close();
+
+    const nvrhi::CommandQueue queue = m_UseComputeQueue ? nvrhi::CommandQueue::Compute : nvrhi::CommandQueue::Graphics;
+    if (m_UseComputeQueue)
+    {
+        // The faces were rendered by the graphics submission, the filtering must not start before it is done
+        m_Device->queueWaitForCommandList(nvrhi::CommandQueue::Compute, nvrhi::CommandQueue::Graphics, graphicsSubmission);
+    }
+    m_Device->executeCommandList(m_FilterCommandList, queue);
+
+    for (CaptureTarget& target : m_CaptureTargets)
+    {
+        if (target.state == CaptureState::ReadyToFilter)
+        {
+            m_Device->setEventQuery(target.filterQuery, queue);
+            target.state = CaptureState::Filtering;
+        }
+    }
+}
+
+std::vector<std::shared_ptr<LightProbe>> LightProbeScheduler::GetClosestProbes(const float3& position, size_t maxCount) const
+{
+    std::vector<std::pair<float, const ProbeRecord*>> candidates;
+    for (const ProbeRecord& record : m_Probes)
+    {
+        if (record.probe->enabled)
+            candidates.push_back(std::make_pair(lengthSquared(record.position - position), &record));
+    }
+
+    const size_t count = std::min(maxCount, candidates.size());
+    std::partial_sort(candidates.begin(), candidates.begin() + count, candidates.end(),
+        [](const auto& a, const auto& b) { return a.first < b.first; });
+
+    std::vector<std::shared_ptr<LightProbe>> result;
+    result.reserve(count);
+    for (size_t index = 0; index < count; index++)
+        result.push_back(candidates[index].second->probe);
+
+    return result;
+}
+
+uint32_t LightProbeScheduler::GetNumValidProbes() const
+{
+    uint32_t count = 0;
+    for (const ProbeRecord& record : m_Probes)
+        count += record.valid ? 1 : 0;
+    return count;
+}
+
+uint32_t LightProbeScheduler::GetNumPendingProbes() const
+{
+    uint32_t count = 0;
+    for (const ProbeRecord& record : m_Probes)
+        count += (!record.influenceBounds.isempty() && (!record.valid || record.dirty)) ? 1 : 0;
+    return count;
+}
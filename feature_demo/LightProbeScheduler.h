@@ -0,0 +1,165 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <donut/engine/BindingCache.h>
+#include <donut/engine/FramebufferFactory.h>
+#include <donut/engine/SceneTypes.h>
+#include <donut/engine/View.h>
+#include <nvrhi/nvrhi.h>
+
+#include <array>
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace donut::engine
+{
+    class ShaderFactory;
+}
+
+// Incremental capture and prefiltering of light probes.
+// A capture renders the six faces of a cubemap at the probe position, a few faces per frame, into one of a small ring of
+// pooled capture targets. When all faces are done, the mip chain and the diffuse and specular maps are computed on the
+// async compute queue (or on the graphics queue if there is none) into staging textures owned by the capture target.
+// Once that work has finished on the GPU, the results are copied into the probe's slices of the shared cube arrays,
+// so the lighting passes never read a probe that is being written.
+//
+// The probe to capture next is picked by priority: probes that were never captured come first, then probes that were
+// invalidated by a scene change, then the oldest probes if periodic refresh is enabled. Closer probes win within each group.
+class LightProbeScheduler
+{
+public:
+    static constexpr uint32_t c_NumCaptureTargets = 2;
+
+    struct Settings
+    {
+        uint32_t facesPerFrame = 1;
+        uint32_t refreshIntervalFrames = 0;     // 0 means that valid probes are only captured again when invalidated
+        uint32_t diffuseSampleCount = 128;
+        uint32_t specularSampleCount = 64;
+    };
+
+    // Renders one face of a capture. 'firstFace' is true for the first face that is rendered for this capture,
+    // which is where per-capture work like shadow map rendering should happen.
+    using RenderFaceCallback = std::function<void(nvrhi::ICommandList* commandList, const donut::engine::IView& faceView,
+        donut::engine::FramebufferFactory& framebuffer, uint32_t captureTarget, bool firstFace)>;
+
+    LightProbeScheduler(nvrhi::IDevice* device, donut::engine::ShaderFactory& shaderFactory,
+        uint32_t captureSize, uint32_t captureMipLevels, float nearPlane, float cullDistance);
+
+    // Replaces the set of scheduled probes. The probe maps must be cube arrays in the ShaderResource state,
+    // and mips 0..N of their slices must match the staging maps created for them.
+    void SetProbes(const std::vector<std::shared_ptr<donut::engine::LightProbe>>& probes);
+    void SetProbePosition(const donut::engine::LightProbe& probe, const donut::math::float3& position, const donut::math::box3& influenceBounds);
+
+    void InvalidateAll();
+    // Invalidates the probes whose influence bounds are within 'margin' of the changed region
+    void InvalidateBounds(const donut::math::box3& bounds, float margin);
+
+    // Copies finished probes into their maps, picks the next probe to capture if a capture target is free,
+    // and renders up to 'facesPerFrame' faces with the callback.
+    void Update(nvrhi::ICommandList* commandList, const donut::math::float3& cameraPosition, const RenderFaceCallback& renderFace);
+
+    // Submits the filtering of the captures that were completed in the last Update call.
+    // Must be called after the command list passed to Update has been executed, 'graphicsSubmission' is its submission ID.
+    void SubmitFiltering(uint64_t graphicsSubmission);
+
+    // Returns the captured probes, closest to 'position' first
+    [[nodiscard]] std::vector<std::shared_ptr<donut::engine::LightProbe>> GetClosestProbes(const donut::math::float3& position, size_t maxCount) const;
+
+    [[nodiscard]] Settings& GetSettings() { return m_Settings; }
+    [[nodiscard]] donut::engine::FramebufferFactory& GetCaptureFramebuffer(uint32_t captureTarget) const { return *m_CaptureTargets[captureTarget].framebuffer; }
+    [[nodiscard]] const donut::engine::IView& GetReferenceFaceView() const { return *m_ReferenceView.GetChildView(donut::engine::ViewType::PLANAR, 0); }
+    [[nodiscard]] uint32_t GetNumValidProbes() const;
+    [[nodiscard]] uint32_t GetNumPendingProbes() const;
+    [[nodiscard]] bool IsUsingComputeQueue() const { return m_UseComputeQueue; }
+
+private:
+    enum class CaptureState
+    {
+        Free,
+        Rendering,
+        ReadyToFilter,
+        Filtering
+    };
+
+    struct ProbeRecord
+    {
+        std::shared_ptr<donut::engine::LightProbe> probe;
+        donut::math::float3 position = 0.f;
+        donut::math::box3 influenceBounds = donut::math::box3::empty();
+        uint64_t lastCaptureFrame = 0;
+        bool valid = false;
+        bool dirty = true;
+        bool inFlight = false;
+    };
+
+    struct CaptureTarget
+    {
+        nvrhi::TextureHandle color;
+        nvrhi::TextureHandle diffuse;
+        nvrhi::TextureHandle specular;
+        std::shared_ptr<donut::engine::FramebufferFactory> framebuffer;
+        nvrhi::EventQueryHandle filterQuery;
+        donut::engine::CubemapView view;
+        CaptureState state = CaptureState::Free;
+        int probeIndex = -1;
+        donut::math::float3 position = 0.f;
+        uint32_t facesRendered = 0;
+    };
+
+    nvrhi::DeviceHandle m_Device;
+    Settings m_Settings;
+    bool m_UseComputeQueue = false;
+    uint32_t m_CaptureSize;
+    uint32_t m_CaptureMipLevels;
+    float m_NearPlane;
+    float m_CullDistance;
+    uint64_t m_FrameIndex = 0;
+
+    nvrhi::TextureHandle m_CaptureDepth;
+    std::array<CaptureTarget, c_NumCaptureTargets> m_CaptureTargets;
+    donut::engine::CubemapView m_ReferenceView;
+    std::vector<ProbeRecord> m_Probes;
+
+    nvrhi::CommandListHandle m_FilterCommandList;
+    nvrhi::ShaderHandle m_DownsampleShader;
+    nvrhi::ShaderHandle m_DiffuseShader;
+    nvrhi::ShaderHandle m_SpecularShader;
+    nvrhi::BindingLayoutHandle m_DownsampleBindingLayout;
+    nvrhi::BindingLayoutHandle m_FilterBindingLayout;
+    nvrhi::ComputePipelineHandle m_DownsamplePipeline;
+    nvrhi::ComputePipelineHandle m_DiffusePipeline;
+    nvrhi::ComputePipelineHandle m_SpecularPipeline;
+    nvrhi::BufferHandle m_ConstantBuffer;
+    nvrhi::SamplerHandle m_LinearSampler;
+    donut::engine::BindingCache m_BindingCache;
+
+    int SelectNextProbe(const donut::math::float3& cameraPosition) const;
+    void BeginCapture(CaptureTarget& target, int probeIndex);
+    void FinishCapture(nvrhi::ICommandList* commandList, CaptureTarget& target);
+    void RecordFiltering(CaptureTarget& target);
+    void Dispatch(nvrhi::IComputePipeline* pipeline, nvrhi::ITexture* source, uint32_t sourceMip, nvrhi::ITexture* output, uint32_t outputMip,
+        uint32_t sampleCount, float roughness);
+};
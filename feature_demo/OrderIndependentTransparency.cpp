@@ -0,0 +1,137 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+#include "OrderIndependentTransparency.h"
+
+#include <donut/engine/CommonRenderPasses.h>
+#include <donut/engine/FramebufferFactory.h>
+#include <donut/engine/ShaderFactory.h>
+#include <donut/engine/View.h>
+
+using namespace donut;
+using namespace donut::engine;
+using namespace donut::render;
+
+OitForwardShadingPass::OitForwardShadingPass(nvrhi::IDevice* device, std::shared_ptr<CommonRenderPasses> commonPasses)
+    : ForwardShadingPass(device, commonPasses)
+{
+}
+
+nvrhi::ShaderHandle OitForwardShadingPass::CreatePixelShader(ShaderFactory& shaderFactory, const CreateParameters& params, bool transmissiveMaterial)
+{
+    // Transmissive materials are blended like the others, their background blend factor has no place in the OIT targets
+    return shaderFactory.CreateShader("app/oit_forward.hlsl", "main_ps", nullptr, nvrhi::ShaderType::Pixel);
+}
+
+nvrhi::GraphicsPipelineHandle OitForwardShadingPass::CreateGraphicsPipeline(PipelineKey key, nvrhi::IFramebuffer* framebuffer)
+{
+    // Start from the regular pipeline for the material domain, and only replace the output merger state
+    nvrhi::GraphicsPipelineHandle pipeline = ForwardShadingPass::CreateGraphicsPipeline(key, framebuffer);
+    if (!pipeline)
+        return nullptr;
+
+    nvrhi::GraphicsPipelineDesc pipelineDesc = pipeline->getDesc();
+    pipelineDesc.renderState.blendState = nvrhi::BlendState();
+    pipelineDesc.renderState.depthStencilState.disableDepthWrite();
+
+    // Sum of (color * alpha, alpha) * weight, the shader does the weighting
+    pipelineDesc.renderState.blendState.targets[0]
+        .enableBlend()
+        .setSrcBlend(nvrhi::BlendFactor::One)
+        .setDestBlend(nvrhi::BlendFactor::One)
+        .setSrcBlendAlpha(nvrhi::BlendFactor::One)
+        .setDestBlendAlpha(nvrhi::BlendFactor::One);
+
+    // Product of (1 - alpha), the shader writes alpha into the red channel
+    pipelineDesc.renderState.blendState.targets[1]
+        .enableBlend()
+        .setSrcBlend(nvrhi::BlendFactor::Zero)
+        .setDestBlend(nvrhi::BlendFactor::InvSrcColor)
+        .setSrcBlendAlpha(nvrhi::BlendFactor::Zero)
+        .setDestBlendAlpha(nvrhi::BlendFactor::InvSrcAlpha);
+
+    return m_Device->createGraphicsPipeline(pipelineDesc, framebuffer->getFramebufferInfo());
+}
+
+OitCompositePass::OitCompositePass(nvrhi::IDevice* device, ShaderFactory& shaderFactory,
+    nvrhi::ITexture* accumulation, nvrhi::ITexture* revealage, std::shared_ptr<FramebufferFactory> framebufferFactory)
+    : m_Device(device)
+    , m_FramebufferFactory(std::move(framebufferFactory))
+{
+    const bool multisampled = accumulation->getDesc().sampleCount > 1;
+    std::vector<ShaderMacro> macros = { ShaderMacro("OIT_MSAA", multisampled ? "1" : "0") };
+
+    m_VertexShader = shaderFactory.CreateShader("app/oit_composite.hlsl", "main_vs", nullptr, nvrhi::ShaderType::Vertex);
+    m_PixelShader = shaderFactory.CreateShader("app/oit_composite.hlsl", "main_ps", &macros, nvrhi::ShaderType::Pixel);
+
+    nvrhi::BindingLayoutDesc layoutDesc;
+    layoutDesc.visibility = nvrhi::ShaderType::Pixel;
+    layoutDesc.bindings = {
+        nvrhi::BindingLayoutItem::Texture_SRV(0),
+        nvrhi::BindingLayoutItem::Texture_SRV(1)
+    };
+    m_BindingLayout = m_Device->createBindingLayout(layoutDesc);
+
+    nvrhi::BindingSetDesc setDesc;
+    setDesc.bindings = {
+        nvrhi::BindingSetItem::Texture_SRV(0, accumulation),
+        nvrhi::BindingSetItem::Texture_SRV(1, revealage)
+    };
+    m_BindingSet = m_Device->createBindingSet(setDesc, m_BindingLayout);
+}
+
+void OitCompositePass::Render(nvrhi::ICommandList* commandList, const IView& view)
+{
+    nvrhi::IFramebuffer* framebuffer = m_FramebufferFactory->GetFramebuffer(view);
+
+    if (!m_Pipeline)
+    {
+        nvrhi::GraphicsPipelineDesc pipelineDesc;
+        pipelineDesc.VS = m_VertexShader;
+        pipelineDesc.PS = m_PixelShader;
+        pipelineDesc.bindingLayouts = { m_BindingLayout };
+        pipelineDesc.primType = nvrhi::PrimitiveType::TriangleList;
+        pipelineDesc.renderState.rasterState.setCullNone();
+        pipelineDesc.renderState.depthStencilState.disableDepthTest().disableDepthWrite();
+        pipelineDesc.renderState.blendState.targets[0]
+            .enableBlend()
+            .setSrcBlend(nvrhi::BlendFactor::SrcAlpha)
+            .setDestBlend(nvrhi::BlendFactor::InvSrcAlpha)
+            .setSrcBlendAlpha(nvrhi::BlendFactor::Zero)
+            .setDestBlendAlpha(nvrhi::BlendFactor::One);
+
+        m_Pipeline = m_Device->createGraphicsPipeline(pipelineDesc, framebuffer->getFramebufferInfo());
+    }
+
+    const nvrhi::FramebufferInfoEx& framebufferInfo = framebuffer->getFramebufferInfo();
+
+    nvrhi::GraphicsState state;
+    state.pipeline = m_Pipeline;
+    state.framebuffer = framebuffer;
+    state.bindings = { m_BindingSet };
+    state.viewport.addViewportAndScissorRect(nvrhi::Viewport(float(framebufferInfo.width), float(framebufferInfo.height)));
+    commandList->setGraphicsState(state);
+
+    nvrhi::DrawArguments args;
+    args.vertexCount = 3;
+    commandList->draw(args);
+}
@@ -0,0 +1,71 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <donut/render/ForwardShadingPass.h>
+#include <nvrhi/nvrhi.h>
+
+#include <memory>
+
+namespace donut::engine
+{
+    class CommonRenderPasses;
+    class FramebufferFactory;
+    class ShaderFactory;
+}
+
+// Weighted blended order-independent transparency, with the depth weight of McGuire and Bavoil.
+// The transparent surfaces are rendered once into a framebuffer with two render targets: the accumulation target
+// (RGBA16_FLOAT, cleared to 0), which sums the weighted premultiplied colors and opacities, and the revealage target
+// (R16_FLOAT, cleared to 1), which multiplies the transmittances. oit_forward.hlsl wraps the regular forward pixel
+// shader to write both. OitCompositePass then blends the average color over the opaque image.
+// The order-dependent multi-layer alpha blending of the particle sample needs rasterizer ordered views,
+// which the geometry passes don't support.
+class OitForwardShadingPass : public donut::render::ForwardShadingPass
+{
+public:
+    OitForwardShadingPass(nvrhi::IDevice* device, std::shared_ptr<donut::engine::CommonRenderPasses> commonPasses);
+
+protected:
+    nvrhi::ShaderHandle CreatePixelShader(donut::engine::ShaderFactory& shaderFactory, const CreateParameters& params, bool transmissiveMaterial) override;
+    nvrhi::GraphicsPipelineHandle CreateGraphicsPipeline(PipelineKey key, nvrhi::IFramebuffer* framebuffer) override;
+};
+
+class OitCompositePass
+{
+public:
+    OitCompositePass(nvrhi::IDevice* device, donut::engine::ShaderFactory& shaderFactory,
+        nvrhi::ITexture* accumulation, nvrhi::ITexture* revealage, std::shared_ptr<donut::engine::FramebufferFactory> framebufferFactory);
+
+    // Blends the transparent layers over the render target of the framebuffer factory, for all views at once
+    void Render(nvrhi::ICommandList* commandList, const donut::engine::IView& view);
+
+private:
+    nvrhi::DeviceHandle m_Device;
+    nvrhi::ShaderHandle m_VertexShader;
+    nvrhi::ShaderHandle m_PixelShader;
+    nvrhi::BindingLayoutHandle m_BindingLayout;
+    nvrhi::BindingSetHandle m_BindingSet;
+    nvrhi::GraphicsPipelineHandle m_Pipeline;
+    std::shared_ptr<donut::engine::FramebufferFactory> m_FramebufferFactory;
+};
@@ -0,0 +1,381 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+#include "ShadowCache.h"
+
+#include <donut/engine/ShaderFactory.h>
+#include <donut/render/CascadedShadowMap.h>
+#include <donut/render/DepthPass.h>
+#include <donut/render/GeometryPasses.h>
+#include <nvrhi/utils.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+
+using namespace donut;
+using namespace donut::math;
+using namespace donut::engine;
+using namespace donut::render;
+
+#include "shadow_cache_cb.h"
+
+ShadowCache::FilteredDrawStrategy::FilteredDrawStrategy(const std::unordered_set<const MeshInstance*>& dynamicInstances, bool dynamic)
+    : m_DynamicInstances(dynamicInstances)
+    , m_Dynamic(dynamic)
+{
+}
+
+void ShadowCache::FilteredDrawStrategy::PrepareForView(const std::shared_ptr<SceneGraphNode>& rootNode, const IView& view)
+{
+    m_Strategy.PrepareForView(rootNode, view);
+}
+
+const DrawItem* ShadowCache::FilteredDrawStrategy::GetNextItem()
+{
+    while (const DrawItem* item = m_Strategy.GetNextItem())
+    {
+        const bool isDynamic = m_DynamicInstances.find(item->instance) != m_DynamicInstances.end();
+        if (isDynamic == m_Dynamic)
+            return item;
+    }
+
+    return nullptr;
+}
+
+ShadowCache::ShadowCache(nvrhi::IDevice* device, ShaderFactory& shaderFactory, nvrhi::ITexture* shadowMapTexture)
+    : m_Device(device)
+    , m_ShadowMapTexture(shadowMapTexture)
+    , m_StaticDrawStrategy(m_DynamicInstances, false)
+    , m_DynamicDrawStrategy(m_DynamicInstances, true)
+{
+    nvrhi::TextureDesc cacheDesc = shadowMapTexture->getDesc();
+    cacheDesc.debugName = "ShadowCache";
+    m_CacheTexture = m_Device->createTexture(cacheDesc);
+
+    m_ClearDepth = cacheDesc.useClearValue ? cacheDesc.clearValue.r : 1.f;
+    m_Cascades.resize(cacheDesc.arraySize);
+
+    m_ShadowMapFramebuffer = std::make_shared<FramebufferFactory>(m_Device);
+    m_ShadowMapFramebuffer->DepthTarget = m_ShadowMapTexture;
+
+    m_CacheFramebuffer = std::make_shared<FramebufferFactory>(m_Device);
+    m_CacheFramebuffer->DepthTarget = m_CacheTexture;
+
+    m_ScrollVertexShader = shaderFactory.CreateShader("app/shadow_cache.hlsl", "main_vs", nullptr, nvrhi::ShaderType::Vertex);
+    m_ScrollPixelShader = shaderFactory.CreateShader("app/shadow_cache.hlsl", "main_ps", nullptr, nvrhi::ShaderType::Pixel);
+
+    m_ScrollConstantBuffer = m_Device->createBuffer(nvrhi::utils::CreateVolatileConstantBufferDesc(
+        sizeof(ShadowCacheConstants), "ShadowCacheConstants", c_MaxRenderPassConstantBufferVersions));
+
+    nvrhi::BindingLayoutDesc layoutDesc;
+    layoutDesc.visibility = nvrhi::ShaderType::Pixel;
+    layoutDesc.bindings = {
+        nvrhi::BindingLayoutItem::VolatileConstantBuffer(0),
+        nvrhi::BindingLayoutItem::Texture_SRV(0)
+    };
+    m_ScrollBindingLayout = m_Device->createBindingLayout(layoutDesc);
+
+    nvrhi::BindingSetDesc setDesc;
+    setDesc.bindings = {
+        nvrhi::BindingSetItem::ConstantBuffer(0, m_ScrollConstantBuffer),
+        nvrhi::BindingSetItem::Texture_SRV(0, m_CacheTexture)
+    };
+    m_ScrollBindingSet = m_Device->createBindingSet(setDesc, m_ScrollBindingLayout);
+}
+
+void ShadowCache::SetScene(const SceneGraph& sceneGraph)
+{
+    m_DynamicInstances.clear();
+
+    std::unordered_set<const SceneGraphNode*> animatedNodes;
+    for (const auto& animation : sceneGraph.GetAnimations())
+    {
+        for (const auto& channel : animation->GetChannels())
+        {
+            if (auto node = channel->GetTargetNode())
+                animatedNodes.insert(node.get());
+        }
+    }
+
+    // An instance moves when any of its ancestors is animated,
+    // and skinned instances are deformed by their joints which may be anywhere in the graph
+    for (const auto& instance : sceneGraph.GetMeshInstances())
+    {
+        if (dynamic_cast<const SkinnedMeshInstance*>(instance.get()))
+        {
+            m_DynamicInstances.insert(instance.get());
+            continue;
+        }
+
+        for (const SceneGraphNode* node = instance->GetNode(); node; node = node->GetParent())
+        {
+            if (animatedNodes.find(node) != animatedNodes.end())
+            {
+                m_DynamicInstances.insert(instance.get());
+                break;
+            }
+        }
+    }
+
+    Invalidate();
+}
+
+void ShadowCache::Invalidate()
+{
+    for (CascadeState& state : m_Cascades)
+        state = CascadeState();
+}
+
+// The values that determine which texel a point lands on: columns X, Y and W of the view-projection matrix,
+// except for the translation row. The Z column is not compared because the depth range follows the scene bounds,
+// which change whenever anything moves. The scroll shader transforms the cached depth into the new range.
+static bool HaveSameTexelGrid(const float4x4& a, const float4x4& b)
+{
+    for (int row = 0; row < 3; row++)
+    {
+        if (a[row].x != b[row].x || a[row].y != b[row].y || a[row].w != b[row].w)
+            return false;
+    }
+    return a[3].w == b[3].w;
+}
+
+void ShadowCache::Render(nvrhi::ICommandList* commandList, CascadedShadowMap& shadowMap,
+    const std::shared_ptr<SceneGraphNode>& rootNode, DepthPass& depthPass, bool materialEvents)
+{
+    assert(shadowMap.GetTexture() == m_ShadowMapTexture);
+
+    m_Statistics = Statistics();
+    m_FrameIndex++;
+
+    const bool sceneHasDynamicGeometry = !m_DynamicInstances.empty();
+
+    for (uint32_t cascade = 0; cascade < uint32_t(m_Cascades.size()); cascade++)
+    {
+        const IView* cascadeView = shadowMap.GetView().GetChildView(ViewType::PLANAR, cascade);
+        if (!cascadeView)
+            break;
+
+        CascadeState& state = m_Cascades[cascade];
+        const float4x4 viewProjection = cascadeView->GetViewProjectionMatrix();
+
+        bool unchanged = state.cacheValid;
+        for (int row = 0; row < 4 && unchanged; row++)
+            unchanged = all(viewProjection[row] == state.cachedViewProjection[row]);
+
+        if (unchanged)
+        {
+            // The slice still holds the cached cascade, with dynamic geometry from the last update on top
+            const bool reducedRate = cascade >= m_Settings.reducedRateFirstCascade &&
+                m_FrameIndex - state.lastDynamicUpdate < m_Settings.reducedRateInterval;
+
+            if ((!sceneHasDynamicGeometry && !state.hasDynamicGeometry) || reducedRate)
+            {
+                m_Statistics.skippedCascades++;
+                continue;
+            }
+
+            CopySlice(commandList, m_ShadowMapTexture, m_CacheTexture, cascade);
+            m_Statistics.reusedCascades++;
+        }
+        else if (state.cacheValid && m_Settings.enableScrolling && HaveSameTexelGrid(viewProjection, state.cachedViewProjection) &&
+            ScrollCascade(commandList, *cascadeView, cascade, rootNode, depthPass, materialEvents))
+        {
+            m_Statistics.scrolledCascades++;
+        }
+        else
+        {
+            char passName[32];
+            snprintf(passName, std::size(passName), "ShadowCache Cascade %u", cascade);
+            commandList->beginMarker(passName);
+
+            ClearSlice(commandList, m_CacheTexture, cascade);
+            RenderStaticGeometry(commandList, *cascadeView, cascade, *m_CacheFramebuffer, rootNode, depthPass, materialEvents);
+            CopySlice(commandList, m_ShadowMapTexture, m_CacheTexture, cascade);
+
+            commandList->endMarker();
+
+            m_Statistics.renderedCascades++;
+        }
+
+        state.cachedViewProjection = viewProjection;
+        state.cacheValid = true;
+        state.hasDynamicGeometry = sceneHasDynamicGeometry;
+        state.lastDynamicUpdate = m_FrameIndex;
+
+        if (sceneHasDynamicGeometry)
+        {
+            DepthPass::Context context;
+
+            RenderCompositeView(commandList,
+                cascadeView, nullptr,
+                *m_ShadowMapFramebuffer,
+                rootNode,
+                m_DynamicDrawStrategy,
+                depthPass,
+                context,
+                "ShadowMap Dynamic",
+                materialEvents);
+        }
+    }
+}
+
+void ShadowCache::RenderStaticGeometry(nvrhi::ICommandList* commandList, const IView& cascadeView, uint32_t cascade,
+    FramebufferFactory& framebuffer, const std::shared_ptr<SceneGraphNode>& rootNode, DepthPass& depthPass, bool materialEvents)
+{
+    DepthPass::Context context;
+
+    RenderCompositeView(commandList,
+        &cascadeView, nullptr,
+        framebuffer,
+        rootNode,
+        m_StaticDrawStrategy,
+        depthPass,
+        context,
+        nullptr,
+        materialEvents);
+}
+
+bool ShadowCache::ScrollCascade(nvrhi::ICommandList* commandList, const IView& cascadeView, uint32_t cascade,
+    const std::shared_ptr<SceneGraphNode>& rootNode, DepthPass& depthPass, bool materialEvents)
+{
+    const CascadeState& state = m_Cascades[cascade];
+    const nvrhi::TextureDesc& desc = m_ShadowMapTexture->getDesc();
+    const float width = float(desc.width);
+    const float height = float(desc.height);
+
+    const float4x4 viewProjection = cascadeView.GetViewProjectionMatrix();
+
+    // Stable cascades only move by whole texels, anything else has to be re-rendered
+    const float2 clipOffset = viewProjection[3].xy() - state.cachedViewProjection[3].xy();
+    const float2 texelOffset = clipOffset * float2(0.5f * width, -0.5f * height);
+    const int2 offset = int2(round(texelOffset));
+
+    if (any(abs(texelOffset - float2(offset)) > 0.01f))
+        return false;
+    if (std::abs(offset.x) >= int(desc.width) || std::abs(offset.y) >= int(desc.height))
+        return false;
+
+    commandList->beginMarker("ShadowCache Scroll");
+
+    ClearSlice(commandList, m_ShadowMapTexture, cascade);
+
+    nvrhi::IFramebuffer* framebuffer = m_ShadowMapFramebuffer->GetFramebuffer(nvrhi::TextureSubresourceSet(0, 1, cascade, 1));
+
+    if (!m_ScrollPipeline)
+    {
+        nvrhi::GraphicsPipelineDesc psoDesc;
+        psoDesc.VS = m_ScrollVertexShader;
+        psoDesc.PS = m_ScrollPixelShader;
+        psoDesc.primType = nvrhi::PrimitiveType::TriangleList;
+        psoDesc.renderState.rasterState.setCullNone();
+        psoDesc.renderState.depthStencilState.depthTestEnable = true;
+        psoDesc.renderState.depthStencilState.depthWriteEnable = true;
+        psoDesc.renderState.depthStencilState.depthFunc = nvrhi::ComparisonFunc::Always;
+        psoDesc.bindingLayouts = { m_ScrollBindingLayout };
+
+        m_ScrollPipeline = m_Device->createGraphicsPipeline(psoDesc, framebuffer->getFramebufferInfo());
+    }
+
+    ShadowCacheConstants constants = {};
+    constants.targetWorldToClip = viewProjection;
+    constants.targetClipToWorld = inverse(viewProjection);
+    constants.cacheWorldToClip = state.cachedViewProjection;
+    constants.cacheClipToWorld = inverse(state.cachedViewProjection);
+    constants.targetSize = float2(width, height);
+    constants.targetSizeInv = 1.f / constants.targetSize;
+    constants.arraySlice = cascade;
+    constants.clearDepth = m_ClearDepth;
+    commandList->writeBuffer(m_ScrollConstantBuffer, &constants, sizeof(constants));
+
+    const nvrhi::Viewport& cascadeViewport = cascadeView.GetViewportState().viewports[0];
+
+    nvrhi::GraphicsState state;
+    state.pipeline = m_ScrollPipeline;
+    state.framebuffer = framebuffer;
+    state.bindings = { m_ScrollBindingSet };
+    state.viewport.addViewportAndScissorRect(cascadeViewport);
+    commandList->setGraphicsState(state);
+    commandList->draw(nvrhi::DrawArguments().setVertexCount(3));
+
+    // Render the static geometry into the strips that the cache didn't cover, each through a view that maps
+    // the full clip space onto the strip: the projection is followed by a scale and offset in clip space.
+    const auto renderStrip = [&](int x0, int x1, int y0, int y1)
+    {
+        if (x0 >= x1 || y0 >= y1)
+            return;
+
+        const float halfX = float(x1 - x0) / width;
+        const float halfY = float(y1 - y0) / height;
+        const float centerX = float(x0 + x1) / width - 1.f;
+        const float centerY = 1.f - float(y0 + y1) / height;
+
+        float4x4 stripTransform = diagonal(float4(1.f / halfX, 1.f / halfY, 1.f, 1.f));
+        stripTransform[3] = float4(-centerX / halfX, -centerY / halfY, 0.f, 1.f);
+
+        PlanarView stripView;
+        stripView.SetViewport(nvrhi::Viewport(float(x0), float(x1), float(y0), float(y1), cascadeViewport.minZ, cascadeViewport.maxZ));
+        stripView.SetMatrices(cascadeView.GetViewMatrix(), cascadeView.GetProjectionMatrix() * stripTransform);
+        stripView.SetArraySlice(int(cascade));
+        stripView.UpdateCache();
+
+        RenderStaticGeometry(commandList, stripView, cascade, *m_ShadowMapFramebuffer, rootNode, depthPass, materialEvents);
+    };
+
+    const int sizeX = int(desc.width);
+    const int sizeY = int(desc.height);
+
+    // The columns on the side that the contents moved away from, at full height
+    if (offset.x > 0)
+        renderStrip(0, offset.x, 0, sizeY);
+    else if (offset.x < 0)
+        renderStrip(sizeX + offset.x, sizeX, 0, sizeY);
+
+    // The rows on the side that the contents moved away from, without the columns above
+    const int rowsX0 = std::max(offset.x, 0);
+    const int rowsX1 = sizeX + std::min(offset.x, 0);
+    if (offset.y > 0)
+        renderStrip(rowsX0, rowsX1, 0, offset.y);
+    else if (offset.y < 0)
+        renderStrip(rowsX0, rowsX1, sizeY + offset.y, sizeY);
+
+    // The slice now holds the static geometry of the new cascade position, keep it for the following frames
+    CopySlice(commandList, m_CacheTexture, m_ShadowMapTexture, cascade);
+
+    commandList->endMarker();
+
+    return true;
+}
+
+void ShadowCache::ClearSlice(nvrhi::ICommandList* commandList, nvrhi::ITexture* texture, uint32_t cascade)
+{
+    const nvrhi::FormatInfo& formatInfo = nvrhi::getFormatInfo(texture->getDesc().format);
+    commandList->clearDepthStencilTexture(texture, nvrhi::TextureSubresourceSet(0, 1, cascade, 1),
+        true, m_ClearDepth, formatInfo.hasStencil, 0);
+}
+
+void ShadowCache::CopySlice(nvrhi::ICommandList* commandList, nvrhi::ITexture* dest, nvrhi::ITexture* src, uint32_t cascade)
+{
+    const nvrhi::TextureSlice slice = nvrhi::TextureSlice().setArraySlice(cascade);
+    commandList->copyTexture(dest, slice, src, slice);
+}
@@ -0,0 +1,140 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <donut/engine/FramebufferFactory.h>
+#include <donut/engine/SceneGraph.h>
+#include <donut/engine/View.h>
+#include <donut/render/DrawStrategy.h>
+#include <nvrhi/nvrhi.h>
+
+#include <memory>
+#include <unordered_set>
+#include <vector>
+
+namespace donut::engine
+{
+    class ShaderFactory;
+}
+
+namespace donut::render
+{
+    class CascadedShadowMap;
+    class DepthPass;
+}
+
+// Caching of the static geometry in the cascades of a CascadedShadowMap.
+// Every cascade has a cached copy of its static geometry that is kept as long as the cascade's light-space transform
+// doesn't change. With stable cascades, camera movement shifts a cascade by whole texels: the cache is then scrolled
+// by reprojecting it, and only the strips that became visible are rendered. Any other change re-renders the cascade.
+// Mesh instances under animated nodes are dynamic, they are rendered into the cascades on top of the cached geometry.
+//
+// Cascades starting at 'reducedRateFirstCascade' only re-render their dynamic geometry every 'reducedRateInterval' frames,
+// as long as they haven't moved.
+class ShadowCache
+{
+public:
+    struct Settings
+    {
+        bool enableScrolling = true;
+        uint32_t reducedRateFirstCascade = 2;
+        uint32_t reducedRateInterval = 4;
+    };
+
+    struct Statistics
+    {
+        uint32_t renderedCascades = 0;
+        uint32_t scrolledCascades = 0;
+        uint32_t reusedCascades = 0;
+        uint32_t skippedCascades = 0;
+    };
+
+    ShadowCache(nvrhi::IDevice* device, donut::engine::ShaderFactory& shaderFactory, nvrhi::ITexture* shadowMapTexture);
+
+    // Finds the dynamic mesh instances of the scene and drops the cached cascades
+    void SetScene(const donut::engine::SceneGraph& sceneGraph);
+    void Invalidate();
+
+    // Fills the cascades of 'shadowMap', which must have been set up for the current frame. This replaces clearing
+    // the shadow map and rendering all of its cascades.
+    void Render(nvrhi::ICommandList* commandList, donut::render::CascadedShadowMap& shadowMap,
+        const std::shared_ptr<donut::engine::SceneGraphNode>& rootNode, donut::render::DepthPass& depthPass, bool materialEvents);
+
+    [[nodiscard]] Settings& GetSettings() { return m_Settings; }
+    [[nodiscard]] const Statistics& GetStatistics() const { return m_Statistics; }
+
+private:
+    // Returns the items of the wrapped strategy that are, or are not, in the set of dynamic instances
+    class FilteredDrawStrategy : public donut::render::IDrawStrategy
+    {
+    public:
+        FilteredDrawStrategy(const std::unordered_set<const donut::engine::MeshInstance*>& dynamicInstances, bool dynamic);
+
+        void PrepareForView(const std::shared_ptr<donut::engine::SceneGraphNode>& rootNode, const donut::engine::IView& view) override;
+        const donut::engine::DrawItem* GetNextItem() override;
+
+    private:
+        donut::render::InstancedOpaqueDrawStrategy m_Strategy;
+        const std::unordered_set<const donut::engine::MeshInstance*>& m_DynamicInstances;
+        bool m_Dynamic;
+    };
+
+    struct CascadeState
+    {
+        donut::math::float4x4 cachedViewProjection = donut::math::float4x4::zero();
+        uint64_t lastDynamicUpdate = 0;
+        bool cacheValid = false;
+        bool hasDynamicGeometry = false;
+    };
+
+    nvrhi::DeviceHandle m_Device;
+    Settings m_Settings;
+    Statistics m_Statistics;
+    uint64_t m_FrameIndex = 0;
+    float m_ClearDepth = 1.f;
+
+    nvrhi::TextureHandle m_ShadowMapTexture;
+    nvrhi::TextureHandle m_CacheTexture;
+    std::shared_ptr<donut::engine::FramebufferFactory> m_ShadowMapFramebuffer;
+    std::shared_ptr<donut::engine::FramebufferFactory> m_CacheFramebuffer;
+    std::vector<CascadeState> m_Cascades;
+
+    std::unordered_set<const donut::engine::MeshInstance*> m_DynamicInstances;
+    FilteredDrawStrategy m_StaticDrawStrategy;
+    FilteredDrawStrategy m_DynamicDrawStrategy;
+
+    nvrhi::ShaderHandle m_ScrollVertexShader;
+    nvrhi::ShaderHandle m_ScrollPixelShader;
+    nvrhi::BindingLayoutHandle m_ScrollBindingLayout;
+    nvrhi::BindingSetHandle m_ScrollBindingSet;
+    nvrhi::GraphicsPipelineHandle m_ScrollPipeline;
+    nvrhi::BufferHandle m_ScrollConstantBuffer;
+
+    void RenderStaticGeometry(nvrhi::ICommandList* commandList, const donut::engine::IView& cascadeView, uint32_t cascade,
+        donut::engine::FramebufferFactory& framebuffer, const std::shared_ptr<donut::engine::SceneGraphNode>& rootNode,
+        donut::render::DepthPass& depthPass, bool materialEvents);
+    bool ScrollCascade(nvrhi::ICommandList* commandList, const donut::engine::IView& cascadeView, uint32_t cascade,
+        const std::shared_ptr<donut::engine::SceneGraphNode>& rootNode, donut::render::DepthPass& depthPass, bool materialEvents);
+    void ClearSlice(nvrhi::ICommandList* commandList, nvrhi::ITexture* texture, uint32_t cascade);
+    void CopySlice(nvrhi::ICommandList* commandList, nvrhi::ITexture* dest, nvrhi::ITexture* src, uint32_t cascade);
+};
@@ -0,0 +1,379 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+#include "TextureStreamer.h"
+
+#include <donut/engine/DDSFile.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+
+using namespace donut;
+using namespace donut::engine;
+
+// Byte offsets of the DDS_HEADER fields that change when mips are removed from a file, including the magic number before the header
+static const size_t c_DdsFlagsOffset = 8;
+static const size_t c_DdsHeightOffset = 12;
+static const size_t c_DdsWidthOffset = 16;
+static const size_t c_DdsPitchOrLinearSizeOffset = 20;
+static const size_t c_DdsMipMapCountOffset = 28;
+static const uint32_t c_DdsFlagPitch = 0x8;
+static const uint32_t c_DdsFlagLinearSize = 0x80000;
+
+TextureStreamer::TextureStreamer(nvrhi::IDevice* device, uint64_t budgetBytesPerFrame)
+    : m_Device(device)
+    , m_BudgetBytesPerFrame(budgetBytesPerFrame)
+{
+}
+
+uint64_t TextureStreamer::GetMipSize(const TextureData& data, uint32_t mipLevel)
+{
+    uint64_t size = 0;
+    for (const auto& arraySlice : data.dataLayout)
+        size += arraySlice[mipLevel].dataSize;
+    return size;
+}
+
+bool TextureStreamer::CanPublishMip(const nvrhi::TextureDesc& desc, uint32_t mipLevel)
+{
+    if (mipLevel == 0)
+        return true;
+
+    // The top mip of a block compressed texture must consist of whole blocks
+    const uint32_t blockSize = nvrhi::getFormatInfo(desc.format).blockSize;
+    const uint32_t width = std::max(desc.width >> mipLevel, 1u);
+    const uint32_t height = std::max(desc.height >> mipLevel, 1u);
+    return blockSize <= 1 || (width % blockSize == 0 && height % blockSize == 0);
+}
+
+std::shared_ptr<vfs::IBlob> TextureStreamer::AddTextureFile(const std::filesystem::path& path, const std::shared_ptr<vfs::IBlob>& file)
+{
+    std::string extension = path.extension().generic_string();
+    std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return char(std::tolower(c)); });
+    if (!file || extension != ".dds")
+        return file;
+
+    auto source = std::make_shared<TextureData>();
+    source->data = file;
+    source->path = path.generic_string();
+
+    const bool streamable = LoadDDSTextureFromMemory(*source) && source->mipLevels > 1 &&
+        source->dimension != nvrhi::TextureDimension::Texture3D &&
+        !source->dataLayout.empty() && source->dataLayout[0].size() == source->mipLevels;
+    if (!streamable)
+        return file;
+
+    nvrhi::TextureDesc desc;
+    desc.width = source->width;
+    desc.height = source->height;
+    desc.mipLevels = source->mipLevels;
+    desc.format = source->format;
+
+    // The mip tail goes through the cache, down to the first mip that the texture can be published with
+    uint32_t tailMip = 0;
+    while (tailMip + 1 < desc.mipLevels && std::max(desc.width >> tailMip, desc.height >> tailMip) > ResidentTailSize)
+        ++tailMip;
+    while (tailMip > 0 && !CanPublishMip(desc, tailMip))
+        --tailMip;
+
+    if (tailMip == 0)
+        return file;
+
+    // The tail file is the original header followed by the tail mips of every array slice, which are contiguous in a DDS file
+    const auto* fileData = static_cast<const uint8_t*>(file->data());
+    const size_t headerSize = source->dataLayout[0][0].dataOffset;
+    assert(headerSize >= c_DdsMipMapCountOffset + sizeof(uint32_t));
+
+    size_t tailSize = headerSize;
+    for (const auto& arraySlice : source->dataLayout)
+        tailSize += arraySlice.back().dataOffset + arraySlice.back().dataSize - arraySlice[tailMip].dataOffset;
+
+    auto* tailData = static_cast<uint8_t*>(malloc(tailSize));
+    memcpy(tailData, fileData, headerSize);
+
+    uint8_t* tailMips = tailData + headerSize;
+    for (const auto& arraySlice : source->dataLayout)
+    {
+        const size_t size = arraySlice.back().dataOffset + arraySlice.back().dataSize - arraySlice[tailMip].dataOffset;
+        memcpy(tailMips, fileData + arraySlice[tailMip].dataOffset, size);
+        tailMips += size;
+    }
+
+    auto writeHeaderField = [tailData](size_t offset, uint32_t value) { memcpy(tailData + offset, &value, sizeof(value)); };
+    uint32_t flags;
+    memcpy(&flags, tailData + c_DdsFlagsOffset, sizeof(flags));
+    writeHeaderField(c_DdsFlagsOffset, flags & ~(c_DdsFlagPitch | c_DdsFlagLinearSize));
+    writeHeaderField(c_DdsHeightOffset, std::max(desc.height >> tailMip, 1u));
+    writeHeaderField(c_DdsWidthOffset, std::max(desc.width >> tailMip, 1u));
+    writeHeaderField(c_DdsPitchOrLinearSizeOffset, 0);
+    writeHeaderField(c_DdsMipMapCountOffset, desc.mipLevels - tailMip);
+
+    StreamingTexture entry;
+    entry.path = path;
+    entry.source = std::move(source);
+    entry.residentMip = tailMip;
+    entry.publishedMip = tailMip;
+
+    {
+        std::lock_guard<std::mutex> lockGuard(m_QueuedTexturesMutex);
+        m_QueuedTextures.push_back(std::move(entry));
+    }
+
+    return std::make_shared<vfs::Blob>(tailData, tailSize);
+}
+
+bool TextureStreamer::BeginStreaming(nvrhi::ICommandList* commandList, TextureCache& textureCache, StreamingTexture& entry)
+{
+    std::shared_ptr<LoadedTexture> loadedTexture = textureCache.GetLoadedTexture(entry.path);
+    if (!loadedTexture || !loadedTexture->texture)
+        return false;
+
+    // The tail texture has the format that the cache chose, e.g. the sRGB variant for color textures
+    const nvrhi::TextureDesc& tailDesc = loadedTexture->texture->getDesc();
+    assert(tailDesc.mipLevels == entry.source->mipLevels - entry.residentMip);
+
+    nvrhi::TextureDesc desc = tailDesc;
+    desc.width = entry.source->width;
+    desc.height = entry.source->height;
+    desc.depth = entry.source->depth;
+    desc.arraySize = entry.source->arraySize;
+    desc.mipLevels = entry.source->mipLevels;
+    desc.dimension = entry.source->dimension;
+    desc.debugName = entry.source->path;
+    desc.initialState = nvrhi::ResourceStates::ShaderResource;
+    desc.keepInitialState = true;
+    entry.texture = m_Device->createTexture(desc);
+
+    for (uint32_t mipLevel = 0; mipLevel < tailDesc.mipLevels; ++mipLevel)
+    {
+        for (uint32_t arraySlice = 0; arraySlice < uint32_t(entry.source->dataLayout.size()); ++arraySlice)
+        {
+            commandList->copyTexture(
+                entry.texture, nvrhi::TextureSlice().setMipLevel(mipLevel + entry.residentMip).setArraySlice(arraySlice),
+                loadedTexture->texture, nvrhi::TextureSlice().setMipLevel(mipLevel).setArraySlice(arraySlice));
+        }
+    }
+
+    entry.loadedTexture = loadedTexture;
+    entry.publishedTexture = loadedTexture->texture;
+
+    for (uint32_t mipLevel = 0; mipLevel < entry.residentMip; ++mipLevel)
+        m_PendingBytes += GetMipSize(*entry.source, mipLevel);
+
+    return true;
+}
+
+void TextureStreamer::WriteMip(nvrhi::ICommandList* commandList, const StreamingTexture& entry, uint32_t mipLevel) const
+{
+    const auto* data = static_cast<const uint8_t*>(entry.source->data->data());
+
+    for (uint32_t arraySlice = 0; arraySlice < uint32_t(entry.source->dataLayout.size()); ++arraySlice)
+    {
+        const TextureSubresourceData& layout = entry.source->dataLayout[arraySlice][mipLevel];
+        commandList->writeTexture(entry.texture, arraySlice, mipLevel, data + layout.dataOffset, layout.rowPitch, layout.depthPitch);
+    }
+}
+
+void TextureStreamer::Publish(nvrhi::ICommandList* commandList, StreamingTexture& entry) const
+{
+    if (entry.residentMip == entry.publishedMip)
+        return;
+
+    std::shared_ptr<LoadedTexture> loadedTexture = entry.loadedTexture.lock();
+    if (!loadedTexture)
+        return;
+
+    if (entry.residentMip == 0)
+    {
+        loadedTexture->texture = entry.texture;
+        entry.publishedTexture = entry.texture;
+        entry.publishedMip = 0;
+        return;
+    }
+
+    const nvrhi::TextureDesc& fullDesc = entry.texture->getDesc();
+    if (!CanPublishMip(fullDesc, entry.residentMip))
+        return;
+
+    const uint32_t firstMip = entry.residentMip;
+    nvrhi::TextureDesc desc = fullDesc;
+    desc.width = std::max(fullDesc.width >> firstMip, 1u);
+    desc.height = std::max(fullDesc.height >> firstMip, 1u);
+    desc.mipLevels = fullDesc.mipLevels - firstMip;
+
+    nvrhi::TextureHandle residentTexture = m_Device->createTexture(desc);
+
+    for (uint32_t mipLevel = 0; mipLevel < desc.mipLevels; ++mipLevel)
+    {
+        for (uint32_t arraySlice = 0; arraySlice < uint32_t(entry.source->dataLayout.size()); ++arraySlice)
+        {
+            commandList->copyTexture(
+                residentTexture, nvrhi::TextureSlice().setMipLevel(mipLevel).setArraySlice(arraySlice),
+                entry.texture, nvrhi::TextureSlice().setMipLevel(mipLevel + firstMip).setArraySlice(arraySlice));
+        }
+    }
+
+    loadedTexture->texture = residentTexture;
+    entry.publishedTexture = residentTexture;
+    entry.publishedMip = firstMip;
+}
+
+void TextureStreamer::Update(nvrhi::ICommandList* commandList, TextureCache& textureCache)
+{
+    // Start streaming the textures whose tails have been finalized. The queue is taken out of the lock
+    // so that the loading threads are not blocked by the texture cache lookups.
+    std::vector<StreamingTexture> queuedTextures;
+    {
+        std::lock_guard<std::mutex> lockGuard(m_QueuedTexturesMutex);
+        queuedTextures.swap(m_QueuedTextures);
+    }
+
+    for (size_t index = 0; index < queuedTextures.size(); )
+    {
+        if (BeginStreaming(commandList, textureCache, queuedTextures[index]))
+        {
+            m_Textures.push_back(std::move(queuedTextures[index]));
+            queuedTextures[index] = std::move(queuedTextures.back());
+            queuedTextures.pop_back();
+        }
+        else
+            ++index;
+    }
+
+    if (!queuedTextures.empty())
+    {
+        std::lock_guard<std::mutex> lockGuard(m_QueuedTexturesMutex);
+        m_QueuedTextures.insert(m_QueuedTextures.end(), std::make_move_iterator(queuedTextures.begin()), std::make_move_iterator(queuedTextures.end()));
+    }
+
+    // Textures that the cache has unloaded or replaced since they were published are not streamed anymore
+    auto abandoned = std::remove_if(m_Textures.begin(), m_Textures.end(), [this](const StreamingTexture& entry)
+    {
+        std::shared_ptr<LoadedTexture> loadedTexture = entry.loadedTexture.lock();
+        if (loadedTexture && loadedTexture->texture == entry.publishedTexture)
+            return false;
+        for (uint32_t mipLevel = 0; mipLevel < entry.residentMip; ++mipLevel)
+            m_PendingBytes -= GetMipSize(*entry.source, mipLevel);
+        return true;
+    });
+    m_Textures.erase(abandoned, m_Textures.end());
+
+    uint64_t writtenBytes = 0;
+
+    while (true)
+    {
+        // The smallest pending mip of all textures goes next, so that every texture gets sharper at a similar rate
+        StreamingTexture* next = nullptr;
+        uint64_t nextSize = 0;
+        for (StreamingTexture& entry : m_Textures)
+        {
+            if (entry.residentMip == 0)
+                continue;
+
+            const uint64_t size = GetMipSize(*entry.source, entry.residentMip - 1);
+            if (!next || size < nextSize)
+            {
+                next = &entry;
+                nextSize = size;
+            }
+        }
+
+        if (!next || (writtenBytes > 0 && writtenBytes + nextSize > m_BudgetBytesPerFrame))
+            break;
+
+        --next->residentMip;
+        WriteMip(commandList, *next, next->residentMip);
+        writtenBytes += nextSize;
+        m_PendingBytes -= nextSize;
+    }
+
+    for (StreamingTexture& entry : m_Textures)
+        Publish(commandList, entry);
+
+    // Complete textures don't need their file data anymore
+    auto completed = std::remove_if(m_Textures.begin(), m_Textures.end(),
+        [](const StreamingTexture& entry) { return entry.publishedMip == 0; });
+    m_Textures.erase(completed, m_Textures.end());
+}
+
+void TextureStreamer::Clear()
+{
+    {
+        std::lock_guard<std::mutex> lockGuard(m_QueuedTexturesMutex);
+        m_QueuedTextures.clear();
+    }
+
+    m_Textures.clear();
+    m_PendingBytes = 0;
+}
+
+bool TextureStreamer::IsIdle() const
+{
+    std::lock_guard<std::mutex> lockGuard(m_QueuedTexturesMutex);
+    return m_Textures.empty() && m_QueuedTextures.empty();
+}
+
+size_t TextureStreamer::GetNumStreamingTextures() const
+{
+    std::lock_guard<std::mutex> lockGuard(m_QueuedTexturesMutex);
+    return m_Textures.size() + m_QueuedTextures.size();
+}
+
+StreamingFileSystem::StreamingFileSystem(std::shared_ptr<vfs::IFileSystem> fs, std::shared_ptr<TextureStreamer> streamer)
+    : m_Fs(std::move(fs))
+    , m_Streamer(std::move(streamer))
+{
+}
+
+bool StreamingFileSystem::folderExists(const std::filesystem::path& name)
+{
+    return m_Fs->folderExists(name);
+}
+
+bool StreamingFileSystem::fileExists(const std::filesystem::path& name)
+{
+    return m_Fs->fileExists(name);
+}
+
+std::shared_ptr<vfs::IBlob> StreamingFileSystem::readFile(const std::filesystem::path& name)
+{
+    return m_Streamer->AddTextureFile(name, m_Fs->readFile(name));
+}
+
+bool StreamingFileSystem::writeFile(const std::filesystem::path& name, const void* data, size_t size)
+{
+    return m_Fs->writeFile(name, data, size);
+}
+
+int StreamingFileSystem::enumerateFiles(const std::filesystem::path& path, const std::vector<std::string>& extensions,
+    vfs::enumerate_callback_t callback, bool allowDuplicates)
+{
+    return m_Fs->enumerateFiles(path, extensions, callback, allowDuplicates);
+}
+
+int StreamingFileSystem::enumerateDirectories(const std::filesystem::path& path, vfs::enumerate_callback_t callback, bool allowDuplicates)
+{
+    return m_Fs->enumerateDirectories(path, callback, allowDuplicates);
+}
@@ -0,0 +1,116 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <donut/core/vfs/VFS.h>
+#include <donut/engine/TextureCache.h>
+#include <nvrhi/nvrhi.h>
+
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Uploads textures progressively, lowest mips first, under a per-frame byte budget.
+//
+// The streamer works with a regular TextureCache through its file system, see StreamingFileSystem: DDS files with a mip chain
+// are served to the cache with only their mip tail, up to ResidentTailSize, which the cache loads and finalizes like any other
+// texture. When the tail is finalized, the streamer creates the texture with its full mip chain, copies the tail into it on the GPU,
+// and writes the remaining mips from the smallest to the largest, across all textures, until the budget of the frame is used.
+// At least one mip is written every frame, so mips larger than the budget still make progress.
+//
+// The mips that haven't been written are undefined, and the material passes sample the whole mip chain. Until a texture is
+// complete, its LoadedTexture therefore points to a smaller texture that only has the resident mips, which is copied on the GPU
+// from the full texture whenever more mips become resident. Materials that use the texture must rebuild their binding sets
+// when the LoadedTexture::texture pointer changes. Block compressed textures can only switch to a resident mip whose size
+// is a multiple of the block size. Textures that the cache unloads or replaces are dropped from streaming.
+class TextureStreamer
+{
+public:
+    static constexpr uint32_t ResidentTailSize = 64;
+
+    TextureStreamer(nvrhi::IDevice* device, uint64_t budgetBytesPerFrame);
+
+    // Called by StreamingFileSystem, from any thread, with the contents of a texture file that the cache is loading.
+    // If the file is a DDS texture with mips above the tail, the full file is queued for streaming and the returned blob
+    // is a DDS file with the mip tail only. Otherwise, the file is returned unchanged.
+    std::shared_ptr<donut::vfs::IBlob> AddTextureFile(const std::filesystem::path& path, const std::shared_ptr<donut::vfs::IBlob>& file);
+
+    // Starts streaming the queued textures whose tails have been finalized by the cache,
+    // writes the pending mips within the budget, and publishes the textures that have more resident mips
+    void Update(nvrhi::ICommandList* commandList, donut::engine::TextureCache& textureCache);
+
+    void Clear();
+
+    [[nodiscard]] bool IsIdle() const;
+    [[nodiscard]] size_t GetNumStreamingTextures() const;
+    [[nodiscard]] uint64_t GetPendingBytes() const { return m_PendingBytes; }
+
+private:
+    struct StreamingTexture
+    {
+        std::filesystem::path path;
+        std::shared_ptr<donut::engine::TextureData> source; // The full DDS file and its layout
+        std::weak_ptr<donut::engine::LoadedTexture> loadedTexture;
+        nvrhi::TextureHandle texture;           // Full mip chain
+        nvrhi::TextureHandle publishedTexture;  // What loadedTexture points to, the cache's tail texture at first
+        uint32_t residentMip = 0;               // Finest mip that has been written
+        uint32_t publishedMip = 0;              // Finest mip of publishedTexture
+    };
+
+    nvrhi::DeviceHandle m_Device;
+    uint64_t m_BudgetBytesPerFrame;
+    uint64_t m_PendingBytes = 0;
+    std::vector<StreamingTexture> m_Textures;
+
+    // Textures whose tails are being loaded by the cache, written by the loading threads
+    std::vector<StreamingTexture> m_QueuedTextures;
+    mutable std::mutex m_QueuedTexturesMutex;
+
+    static uint64_t GetMipSize(const donut::engine::TextureData& data, uint32_t mipLevel);
+    static bool CanPublishMip(const nvrhi::TextureDesc& desc, uint32_t mipLevel);
+
+    bool BeginStreaming(nvrhi::ICommandList* commandList, donut::engine::TextureCache& textureCache, StreamingTexture& entry);
+    void WriteMip(nvrhi::ICommandList* commandList, const StreamingTexture& entry, uint32_t mipLevel) const;
+    void Publish(nvrhi::ICommandList* commandList, StreamingTexture& entry) const;
+};
+
+// Forwards to another file system, and passes the texture files that it reads through TextureStreamer::AddTextureFile.
+// Texture caches that are created with this file system load the mip tails of the streamed textures instead of the full files.
+class StreamingFileSystem : public donut::vfs::IFileSystem
+{
+public:
+    StreamingFileSystem(std::shared_ptr<donut::vfs::IFileSystem> fs, std::shared_ptr<TextureStreamer> streamer);
+
+    bool folderExists(const std::filesystem::path& name) override;
+    bool fileExists(const std::filesystem::path& name) override;
+    std::shared_ptr<donut::vfs::IBlob> readFile(const std::filesystem::path& name) override;
+    bool writeFile(const std::filesystem::path& name, const void* data, size_t size) override;
+    int enumerateFiles(const std::filesystem::path& path, const std::vector<std::string>& extensions,
+        donut::vfs::enumerate_callback_t callback, bool allowDuplicates = false) override;
+    int enumerateDirectories(const std::filesystem::path& path, donut::vfs::enumerate_callback_t callback, bool allowDuplicates = false) override;
+
+private:
+    std::shared_ptr<donut::vfs::IFileSystem> m_Fs;
+    std::shared_ptr<TextureStreamer> m_Streamer;
+};
@@ -0,0 +1,174 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+#include "TransientTextures.h"
+
+#include <donut/core/log.h>
+
+#include <algorithm>
+#include <cassert>
+
+using namespace donut;
+
+TransientTextureAllocator::TransientTextureAllocator(nvrhi::IDevice* device)
+    : m_Device(device)
+{
+}
+
+TransientTextureAllocator::TextureEntry& TransientTextureAllocator::FindOrAddTexture(nvrhi::ITexture* texture)
+{
+    for (auto& entry : m_Textures)
+    {
+        if (entry.texture == texture)
+            return entry;
+    }
+
+    TextureEntry& entry = m_Textures.emplace_back();
+    entry.texture = texture;
+    return entry;
+}
+
+void TransientTextureAllocator::DeclarePass(uint32_t pass, std::initializer_list<nvrhi::ITexture*> reads, std::initializer_list<nvrhi::ITexture*> writes)
+{
+    if (m_Passes.size() <= pass)
+        m_Passes.resize(pass + 1);
+
+    PassEntry& passEntry = m_Passes[pass];
+
+    auto addUse = [this, pass](nvrhi::ITexture* texture)
+    {
+        TextureEntry& entry = FindOrAddTexture(texture);
+        entry.firstPass = std::min(entry.firstPass, pass);
+        entry.lastPass = std::max(entry.lastPass, pass);
+    };
+
+    for (nvrhi::ITexture* texture : reads)
+    {
+        if (!texture)
+            continue;
+        addUse(texture);
+        passEntry.reads.push_back(texture);
+    }
+
+    for (nvrhi::ITexture* texture : writes)
+    {
+        if (!texture)
+            continue;
+        addUse(texture);
+        passEntry.writes.push_back(texture);
+    }
+}
+
+bool TransientTextureAllocator::Allocate(const char* debugName)
+{
+    m_Statistics = Statistics();
+    m_Statistics.textureCount = uint32_t(m_Textures.size());
+
+    if (m_Textures.empty() || !m_Textures[0].texture->getDesc().isVirtual)
+        return false;
+
+    for (auto& entry : m_Textures)
+    {
+        assert(entry.texture->getDesc().isVirtual);
+
+        const nvrhi::MemoryRequirements memReq = m_Device->getTextureMemoryRequirements(entry.texture);
+        entry.size = memReq.size;
+        entry.alignment = memReq.alignment;
+        m_Statistics.totalSize += memReq.size;
+    }
+
+    // Greedy placement, largest textures first: every texture goes to the lowest offset where it doesn't overlap
+    // the memory of an already placed texture whose lifetime overlaps its own.
+    std::vector<TextureEntry*> sorted;
+    for (auto& entry : m_Textures)
+        sorted.push_back(&entry);
+    std::stable_sort(sorted.begin(), sorted.end(), [](const TextureEntry* a, const TextureEntry* b) { return a->size > b->size; });
+
+    std::vector<const TextureEntry*> placed;
+    for (TextureEntry* entry : sorted)
+    {
+        std::vector<const TextureEntry*> conflicts;
+        for (const TextureEntry* other : placed)
+        {
+            if (entry->firstPass <= other->lastPass && other->firstPass <= entry->lastPass)
+                conflicts.push_back(other);
+        }
+        std::sort(conflicts.begin(), conflicts.end(), [](const TextureEntry* a, const TextureEntry* b) { return a->offset < b->offset; });
+
+        uint64_t offset = 0;
+        for (const TextureEntry* other : conflicts)
+        {
+            if (offset + entry->size <= other->offset)
+                break;
+
+            offset = std::max(offset, nvrhi::align(other->offset + other->size, entry->alignment));
+        }
+
+        entry->offset = offset;
+        m_Statistics.heapSize = std::max(m_Statistics.heapSize, offset + entry->size);
+        placed.push_back(entry);
+    }
+
+    nvrhi::HeapDesc heapDesc;
+    heapDesc.type = nvrhi::HeapType::DeviceLocal;
+    heapDesc.capacity = m_Statistics.heapSize;
+    heapDesc.debugName = debugName;
+    m_Heap = m_Device->createHeap(heapDesc);
+
+    for (const auto& entry : m_Textures)
+        m_Device->bindTextureMemory(entry.texture, m_Heap, entry.offset);
+
+    log::info("%s: %u transient textures in %.1f MB, %.1f MB without aliasing", debugName, m_Statistics.textureCount,
+        double(m_Statistics.heapSize) / (1024.0 * 1024.0), double(m_Statistics.totalSize) / (1024.0 * 1024.0));
+
+    return true;
+}
+
+void TransientTextureAllocator::ActivateTexture(nvrhi::ICommandList* commandList, nvrhi::ITexture* texture) const
+{
+    const nvrhi::TextureDesc& desc = texture->getDesc();
+    const nvrhi::FormatInfo& formatInfo = nvrhi::getFormatInfo(desc.format);
+
+    if (formatInfo.hasDepth || formatInfo.hasStencil)
+        commandList->clearDepthStencilTexture(texture, nvrhi::AllSubresources, true, desc.clearValue.r, formatInfo.hasStencil, 0);
+    else if (formatInfo.kind == nvrhi::FormatKind::Integer)
+        commandList->clearTextureUInt(texture, nvrhi::AllSubresources, uint32_t(desc.clearValue.r));
+    else
+        commandList->clearTextureFloat(texture, nvrhi::AllSubresources, desc.clearValue);
+}
+
+void TransientTextureAllocator::BeginPass(nvrhi::ICommandList* commandList, uint32_t pass) const
+{
+    if (pass >= m_Passes.size())
+        return;
+
+    for (const auto& entry : m_Textures)
+    {
+        if (entry.firstPass == pass)
+            ActivateTexture(commandList, entry.texture);
+    }
+
+    // Batch the transitions of all the inputs instead of letting each draw or dispatch of the pass place its own
+    for (nvrhi::ITexture* texture : m_Passes[pass].reads)
+        commandList->setTextureState(texture, nvrhi::AllSubresources, nvrhi::ResourceStates::ShaderResource);
+    commandList->commitBarriers();
+}
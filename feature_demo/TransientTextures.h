@@ -0,0 +1,87 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <nvrhi/nvrhi.h>
+
+#include <initializer_list>
+#include <vector>
+
+// Places render targets with non-overlapping lifetimes at the same offsets of a single heap.
+// The frame is described as an ordered list of passes, numbered from 0, that declare which textures they read and write.
+// The lifetime of a texture spans from the first to the last pass that uses it, and its contents are undefined outside of it:
+// BeginPass clears the texture when its lifetime starts, which is also the initialization that placed render targets
+// require after another texture has used their memory, and transitions the pass inputs before the pass records its work.
+//
+// The declarations must cover the union of what all rendering modes do in a frame, since the placement is static.
+// Textures must be created with isVirtual = true; if the device doesn't support virtual resources, Allocate returns false
+// and the textures are expected to be committed, in which case BeginPass still clears them.
+class TransientTextureAllocator
+{
+public:
+    struct Statistics
+    {
+        uint64_t heapSize = 0;      // Bytes, with aliasing
+        uint64_t totalSize = 0;     // Bytes, if every texture had its own memory
+        uint32_t textureCount = 0;
+    };
+
+    explicit TransientTextureAllocator(nvrhi::IDevice* device);
+
+    void DeclarePass(uint32_t pass, std::initializer_list<nvrhi::ITexture*> reads, std::initializer_list<nvrhi::ITexture*> writes);
+
+    // Computes the lifetimes and the placement, creates the heap and binds the texture memory
+    bool Allocate(const char* debugName);
+
+    // Call before recording the work of 'pass'. Passes must be recorded in order, possibly into several command lists
+    // that are executed in that order.
+    void BeginPass(nvrhi::ICommandList* commandList, uint32_t pass) const;
+
+    [[nodiscard]] const Statistics& GetStatistics() const { return m_Statistics; }
+
+private:
+    struct TextureEntry
+    {
+        nvrhi::TextureHandle texture;
+        uint32_t firstPass = ~0u;
+        uint32_t lastPass = 0;
+        uint64_t size = 0;
+        uint64_t alignment = 0;
+        uint64_t offset = 0;
+    };
+
+    struct PassEntry
+    {
+        std::vector<nvrhi::ITexture*> reads;
+        std::vector<nvrhi::ITexture*> writes;
+    };
+
+    nvrhi::DeviceHandle m_Device;
+    nvrhi::HeapHandle m_Heap;
+    std::vector<TextureEntry> m_Textures;
+    std::vector<PassEntry> m_Passes;
+    Statistics m_Statistics;
+
+    TextureEntry& FindOrAddTexture(nvrhi::ITexture* texture);
+    void ActivateTexture(nvrhi::ICommandList* commandList, nvrhi::ITexture* texture) const;
+};
@@ -0,0 +1,326 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+#include "TransparencySort.h"
+#include "AsyncReadback.h"
+
+#include <donut/engine/Scene.h>
+#include <donut/engine/ShaderFactory.h>
+#include <nvrhi/utils.h>
+
+using namespace donut;
+using namespace donut::math;
+using namespace donut::engine;
+using namespace donut::render;
+
+#include <donut/shaders/bindless.h>
+#include "gpu_culling_cb.h"
+#include "transparency_sort_cb.h"
+
+static_assert(sizeof(TransparencySortRecord) == 32, "TransparencySortRecord must match the structured buffer layout in transparency_sort.hlsl");
+static_assert(TRANSPARENCY_SORT_GROUP_SIZE == TRANSPARENCY_SORT_RADIX, "The sort shaders use one thread per digit");
+
+TransparencySort::TransparencySort(nvrhi::IDevice* device, ShaderFactory& shaderFactory)
+    : m_Device(device)
+{
+    m_KeysShader = shaderFactory.CreateShader("app/transparency_sort.hlsl", "keys_cs", nullptr, nvrhi::ShaderType::Compute);
+    m_HistogramShader = shaderFactory.CreateShader("app/transparency_sort.hlsl", "histogram_cs", nullptr, nvrhi::ShaderType::Compute);
+    m_ScanShader = shaderFactory.CreateShader("app/transparency_sort.hlsl", "scan_cs", nullptr, nvrhi::ShaderType::Compute);
+    m_ScatterShader = shaderFactory.CreateShader("app/transparency_sort.hlsl", "scatter_cs", nullptr, nvrhi::ShaderType::Compute);
+
+    nvrhi::BindingLayoutDesc keysLayoutDesc;
+    keysLayoutDesc.visibility = nvrhi::ShaderType::Compute;
+    keysLayoutDesc.bindings = {
+        nvrhi::BindingLayoutItem::VolatileConstantBuffer(0),
+        nvrhi::BindingLayoutItem::StructuredBuffer_SRV(0),
+        nvrhi::BindingLayoutItem::RawBuffer_SRV(1),
+        nvrhi::BindingLayoutItem::TypedBuffer_UAV(0),
+        nvrhi::BindingLayoutItem::TypedBuffer_UAV(1)
+    };
+    m_KeysBindingLayout = m_Device->createBindingLayout(keysLayoutDesc);
+
+    nvrhi::BindingLayoutDesc sortLayoutDesc;
+    sortLayoutDesc.visibility = nvrhi::ShaderType::Compute;
+    sortLayoutDesc.bindings = {
+        nvrhi::BindingLayoutItem::VolatileConstantBuffer(0),
+        nvrhi::BindingLayoutItem::TypedBuffer_SRV(0),
+        nvrhi::BindingLayoutItem::TypedBuffer_SRV(1),
+        nvrhi::BindingLayoutItem::TypedBuffer_UAV(0),
+        nvrhi::BindingLayoutItem::TypedBuffer_UAV(1),
+        nvrhi::BindingLayoutItem::TypedBuffer_UAV(2)
+    };
+    m_SortBindingLayout = m_Device->createBindingLayout(sortLayoutDesc);
+
+    auto createPipeline = [this](nvrhi::IShader* shader, nvrhi::IBindingLayout* layout)
+    {
+        auto pipelineDesc = nvrhi::ComputePipelineDesc()
+            .setComputeShader(shader)
+            .addBindingLayout(layout);
+        return m_Device->createComputePipeline(pipelineDesc);
+    };
+
+    m_KeysPipeline = createPipeline(m_KeysShader, m_KeysBindingLayout);
+    m_HistogramPipeline = createPipeline(m_HistogramShader, m_SortBindingLayout);
+    m_ScanPipeline = createPipeline(m_ScanShader, m_SortBindingLayout);
+    m_ScatterPipeline = createPipeline(m_ScatterShader, m_SortBindingLayout);
+
+    // Written once for the keys and once per radix pass
+    m_ConstantBuffer = m_Device->createBuffer(nvrhi::utils::CreateVolatileConstantBufferDesc(
+        sizeof(TransparencySortConstants), "TransparencySortConstants", c_MaxRenderPassConstantBufferVersions));
+}
+
+void TransparencySort::Update(nvrhi::ICommandList* commandList, Scene& scene)
+{
+    if (IsSceneChanged(scene))
+        BuildRecords(commandList, scene);
+}
+
+bool TransparencySort::IsSceneChanged(Scene& scene) const
+{
+    if (scene.GetInstanceBuffer() != m_SceneInstanceBuffer)
+        return true;
+
+    const auto& instances = scene.GetSceneGraph()->GetMeshInstances();
+    if (instances.size() != m_Instances.size())
+        return true;
+
+    for (size_t index = 0; index < instances.size(); index++)
+    {
+        if (instances[index].get() != m_Instances[index])
+            return true;
+    }
+
+    return false;
+}
+
+void TransparencySort::BuildRecords(nvrhi::ICommandList* commandList, Scene& scene)
+{
+    m_Instances.clear();
+    m_Records.clear();
+    m_Order.clear();
+    m_DrawItems.clear();
+    m_NumVisibleRecords = 0;
+    m_RecordBuffer = nullptr;
+    m_KeysBindingSet = nullptr;
+    m_SortBindingSets[0] = nullptr;
+    m_SortBindingSets[1] = nullptr;
+    m_SceneInstanceBuffer = scene.GetInstanceBuffer();
+    ++m_Generation;
+
+    std::vector<TransparencySortRecord> records;
+
+    for (const auto& instance : scene.GetSceneGraph()->GetMeshInstances())
+    {
+        m_Instances.push_back(instance.get());
+
+        const auto& mesh = instance->GetMesh();
+        if (!mesh || !mesh->buffers)
+            continue;
+
+        for (const auto& geometry : mesh->geometries)
+        {
+            const Material* material = geometry->material.get();
+            if (!material || material->domain == MaterialDomain::Opaque || material->domain == MaterialDomain::AlphaTested)
+                continue;
+
+            DrawItem item{};
+            item.instance = instance.get();
+            item.mesh = mesh.get();
+            item.geometry = geometry.get();
+            item.material = material;
+            item.buffers = mesh->buffers.get();
+            item.cullMode = material->doubleSided ? nvrhi::RasterCullMode::Front : nvrhi::RasterCullMode::Back;
+            m_Records.push_back(item);
+
+            TransparencySortRecord record{};
+            record.boundsMin = geometry->objectSpaceBounds.m_mins;
+            record.boundsMax = geometry->objectSpaceBounds.m_maxs;
+            record.instanceIndex = uint32_t(instance->GetInstanceIndex());
+            records.push_back(record);
+        }
+    }
+
+    if (records.empty())
+        return;
+
+    const uint32_t numRecords = uint32_t(records.size());
+    const uint32_t numGroups = div_ceil(numRecords, TRANSPARENCY_SORT_GROUP_SIZE);
+
+    nvrhi::BufferDesc bufferDesc;
+    bufferDesc.byteSize = records.size() * sizeof(TransparencySortRecord);
+    bufferDesc.structStride = sizeof(TransparencySortRecord);
+    bufferDesc.initialState = nvrhi::ResourceStates::ShaderResource;
+    bufferDesc.keepInitialState = true;
+    bufferDesc.debugName = "TransparencySortRecords";
+    m_RecordBuffer = m_Device->createBuffer(bufferDesc);
+
+    commandList->writeBuffer(m_RecordBuffer, records.data(), records.size() * sizeof(TransparencySortRecord));
+
+    auto createUintBuffer = [this](uint64_t count, const char* debugName)
+    {
+        nvrhi::BufferDesc desc;
+        desc.byteSize = count * sizeof(uint32_t);
+        desc.format = nvrhi::Format::R32_UINT;
+        desc.canHaveTypedViews = true;
+        desc.canHaveUAVs = true;
+        desc.initialState = nvrhi::ResourceStates::UnorderedAccess;
+        desc.keepInitialState = true;
+        desc.debugName = debugName;
+        return m_Device->createBuffer(desc);
+    };
+
+    m_Keys[0] = createUintBuffer(numRecords, "TransparencySortKeys0");
+    m_Keys[1] = createUintBuffer(numRecords, "TransparencySortKeys1");
+    m_Values[0] = createUintBuffer(numRecords, "TransparencySortValues0");
+    m_Values[1] = createUintBuffer(numRecords, "TransparencySortValues1");
+    m_Histograms = createUintBuffer(uint64_t(numGroups) * TRANSPARENCY_SORT_RADIX, "TransparencySortHistograms");
+
+    nvrhi::BindingSetDesc keysSetDesc;
+    keysSetDesc.bindings = {
+        nvrhi::BindingSetItem::ConstantBuffer(0, m_ConstantBuffer),
+        nvrhi::BindingSetItem::StructuredBuffer_SRV(0, m_RecordBuffer),
+        nvrhi::BindingSetItem::RawBuffer_SRV(1, m_SceneInstanceBuffer),
+        nvrhi::BindingSetItem::TypedBuffer_UAV(0, m_Keys[0]),
+        nvrhi::BindingSetItem::TypedBuffer_UAV(1, m_Values[0])
+    };
+    m_KeysBindingSet = m_Device->createBindingSet(keysSetDesc, m_KeysBindingLayout);
+
+    // Set 0 sorts from buffers 0 into buffers 1, set 1 the other way around
+    for (int source = 0; source < 2; source++)
+    {
+        nvrhi::BindingSetDesc sortSetDesc;
+        sortSetDesc.bindings = {
+            nvrhi::BindingSetItem::ConstantBuffer(0, m_ConstantBuffer),
+            nvrhi::BindingSetItem::TypedBuffer_SRV(0, m_Keys[source]),
+            nvrhi::BindingSetItem::TypedBuffer_SRV(1, m_Values[source]),
+            nvrhi::BindingSetItem::TypedBuffer_UAV(0, m_Keys[1 - source]),
+            nvrhi::BindingSetItem::TypedBuffer_UAV(1, m_Values[1 - source]),
+            nvrhi::BindingSetItem::TypedBuffer_UAV(2, m_Histograms)
+        };
+        m_SortBindingSets[source] = m_Device->createBindingSet(sortSetDesc, m_SortBindingLayout);
+    }
+
+    // Until the first sorted order arrives, draw in record order
+    m_Order.resize(numRecords);
+    for (uint32_t index = 0; index < numRecords; index++)
+        m_Order[index] = index;
+}
+
+void TransparencySort::Sort(nvrhi::ICommandList* commandList, const IView& view, AsyncReadback& readback)
+{
+    if (!m_KeysBindingSet)
+        return;
+
+    const uint32_t numRecords = uint32_t(m_Records.size());
+    const uint32_t numGroups = div_ceil(numRecords, TRANSPARENCY_SORT_GROUP_SIZE);
+
+    commandList->beginMarker("TransparencySort");
+
+    TransparencySortConstants constants = {};
+    constants.viewOrigin = view.GetViewOrigin();
+    constants.viewDirection = view.GetViewDirection();
+    constants.numRecords = numRecords;
+    constants.numGroups = numGroups;
+    constants.instanceDataStride = sizeof(InstanceData);
+    commandList->writeBuffer(m_ConstantBuffer, &constants, sizeof(constants));
+
+    nvrhi::ComputeState state;
+    state.pipeline = m_KeysPipeline;
+    state.bindings = { m_KeysBindingSet };
+    commandList->setComputeState(state);
+    commandList->dispatch(numGroups);
+
+    for (uint32_t pass = 0; pass < TRANSPARENCY_SORT_PASSES; pass++)
+    {
+        constants.digitShift = pass * TRANSPARENCY_SORT_RADIX_BITS;
+        commandList->writeBuffer(m_ConstantBuffer, &constants, sizeof(constants));
+
+        state.bindings = { m_SortBindingSets[pass & 1] };
+
+        state.pipeline = m_HistogramPipeline;
+        commandList->setComputeState(state);
+        commandList->dispatch(numGroups);
+
+        state.pipeline = m_ScanPipeline;
+        commandList->setComputeState(state);
+        commandList->dispatch(1);
+
+        state.pipeline = m_ScatterPipeline;
+        commandList->setComputeState(state);
+        commandList->dispatch(numGroups);
+    }
+
+    static_assert(TRANSPARENCY_SORT_PASSES % 2 == 0, "The sorted values are expected in buffer 0");
+
+    commandList->endMarker();
+
+    const uint32_t generation = m_Generation;
+    readback.ReadBuffer(commandList, m_Values[0], 0, uint64_t(numRecords) * sizeof(uint32_t),
+        [this, generation, numRecords](const void* data, size_t size)
+        {
+            if (generation != m_Generation || size != numRecords * sizeof(uint32_t))
+                return;
+
+            const uint32_t* values = static_cast<const uint32_t*>(data);
+            m_Order.assign(values, values + numRecords);
+        });
+}
+
+void TransparencySort::PrepareForView(const std::shared_ptr<SceneGraphNode>& rootNode, const IView& view)
+{
+    // The order may be a few frames old, but the visibility is always tested against the current view
+    const frustum viewFrustum = view.GetViewFrustum();
+
+    m_DrawItems.clear();
+    m_NextDrawItem = 0;
+    m_NumVisibleRecords = 0;
+
+    for (uint32_t recordIndex : m_Order)
+    {
+        if (recordIndex >= m_Records.size())
+            continue;
+
+        const DrawItem& record = m_Records[recordIndex];
+
+        // Skinned meshes move outside of their bind pose bounds
+        const SceneGraphNode* node = record.instance->GetNode();
+        if (!record.mesh->skinPrototype && node && !viewFrustum.intersectsWith(node->GetGlobalBoundingBox()))
+            continue;
+
+        ++m_NumVisibleRecords;
+        m_DrawItems.push_back(record);
+
+        if (record.material->doubleSided)
+        {
+            m_DrawItems.push_back(record);
+            m_DrawItems.back().cullMode = nvrhi::RasterCullMode::Back;
+        }
+    }
+}
+
+const DrawItem* TransparencySort::GetNextItem()
+{
+    if (m_NextDrawItem < m_DrawItems.size())
+        return &m_DrawItems[m_NextDrawItem++];
+
+    return nullptr;
+}
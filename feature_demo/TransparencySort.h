@@ -0,0 +1,101 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <donut/engine/SceneGraph.h>
+#include <donut/engine/SceneTypes.h>
+#include <donut/engine/View.h>
+#include <donut/render/DrawStrategy.h>
+#include <nvrhi/nvrhi.h>
+
+#include <vector>
+
+namespace donut::engine
+{
+    class Scene;
+    class ShaderFactory;
+}
+
+class AsyncReadback;
+
+// Replacement for TransparentDrawStrategy that sorts the transparent (instance, geometry) pairs back to front on the GPU.
+// Every frame, Sort computes the view depth of every pair and radix sorts them, and the resulting order is read back
+// asynchronously. The readback only decides the order: the draw strategy frustum culls the pairs on the CPU for the
+// current view and returns the visible ones in the most recent order that has arrived. Only the order lags the view,
+// by the readback latency of usually one or two frames, so instances that become visible are drawn right away.
+// Draws can't be issued indirectly in the sorted order because every draw may need a different material binding set.
+// Double-sided materials are drawn twice, back faces first, like TransparentDrawStrategy does.
+class TransparencySort : public donut::render::IDrawStrategy
+{
+public:
+    TransparencySort(nvrhi::IDevice* device, donut::engine::ShaderFactory& shaderFactory);
+
+    // Rebuilds the records when the set of mesh instances has changed
+    void Update(nvrhi::ICommandList* commandList, donut::engine::Scene& scene);
+
+    // Records the sort for 'view' and the readback of its result
+    void Sort(nvrhi::ICommandList* commandList, const donut::engine::IView& view, AsyncReadback& readback);
+
+    void PrepareForView(const std::shared_ptr<donut::engine::SceneGraphNode>& rootNode, const donut::engine::IView& view) override;
+    const donut::engine::DrawItem* GetNextItem() override;
+
+    [[nodiscard]] uint32_t GetNumRecords() const { return uint32_t(m_Records.size()); }
+    [[nodiscard]] uint32_t GetNumVisibleRecords() const { return m_NumVisibleRecords; }
+
+private:
+    nvrhi::DeviceHandle m_Device;
+
+    nvrhi::ShaderHandle m_KeysShader;
+    nvrhi::ShaderHandle m_HistogramShader;
+    nvrhi::ShaderHandle m_ScanShader;
+    nvrhi::ShaderHandle m_ScatterShader;
+    nvrhi::BindingLayoutHandle m_KeysBindingLayout;
+    nvrhi::BindingLayoutHandle m_SortBindingLayout;
+    nvrhi::ComputePipelineHandle m_KeysPipeline;
+    nvrhi::ComputePipelineHandle m_HistogramPipeline;
+    nvrhi::ComputePipelineHandle m_ScanPipeline;
+    nvrhi::ComputePipelineHandle m_ScatterPipeline;
+    nvrhi::BufferHandle m_ConstantBuffer;
+
+    // Scene state that the records were built from
+    std::vector<const donut::engine::MeshInstance*> m_Instances;
+    nvrhi::BufferHandle m_SceneInstanceBuffer;
+    uint32_t m_Generation = 0; // Incremented with every rebuild, results of older generations are dropped
+
+    std::vector<donut::engine::DrawItem> m_Records;
+    nvrhi::BufferHandle m_RecordBuffer;
+    nvrhi::BufferHandle m_Keys[2];
+    nvrhi::BufferHandle m_Values[2];    // Record indices
+    nvrhi::BufferHandle m_Histograms;
+    nvrhi::BindingSetHandle m_KeysBindingSet;
+    nvrhi::BindingSetHandle m_SortBindingSets[2];
+
+    // All record indices in back to front order, from the latest readback
+    std::vector<uint32_t> m_Order;
+    std::vector<donut::engine::DrawItem> m_DrawItems;
+    size_t m_NextDrawItem = 0;
+    uint32_t m_NumVisibleRecords = 0; // In the last view that was prepared
+
+    [[nodiscard]] bool IsSceneChanged(donut::engine::Scene& scene) const;
+    void BuildRecords(nvrhi::ICommandList* commandList, donut::engine::Scene& scene);
+};
@@ -0,0 +1,154 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+#pragma pack_matrix(row_major)
+
+#include "gpu_culling_cb.h"
+
+// ---[ Instance Culling ]---
+
+ConstantBuffer<GpuCullingConstants> g_Culling : register(b0);
+
+StructuredBuffer<CullingRecord> t_Records : register(t0);
+ByteAddressBuffer t_Instances : register(t1);
+Texture2D<float> t_HiZ : register(t2);
+
+RWByteAddressBuffer u_DrawArguments : register(u0);
+RWByteAddressBuffer u_CulledInstances : register(u1);
+
+float3x4 LoadTransform(uint offset)
+{
+    return float3x4(
+        asfloat(t_Instances.Load4(offset)),
+        asfloat(t_Instances.Load4(offset + 16)),
+        asfloat(t_Instances.Load4(offset + 32)));
+}
+
+float3 GetBoxCorner(CullingRecord record, uint corner)
+{
+    return float3(
+        (corner & 1) ? record.boundsMax.x : record.boundsMin.x,
+        (corner & 2) ? record.boundsMax.y : record.boundsMin.y,
+        (corner & 4) ? record.boundsMax.z : record.boundsMin.z);
+}
+
+bool IsInsideFrustum(CullingRecord record, float3x4 transform)
+{
+    // The box is outside if all of its corners are on the outer side of one clip plane
+    uint outsideMask = 0x3f;
+
+    for (uint corner = 0; corner < 8; corner++)
+    {
+        float3 worldPos = mul(transform, float4(GetBoxCorner(record, corner), 1.0));
+        float4 clipPos = mul(float4(worldPos, 1.0), g_Culling.matWorldToClip);
+
+        uint mask = 0;
+        if (clipPos.x < -clipPos.w) mask |= 0x01;
+        if (clipPos.x > clipPos.w)  mask |= 0x02;
+        if (clipPos.y < -clipPos.w) mask |= 0x04;
+        if (clipPos.y > clipPos.w)  mask |= 0x08;
+        if (clipPos.z < 0)          mask |= 0x10;
+        if (clipPos.z > clipPos.w)  mask |= 0x20;
+        outsideMask &= mask;
+    }
+
+    return outsideMask == 0;
+}
+
+// Tests the box as it was in the previous frame against the Hi-Z pyramid built from that frame's depth.
+// The depth buffer uses reverse Z, so the pyramid stores the farthest (minimum) depth of every footprint.
+bool IsOccluded(CullingRecord record, float3x4 prevTransform)
+{
+    float2 uvMin = 1.0;
+    float2 uvMax = 0.0;
+    float nearestDepth = 0.0;
+
+    for (uint corner = 0; corner < 8; corner++)
+    {
+        float3 worldPos = mul(prevTransform, float4(GetBoxCorner(record, corner), 1.0));
+        float4 clipPos = mul(float4(worldPos, 1.0), g_Culling.matPrevWorldToClip);
+
+        // The box crosses the camera plane, the projected rectangle is unbounded
+        if (clipPos.w <= 0)
+            return false;
+
+        float3 ndc = clipPos.xyz / clipPos.w;
+        float2 uv = (ndc.xy * float2(0.5, -0.5) + 0.5) * g_Culling.hizUvScale;
+        uvMin = min(uvMin, uv);
+        uvMax = max(uvMax, uv);
+        nearestDepth = max(nearestDepth, ndc.z);
+    }
+
+    uvMin = clamp(uvMin, 0.0, g_Culling.hizUvScale);
+    uvMax = clamp(uvMax, 0.0, g_Culling.hizUvScale);
+
+    // Pick the mip where the rectangle covers at most 2x2 texels
+    float2 texelMin = uvMin * g_Culling.hizSize;
+    float2 texelMax = uvMax * g_Culling.hizSize;
+    float2 extent = texelMax - texelMin;
+    uint mipLevel = uint(ceil(log2(max(max(extent.x, extent.y), 1.0))));
+    mipLevel = min(mipLevel, g_Culling.hizMipLevels - 1);
+
+    uint2 mipSize;
+    uint mipCount;
+    t_HiZ.GetDimensions(mipLevel, mipSize.x, mipSize.y, mipCount);
+
+    float2 mipScale = float2(mipSize) / g_Culling.hizSize;
+    int2 coordMin = min(int2(texelMin * mipScale), int2(mipSize) - 1);
+    int2 coordMax = min(int2(texelMax * mipScale), int2(mipSize) - 1);
+
+    float farthestOccluderDepth = min(
+        min(t_HiZ.Load(int3(coordMin.x, coordMin.y, mipLevel)), t_HiZ.Load(int3(coordMax.x, coordMin.y, mipLevel))),
+        min(t_HiZ.Load(int3(coordMin.x, coordMax.y, mipLevel)), t_HiZ.Load(int3(coordMax.x, coordMax.y, mipLevel))));
+
+    return nearestDepth < farthestOccluderDepth;
+}
+
+[numthreads(GPU_CULLING_GROUP_SIZE, 1, 1)]
+void cull_cs(uint recordIndex : SV_DispatchThreadID)
+{
+    if (recordIndex >= g_Culling.numRecords)
+        return;
+
+    CullingRecord record = t_Records[recordIndex];
+    uint instanceOffset = record.instanceIndex * g_Culling.instanceDataStride;
+
+    if ((record.flags & CULLING_RECORD_ALWAYS_VISIBLE) == 0)
+    {
+        if (!IsInsideFrustum(record, LoadTransform(instanceOffset + INSTANCE_DATA_TRANSFORM_OFFSET)))
+            return;
+
+        if (g_Culling.enableOcclusion && IsOccluded(record, LoadTransform(instanceOffset + INSTANCE_DATA_PREV_TRANSFORM_OFFSET)))
+            return;
+    }
+
+    // Append the instance to its draw: the instance count is the second field of the indirect arguments
+    uint drawIndex = g_Culling.drawArgsBase + record.batchIndex;
+    uint slot;
+    u_DrawArguments.InterlockedAdd(drawIndex * DRAW_INDEXED_INDIRECT_ARGS_SIZE + 4, 1, slot);
+
+    uint culledOffset = (g_Culling.instanceBase + record.batchFirstInstance + slot) * g_Culling.instanceDataStride;
+    for (uint offset = 0; offset < g_Culling.instanceDataStride; offset += 16)
+    {
+        u_CulledInstances.Store4(culledOffset + offset, t_Instances.Load4(instanceOffset + offset));
+    }
+}
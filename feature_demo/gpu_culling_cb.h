@@ -0,0 +1,75 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef GPU_CULLING_CB_H
+#define GPU_CULLING_CB_H
+
+// Byte offsets of the transforms in the InstanceData structure from <donut/shaders/bindless.h>
+#define INSTANCE_DATA_TRANSFORM_OFFSET      16
+#define INSTANCE_DATA_PREV_TRANSFORM_OFFSET 64
+
+#define CULLING_RECORD_ALWAYS_VISIBLE       1
+
+#define DRAW_INDEXED_INDIRECT_ARGS_SIZE     20
+
+#define GPU_CULLING_GROUP_SIZE              64
+#define HIZ_BUILD_GROUP_SIZE                8
+
+// One (mesh instance, geometry) pair that may be drawn
+struct CullingRecord
+{
+    float3 boundsMin;               // Object space bounds of the geometry
+    uint instanceIndex;             // Index into the scene instance buffer
+
+    float3 boundsMax;
+    uint batchIndex;                // Indirect draw that renders the geometry
+
+    uint batchFirstInstance;        // First compacted instance slot of that draw
+    uint flags;
+    uint2 padding;
+};
+
+struct GpuCullingConstants
+{
+    float4x4 matWorldToClip;
+    float4x4 matPrevWorldToClip;    // Used for the occlusion test against last frame's depth
+
+    float2 hizSize;                 // Size of mip 0 of the Hi-Z pyramid
+    uint hizMipLevels;
+    uint enableOcclusion;
+
+    float2 hizUvScale;              // Part of the pyramid covered by the previous view's viewport, less than 1 with dynamic resolution
+    uint2 padding;
+
+    uint numRecords;
+    uint instanceDataStride;
+    uint drawArgsBase;              // First indirect draw of this view in the arguments buffer
+    uint instanceBase;              // First compacted instance of this view in the culled instance buffer
+};
+
+struct HiZBuildConstants
+{
+    uint2 inputSize;
+    uint2 outputSize;
+};
+
+#endif // GPU_CULLING_CB_H
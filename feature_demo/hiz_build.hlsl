@@ -0,0 +1,52 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+#include "gpu_culling_cb.h"
+
+// Builds one level of the Hi-Z pyramid that is used for occlusion culling from the level above it, or from the depth buffer.
+
+ConstantBuffer<HiZBuildConstants> g_HiZ : register(b0);
+
+Texture2D<float> t_HiZInput : register(t0);
+RWTexture2D<float> u_HiZOutput : register(u0);
+
+[numthreads(HIZ_BUILD_GROUP_SIZE, HIZ_BUILD_GROUP_SIZE, 1)]
+void main(uint2 pixel : SV_DispatchThreadID)
+{
+    if (any(pixel >= g_HiZ.outputSize))
+        return;
+
+    // The footprint is 3 texels wide where the input size is odd, so that no depth sample is skipped
+    uint2 begin = pixel * g_HiZ.inputSize / g_HiZ.outputSize;
+    uint2 end = min(((pixel + 1) * g_HiZ.inputSize + g_HiZ.outputSize - 1) / g_HiZ.outputSize, g_HiZ.inputSize);
+
+    float farthestDepth = 1.0;
+    for (uint y = begin.y; y < end.y; y++)
+    {
+        for (uint x = begin.x; x < end.x; x++)
+        {
+            farthestDepth = min(farthestDepth, t_HiZInput[uint2(x, y)]);
+        }
+    }
+
+    u_HiZOutput[pixel] = farthestDepth;
+}
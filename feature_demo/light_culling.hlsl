@@ -0,0 +1,179 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+// Bins the local lights into screen tiles.
+// Every tile is bounded by its four side planes and by the nearest and farthest depth of its pixels,
+// and a light is added to the tile if its bounding sphere intersects that volume.
+// All the tests are done in world space, so they don't depend on the projection or depth conventions.
+
+#pragma pack_matrix(row_major)
+
+#include "light_culling_cb.h"
+
+ConstantBuffer<LightCullingConstants> g_Culling : register(b0);
+
+Texture2D<float> t_Depth : register(t0);
+StructuredBuffer<float4> t_LightBounds : register(t1); // xyz = world-space center, w = radius
+RWStructuredBuffer<uint> u_TileLights : register(u0);
+RWStructuredBuffer<uint> u_Stats : register(u1);
+
+groupshared uint s_MinDepth;
+groupshared uint s_MaxDepth;
+groupshared uint s_NumLights;
+groupshared float4 s_TilePlanes[4];
+groupshared float3 s_DepthPlaneNormal;
+groupshared float s_SlabMin;
+groupshared float s_SlabMax;
+
+float3 ClipToWorld(float2 windowPos, float depth)
+{
+    const float2 uv = (windowPos - g_Culling.view.viewportOrigin) * g_Culling.view.viewportSizeInv;
+    const float4 clipPos = float4(uv.x * 2.0 - 1.0, 1.0 - uv.y * 2.0, depth, 1.0);
+    const float4 worldPos = mul(clipPos, g_Culling.view.matClipToWorld);
+    return worldPos.xyz / worldPos.w;
+}
+
+// Plane through a, b, c, facing the 'inside' point
+float4 MakePlane(float3 a, float3 b, float3 c, float3 inside)
+{
+    float3 normal = normalize(cross(b - a, c - a));
+    float distance = dot(normal, a);
+    if (dot(normal, inside) - distance < 0)
+    {
+        normal = -normal;
+        distance = -distance;
+    }
+    return float4(normal, distance);
+}
+
+[numthreads(LIGHT_CULLING_TILE_SIZE, LIGHT_CULLING_TILE_SIZE, 1)]
+void cull_cs(uint2 groupThreadId : SV_GroupThreadID, uint2 tile : SV_GroupID, uint threadIndex : SV_GroupIndex)
+{
+    const uint2 viewportSize = uint2(g_Culling.view.viewportSize);
+    const uint2 tileOrigin = uint2(g_Culling.view.viewportOrigin) + tile * LIGHT_CULLING_TILE_SIZE;
+    const uint2 pixel = tileOrigin + groupThreadId;
+    const float farDepth = g_Culling.reverseDepth ? 0.0 : 1.0;
+
+    if (threadIndex == 0)
+    {
+        s_MinDepth = asuint(1.0);
+        s_MaxDepth = 0;
+        s_NumLights = 0;
+    }
+
+    GroupMemoryBarrierWithGroupSync();
+
+    // Depth values are non-negative, so their bit patterns sort in the same order as the values
+    if (all(tile * LIGHT_CULLING_TILE_SIZE + groupThreadId < viewportSize))
+    {
+        const float depth = t_Depth[pixel];
+        if (depth != farDepth)
+        {
+            InterlockedMin(s_MinDepth, asuint(depth));
+            InterlockedMax(s_MaxDepth, asuint(depth));
+        }
+    }
+
+    GroupMemoryBarrierWithGroupSync();
+
+    const uint tileIndex = tile.y * g_Culling.tileCount.x + tile.x;
+    const uint listStart = tileIndex * LIGHT_CULLING_MAX_LIGHTS_PER_TILE;
+
+    // Only sky in this tile, nothing to light
+    if (s_MaxDepth < s_MinDepth)
+    {
+        if (threadIndex == 0)
+            u_TileLights[listStart] = LIGHT_CULLING_END_OF_LIST;
+        return;
+    }
+
+    if (threadIndex == 0)
+    {
+        const float2 tileMin = float2(tileOrigin);
+        const float2 tileMax = min(tileMin + LIGHT_CULLING_TILE_SIZE, g_Culling.view.viewportOrigin + g_Culling.view.viewportSize);
+        const float2 corners[4] = { tileMin, float2(tileMax.x, tileMin.y), tileMax, float2(tileMin.x, tileMax.y) };
+
+        // The side planes don't depend on the depth, use any two depths inside of the view frustum to build them
+        const float3 inside = ClipToWorld((tileMin + tileMax) * 0.5, 0.5);
+        float3 front[4];
+        float3 back[4];
+        [unroll]
+        for (uint i = 0; i < 4; i++)
+        {
+            front[i] = ClipToWorld(corners[i], 0.25);
+            back[i] = ClipToWorld(corners[i], 0.75);
+        }
+
+        [unroll]
+        for (uint i = 0; i < 4; i++)
+            s_TilePlanes[i] = MakePlane(front[i], front[(i + 1) % 4], back[i], inside);
+
+        // Points of equal depth lie on parallel planes, so the depth range of the tile is a slab between two of them.
+        // The slab test is symmetric, which is why the orientation of the normal doesn't matter.
+        const float3 depthPlaneNormal = normalize(cross(front[1] - front[0], front[3] - front[0]));
+        const float nearDistance = dot(depthPlaneNormal, ClipToWorld(corners[0], asfloat(s_MinDepth)));
+        const float farDistance = dot(depthPlaneNormal, ClipToWorld(corners[0], asfloat(s_MaxDepth)));
+        s_DepthPlaneNormal = depthPlaneNormal;
+        s_SlabMin = min(nearDistance, farDistance);
+        s_SlabMax = max(nearDistance, farDistance);
+    }
+
+    GroupMemoryBarrierWithGroupSync();
+
+    for (uint lightIndex = threadIndex; lightIndex < g_Culling.numLights; lightIndex += LIGHT_CULLING_TILE_SIZE * LIGHT_CULLING_TILE_SIZE)
+    {
+        const float4 bounds = t_LightBounds[lightIndex];
+
+        bool visible = true;
+        [unroll]
+        for (uint i = 0; i < 4; i++)
+            visible = visible && (dot(s_TilePlanes[i].xyz, bounds.xyz) - s_TilePlanes[i].w >= -bounds.w);
+
+        const float centerDistance = dot(s_DepthPlaneNormal, bounds.xyz);
+        visible = visible && (centerDistance + bounds.w >= s_SlabMin) && (centerDistance - bounds.w <= s_SlabMax);
+
+        if (visible)
+        {
+            uint slot;
+            InterlockedAdd(s_NumLights, 1, slot);
+            if (slot < LIGHT_CULLING_MAX_LIGHTS_PER_TILE)
+                u_TileLights[listStart + slot] = lightIndex;
+        }
+    }
+
+    GroupMemoryBarrierWithGroupSync();
+
+    if (threadIndex == 0)
+    {
+        // A full list has no end marker. The lights that didn't fit are dropped, report them to the application.
+        if (s_NumLights < LIGHT_CULLING_MAX_LIGHTS_PER_TILE)
+        {
+            u_TileLights[listStart + s_NumLights] = LIGHT_CULLING_END_OF_LIST;
+        }
+        else if (s_NumLights > LIGHT_CULLING_MAX_LIGHTS_PER_TILE)
+        {
+            InterlockedAdd(u_Stats[LIGHT_CULLING_STAT_OVERFLOW_TILES], 1);
+        }
+
+        InterlockedMax(u_Stats[LIGHT_CULLING_STAT_MAX_TILE_LIGHTS], s_NumLights);
+    }
+}
@@ -0,0 +1,52 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef LIGHT_CULLING_CB_H
+#define LIGHT_CULLING_CB_H
+
+#include <donut/shaders/view_cb.h>
+
+// Each tile is culled by one thread group, one thread per pixel
+#define LIGHT_CULLING_TILE_SIZE             16
+
+// Size of the light list of every tile. The lights of a tile beyond this limit are not shaded, in no particular order;
+// such tiles are counted in the statistics buffer, see LIGHT_CULLING_STAT_*.
+#define LIGHT_CULLING_MAX_LIGHTS_PER_TILE   64
+
+// Marks the end of a tile's light list when it has fewer than LIGHT_CULLING_MAX_LIGHTS_PER_TILE lights
+#define LIGHT_CULLING_END_OF_LIST           0xffffffff
+
+// Indices into the statistics buffer, which is cleared before every culling pass
+#define LIGHT_CULLING_STAT_OVERFLOW_TILES   0   // Tiles with more lights than LIGHT_CULLING_MAX_LIGHTS_PER_TILE
+#define LIGHT_CULLING_STAT_MAX_TILE_LIGHTS  1   // Largest number of lights that intersect one tile, including the dropped ones
+#define LIGHT_CULLING_STAT_COUNT            2
+
+struct LightCullingConstants
+{
+    PlanarViewConstants view;
+
+    uint2 tileCount;
+    uint numLights;
+    uint reverseDepth;
+};
+
+#endif // LIGHT_CULLING_CB_H
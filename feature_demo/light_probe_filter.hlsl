@@ -0,0 +1,167 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+#include "light_probe_filter_cb.h"
+
+// Prefiltering of captured light probe cubemaps into the diffuse and specular maps that the lighting passes use.
+// These passes only use compute shaders so that they can run on the async compute queue.
+// Every cubemap is accessed as a 6-slice texture array when writing, and the dispatch Z coordinate is the face index.
+
+ConstantBuffer<LightProbeFilterConstants> g_Filter : register(b0);
+
+Texture2DArray<float4> t_SourceMip : register(t0);
+TextureCube<float4> t_Source : register(t1);
+SamplerState s_LinearSampler : register(s0);
+RWTexture2DArray<float4> u_Output : register(u0);
+
+static const float c_Pi = 3.14159265;
+
+// Direction through the center of a cubemap texel, using the D3D face orientation convention
+float3 GetCubemapDirection(uint2 pixel, uint face, uint size)
+{
+    const float2 uv = (float2(pixel) + 0.5) / float(size) * 2.0 - 1.0;
+
+    float3 direction;
+    switch (face)
+    {
+    case 0: direction = float3(1.0, -uv.y, -uv.x); break;
+    case 1: direction = float3(-1.0, -uv.y, uv.x); break;
+    case 2: direction = float3(uv.x, 1.0, uv.y); break;
+    case 3: direction = float3(uv.x, -1.0, -uv.y); break;
+    case 4: direction = float3(uv.x, -uv.y, 1.0); break;
+    default: direction = float3(-uv.x, -uv.y, -1.0); break;
+    }
+    return normalize(direction);
+}
+
+float2 Hammersley(uint index, uint count)
+{
+    return float2((float(index) + 0.5) / float(count), reversebits(index) * 2.3283064365386963e-10);
+}
+
+void GetTangentBasis(float3 normal, out float3 tangent, out float3 bitangent)
+{
+    const float3 up = abs(normal.y) < 0.999 ? float3(0.0, 1.0, 0.0) : float3(1.0, 0.0, 0.0);
+    tangent = normalize(cross(up, normal));
+    bitangent = cross(normal, tangent);
+}
+
+// Filtered importance sampling: the source mip is chosen so that one texel covers the solid angle of one sample,
+// which removes most of the noise without having to take many samples
+float GetSampleMipLevel(float pdf)
+{
+    const float sampleSolidAngle = 1.0 / (float(g_Filter.sampleCount) * max(pdf, 1e-6));
+    const float mipLevel = 0.5 * log2(sampleSolidAngle / g_Filter.sourceTexelSolidAngle) + 1.0;
+    return clamp(mipLevel, 0.0, g_Filter.sourceMipLevels - 1.0);
+}
+
+// Box filter from the mip level bound to t0 into the next one
+[numthreads(LIGHT_PROBE_FILTER_GROUP_SIZE, LIGHT_PROBE_FILTER_GROUP_SIZE, 1)]
+void downsample_cs(uint3 globalIdx : SV_DispatchThreadID)
+{
+    if (any(globalIdx.xy >= g_Filter.outputSize))
+        return;
+
+    const uint3 source = uint3(globalIdx.xy * 2, globalIdx.z);
+    const float4 sum = t_SourceMip[source]
+        + t_SourceMip[source + uint3(1, 0, 0)]
+        + t_SourceMip[source + uint3(0, 1, 0)]
+        + t_SourceMip[source + uint3(1, 1, 0)];
+
+    u_Output[globalIdx] = sum * 0.25;
+}
+
+// Cosine-weighted convolution over the hemisphere
+[numthreads(LIGHT_PROBE_FILTER_GROUP_SIZE, LIGHT_PROBE_FILTER_GROUP_SIZE, 1)]
+void diffuse_cs(uint3 globalIdx : SV_DispatchThreadID)
+{
+    if (any(globalIdx.xy >= g_Filter.outputSize))
+        return;
+
+    const float3 normal = GetCubemapDirection(globalIdx.xy, globalIdx.z, g_Filter.outputSize);
+    float3 tangent, bitangent;
+    GetTangentBasis(normal, tangent, bitangent);
+
+    float3 sum = 0;
+    for (uint sampleIndex = 0; sampleIndex < g_Filter.sampleCount; sampleIndex++)
+    {
+        const float2 xi = Hammersley(sampleIndex, g_Filter.sampleCount);
+        const float phi = 2.0 * c_Pi * xi.y;
+        const float cosTheta = sqrt(1.0 - xi.x);
+        const float sinTheta = sqrt(xi.x);
+
+        const float3 direction = tangent * (cos(phi) * sinTheta) + bitangent * (sin(phi) * sinTheta) + normal * cosTheta;
+        const float pdf = cosTheta / c_Pi;
+
+        sum += t_Source.SampleLevel(s_LinearSampler, direction, GetSampleMipLevel(pdf)).rgb;
+    }
+
+    u_Output[globalIdx] = float4(sum / float(g_Filter.sampleCount), 1.0);
+}
+
+// GGX prefiltering with the N = V = R assumption
+[numthreads(LIGHT_PROBE_FILTER_GROUP_SIZE, LIGHT_PROBE_FILTER_GROUP_SIZE, 1)]
+void specular_cs(uint3 globalIdx : SV_DispatchThreadID)
+{
+    if (any(globalIdx.xy >= g_Filter.outputSize))
+        return;
+
+    const float3 normal = GetCubemapDirection(globalIdx.xy, globalIdx.z, g_Filter.outputSize);
+
+    if (g_Filter.roughness <= 0.0)
+    {
+        u_Output[globalIdx] = float4(t_Source.SampleLevel(s_LinearSampler, normal, 0).rgb, 1.0);
+        return;
+    }
+
+    float3 tangent, bitangent;
+    GetTangentBasis(normal, tangent, bitangent);
+
+    const float alpha = g_Filter.roughness * g_Filter.roughness;
+    const float alpha2 = alpha * alpha;
+
+    float3 sum = 0;
+    float weight = 0;
+    for (uint sampleIndex = 0; sampleIndex < g_Filter.sampleCount; sampleIndex++)
+    {
+        const float2 xi = Hammersley(sampleIndex, g_Filter.sampleCount);
+        const float phi = 2.0 * c_Pi * xi.y;
+        const float cosTheta = sqrt((1.0 - xi.x) / (1.0 + (alpha2 - 1.0) * xi.x));
+        const float sinTheta = sqrt(1.0 - cosTheta * cosTheta);
+
+        const float3 halfVector = tangent * (cos(phi) * sinTheta) + bitangent * (sin(phi) * sinTheta) + normal * cosTheta;
+        const float3 direction = reflect(-normal, halfVector);
+        const float NdotL = dot(normal, direction);
+        if (NdotL <= 0.0)
+            continue;
+
+        // With N = V, the pdf of the reflected direction is D(h) / 4
+        const float d = (cosTheta * cosTheta) * (alpha2 - 1.0) + 1.0;
+        const float ggx = alpha2 / (c_Pi * d * d);
+        const float pdf = ggx * 0.25;
+
+        sum += t_Source.SampleLevel(s_LinearSampler, direction, GetSampleMipLevel(pdf)).rgb * NdotL;
+        weight += NdotL;
+    }
+
+    u_Output[globalIdx] = float4(sum / max(weight, 1e-6), 1.0);
+}
@@ -0,0 +1,41 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef LIGHT_PROBE_FILTER_CB_H
+#define LIGHT_PROBE_FILTER_CB_H
+
+#define LIGHT_PROBE_FILTER_GROUP_SIZE 8
+
+struct LightProbeFilterConstants
+{
+    uint outputSize;        // Width and height of the output mip level
+    uint sampleCount;
+    float roughness;        // Specular filter only
+    float sourceMipLevels;  // Diffuse and specular filters only
+
+    float sourceTexelSolidAngle;    // Solid angle of a texel in mip 0 of the source cubemap
+    float padding0;
+    float padding1;
+    float padding2;
+};
+
+#endif // LIGHT_PROBE_FILTER_CB_H
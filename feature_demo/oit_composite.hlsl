@@ -0,0 +1,67 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+// Blends the average color of the order-independent transparent layers over the opaque image:
+// result = average * (1 - revealage) + background * revealage, with the blend state of OitCompositePass.
+
+#ifndef OIT_MSAA
+#define OIT_MSAA 0
+#endif
+
+#if OIT_MSAA
+Texture2DMS<float4> t_Accumulation : register(t0);
+Texture2DMS<float> t_Revealage : register(t1);
+#else
+Texture2D<float4> t_Accumulation : register(t0);
+Texture2D<float> t_Revealage : register(t1);
+#endif
+
+void main_vs(uint vertexID : SV_VertexID, out float4 o_position : SV_Position)
+{
+    const float2 uv = float2((vertexID << 1) & 2, vertexID & 2);
+    o_position = float4(uv * float2(2.0, -2.0) + float2(-1.0, 1.0), 0.0, 1.0);
+}
+
+float4 main_ps(
+    float4 i_position : SV_Position
+#if OIT_MSAA
+    , uint i_sampleIndex : SV_SampleIndex
+#endif
+) : SV_Target0
+{
+    const int2 pixel = int2(i_position.xy);
+
+#if OIT_MSAA
+    const float4 accumulation = t_Accumulation.Load(pixel, i_sampleIndex);
+    const float revealage = t_Revealage.Load(pixel, i_sampleIndex);
+#else
+    const float4 accumulation = t_Accumulation[pixel];
+    const float revealage = t_Revealage[pixel];
+#endif
+
+    // No transparent surface covers this sample
+    if (revealage >= 1.0)
+        discard;
+
+    const float3 averageColor = accumulation.rgb / max(accumulation.a, 1e-5);
+    return float4(averageColor, 1.0 - revealage);
+}
@@ -0,0 +1,55 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+// Forward shading for weighted blended order-independent transparency (McGuire and Bavoil, JCGT 2013).
+// Wraps the regular forward pixel shader and writes both OIT targets in one pass:
+// the accumulation target sums (color * alpha, alpha) * weight, and the revealage target multiplies (1 - alpha).
+// The weight is equation 9 of the paper, which favors the surfaces close to the camera.
+
+#define TRANSMISSIVE_MATERIAL 0
+#define main ForwardShadingMain
+#include "../donut/shaders/passes/forward_ps.hlsl"
+#undef main
+
+float GetOitWeight(float viewDepth, float alpha)
+{
+    const float scaledDepth = viewDepth / 200.0;
+    return alpha * clamp(0.03 / (1e-5 + pow(scaledDepth, 4.0)), 1e-2, 3e3);
+}
+
+void main_ps(
+    in float4 i_position : SV_Position,
+    in SceneVertex i_vtx,
+    in bool i_isFrontFace : SV_IsFrontFace,
+    out float4 o_accumulation : SV_Target0,
+    out float o_revealage : SV_Target1
+)
+{
+    float4 color;
+    ForwardShadingMain(i_position, i_vtx, i_isFrontFace, color);
+
+    // SV_Position.w is the view depth for perspective projections
+    const float weight = GetOitWeight(i_position.w, color.a);
+
+    o_accumulation = float4(color.rgb * color.a, color.a) * weight;
+    o_revealage = color.a;
+}
@@ -0,0 +1,63 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+// Moves the contents of a cached shadow cascade into a cascade with the same light orientation that has been shifted
+// by a whole number of texels. Every target pixel is reprojected into the cache, and the cached depth is transformed
+// into the target depth range. Pixels that the cache doesn't cover are left at the clear value of the target.
+
+#pragma pack_matrix(row_major)
+
+#include "shadow_cache_cb.h"
+
+ConstantBuffer<ShadowCacheConstants> g_ShadowCache : register(b0);
+
+Texture2DArray<float> t_Cache : register(t0);
+
+void main_vs(uint vertexID : SV_VertexID, out float4 o_position : SV_Position)
+{
+    const float2 uv = float2((vertexID << 1) & 2, vertexID & 2);
+    o_position = float4(uv * float2(2.0, -2.0) + float2(-1.0, 1.0), 0.0, 1.0);
+}
+
+float main_ps(float4 i_position : SV_Position) : SV_Depth
+{
+    const float2 targetClip = i_position.xy * g_ShadowCache.targetSizeInv * float2(2.0, -2.0) + float2(-1.0, 1.0);
+
+    // Both cascades are orthographic with the same orientation, so any point on the texel's ray maps to the same cache texel
+    const float4 worldPos = mul(float4(targetClip, 0.0, 1.0), g_ShadowCache.targetClipToWorld);
+    const float4 cacheClip = mul(worldPos, g_ShadowCache.cacheWorldToClip);
+    const float2 cacheUV = (cacheClip.xy / cacheClip.w) * float2(0.5, -0.5) + 0.5;
+
+    if (any(cacheUV < 0.0) || any(cacheUV >= 1.0))
+        discard;
+
+    const int2 cachePixel = int2(floor(cacheUV * g_ShadowCache.targetSize));
+    const float cacheDepth = t_Cache[int3(cachePixel, g_ShadowCache.arraySlice)];
+
+    if (cacheDepth == g_ShadowCache.clearDepth)
+        discard;
+
+    const float4 cachedWorldPos = mul(float4(cacheClip.xy / cacheClip.w, cacheDepth, 1.0), g_ShadowCache.cacheClipToWorld);
+    const float4 targetPos = mul(cachedWorldPos, g_ShadowCache.targetWorldToClip);
+
+    return saturate(targetPos.z / targetPos.w);
+}
@@ -0,0 +1,83 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+// Adds the direct lighting from the local lights binned by light_culling.hlsl to the output of the deferred lighting pass.
+// The local lights don't cast shadows, the shadowed and directional lights are handled by the regular deferred pass.
+
+#pragma pack_matrix(row_major)
+
+#include <donut/shaders/gbuffer.hlsli>
+#include <donut/shaders/lighting.hlsli>
+#include "light_culling_cb.h"
+
+ConstantBuffer<LightCullingConstants> g_Culling : register(b0);
+
+Texture2D t_GBufferDepth : register(t0);
+Texture2D t_GBuffer0 : register(t1);
+Texture2D t_GBuffer1 : register(t2);
+Texture2D t_GBuffer2 : register(t3);
+Texture2D t_GBuffer3 : register(t4);
+StructuredBuffer<LightConstants> t_Lights : register(t5);
+StructuredBuffer<uint> t_TileLights : register(t6);
+
+RWTexture2D<float4> u_Output : register(u0);
+
+[numthreads(LIGHT_CULLING_TILE_SIZE, LIGHT_CULLING_TILE_SIZE, 1)]
+void main(uint2 dispatchThreadId : SV_DispatchThreadID, uint2 tile : SV_GroupID)
+{
+    if (any(dispatchThreadId >= uint2(g_Culling.view.viewportSize)))
+        return;
+
+    const uint2 globalIdx = dispatchThreadId + uint2(g_Culling.view.viewportOrigin);
+    const float depth = t_GBufferDepth[globalIdx].x;
+
+    if (depth == (g_Culling.reverseDepth ? 0.0 : 1.0))
+        return;
+
+    MaterialSample surfaceMaterial = DecodeGBuffer(globalIdx, t_GBuffer0, t_GBuffer1, t_GBuffer2, t_GBuffer3);
+
+    float3 surfaceWorldPos = ReconstructWorldPosition(g_Culling.view, float2(globalIdx) + 0.5, depth);
+
+    float3 viewIncident = GetIncidentVector(g_Culling.view.cameraDirectionOrPosition, surfaceWorldPos);
+
+    float3 diffuseTerm = 0;
+    float3 specularTerm = 0;
+
+    const uint listStart = (tile.y * g_Culling.tileCount.x + tile.x) * LIGHT_CULLING_MAX_LIGHTS_PER_TILE;
+
+    for (uint i = 0; i < LIGHT_CULLING_MAX_LIGHTS_PER_TILE; i++)
+    {
+        const uint lightIndex = t_TileLights[listStart + i];
+        if (lightIndex == LIGHT_CULLING_END_OF_LIST)
+            break;
+
+        LightConstants light = t_Lights[lightIndex];
+
+        float3 diffuseRadiance, specularRadiance;
+        ShadeSurface(light, surfaceMaterial, surfaceWorldPos, viewIncident, diffuseRadiance, specularRadiance);
+
+        diffuseTerm += diffuseRadiance * light.color;
+        specularTerm += specularRadiance * light.color;
+    }
+
+    u_Output[globalIdx] += float4(diffuseTerm + specularTerm, 0);
+}
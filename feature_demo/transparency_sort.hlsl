@@ -0,0 +1,165 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+// Sorts the transparent (instance, geometry) records of a view back to front on the GPU.
+// keys_cs computes a 32-bit key per record from the view depth of its bounding box center. Culling is left to the CPU,
+// which tests the records against the current view when it draws them. The keys are sorted with a stable LSD radix
+// sort, one histogram_cs, scan_cs and scatter_cs dispatch per 8-bit digit, ping-ponging between two key/value buffers.
+
+#pragma pack_matrix(row_major)
+
+#include "gpu_culling_cb.h"
+#include "transparency_sort_cb.h"
+
+ConstantBuffer<TransparencySortConstants> g_Sort : register(b0);
+
+// ---[ Keys ]---
+
+StructuredBuffer<TransparencySortRecord> t_Records : register(t0);
+ByteAddressBuffer t_Instances : register(t1);
+
+RWBuffer<uint> u_InitialKeys : register(u0);
+RWBuffer<uint> u_InitialValues : register(u1);
+
+float3x4 LoadTransform(uint offset)
+{
+    return float3x4(
+        asfloat(t_Instances.Load4(offset)),
+        asfloat(t_Instances.Load4(offset + 16)),
+        asfloat(t_Instances.Load4(offset + 32)));
+}
+
+[numthreads(TRANSPARENCY_SORT_GROUP_SIZE, 1, 1)]
+void keys_cs(uint recordIndex : SV_DispatchThreadID)
+{
+    if (recordIndex >= g_Sort.numRecords)
+        return;
+
+    TransparencySortRecord record = t_Records[recordIndex];
+    float3x4 transform = LoadTransform(record.instanceIndex * g_Sort.instanceDataStride + INSTANCE_DATA_TRANSFORM_OFFSET);
+
+    // The bit patterns of non-negative floats sort like the values, so inverting them sorts far to near
+    float3 center = mul(transform, float4((record.boundsMin + record.boundsMax) * 0.5, 1.0));
+    float viewDepth = max(dot(center - g_Sort.viewOrigin, g_Sort.viewDirection), 0.0);
+
+    u_InitialKeys[recordIndex] = ~asuint(viewDepth);
+    u_InitialValues[recordIndex] = recordIndex;
+}
+
+// ---[ Radix Sort ]---
+
+Buffer<uint> t_Keys : register(t0);
+Buffer<uint> t_Values : register(t1);
+
+RWBuffer<uint> u_Keys : register(u0);
+RWBuffer<uint> u_Values : register(u1);
+RWBuffer<uint> u_Histograms : register(u2);     // Digit-major: one count or offset per (digit, group)
+
+groupshared uint s_Digits[TRANSPARENCY_SORT_GROUP_SIZE];
+
+uint LoadDigit(uint keyIndex)
+{
+    // Threads past the end get a digit that matches no key
+    if (keyIndex >= g_Sort.numRecords)
+        return TRANSPARENCY_SORT_RADIX;
+
+    return (t_Keys[keyIndex] >> g_Sort.digitShift) & (TRANSPARENCY_SORT_RADIX - 1);
+}
+
+// Counts the digits of every group's keys
+[numthreads(TRANSPARENCY_SORT_GROUP_SIZE, 1, 1)]
+void histogram_cs(uint threadIndex : SV_GroupThreadID, uint groupIndex : SV_GroupID)
+{
+    s_Digits[threadIndex] = 0;
+    GroupMemoryBarrierWithGroupSync();
+
+    uint digit = LoadDigit(groupIndex * TRANSPARENCY_SORT_GROUP_SIZE + threadIndex);
+    if (digit < TRANSPARENCY_SORT_RADIX)
+        InterlockedAdd(s_Digits[digit], 1);
+
+    GroupMemoryBarrierWithGroupSync();
+
+    u_Histograms[threadIndex * g_Sort.numGroups + groupIndex] = s_Digits[threadIndex];
+}
+
+// Turns the histograms into the output offset of every (digit, group), with a single group.
+// Each thread scans the groups of one digit, and the digit totals are then scanned across threads.
+[numthreads(TRANSPARENCY_SORT_RADIX, 1, 1)]
+void scan_cs(uint digit : SV_GroupThreadID)
+{
+    uint digitTotal = 0;
+    for (uint group = 0; group < g_Sort.numGroups; group++)
+    {
+        const uint index = digit * g_Sort.numGroups + group;
+        const uint count = u_Histograms[index];
+        u_Histograms[index] = digitTotal;
+        digitTotal += count;
+    }
+
+    s_Digits[digit] = digitTotal;
+    GroupMemoryBarrierWithGroupSync();
+
+    if (digit == 0)
+    {
+        uint sum = 0;
+        for (uint d = 0; d < TRANSPARENCY_SORT_RADIX; d++)
+        {
+            const uint count = s_Digits[d];
+            s_Digits[d] = sum;
+            sum += count;
+        }
+    }
+
+    GroupMemoryBarrierWithGroupSync();
+
+    const uint digitBase = s_Digits[digit];
+    for (uint group = 0; group < g_Sort.numGroups; group++)
+    {
+        u_Histograms[digit * g_Sort.numGroups + group] += digitBase;
+    }
+}
+
+// Moves every key to its sorted position for the current digit. Keys with the same digit keep their order,
+// which is what makes the passes compose into a full sort.
+[numthreads(TRANSPARENCY_SORT_GROUP_SIZE, 1, 1)]
+void scatter_cs(uint threadIndex : SV_GroupThreadID, uint groupIndex : SV_GroupID)
+{
+    const uint keyIndex = groupIndex * TRANSPARENCY_SORT_GROUP_SIZE + threadIndex;
+    const uint digit = LoadDigit(keyIndex);
+
+    s_Digits[threadIndex] = digit;
+    GroupMemoryBarrierWithGroupSync();
+
+    if (digit >= TRANSPARENCY_SORT_RADIX)
+        return;
+
+    uint rank = 0;
+    for (uint other = 0; other < threadIndex; other++)
+    {
+        if (s_Digits[other] == digit)
+            rank++;
+    }
+
+    const uint destination = u_Histograms[digit * g_Sort.numGroups + groupIndex] + rank;
+    u_Keys[destination] = t_Keys[keyIndex];
+    u_Values[destination] = t_Values[keyIndex];
+}
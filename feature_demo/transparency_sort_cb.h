@@ -0,0 +1,55 @@
+/*
+* Copyright (c) 2014-2021, NVIDIA CORPORATION. All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef TRANSPARENCY_SORT_CB_H
+#define TRANSPARENCY_SORT_CB_H
+
+// The radix sort processes 8 bits of the 32-bit keys per pass, one digit per thread of a group
+#define TRANSPARENCY_SORT_GROUP_SIZE        256
+#define TRANSPARENCY_SORT_RADIX_BITS        8
+#define TRANSPARENCY_SORT_RADIX             (1 << TRANSPARENCY_SORT_RADIX_BITS)
+#define TRANSPARENCY_SORT_PASSES            (32 / TRANSPARENCY_SORT_RADIX_BITS)
+
+// One (mesh instance, transparent geometry) pair
+struct TransparencySortRecord
+{
+    float3 boundsMin;               // Object space bounds of the geometry
+    uint instanceIndex;             // Index into the scene instance buffer
+
+    float3 boundsMax;
+    uint padding;
+};
+
+struct TransparencySortConstants
+{
+    float3 viewOrigin;
+    uint numRecords;
+
+    float3 viewDirection;
+    uint numGroups;
+
+    uint instanceDataStride;
+    uint digitShift;                // First key bit sorted by the current radix pass
+    uint2 padding;
+};
+
+#endif // TRANSPARENCY_SORT_CB_H